@@ -4,7 +4,13 @@
 #define CHIAKI_CHIAKI_CLI_H
 
 #include <chiaki/common.h>
+#include <chiaki/controller.h>
 #include <chiaki/log.h>
+#include <chiaki/session.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -12,6 +18,54 @@ extern "C" {
 
 CHIAKI_EXPORT int chiaki_cli_cmd_discover(ChiakiLog *log, int argc, char *argv[]);
 CHIAKI_EXPORT int chiaki_cli_cmd_wakeup(ChiakiLog *log, int argc, char *argv[]);
+CHIAKI_EXPORT int chiaki_cli_cmd_stream(ChiakiLog *log, int argc, char *argv[]);
+
+typedef enum
+{
+	CHIAKI_CLI_VIDEO_SINK_NULL,
+	CHIAKI_CLI_VIDEO_SINK_FILE,
+	CHIAKI_CLI_VIDEO_SINK_DECODE
+} ChiakiCliVideoSink;
+
+typedef struct chiaki_cli_stream_options_t
+{
+	ChiakiConnectInfo connect_info;
+	ChiakiCliVideoSink video_sink;
+	const char *output;
+	const char *record;
+	const char *input;
+	bool input_loop;
+	uint64_t duration_ms; // 0 for until the console quits
+	uint64_t stats_interval_ms; // 0 for only at the end
+} ChiakiCliStreamOptions;
+
+/**
+ * Parse and validate the arguments of the stream command, errors are printed to stderr.
+ * The strings in stream_options point into argv.
+ */
+CHIAKI_EXPORT bool chiaki_cli_stream_parse_args(ChiakiCliStreamOptions *stream_options, int argc, char *argv[]);
+
+typedef struct chiaki_cli_input_step_t
+{
+	uint64_t duration_ms;
+	ChiakiControllerState state;
+} ChiakiCliInputStep;
+
+typedef struct chiaki_cli_input_script_t
+{
+	ChiakiCliInputStep *steps;
+	size_t steps_count;
+	size_t cur;
+	uint64_t next_ms;
+	bool loop;
+} ChiakiCliInputScript;
+
+/**
+ * Append the steps of an input script, see the stream command's help for the format.
+ * script must be zeroed or already hold steps, release it with chiaki_cli_input_script_fini() also on error.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_cli_input_script_read(ChiakiCliInputScript *script, ChiakiLog *log, FILE *f);
+CHIAKI_EXPORT void chiaki_cli_input_script_fini(ChiakiCliInputScript *script);
 
 #ifdef __cplusplus
 }
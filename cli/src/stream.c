@@ -0,0 +1,473 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki-cli.h>
+
+#include <chiaki/config.h>
+#include <chiaki/session.h>
+#include <chiaki/stoppipe.h>
+#include <chiaki/time.h>
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+#include <chiaki/ffmpegdecoder.h>
+#include <chiaki/recorder.h>
+#endif
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct stream_t
+{
+	ChiakiLog *log;
+	ChiakiSession session;
+	ChiakiStopPipe stop_pipe;
+	ChiakiCliVideoSink video_sink;
+	FILE *video_file;
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+	ChiakiFfmpegDecoder decoder;
+	bool recording;
+	ChiakiRecorder recorder;
+#endif
+
+	/**
+	 * protects everything below, written from the session's threads
+	 */
+	ChiakiMutex mutex;
+	bool connected;
+	uint64_t connected_ms;
+	bool quit;
+	ChiakiQuitReason quit_reason;
+
+	uint64_t video_samples;
+	uint64_t video_bytes;
+	uint64_t video_frames_lost;
+	uint64_t video_frames_recovered;
+	uint64_t video_fec_failures;
+	uint64_t video_sink_errors;
+	ChiakiVideoReceiverRecoveryStats video_recovery;
+
+	uint64_t decoded_frames;
+	uint64_t decode_us_total;
+	uint64_t decode_us_max; // since the last stats output
+
+	uint64_t audio_frames;
+	ChiakiAudioReceiverStats audio;
+
+	// state of the last stats output, only used on the main thread
+	uint64_t stats_last_ms;
+	uint64_t stats_last_video_bytes;
+	uint64_t stats_last_decoded_frames;
+	uint64_t stats_last_decode_us_total;
+} Stream;
+
+static volatile sig_atomic_t interrupt_requested;
+static ChiakiStopPipe *interrupt_stop_pipe;
+
+static void interrupt_handler(int signum)
+{
+	(void)signum;
+	interrupt_requested = 1;
+	if(interrupt_stop_pipe)
+		chiaki_stop_pipe_stop(interrupt_stop_pipe);
+}
+
+/**
+ * Apply all steps that are due.
+ * @return time of the next step or UINT64_MAX if the script is done
+ */
+static uint64_t input_script_run(ChiakiCliInputScript *script, ChiakiSession *session, uint64_t now_ms)
+{
+	while(script->cur < script->steps_count && now_ms >= script->next_ms)
+	{
+		ChiakiCliInputStep *step = &script->steps[script->cur];
+		chiaki_session_set_controller_state(session, &step->state);
+		script->next_ms += step->duration_ms;
+		script->cur++;
+		if(script->cur == script->steps_count && script->loop)
+		{
+			script->cur = 0;
+			// a script of only zero durations would spin here forever
+			if(script->next_ms <= now_ms)
+				script->next_ms = now_ms + 1;
+		}
+	}
+	if(script->cur == script->steps_count)
+		return UINT64_MAX;
+	return script->next_ms;
+}
+
+static void event_cb(ChiakiEvent *event, void *user)
+{
+	Stream *stream = user;
+	switch(event->type)
+	{
+		case CHIAKI_EVENT_CONNECTED:
+			CHIAKI_LOGI(stream->log, "Stream connected");
+			chiaki_mutex_lock(&stream->mutex);
+			stream->connected = true;
+			stream->connected_ms = chiaki_time_now_monotonic_ms();
+			chiaki_mutex_unlock(&stream->mutex);
+			chiaki_stop_pipe_stop(&stream->stop_pipe);
+			break;
+		case CHIAKI_EVENT_LOGIN_PIN_REQUEST:
+			CHIAKI_LOGE(stream->log, "Console requested a login PIN, which is not supported headless");
+			chiaki_session_stop(&stream->session);
+			break;
+		case CHIAKI_EVENT_VIDEO_FEC_FAILURE:
+			chiaki_mutex_lock(&stream->mutex);
+			stream->video_fec_failures++;
+			chiaki_mutex_unlock(&stream->mutex);
+			break;
+		case CHIAKI_EVENT_QUIT:
+			CHIAKI_LOGI(stream->log, "Session quit: %s%s%s", chiaki_quit_reason_string(event->quit.reason),
+					event->quit.reason_str ? ", " : "", event->quit.reason_str ? event->quit.reason_str : "");
+			chiaki_mutex_lock(&stream->mutex);
+			stream->quit = true;
+			stream->quit_reason = event->quit.reason;
+			chiaki_mutex_unlock(&stream->mutex);
+			chiaki_stop_pipe_stop(&stream->stop_pipe);
+			break;
+		default:
+			break;
+	}
+}
+
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+static void decoder_frame_available_cb(ChiakiFfmpegDecoder *decoder, void *user)
+{
+	(void)user;
+	int32_t frames_lost;
+	ChiakiFfmpegFrame frame = chiaki_ffmpeg_decoder_pull_frame(decoder, &frames_lost);
+	if(frame.frame)
+		av_frame_free(&frame.frame);
+}
+#endif
+
+static bool video_sample_cb(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered, void *user)
+{
+	Stream *stream = user;
+	bool ok = true;
+	uint64_t decode_us = 0;
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+	// only copies the sample
+	if(stream->recording)
+		chiaki_recorder_video_sample_cb(buf, buf_size, frames_lost, frame_recovered, &stream->recorder);
+#endif
+	switch(stream->video_sink)
+	{
+		case CHIAKI_CLI_VIDEO_SINK_NULL:
+			break;
+		case CHIAKI_CLI_VIDEO_SINK_FILE:
+			ok = fwrite(buf, 1, buf_size, stream->video_file) == buf_size;
+			break;
+		case CHIAKI_CLI_VIDEO_SINK_DECODE:
+		{
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+			uint64_t start_us = chiaki_time_now_monotonic_us();
+			ok = chiaki_ffmpeg_decoder_video_sample_cb(buf, buf_size, frames_lost, frame_recovered, &stream->decoder);
+			decode_us = chiaki_time_now_monotonic_us() - start_us;
+#endif
+			break;
+		}
+	}
+
+	// the receiver is alive while it calls us and its lock is not held here
+	ChiakiVideoReceiverRecoveryStats recovery;
+	chiaki_video_receiver_get_recovery_stats(stream->session.stream_connection.video_receiver, &recovery);
+
+	chiaki_mutex_lock(&stream->mutex);
+	stream->video_samples++;
+	stream->video_bytes += buf_size;
+	stream->video_frames_lost += frames_lost > 0 ? (uint64_t)frames_lost : 0;
+	if(frame_recovered)
+		stream->video_frames_recovered++;
+	if(!ok)
+		stream->video_sink_errors++;
+	stream->video_recovery = recovery;
+	if(stream->video_sink == CHIAKI_CLI_VIDEO_SINK_DECODE && ok)
+	{
+		stream->decoded_frames++;
+		stream->decode_us_total += decode_us;
+		if(decode_us > stream->decode_us_max)
+			stream->decode_us_max = decode_us;
+	}
+	chiaki_mutex_unlock(&stream->mutex);
+	return ok;
+}
+
+static void audio_header_cb(ChiakiAudioHeader *header, void *user)
+{
+	Stream *stream = user;
+	CHIAKI_LOGI(stream->log, "Audio: %u channels, %u Hz", (unsigned int)header->channels, (unsigned int)header->rate);
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+	if(stream->recording)
+		chiaki_recorder_audio_header_cb(header, &stream->recorder);
+#endif
+}
+
+static void audio_frame_cb(uint8_t *buf, size_t buf_size, void *user)
+{
+	Stream *stream = user;
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+	if(stream->recording)
+		chiaki_recorder_audio_frame_cb(buf, buf_size, &stream->recorder);
+#endif
+	// frame_cb is called with the receiver unlocked, see chiaki_audio_receiver_av_packet()
+	ChiakiAudioReceiverStats audio;
+	chiaki_audio_receiver_get_stats(stream->session.stream_connection.audio_receiver, &audio);
+	chiaki_mutex_lock(&stream->mutex);
+	stream->audio_frames++;
+	stream->audio = audio;
+	chiaki_mutex_unlock(&stream->mutex);
+}
+
+static void stream_print_stats(Stream *stream, uint64_t now_ms, bool final)
+{
+	chiaki_mutex_lock(&stream->mutex);
+	uint64_t interval_ms = now_ms - stream->stats_last_ms;
+	uint64_t interval_bytes = stream->video_bytes - stream->stats_last_video_bytes;
+	uint64_t interval_decoded = stream->decoded_frames - stream->stats_last_decoded_frames;
+	uint64_t interval_decode_us = stream->decode_us_total - stream->stats_last_decode_us_total;
+
+	// written periodically by the session's own threads, same as the GUI reads them
+	double measured_bitrate = stream->session.stream_connection.measured_bitrate;
+	double packet_loss = stream->session.stream_connection.congestion_control.packet_loss;
+
+	printf("{\"time_ms\":%llu,\"final\":%s,\"connected\":%s,"
+			"\"bitrate_kbps\":%.1f,\"measured_bitrate_mbps\":%.3f,\"packet_loss\":%.4f,"
+			"\"video\":{\"samples\":%llu,\"bytes\":%llu,\"frames_lost\":%llu,\"frames_recovered\":%llu,"
+			"\"fec_failures\":%llu,\"fec_recovered\":%d,\"idr_requests\":%d,\"idr_requests_avoided\":%d,\"sink_errors\":%llu},"
+			"\"decode\":{\"frames\":%llu,\"avg_us\":%.1f,\"max_us\":%llu},"
+			"\"audio\":{\"frames\":%llu,\"jitter_ms\":%.2f,\"target_frames\":%u,\"buffered_frames\":%zu,"
+			"\"frames_concealed\":%llu,\"frames_fec_recovered\":%llu}}\n",
+			(unsigned long long)(stream->connected ? now_ms - stream->connected_ms : 0),
+			final ? "true" : "false",
+			stream->connected ? "true" : "false",
+			interval_ms ? (double)interval_bytes * 8.0 / (double)interval_ms : 0.0,
+			measured_bitrate,
+			packet_loss,
+			(unsigned long long)stream->video_samples,
+			(unsigned long long)stream->video_bytes,
+			(unsigned long long)stream->video_frames_lost,
+			(unsigned long long)stream->video_frames_recovered,
+			(unsigned long long)stream->video_fec_failures,
+			(int)stream->video_recovery.frames_recovered_total,
+			(int)stream->video_recovery.idr_requests_total,
+			(int)stream->video_recovery.idr_requests_avoided_total,
+			(unsigned long long)stream->video_sink_errors,
+			(unsigned long long)stream->decoded_frames,
+			interval_decoded ? (double)interval_decode_us / (double)interval_decoded : 0.0,
+			(unsigned long long)stream->decode_us_max,
+			(unsigned long long)stream->audio_frames,
+			stream->audio.jitter_ms,
+			stream->audio.target_frames,
+			stream->audio.buffered_frames,
+			(unsigned long long)stream->audio.frames_concealed,
+			(unsigned long long)stream->audio.frames_fec_recovered);
+	fflush(stdout);
+
+	stream->stats_last_ms = now_ms;
+	stream->stats_last_video_bytes = stream->video_bytes;
+	stream->stats_last_decoded_frames = stream->decoded_frames;
+	stream->stats_last_decode_us_total = stream->decode_us_total;
+	stream->decode_us_max = 0;
+	chiaki_mutex_unlock(&stream->mutex);
+}
+
+CHIAKI_EXPORT int chiaki_cli_cmd_stream(ChiakiLog *log, int argc, char *argv[])
+{
+	ChiakiCliStreamOptions options;
+	if(!chiaki_cli_stream_parse_args(&options, argc, argv))
+		return 1;
+	ChiakiConnectInfo *connect_info = &options.connect_info;
+
+	static Stream stream;
+	memset(&stream, 0, sizeof(stream));
+	stream.log = log;
+	stream.video_sink = options.video_sink;
+
+	ChiakiCliInputScript script = { 0 };
+	script.loop = options.input_loop;
+	if(options.input)
+	{
+		FILE *f = fopen(options.input, "r");
+		if(!f)
+		{
+			CHIAKI_LOGE(log, "Failed to open input script %s", options.input);
+			return 1;
+		}
+		ChiakiErrorCode err = chiaki_cli_input_script_read(&script, log, f);
+		fclose(f);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			chiaki_cli_input_script_fini(&script);
+			return 1;
+		}
+	}
+
+	int ret = 1;
+	ChiakiErrorCode err = chiaki_mutex_init(&stream.mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_script;
+	err = chiaki_stop_pipe_init(&stream.stop_pipe);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+
+	if(stream.video_sink == CHIAKI_CLI_VIDEO_SINK_FILE)
+	{
+		stream.video_file = fopen(options.output, "wb");
+		if(!stream.video_file)
+		{
+			CHIAKI_LOGE(log, "Failed to open %s for writing", options.output);
+			goto error_stop_pipe;
+		}
+	}
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+	else if(stream.video_sink == CHIAKI_CLI_VIDEO_SINK_DECODE)
+	{
+		err = chiaki_ffmpeg_decoder_init(&stream.decoder, log, connect_info->video_profile.codec,
+				connect_info->video_profile.max_fps, NULL, NULL, decoder_frame_available_cb, &stream);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(log, "Failed to init decoder: %s", chiaki_error_string(err));
+			goto error_stop_pipe;
+		}
+	}
+	if(options.record)
+	{
+		ChiakiRecorderSettings recorder_settings = { 0 };
+		recorder_settings.path = options.record;
+		recorder_settings.codec = connect_info->video_profile.codec;
+		// may still be downgraded, the recorder prefers the size from the stream's parameter sets
+		recorder_settings.width = connect_info->video_profile.width;
+		recorder_settings.height = connect_info->video_profile.height;
+		recorder_settings.max_fps = connect_info->video_profile.max_fps;
+		err = chiaki_recorder_init(&stream.recorder, log, &recorder_settings);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(log, "Failed to init recorder: %s", chiaki_error_string(err));
+			goto error_sink;
+		}
+		stream.recording = true;
+	}
+#endif
+
+	err = chiaki_session_init(&stream.session, connect_info, log);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log, "Failed to init session: %s", chiaki_error_string(err));
+		goto error_sink;
+	}
+	chiaki_session_set_event_cb(&stream.session, event_cb, &stream);
+	chiaki_session_set_video_sample_cb(&stream.session, video_sample_cb, &stream);
+	ChiakiAudioSink audio_sink = { 0 };
+	audio_sink.user = &stream;
+	audio_sink.header_cb = audio_header_cb;
+	audio_sink.frame_cb = audio_frame_cb;
+	chiaki_session_set_audio_sink(&stream.session, &audio_sink);
+
+	err = chiaki_session_start(&stream.session);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log, "Failed to start session: %s", chiaki_error_string(err));
+		goto error_session;
+	}
+
+	interrupt_requested = 0;
+	interrupt_stop_pipe = &stream.stop_pipe;
+	signal(SIGINT, interrupt_handler);
+	signal(SIGTERM, interrupt_handler);
+
+	stream.stats_last_ms = chiaki_time_now_monotonic_ms();
+	uint64_t stats_next_ms = options.stats_interval_ms ? stream.stats_last_ms + options.stats_interval_ms : UINT64_MAX;
+	bool script_started = false;
+	while(true)
+	{
+		uint64_t now_ms = chiaki_time_now_monotonic_ms();
+		chiaki_mutex_lock(&stream.mutex);
+		bool connected = stream.connected;
+		uint64_t connected_ms = stream.connected_ms;
+		bool quit = stream.quit;
+		chiaki_mutex_unlock(&stream.mutex);
+		if(quit)
+			break;
+		if(interrupt_requested)
+		{
+			CHIAKI_LOGI(log, "Interrupted, stopping session");
+			break;
+		}
+		if(connected && options.duration_ms && now_ms - connected_ms >= options.duration_ms)
+		{
+			CHIAKI_LOGI(log, "Duration reached, stopping session");
+			break;
+		}
+
+		if(now_ms >= stats_next_ms)
+		{
+			stream_print_stats(&stream, now_ms, false);
+			stats_next_ms = now_ms + options.stats_interval_ms;
+		}
+
+		uint64_t next_ms = stats_next_ms;
+		if(connected)
+		{
+			if(options.duration_ms && connected_ms + options.duration_ms < next_ms)
+				next_ms = connected_ms + options.duration_ms;
+			if(script.steps_count)
+			{
+				if(!script_started)
+				{
+					script.next_ms = connected_ms;
+					script_started = true;
+				}
+				uint64_t script_next_ms = input_script_run(&script, &stream.session, now_ms);
+				if(script_next_ms < next_ms)
+					next_ms = script_next_ms;
+			}
+		}
+
+		// woken up early by session events and the interrupt handler
+		uint64_t timeout_ms = next_ms == UINT64_MAX ? UINT64_MAX : next_ms > now_ms ? next_ms - now_ms : 0;
+		err = chiaki_stop_pipe_sleep(&stream.stop_pipe, timeout_ms);
+		if(err == CHIAKI_ERR_CANCELED)
+			chiaki_stop_pipe_reset(&stream.stop_pipe);
+	}
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	interrupt_stop_pipe = NULL;
+
+	chiaki_session_stop(&stream.session);
+	chiaki_session_join(&stream.session);
+	stream_print_stats(&stream, chiaki_time_now_monotonic_ms(), true);
+	// joining the session guarantees the quit event
+	ret = chiaki_quit_reason_is_error(stream.quit_reason) ? 1 : 0;
+
+error_session:
+	chiaki_session_fini(&stream.session);
+error_sink:
+	if(stream.video_file)
+		fclose(stream.video_file);
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+	if(stream.recording)
+	{
+		chiaki_recorder_fini(&stream.recorder);
+		ChiakiRecorderStats recorder_stats = stream.recorder.stats;
+		CHIAKI_LOGI(log, "Recorded %llu video and %llu audio packets into %llu files, %llu dropped, %llu errors",
+				(unsigned long long)recorder_stats.video_packets, (unsigned long long)recorder_stats.audio_packets,
+				(unsigned long long)recorder_stats.files_written, (unsigned long long)recorder_stats.packets_dropped,
+				(unsigned long long)recorder_stats.errors);
+		if(recorder_stats.errors)
+			ret = 1;
+	}
+	if(stream.video_sink == CHIAKI_CLI_VIDEO_SINK_DECODE)
+		chiaki_ffmpeg_decoder_fini(&stream.decoder);
+#endif
+error_stop_pipe:
+	chiaki_stop_pipe_fini(&stream.stop_pipe);
+error_mutex:
+	chiaki_mutex_fini(&stream.mutex);
+error_script:
+	chiaki_cli_input_script_fini(&script);
+	return ret;
+}
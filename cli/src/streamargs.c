@@ -0,0 +1,412 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki-cli.h>
+
+#include <chiaki/config.h>
+
+#include <argp.h>
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char doc[] =
+	"Run a PS4 or PS5 streaming session without any GUI, for load and regression testing."
+	"\v"
+	"Video goes to one of the sinks:\n"
+	"  null      Only count the samples (default).\n"
+	"  file      Append the samples to --output as a raw H264/H265 elementary stream.\n"
+	"  decode    Decode the samples with FFMPEG and drop the frames.\n"
+	"\n"
+	"With --record, the video and audio are additionally muxed into a Matroska or MP4 file,\n"
+	"the container is chosen by the file extension.\n"
+	"\n"
+	"Stats are printed as one JSON object per line on stdout.\n"
+	"\n"
+	"An input script contains one controller state per line, held for the given time:\n"
+	"  <ms> <buttons|none> [<l2> <r2> <left_x> <left_y> <right_x> <right_y>]\n"
+	"where buttons are joined with '+', e.g. \"500 cross+dpad_up\". Lines starting with # are ignored.";
+
+#define ARG_KEY_HOST 'h'
+#define ARG_KEY_REGISTKEY 'r'
+#define ARG_KEY_MORNING 'm'
+#define ARG_KEY_PS4 '4'
+#define ARG_KEY_PS5 '5'
+#define ARG_KEY_RESOLUTION 'R'
+#define ARG_KEY_FPS 'f'
+#define ARG_KEY_BITRATE 'b'
+#define ARG_KEY_CODEC 'c'
+#define ARG_KEY_VIDEO 'V'
+#define ARG_KEY_OUTPUT 'o'
+#define ARG_KEY_NO_AUDIO 'A'
+#define ARG_KEY_INPUT 'i'
+#define ARG_KEY_INPUT_LOOP 'l'
+#define ARG_KEY_DURATION 'd'
+#define ARG_KEY_STATS_INTERVAL 's'
+#define ARG_KEY_RECORD 'w'
+
+static struct argp_option options[] = {
+	{ "host", ARG_KEY_HOST, "Host", 0, "Host to connect to", 0 },
+	{ "registkey", ARG_KEY_REGISTKEY, "RegistKey", 0, "Remote Play registration key (plaintext)", 0 },
+	{ "morning", ARG_KEY_MORNING, "Morning", 0, "Remote Play key from registration (hex)", 0 },
+	{ "ps4", ARG_KEY_PS4, NULL, 0, "PlayStation 4", 0 },
+	{ "ps5", ARG_KEY_PS5, NULL, 0, "PlayStation 5 (default)", 0 },
+	{ "resolution", ARG_KEY_RESOLUTION, "Lines", 0, "360, 540, 720 (default) or 1080", 0 },
+	{ "fps", ARG_KEY_FPS, "FPS", 0, "30 or 60 (default)", 0 },
+	{ "bitrate", ARG_KEY_BITRATE, "kbps", 0, "Video bitrate (default from resolution)", 0 },
+	{ "codec", ARG_KEY_CODEC, "Codec", 0, "h264 (default), h265 or h265_hdr", 0 },
+	{ "video", ARG_KEY_VIDEO, "Sink", 0, "Video sink: null (default), file or decode", 0 },
+	{ "output", ARG_KEY_OUTPUT, "File", 0, "Output file for the file sink", 0 },
+	{ "record", ARG_KEY_RECORD, "File", 0, "Record the stream to a Matroska/MP4 file without re-encoding", 0 },
+	{ "no-audio", ARG_KEY_NO_AUDIO, NULL, 0, "Do not request audio from the console", 0 },
+	{ "input", ARG_KEY_INPUT, "File", 0, "Controller input script", 0 },
+	{ "input-loop", ARG_KEY_INPUT_LOOP, NULL, 0, "Restart the input script when it ends", 0 },
+	{ "duration", ARG_KEY_DURATION, "Seconds", 0, "Stop after streaming this long (default: until the console quits)", 0 },
+	{ "stats-interval", ARG_KEY_STATS_INTERVAL, "ms", 0, "Interval of the stats output (default=1000, 0 for only at the end)", 0 },
+	{ 0 }
+};
+
+typedef struct arguments
+{
+	const char *host;
+	const char *registkey;
+	const char *morning;
+	bool ps5;
+	const char *resolution;
+	const char *fps;
+	const char *bitrate;
+	const char *codec;
+	const char *video;
+	const char *output;
+	const char *record;
+	bool no_audio;
+	const char *input;
+	bool input_loop;
+	const char *duration;
+	const char *stats_interval;
+} Arguments;
+
+static int parse_opt(int key, char *arg, struct argp_state *state)
+{
+	Arguments *arguments = state->input;
+
+	switch(key)
+	{
+		case ARG_KEY_HOST:
+			arguments->host = arg;
+			break;
+		case ARG_KEY_REGISTKEY:
+			arguments->registkey = arg;
+			break;
+		case ARG_KEY_MORNING:
+			arguments->morning = arg;
+			break;
+		case ARG_KEY_PS4:
+			arguments->ps5 = false;
+			break;
+		case ARG_KEY_PS5:
+			arguments->ps5 = true;
+			break;
+		case ARG_KEY_RESOLUTION:
+			arguments->resolution = arg;
+			break;
+		case ARG_KEY_FPS:
+			arguments->fps = arg;
+			break;
+		case ARG_KEY_BITRATE:
+			arguments->bitrate = arg;
+			break;
+		case ARG_KEY_CODEC:
+			arguments->codec = arg;
+			break;
+		case ARG_KEY_VIDEO:
+			arguments->video = arg;
+			break;
+		case ARG_KEY_OUTPUT:
+			arguments->output = arg;
+			break;
+		case ARG_KEY_RECORD:
+			arguments->record = arg;
+			break;
+		case ARG_KEY_NO_AUDIO:
+			arguments->no_audio = true;
+			break;
+		case ARG_KEY_INPUT:
+			arguments->input = arg;
+			break;
+		case ARG_KEY_INPUT_LOOP:
+			arguments->input_loop = true;
+			break;
+		case ARG_KEY_DURATION:
+			arguments->duration = arg;
+			break;
+		case ARG_KEY_STATS_INTERVAL:
+			arguments->stats_interval = arg;
+			break;
+		case ARGP_KEY_ARG:
+			argp_usage(state);
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+static struct argp argp = { options, parse_opt, 0, doc, 0, 0, 0 };
+
+static const struct
+{
+	const char *name;
+	uint32_t button;
+} input_button_names[] = {
+	{ "cross", CHIAKI_CONTROLLER_BUTTON_CROSS },
+	{ "moon", CHIAKI_CONTROLLER_BUTTON_MOON },
+	{ "circle", CHIAKI_CONTROLLER_BUTTON_MOON },
+	{ "box", CHIAKI_CONTROLLER_BUTTON_BOX },
+	{ "square", CHIAKI_CONTROLLER_BUTTON_BOX },
+	{ "pyramid", CHIAKI_CONTROLLER_BUTTON_PYRAMID },
+	{ "triangle", CHIAKI_CONTROLLER_BUTTON_PYRAMID },
+	{ "dpad_left", CHIAKI_CONTROLLER_BUTTON_DPAD_LEFT },
+	{ "dpad_right", CHIAKI_CONTROLLER_BUTTON_DPAD_RIGHT },
+	{ "dpad_up", CHIAKI_CONTROLLER_BUTTON_DPAD_UP },
+	{ "dpad_down", CHIAKI_CONTROLLER_BUTTON_DPAD_DOWN },
+	{ "l1", CHIAKI_CONTROLLER_BUTTON_L1 },
+	{ "r1", CHIAKI_CONTROLLER_BUTTON_R1 },
+	{ "l3", CHIAKI_CONTROLLER_BUTTON_L3 },
+	{ "r3", CHIAKI_CONTROLLER_BUTTON_R3 },
+	{ "options", CHIAKI_CONTROLLER_BUTTON_OPTIONS },
+	{ "share", CHIAKI_CONTROLLER_BUTTON_SHARE },
+	{ "touchpad", CHIAKI_CONTROLLER_BUTTON_TOUCHPAD },
+	{ "ps", CHIAKI_CONTROLLER_BUTTON_PS }
+};
+
+static bool input_parse_buttons(char *str, uint32_t *buttons)
+{
+	*buttons = 0;
+	if(strcmp(str, "none") == 0)
+		return true;
+	for(char *name = strtok(str, "+"); name; name = strtok(NULL, "+"))
+	{
+		size_t i;
+		for(i=0; i<sizeof(input_button_names) / sizeof(input_button_names[0]); i++)
+		{
+			if(strcmp(name, input_button_names[i].name) == 0)
+				break;
+		}
+		if(i == sizeof(input_button_names) / sizeof(input_button_names[0]))
+			return false;
+		*buttons |= input_button_names[i].button;
+	}
+	return true;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_cli_input_script_read(ChiakiCliInputScript *script, ChiakiLog *log, FILE *f)
+{
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	size_t steps_allocated = script->steps_count;
+	char line[256];
+	unsigned int line_num = 0;
+	while(fgets(line, sizeof(line), f))
+	{
+		line_num++;
+		char *s = line;
+		while(isspace((unsigned char)*s))
+			s++;
+		if(!*s || *s == '#')
+			continue;
+
+		unsigned long long duration_ms;
+		char buttons_str[128];
+		int l2 = 0, r2 = 0, left_x = 0, left_y = 0, right_x = 0, right_y = 0;
+		int fields = sscanf(s, "%llu %127s %d %d %d %d %d %d", &duration_ms, buttons_str,
+				&l2, &r2, &left_x, &left_y, &right_x, &right_y);
+		ChiakiCliInputStep step;
+		chiaki_controller_state_set_idle(&step.state);
+		if((fields != 2 && fields != 8) || !input_parse_buttons(buttons_str, &step.state.buttons))
+		{
+			CHIAKI_LOGE(log, "Invalid input script line %u", line_num);
+			err = CHIAKI_ERR_INVALID_DATA;
+			break;
+		}
+		step.duration_ms = duration_ms;
+		step.state.l2_state = (uint8_t)l2;
+		step.state.r2_state = (uint8_t)r2;
+		step.state.left_x = (int16_t)left_x;
+		step.state.left_y = (int16_t)left_y;
+		step.state.right_x = (int16_t)right_x;
+		step.state.right_y = (int16_t)right_y;
+
+		if(script->steps_count == steps_allocated)
+		{
+			steps_allocated = steps_allocated ? steps_allocated * 2 : 16;
+			ChiakiCliInputStep *steps = realloc(script->steps, steps_allocated * sizeof(ChiakiCliInputStep));
+			if(!steps)
+			{
+				err = CHIAKI_ERR_MEMORY;
+				break;
+			}
+			script->steps = steps;
+		}
+		script->steps[script->steps_count++] = step;
+	}
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_cli_input_script_fini(ChiakiCliInputScript *script)
+{
+	free(script->steps);
+	script->steps = NULL;
+	script->steps_count = 0;
+}
+
+
+static bool parse_hex(const char *str, uint8_t *buf, size_t size)
+{
+	if(strlen(str) != size * 2)
+		return false;
+	for(size_t i=0; i<size; i++)
+	{
+		unsigned int v;
+		if(!isxdigit((unsigned char)str[i*2]) || !isxdigit((unsigned char)str[i*2+1])
+				|| sscanf(str + i*2, "%2x", &v) != 1)
+			return false;
+		buf[i] = (uint8_t)v;
+	}
+	return true;
+}
+
+static bool parse_connect_info(ChiakiConnectInfo *connect_info, Arguments *arguments)
+{
+	connect_info->ps5 = arguments->ps5;
+	connect_info->host = arguments->host;
+
+	if(strlen(arguments->registkey) > sizeof(connect_info->regist_key))
+	{
+		fprintf(stderr, "Given registkey is too long.\n");
+		return false;
+	}
+	strncpy(connect_info->regist_key, arguments->registkey, sizeof(connect_info->regist_key));
+
+	if(!parse_hex(arguments->morning, connect_info->morning, sizeof(connect_info->morning)))
+	{
+		fprintf(stderr, "Given morning must be %zu hex digits.\n", sizeof(connect_info->morning) * 2);
+		return false;
+	}
+
+	ChiakiVideoResolutionPreset resolution = CHIAKI_VIDEO_RESOLUTION_PRESET_720p;
+	if(arguments->resolution)
+	{
+		int lines = atoi(arguments->resolution);
+		switch(lines)
+		{
+			case 360: resolution = CHIAKI_VIDEO_RESOLUTION_PRESET_360p; break;
+			case 540: resolution = CHIAKI_VIDEO_RESOLUTION_PRESET_540p; break;
+			case 720: resolution = CHIAKI_VIDEO_RESOLUTION_PRESET_720p; break;
+			case 1080: resolution = CHIAKI_VIDEO_RESOLUTION_PRESET_1080p; break;
+			default:
+				fprintf(stderr, "Invalid resolution %s.\n", arguments->resolution);
+				return false;
+		}
+	}
+	ChiakiVideoFPSPreset fps = CHIAKI_VIDEO_FPS_PRESET_60;
+	if(arguments->fps)
+	{
+		int v = atoi(arguments->fps);
+		if(v != 30 && v != 60)
+		{
+			fprintf(stderr, "Invalid fps %s.\n", arguments->fps);
+			return false;
+		}
+		fps = (ChiakiVideoFPSPreset)v;
+	}
+	chiaki_connect_video_profile_preset(&connect_info->video_profile, resolution, fps);
+	if(arguments->bitrate)
+		connect_info->video_profile.bitrate = (unsigned int)strtoul(arguments->bitrate, NULL, 10);
+	if(arguments->codec)
+	{
+		if(strcmp(arguments->codec, "h264") == 0)
+			connect_info->video_profile.codec = CHIAKI_CODEC_H264;
+		else if(strcmp(arguments->codec, "h265") == 0)
+			connect_info->video_profile.codec = CHIAKI_CODEC_H265;
+		else if(strcmp(arguments->codec, "h265_hdr") == 0)
+			connect_info->video_profile.codec = CHIAKI_CODEC_H265_HDR;
+		else
+		{
+			fprintf(stderr, "Invalid codec %s.\n", arguments->codec);
+			return false;
+		}
+	}
+
+	connect_info->video_profile_auto_downgrade = true;
+	connect_info->enable_idr_on_fec_failure = true;
+	connect_info->packet_loss_max = 0.05;
+	connect_info->audio_video_disabled = arguments->no_audio ? CHIAKI_AUDIO_DISABLED : CHIAKI_NONE_DISABLED;
+	return true;
+}
+
+CHIAKI_EXPORT bool chiaki_cli_stream_parse_args(ChiakiCliStreamOptions *stream_options, int argc, char *argv[])
+{
+	memset(stream_options, 0, sizeof(*stream_options));
+	Arguments arguments = { 0 };
+	arguments.ps5 = true;
+	error_t argp_r = argp_parse(&argp, argc, argv, ARGP_IN_ORDER, NULL, &arguments);
+	if(argp_r != 0)
+		return false;
+
+	if(!arguments.host)
+	{
+		fprintf(stderr, "No host specified, see --help.\n");
+		return false;
+	}
+	if(!arguments.registkey)
+	{
+		fprintf(stderr, "No registration key specified, see --help.\n");
+		return false;
+	}
+	if(!arguments.morning)
+	{
+		fprintf(stderr, "No morning specified, see --help.\n");
+		return false;
+	}
+
+	if(!parse_connect_info(&stream_options->connect_info, &arguments))
+		return false;
+
+	if(!arguments.video || strcmp(arguments.video, "null") == 0)
+		stream_options->video_sink = CHIAKI_CLI_VIDEO_SINK_NULL;
+	else if(strcmp(arguments.video, "file") == 0)
+		stream_options->video_sink = CHIAKI_CLI_VIDEO_SINK_FILE;
+	else if(strcmp(arguments.video, "decode") == 0)
+		stream_options->video_sink = CHIAKI_CLI_VIDEO_SINK_DECODE;
+	else
+	{
+		fprintf(stderr, "Invalid video sink %s.\n", arguments.video);
+		return false;
+	}
+#if !CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+	if(stream_options->video_sink == CHIAKI_CLI_VIDEO_SINK_DECODE)
+	{
+		fprintf(stderr, "The decode sink requires Chiaki built with the FFMPEG decoder.\n");
+		return false;
+	}
+	if(arguments.record)
+	{
+		fprintf(stderr, "Recording requires Chiaki built with FFMPEG.\n");
+		return false;
+	}
+#endif
+	if(stream_options->video_sink == CHIAKI_CLI_VIDEO_SINK_FILE && !arguments.output)
+	{
+		fprintf(stderr, "No output file specified for the file sink, see --help.\n");
+		return false;
+	}
+
+	stream_options->output = arguments.output;
+	stream_options->record = arguments.record;
+	stream_options->input = arguments.input;
+	stream_options->input_loop = arguments.input_loop;
+	stream_options->duration_ms = arguments.duration ? (uint64_t)(atof(arguments.duration) * 1000.0) : 0;
+	stream_options->stats_interval_ms = arguments.stats_interval ? strtoull(arguments.stats_interval, NULL, 10) : 1000;
+	return true;
+}
@@ -4,13 +4,17 @@
 #define CHIAKI_CONTROLLERMANAGER_H
 
 #include <chiaki/controller.h>
+#include <chiaki/controllerinput.h>
 
 #include <QObject>
 #include <QSet>
 #include <QMap>
+#include <QMutex>
 #include <QString>
 #include <QTimer>
 
+#include <atomic>
+
 #ifdef CHIAKI_GUI_ENABLE_SDL_GAMECONTROLLER
 #include <SDL.h>
 #include <chiaki/orientation.h>
@@ -26,25 +30,33 @@ class ControllerManager : public QObject
 	Q_OBJECT
 
 	friend class Controller;
+	friend class ControllerManagerPrivate;
 
 	private:
 #ifdef CHIAKI_GUI_ENABLE_SDL_GAMECONTROLLER
 		QSet<SDL_JoystickID> available_controllers;
 #endif
+		// SDL events are handled on the input thread, everything else on the gui thread
+		ChiakiControllerInput input;
+		bool input_thread_running;
+		bool input_thread_prioritized;
+		QMutex controllers_mutex; // open_controllers, for the input thread
 		QMap<int, Controller *> open_controllers;
-		bool creating_controller_mapping;
-		bool joystick_allow_background_events;
-		bool is_app_active;
-		bool moved;
+		std::atomic<bool> creating_controller_mapping;
+		std::atomic<bool> joystick_allow_background_events;
+		std::atomic<bool> is_app_active;
+		std::atomic<bool> moved;
 		uint8_t dualsense_intensity;
 
 		void ControllerClosed(Controller *controller);
 		void CheckMoved();
+		void WaitEvents(uint32_t timeout_ms);
 
 	private slots:
 		void UpdateAvailableControllers();
 		void HandleEvents();
 #ifdef CHIAKI_GUI_ENABLE_SDL_GAMECONTROLLER
+		void HandleEvent(SDL_Event event);
 		void ControllerEvent(SDL_Event evt);
 #endif
 
@@ -62,6 +74,12 @@ class ControllerManager : public QObject
 		QSet<int> GetAvailableControllers();
 		Controller *OpenController(int device_id);
 
+		/**
+		 * Receive the merged state of all open controllers as soon as it changes.
+		 * cb is called on the input thread, see chiaki_controller_input_set_sink().
+		 */
+		void SetControllerStateSink(ChiakiControllerInputSinkCb cb, void *user);
+
 	signals:
 		void AvailableControllersUpdated();
 		void ControllerMoved();
@@ -90,6 +108,8 @@ class Controller : public QObject
 		int ref;
 		ControllerManager *manager;
 		int id;
+		int input_source;
+		QMutex state_mutex; // state and motion, updated on the input thread
 		ChiakiOrientationTracker orientation_tracker;
 		ChiakiControllerState state;
 		bool updating_mapping_button;
@@ -108,7 +128,7 @@ class Controller : public QObject
 		SDL_GameController *controller;
 		ChiakiAccelNewZero accel_zero;
 		ChiakiAccelNewZero real_accel;
-		uint32_t last_motion_timestamp;
+		uint64_t last_motion_timestamp;
 #endif
 
 	public:
@@ -56,7 +56,7 @@ class DiscoveryManager : public QObject
 		QHash<QString, ManualService*> manual_services;
 
 	private slots:
-		void DiscoveryServiceHosts(QList<DiscoveryHost> hosts);
+		void DiscoveryServiceHostEvent(int event, DiscoveryHost host);
 		void UpdateManualServices();
 
 	public:
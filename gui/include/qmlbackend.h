@@ -6,6 +6,8 @@
 #include "qmlcontroller.h"
 #include "qmlsettings.h"
 
+#include <chiaki/hwframetransfer.h>
+
 #include <QObject>
 #include <QMutex>
 #include <QThread>
@@ -238,8 +240,6 @@ signals:
     void psnTokenChanged();
     void psnCredsExpired();
     void autoConnectChanged();
-    void wakeupStartInitiated();
-    void wakeupStartFailed();
     void windowTypeUpdated(WindowType type);
 
     void error(const QString &title, const QString &text);
@@ -281,6 +281,8 @@ private:
     uint32_t getStreamShortcut() const;
     void updateStreamShortcut();
     QString getExecutable();
+    void resetHwTransferLocked(ChiakiLog *log, bool allow_map, bool clear_stats);
+    void applyHwTransferResetLocked();
 
     Settings *settings = {};
     QmlSettings *settings_qml = {};
@@ -289,7 +291,6 @@ private:
     QThread *frame_thread = {};
     QTimer *psn_reconnect_timer = {};
     QTimer *psn_auto_connect_timer = {};
-    QTimer *wakeup_start_timer = {};
     int psn_reconnect_tries = 0;
     QThread psn_connection_thread;
     PsnConnectState psn_connect_state;
@@ -310,7 +311,15 @@ private:
     QFutureWatcher<void> psn_hosts_watcher;
     QFuture<void> psn_hosts_future;
     bool disable_zero_copy = false;
+    // guards everything hw_transfer below, but not hw_transfer itself while a download is running
     QMutex hw_transfer_state_mutex;
+    ChiakiHwFrameTransfer hw_transfer; // used on the frame thread, reset by the session lifecycle
+    bool hw_transfer_busy = false; // frame thread is downloading, resets are deferred until it is done
+    bool hw_transfer_reset_pending = false;
+    ChiakiLog *hw_transfer_reset_log = nullptr;
+    bool hw_transfer_reset_allow_map = true;
+    bool hw_transfer_reset_stats = false;
+    ChiakiHwFrameTransferStats hw_transfer_stats = {}; // copy of hw_transfer.stats as of the last download
     QSet<int> logged_hw_transfer_formats;
     QSet<int> logged_hw_transfer_failures;
     QAtomicInteger<int> pending_recovered_frame = 0;
@@ -331,8 +340,6 @@ private:
     bool settings_allocd = false;
     HostMAC auto_connect_mac = {};
     QString auto_connect_nickname = "";
-    QString wakeup_nickname = "";
-    bool wakeup_start = false;
     QMap<QString, PsnHost> psn_hosts = {};
     QMap<QString, PsnHost> psn_nickname_hosts = {};
 #ifdef CHIAKI_HAVE_WEBENGINE
@@ -3,6 +3,9 @@
 #include "streamsession.h"
 #include "settings.h"
 
+#include <chiaki/framepacer.h>
+
+#include <QFuture>
 #include <QMutex>
 #include <QAtomicInteger>
 #include <QWindow>
@@ -195,6 +198,7 @@ private:
 
     void init(Settings *settings, bool exit_app_on_stream_exit = false);
     pl_gpu placeboGpu() const;
+    void loadSpatialHooks(VideoPreset preset, PlaceboUpscaler upscaler);
     void update();
     void scheduleUpdate(bool force = false);
     void scheduleUpdate(bool force, UpdateRequestReason reason);
@@ -236,19 +240,19 @@ private:
     void render();
     void handleVulkanDeviceLost(const QString &reason);
     void handleVulkanRendererFallback(const QString &title, const QString &message, const QString &fallback_reason);
-    void applyPendingFrame();
+    void applyPendingFrame(bool paced = false);
     void queuePendingFrameRelease();
     bool applyPendingFrameIfQueueHasCapacity();
     bool hasPendingFrame() const;
     bool hasPendingFrameOverflow();
-    bool pendingFrameOverflowEnabled() const;
     int effectiveQueueDepthLimit() const;
-    int pendingFrameOverflowLimit(int submission_depth_limit) const;
     void clearPendingFrameStateLocked();
     void prunePendingFramesBeforeLocked(double cutoff_pts);
     void insertPendingOverflowLocked(PendingFrameEntry entry);
     bool takePendingFrameLocked(PendingFrameEntry &entry);
+    bool takePacedPendingFrameLocked(PendingFrameEntry &entry);
     bool dropPendingFrameLocked();
+    void dropPacedPendingFrameLocked(uint64_t pacer_id);
     void resetQueueDepthTracking();
     bool promotePendingFrameFromOverflowLocked();
     bool storePendingFrame(ChiakiFfmpegFrame &frame, bool take_ownership = false, bool synthetic_warmup = false);
@@ -289,8 +293,7 @@ private:
     bool nvidia_card = false;
     bool direct_stream = false;
     std::atomic<qint64> queue_pts_origin_cached_us = -1;
-    uint64_t next_frame_target_us = 0;
-    double last_throttle_interval_s = 0.0;
+    ChiakiFramePacer frame_pacer; // frame queue mirrors the pending frames, guarded by pending_frame_mutex
     QAtomicInteger<int> present_backpressure_active = 0;
     QAtomicInteger<int> present_pace_timer_rearm = 0;
     QAtomicInteger<int> present_pacing_reset_pending = 0;
@@ -321,6 +324,7 @@ private:
     bool startup_warmup_preserve_next_session_change = false;
 
     pl_cache placebo_cache = {};
+    QFuture<void> shader_cache_load;
     pl_log placebo_log = {};
     pl_vk_inst placebo_vk_inst = {};
     pl_vulkan placebo_vulkan = {};
@@ -351,8 +355,11 @@ private:
         double queue_origin = 0.0;
         uint64_t stored_us = 0;
         bool synthetic_warmup = false;
+        uint64_t pacer_id = 0; // 0 for frames not handed to frame_pacer
     };
     AVFrame *pending_frame = nullptr;
+    uint64_t pending_frame_pacer_id = 0;
+    uint64_t frame_pacer_next_id = 1;
     std::deque<PendingFrameEntry> pending_frame_overflow;
     bool pending_frame_synthetic_warmup = false;
     double pending_pts = 0.0;
@@ -449,6 +456,9 @@ private:
     const struct pl_hook *fsr_hook = nullptr;
     const struct pl_hook *fsrcnnx_hook_8 = nullptr;
     const struct pl_hook *fsrcnnx_hook_16 = nullptr;
+    bool fsr_hook_loaded = false;
+    bool fsrcnnx_hook_8_loaded = false;
+    bool fsrcnnx_hook_16_loaded = false;
 
     struct {
         PFN_vkGetDeviceProcAddr vkGetDeviceProcAddr;
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QPair>
+
+/**
+ * Measures how long each step from process start up to the first rendered ui frame takes.
+ * Only to be used from the gui thread.
+ */
+class StartupTimer
+{
+public:
+    static void Start();
+
+    /**
+     * Mark the end of a phase, which started at the end of the previous one.
+     */
+    static void Phase(const char *name);
+
+    /**
+     * Mark the first frame of the ui as rendered and log all phases.
+     * Only the first call does anything.
+     *
+     * With CHIAKI_TEST_EXIT_AFTER_STARTUP=1, the app quits afterwards, so startup can be measured headless,
+     * e.g. with QT_QPA_PLATFORM=offscreen.
+     */
+    static void Interactive();
+
+private:
+    static QElapsedTimer timer;
+    static qint64 last_ms;
+    static bool interactive;
+    static QList<QPair<const char *, qint64>> phases;
+};
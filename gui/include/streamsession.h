@@ -6,6 +6,9 @@
 #include <chiaki/session.h>
 #include <chiaki/opusdecoder.h>
 #include <chiaki/opusencoder.h>
+#include <chiaki/audioring.h>
+#include <chiaki/audioresampler.h>
+#include <chiaki/haptics.h>
 #include <chiaki/ffmpegdecoder.h>
 
 #if CHIAKI_LIB_ENABLE_PI_DECODER
@@ -40,7 +43,6 @@
 #include <QQueue>
 #include <QElapsedTimer>
 #include <QThread>
-#include <QWaitCondition>
 #include <QAtomicInteger>
 #if CHIAKI_GUI_ENABLE_SPEEX
 #include <QQueue>
@@ -97,6 +99,7 @@ class SdeckHapticsWorker;
 		bool mouse_touch_enabled;
 		bool enable_dualsense;
 		bool auto_regist;
+		bool wakeup = false;
 		float haptic_override;
 		ChiakiDisableAudioVideo audio_video_disabled;
 		RumbleHapticsIntensity rumble_haptics_intensity;
@@ -238,6 +241,14 @@ class StreamSession : public QObject
 		int8_t dpad_touch_id;
 		QPair<uint16_t, uint16_t> dpad_touch_value;
 		QTimer *dpad_touch_timer, *dpad_touch_stop_timer;
+		// controllers are merged on ControllerManager's input thread,
+		// together with the rest of the input as last published by the gui thread
+		QMutex input_mutex;
+		ChiakiControllerState input_controllers_state;
+		ChiakiControllerState input_gui_first_state; // setsu, goes before the controllers for motion
+		ChiakiControllerState input_gui_state;
+		bool input_dpad_touch; // dpad is mapped to touch
+		bool input_gui_only; // input is blocked or the dpad is touching, which only the gui thread handles
 		QElapsedTimer double_tap_timer;
 		RumbleHapticsIntensity rumble_haptics_intensity;
 		bool start_mic_unmuted;
@@ -245,6 +256,8 @@ class StreamSession : public QObject
 
 		ChiakiFfmpegDecoder *ffmpeg_decoder;
 		void TriggerFfmpegFrameAvailable();
+		void PushControllerInput(ChiakiControllerState *controllers_state);
+		bool DpadTouchShortcutPressed(const ChiakiControllerState *state);
 #if CHIAKI_LIB_ENABLE_PI_DECODER
 		ChiakiPiDecoder *pi_decoder;
 #endif
@@ -254,17 +267,12 @@ class StreamSession : public QObject
 		SDL_AudioDeviceID audio_out;
 		SDL_AudioDeviceID audio_in;
 		size_t audio_out_sample_size;
-		QMutex audio_out_ring_mutex;
-		QByteArray audio_out_ring_buf;
-		size_t audio_out_ring_read_pos = 0;
-		size_t audio_out_ring_write_pos = 0;
-		size_t audio_out_ring_fill = 0;
-		bool audio_out_overflow_logged = false;
-		QMutex audio_out_drain_mutex;
-		QWaitCondition audio_out_drain_wait;
-		QThread *audio_out_drain_thread = nullptr;
-		bool audio_out_drain_thread_running = false;
-		bool audio_out_drain_requested = false;
+		ChiakiAudioRing audio_out_ring = {};
+		bool audio_out_ring_valid = false;
+		ChiakiAudioResampler audio_out_resampler;
+		ChiakiAudioDriftController audio_out_drift;
+		int16_t *audio_out_resampled_buf = nullptr;
+		size_t audio_out_resampled_frames = 0;
 		size_t haptics_buffer_size;
 		unsigned int audio_buffer_size;
 		ChiakiHolepunchSession holepunch_session;
@@ -279,8 +287,12 @@ class StreamSession : public QObject
 		QQueue<QByteArray> echo_to_cancel;
 #endif
 		SDL_AudioDeviceID haptics_output;
-		SDL_AudioCVT haptics_cvt;
-		uint8_t *haptics_resampler_buf;
+		ChiakiHapticsProcessor haptics_processor;
+		int16_t *haptics_resampler_buf;
+		ChiakiAudioResampler haptics_drift_resampler;
+		ChiakiAudioDriftController haptics_drift;
+		int16_t *haptics_drift_buf = nullptr;
+		size_t haptics_drift_buf_frames = 0;
 		MicBuf mic_buf;
 		QMutex mic_ring_mutex;
 		QByteArray mic_ring_buf;
@@ -293,11 +305,8 @@ class StreamSession : public QObject
 		QMap<Qt::Key, int> key_map;
 		QElapsedTimer connect_timer;
 
-		void StartAudioOutDrainThread();
-		void StopAudioOutDrainThread();
-		void AudioOutDrainThreadMain();
-		void QueueAudioOutData(const QByteArray &audio_data);
-		void DrainAudioOutRingBuffer();
+		void CloseAudioOut();
+		static void AudioOutCallback(void *user, Uint8 *stream, int len);
 		void PushAudioFrame(int16_t *buf, size_t samples_count);
 		void PushHapticsFrame(uint8_t *buf, size_t buf_size);
 		void CantDisplayMessage(bool cant_display);
@@ -307,6 +316,7 @@ class StreamSession : public QObject
 #endif
 #if CHIAKI_GUI_ENABLE_SETSU
 		void HandleSetsuEvent(SetsuEvent *event);
+		void DispatchSetsu();
 #endif
 #if CHIAKI_GUI_ENABLE_STEAMDECK_NATIVE
 		void HandleSDeckEvent(SDeckEvent *event);
@@ -400,6 +410,7 @@ class StreamSession : public QObject
 		void UpdateGamepads();
 		void DpadSendFeedbackState();
 		void SendFeedbackState();
+		void UpdateFeedbackState(bool dpad_touch_placeholder);
 };
 
 Q_DECLARE_METATYPE(ChiakiQuitReason)
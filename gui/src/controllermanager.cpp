@@ -128,6 +128,18 @@ static QSet<QPair<uint16_t, uint16_t>> chiaki_steam_virtual_controller_ids({
 
 static ControllerManager *instance = nullptr;
 
+class ControllerManagerPrivate
+{
+	public:
+		static void WaitEvents(ControllerManager *manager, uint32_t timeout_ms)	{ manager->WaitEvents(timeout_ms); }
+};
+
+static void ControllerInputPollCb(ChiakiControllerInput *input, uint32_t timeout_ms, void *user)
+{
+	auto manager = reinterpret_cast<ControllerManager *>(user);
+	ControllerManagerPrivate::WaitEvents(manager, timeout_ms);
+}
+
 #define UPDATE_INTERVAL_MS 4
 #define MOVE_CHECK_MS 1000
 
@@ -139,9 +151,10 @@ ControllerManager *ControllerManager::GetInstance()
 }
 
 ControllerManager::ControllerManager(QObject *parent)
-	: QObject(parent), creating_controller_mapping(false),
-	joystick_allow_background_events(true), dualsense_intensity(0x00), is_app_active(true)
+	: QObject(parent), input_thread_running(false), input_thread_prioritized(false), creating_controller_mapping(false),
+	joystick_allow_background_events(true), is_app_active(true), moved(false), dualsense_intensity(0x00)
 {
+	chiaki_controller_input_init(&input);
 #ifdef CHIAKI_GUI_ENABLE_SDL_GAMECONTROLLER
 	SDL_SetMainReady();
 	SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_PS4_RUMBLE, "1");
@@ -150,12 +163,23 @@ ControllerManager::ControllerManager(QObject *parent)
 #if SDL_VERSION_ATLEAST(2, 29, 1)
 	SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_STEAMDECK, "0");
 #endif
+	// device notifications and raw input on Windows come through a window of their own thread,
+	// not the thread that called SDL_Init()
+	SDL_SetHint(SDL_HINT_JOYSTICK_THREAD, "1");
 	if(SDL_Init(SDL_INIT_GAMECONTROLLER) < 0)
 		return;
 
-	auto timer = new QTimer(this);
-	connect(timer, &QTimer::timeout, this, &ControllerManager::HandleEvents);
-	timer->start(UPDATE_INTERVAL_MS);
+	// Pump events on a thread of our own so input reaches the session without waiting for the gui's event loop.
+	// IOKit delivers macOS controllers to the run loop of the main thread, so keep pumping there.
+#ifndef Q_OS_MACOS
+	input_thread_running = chiaki_controller_input_start(&input, ControllerInputPollCb, this) == CHIAKI_ERR_SUCCESS;
+#endif
+	if(!input_thread_running)
+	{
+		auto timer = new QTimer(this);
+		connect(timer, &QTimer::timeout, this, &ControllerManager::HandleEvents);
+		timer->start(UPDATE_INTERVAL_MS);
+	}
 	auto move_timer = new QTimer(this);
 	connect(move_timer, &QTimer::timeout, this, &ControllerManager::CheckMoved);
 	move_timer->start(MOVE_CHECK_MS);
@@ -166,10 +190,12 @@ ControllerManager::ControllerManager(QObject *parent)
 
 ControllerManager::~ControllerManager()
 {
+	chiaki_controller_input_stop(&input);
 #ifdef CHIAKI_GUI_ENABLE_SDL_GAMECONTROLLER
 	open_controllers.clear();
 	SDL_Quit();
 #endif
+	chiaki_controller_input_fini(&input);
 }
 
 void ControllerManager::SetAllowJoystickBackgroundEvents(bool enabled)
@@ -245,35 +271,55 @@ void ControllerManager::HandleEvents()
 #ifdef CHIAKI_GUI_ENABLE_SDL_GAMECONTROLLER
 	SDL_Event event;
 	while(SDL_PollEvent(&event))
+		HandleEvent(event);
+#endif
+}
+
+void ControllerManager::WaitEvents(uint32_t timeout_ms)
+{
+#ifdef CHIAKI_GUI_ENABLE_SDL_GAMECONTROLLER
+	if(!input_thread_prioritized)
 	{
-		switch(event.type)
-		{
-			case SDL_JOYDEVICEADDED:
-			case SDL_JOYDEVICEREMOVED:
-				UpdateAvailableControllers();
-				break;
-			case SDL_JOYAXISMOTION:
-			case SDL_JOYBUTTONDOWN:
-			case SDL_JOYBUTTONUP:
-			case SDL_JOYHATMOTION:
-			case SDL_CONTROLLERBUTTONUP:
-			case SDL_CONTROLLERBUTTONDOWN:
-			case SDL_CONTROLLERAXISMOTION:
-#if not defined(CHIAKI_ENABLE_SETSU) and SDL_VERSION_ATLEAST(2, 0, 14)
-			case SDL_CONTROLLERSENSORUPDATE:
-			case SDL_CONTROLLERTOUCHPADDOWN:
-			case SDL_CONTROLLERTOUCHPADMOTION:
-			case SDL_CONTROLLERTOUCHPADUP:
-#endif
-				if(joystick_allow_background_events || is_app_active)
-					ControllerEvent(event);
-				break;
-		}
+		SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+		input_thread_prioritized = true;
 	}
+	SDL_Event event;
+	if(!SDL_WaitEventTimeout(&event, timeout_ms))
+		return;
+	do
+		HandleEvent(event);
+	while(SDL_PollEvent(&event));
 #endif
 }
 
 #ifdef CHIAKI_GUI_ENABLE_SDL_GAMECONTROLLER
+void ControllerManager::HandleEvent(SDL_Event event)
+{
+	switch(event.type)
+	{
+		case SDL_JOYDEVICEADDED:
+		case SDL_JOYDEVICEREMOVED:
+			QMetaObject::invokeMethod(this, &ControllerManager::UpdateAvailableControllers, Qt::QueuedConnection);
+			break;
+		case SDL_JOYAXISMOTION:
+		case SDL_JOYBUTTONDOWN:
+		case SDL_JOYBUTTONUP:
+		case SDL_JOYHATMOTION:
+		case SDL_CONTROLLERBUTTONUP:
+		case SDL_CONTROLLERBUTTONDOWN:
+		case SDL_CONTROLLERAXISMOTION:
+#if not defined(CHIAKI_ENABLE_SETSU) and SDL_VERSION_ATLEAST(2, 0, 14)
+		case SDL_CONTROLLERSENSORUPDATE:
+		case SDL_CONTROLLERTOUCHPADDOWN:
+		case SDL_CONTROLLERTOUCHPADMOTION:
+		case SDL_CONTROLLERTOUCHPADUP:
+#endif
+			if(joystick_allow_background_events || is_app_active)
+				ControllerEvent(event);
+			break;
+	}
+}
+
 void ControllerManager::ControllerEvent(SDL_Event event)
 {
 	int device_id;
@@ -318,6 +364,7 @@ void ControllerManager::ControllerEvent(SDL_Event event)
 		default:
 			return;
 	}
+	QMutexLocker locker(&controllers_mutex);
 	if(!open_controllers.contains(device_id))
 		return;
 	if(creating_controller_mapping && start_updating_mapping)
@@ -338,8 +385,14 @@ QSet<int> ControllerManager::GetAvailableControllers()
 #endif
 }
 
+void ControllerManager::SetControllerStateSink(ChiakiControllerInputSinkCb cb, void *user)
+{
+	chiaki_controller_input_set_sink(&input, cb, user);
+}
+
 Controller *ControllerManager::OpenController(int device_id)
 {
+	QMutexLocker locker(&controllers_mutex);
 	Controller *controller = open_controllers.value(device_id);
 	if(!controller)
 	{
@@ -352,6 +405,7 @@ Controller *ControllerManager::OpenController(int device_id)
 
 void ControllerManager::ControllerClosed(Controller *controller)
 {
+	QMutexLocker locker(&controllers_mutex);
 	open_controllers.remove(controller->GetDeviceID());
 }
 
@@ -362,6 +416,7 @@ Controller::Controller(int device_id, ControllerManager *manager)
 {
 	this->id = device_id;
 	this->manager = manager;
+	this->input_source = chiaki_controller_input_add_source(&manager->input);
 	chiaki_orientation_tracker_init(&this->orientation_tracker);
 	chiaki_accel_new_zero_set_inactive(&this->accel_zero, false);
 	chiaki_accel_new_zero_set_inactive(&this->real_accel, true);
@@ -407,6 +462,7 @@ Controller::Controller(int device_id, ControllerManager *manager)
 Controller::~Controller()
 {
 	Q_ASSERT(ref == 0);
+	chiaki_controller_input_remove_source(&manager->input, input_source);
 #ifdef CHIAKI_GUI_ENABLE_SDL_GAMECONTROLLER
 	if(controller && SDL_WasInit(SDL_INIT_GAMECONTROLLER)!=0)
 	{
@@ -437,6 +493,7 @@ void Controller::EnableAnalogStickMapping(bool enabled)
 #ifdef CHIAKI_GUI_ENABLE_SDL_GAMECONTROLLER
 void Controller::UpdateState(SDL_Event event)
 {
+	QMutexLocker locker(&state_mutex);
 	switch(event.type)
 	{
 		case SDL_JOYAXISMOTION:
@@ -487,6 +544,9 @@ void Controller::UpdateState(SDL_Event event)
 			return;
 
 	}
+	// straight to the session, on the input thread
+	chiaki_controller_input_set_source(&manager->input, input_source, &state);
+	locker.unlock();
 	emit StateChanged();
 	manager->moved = true;
 }
@@ -608,31 +668,34 @@ inline bool Controller::HandleAxisEvent(SDL_ControllerAxisEvent event) {
 #if SDL_VERSION_ATLEAST(2, 0, 14)
 inline bool Controller::HandleSensorEvent(SDL_ControllerSensorEvent event)
 {
-	float accel_x, accel_y, accel_z, gyro_x, gyro_y, gyro_z;
+	ChiakiMotionSample sample = {};
+	// prefer the time of the reading from the controller itself, events may be delivered late and in batches
+	sample.timestamp_us = (uint64_t)event.timestamp * 1000;
+#if SDL_VERSION_ATLEAST(2, 26, 0)
+	if(event.timestamp_us)
+		sample.timestamp_us = event.timestamp_us;
+#endif
 	switch(event.sensor)
 	{
 		case SDL_SENSOR_ACCEL:
-			accel_x = event.data[0] / SDL_STANDARD_GRAVITY;
-			accel_y = event.data[1] / SDL_STANDARD_GRAVITY;
-			accel_z = event.data[2] / SDL_STANDARD_GRAVITY;
+			sample.flags = CHIAKI_MOTION_SAMPLE_ACCEL;
+			sample.accel_x = event.data[0] / SDL_STANDARD_GRAVITY;
+			sample.accel_y = event.data[1] / SDL_STANDARD_GRAVITY;
+			sample.accel_z = event.data[2] / SDL_STANDARD_GRAVITY;
 			chiaki_accel_new_zero_set_active(&this->real_accel,
-			accel_x, accel_y, accel_z, true);
-			chiaki_orientation_tracker_update(
-				&orientation_tracker, state.gyro_x, state.gyro_y, state.gyro_z,
-				accel_x, accel_y, accel_z, &accel_zero, false, event.timestamp * 1000);
+			sample.accel_x, sample.accel_y, sample.accel_z, true);
 			break;
 		case SDL_SENSOR_GYRO:
-			gyro_x = event.data[0];
-			gyro_y = event.data[1];
-			gyro_z = event.data[2];
-			chiaki_orientation_tracker_update(
-				&orientation_tracker, gyro_x, gyro_y, gyro_z,
-				state.accel_x, state.accel_y, state.accel_z, &accel_zero, true, event.timestamp * 1000);
+			sample.flags = CHIAKI_MOTION_SAMPLE_GYRO;
+			sample.gyro_x = event.data[0];
+			sample.gyro_y = event.data[1];
+			sample.gyro_z = event.data[2];
 			break;
 		default:
 			return false;
 	}
-	last_motion_timestamp = event.timestamp * 1000;
+	chiaki_orientation_tracker_update_sample(&orientation_tracker, &sample, &accel_zero);
+	last_motion_timestamp = sample.timestamp_us;
 	chiaki_orientation_tracker_apply_to_controller_state(&orientation_tracker, &state);
 	return true;
 }
@@ -772,6 +835,7 @@ QString Controller::GetVIDPIDString()
 
 ChiakiControllerState Controller::GetState()
 {
+	QMutexLocker locker(&state_mutex);
 	return state;
 }
 
@@ -940,11 +1004,12 @@ void Controller::resetMotionControls()
 #ifdef CHIAKI_GUI_ENABLE_SDL_GAMECONTROLLER
 	if(!controller)
 		return;
+	QMutexLocker locker(&state_mutex);
 	chiaki_accel_new_zero_set_active(&accel_zero, real_accel.accel_x, real_accel.accel_y, real_accel.accel_z, false);
-	chiaki_orientation_tracker_init(&orientation_tracker);
-	chiaki_orientation_tracker_update(
+	chiaki_orientation_tracker_reset(
 		&orientation_tracker, state.gyro_x, state.gyro_y, state.gyro_z,
-		real_accel.accel_x, real_accel.accel_y, real_accel.accel_z, &accel_zero, false, last_motion_timestamp);
+		real_accel.accel_x, real_accel.accel_y, real_accel.accel_z, &accel_zero, last_motion_timestamp);
 	chiaki_orientation_tracker_apply_to_controller_state(&orientation_tracker, &state);
+	chiaki_controller_input_set_source(&manager->input, input_source, &state);
 #endif
 }
@@ -33,7 +33,7 @@ HostMAC DiscoveryHost::GetHostMAC() const
 	return HostMAC((uint8_t *)data.constData());
 }
 
-static void DiscoveryServiceHostsCallback(ChiakiDiscoveryHost *hosts, size_t hosts_count, void *user);
+static void DiscoveryServiceHostCallback(ChiakiDiscoveryServiceHostEvent event, ChiakiDiscoveryHost *host, void *user);
 static void DiscoveryServiceHostsManualCallback(ChiakiDiscoveryHost *hosts, size_t hosts_count, void *user);
 
 DiscoveryManager::DiscoveryManager(QObject *parent) : QObject(parent)
@@ -66,7 +66,7 @@ void DiscoveryManager::SetActive(bool active)
 			options.ping_ms = PING_MS;
 			options.hosts_max = HOSTS_MAX;
 			options.host_drop_pings = DROP_PINGS;
-			options.cb = DiscoveryServiceHostsCallback;
+			options.host_cb = DiscoveryServiceHostCallback;
 			options.cb_user = this;
 
 			struct sockaddr_in in_addr = {};
@@ -218,7 +218,7 @@ void DiscoveryManager::SetActive(bool active)
 			options_ipv6.ping_ms = PING_MS;
 			options_ipv6.hosts_max = HOSTS_MAX;
 			options_ipv6.host_drop_pings = DROP_PINGS;
-			options_ipv6.cb = DiscoveryServiceHostsCallback;
+			options_ipv6.host_cb = DiscoveryServiceHostCallback;
 			options_ipv6.cb_user = this;
 			struct sockaddr_in6 in_addr_ipv6 = {};
 			in_addr_ipv6.sin6_family = AF_INET6;
@@ -313,9 +313,33 @@ const QList<DiscoveryHost> DiscoveryManager::GetHosts() const
 	return ret;
 }
 
-void DiscoveryManager::DiscoveryServiceHosts(QList<DiscoveryHost> hosts)
+void DiscoveryManager::DiscoveryServiceHostEvent(int event, DiscoveryHost host)
 {
-	this->hosts = std::move(hosts);
+	// the IPv4 and IPv6 services report the same console separately, so both the id and the address identify it
+	qsizetype i = 0;
+	for(; i < hosts.size(); i++)
+	{
+		if(hosts[i].host_id == host.host_id && hosts[i].host_addr == host.host_addr)
+			break;
+	}
+
+	switch(event)
+	{
+		case CHIAKI_DISCOVERY_SERVICE_HOST_ADDED:
+		case CHIAKI_DISCOVERY_SERVICE_HOST_CHANGED:
+			if(i < hosts.size())
+				hosts[i] = std::move(host);
+			else
+				hosts.append(std::move(host));
+			break;
+		case CHIAKI_DISCOVERY_SERVICE_HOST_REMOVED:
+			if(i >= hosts.size())
+				return;
+			hosts.removeAt(i);
+			break;
+		default:
+			return;
+	}
 	emit HostsUpdated();
 }
 
@@ -380,9 +404,9 @@ void DiscoveryManager::UpdateManualServices()
 class DiscoveryManagerPrivate
 {
 	public:
-		static void DiscoveryServiceHosts(DiscoveryManager *discovery_manager, const QList<DiscoveryHost> &hosts)
+		static void DiscoveryServiceHostEvent(DiscoveryManager *discovery_manager, ChiakiDiscoveryServiceHostEvent event, const DiscoveryHost &host)
 		{
-			QMetaObject::invokeMethod(discovery_manager, "DiscoveryServiceHosts", Qt::ConnectionType::QueuedConnection, Q_ARG(QList<DiscoveryHost>, hosts));
+			QMetaObject::invokeMethod(discovery_manager, "DiscoveryServiceHostEvent", Qt::ConnectionType::QueuedConnection, Q_ARG(int, event), Q_ARG(DiscoveryHost, host));
 		}
 
 		static void DiscoveryServiceManualHost(DiscoveryManager *discovery_manager)
@@ -391,31 +415,22 @@ class DiscoveryManagerPrivate
 		}
 };
 
-static QList<DiscoveryHost> CreateHostsList(ChiakiDiscoveryHost *hosts, size_t hosts_count)
+static DiscoveryHost CreateHost(ChiakiDiscoveryHost *h)
 {
-	QList<DiscoveryHost> hosts_list;
-	hosts_list.reserve(hosts_count);
-
-	for(size_t i=0; i<hosts_count; i++)
-	{
-		ChiakiDiscoveryHost *h = hosts + i;
-		DiscoveryHost o = {};
-		o.ps5 = chiaki_discovery_host_is_ps5(h);
-		o.target = chiaki_discovery_host_system_version_target(h);
-		o.state = h->state;
-		o.host_request_port = h->host_request_port;
+	DiscoveryHost o = {};
+	o.ps5 = chiaki_discovery_host_is_ps5(h);
+	o.target = chiaki_discovery_host_system_version_target(h);
+	o.state = h->state;
+	o.host_request_port = h->host_request_port;
 #define CONVERT_STRING(name) if(h->name) { o.name = QString::fromLocal8Bit(h->name); }
-		CHIAKI_DISCOVERY_HOST_STRING_FOREACH(CONVERT_STRING)
+	CHIAKI_DISCOVERY_HOST_STRING_FOREACH(CONVERT_STRING)
 #undef CONVERT_STRING
-		hosts_list.append(o);
-	}
-
-	return hosts_list;
+	return o;
 }
 
-static void DiscoveryServiceHostsCallback(ChiakiDiscoveryHost *hosts, size_t hosts_count, void *user)
+static void DiscoveryServiceHostCallback(ChiakiDiscoveryServiceHostEvent event, ChiakiDiscoveryHost *host, void *user)
 {
-	DiscoveryManagerPrivate::DiscoveryServiceHosts(reinterpret_cast<DiscoveryManager *>(user), CreateHostsList(hosts, hosts_count));
+	DiscoveryManagerPrivate::DiscoveryServiceHostEvent(reinterpret_cast<DiscoveryManager *>(user), event, CreateHost(host));
 }
 
 static void DiscoveryServiceHostsManualCallback(ChiakiDiscoveryHost *hosts, size_t hosts_count, void *user)
@@ -423,6 +438,6 @@ static void DiscoveryServiceHostsManualCallback(ChiakiDiscoveryHost *hosts, size
 	ManualService *s = reinterpret_cast<ManualService *>(user);
 	s->discovered = hosts_count;
 	if(s->discovered)
-		s->discovery_host = CreateHostsList(hosts, hosts_count).at(0);
+		s->discovery_host = CreateHost(&hosts[0]);
 	DiscoveryManagerPrivate::DiscoveryServiceManualHost(s->manager);
 }
@@ -19,6 +19,7 @@ int main(int argc, char *argv[]) { return real_main(argc, argv); }
 #include <controllermanager.h>
 #include <discoverymanager.h>
 #include <qmlmainwindow.h>
+#include <startuptimer.h>
 #include <QApplication>
 #include <QtTypes>
 
@@ -66,6 +67,7 @@ int RunMain(QGuiApplication &app, Settings *settings, bool exit_app_on_stream_ex
 
 int real_main(int argc, char *argv[])
 {
+	StartupTimer::Start();
 	qRegisterMetaType<DiscoveryHost>();
 	qRegisterMetaType<RegisteredHost>();
 	qRegisterMetaType<HostMAC>();
@@ -110,6 +112,7 @@ int real_main(int argc, char *argv[])
 		fprintf(stderr, "Chiaki lib init failed: %s\n", chiaki_error_string(err));
 		return 1;
 	}
+	StartupTimer::Phase("lib init");
 
     SDL_SetHint(SDL_HINT_APP_NAME, "chiaki-ng");
 
@@ -118,6 +121,7 @@ int real_main(int argc, char *argv[])
 		fprintf(stderr, "SDL Audio init failed: %s\n", SDL_GetError());
 		return 1;
 	}
+	StartupTimer::Phase("audio init");
 
 	QGuiApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
 #ifdef CHIAKI_HAVE_WEBENGINE
@@ -130,6 +134,7 @@ int real_main(int argc, char *argv[])
 #else
 	QGuiApplication::setWindowIcon(QIcon(":/icons/chiaking.svg"));
 #endif
+	StartupTimer::Phase("application");
 
 	QCommandLineParser parser;
 	parser.setOptionsAfterPositionalArgumentsMode(QCommandLineParser::ParseAsPositionalArguments);
@@ -187,6 +192,7 @@ int real_main(int argc, char *argv[])
 	bool use_alt_settings = false;
 	if(!parser.isSet(profile_option))
 		use_alt_settings = true;
+	StartupTimer::Phase("settings");
 
 	if(args.length() == 0)
 		return RunMain(app, use_alt_settings ? &alt_settings : &settings, exit_app_on_stream_exit);
@@ -92,14 +92,4 @@ Rectangle {
         running: false
         onTriggered: view.stop();
     }
-
-    Connections {
-        target: Chiaki
-
-        function onWakeupStartFailed() {
-            view.textVisible = false;
-            infoLabel.text = qsTr("Timed out waiting for console. Exiting...");
-            failTimer.start();
-        }
-    }
 }
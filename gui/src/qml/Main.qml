@@ -45,9 +45,15 @@ Item {
             showRegistDialog(host, ps5);
     }
 
+    function separateSettingsLoader(windowLoader) {
+        windowLoader.active = true;
+        return windowLoader.item.settingsLoader;
+    }
+
     function openDisplaySettings() {
         useSeparateStreamSettingsWindows = preferSeparateStreamSettingsWindows;
-        const loader = useSeparateStreamSettingsWindows ? separateDisplaySettingsLoader : displaySettingsLoader;
+        const loader = useSeparateStreamSettingsWindows ? separateSettingsLoader(separateDisplaySettingsWindowLoader) : displaySettingsLoader;
+        loader.active = true;
         if(loader.status == Loader.Ready)
         {
             if(placeboSettingsRect.opacity || displaySettingsRect.opacity || colorMappingSettingsRect.opacity)
@@ -67,7 +73,8 @@ Item {
     function openPlaceboSettings() {
         if (!displaySettingsRect.opacity && !placeboSettingsRect.opacity && !colorMappingSettingsRect.opacity)
             useSeparateStreamSettingsWindows = preferSeparateStreamSettingsWindows;
-        const loader = useSeparateStreamSettingsWindows ? separatePlaceboSettingsLoader : placeboSettingsLoader;
+        const loader = useSeparateStreamSettingsWindows ? separateSettingsLoader(separatePlaceboSettingsWindowLoader) : placeboSettingsLoader;
+        loader.active = true;
         if(loader.status == Loader.Ready)
         {
             if(placeboSettingsRect.opacity || displaySettingsRect.opacity || colorMappingSettingsRect.opacity)
@@ -88,14 +95,14 @@ Item {
     function closeDialog() {
        if(displaySettingsRect.opacity) {
         displaySettingsRect.opacity = 0.0;
-        const loader = useSeparateStreamSettingsWindows ? separateDisplaySettingsLoader : displaySettingsLoader;
+        const loader = useSeparateStreamSettingsWindows ? separateSettingsLoader(separateDisplaySettingsWindowLoader) : displaySettingsLoader;
         loader.item.restoreFocusItem = Window.window.activeFocusItem;
         releaseInput();
         useSeparateStreamSettingsWindows = false;
        }
        else if(placeboSettingsRect.opacity) {
         placeboSettingsRect.opacity = 0.0;
-        const loader = useSeparateStreamSettingsWindows ? separatePlaceboSettingsLoader : placeboSettingsLoader;
+        const loader = useSeparateStreamSettingsWindows ? separateSettingsLoader(separatePlaceboSettingsWindowLoader) : placeboSettingsLoader;
         loader.item.restoreFocusItem = Window.window.activeFocusItem;
         releaseInput();
         useSeparateStreamSettingsWindows = false;
@@ -103,7 +110,7 @@ Item {
        else if(colorMappingSettingsRect.opacity) {
         releaseInput();
         colorMappingSettingsRect.opacity = 0.0;
-        const loader = useSeparateStreamSettingsWindows ? separateColorMappingSettingsLoader : colorMappingSettingsLoader;
+        const loader = useSeparateStreamSettingsWindows ? separateSettingsLoader(separateColorMappingSettingsWindowLoader) : colorMappingSettingsLoader;
         loader.item.restoreFocusItem = Window.window.activeFocusItem;
         root.openPlaceboSettings();
        }
@@ -114,21 +121,21 @@ Item {
     function showMainView() {
         if(displaySettingsRect.opacity) {
             displaySettingsRect.opacity = 0.0;
-            const loader = useSeparateStreamSettingsWindows ? separateDisplaySettingsLoader : displaySettingsLoader;
+            const loader = useSeparateStreamSettingsWindows ? separateSettingsLoader(separateDisplaySettingsWindowLoader) : displaySettingsLoader;
             loader.item.restoreFocusItem = Window.window.activeFocusItem;
             releaseInput();
             useSeparateStreamSettingsWindows = false;
         }
         else if(placeboSettingsRect.opacity) {
             placeboSettingsRect.opacity = 0.0;
-            const loader = useSeparateStreamSettingsWindows ? separatePlaceboSettingsLoader : placeboSettingsLoader;
+            const loader = useSeparateStreamSettingsWindows ? separateSettingsLoader(separatePlaceboSettingsWindowLoader) : placeboSettingsLoader;
             loader.item.restoreFocusItem = Window.window.activeFocusItem;
             releaseInput();
             useSeparateStreamSettingsWindows = false;
         }
         else if(colorMappingSettingsRect.opacity) {
             colorMappingSettingsRect.opacity = 0.0;
-            const loader = useSeparateStreamSettingsWindows ? separateColorMappingSettingsLoader : colorMappingSettingsLoader;
+            const loader = useSeparateStreamSettingsWindows ? separateSettingsLoader(separateColorMappingSettingsWindowLoader) : colorMappingSettingsLoader;
             loader.item.restoreFocusItem = Window.window.activeFocusItem;
             releaseInput();
             useSeparateStreamSettingsWindows = false;
@@ -152,19 +159,23 @@ Item {
     }
 
     function showConfirmDialog(title, text, callback, rejectCallback = null) {
-        confirmDialog.title = title;
-        confirmDialog.text = text;
-        confirmDialog.callback = callback;
-        confirmDialog.rejectCallback = rejectCallback;
-        confirmDialog.restoreFocusItem = Window.window.activeFocusItem;
-        confirmDialog.open();
+        confirmDialogLoader.active = true;
+        const dialog = confirmDialogLoader.item;
+        dialog.title = title;
+        dialog.text = text;
+        dialog.callback = callback;
+        dialog.rejectCallback = rejectCallback;
+        dialog.restoreFocusItem = Window.window.activeFocusItem;
+        dialog.open();
     }
 
     function showInfoDialog(title, text) {
-        infoDialog.title = title;
-        infoDialog.text = text;
-        infoDialog.restoreFocusItem = Window.window.activeFocusItem;
-        infoDialog.open();
+        infoDialogLoader.active = true;
+        const dialog = infoDialogLoader.item;
+        dialog.title = title;
+        dialog.text = text;
+        dialog.restoreFocusItem = Window.window.activeFocusItem;
+        dialog.open();
     }
 
     function showRendererFallbackDialog(reason) {
@@ -173,12 +184,14 @@ Item {
     }
 
     function showRemindDialog(title, text, remotePlay, callback) {
-        remindDialog.title = title;
-        remindDialog.text = text;
-        remindDialog.remotePlay = remotePlay;
-        remindDialog.callback = callback;
-        remindDialog.restoreFocusItem = Window.window.activeFocusItem;
-        remindDialog.open();
+        remindDialogLoader.active = true;
+        const dialog = remindDialogLoader.item;
+        dialog.title = title;
+        dialog.text = text;
+        dialog.remotePlay = remotePlay;
+        dialog.callback = callback;
+        dialog.restoreFocusItem = Window.window.activeFocusItem;
+        dialog.open();
     }
 
 
@@ -203,7 +216,8 @@ Item {
         {
             root.closeDialog();
             useSeparateStreamSettingsWindows = preferSeparateStreamSettingsWindows;
-            const loader = useSeparateStreamSettingsWindows ? separateColorMappingSettingsLoader : colorMappingSettingsLoader;
+            const loader = useSeparateStreamSettingsWindows ? separateSettingsLoader(separateColorMappingSettingsWindowLoader) : colorMappingSettingsLoader;
+            loader.active = true;
             if(loader.status == Loader.Ready)
             {
                 grabInput(loader);
@@ -293,6 +307,7 @@ Item {
             anchors.fill: parent
             id: placeboSettingsLoader
             sourceComponent: placeboSettingsDialogComponent
+            active: false
         }
     }
     Rectangle {
@@ -308,6 +323,7 @@ Item {
             anchors.fill: parent
             id: displaySettingsLoader
             sourceComponent: displaySettingsDialogComponent
+            active: false
         }
     }
     Rectangle {
@@ -323,96 +339,115 @@ Item {
             anchors.fill: parent
             id: colorMappingSettingsLoader
             sourceComponent: placeboColorMappingDialogComponent
-        }
-    }
-
-    Window {
-        id: separateDisplaySettingsWindow
-        visible: useSeparateStreamSettingsWindows && displaySettingsRect.opacity > 0.0
-        transientParent: Chiaki.window
-        flags: Qt.Dialog | Qt.FramelessWindowHint
-        color: Material.background
-        modality: Qt.NonModal
-        x: Math.round(root.mapToGlobal(0, 0).x)
-        y: Math.round(root.mapToGlobal(0, 0).y)
-        width: Math.round(root.width)
-        height: separateDisplaySettingsLoader.item ? Math.min(Math.round(root.height), Math.round(separateDisplaySettingsLoader.item.gridHeight + 140)) : 500
-        onVisibleChanged: if (visible) requestActivate()
-
-        Shortcut {
-            sequence: "Ctrl+O"
-            onActivated: root.closeDialog()
-        }
+            active: false
+        }
+    }
+
+    Loader {
+        id: separateDisplaySettingsWindowLoader
+        active: false
+        sourceComponent: Window {
+            id: separateDisplaySettingsWindow
+            property alias settingsLoader: separateDisplaySettingsLoader
+            visible: useSeparateStreamSettingsWindows && displaySettingsRect.opacity > 0.0
+            transientParent: Chiaki.window
+            flags: Qt.Dialog | Qt.FramelessWindowHint
+            color: Material.background
+            modality: Qt.NonModal
+            x: Math.round(root.mapToGlobal(0, 0).x)
+            y: Math.round(root.mapToGlobal(0, 0).y)
+            width: Math.round(root.width)
+            height: separateDisplaySettingsLoader.item ? Math.min(Math.round(root.height), Math.round(separateDisplaySettingsLoader.item.gridHeight + 140)) : 500
+            onVisibleChanged: if (visible) requestActivate()
+
+            Shortcut {
+                sequence: "Ctrl+O"
+                onActivated: root.closeDialog()
+            }
 
-        Shortcut {
-            sequence: StandardKey.Cancel
-            onActivated: root.closeDialog()
-        }
+            Shortcut {
+                sequence: StandardKey.Cancel
+                onActivated: root.closeDialog()
+            }
 
-        Loader {
-            anchors.fill: parent
-            id: separateDisplaySettingsLoader
-            sourceComponent: displaySettingsDialogComponent
+            Loader {
+                anchors.fill: parent
+                id: separateDisplaySettingsLoader
+                sourceComponent: displaySettingsDialogComponent
+                active: false
+            }
         }
     }
 
-    Window {
-        id: separatePlaceboSettingsWindow
-        visible: useSeparateStreamSettingsWindows && placeboSettingsRect.opacity > 0.0
-        transientParent: Chiaki.window
-        flags: Qt.Dialog | Qt.FramelessWindowHint
-        color: Material.background
-        modality: Qt.NonModal
-        x: Math.round(root.mapToGlobal(0, 0).x)
-        y: Math.round(root.mapToGlobal(0, 0).y)
-        width: Math.round(root.width)
-        height: Math.min(Math.round(root.height), 650)
-        onVisibleChanged: if (visible) requestActivate()
-
-        Shortcut {
-            sequence: "Ctrl+O"
-            onActivated: root.closeDialog()
-        }
+    Loader {
+        id: separatePlaceboSettingsWindowLoader
+        active: false
+        sourceComponent: Window {
+            id: separatePlaceboSettingsWindow
+            property alias settingsLoader: separatePlaceboSettingsLoader
+            visible: useSeparateStreamSettingsWindows && placeboSettingsRect.opacity > 0.0
+            transientParent: Chiaki.window
+            flags: Qt.Dialog | Qt.FramelessWindowHint
+            color: Material.background
+            modality: Qt.NonModal
+            x: Math.round(root.mapToGlobal(0, 0).x)
+            y: Math.round(root.mapToGlobal(0, 0).y)
+            width: Math.round(root.width)
+            height: Math.min(Math.round(root.height), 650)
+            onVisibleChanged: if (visible) requestActivate()
+
+            Shortcut {
+                sequence: "Ctrl+O"
+                onActivated: root.closeDialog()
+            }
 
-        Shortcut {
-            sequence: StandardKey.Cancel
-            onActivated: root.closeDialog()
-        }
+            Shortcut {
+                sequence: StandardKey.Cancel
+                onActivated: root.closeDialog()
+            }
 
-        Loader {
-            anchors.fill: parent
-            id: separatePlaceboSettingsLoader
-            sourceComponent: placeboSettingsDialogComponent
+            Loader {
+                anchors.fill: parent
+                id: separatePlaceboSettingsLoader
+                sourceComponent: placeboSettingsDialogComponent
+                active: false
+            }
         }
     }
 
-    Window {
-        id: separateColorMappingSettingsWindow
-        visible: useSeparateStreamSettingsWindows && colorMappingSettingsRect.opacity > 0.0
-        transientParent: Chiaki.window
-        flags: Qt.Dialog | Qt.FramelessWindowHint
-        color: Material.background
-        modality: Qt.NonModal
-        x: Math.round(root.mapToGlobal(0, 0).x)
-        y: Math.round(root.mapToGlobal(0, 0).y)
-        width: Math.round(root.width)
-        height: Math.min(Math.round(root.height), 600)
-        onVisibleChanged: if (visible) requestActivate()
-
-        Shortcut {
-            sequence: "Ctrl+O"
-            onActivated: root.closeDialog()
-        }
+    Loader {
+        id: separateColorMappingSettingsWindowLoader
+        active: false
+        sourceComponent: Window {
+            id: separateColorMappingSettingsWindow
+            property alias settingsLoader: separateColorMappingSettingsLoader
+            visible: useSeparateStreamSettingsWindows && colorMappingSettingsRect.opacity > 0.0
+            transientParent: Chiaki.window
+            flags: Qt.Dialog | Qt.FramelessWindowHint
+            color: Material.background
+            modality: Qt.NonModal
+            x: Math.round(root.mapToGlobal(0, 0).x)
+            y: Math.round(root.mapToGlobal(0, 0).y)
+            width: Math.round(root.width)
+            height: Math.min(Math.round(root.height), 600)
+            onVisibleChanged: if (visible) requestActivate()
+
+            Shortcut {
+                sequence: "Ctrl+O"
+                onActivated: root.closeDialog()
+            }
 
-        Shortcut {
-            sequence: StandardKey.Cancel
-            onActivated: root.closeDialog()
-        }
+            Shortcut {
+                sequence: StandardKey.Cancel
+                onActivated: root.closeDialog()
+            }
 
-        Loader {
-            anchors.fill: parent
-            id: separateColorMappingSettingsLoader
-            sourceComponent: placeboColorMappingDialogComponent
+            Loader {
+                anchors.fill: parent
+                id: separateColorMappingSettingsLoader
+                sourceComponent: placeboColorMappingDialogComponent
+                active: false
+            }
         }
     }
     Rectangle {
@@ -454,69 +489,77 @@ Item {
         }
     }
 
-    Dialog {
-        id: infoDialog
-        property alias text: infoDialogLabel.text
-        property Item restoreFocusItem
-        parent: Overlay.overlay
-        x: Math.round((root.width - width) / 2)
-        y: Math.round((root.height - height) / 2)
-        modal: true
-        Material.roundedScale: Material.MediumScale
-        onOpened: infoDialogLabel.forceActiveFocus(Qt.TabFocusReason)
-        onClosed: {
-            if (restoreFocusItem)
-                restoreFocusItem.forceActiveFocus(Qt.TabFocusReason);
-            infoDialogLabel.focus = false;
-        }
-
-        Component.onCompleted: {
-            header.horizontalAlignment = Text.AlignHCenter;
-            header.background = null;
-        }
-
-        ColumnLayout {
-            spacing: 20
+    Loader {
+        id: infoDialogLoader
+        active: false
+        sourceComponent: Dialog {
+            id: infoDialog
+            property alias text: infoDialogLabel.text
+            property Item restoreFocusItem
+            parent: Overlay.overlay
+            x: Math.round((root.width - width) / 2)
+            y: Math.round((root.height - height) / 2)
+            modal: true
+            Material.roundedScale: Material.MediumScale
+            onOpened: infoDialogLabel.forceActiveFocus(Qt.TabFocusReason)
+            onClosed: {
+                if (restoreFocusItem)
+                    restoreFocusItem.forceActiveFocus(Qt.TabFocusReason);
+                infoDialogLabel.focus = false;
+            }
 
-            Label {
-                id: infoDialogLabel
-                Keys.onEscapePressed: infoDialog.close()
-                Keys.onReturnPressed: infoDialog.close()
+            Component.onCompleted: {
+                header.horizontalAlignment = Text.AlignHCenter;
+                header.background = null;
             }
 
-            RowLayout {
-                Layout.alignment: Qt.AlignCenter
+            ColumnLayout {
+                spacing: 20
 
-                Button {
-                    text: qsTr("OK")
-                    Material.background: Material.accent
-                    flat: true
-                    leftPadding: 50
-                    onClicked: infoDialog.close()
-                    Material.roundedScale: Material.SmallScale
-
-                    Image {
-                        anchors {
-                            left: parent.left
-                            verticalCenter: parent.verticalCenter
-                            leftMargin: 12
+                Label {
+                    id: infoDialogLabel
+                    Keys.onEscapePressed: infoDialog.close()
+                    Keys.onReturnPressed: infoDialog.close()
+                }
+
+                RowLayout {
+                    Layout.alignment: Qt.AlignCenter
+
+                    Button {
+                        text: qsTr("OK")
+                        Material.background: Material.accent
+                        flat: true
+                        leftPadding: 50
+                        onClicked: infoDialog.close()
+                        Material.roundedScale: Material.SmallScale
+
+                        Image {
+                            anchors {
+                                left: parent.left
+                                verticalCenter: parent.verticalCenter
+                                leftMargin: 12
+                            }
+                            width: 28
+                            height: 28
+                            sourceSize: Qt.size(width, height)
+                            source: root.controllerButton("cross")
                         }
-                        width: 28
-                        height: 28
-                        sourceSize: Qt.size(width, height)
-                        source: root.controllerButton("cross")
                     }
                 }
             }
         }
     }
 
-    ConfirmDialog {
-        id: confirmDialog
+    Loader {
+        id: confirmDialogLoader
+        active: false
+        sourceComponent: ConfirmDialog { }
     }
 
-    RemindDialog {
-        id: remindDialog
+    Loader {
+        id: remindDialogLoader
+        active: false
+        sourceComponent: RemindDialog { }
     }
 
     Connections {
@@ -556,10 +599,6 @@ Item {
                     root.showConfirmDialog(qsTr("Registration Type"), qsTr("Would you like to use automatic registration (must be main PS4 console registered to your PSN)?"), () => root.autoRegister(true, host, ps5), () => root.autoRegister(false, host, ps5))
             }
         }
-
-        function onWakeupStartInitiated() {
-            stack.replace(stack.get(0), autoConnectViewComponent, {}, StackView.Immediate);
-        }
     }
 
     Component {
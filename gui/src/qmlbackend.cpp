@@ -216,7 +216,6 @@ static bool frame_can_use_direct_render(const AVFrame *frame, bool use_opengl_re
 #define MAX_PSN_RECONNECT_TRIES 6
 #define PSN_INTERNET_WAIT_SECONDS 5
 #define WAKEUP_PSN_IGNORE_SECONDS 10
-#define WAKEUP_WAIT_SECONDS 25
 static QMutex chiaki_log_mutex;
 static ChiakiLog *chiaki_log_ctx = nullptr;
 static QtMessageHandler qt_msg_handler = nullptr;
@@ -299,6 +298,7 @@ QmlBackend::QmlBackend(Settings *settings, QmlMainWindow *window)
     frame_thread->setObjectName("frame");
     frame_thread->start();
     frame_obj->moveToThread(frame_thread);
+    chiaki_hw_frame_transfer_init(&hw_transfer, nullptr, true);
 
     PsnConnectionWorker *worker = new PsnConnectionWorker;
     worker->moveToThread(&psn_connection_thread);
@@ -350,8 +350,6 @@ QmlBackend::QmlBackend(Settings *settings, QmlMainWindow *window)
     psn_auto_connect_timer->setSingleShot(true);
     psn_reconnect_tries = 0;
     psn_reconnect_timer = new QTimer(this);
-    wakeup_start_timer = new QTimer(this);
-    wakeup_start_timer->setSingleShot(true);
     if(autoConnect() && !auto_connect_nickname.isEmpty())
     {
         connect(psn_auto_connect_timer, &QTimer::timeout, this, [this]
@@ -408,10 +406,6 @@ QmlBackend::QmlBackend(Settings *settings, QmlMainWindow *window)
         QString refresh_token = this->settings->GetPsnRefreshToken();
         psnToken->RefreshPsnToken(std::move(refresh_token));
     });
-    connect(wakeup_start_timer, &QTimer::timeout, this, [this]
-    {
-        emit wakeupStartFailed();
-    });
     psn_auto_connect_timer->start(PSN_INTERNET_WAIT_SECONDS * 1000);
     sleep_inhibit = new SystemdInhibit(QGuiApplication::applicationName(), tr("Remote Play session"), "sleep", "delay", this);
     connect(sleep_inhibit, &SystemdInhibit::sleep, this, &QmlBackend::goToSleep);
@@ -445,44 +439,71 @@ bool QmlBackend::prepareFrameForPresentation(ChiakiFfmpegFrame &frame, bool use_
         return frame_has_planes(frame.frame);
 
     const int format = frame.frame->format;
+    bool should_log_format = false;
     {
         QMutexLocker locker(&hw_transfer_state_mutex);
+        hw_transfer_busy = true;
         if (!logged_hw_transfer_formats.contains(format)) {
             logged_hw_transfer_formats.insert(format);
-            const char *format_name = av_get_pix_fmt_name(static_cast<AVPixelFormat>(format));
-            qCInfo(chiakiGui) << "Transferring hardware-decoded frames to software for presentation:"
-                              << (format_name ? format_name : "unknown");
+            should_log_format = true;
         }
     }
+    if (should_log_format) {
+        const char *format_name = av_get_pix_fmt_name(static_cast<AVPixelFormat>(format));
+        qCInfo(chiakiGui) << "Transferring hardware-decoded frames to software for presentation:"
+                          << (format_name ? format_name : "unknown");
+    }
 
-    AVFrame *sw_frame = av_frame_alloc();
-    if (!sw_frame)
-        return false;
+    // pooled buffers or a mapping of the surface, instead of a new frame every time.
+    // Runs without the mutex, so the session lifecycle never waits for a download.
+    ChiakiErrorCode err = chiaki_hw_frame_transfer_download(&hw_transfer, &frame.frame);
 
-    if (av_hwframe_transfer_data(sw_frame, frame.frame, 0) < 0) {
-        bool should_log_failure = false;
-        {
-            QMutexLocker locker(&hw_transfer_state_mutex);
-            if (!logged_hw_transfer_failures.contains(format)) {
-                logged_hw_transfer_failures.insert(format);
-                should_log_failure = true;
-            }
+    bool should_log_failure = false;
+    {
+        QMutexLocker locker(&hw_transfer_state_mutex);
+        hw_transfer_busy = false;
+        if (hw_transfer_reset_pending)
+            applyHwTransferResetLocked();
+        hw_transfer_stats = hw_transfer.stats;
+        if (err != CHIAKI_ERR_SUCCESS && !logged_hw_transfer_failures.contains(format)) {
+            logged_hw_transfer_failures.insert(format);
+            should_log_failure = true;
         }
+    }
+    if (err != CHIAKI_ERR_SUCCESS) {
         if (should_log_failure) {
             const char *format_name = av_get_pix_fmt_name(static_cast<AVPixelFormat>(format));
             qCWarning(chiakiGui) << "Failed to transfer hardware frame for presentation:"
                                  << (format_name ? format_name : "unknown");
         }
-        av_frame_free(&sw_frame);
         return false;
     }
-
-    av_frame_copy_props(sw_frame, frame.frame);
-    av_frame_free(&frame.frame);
-    frame.frame = sw_frame;
     return frame_has_planes(frame.frame);
 }
 
+void QmlBackend::resetHwTransferLocked(ChiakiLog *log, bool allow_map, bool clear_stats)
+{
+    hw_transfer_reset_log = log;
+    hw_transfer_reset_allow_map = allow_map;
+    hw_transfer_reset_stats = hw_transfer_reset_stats || clear_stats;
+    hw_transfer_reset_pending = true;
+    if (clear_stats)
+        memset(&hw_transfer_stats, 0, sizeof(hw_transfer_stats));
+    // otherwise the frame thread applies it once its download is done
+    if (!hw_transfer_busy)
+        applyHwTransferResetLocked();
+}
+
+void QmlBackend::applyHwTransferResetLocked()
+{
+    chiaki_hw_frame_transfer_reset(&hw_transfer, hw_transfer_reset_log, hw_transfer_reset_allow_map);
+    if (hw_transfer_reset_stats)
+        memset(&hw_transfer.stats, 0, sizeof(hw_transfer.stats));
+    hw_transfer_stats = hw_transfer.stats;
+    hw_transfer_reset_pending = false;
+    hw_transfer_reset_stats = false;
+}
+
 QmlBackend::~QmlBackend()
 {
     if(session)
@@ -500,6 +521,7 @@ QmlBackend::~QmlBackend()
     frame_thread->quit();
     frame_thread->wait();
     frame_thread->parent()->deleteLater();
+    chiaki_hw_frame_transfer_fini(&hw_transfer);
     psn_connection_thread.quit();
     psn_connection_thread.wait();
 }
@@ -1103,6 +1125,10 @@ void QmlBackend::createSession(const StreamSessionConnectInfo &connect_info)
         emit error(tr("Stream failed"), tr("Failed to initialize Stream Session: %1").arg(e.what()));
         return;
     }
+    {
+        QMutexLocker locker(&hw_transfer_state_mutex);
+        resetHwTransferLocked(session->GetChiakiLog(), !disable_zero_copy, true);
+    }
 
     connect(session, &StreamSession::FfmpegFrameAvailable, frame_thread->parent(), [this, use_opengl_renderer]() {
         ChiakiFfmpegDecoder *decoder = session->GetFfmpegDecoder();
@@ -1163,6 +1189,18 @@ void QmlBackend::createSession(const StreamSessionConnectInfo &connect_info)
             QMutexLocker locker(&hw_transfer_state_mutex);
             logged_hw_transfer_formats.clear();
             logged_hw_transfer_failures.clear();
+            const ChiakiHwFrameTransferStats &stats = hw_transfer_stats;
+            const uint64_t downloads = stats.mapped + stats.copied;
+            if (downloads || stats.failed) {
+                qCInfo(chiakiGui).nospace()
+                    << "Hardware frame downloads: mapped=" << stats.mapped
+                    << " copied=" << stats.copied
+                    << " failed=" << stats.failed
+                    << " pool_allocs=" << stats.pool_allocs
+                    << " avg_us=" << (downloads ? stats.download_us_total / downloads : 0)
+                    << " max_us=" << stats.download_us_max;
+            }
+            resetHwTransferLocked(nullptr, true, false);
         }
 
         session_for_connections->deleteLater();
@@ -1213,17 +1251,7 @@ void QmlBackend::createSession(const StreamSessionConnectInfo &connect_info)
 
     if(connect_info.duid.isEmpty())
     {
-        if(!wakeup_nickname.isEmpty())
-        {
-            wakeup_start = true;
-            wakeup_start_timer->start(WAKEUP_WAIT_SECONDS * 1000);
-            emit wakeupStartInitiated();
-            QTimer::singleShot(0, this, &QmlBackend::updateDiscoveryHosts);
-        }
-        else
-        {
-            startSession(true);
-        }
+        startSession(true);
     }
     else
     {
@@ -1527,28 +1555,15 @@ void QmlBackend::connectToHost(int index, QString nickname)
         return;
     }
 
-    if (server.discovered && server.discovery_host.state == CHIAKI_DISCOVERY_HOST_STATE_STANDBY)
+    // the session wakes the console itself and requests the stream as soon as it is up
+    const bool wakeup = server.discovered && server.discovery_host.state == CHIAKI_DISCOVERY_HOST_STATE_STANDBY;
+    if (wakeup && !nickname.isEmpty())
     {
-        const QString wake_host = server.GetHostAddr();
-        const QByteArray wake_regist_key = server.registered_host.GetRPRegistKey();
-        const bool wake_ps5 = server.IsPS5();
-        if(!sendWakeup(wake_host, wake_regist_key, wake_ps5))
-        {
-            qCWarning(chiakiGui) << "Couldn't wakeup server";
-            window->setWindowAdjustable(true);
-            return;
-        }
-        if(nickname.isEmpty())
-        {
-            qCWarning(chiakiGui) << "No nickname given for registered connection, not connecting...";
-            return;
-        }
         waking_sleeping_nicknames.append(nickname);
         QTimer::singleShot(WAKEUP_PSN_IGNORE_SECONDS * 1000, [this, nickname]{
             waking_sleeping_nicknames.removeOne(nickname);
             emit hostsChanged();
         });
-        wakeup_nickname = nickname;
     }
 
     bool fullscreen = false, zoom = false, stretch = false;
@@ -1590,6 +1605,7 @@ void QmlBackend::connectToHost(int index, QString nickname)
                 fullscreen,
                 zoom,
                 stretch);
+        info.wakeup = wakeup;
         createSession(info);
     }
     else
@@ -1712,21 +1728,6 @@ bool QmlBackend::handlePsnLoginRedirect(const QUrl &url)
 void QmlBackend::stopAutoConnect()
 {
     auto_connect_mac = {};
-    if(!wakeup_nickname.isEmpty())
-    {
-        wakeup_start_timer->stop();
-        wakeup_nickname.clear();
-        if(wakeup_start)
-        {
-            wakeup_start = false;
-            chiaki_log_mutex.lock();
-            chiaki_log_ctx = nullptr;
-            chiaki_log_mutex.unlock();
-
-            session->deleteLater();
-            session = nullptr;
-        }
-    }
     emit autoConnectChanged();
 }
 
@@ -2327,18 +2328,11 @@ void QmlBackend::updateDiscoveryHosts()
             continue;
         auto registered = settings->GetRegisteredHost(host.GetHostMAC());
         if (registered.GetRPRegistKey() == session_info.regist_key) {
-            if(wakeup_start && session && host.host_name == wakeup_nickname && host.state == CHIAKI_DISCOVERY_HOST_STATE_READY)
-            {
-                wakeup_nickname.clear();
-                wakeup_start = false;
-                wakeup_start_timer->stop();
-                startSession(true);
-            }
-            else if(host.state == CHIAKI_DISCOVERY_HOST_STATE_STANDBY && session && session->IsConnecting())
+            // sessions started with wakeup send their own wakeup packets
+            if(host.state == CHIAKI_DISCOVERY_HOST_STATE_STANDBY && session && session->IsConnecting() && !session_info.wakeup)
             {
                 sendWakeup(host.host_addr, registered.GetRPRegistKey(), host.ps5);
                 QString nickname = host.host_name;
-                wakeup_nickname = nickname;
                 waking_sleeping_nicknames.append(nickname);
                 QTimer::singleShot(WAKEUP_PSN_IGNORE_SECONDS * 1000, [this, nickname]{
                     waking_sleeping_nicknames.removeOne(nickname);
@@ -4,6 +4,7 @@
 #include "chiaki/log.h"
 #include "chiaki/time.h"
 #include "streamsession.h"
+#include "startuptimer.h"
 
 #include <qpa/qplatformnativeinterface.h>
 
@@ -48,6 +49,7 @@ extern "C" {
 #include <QQuickRenderControl>
 #include <QQuickGraphicsDevice>
 #include <QTimer>
+#include <QtConcurrentRun>
 #include <QWaitCondition>
 #include <QProcess>
 #include <QProcessEnvironment>
@@ -963,8 +965,6 @@ static void logDeferredPresentDecision(qint64 now_us,
     }
 }
 
-// Estimated submit+swap cost (microseconds) used to compensate throttle sleeps.
-static std::atomic<long long> g_submit_swap_est_us{1500LL};
 static const long long g_submit_swap_spin_margin_us = 1500LL;
 
 static void logDeferredTimerWakeup(qint64 timer_fire_us,
@@ -2456,6 +2456,30 @@ static const struct pl_hook *select_spatial_hook(QmlMainWindow::VideoPreset pres
     }
 }
 
+void QmlMainWindow::loadSpatialHooks(VideoPreset preset, PlaceboUpscaler upscaler)
+{
+    // parsing the FSRCNNX shaders is slow, so they are only loaded once a stream actually upscales with them
+    const bool custom = preset == VideoPreset::Custom;
+    const bool need_fsr = preset == VideoPreset::HighQualitySpatial
+        || preset == VideoPreset::HighQualityAdvancedSpatial
+        || (custom && uses_custom_upscale_hook(upscaler));
+    const bool need_8 = preset == VideoPreset::HighQualitySpatial || (custom && upscaler == PlaceboUpscaler::FSRCNNX8);
+    const bool need_16 = preset == VideoPreset::HighQualityAdvancedSpatial || (custom && upscaler == PlaceboUpscaler::FSRCNNX16);
+
+    if (need_fsr && !fsr_hook_loaded) {
+        fsr_hook = load_mpv_hook(placeboGpu(), QStringLiteral(":/shaders/FSR.glsl"));
+        fsr_hook_loaded = true;
+    }
+    if (need_8 && !fsrcnnx_hook_8_loaded) {
+        fsrcnnx_hook_8 = load_mpv_hook(placeboGpu(), QStringLiteral(":/shaders/FSRCNNX_x2_8-0-4-1.glsl"));
+        fsrcnnx_hook_8_loaded = true;
+    }
+    if (need_16 && !fsrcnnx_hook_16_loaded) {
+        fsrcnnx_hook_16 = load_mpv_hook(placeboGpu(), QStringLiteral(":/shaders/FSRCNNX_x2_16-0-4-1.glsl"));
+        fsrcnnx_hook_16_loaded = true;
+    }
+}
+
 static void clearQuickOpenGLTarget(QOpenGLFramebufferObject *fbo)
 {
     if (!fbo)
@@ -2639,6 +2663,7 @@ QmlMainWindow::~QmlMainWindow()
         delete render_thread->parent();
     delete qml_engine;
 
+    shader_cache_load.waitForFinished();
     FILE *file = fopen(qPrintable(shader_cache_path()), "wb");
     if (file) {
         pl_cache_save_file(placebo_cache, file);
@@ -2870,6 +2895,7 @@ void QmlMainWindow::show()
         QMetaObject::invokeMethod(QGuiApplication::instance(), &QGuiApplication::quit, Qt::QueuedConnection);
         return;
     }
+    StartupTimer::Phase("main qml");
     if (!pending_renderer_fallback_reason.isEmpty()) {
         const QString reason = pending_renderer_fallback_reason;
         pending_renderer_fallback_reason.clear();
@@ -2895,8 +2921,6 @@ void QmlMainWindow::show()
 }
 
 namespace {
-constexpr int kDefaultQueueDepthLimit = 2;
-
 constexpr double kPtsStaleMarginS = 0.0005; // 500 µs
 
 static const struct pl_filter_config *frame_mixer_config(Settings *settings)
@@ -3086,7 +3110,6 @@ void QmlMainWindow::presentFrame(ChiakiFfmpegFrame frame, int32_t frames_lost, q
     const int submission_depth_limit = depth_limit;
     bool queued = false;
     bool depth_exceeded = false;
-    bool promote_pending = false;
     const bool render_busy = render_active.loadAcquire() != 0;
     bool render_scheduled_now = false;
     bool render_pending_now = false;
@@ -3103,56 +3126,22 @@ void QmlMainWindow::presentFrame(ChiakiFfmpegFrame frame, int32_t frames_lost, q
                pending_frame_present.loadAcquire() == 0;
     }();
     const bool render_pipeline_busy = render_busy || render_scheduled_now || render_pending_now;
-    AVFrame *promoted_frame = nullptr;
-    double promoted_pts = 0.0;
-    float promoted_duration = 0.0f;
-    double promoted_queue_origin = 0.0;
-    bool promoted_deinterlace_enabled = false;
-    qint64 promoted_age_us = -1;
     int queue_depth_snapshot = -1;
     bool pending_exists_snapshot = false;
-    bool promote_eligible_snapshot = false;
     bool has_capacity_snapshot = false;
     qint64 idle_gap_us_snapshot = -1;
     {
         QMutexLocker locker(&placebo_state_mutex);
         const int depth = pl_queue_num_frames(placebo_queue);
         queue_depth_snapshot = depth;
+        // Frames are shown in order. While earlier ones wait in the frame pacer this one has to
+        // wait behind them, and the pacer decides on the next refresh which of them is shown.
         const bool pending_exists = pending_frame_present.loadAcquire() != 0 || pending_submission_active;
         pending_exists_snapshot = pending_exists;
-        const int tolerated_depth = submission_depth_limit + (pending_exists ? 1 : 0);
-        depth_exceeded = depth >= tolerated_depth;
-        has_capacity_snapshot = depth < submission_depth_limit;
-        promote_eligible_snapshot = !render_pipeline_busy && pending_exists && has_capacity_snapshot;
+        depth_exceeded = depth >= submission_depth_limit;
+        has_capacity_snapshot = !depth_exceeded;
         updateQueueDepthAverage(depth);
-        if (promote_eligible_snapshot) {
-            QMutexLocker pending_locker(&pending_frame_mutex);
-            PendingFrameEntry promoted_entry;
-            if (takePendingFrameLocked(promoted_entry)) {
-                promote_pending = true;
-                promoted_frame = promoted_entry.frame;
-                promoted_pts = promoted_entry.pts;
-                promoted_duration = promoted_entry.duration;
-                promoted_queue_origin = promoted_entry.queue_origin;
-                promoted_deinterlace_enabled = deinterlace_enabled;
-                promoted_age_us = promoted_entry.stored_us > 0
-                    ? static_cast<qint64>(chiaki_time_now_monotonic_us()) - static_cast<qint64>(promoted_entry.stored_us)
-                    : -1;
-                const bool pending_now = pending_frame != nullptr;
-
-                logPendingFrameTransition("promoted_clear",
-                                          pending_now,
-                                          promoted_pts,
-                                          promoted_age_us,
-                                          depth,
-                                          submission_depth_limit,
-                                          render_busy,
-                                          render_scheduled_now,
-                                          render_pending_now,
-                                          false);
-            }
-        }
-        if (!depth_exceeded && !promote_pending && !pending_exists)
+        if (!depth_exceeded && !pending_exists)
         {
             const qint64 push_begin_us = static_cast<qint64>(chiaki_time_now_monotonic_us());
             pl_queue_push(placebo_queue, &src_frame);
@@ -3173,9 +3162,9 @@ void QmlMainWindow::presentFrame(ChiakiFfmpegFrame frame, int32_t frames_lost, q
         idle_gap_us_snapshot = idle_us > 0 ? qMax<qint64>(0, now_us - idle_us) : -1;
     }
 
-    if (pending_exists_snapshot && !promote_eligible_snapshot) {
+    if (pending_exists_snapshot) {
         const char *gate_reason = render_pipeline_busy ? "render_busy"
-                                              : (!has_capacity_snapshot ? "queue_full" : "promotion_window");
+                                              : (!has_capacity_snapshot ? "queue_full" : "frame_pacer");
         qint64 blocked_age_us = -1;
         double blocked_pts = 0.0;
         float blocked_duration = 0.0f;
@@ -3195,90 +3184,35 @@ void QmlMainWindow::presentFrame(ChiakiFfmpegFrame frame, int32_t frames_lost, q
                                  blocked_age_us,
                                  idle_gap_us_snapshot,
                                  queue_depth_snapshot,
-                                                                 submission_depth_limit,
-                                   render_pipeline_busy,
+                                 submission_depth_limit,
+                                 render_pipeline_busy,
                                  has_capacity_snapshot);
         logPendingFrameGate("blocked",
                             gate_reason,
                             blocked_pts,
                             blocked_age_us,
                             queue_depth_snapshot,
-                                     submission_depth_limit,
-                               render_pipeline_busy,
+                            submission_depth_limit,
+                            render_pipeline_busy,
                             render_scheduled_now,
                             render_pending_now,
                             pending_exists_snapshot,
                             has_capacity_snapshot);
     }
-    bool promoted_frame_queued = false;
-    if (promote_pending) {
-        if (promoted_frame) {
-            struct pl_source_frame promoted_src_frame = {
-                .pts = promoted_pts - promoted_queue_origin,
-                .duration = promoted_duration,
-                .first_field = promoted_deinterlace_enabled
-                    ? pl_field_from_avframe(promoted_frame)
-                    : PL_FIELD_NONE,
-                .frame_data = promoted_frame,
-                .map = map_frame,
-                .unmap = unmap_frame,
-                .discard = discard_frame,
-            };
-            {
-                QMutexLocker locker(&placebo_state_mutex);
-                {
-                    const qint64 push_begin_us = static_cast<qint64>(chiaki_time_now_monotonic_us());
-                    pl_queue_push(placebo_queue, &promoted_src_frame);
-                    const qint64 push_end_us = static_cast<qint64>(chiaki_time_now_monotonic_us());
-                    queue_depth_cached.storeRelease(pl_queue_num_frames(placebo_queue));
-                    logLatencyStats("pl_queue_push", push_end_us - push_begin_us);
-                    CHIAKI_NOISY_DEBUG().nospace()
-                        << "[latency] pl_queue_push_promoted_us=" << (push_end_us - push_begin_us)
-                        << " queue_depth=" << pl_queue_num_frames(placebo_queue);
-                    newest_queued_frame_pts = qMax(newest_queued_frame_pts, promoted_pts);
-                    // Record that a promoted frame was queued so scheduling
-                    // fires even when render pipeline is busy.  Do NOT set
-                    // queued/queued_after_promotion here — the current frame
-                    // still needs to go through the storage/free path below.
-                    promoted_frame_queued = true;
-                }
-            }
-            logPendingFrameLifecycle("promoted",
-                                     promoted_pts,
-                                     promoted_duration,
-                                     promoted_age_us,
-                                     idle_gap_us_snapshot,
-                                     queue_depth_snapshot,
-                                     submission_depth_limit,
-                                     render_busy,
-                                     true);
-        }
-        if (storePendingFrame(frame, true, synthetic_warmup_frame)) {
-            snapshotPendingFrame();
-            armStartupVisibility();
-        }
-        if (frame.frame)
-            av_frame_free(&frame.frame);
-        // Schedule even when render pipeline is busy: a promoted frame
-        // was just queued so we must re-arm to consume it.
-        if (should_rearm_stored_frame || promoted_frame_queued)
-            scheduleUpdate(false, UpdateRequestReason::QueueStoredFrame);
-        return;
-    }
     if (!queued)
-        {
-            const char *gate_reason = pending_exists_snapshot ? "pending_exists" : (depth_exceeded ? "queue_full" : "not_queued");
-            logPendingFrameGate("store_pending",
-                                gate_reason,
+    {
+        const char *gate_reason = pending_exists_snapshot ? "pending_exists" : (depth_exceeded ? "queue_full" : "not_queued");
+        logPendingFrameGate("store_pending",
+                            gate_reason,
                             frame.pts,
                             -1,
                             queue_depth_snapshot,
                             submission_depth_limit,
                             render_busy,
                             render_scheduled_now,
-                                render_pending_now,
-                                pending_exists_snapshot,
-                                has_capacity_snapshot);
+                            render_pending_now,
+                            pending_exists_snapshot,
+                            has_capacity_snapshot);
         const quint64 reset_seed_generation = reset_seed_capture_generation.loadAcquire();
         if (reset_seed_capture_active.loadAcquire() != 0 && reset_seed_generation != 0)
             storeResetSeedFrame(frame.frame, frame.pts, frame.duration, reset_seed_generation);
@@ -3293,46 +3227,6 @@ void QmlMainWindow::presentFrame(ChiakiFfmpegFrame frame, int32_t frames_lost, q
         return;
     }
 
-    bool dropped_stale_pending = false;
-    {
-        QMutexLocker locker(&pending_frame_mutex);
-        while (pending_frame && pending_pts <= frame.pts + 1e-6) {
-            const double dropped_pts = pending_pts;
-            const qint64 dropped_age_us = pending_frame_stored_us > 0
-                ? static_cast<qint64>(chiaki_time_now_monotonic_us()) - static_cast<qint64>(pending_frame_stored_us)
-                : -1;
-            logDroppedFrameReason("stale_pending_frame", static_cast<qint64>(chiaki_time_now_monotonic_us()), dropped_pts,
-                                  "replaced by newer direct queue submission");
-            bool render_scheduled_now = false;
-            bool render_pending_now = false;
-            {
-                QMutexLocker schedule_locker(&render_schedule_mutex);
-                render_scheduled_now = render_scheduled;
-                render_pending_now = render_pending;
-            }
-            qCInfo(chiakiGui)
-                << "Dropping stale pending frame after newer direct queue submission"
-                << "pending_pts=" << dropped_pts
-                << "queued_pts=" << frame.pts;
-            increaseDroppedFrames();
-            dropPendingFrameLocked();
-            const bool pending_now = pending_frame != nullptr;
-            logPendingFrameTransition("stale_clear",
-                                      pending_now,
-                                      dropped_pts,
-                                      dropped_age_us,
-                                      queue_depth_snapshot,
-                                      submission_depth_limit,
-                                      render_active.loadAcquire() != 0,
-                                      render_scheduled_now,
-                                      render_pending_now,
-                                      false);
-            dropped_stale_pending = true;
-        }
-    }
-    if (dropped_stale_pending)
-        refreshPendingFrameAge();
-
     if (!synthetic_warmup_frame) {
         {
             const quint64 reset_seed_generation = reset_seed_capture_generation.loadAcquire();
@@ -3353,10 +3247,8 @@ void QmlMainWindow::presentFrame(ChiakiFfmpegFrame frame, int32_t frames_lost, q
     }
 
     armStartupVisibility();
-    if (queued) {
-        if (should_rearm_stored_frame || promoted_frame_queued)
-            scheduleUpdate(false, UpdateRequestReason::QueueStoredFrame);
-    }
+    if (should_rearm_stored_frame)
+        scheduleUpdate(false, UpdateRequestReason::QueueStoredFrame);
 }
 
 void QmlMainWindow::setStreamMaxFPS(unsigned int max_fps)
@@ -3578,89 +3470,61 @@ bool QmlMainWindow::storePendingFrame(ChiakiFfmpegFrame &frame, bool take_owners
         queued_existing = pending_frame != nullptr;
 
         const uint64_t now_us = chiaki_time_now_monotonic_us();
-        const bool overflow_enabled = pendingFrameOverflowEnabled();
-        if (!overflow_enabled) {
-            while (!pending_frame_overflow.empty()) {
-                PendingFrameEntry dropped = std::move(pending_frame_overflow.front());
-                pending_frame_overflow.pop_front();
-                if (dropped.frame) {
-                    logDroppedFrameReason("pending_overflow_disabled_drop", static_cast<qint64>(now_us), dropped.pts,
-                                          "overflow disabled");
-                    increaseDroppedFrames();
-                    av_frame_free(&dropped.frame);
-                }
+        if (pending_frame && pending_frame_synthetic_warmup && !synthetic_warmup) {
+            dropPendingFrameLocked();
+            replaced_existing = true;
+        }
+        if (pending_frame && !synthetic_warmup) {
+            const double newest_pending_pts = pending_frame_overflow.empty()
+                ? pending_pts
+                : pending_frame_overflow.back().pts;
+            if (frame.pts <= newest_pending_pts + 1e-6) {
+                logDroppedFrameReason("stale_pending_reject", static_cast<qint64>(chiaki_time_now_monotonic_us()), frame.pts,
+                                      "before pending insert");
+                qCInfo(chiakiGui)
+                    << "Dropping stale pending frame before overflow insert"
+                    << "frame_pts=" << frame.pts
+                    << "newest_pending_pts=" << newest_pending_pts;
+                increaseDroppedFrames();
+                av_frame_free(&stored_frame);
+                if (take_ownership)
+                    frame.frame = nullptr;
+                if (have_state_lock)
+                    placebo_state_mutex.unlock();
+                return false;
+            }
+        }
+
+        // Synthetic warmup frames are placeholders outside of the stream timing and bypass the pacer.
+        uint64_t pacer_id = 0;
+        if (!synthetic_warmup) {
+            pacer_id = frame_pacer_next_id++;
+            const uint64_t pts_us = frame.pts > 0.0 ? static_cast<uint64_t>(frame.pts * 1000000.0) : 0;
+            ChiakiFramePacerFrame dropped;
+            if (chiaki_frame_pacer_push(&frame_pacer, pacer_id, pts_us, &dropped)) {
+                dropPacedPendingFrameLocked(dropped.id);
+                replaced_existing = true;
             }
         }
 
         if (!pending_frame) {
             pending_frame = stored_frame;
+            pending_frame_pacer_id = pacer_id;
             pending_frame_synthetic_warmup = synthetic_warmup;
             pending_pts = frame.pts;
             pending_duration = frame.duration;
             pending_frame_queue_origin = queue_origin;
             pending_frame_stored_us = now_us;
         } else {
-            if (pending_frame_synthetic_warmup && !synthetic_warmup) {
-                av_frame_free(&pending_frame);
-                pending_frame = stored_frame;
-                pending_frame_synthetic_warmup = false;
-                pending_pts = frame.pts;
-                pending_duration = frame.duration;
-                pending_frame_queue_origin = queue_origin;
-                pending_frame_stored_us = now_us;
-                replaced_existing = true;
-            } else {
-                const size_t overflow_limit = static_cast<size_t>(pendingFrameOverflowLimit(submission_depth_limit));
-                const double newest_pending_pts = pending_frame_overflow.empty()
-                    ? pending_pts
-                    : pending_frame_overflow.back().pts;
-                if (frame.pts <= newest_pending_pts + 1e-6) {
-                    logDroppedFrameReason("stale_pending_reject", static_cast<qint64>(chiaki_time_now_monotonic_us()), frame.pts,
-                                          "before pending insert");
-                    qCInfo(chiakiGui)
-                        << "Dropping stale pending frame before overflow insert"
-                        << "frame_pts=" << frame.pts
-                        << "newest_pending_pts=" << newest_pending_pts;
-                    increaseDroppedFrames();
-                    av_frame_free(&stored_frame);
-                    if (take_ownership)
-                        frame.frame = nullptr;
-                    return false;
-                }
-                if (overflow_limit == 0) {
-                    logDroppedFrameReason("pending_overflow_disabled_replace", static_cast<qint64>(chiaki_time_now_monotonic_us()), pending_pts,
-                                          "overflow disabled");
-                    increaseDroppedFrames();
-                    av_frame_free(&pending_frame);
-                    pending_frame = stored_frame;
-                    pending_frame_synthetic_warmup = synthetic_warmup;
-                    pending_pts = frame.pts;
-                    pending_duration = frame.duration;
-                    pending_frame_queue_origin = queue_origin;
-                    pending_frame_stored_us = now_us;
-                    replaced_existing = true;
-                } else {
-                    if (pending_frame_overflow.size() >= overflow_limit) {
-                        PendingFrameEntry dropped = std::move(pending_frame_overflow.front());
-                        pending_frame_overflow.pop_front();
-                        if (dropped.frame) {
-                            logDroppedFrameReason("pending_overflow_evict", static_cast<qint64>(chiaki_time_now_monotonic_us()), dropped.pts,
-                                                  "overflow queue full");
-                            increaseDroppedFrames();
-                            av_frame_free(&dropped.frame);
-                        }
-                    }
-                    insertPendingOverflowLocked({
-                        stored_frame,
-                        frame.pts,
-                        static_cast<float>(frame.duration),
-                        queue_origin,
-                        now_us,
-                        synthetic_warmup,
-                    });
-                    replaced_existing = true;
-                }
-            }
+            insertPendingOverflowLocked({
+                stored_frame,
+                frame.pts,
+                static_cast<float>(frame.duration),
+                queue_origin,
+                now_us,
+                synthetic_warmup,
+                pacer_id,
+            });
         }
 
         pending_frame_present.storeRelease(1);
@@ -3821,6 +3685,7 @@ void QmlMainWindow::clearPendingFrameStateLocked()
 {
     if (pending_frame)
         av_frame_free(&pending_frame);
+    pending_frame_pacer_id = 0;
     pending_pts = 0.0;
     pending_duration = 0.0f;
     pending_frame_queue_origin = 0.0;
@@ -3832,6 +3697,7 @@ void QmlMainWindow::clearPendingFrameStateLocked()
         if (entry.frame)
             av_frame_free(&entry.frame);
     }
+    chiaki_frame_pacer_reset(&frame_pacer);
     pending_frame_present.storeRelease(0);
     queue_stored_frame_pending.storeRelease(0);
     pending_frame_submission_active.storeRelease(0);
@@ -3865,6 +3731,7 @@ void QmlMainWindow::prunePendingFramesBeforeLocked(double cutoff_pts)
         dropped.queue_origin = pending_frame_queue_origin;
         dropped.stored_us = pending_frame_stored_us;
         pending_frame = nullptr;
+        pending_frame_pacer_id = 0;
         pending_frame_synthetic_warmup = false;
         pending_pts = 0.0;
         pending_duration = 0.0f;
@@ -3950,6 +3817,7 @@ bool QmlMainWindow::promotePendingFrameFromOverflowLocked()
     PendingFrameEntry entry = std::move(pending_frame_overflow.front());
     pending_frame_overflow.pop_front();
     pending_frame = entry.frame;
+    pending_frame_pacer_id = entry.pacer_id;
     pending_frame_synthetic_warmup = entry.synthetic_warmup;
     pending_pts = entry.pts;
     pending_duration = entry.duration;
@@ -3977,8 +3845,10 @@ bool QmlMainWindow::takePendingFrameLocked(PendingFrameEntry &entry)
     entry.queue_origin = pending_frame_queue_origin;
     entry.stored_us = pending_frame_stored_us;
     entry.synthetic_warmup = pending_frame_synthetic_warmup;
+    entry.pacer_id = pending_frame_pacer_id;
 
     pending_frame = nullptr;
+    pending_frame_pacer_id = 0;
     pending_pts = 0.0;
     pending_duration = 0.0f;
     pending_frame_queue_origin = 0.0;
@@ -3996,6 +3866,7 @@ bool QmlMainWindow::dropPendingFrameLocked()
 {
     if (pending_frame)
         av_frame_free(&pending_frame);
+    pending_frame_pacer_id = 0;
     pending_pts = 0.0;
     pending_duration = 0.0f;
     pending_frame_queue_origin = 0.0;
@@ -4009,6 +3880,56 @@ bool QmlMainWindow::dropPendingFrameLocked()
     return promoted;
 }
 
+bool QmlMainWindow::takePacedPendingFrameLocked(PendingFrameEntry &entry)
+{
+    if (!pending_frame && !promotePendingFrameFromOverflowLocked())
+        return false;
+    // Frames outside of the pacer (synthetic warmup, or left over after a pacer reset) go out as they are.
+    if (!pending_frame_pacer_id || chiaki_frame_pacer_queued(&frame_pacer) == 0)
+        return takePendingFrameLocked(entry);
+
+    // The render loop may ask more than once per cycle, but every refresh gets a single decision.
+    const uint64_t vsync_us = static_cast<uint64_t>(last_render_entry_us.loadAcquire());
+    if (vsync_us <= frame_pacer.last_vsync_us)
+        return false;
+    ChiakiFramePacerDecision decision;
+    chiaki_frame_pacer_vsync(&frame_pacer, vsync_us, &decision);
+    if (decision.action != CHIAKI_FRAME_PACER_PRESENT)
+        return false;
+
+    const qint64 now_us = static_cast<qint64>(chiaki_time_now_monotonic_us());
+    while (pending_frame && pending_frame_pacer_id && pending_frame_pacer_id < decision.frame.id) {
+        logDroppedFrameReason("frame_pacer_skip", now_us, pending_pts, "skipped by frame pacer");
+        increaseDroppedFrames();
+        dropPendingFrameLocked();
+    }
+    // The decided frame may already be gone, e.g. pruned after a pts rollback.
+    if (!pending_frame || pending_frame_pacer_id != decision.frame.id)
+        return false;
+    return takePendingFrameLocked(entry);
+}
+
+void QmlMainWindow::dropPacedPendingFrameLocked(uint64_t pacer_id)
+{
+    const qint64 now_us = static_cast<qint64>(chiaki_time_now_monotonic_us());
+    if (pending_frame && pending_frame_pacer_id == pacer_id) {
+        logDroppedFrameReason("frame_pacer_queue_full", now_us, pending_pts, "dropped by frame pacer");
+        increaseDroppedFrames();
+        dropPendingFrameLocked();
+        return;
+    }
+    for (auto it = pending_frame_overflow.begin(); it != pending_frame_overflow.end(); ++it) {
+        if (it->pacer_id != pacer_id)
+            continue;
+        logDroppedFrameReason("frame_pacer_queue_full", now_us, it->pts, "dropped by frame pacer");
+        increaseDroppedFrames();
+        if (it->frame)
+            av_frame_free(&it->frame);
+        pending_frame_overflow.erase(it);
+        return;
+    }
+}
+
 void QmlMainWindow::snapshotLastFrame(AVFrame *frame, double pts, float duration, bool take_ownership)
 {
     // qCInfo(chiakiGui) << "snapshotLastFrame invoked pts=" << pts << " duration=" << duration;
@@ -4364,21 +4285,26 @@ bool QmlMainWindow::applyKeptFrameSnapshot()
     return queueStoredFrame(clone, pts, duration, discard_snapshot_frame);
 }
 
-void QmlMainWindow::applyPendingFrame()
+void QmlMainWindow::applyPendingFrame(bool paced)
 {
     PendingFrameEntry pending_entry;
     bool pending_still_present = false;
+    bool taken = false;
     {
         QMutexLocker locker(&pending_frame_mutex);
         pending_frame_submission_active.storeRelease(1);
-        if (!takePendingFrameLocked(pending_entry))
-        {
+        taken = paced
+            ? takePacedPendingFrameLocked(pending_entry)
+            : takePendingFrameLocked(pending_entry);
+        if (!taken)
             pending_frame_submission_active.storeRelease(0);
-            updatePendingFrameAge(0.0);
-            return;
-        }
         pending_still_present = pending_frame != nullptr;
     }
+    if (!taken) {
+        // held by the frame pacer for this refresh, or nothing pending at all
+        refreshPendingFrameAge();
+        return;
+    }
 
     bool render_scheduled_now = false;
     bool render_pending_now = false;
@@ -4469,7 +4395,7 @@ bool QmlMainWindow::applyPendingFrameIfQueueHasCapacity()
                              render_pending_now);
     if (has_capacity) {
         const qint64 apply_begin_us = static_cast<qint64>(chiaki_time_now_monotonic_us());
-        applyPendingFrame();
+        applyPendingFrame(true);
         const qint64 apply_end_us = static_cast<qint64>(chiaki_time_now_monotonic_us());
         logLatencyStats("pending_apply", apply_end_us - apply_begin_us);
         CHIAKI_NOISY_DEBUG().nospace()
@@ -4541,19 +4467,6 @@ bool QmlMainWindow::hasPendingFrameOverflow()
     return !pending_frame_overflow.empty();
 }
 
-bool QmlMainWindow::pendingFrameOverflowEnabled() const
-{
-    static const bool enabled = []() {
-        const QByteArray value = qgetenv("CHIAKI_ENABLE_PENDING_OVERFLOW");
-        if (value.isEmpty())
-            return true;
-
-        const QByteArray normalized = value.trimmed().toLower();
-        return normalized != "0" && normalized != "false" && normalized != "off";
-    }();
-    return enabled;
-}
-
 bool QmlMainWindow::hasBufferedWork()
 {
     if (queue_depth_cached.loadAcquire() > 0)
@@ -4576,32 +4489,8 @@ bool QmlMainWindow::hasBufferedWork()
 
 int QmlMainWindow::effectiveQueueDepthLimit() const
 {
-    int depth_limit = kDefaultQueueDepthLimit;
-
-    // Test hook: allow forcing queue depth via env var for quick A/B experiments.
-    const QByteArray force_depth = qgetenv("CHIAKI_TEST_QUEUE_DEPTH");
-    if (!force_depth.isEmpty()) {
-        bool ok = false;
-        const int v = force_depth.toInt(&ok);
-        if (ok && v > 0)
-            depth_limit = v;
-    }
-
     // Always use low-latency queue depth regardless of frame mixer mode.
-    return qMax(depth_limit, 2);
-}
-
-int QmlMainWindow::pendingFrameOverflowLimit(int submission_depth_limit) const
-{
-    if (!pendingFrameOverflowEnabled())
-        return 0;
-
-    // Enabled by default. Set CHIAKI_ENABLE_PENDING_OVERFLOW=0 to disable the
-    // small overflow queue behind the primary pending-frame slot. Keep this
-    // intentionally tight so it absorbs short bursts without building a long
-    // presentation backlog.
-    Q_UNUSED(submission_depth_limit);
-    return 2;
+    return qMax(static_cast<int>(frame_pacer.queue_depth_limit), 2);
 }
 
 AVBufferRef *QmlMainWindow::vulkanHwDeviceCtx()
@@ -4707,6 +4596,17 @@ void QmlMainWindow::doneOpenGLContextCurrent()
 
 void QmlMainWindow::init(Settings *settings, bool exit_app_on_stream_exit)
 {
+    // Test hook: allow forcing queue depth via env var for quick A/B experiments.
+    unsigned int queue_depth_limit = 0;
+    const QByteArray force_depth = qgetenv("CHIAKI_TEST_QUEUE_DEPTH");
+    if (!force_depth.isEmpty()) {
+        bool ok = false;
+        const int v = force_depth.toInt(&ok);
+        if (ok && v > 0)
+            queue_depth_limit = static_cast<unsigned int>(v);
+    }
+    chiaki_frame_pacer_init(&frame_pacer, nullptr, nullptr, queue_depth_limit);
+
     render_backend = settings->GetRenderBackend();
     setSurfaceType(render_backend == RenderBackend::Vulkan ? QWindow::VulkanSurface : QWindow::OpenGLSurface);
     qparams = {};
@@ -4956,17 +4856,21 @@ vulkan_setup_done:
     }
 
 renderer_backend_ready:
+    StartupTimer::Phase("renderer backend");
     struct pl_cache_params cache_params = {
         .log = placebo_log,
         .max_total_size = 10 << 20, // 10 MB
     };
     placebo_cache = pl_cache_create(&cache_params);
     pl_gpu_set_cache(placeboGpu(), placebo_cache);
-    FILE *file = fopen(qPrintable(shader_cache_path()), "rb");
-    if (file) {
-        pl_cache_load_file(placebo_cache, file);
-        fclose(file);
-    }
+    // pl_cache is thread-safe, shaders compiled before the file is read just miss the cache
+    shader_cache_load = QtConcurrent::run([cache = placebo_cache, path = shader_cache_path()]() {
+        FILE *file = fopen(qPrintable(path), "rb");
+        if (file) {
+            pl_cache_load_file(cache, file);
+            fclose(file);
+        }
+    });
 
     placebo_renderer = pl_renderer_create(
         placebo_log,
@@ -4997,6 +4901,9 @@ renderer_backend_ready:
     }
     quick_window->setColor(QColor(0, 0, 0, 0));
     connect(quick_window, &QQuickWindow::focusObjectChanged, this, &QmlMainWindow::focusObjectChanged);
+    connect(quick_window, &QQuickWindow::afterRendering, this, [this]() {
+        QMetaObject::invokeMethod(this, &StartupTimer::Interactive, Qt::QueuedConnection);
+    }, static_cast<Qt::ConnectionType>(Qt::DirectConnection | Qt::SingleShotConnection));
 
     buffered_pace_thread = new BufferedPlaybackPacerThread(this);
     buffered_pace_thread->start();
@@ -5013,8 +4920,10 @@ renderer_backend_ready:
     if (!qml_engine->incubationController())
         qml_engine->setIncubationController(quick_window->incubationController());
     connect(qml_engine, &QQmlEngine::quit, this, &QWindow::close);
+    StartupTimer::Phase("quick window");
 
     backend = new QmlBackend(settings, this);
+    StartupTimer::Phase("backend");
     stats_overlay_widget = new StatsOverlayWidget(this, backend);
     connect(backend, &QmlBackend::sessionChanged, this, [this, exit_app_on_stream_exit](StreamSession *s) {
         const bool preserve_startup_warmup = s && startup_warmup_preserve_next_session_change;
@@ -5166,10 +5075,6 @@ renderer_backend_ready:
     this->renderparams_opts = pl_options_alloc(this->placebo_log);
     pl_options_reset(this->renderparams_opts, &pl_render_high_quality_params);
     this->renderparams_changed = true;
-    this->fsr_hook = load_mpv_hook(placeboGpu(), QStringLiteral(":/shaders/FSR.glsl"));
-    this->fsrcnnx_hook_8 = load_mpv_hook(placeboGpu(), QStringLiteral(":/shaders/FSRCNNX_x2_8-0-4-1.glsl"));
-    this->fsrcnnx_hook_16 = load_mpv_hook(placeboGpu(), QStringLiteral(":/shaders/FSRCNNX_x2_16-0-4-1.glsl"));
-
 
     switch (settings->GetPlaceboPreset()) {
     case PlaceboPreset::Fast:
@@ -5193,6 +5098,7 @@ renderer_backend_ready:
         break;
     }
     setZoomFactor(settings->GetZoomFactor());
+    StartupTimer::Phase("render setup");
 }
 
 void QmlMainWindow::drainRenderThread()
@@ -5424,8 +5330,7 @@ void QmlMainWindow::handleBufferedPlaybackWake(qint64 timer_fire_us)
 bool QmlMainWindow::throttleFramePresentation(double interval_s)
 {
     auto reset_present_pacing = [this]() {
-        next_frame_target_us = 0;
-        last_throttle_interval_s = 0.0;
+        chiaki_frame_pacer_throttle_reset(&frame_pacer);
     };
 
     if (present_pacing_reset_pending.fetchAndStoreRelaxed(0) != 0)
@@ -5441,29 +5346,21 @@ bool QmlMainWindow::throttleFramePresentation(double interval_s)
     const uint64_t interval_us = static_cast<uint64_t>(interval_s * 1000000.0 + 0.5);
     if (!interval_us)
         return true;
-    if (qAbs(last_throttle_interval_s - interval_s) > 1e-6)
-        next_frame_target_us = 0;
-    last_throttle_interval_s = interval_s;
 
-    const uint64_t now_us = chiaki_time_now_monotonic_us();
-    if (!next_frame_target_us)
-        next_frame_target_us = now_us + interval_us;
-    while (next_frame_target_us <= now_us)
-        next_frame_target_us += interval_us;
     const qint64 swap_to_start_gap_estimate_us = this->swap_to_start_gap_estimate_us.loadAcquire();
     const qint64 start_frame_block_estimate_us = this->start_frame_block_estimate_us.loadAcquire();
     const qint64 render_submit_estimate_us = this->render_submit_estimate_us.loadAcquire();
-    const qint64 submit_swap_estimate_us = qMax<qint64>(0, static_cast<qint64>(g_submit_swap_est_us.load(std::memory_order_acquire)));
+    const qint64 submit_swap_estimate_us = chiaki_frame_pacer_submit_swap_estimate(&frame_pacer);
     const qint64 render_path_estimate_us = qMax<qint64>(0, swap_to_start_gap_estimate_us) +
         qMax<qint64>(0, start_frame_block_estimate_us) +
         qMax<qint64>(0, render_submit_estimate_us);
     const uint64_t base_lead_us = static_cast<uint64_t>(qMax<qint64>(0, render_path_estimate_us));
     const uint64_t extra_lead_us = static_cast<uint64_t>(qMax<qint64>(0, submit_swap_estimate_us));
     const uint64_t total_lead_us = base_lead_us + extra_lead_us;
+    uint64_t next_frame_target_us = 0;
+    const uint64_t target_wakeup_us = chiaki_frame_pacer_throttle_wakeup(&frame_pacer, interval_us, total_lead_us, &next_frame_target_us);
+    const uint64_t now_us = chiaki_time_now_monotonic_us();
     const uint64_t remaining_to_target_us = next_frame_target_us > now_us ? (next_frame_target_us - now_us) : 0;
-    const uint64_t target_wakeup_us = remaining_to_target_us > total_lead_us
-        ? (next_frame_target_us - total_lead_us)
-        : now_us;
     logDeferredPresentDecision(static_cast<qint64>(now_us),
                                static_cast<qint64>(next_frame_target_us),
                                static_cast<qint64>(target_wakeup_us),
@@ -5484,7 +5381,7 @@ bool QmlMainWindow::throttleFramePresentation(double interval_s)
         present_pacing_reset_pending.fetchAndStoreRelaxed(0) != 0) {
         reset_present_pacing();
     } else {
-        next_frame_target_us += interval_us;
+        chiaki_frame_pacer_throttle_advance(&frame_pacer);
     }
     present_pace_timer_rearm.storeRelease(0);
     last_present_target_us.storeRelease(0);
@@ -5654,12 +5551,7 @@ void QmlMainWindow::processDeferredSwapTask(qint64 submit_begin_us,
                                       true);
             if (swap_us >= present_swap_begin_us)
                 logLatencyStats("swap_call", swap_us - present_swap_begin_us);
-            const qint64 observed = swap_us - submit_begin_local_us;
-            if (observed > 0) {
-                const long long prev = g_submit_swap_est_us.load(std::memory_order_acquire);
-                const long long next = static_cast<long long>(((prev * 7ll) + observed) / 8ll);
-                g_submit_swap_est_us.store(next, std::memory_order_release);
-            }
+            chiaki_frame_pacer_submit_swap_observed(&frame_pacer, swap_us - submit_begin_local_us);
         }
     }
 }
@@ -5713,20 +5605,6 @@ void QmlMainWindow::updatePlacebo()
 
 void QmlMainWindow::updateVSync()
 {
-    if (!pendingFrameOverflowEnabled()) {
-        QMutexLocker locker(&pending_frame_mutex);
-        while (!pending_frame_overflow.empty()) {
-            PendingFrameEntry entry = std::move(pending_frame_overflow.front());
-            pending_frame_overflow.pop_front();
-            if (entry.frame)
-                av_frame_free(&entry.frame);
-        }
-        if (!pending_frame) {
-            pending_frame_present.storeRelease(0);
-            queue_stored_frame_pending.storeRelease(0);
-        }
-    }
-
     if (render_backend != RenderBackend::Vulkan)
         return;
     armQuickNeedSync("updateVSync");
@@ -6985,14 +6863,7 @@ void QmlMainWindow::render()
                 if (render_us > 0 && swap_us >= render_us)
                     logLatencyStats("render_to_swap", swap_us - render_us);
                 // Update exponential moving average of submit+swap cost so we sleep for right amount in throttle
-                {
-                    const qint64 observed = swap_us - submit_begin_us;
-                    if (observed > 0) {
-                        const long long prev = g_submit_swap_est_us.load(std::memory_order_acquire);
-                        const long long next = static_cast<long long>(((prev * 7ll) + observed) / 8ll);
-                        g_submit_swap_est_us.store(next, std::memory_order_release);
-                    }
-                }
+                chiaki_frame_pacer_submit_swap_observed(&frame_pacer, swap_us - submit_begin_us);
                 logPresentCompletionStats(swap_us,
                                           submit_begin_us,
                                           swap_us,
@@ -7265,6 +7136,8 @@ void QmlMainWindow::render()
         const float dst_height = fabsf(pl_rect_h(target_frame.crop));
         if (src_width > 0.0f && src_height > 0.0f) {
             const float upscale_factor = qMin(dst_width / src_width, dst_height / src_height);
+            if (upscale_factor > 1.0f)
+                loadSpatialHooks(video_preset, configured_upscaler);
             fsrcnnx_hook = select_spatial_hook(video_preset, configured_upscaler, upscale_factor,
                                                fsr_hook, fsrcnnx_hook_8, fsrcnnx_hook_16);
         }
@@ -0,0 +1,41 @@
+#include "startuptimer.h"
+#include "qmlmainwindow.h"
+
+#include <QGuiApplication>
+
+QElapsedTimer StartupTimer::timer;
+qint64 StartupTimer::last_ms = 0;
+bool StartupTimer::interactive = false;
+QList<QPair<const char *, qint64>> StartupTimer::phases;
+
+void StartupTimer::Start()
+{
+    timer.start();
+    last_ms = 0;
+    interactive = false;
+    phases.clear();
+}
+
+void StartupTimer::Phase(const char *name)
+{
+    if (!timer.isValid() || interactive)
+        return;
+    const qint64 now = timer.elapsed();
+    phases.append({name, now - last_ms});
+    last_ms = now;
+}
+
+void StartupTimer::Interactive()
+{
+    if (!timer.isValid() || interactive)
+        return;
+    Phase("first frame");
+    interactive = true;
+    // logged at once so it ends up in the log file too, the handler for that is only installed by the backend
+    for (const auto &phase : std::as_const(phases))
+        qCInfo(chiakiGui) << "Startup phase" << phase.first << "took" << phase.second << "ms";
+    qCInfo(chiakiGui) << "Time to interactive:" << last_ms << "ms";
+
+    if (qEnvironmentVariableIntValue("CHIAKI_TEST_EXIT_AFTER_STARTUP") == 1)
+        QMetaObject::invokeMethod(QGuiApplication::instance(), &QGuiApplication::quit, Qt::QueuedConnection);
+}
@@ -11,8 +11,10 @@
 #include <chiaki/time.h>
 #include "../../lib/src/utils.h"
 
+#include <QDir>
 #include <QKeyEvent>
 #include <QMutexLocker>
+#include <QStandardPaths>
 #include <QtMath>
 #include <atomic>
 
@@ -26,6 +28,7 @@
 #define STEAMDECK_HAPTIC_CONNECT_DELAY_MS 1100
 #define NEW_DPAD_TOUCH_INTERVAL_MS 500
 #define DPAD_TOUCH_UPDATE_INTERVAL_MS 10
+#define DPAD_BUTTONS_MASK (CHIAKI_CONTROLLER_BUTTON_DPAD_DOWN | CHIAKI_CONTROLLER_BUTTON_DPAD_LEFT | CHIAKI_CONTROLLER_BUTTON_DPAD_RIGHT | CHIAKI_CONTROLLER_BUTTON_DPAD_UP)
 #define STEAMDECK_HAPTIC_PACKETS_PER_ANALYSIS 4 // send packets every interval * packets per analysis
 #define RUMBLE_HAPTICS_PACKETS_PER_RUMBLE 3
 #define STEAMDECK_HAPTIC_SAMPLING_RATE 3000
@@ -37,6 +40,7 @@
 #define PS5_TOUCHPAD_MAX_Y 1079.0f
 #define SESSION_RETRY_SECONDS 20
 #define HAPTIC_RUMBLE_MIN_STRENGTH 100
+#define HAPTICS_PAUSE_US 200000 // no haptics packets for this long means the host stopped sending
 
 #define MICROPHONE_SAMPLES 480
 #ifdef Q_OS_LINUX
@@ -72,7 +76,7 @@ class SdeckHapticsWorker : public QObject
 			sdeck_queue_segment = samples_per_packet * STEAMDECK_HAPTIC_PACKETS_PER_ANALYSIS;
 			{
 				QMutexLocker locker(sdeck_mutex);
-				if(sdeck_haptic_init(sdeck, sdeck_queue_segment) < 0)
+				if(sdeck_haptic_init(sdeck, STEAMDECK_HAPTIC_SAMPLING_RATE) < 0)
 				{
 					CHIAKI_LOGE(log, "Steam Deck Haptics Audio could not be connected :(");
 					sdeck_haptic_fini(sdeck);
@@ -353,10 +357,12 @@ static void CantDisplayCb(void *user, bool cant_display);
 static void EventCb(ChiakiEvent *event, void *user);
 #if CHIAKI_GUI_ENABLE_SETSU
 static void SessionSetsuCb(SetsuEvent *event, void *user);
+static void SessionSetsuNotifyCb(void *user);
 #endif
 #if CHIAKI_GUI_ENABLE_STEAMDECK_NATIVE
 static void SessionSDeckCb(SDeckEvent *event, void *user);
 #endif
+static void SessionControllerInputCb(ChiakiControllerState *state, void *user);
 static void FfmpegFrameCb(ChiakiFfmpegDecoder *decoder, void *user);
 
 StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObject *parent)
@@ -477,6 +483,7 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	chiaki_connect_info.packet_loss_max = connect_info.packet_loss_max;
 	chiaki_connect_info.auto_regist = connect_info.auto_regist;
 	chiaki_connect_info.audio_video_disabled = connect_info.audio_video_disabled;
+	chiaki_connect_info.wakeup = connect_info.wakeup;
 
 	dpad_touch_shortcut1 = connect_info.dpad_touch_shortcut1;
 	dpad_touch_shortcut2 = connect_info.dpad_touch_shortcut2;
@@ -518,6 +525,11 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	mouse_touch_id=-1;
 	dpad_touch_id =-1;
 	chiaki_controller_state_set_idle(&dpad_touch_state);
+	chiaki_controller_state_set_idle(&input_controllers_state);
+	chiaki_controller_state_set_idle(&input_gui_first_state);
+	chiaki_controller_state_set_idle(&input_gui_state);
+	input_dpad_touch = false;
+	input_gui_only = false;
 	dpad_touch_value = QPair<uint16_t, uint16_t>(0,0);
 	dpad_touch_increment = connect_info.dpad_touch_increment;
 	dpad_touch_timer = new QTimer(this);
@@ -565,7 +577,7 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 
 	if (connect_info.enable_dualsense)
 	{
-		ChiakiAudioSink haptics_sink;
+		ChiakiAudioSink haptics_sink = {};
 		haptics_sink.user = this;
 		haptics_sink.frame_cb = HapticsFrameCb;
 		chiaki_session_set_haptics_sink(&session, &haptics_sink);
@@ -595,6 +607,7 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	if(connect_info.buttons_by_pos)
 		ControllerManager::GetInstance()->SetButtonsByPos();
 #endif
+	ControllerManager::GetInstance()->SetControllerStateSink(SessionControllerInputCb, this);
 #if CHIAKI_GUI_ENABLE_SETSU
 	setsu_motion_device = nullptr;
 	chiaki_controller_state_set_idle(&setsu_state);
@@ -604,17 +617,15 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	orient_dirty = true;
 	chiaki_orientation_tracker_init(&orient_tracker);
 	setsu = setsu_new();
-	auto timer = new QTimer(this);
-	connect(timer, &QTimer::timeout, this, [this]{
-		setsu_poll(setsu, SessionSetsuCb, this);
-		if(orient_dirty)
-		{
-			chiaki_orientation_tracker_apply_to_controller_state(&orient_tracker, &setsu_state);
-			SendFeedbackState();
-			orient_dirty = false;
-		}
-	});
-	timer->start(SETSU_UPDATE_INTERVAL_MS);
+	// events are read on setsu's own thread and dispatched as soon as they arrive,
+	// polling on a timer is only the fallback if that thread can't be started
+	if(setsu_thread_start(setsu, SessionSetsuNotifyCb, this) != 0)
+	{
+		CHIAKI_LOGW(log.GetChiakiLog(), "Failed to start Setsu thread, polling instead");
+		auto timer = new QTimer(this);
+		connect(timer, &QTimer::timeout, this, &StreamSession::DispatchSetsu);
+		timer->start(SETSU_UPDATE_INTERVAL_MS);
+	}
 #endif
 
 #if CHIAKI_GUI_ENABLE_STEAMDECK_NATIVE
@@ -642,7 +653,7 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 			sdeck_mutex.unlock();
 			if(sdeck_orient_dirty)
 			{
-				chiaki_orientation_tracker_apply_to_controller_state(&sdeck_orient_tracker, &sdeck_state);
+				chiaki_orientation_tracker_apply_to_controller_state_at(&sdeck_orient_tracker, &sdeck_state, chiaki_time_now_monotonic_us());
 				SendFeedbackState();
 				sdeck_orient_dirty = false;
 			}
@@ -692,23 +703,16 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 			pending_frames_lost = total;
 		}
 	});
-
-	StartAudioOutDrainThread();
 }
 
 StreamSession::~StreamSession()
 {
+	ControllerManager::GetInstance()->SetControllerStateSink(nullptr, nullptr);
 	mic_active.storeRelaxed(false);
-	StopAudioOutDrainThread();
 	if(audio_out)
-		SDL_CloseAudioDevice(audio_out);
 	{
-		QMutexLocker locker(&audio_out_ring_mutex);
-		audio_out_ring_buf.clear();
-		audio_out_ring_read_pos = 0;
-		audio_out_ring_write_pos = 0;
-		audio_out_ring_fill = 0;
-		audio_out_overflow_logged = false;
+		SDL_CloseAudioDevice(audio_out);
+		audio_out = 0;
 	}
 	if(audio_in)
 		SDL_CloseAudioDevice(audio_in);
@@ -725,6 +729,8 @@ StreamSession::~StreamSession()
 		chiaki_session_join(&session);
 	chiaki_session_fini(&session);
 	chiaki_opus_decoder_fini(&opus_decoder);
+	// only now that no more audio frames can be pushed
+	CloseAudioOut();
 	chiaki_opus_encoder_fini(&opus_encoder);
 #if CHIAKI_GUI_ENABLE_SPEEX
 	if(speech_processing_enabled)
@@ -746,6 +752,7 @@ StreamSession::~StreamSession()
 #endif
 #if CHIAKI_GUI_ENABLE_SETSU
 	setsu_free(setsu);
+	setsu = nullptr;
 #endif
 #if CHIAKI_GUI_ENABLE_STEAMDECK_NATIVE
 	sdeck_free(sdeck);
@@ -772,6 +779,8 @@ StreamSession::~StreamSession()
 		free(haptics_resampler_buf);
 		haptics_resampler_buf = nullptr;
 	}
+	free(haptics_drift_buf);
+	haptics_drift_buf = nullptr;
 	if(mic_buf.buf)
 	{
 		free(mic_buf.buf);
@@ -1171,7 +1180,6 @@ void StreamSession::UpdateGamepads()
 				continue;
 			}
 			CHIAKI_LOGI(log.GetChiakiLog(), "Controller %d opened: \"%s\"", controller_id, controller->GetName().toLocal8Bit().constData());
-			connect(controller, &Controller::StateChanged, this, &StreamSession::SendFeedbackState);
 			connect(controller, &Controller::MicButtonPush, this, &StreamSession::ToggleMute);
 			controllers[controller_id] = controller;
 			if(controller->IsHandheld())
@@ -1217,25 +1225,41 @@ void StreamSession::WaitHaptics()
 
 void StreamSession::DpadSendFeedbackState()
 {
-	ChiakiControllerState state;
-	chiaki_controller_state_set_idle(&state);
+	UpdateFeedbackState(true);
+}
+
+void StreamSession::SendFeedbackState()
+{
+	UpdateFeedbackState(false);
+}
+
+bool StreamSession::DpadTouchShortcutPressed(const ChiakiControllerState *state)
+{
+	return (dpad_touch_shortcut1 || dpad_touch_shortcut2 || dpad_touch_shortcut3 || dpad_touch_shortcut4) && (!dpad_touch_shortcut1 || (state->buttons & dpad_touch_shortcut1)) && (!dpad_touch_shortcut2 || (state->buttons & dpad_touch_shortcut2)) && (!dpad_touch_shortcut3 || (state->buttons & dpad_touch_shortcut3)) && (!dpad_touch_shortcut4 || (state->buttons & dpad_touch_shortcut4));
+}
+
+void StreamSession::UpdateFeedbackState(bool dpad_touch_placeholder)
+{
+	ChiakiControllerState gui_first_state;
+	chiaki_controller_state_set_idle(&gui_first_state);
 
 #if CHIAKI_GUI_ENABLE_SETSU
 	// setsu is the one that potentially has gyro/accel/orient so copy that directly first
-	state = setsu_state;
+	gui_first_state = setsu_state;
 #endif
 
-	for(auto controller : controllers)
-	{
-		auto controller_state = controller->GetState();
-		chiaki_controller_state_or(&state, &state, &controller_state);
-	}
-
+	ChiakiControllerState gui_state;
+	chiaki_controller_state_set_idle(&gui_state);
 #if CHIAKI_GUI_ENABLE_STEAMDECK_NATIVE
-	chiaki_controller_state_or(&state, &state, &sdeck_state);
+	chiaki_controller_state_or(&gui_state, &gui_state, &sdeck_state);
 #endif
-	chiaki_controller_state_or(&state, &state, &keyboard_state);
-	chiaki_controller_state_or(&state, &state, &touch_state);
+	chiaki_controller_state_or(&gui_state, &gui_state, &keyboard_state);
+	chiaki_controller_state_or(&gui_state, &gui_state, &touch_state);
+
+	QMutexLocker locker(&input_mutex);
+	ChiakiControllerState state = gui_first_state;
+	chiaki_controller_state_or(&state, &state, &input_controllers_state);
+	chiaki_controller_state_or(&state, &state, &gui_state);
 
 	if(input_block)
 	{
@@ -1248,7 +1272,7 @@ void StreamSession::DpadSendFeedbackState()
 			chiaki_controller_state_set_idle(&keyboard_state);
 		}
 	}
-	if((dpad_touch_shortcut1 || dpad_touch_shortcut2 || dpad_touch_shortcut3 || dpad_touch_shortcut4) && (!dpad_touch_shortcut1 || (state.buttons & dpad_touch_shortcut1)) && (!dpad_touch_shortcut2 || (state.buttons & dpad_touch_shortcut2)) && (!dpad_touch_shortcut3 || (state.buttons & dpad_touch_shortcut3)) && (!dpad_touch_shortcut4 || (state.buttons & dpad_touch_shortcut4)))
+	if(DpadTouchShortcutPressed(&state))
 	{
 		if(!dpad_regular_touch_switched)
 		{
@@ -1258,9 +1282,9 @@ void StreamSession::DpadSendFeedbackState()
 	}
 	else
 		dpad_regular_touch_switched = false;
-	if(dpad_touch_increment && !dpad_regular && (state.buttons & (CHIAKI_CONTROLLER_BUTTON_DPAD_DOWN | CHIAKI_CONTROLLER_BUTTON_DPAD_LEFT | CHIAKI_CONTROLLER_BUTTON_DPAD_RIGHT | CHIAKI_CONTROLLER_BUTTON_DPAD_UP)))
+	if(dpad_touch_increment && !dpad_regular && (state.buttons & DPAD_BUTTONS_MASK))
 	{
-		HandleDpadTouchEvent(&state, true);
+		HandleDpadTouchEvent(&state, dpad_touch_placeholder);
 	}
 	else
 	{
@@ -1268,91 +1292,103 @@ void StreamSession::DpadSendFeedbackState()
 			dpad_touch_stop_timer->start(NEW_DPAD_TOUCH_INTERVAL_MS);
 	}
 	chiaki_controller_state_or(&state, &state, &dpad_touch_state);
+	chiaki_controller_state_or(&gui_state, &gui_state, &dpad_touch_state);
+
+	input_gui_first_state = gui_first_state;
+	input_gui_state = gui_state;
+	input_dpad_touch = dpad_touch_increment && !dpad_regular;
+	input_gui_only = input_block || dpad_regular_touch_switched || dpad_touch_id >= 0;
 	chiaki_session_set_controller_state(&session, &state);
 }
 
-void StreamSession::SendFeedbackState()
+void StreamSession::PushControllerInput(ChiakiControllerState *controllers_state)
 {
-	ChiakiControllerState state;
-	chiaki_controller_state_set_idle(&state);
-
-#if CHIAKI_GUI_ENABLE_SETSU
-	// setsu is the one that potentially has gyro/accel/orient so copy that directly first
-	state = setsu_state;
-#endif
-
-	for(auto controller : controllers)
-	{
-		auto controller_state = controller->GetState();
-		chiaki_controller_state_or(&state, &state, &controller_state);
+	QMutexLocker locker(&input_mutex);
+	input_controllers_state = *controllers_state;
+	ChiakiControllerState state = input_gui_first_state;
+	chiaki_controller_state_or(&state, &state, &input_controllers_state);
+	chiaki_controller_state_or(&state, &state, &input_gui_state);
+	if(input_gui_only || DpadTouchShortcutPressed(&state) || (input_dpad_touch && (state.buttons & DPAD_BUTTONS_MASK)))
+	{
+		// the dpad's touch emulation runs on timers
+		QMetaObject::invokeMethod(this, &StreamSession::SendFeedbackState, Qt::QueuedConnection);
+		return;
 	}
+	chiaki_session_set_controller_state(&session, &state);
+}
 
-#if CHIAKI_GUI_ENABLE_STEAMDECK_NATIVE
-	chiaki_controller_state_or(&state, &state, &sdeck_state);
-#endif
-	chiaki_controller_state_or(&state, &state, &keyboard_state);
-	chiaki_controller_state_or(&state, &state, &touch_state);
-
-	if(input_block)
-	{
-		// Only unblock input after all buttons were released
-		if(input_block == 2 && !state.buttons)
-			input_block = 0;
-		else
-		{
-			chiaki_controller_state_set_idle(&state);
-			chiaki_controller_state_set_idle(&keyboard_state);
-		}
-	}
-	if((dpad_touch_shortcut1 || dpad_touch_shortcut2 || dpad_touch_shortcut3 || dpad_touch_shortcut4) && (!dpad_touch_shortcut1 || (state.buttons & dpad_touch_shortcut1)) && (!dpad_touch_shortcut2 || (state.buttons & dpad_touch_shortcut2)) && (!dpad_touch_shortcut3 || (state.buttons & dpad_touch_shortcut3)) && (!dpad_touch_shortcut4 || (state.buttons & dpad_touch_shortcut4)))
-	{
-		if(!dpad_regular_touch_switched)
-		{
-			dpad_regular_touch_switched = true;
-			dpad_regular = !dpad_regular;
-		}
-	}
-	else
-		dpad_regular_touch_switched = false;
-	if(dpad_touch_increment && !dpad_regular && (state.buttons & (CHIAKI_CONTROLLER_BUTTON_DPAD_DOWN | CHIAKI_CONTROLLER_BUTTON_DPAD_LEFT | CHIAKI_CONTROLLER_BUTTON_DPAD_RIGHT | CHIAKI_CONTROLLER_BUTTON_DPAD_UP)))
+void StreamSession::CloseAudioOut()
+{
+	// closing the device guarantees the callback is not running anymore
+	if(audio_out)
 	{
-		HandleDpadTouchEvent(&state);
+		SDL_CloseAudioDevice(audio_out);
+		audio_out = 0;
 	}
-	else
+	if(audio_out_ring_valid)
 	{
-		if(dpad_touch_id >= 0 && !dpad_touch_stop_timer->isActive())
-			dpad_touch_stop_timer->start(NEW_DPAD_TOUCH_INTERVAL_MS);
+		chiaki_audio_ring_fini(&audio_out_ring);
+		audio_out_ring_valid = false;
 	}
-	chiaki_controller_state_or(&state, &state, &dpad_touch_state);
-	chiaki_session_set_controller_state(&session, &state);
+	free(audio_out_resampled_buf);
+	audio_out_resampled_buf = nullptr;
+	audio_out_resampled_frames = 0;
+}
+
+void StreamSession::AudioOutCallback(void *user, Uint8 *stream, int len)
+{
+	auto session = reinterpret_cast<StreamSession *>(user);
+	chiaki_audio_ring_read(&session->audio_out_ring, stream, (size_t)len);
 }
 
 void StreamSession::InitAudio(unsigned int channels, unsigned int rate)
 {
-	StopAudioOutDrainThread();
+	// The audio receiver thread is blocked on us (BlockingQueuedConnection),
+	// so nobody is writing to the ring while it is replaced.
 	allow_unmute = true;
 	if(start_mic_unmuted)
 		ToggleMute();
-	if(audio_out)
+	CloseAudioOut();
+
+	audio_out_sample_size = sizeof(int16_t) * channels;
+	// the device pulls one audio_buffer_size period at a time, keep two of them queued like before
+	unsigned int period_ms = (unsigned int)((uint64_t)audio_buffer_size / audio_out_sample_size * 1000 / rate);
+	unsigned int latency_target_ms = 2 * (period_ms ? period_ms : 1);
+	ChiakiErrorCode err = chiaki_audio_ring_init(&audio_out_ring, audio_out_sample_size, rate, latency_target_ms);
+	if(err != CHIAKI_ERR_SUCCESS)
 	{
-		SDL_CloseAudioDevice(audio_out);
-		audio_out = 0;
+		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to init Audio Output ring: %s", chiaki_error_string(err));
+		return;
+	}
+	audio_out_ring_valid = true;
+
+	// Instead of letting the ring trim audio once the host's clock drifted far enough,
+	// stretch or squeeze the stream by a few hundred ppm to hold the target.
+	err = chiaki_audio_resampler_init(&audio_out_resampler, channels);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to init Audio Output resampler for %u channels: %s", channels, chiaki_error_string(err));
+		CloseAudioOut();
+		return;
 	}
+	chiaki_audio_drift_controller_init(&audio_out_drift, audio_out_ring.target / audio_out_sample_size);
+	// large enough for the longest possible Opus frame of 120ms
+	audio_out_resampled_frames = chiaki_audio_resampler_output_max(rate * 120 / 1000);
+	audio_out_resampled_buf = (int16_t *)malloc(audio_out_resampled_frames * audio_out_sample_size);
+	if(!audio_out_resampled_buf)
 	{
-		QMutexLocker locker(&audio_out_ring_mutex);
-		audio_out_ring_buf.clear();
-		audio_out_ring_read_pos = 0;
-		audio_out_ring_write_pos = 0;
-		audio_out_ring_fill = 0;
-		audio_out_overflow_logged = false;
+		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to allocate Audio Output resampler buffer");
+		CloseAudioOut();
+		return;
 	}
 
 	SDL_AudioSpec spec = {0};
 	spec.freq = rate;
 	spec.channels = channels;
 	spec.format = AUDIO_S16SYS;
-	audio_out_sample_size = sizeof(int16_t) * channels;
 	spec.samples = audio_buffer_size / audio_out_sample_size;
+	spec.callback = AudioOutCallback;
+	spec.userdata = this;
 
 	SDL_AudioSpec obtained;
 	audio_out = SDL_OpenAudioDevice(audio_out_device_name.isEmpty() ? nullptr : qUtf8Printable(audio_out_device_name), false, &spec, &obtained, false);
@@ -1377,20 +1413,10 @@ void StreamSession::InitAudio(unsigned int channels, unsigned int rate)
 			"Audio output '%s' opened with converted format %#x, %u channels @ %u Hz (requested %#x, %u channels @ %u Hz)",
 			qPrintable(audio_out_device_name), obtained.format, obtained.channels, obtained.freq, spec.format, spec.channels, spec.freq);
 
-	{
-		QMutexLocker locker(&audio_out_ring_mutex);
-		audio_out_ring_buf.resize((int)(audio_buffer_size * 8));
-		audio_out_ring_read_pos = 0;
-		audio_out_ring_write_pos = 0;
-		audio_out_ring_fill = 0;
-		audio_out_overflow_logged = false;
-	}
-
 	SDL_PauseAudioDevice(audio_out, 0);
-	StartAudioOutDrainThread();
 
-	CHIAKI_LOGI(log.GetChiakiLog(), "Audio Device '%s' opened with %u channels @ %d Hz, buffer size %u",
-				qPrintable(audio_out_device_name), obtained.channels, obtained.freq, obtained.size);
+	CHIAKI_LOGI(log.GetChiakiLog(), "Audio Device '%s' opened with %u channels @ %d Hz, buffer size %u, latency target %u ms",
+				qPrintable(audio_out_device_name), obtained.channels, obtained.freq, obtained.size, latency_target_ms);
 }
 
 void StreamSession::InitMic(unsigned int channels, unsigned int rate)
@@ -1737,16 +1763,34 @@ void StreamSession::InitHaptics()
 	}
 #endif
 
-	SDL_AudioCVT cvt;
-	if(SDL_BuildAudioCVT(&haptics_cvt, AUDIO_S16SYS, 4, 3000, AUDIO_S16SYS, 4, 48000) < 0)
+	if(chiaki_haptics_processor_init(&haptics_processor, CHIAKI_HAPTICS_SAMPLE_RATE, 48000) != CHIAKI_ERR_SUCCESS)
 	{
-		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to build haptics audio converter: %s", SDL_GetError());
+		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to init haptics processor");
 		return;
 	}
-	haptics_cvt.len = 240;  // 10 16bit stereo samples
-	haptics_resampler_buf = (uint8_t*) calloc(haptics_cvt.len * haptics_cvt.len_mult, sizeof(uint8_t));
+	size_t haptics_frames_max = chiaki_haptics_processor_output_frames(&haptics_processor, CHIAKI_HAPTICS_PACKET_FRAMES_MAX);
+	haptics_resampler_buf = (int16_t *)calloc(haptics_frames_max * 4, sizeof(int16_t));
 	if(!haptics_resampler_buf)
+	{
 		CHIAKI_LOGE(log.GetChiakiLog(),"Haptics resampler buf could not be allocated");
+		return;
+	}
+	ChiakiErrorCode err = chiaki_audio_resampler_init(&haptics_drift_resampler, 4);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to init haptics resampler: %s", chiaki_error_string(err));
+		free(haptics_resampler_buf);
+		haptics_resampler_buf = nullptr;
+		return;
+	}
+	haptics_drift_buf_frames = chiaki_audio_resampler_output_max(haptics_frames_max);
+	haptics_drift_buf = (int16_t *)calloc(haptics_drift_buf_frames * 4, sizeof(int16_t));
+	if(!haptics_drift_buf)
+	{
+		CHIAKI_LOGE(log.GetChiakiLog(),"Haptics drift buf could not be allocated");
+		free(haptics_resampler_buf);
+		haptics_resampler_buf = nullptr;
+	}
 }
 
 void StreamSession::DisconnectHaptics()
@@ -1840,6 +1884,9 @@ void StreamSession::ConnectHaptics()
 			CHIAKI_LOGE(log.GetChiakiLog(), "Could not open SDL Audio Device %s for haptics output: %s", device_name, SDL_GetError());
 			continue;
 		}
+		chiaki_haptics_processor_reset(&haptics_processor);
+		chiaki_audio_resampler_reset(&haptics_drift_resampler);
+		chiaki_audio_drift_controller_init(&haptics_drift, 2 * have.samples);
 		SDL_PauseAudioDevice(haptics_output, 0);
 		CHIAKI_LOGI(log.GetChiakiLog(), "Haptics Audio Device '%s' opened with %d channels @ %d Hz, buffer size %u (driver=%s)", device_name, have.channels, have.freq, have.size, SDL_GetCurrentAudioDriver());
 		QMetaObject::invokeMethod(this, [this]() {
@@ -1911,39 +1958,37 @@ void StreamSession::PushAudioFrame(int16_t *og_buf, size_t samples_count)
 	if(!audio_out || !audio_volume)
 		return;
 
-	QByteArray buf((int)(samples_count * audio_out_sample_size), 0);
-
-	// qDebug() << "Audio queue" << (SDL_GetQueuedAudioSize(audio_out) / audio_out_sample_size / samples_count) * 10 << "ms";
-	// If the SDL queue runs away, drop the stale backlog and resume from the latest frame.
-	if(SDL_GetQueuedAudioSize(audio_out) > 3 * audio_buffer_size)
-	{
-		CHIAKI_LOGW(log.GetChiakiLog(), "Audio queue exceeded latency threshold, clearing queued audio");
-		SDL_ClearQueuedAudio(audio_out);
-		QMutexLocker locker(&audio_out_ring_mutex);
-		audio_out_ring_read_pos = 0;
-		audio_out_ring_write_pos = 0;
-		audio_out_ring_fill = 0;
-		audio_out_overflow_logged = false;
-	}
-	if(audio_volume < SDL_MIX_MAXVOLUME)
-		SDL_MixAudioFormat((uint8_t *)buf.data(), (uint8_t *)og_buf, AUDIO_S16SYS, buf.size(), audio_volume);
-	else
-		memcpy(buf.data(), og_buf, (size_t)buf.size());
+	// The device callback picks these up from the ring with no further copies.
+	// Latency is held at the ring's target by the drift controller, the ring only skips stale audio as a last resort.
+	size_t buf_size = samples_count * audio_out_sample_size;
+	double ratio = chiaki_audio_drift_controller_update(&audio_out_drift,
+			chiaki_audio_ring_buffered(&audio_out_ring) / audio_out_sample_size, chiaki_time_now_monotonic_us());
+	chiaki_audio_resampler_set_ratio(&audio_out_resampler, ratio);
+	size_t resampled_frames = chiaki_audio_resampler_process(&audio_out_resampler, og_buf, samples_count,
+			audio_out_resampled_buf, audio_out_resampled_frames);
+	chiaki_audio_ring_write_s16(&audio_out_ring, audio_out_resampled_buf,
+			resampled_frames * audio_out_sample_size / sizeof(int16_t), audio_volume);
 #if CHIAKI_GUI_ENABLE_SPEEX
 	// change samples to mono for processing with SPEEX
 	if(echo_resampler_buf && speech_processing_enabled && !muted)
 	{
-		if(buf.size() != (int)(mic_buf.size_bytes * 2))
+		if(buf_size != mic_buf.size_bytes * 2)
 		{
 			CHIAKI_LOGW(log.GetChiakiLog(),
-				"Skipping echo reference frame with unexpected size %d, expected %u",
-				buf.size(), mic_buf.size_bytes * 2);
-			goto queue_audio;
+				"Skipping echo reference frame with unexpected size %zu, expected %u",
+				buf_size, mic_buf.size_bytes * 2);
+			return;
 		}
 		SDL_AudioCVT cvt = echo_speex_cvt;
 		cvt.len = mic_buf.size_bytes * 2;
 		cvt.buf = echo_resampler_buf;
-		memcpy(echo_resampler_buf, buf.constData(), mic_buf.size_bytes * 2);
+		if(audio_volume < SDL_MIX_MAXVOLUME)
+		{
+			memset(echo_resampler_buf, 0, buf_size);
+			SDL_MixAudioFormat(echo_resampler_buf, (uint8_t *)og_buf, AUDIO_S16SYS, (Uint32)buf_size, audio_volume);
+		}
+		else
+			memcpy(echo_resampler_buf, og_buf, buf_size);
 		if(SDL_ConvertAudio(&cvt) != 0)
 		{
 			CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample echo audio: %s", SDL_GetError());
@@ -1956,176 +2001,6 @@ void StreamSession::PushAudioFrame(int16_t *og_buf, size_t samples_count)
 		echo_to_cancel.enqueue(echo_frame);
 	}
 #endif
-queue_audio:
-	QueueAudioOutData(buf);
-}
-
-void StreamSession::QueueAudioOutData(const QByteArray &audio_data)
-{
-	{
-		QMutexLocker locker(&audio_out_ring_mutex);
-		size_t capacity = (size_t)audio_out_ring_buf.size();
-		size_t data_size = (size_t)audio_data.size();
-		if(capacity == 0 || data_size == 0)
-			return;
-
-		const char *data = audio_data.constData();
-		if(data_size >= capacity)
-		{
-			data += data_size - capacity;
-			data_size = capacity;
-			audio_out_ring_read_pos = 0;
-			audio_out_ring_write_pos = 0;
-			audio_out_ring_fill = 0;
-		}
-		else if(data_size > capacity - audio_out_ring_fill)
-		{
-			size_t bytes_to_drop = data_size - (capacity - audio_out_ring_fill);
-			audio_out_ring_read_pos = (audio_out_ring_read_pos + bytes_to_drop) % capacity;
-			audio_out_ring_fill -= bytes_to_drop;
-			if(!audio_out_overflow_logged)
-			{
-				CHIAKI_LOGW(log.GetChiakiLog(), "Audio output ring overflow, dropping stale queued audio");
-				audio_out_overflow_logged = true;
-			}
-		}
-
-		size_t first_copy = qMin(data_size, capacity - audio_out_ring_write_pos);
-		memcpy(audio_out_ring_buf.data() + audio_out_ring_write_pos, data, first_copy);
-		if(data_size > first_copy)
-			memcpy(audio_out_ring_buf.data(), data + first_copy, data_size - first_copy);
-		audio_out_ring_write_pos = (audio_out_ring_write_pos + data_size) % capacity;
-		audio_out_ring_fill += data_size;
-	}
-
-	{
-		QMutexLocker lock(&audio_out_drain_mutex);
-		audio_out_drain_requested = true;
-	}
-	audio_out_drain_wait.wakeOne();
-}
-
-void StreamSession::DrainAudioOutRingBuffer()
-{
-	const size_t target_queue_size = audio_buffer_size * 2;
-
-	while(audio_out)
-	{
-		if(SDL_GetQueuedAudioSize(audio_out) > 3 * audio_buffer_size)
-		{
-			CHIAKI_LOGW(log.GetChiakiLog(), "Audio queue exceeded latency threshold, clearing queued audio");
-			SDL_ClearQueuedAudio(audio_out);
-			QMutexLocker locker(&audio_out_ring_mutex);
-			audio_out_ring_read_pos = 0;
-			audio_out_ring_write_pos = 0;
-			audio_out_ring_fill = 0;
-			audio_out_overflow_logged = false;
-		}
-
-		if(SDL_GetQueuedAudioSize(audio_out) >= target_queue_size)
-			break;
-
-		QByteArray audio_chunk;
-		{
-			QMutexLocker locker(&audio_out_ring_mutex);
-			if(audio_out_ring_fill == 0)
-			{
-				audio_out_overflow_logged = false;
-				return;
-			}
-
-			size_t capacity = (size_t)audio_out_ring_buf.size();
-			size_t remaining_target = target_queue_size - SDL_GetQueuedAudioSize(audio_out);
-			size_t chunk_size = qMin(audio_out_ring_fill, qMin(remaining_target, capacity - audio_out_ring_read_pos));
-			audio_chunk = QByteArray(audio_out_ring_buf.constData() + audio_out_ring_read_pos, (int)chunk_size);
-			audio_out_ring_read_pos = (audio_out_ring_read_pos + chunk_size) % capacity;
-			audio_out_ring_fill -= chunk_size;
-		}
-
-		if(SDL_QueueAudio(audio_out, audio_chunk.constData(), (Uint32)audio_chunk.size()) < 0)
-		{
-			CHIAKI_LOGE(log.GetChiakiLog(), "Failed to queue audio frame: %s", SDL_GetError());
-			SDL_ClearQueuedAudio(audio_out);
-			break;
-		}
-	}
-}
-
-void StreamSession::StartAudioOutDrainThread()
-{
-	QMutexLocker lock(&audio_out_drain_mutex);
-	if(audio_out_drain_thread_running)
-		return;
-	audio_out_drain_thread_running = true;
-	audio_out_drain_requested = false;
-	audio_out_drain_thread = QThread::create([this]() { AudioOutDrainThreadMain(); });
-	audio_out_drain_thread->start();
-}
-
-void StreamSession::StopAudioOutDrainThread()
-{
-	QThread *thread = nullptr;
-	{
-		QMutexLocker lock(&audio_out_drain_mutex);
-		if(!audio_out_drain_thread_running)
-			return;
-		audio_out_drain_thread_running = false;
-		audio_out_drain_requested = true;
-		thread = audio_out_drain_thread;
-		audio_out_drain_thread = nullptr;
-	}
-	audio_out_drain_wait.wakeOne();
-	if(thread)
-	{
-		thread->wait();
-		delete thread;
-	}
-}
-
-void StreamSession::AudioOutDrainThreadMain()
-{
-	audio_out_drain_mutex.lock();
-	while(audio_out_drain_thread_running)
-	{
-		while(audio_out_drain_thread_running && !audio_out_drain_requested)
-			audio_out_drain_wait.wait(&audio_out_drain_mutex);
-		if(!audio_out_drain_thread_running)
-			break;
-
-		audio_out_drain_requested = false;
-		audio_out_drain_mutex.unlock();
-
-		while(true)
-		{
-			DrainAudioOutRingBuffer();
-
-			bool has_pending_audio = false;
-			{
-				QMutexLocker locker(&audio_out_ring_mutex);
-				has_pending_audio = audio_out && audio_out_ring_fill > 0;
-			}
-			if(!has_pending_audio)
-				break;
-
-			audio_out_drain_mutex.lock();
-			if(!audio_out_drain_thread_running)
-			{
-				audio_out_drain_mutex.unlock();
-				return;
-			}
-			audio_out_drain_wait.wait(&audio_out_drain_mutex, 4);
-			if(!audio_out_drain_thread_running)
-			{
-				audio_out_drain_mutex.unlock();
-				return;
-			}
-			audio_out_drain_requested = false;
-			audio_out_drain_mutex.unlock();
-		}
-
-		audio_out_drain_mutex.lock();
-	}
-	audio_out_drain_mutex.unlock();
 }
 
 #ifdef Q_OS_MACOS
@@ -2172,48 +2047,21 @@ void StreamSession::PushHapticsFrame(uint8_t *buf, size_t buf_size)
 			CHIAKI_LOGE(log.GetChiakiLog(), "Haptic audio of incompatible size: %zu", buf_size);
 			return;
 		}
-		int16_t amplitudel = 0, amplituder = 0;
-		const size_t sample_size = 2 * sizeof(int16_t); // stereo samples
 		haptic_packet_t packetl = {0}, packetr = {0};
 		uint64_t timestamp = chiaki_time_now_monotonic_ms();
 		packetl.timestamp = timestamp;
 		packetr.timestamp = timestamp;
-		size_t buf_count = buf_size / sample_size;
-		for (size_t i = 0; i < buf_count; i++)
-		{
-			size_t cur = i * sample_size;
-			memcpy(&amplitudel, buf + cur, sizeof(int16_t));
-			int32_t adjustedl = (int32_t)amplitudel * intensity;
-			adjustedl = (adjustedl > INT16_MAX) ? INT16_MAX : adjustedl;
-			amplitudel = (adjustedl < INT16_MIN) ? INT16_MIN : adjustedl;
-			packetl.haptic_packet[i] = amplitudel;
-			memcpy(&amplituder, buf + cur + sizeof(int16_t), sizeof(int16_t));
-			int32_t adjustedr = (int32_t)amplituder * intensity;
-			adjustedr = (adjustedr > INT16_MAX) ? INT16_MAX : adjustedr;
-			amplituder = (adjustedr < INT16_MIN) ? INT16_MIN : adjustedr;
-			packetr.haptic_packet[i] = amplituder;
-		}
+		chiaki_haptics_split(packetl.haptic_packet, packetr.haptic_packet, (const int16_t *)buf, buf_size / (2 * sizeof(int16_t)), intensity);
 		emit SdeckHapticPushed(packetl, packetr);
 		return;
 	}
 #endif
 	if((rumble_haptics_intensity != RumbleHapticsIntensity::Off) && haptics_output == 0)
 	{
-		int16_t amplitudel = 0, amplituder = 0;
-		uint32_t suml = 0, sumr = 0;
-		const size_t sample_size = 2 * sizeof(int16_t); // stereo samples
-
-		size_t buf_count = buf_size / sample_size;
-		for (size_t i = 0; i < buf_count; i++){
-			size_t cur = i * sample_size;
-
-			memcpy(&amplitudel, buf + cur, sizeof(int16_t));
-			memcpy(&amplituder, buf + cur + sizeof(int16_t), sizeof(int16_t));
-			suml += static_cast<uint32_t>(qFabs(amplitudel)) * 2;
-			sumr += static_cast<uint32_t>(qFabs(amplituder)) * 2;
-		}
-		uint32_t temp_left = (suml / buf_count);
-		uint32_t temp_right = (sumr / buf_count);
+		uint32_t envelope_left = 0, envelope_right = 0;
+		chiaki_haptics_envelope((const int16_t *)buf, buf_size / (2 * sizeof(int16_t)), &envelope_left, &envelope_right);
+		uint32_t temp_left = envelope_left * 2;
+		uint32_t temp_right = envelope_right * 2;
 		uint16_t original_strength = (temp_left > temp_right) ? temp_left : temp_right;
 		uint16_t left = 0;
 		uint16_t right = 0;
@@ -2280,44 +2128,32 @@ void StreamSession::PushHapticsFrame(uint8_t *buf, size_t buf_size)
 		CHIAKI_LOGE(log.GetChiakiLog(), "Haptics output is active without a resampler buffer");
 		return;
 	}
-	SDL_AudioCVT cvt = haptics_cvt;
-	cvt.len = buf_size * 2;
-	cvt.buf = haptics_resampler_buf;
-	// Remix to 4 channels
-	if(haptic_override > 0.99 && haptic_override < 1.01)
+	size_t haptics_in_frames = buf_size / (2 * sizeof(int16_t));
+	if(haptics_in_frames > CHIAKI_HAPTICS_PACKET_FRAMES_MAX)
 	{
-		for (int i=0; i < buf_size; i+=4)
-		{
-			SDL_memset(haptics_resampler_buf + i * 2, 0, 4);
-			SDL_memcpy(haptics_resampler_buf + (i * 2) + 4, buf + i, 4);
-		}
+		CHIAKI_LOGE(log.GetChiakiLog(), "Haptics audio too large: %zu", buf_size);
+		return;
 	}
-	else
+	// Remix to 4 channels and resample to 48kHz
+	float haptics_gain = (haptic_override > 0.99 && haptic_override < 1.01) ? 1.0f : (float)haptic_override;
+	size_t haptics_resampled_frames = chiaki_haptics_processor_process(&haptics_processor, (const int16_t *)buf, haptics_in_frames, haptics_gain,
+			haptics_resampler_buf, chiaki_haptics_processor_output_frames(&haptics_processor, CHIAKI_HAPTICS_PACKET_FRAMES_MAX));
+
+	// Hold the device queue at two periods, the controller starts over whenever haptics resume after a pause
+	const size_t haptics_frame_size = 4 * sizeof(int16_t);
+	size_t queued_frames = SDL_GetQueuedAudioSize(haptics_output) / haptics_frame_size;
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+	if(haptics_drift.started && now_us - haptics_drift.last_us > HAPTICS_PAUSE_US)
 	{
-		for (int i=0; i < buf_size; i+=4)
-		{
-			SDL_memset(haptics_resampler_buf + i * 2, 0, 4);
-			SDL_memcpy(haptics_resampler_buf + (i * 2) + 4, buf + i, 4);
-			int16_t amplitudel = (*reinterpret_cast<int16_t *>(haptics_resampler_buf + (i * 2) + 4));
-			int32_t adjustedl = static_cast<int32_t>(amplitudel) * haptic_override;
-			adjustedl = (adjustedl > INT16_MAX) ? INT16_MAX : adjustedl;
-			amplitudel = (adjustedl < INT16_MIN) ? INT16_MIN : adjustedl;
-			(*reinterpret_cast<int16_t *>(haptics_resampler_buf + (i * 2) + 4)) = amplitudel;
-			int16_t amplituder = (*reinterpret_cast<int16_t *>(haptics_resampler_buf + (i * 2) + 6));
-			int32_t adjustedr = static_cast<int32_t>(amplituder) * haptic_override;
-			adjustedr = (adjustedr > INT16_MAX) ? INT16_MAX : adjustedr;
-			amplituder = (adjustedr < INT16_MIN) ? INT16_MIN : adjustedr;
-			(*reinterpret_cast<int16_t *>(haptics_resampler_buf + (i * 2) + 6)) = amplituder;
-		}
-	}
-	// Resample to 48kHZ
-	if (SDL_ConvertAudio(&cvt) != 0)
-	{
-		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample haptics audio: %s", SDL_GetError());
-		return;
+		chiaki_audio_drift_controller_init(&haptics_drift, (size_t)haptics_drift.target);
+		chiaki_audio_resampler_reset(&haptics_drift_resampler);
 	}
+	double ratio = chiaki_audio_drift_controller_update(&haptics_drift, queued_frames, now_us);
+	chiaki_audio_resampler_set_ratio(&haptics_drift_resampler, ratio);
+	size_t haptics_frames = chiaki_audio_resampler_process(&haptics_drift_resampler, haptics_resampler_buf,
+			haptics_resampled_frames, haptics_drift_buf, haptics_drift_buf_frames);
 
-	if (SDL_QueueAudio(haptics_output, cvt.buf, cvt.len_cvt) < 0)
+	if (SDL_QueueAudio(haptics_output, haptics_drift_buf, (Uint32)(haptics_frames * haptics_frame_size)) < 0)
 	{
 		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to submit haptics audio to device: %s", SDL_GetError());
 		return;
@@ -2402,6 +2238,10 @@ void StreamSession::Event(ChiakiEvent *event)
 			{
 				CHIAKI_LOGW(log.GetChiakiLog(), "Video FEC failure, waiting for requested IDR");
 			}
+			else if(event->video_fec_failure.idr_deferred)
+			{
+				CHIAKI_LOGW(log.GetChiakiLog(), "Video FEC failure, recovering from remaining reference frames");
+			}
 			else
 			{
 				CHIAKI_LOGW(log.GetChiakiLog(), "Video FEC failure, retrying IDR request after send failure");
@@ -2419,19 +2259,17 @@ void StreamSession::Event(ChiakiEvent *event)
 			if(sdeck)
 			{
 				chiaki_accel_new_zero_set_active(&sdeck_accel_zero, sdeck_real_accel.accel_x, sdeck_real_accel.accel_y, sdeck_real_accel.accel_z, false);
-				chiaki_orientation_tracker_init(&sdeck_orient_tracker);
-				chiaki_orientation_tracker_update(
+				chiaki_orientation_tracker_reset(
 					&sdeck_orient_tracker, sdeck_state.gyro_x, sdeck_state.gyro_y, sdeck_state.gyro_z,
-					sdeck_real_accel.accel_x, sdeck_real_accel.accel_y, sdeck_real_accel.accel_z, &sdeck_accel_zero, false, chiaki_time_now_monotonic_us());
+					sdeck_real_accel.accel_x, sdeck_real_accel.accel_y, sdeck_real_accel.accel_z, &sdeck_accel_zero, chiaki_time_now_monotonic_us());
 				chiaki_orientation_tracker_apply_to_controller_state(&sdeck_orient_tracker, &sdeck_state);
 			}
 #endif
 #if CHIAKI_GUI_ENABLE_SETSU
 			chiaki_accel_new_zero_set_active(&setsu_accel_zero, setsu_real_accel.accel_x, setsu_real_accel.accel_y, setsu_real_accel.accel_z, false);
-			chiaki_orientation_tracker_init(&orient_tracker);
-			chiaki_orientation_tracker_update(
+			chiaki_orientation_tracker_reset(
 				&orient_tracker, setsu_state.gyro_x, setsu_state.gyro_y, setsu_state.gyro_z,
-				setsu_real_accel.accel_x, setsu_real_accel.accel_y, setsu_real_accel.accel_z, &setsu_accel_zero, false, chiaki_time_now_monotonic_us());
+				setsu_real_accel.accel_x, setsu_real_accel.accel_y, setsu_real_accel.accel_z, &setsu_accel_zero, chiaki_time_now_monotonic_us());
 			chiaki_orientation_tracker_apply_to_controller_state(&orient_tracker, &setsu_state);
 #endif
 			break;
@@ -2521,28 +2359,32 @@ void StreamSession::HandleSDeckEvent(SDeckEvent *event)
 	// right now only one event, use switch here for more in the future
 	switch(event->type)
 	{
-		case SDECK_EVENT_MOTION:
+		case SDECK_EVENT_MOTION: {
+			ChiakiMotionSample sample = {};
+			sample.timestamp_us = chiaki_time_now_monotonic_us();
+			sample.flags = CHIAKI_MOTION_SAMPLE_GYRO | CHIAKI_MOTION_SAMPLE_ACCEL;
+			sample.gyro_x = event->motion.gyro_x;
+			sample.accel_x = event->motion.accel_x;
 			if(!vertical_sdeck)
 			{
-				chiaki_accel_new_zero_set_active(&sdeck_real_accel, event->motion.accel_x,
-				event->motion.accel_y, event->motion.accel_z, true);
-				chiaki_orientation_tracker_update(&sdeck_orient_tracker,
-					event->motion.gyro_x, event->motion.gyro_y, event->motion.gyro_z,
-					event->motion.accel_x, event->motion.accel_y, event->motion.accel_z,
-					&sdeck_accel_zero, false, chiaki_time_now_monotonic_us());
+				sample.gyro_y = event->motion.gyro_y;
+				sample.gyro_z = event->motion.gyro_z;
+				sample.accel_y = event->motion.accel_y;
+				sample.accel_z = event->motion.accel_z;
 			}
 			else // swap y with z axis to use roll instead of yaw
 			{
-				// use calculated orient
-				chiaki_accel_new_zero_set_active(&sdeck_real_accel, event->motion.accel_x,
-				-event->motion.accel_z, event->motion.accel_y, true);
-				chiaki_orientation_tracker_update(&sdeck_orient_tracker,
-					event->motion.gyro_x, -event->motion.gyro_z, event->motion.gyro_y,
-					event->motion.accel_x, -event->motion.accel_z, event->motion.accel_y,
-					&sdeck_accel_zero, false, chiaki_time_now_monotonic_us());
+				sample.gyro_y = -event->motion.gyro_z;
+				sample.gyro_z = event->motion.gyro_y;
+				sample.accel_y = -event->motion.accel_z;
+				sample.accel_z = event->motion.accel_y;
 			}
+			chiaki_accel_new_zero_set_active(&sdeck_real_accel, sample.accel_x,
+			sample.accel_y, sample.accel_z, true);
+			chiaki_orientation_tracker_update_sample(&sdeck_orient_tracker, &sample, &sdeck_accel_zero);
 			sdeck_orient_dirty = true;
 			break;
+		}
 		case SDECK_EVENT_GYRO_ENABLE:
 			if(event->enabled)
 				CHIAKI_LOGI(GetChiakiLog(), "Gyro enabled for Steam Deck");
@@ -2560,6 +2402,19 @@ void StreamSession::CantDisplayMessage(bool cant_display)
 }
 
 #if CHIAKI_GUI_ENABLE_SETSU
+void StreamSession::DispatchSetsu()
+{
+	if(!setsu)
+		return;
+	setsu_dispatch(setsu, SessionSetsuCb, this);
+	if(orient_dirty)
+	{
+		chiaki_orientation_tracker_apply_to_controller_state_at(&orient_tracker, &setsu_state, chiaki_time_now_monotonic_us());
+		SendFeedbackState();
+		orient_dirty = false;
+	}
+}
+
 void StreamSession::HandleSetsuEvent(SetsuEvent *event)
 {
 	if(!setsu)
@@ -2655,19 +2510,43 @@ void StreamSession::HandleSetsuEvent(SetsuEvent *event)
 		case SETSU_EVENT_BUTTON_UP:
 			setsu_state.buttons &= ~CHIAKI_CONTROLLER_BUTTON_TOUCHPAD;
 			break;
-		case SETSU_EVENT_MOTION:
-			chiaki_accel_new_zero_set_active(&sdeck_real_accel, event->motion.accel_x,
+		case SETSU_EVENT_MOTION: {
+			chiaki_accel_new_zero_set_active(&setsu_real_accel, event->motion.accel_x,
 			event->motion.accel_y, event->motion.accel_z, true);
-			chiaki_orientation_tracker_update(&orient_tracker,
-					event->motion.gyro_x, event->motion.gyro_y, event->motion.gyro_z,
-					event->motion.accel_x, event->motion.accel_y, event->motion.accel_z,
-					&setsu_accel_zero, false, event->motion.timestamp);
+			// kernel timestamp, the same clock as chiaki_time_now_monotonic_us()
+			ChiakiMotionSample sample = {};
+			sample.timestamp_us = event->time_us;
+			sample.flags = CHIAKI_MOTION_SAMPLE_GYRO | CHIAKI_MOTION_SAMPLE_ACCEL;
+			sample.gyro_x = event->motion.gyro_x;
+			sample.gyro_y = event->motion.gyro_y;
+			sample.gyro_z = event->motion.gyro_z;
+			sample.accel_x = event->motion.accel_x;
+			sample.accel_y = event->motion.accel_y;
+			sample.accel_z = event->motion.accel_z;
+			chiaki_orientation_tracker_update_sample(&orient_tracker, &sample, &setsu_accel_zero);
 			orient_dirty = true;
 			break;
+		}
 	}
 }
 #endif
 
+/**
+ * Network paths learned during remote connections, shared by all sessions for the lifetime of the process.
+ */
+static ChiakiNetworkPathCache *GetNetworkPathCache()
+{
+	static ChiakiNetworkPathCache cache;
+	static const bool initialized = [] {
+		auto base_dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+		if(base_dir.isEmpty() || !QDir().mkpath(base_dir))
+			return chiaki_network_path_cache_init(&cache, nullptr, nullptr) == CHIAKI_ERR_SUCCESS;
+		QString file = QDir(base_dir).absoluteFilePath("network-paths.json");
+		return chiaki_network_path_cache_init(&cache, file.toUtf8().constData(), nullptr) == CHIAKI_ERR_SUCCESS;
+	}();
+	return initialized ? &cache : nullptr;
+}
+
 ChiakiErrorCode StreamSession::InitiatePsnConnection(QString psn_token)
 {
 	ChiakiLog *log = GetChiakiLog();
@@ -2686,6 +2565,7 @@ ChiakiErrorCode StreamSession::InitiatePsnConnection(QString psn_token)
 	chiaki_holepunch_session_set_port_guessing_socks(
 			holepunch_session,
 			port_guess_socket_count);
+	chiaki_holepunch_session_set_path_cache(holepunch_session, GetNetworkPathCache());
 	return CHIAKI_ERR_SUCCESS;
 }
 
@@ -2794,11 +2674,13 @@ class StreamSessionPrivate
 		static void Event(StreamSession *session, ChiakiEvent *event)							{ session->Event(event); }
 #if CHIAKI_GUI_ENABLE_SETSU
 		static void HandleSetsuEvent(StreamSession *session, SetsuEvent *event)					{ session->HandleSetsuEvent(event); }
+		static void DispatchSetsu(StreamSession *session)										{ session->DispatchSetsu(); }
 #endif
 #if CHIAKI_GUI_ENABLE_STEAMDECK_NATIVE
 		static void HandleSDeckEvent(StreamSession *session, SDeckEvent *event)					{ session->HandleSDeckEvent(event); }
 #endif
 		static void TriggerFfmpegFrameAvailable(StreamSession *session)							{ session->TriggerFfmpegFrameAvailable(); }
+		static void PushControllerInput(StreamSession *session, ChiakiControllerState *state)	{ session->PushControllerInput(state); }
 };
 
 static void AudioSettingsCb(uint32_t channels, uint32_t rate, void *user)
@@ -2845,6 +2727,14 @@ static void SessionSetsuCb(SetsuEvent *event, void *user)
 	auto session = reinterpret_cast<StreamSession *>(user);
 	StreamSessionPrivate::HandleSetsuEvent(session, event);
 }
+
+static void SessionSetsuNotifyCb(void *user)
+{
+	auto session = reinterpret_cast<StreamSession *>(user);
+	QMetaObject::invokeMethod(session, [session]() {
+		StreamSessionPrivate::DispatchSetsu(session);
+	}, Qt::QueuedConnection);
+}
 #endif
 
 #if CHIAKI_GUI_ENABLE_STEAMDECK_NATIVE
@@ -2855,6 +2745,12 @@ static void SessionSDeckCb(SDeckEvent *event, void *user)
 }
 #endif
 
+static void SessionControllerInputCb(ChiakiControllerState *state, void *user)
+{
+	auto session = reinterpret_cast<StreamSession *>(user);
+	StreamSessionPrivate::PushControllerInput(session, state);
+}
+
 static void FfmpegFrameCb(ChiakiFfmpegDecoder *decoder, void *user)
 {
 	auto session = reinterpret_cast<StreamSession *>(user);
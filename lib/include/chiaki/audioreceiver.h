@@ -9,6 +9,7 @@
 #include "takion.h"
 #include "thread.h"
 #include "packetstats.h"
+#include "seqnum.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,14 +20,58 @@ typedef void (*ChiakiAudioSinkFrame)(uint8_t *buf, size_t buf_size, void *user);
 
 /**
  * Sink that receives Audio encoded as Opus
+ *
+ * frame_cb is called with buf == NULL for a lost frame that should be concealed.
+ * If fec_frame_cb is set and the frame following a lost one is available, it is called
+ * instead with that following frame, to recover the lost one from its in-band FEC data.
  */
 typedef struct chiaki_audio_sink_t
 {
 	void *user;
 	ChiakiAudioSinkHeader header_cb;
 	ChiakiAudioSinkFrame frame_cb;
+	ChiakiAudioSinkFrame fec_frame_cb; // optional
 } ChiakiAudioSink;
 
+#define CHIAKI_AUDIO_JITTER_BUFFER_SIZE 16
+#define CHIAKI_AUDIO_JITTER_TARGET_MIN 1
+#define CHIAKI_AUDIO_JITTER_TARGET_MAX 12
+#define CHIAKI_AUDIO_JITTER_TARGET_INITIAL 3
+
+/**
+ * Estimates the inter-arrival jitter of audio frames (RFC 3550, 6.4.1) and derives
+ * how many frames the jitter buffer should wait for before treating a missing frame as lost.
+ * The target grows immediately when jitter increases and shrinks slowly on a clean network.
+ */
+typedef struct chiaki_audio_jitter_estimator_t
+{
+	uint64_t frame_duration_us;
+	bool have_prev;
+	ChiakiSeqNum16 frame_index_prev;
+	uint64_t arrival_prev_us;
+	double jitter_us;
+	unsigned target;
+	uint64_t shrink_at_us;
+} ChiakiAudioJitterEstimator;
+
+CHIAKI_EXPORT void chiaki_audio_jitter_estimator_init(ChiakiAudioJitterEstimator *estimator, uint64_t frame_duration_us);
+
+/**
+ * @param frame_index index of the first frame contained in the received packet
+ * @param arrival_us monotonic time the packet was received
+ * @return the new target depth in frames
+ */
+CHIAKI_EXPORT unsigned chiaki_audio_jitter_estimator_push(ChiakiAudioJitterEstimator *estimator, ChiakiSeqNum16 frame_index, uint64_t arrival_us);
+
+typedef struct chiaki_audio_receiver_stats_t
+{
+	double jitter_ms;
+	unsigned target_frames;
+	size_t buffered_frames;
+	uint64_t frames_concealed; // replaced by PLC
+	uint64_t frames_fec_recovered; // recovered from in-band FEC of the following frame
+} ChiakiAudioReceiverStats;
+
 typedef struct chiaki_audio_receiver_t
 {
 	struct chiaki_session_t *session;
@@ -43,14 +88,18 @@ typedef struct chiaki_audio_receiver_t
 		ChiakiSeqNum16 frame_index;
 		uint8_t *buf;
 		size_t buf_size;
-	} jitter_buffer[8];
+	} jitter_buffer[CHIAKI_AUDIO_JITTER_BUFFER_SIZE];
 	size_t jitter_buffer_count;
+	ChiakiAudioJitterEstimator jitter;
+	uint64_t frames_concealed;
+	uint64_t frames_fec_recovered;
 } ChiakiAudioReceiver;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_receiver_init(ChiakiAudioReceiver *audio_receiver, struct chiaki_session_t *session, ChiakiPacketStats *packet_stats);
 CHIAKI_EXPORT void chiaki_audio_receiver_fini(ChiakiAudioReceiver *audio_receiver);
 CHIAKI_EXPORT void chiaki_audio_receiver_stream_info(ChiakiAudioReceiver *audio_receiver, ChiakiAudioHeader *audio_header);
 CHIAKI_EXPORT void chiaki_audio_receiver_av_packet(ChiakiAudioReceiver *audio_receiver, ChiakiTakionAVPacket *packet);
+CHIAKI_EXPORT void chiaki_audio_receiver_get_stats(ChiakiAudioReceiver *audio_receiver, ChiakiAudioReceiverStats *stats);
 
 static inline ChiakiAudioReceiver *chiaki_audio_receiver_new(struct chiaki_session_t *session, ChiakiPacketStats *packet_stats)
 {
@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_AUDIORESAMPLER_H
+#define CHIAKI_AUDIORESAMPLER_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_AUDIO_RESAMPLER_CHANNELS_MAX 8
+#define CHIAKI_AUDIO_RESAMPLER_TAPS 16
+#define CHIAKI_AUDIO_RESAMPLER_PHASES 128
+
+/**
+ * Largest deviation from 1.0 accepted by chiaki_audio_resampler_set_ratio()
+ */
+#define CHIAKI_AUDIO_RESAMPLER_RATIO_RANGE 0.015
+
+/**
+ * Streaming windowed-sinc resampler for ratios very close to 1.0,
+ * meant for stretching or squeezing a stream by a few hundred ppm to compensate clock drift.
+ *
+ * Works on interleaved signed 16 bit samples, keeps its history internally so input may be fed
+ * in arbitrarily sized chunks, and never allocates.
+ */
+typedef struct chiaki_audio_resampler_t
+{
+	unsigned int channels;
+	double step; // input frames per output frame, i.e. 1 / ratio
+	double phase; // position of the next output frame after the center of the history, in input frames
+	float history[CHIAKI_AUDIO_RESAMPLER_CHANNELS_MAX][CHIAKI_AUDIO_RESAMPLER_TAPS * 2]; // every frame is written twice, so a window is always contiguous
+	unsigned int history_pos;
+	float kernel[CHIAKI_AUDIO_RESAMPLER_PHASES + 1][CHIAKI_AUDIO_RESAMPLER_TAPS];
+} ChiakiAudioResampler;
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_resampler_init(ChiakiAudioResampler *resampler, unsigned int channels);
+CHIAKI_EXPORT void chiaki_audio_resampler_reset(ChiakiAudioResampler *resampler);
+
+/**
+ * @param ratio output frames per input frame, clamped to 1.0 +/- CHIAKI_AUDIO_RESAMPLER_RATIO_RANGE
+ */
+CHIAKI_EXPORT void chiaki_audio_resampler_set_ratio(ChiakiAudioResampler *resampler, double ratio);
+
+/**
+ * @return number of frames the output buffer of chiaki_audio_resampler_process() must be able to hold for in_frames
+ */
+static inline size_t chiaki_audio_resampler_output_max(size_t in_frames)
+{
+	return in_frames + in_frames / 64 + 2;
+}
+
+/**
+ * @param in interleaved input, in_frames * channels samples
+ * @param out interleaved output, room for out_frames_max * channels samples
+ * @return number of frames written to out
+ */
+CHIAKI_EXPORT size_t chiaki_audio_resampler_process(ChiakiAudioResampler *resampler, const int16_t *in, size_t in_frames, int16_t *out, size_t out_frames_max);
+
+/**
+ * Adaptive playout controller, holding the fill level of an output buffer at a latency target
+ * by slightly adjusting the resampling ratio instead of dropping or inserting audio.
+ *
+ * The fill level is smoothed over about a second to average out the sawtooth caused by the device
+ * pulling whole periods, then a PI controller maps the deviation from the target to a ratio
+ * of at most CHIAKI_AUDIO_DRIFT_PPM_MAX away from 1.0, which is far below audible pitch changes.
+ */
+#define CHIAKI_AUDIO_DRIFT_PPM_MAX 2000
+
+typedef struct chiaki_audio_drift_controller_t
+{
+	double target; // frames
+	double fill; // smoothed, frames
+	double integral;
+	double ratio;
+	uint64_t last_us;
+	bool started;
+} ChiakiAudioDriftController;
+
+CHIAKI_EXPORT void chiaki_audio_drift_controller_init(ChiakiAudioDriftController *controller, size_t target_frames);
+
+/**
+ * Feed the current fill level of the output buffer.
+ *
+ * @param buffered_frames frames currently waiting to be played
+ * @param now_us monotonic time
+ * @return ratio to use for chiaki_audio_resampler_set_ratio()
+ */
+CHIAKI_EXPORT double chiaki_audio_drift_controller_update(ChiakiAudioDriftController *controller, size_t buffered_frames, uint64_t now_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_AUDIORESAMPLER_H
@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_AUDIORING_H
+#define CHIAKI_AUDIORING_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Single-producer single-consumer ring of interleaved PCM for pull-model audio output.
+ *
+ * The decoder thread writes with chiaki_audio_ring_write(), the audio device callback reads with
+ * chiaki_audio_ring_read(). Neither side takes a lock or allocates; all memory is allocated once
+ * by chiaki_audio_ring_init().
+ *
+ * Latency is controlled entirely on the consumer side: read_pos is owned by the consumer,
+ * so when the buffered amount grows beyond twice the latency target (e.g. because the host's clock
+ * runs slightly fast or a burst of delayed packets arrives), the reader skips the oldest audio to get
+ * back to the target. After an underrun, playback only resumes once the target is buffered again,
+ * so a starving stream turns into one gap instead of constant crackling.
+ *
+ * write_pos and read_pos are free-running byte counters, each written by one side only
+ * and accessed atomically by the other. They are allowed to wrap around, which is why size is a power of two.
+ */
+typedef struct chiaki_audio_ring_t
+{
+	uint8_t *buf;
+	size_t size; // bytes, power of two
+	size_t frame_size; // bytes per sample frame, i.e. all channels of one sample
+	unsigned int rate;
+	size_t target; // bytes
+	size_t write_pos;
+	size_t read_pos;
+	bool primed; // consumer only
+
+	// statistics, written by the consumer only
+	uint64_t underruns;
+	uint64_t dropped_bytes;
+	uint64_t silence_bytes;
+} ChiakiAudioRing;
+
+/**
+ * @param frame_size bytes per sample frame (channels * bytes per sample)
+ * @param rate sample rate in Hz
+ * @param target_ms amount of audio to keep buffered between producer and consumer
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_ring_init(ChiakiAudioRing *ring, size_t frame_size, unsigned int rate, unsigned int target_ms);
+CHIAKI_EXPORT void chiaki_audio_ring_fini(ChiakiAudioRing *ring);
+
+/**
+ * Producer side. If the ring is completely full, the incoming audio that does not fit is discarded,
+ * the consumer will trim the backlog on its next read.
+ *
+ * @return number of bytes actually written
+ */
+CHIAKI_EXPORT size_t chiaki_audio_ring_write(ChiakiAudioRing *ring, const uint8_t *buf, size_t buf_size);
+
+/**
+ * Producer side. Like chiaki_audio_ring_write(), but scales the samples by volume (0-128, as SDL_MIX_MAXVOLUME)
+ * while copying them into the ring. The ring must hold signed 16 bit samples.
+ *
+ * @param samples_count number of individual samples, i.e. sample frames * channels
+ */
+CHIAKI_EXPORT size_t chiaki_audio_ring_write_s16(ChiakiAudioRing *ring, const int16_t *buf, size_t samples_count, int volume);
+
+/**
+ * Consumer side, safe to call from a real-time audio callback.
+ * Always fills all of buf, with silence where no audio is available.
+ */
+CHIAKI_EXPORT void chiaki_audio_ring_read(ChiakiAudioRing *ring, uint8_t *buf, size_t buf_size);
+
+/**
+ * @return number of bytes currently buffered, may be called from either side
+ */
+CHIAKI_EXPORT size_t chiaki_audio_ring_buffered(ChiakiAudioRing *ring);
+
+CHIAKI_EXPORT unsigned int chiaki_audio_ring_buffered_ms(ChiakiAudioRing *ring);
+
+/**
+ * Consumer side. Drop everything buffered and wait for the target to fill up again.
+ */
+CHIAKI_EXPORT void chiaki_audio_ring_flush(ChiakiAudioRing *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_AUDIORING_H
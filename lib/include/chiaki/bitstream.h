@@ -23,6 +23,11 @@ typedef struct chiaki_bitstream_t
 			struct
 			{
 				uint32_t log2_max_frame_num_minus4;
+				uint32_t pic_order_cnt_type;
+				uint32_t log2_max_pic_order_cnt_lsb_minus4;
+				uint32_t max_num_ref_frames;
+				uint32_t width;
+				uint32_t height;
 			} sps;
 		} h264;
 
@@ -31,6 +36,10 @@ typedef struct chiaki_bitstream_t
 			struct
 			{
 				uint32_t log2_max_pic_order_cnt_lsb_minus4;
+				uint32_t max_dec_pic_buffering_minus1;
+				uint32_t slice_segment_address_bits;
+				uint32_t width;
+				uint32_t height;
 			} sps;
 		} h265;
 	};
@@ -43,10 +52,25 @@ typedef enum chiaki_bitstream_slice_type_t
 	CHIAKI_BITSTREAM_SLICE_P,
 } ChiakiBitstreamSliceType;
 
+#define CHIAKI_BITSTREAM_REF_PICS_MAX 16
+
 typedef struct chiaki_bitstream_slice_t
 {
 	ChiakiBitstreamSliceType slice_type;
 	unsigned reference_frame;
+
+	/**
+	 * H264 only: code length of the abs_diff_pic_num_minus1 reference_frame was parsed from.
+	 * 0 if the slice carries no ref_pic_list_modification, so its reference can't be rewritten in place.
+	 */
+	unsigned reference_frame_bits;
+
+	/**
+	 * H265 only: distances (in frames) of all negative pictures in the short-term RPS of the slice,
+	 * i.e. the references the encoder keeps alive after this picture. reference_frame indexes into this.
+	 */
+	unsigned ref_pics_count;
+	uint8_t ref_pics[CHIAKI_BITSTREAM_REF_PICS_MAX];
 } ChiakiBitstreamSlice;
 
 CHIAKI_EXPORT void chiaki_bitstream_init(ChiakiBitstream *bitstream, ChiakiLog *log, ChiakiCodec codec);
@@ -54,6 +78,31 @@ CHIAKI_EXPORT bool chiaki_bitstream_header(ChiakiBitstream *bitstream, uint8_t *
 CHIAKI_EXPORT bool chiaki_bitstream_slice(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, ChiakiBitstreamSlice *slice);
 CHIAKI_EXPORT bool chiaki_bitstream_slice_set_reference_frame(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, unsigned reference_frame);
 
+/**
+ * Number of bits value takes as an Exp-Golomb ue(v) code.
+ */
+CHIAKI_EXPORT unsigned chiaki_bitstream_ue_len(unsigned value);
+
+/**
+ * Max number of frames the encoder keeps as references, as signaled in the last parsed header.
+ */
+CHIAKI_EXPORT unsigned chiaki_bitstream_max_ref_frames(ChiakiBitstream *bitstream);
+
+/**
+ * Size of the pictures after cropping, as signaled in the last parsed header.
+ */
+CHIAKI_EXPORT void chiaki_bitstream_size(ChiakiBitstream *bitstream, unsigned *width, unsigned *height);
+
+/**
+ * Retarget every P slice of a whole frame (access unit) to reference_frame.
+ * The rewrite happens in place, so it only succeeds if the new value can be coded
+ * in exactly the same number of bits (always the case for H265, see chiaki_bitstream_slice_set_reference_frame).
+ * For H264, the slices must already carry a ref_pic_list_modification.
+ *
+ * @return true if at least one slice was changed and no slice failed. On failure, data may be partially modified.
+ */
+CHIAKI_EXPORT bool chiaki_bitstream_frame_set_reference_frame(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, unsigned reference_frame);
+
 #ifdef __cplusplus
 }
 #endif
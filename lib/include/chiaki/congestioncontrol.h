@@ -17,6 +17,8 @@ typedef struct chiaki_congestion_control_t
 	ChiakiPacketStats *stats;
 	ChiakiThread thread;
 	ChiakiBoolPredCond stop_cond;
+	ChiakiExecutor *executor; // taken from takion, runs the control instead of thread if set
+	ChiakiExecutorTask task;
 	double packet_loss;
 	double packet_loss_max;
 } ChiakiCongestionControl;
@@ -24,7 +26,7 @@ typedef struct chiaki_congestion_control_t
 CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionControl *control, ChiakiTakion *takion, ChiakiPacketStats *stats, double packet_loss_max);
 
 /**
- * Stop control and join the thread
+ * Stop control and join the thread or cancel the task
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_stop(ChiakiCongestionControl *control);
 
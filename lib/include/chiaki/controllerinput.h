@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_CONTROLLERINPUT_H
+#define CHIAKI_CONTROLLERINPUT_H
+
+#include "common.h"
+#include "controller.h"
+#include "thread.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_CONTROLLER_INPUT_SOURCES_MAX 16
+#define CHIAKI_CONTROLLER_INPUT_POLL_TIMEOUT_MS 10
+
+typedef struct chiaki_controller_input_t ChiakiControllerInput;
+
+/**
+ * Wait up to timeout_ms for input from the devices and report it with chiaki_controller_input_set_source().
+ * Only called on the input thread.
+ */
+typedef void (*ChiakiControllerInputPollCb)(ChiakiControllerInput *input, uint32_t timeout_ms, void *user);
+
+/**
+ * Receives the merged state of all sources whenever it changes.
+ * Called on the thread that updated a source with the input locked, so it must not call back into the input.
+ */
+typedef void (*ChiakiControllerInputSinkCb)(ChiakiControllerState *state, void *user);
+
+/**
+ * Collects the state of all controllers on a thread of its own, independently of the frontend's event loop,
+ * and hands the merged state straight to a sink such as the session.
+ */
+struct chiaki_controller_input_t
+{
+	ChiakiThread thread;
+	bool thread_running;
+	bool should_stop;
+	ChiakiMutex mutex;
+
+	ChiakiControllerInputPollCb poll_cb;
+	void *poll_cb_user;
+	ChiakiControllerInputSinkCb sink_cb;
+	void *sink_cb_user;
+
+	bool sources_used[CHIAKI_CONTROLLER_INPUT_SOURCES_MAX];
+	ChiakiControllerState sources[CHIAKI_CONTROLLER_INPUT_SOURCES_MAX];
+	ChiakiControllerState state; // all sources merged in index order
+};
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_controller_input_init(ChiakiControllerInput *input);
+
+/**
+ * The thread must have been stopped before.
+ */
+CHIAKI_EXPORT void chiaki_controller_input_fini(ChiakiControllerInput *input);
+
+/**
+ * Start the input thread, which calls poll_cb in a loop until chiaki_controller_input_stop().
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_controller_input_start(ChiakiControllerInput *input, ChiakiControllerInputPollCb poll_cb, void *poll_cb_user);
+
+/**
+ * Join the input thread, which takes at most one poll timeout.
+ */
+CHIAKI_EXPORT void chiaki_controller_input_stop(ChiakiControllerInput *input);
+
+/**
+ * @return index of the new idle source or -1 if all are in use
+ */
+CHIAKI_EXPORT int chiaki_controller_input_add_source(ChiakiControllerInput *input);
+CHIAKI_EXPORT void chiaki_controller_input_remove_source(ChiakiControllerInput *input, int source);
+
+/**
+ * Replace the state of source and push the merged state to the sink if that changed.
+ * May be called from any thread.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_controller_input_set_source(ChiakiControllerInput *input, int source, const ChiakiControllerState *state);
+
+CHIAKI_EXPORT void chiaki_controller_input_get(ChiakiControllerInput *input, ChiakiControllerState *state);
+
+/**
+ * Set or with cb NULL unset the sink. A new sink gets the current state right away.
+ * Once this returns, the previous sink is not called anymore.
+ */
+CHIAKI_EXPORT void chiaki_controller_input_set_sink(ChiakiControllerInput *input, ChiakiControllerInputSinkCb cb, void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_CONTROLLERINPUT_H
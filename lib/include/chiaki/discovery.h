@@ -79,6 +79,11 @@ CHIAKI_EXPORT ChiakiTarget chiaki_discovery_host_system_version_target(ChiakiDis
 
 CHIAKI_EXPORT int chiaki_discovery_packet_fmt(char *buf, size_t buf_size, ChiakiDiscoveryPacket *packet);
 
+/**
+ * Parse a response to a SRCH packet. buf is modified and the strings of response point into buf and addr_buf.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_srch_response_parse(ChiakiDiscoveryHost *response, struct sockaddr *addr, char *addr_buf, size_t addr_buf_size, char *buf, size_t buf_size);
+
 typedef struct chiaki_discovery_t
 {
 	ChiakiLog *log;
@@ -111,6 +116,36 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_thread_stop(ChiakiDiscoveryThread
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_wakeup(ChiakiLog *log, ChiakiDiscovery *discovery, const char *host, uint64_t user_credential, bool ps5);
 
+/**
+ * Get the user credential for a wakeup packet from a regist key, i.e. the key interpreted as hex
+ * @param regist_key null-padded regist key
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_regist_key_credential(const char *regist_key, size_t regist_key_size, uint64_t *credential);
+
+typedef struct chiaki_discovery_wake_options_t
+{
+	uint64_t user_credential;
+	bool ps5;
+	uint16_t port; // discovery port of the console, 0 for the default one
+	uint64_t probe_initial_ms; // first unicast search interval, doubled after every probe
+	uint64_t probe_max_ms;
+	uint64_t wakeup_resend_ms;
+	uint64_t timeout_ms;
+} ChiakiDiscoveryWakeOptions;
+
+CHIAKI_EXPORT void chiaki_discovery_wake_options_default(ChiakiDiscoveryWakeOptions *options, uint64_t user_credential, bool ps5);
+
+/**
+ * Send a wakeup packet to addr and probe it with unicast searches until the console reports ready.
+ * Probing starts right away and backs off exponentially, so a console that is already awake
+ * or wakes up quickly is noticed within a few milliseconds instead of the next regular ping.
+ *
+ * @param addr address of the console, the port is replaced by the discovery port
+ * @return CHIAKI_ERR_SUCCESS once the console is ready, CHIAKI_ERR_TIMEOUT or CHIAKI_ERR_CANCELED if stop_pipe was stopped
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_wake_wait_ready(ChiakiDiscovery *discovery, ChiakiStopPipe *stop_pipe,
+		const struct sockaddr *addr, socklen_t addr_len, const ChiakiDiscoveryWakeOptions *options);
+
 #ifdef __cplusplus
 }
 #endif
@@ -12,6 +12,19 @@ extern "C" {
 
 typedef void (*ChiakiDiscoveryServiceCb)(ChiakiDiscoveryHost *hosts, size_t hosts_count, void *user);
 
+typedef enum chiaki_discovery_service_host_event_t
+{
+	CHIAKI_DISCOVERY_SERVICE_HOST_ADDED,
+	CHIAKI_DISCOVERY_SERVICE_HOST_CHANGED,
+	CHIAKI_DISCOVERY_SERVICE_HOST_REMOVED
+} ChiakiDiscoveryServiceHostEvent;
+
+/**
+ * Called for every single host that appeared, changed or disappeared.
+ * host and its strings are only valid during the call.
+ */
+typedef void (*ChiakiDiscoveryServiceHostCb)(ChiakiDiscoveryServiceHostEvent event, ChiakiDiscoveryHost *host, void *user);
+
 typedef struct chiaki_discovery_service_options_t
 {
 	size_t hosts_max;
@@ -22,8 +35,11 @@ typedef struct chiaki_discovery_service_options_t
 	size_t send_addr_size;
 	struct sockaddr_storage *broadcast_addrs;
 	size_t broadcast_num;
-	char *send_host;
-	ChiakiDiscoveryServiceCb cb;
+	char *send_host; // resolved in the background, send_addr is only pinged once it is known
+	uint16_t ps4_port; // 0 for CHIAKI_DISCOVERY_PORT_PS4
+	uint16_t ps5_port; // 0 for CHIAKI_DISCOVERY_PORT_PS5
+	ChiakiDiscoveryServiceCb cb; // optional, called with all hosts once per batch of received responses that changed any of them
+	ChiakiDiscoveryServiceHostCb host_cb; // optional
 	void *cb_user;
 } ChiakiDiscoveryServiceOptions;
 
@@ -32,6 +48,23 @@ typedef struct chiaki_discovery_service_host_discovery_info_t
 	uint64_t last_ping_index;
 } ChiakiDiscoveryServiceHostDiscoveryInfo;
 
+typedef struct chiaki_discovery_service_ping_target_t
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_size;
+	size_t packet; // index into ping_packets
+} ChiakiDiscoveryServicePingTarget;
+
+typedef enum chiaki_discovery_service_resolve_state_t
+{
+	CHIAKI_DISCOVERY_SERVICE_RESOLVE_NONE,
+	CHIAKI_DISCOVERY_SERVICE_RESOLVE_RUNNING,
+	CHIAKI_DISCOVERY_SERVICE_RESOLVE_FAILED,
+	CHIAKI_DISCOVERY_SERVICE_RESOLVE_DONE
+} ChiakiDiscoveryServiceResolveState;
+
+#define CHIAKI_DISCOVERY_SERVICE_PING_PACKET_SIZE_MAX 128
+
 typedef struct chiaki_discovery_service_t
 {
 	ChiakiLog *log;
@@ -42,10 +75,24 @@ typedef struct chiaki_discovery_service_t
 	ChiakiDiscoveryHost *hosts;
 	ChiakiDiscoveryServiceHostDiscoveryInfo *host_discovery_infos;
 	size_t hosts_count;
+	size_t *host_table; // open addressing on the host id, indices into hosts or SIZE_MAX
+	size_t host_table_size; // power of two
 	ChiakiMutex state_mutex;
 
+	// both SRCH packets are formatted once and sent to all targets in one batch per ping
+	char ping_packets[2][CHIAKI_DISCOVERY_SERVICE_PING_PACKET_SIZE_MAX];
+	size_t ping_packets_size[2];
+	ChiakiDiscoveryServicePingTarget *ping_targets;
+	size_t ping_targets_count;
+
+	ChiakiThread resolve_thread;
+	bool resolve_thread_joinable;
+	ChiakiDiscoveryServiceResolveState resolve_state; // protected by state_mutex
+	struct sockaddr_storage resolved_addr;
+
 	ChiakiThread thread;
-	ChiakiBoolPredCond stop_cond;
+	ChiakiStopPipe stop_pipe; // also stopped by the resolve thread to wake up the service thread
+	bool stopping; // protected by state_mutex
 } ChiakiDiscoveryService;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_init(ChiakiDiscoveryService *service, ChiakiDiscoveryServiceOptions *options, ChiakiLog *log);
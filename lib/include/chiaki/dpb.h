@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_DPB_H
+#define CHIAKI_DPB_H
+
+#include "common.h"
+#include "seqnum.h"
+#include "bitstream.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_DPB_SIZE 16
+
+/**
+ * Model of the decoded picture buffer, mirroring which frames the encoder may still reference
+ * and which of them we actually handed to the decoder.
+ *
+ * Frames are stored by frame index modulo CHIAKI_DPB_SIZE, so lookups are O(1) and a frame
+ * automatically falls out once a frame CHIAKI_DPB_SIZE indices newer arrives.
+ */
+typedef struct chiaki_dpb_t
+{
+	ChiakiCodec codec;
+	ChiakiSeqNum16 frames[CHIAKI_DPB_SIZE];
+	uint32_t valid; // bitmask of slots in frames that hold a decoded reference
+	unsigned max_ref_frames; // H264 sliding window size (max_num_ref_frames)
+	unsigned h264_reference_bits; // H264: code length of the reference in the last P slice, 0 if it can't be rewritten
+} ChiakiDpb;
+
+CHIAKI_EXPORT void chiaki_dpb_init(ChiakiDpb *dpb, ChiakiCodec codec);
+
+/**
+ * Forget all references, e.g. on an IDR frame or a stream switch.
+ */
+CHIAKI_EXPORT void chiaki_dpb_reset(ChiakiDpb *dpb);
+
+/**
+ * @param max_ref_frames number of frames the encoder keeps as references, 0 to use CHIAKI_DPB_SIZE
+ */
+CHIAKI_EXPORT void chiaki_dpb_set_max_ref_frames(ChiakiDpb *dpb, unsigned max_ref_frames);
+
+/**
+ * Mark frame_index as successfully decoded, making it available as a reference.
+ * For H265, the frame's RPS (from slice) is applied first, dropping everything the encoder released.
+ *
+ * @param slice parsed first slice of the frame, may be NULL
+ */
+CHIAKI_EXPORT void chiaki_dpb_add(ChiakiDpb *dpb, ChiakiSeqNum16 frame_index, const ChiakiBitstreamSlice *slice);
+
+CHIAKI_EXPORT bool chiaki_dpb_has(ChiakiDpb *dpb, ChiakiSeqNum16 frame_index);
+
+/**
+ * @return frame index referenced by reference_frame (as in ChiakiBitstreamSlice) when decoding frame_index
+ */
+CHIAKI_EXPORT ChiakiSeqNum16 chiaki_dpb_reference_frame_index(ChiakiDpb *dpb, ChiakiSeqNum16 frame_index,
+		const ChiakiBitstreamSlice *slice, unsigned reference_frame);
+
+/**
+ * Collect all values for reference_frame that would make frame_index reference a frame that
+ * is both still held by the encoder and present in the dpb, nearest frame first.
+ *
+ * @return number of candidates written to candidates, 0 if the only way to recover is an IDR
+ */
+CHIAKI_EXPORT size_t chiaki_dpb_reference_candidates(ChiakiDpb *dpb, ChiakiSeqNum16 frame_index,
+		const ChiakiBitstreamSlice *slice, unsigned *candidates, size_t candidates_max);
+
+/**
+ * Check whether a P frame following frame_index (which is lost) could still be
+ * decoded against some reference, assuming the encoder's reference window.
+ * For H264, the reference must also be reachable by rewriting the slice in place,
+ * judged by the last P slice passed to chiaki_dpb_add().
+ */
+CHIAKI_EXPORT bool chiaki_dpb_can_recover(ChiakiDpb *dpb, ChiakiSeqNum16 frame_index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_DPB_H
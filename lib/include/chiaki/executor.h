@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_EXECUTOR_H
+#define CHIAKI_EXECUTOR_H
+
+#include "common.h"
+#include "log.h"
+#include "thread.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_EXECUTOR_THREADS_DEFAULT 2
+
+typedef void (*ChiakiExecutorTaskCb)(void *user);
+
+/**
+ * Timed callback run by a ChiakiExecutor.
+ * A task never runs on more than one thread at a time.
+ */
+typedef struct chiaki_executor_task_t
+{
+	ChiakiExecutorTaskCb cb;
+	void *user;
+	uint64_t due_ms; // chiaki_time_now_monotonic_ms()
+	uint64_t interval_ms; // 0 for a task that only runs once
+	size_t heap_index; // SIZE_MAX if not scheduled
+	bool running;
+	bool rescheduled; // scheduled again while running
+	uint64_t runs;
+} ChiakiExecutorTask;
+
+/**
+ * Small pool of threads running timed tasks, so that many sessions in one process don't need
+ * a thread of their own for every periodic job.
+ */
+typedef struct chiaki_executor_t
+{
+	ChiakiLog *log;
+	ChiakiThread *threads;
+	size_t threads_count;
+	ChiakiMutex mutex;
+	ChiakiCond cond; // the earliest due task changed or should_stop
+	ChiakiCond idle_cond; // a task finished running
+	ChiakiExecutorTask **heap; // min-heap on due_ms
+	size_t heap_count;
+	size_t heap_size;
+	bool should_stop;
+} ChiakiExecutor;
+
+/**
+ * @param threads_count number of worker threads, 0 for CHIAKI_EXECUTOR_THREADS_DEFAULT
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_executor_init(ChiakiExecutor *executor, ChiakiLog *log, size_t threads_count);
+
+/**
+ * Stop and join all threads. All tasks must have been canceled before.
+ */
+CHIAKI_EXPORT void chiaki_executor_fini(ChiakiExecutor *executor);
+
+CHIAKI_EXPORT void chiaki_executor_task_init(ChiakiExecutorTask *task, ChiakiExecutorTaskCb cb, void *user);
+
+/**
+ * Run task after delay_ms and then every interval_ms if interval_ms is not 0.
+ * Scheduling a task that is already scheduled moves it to the new time.
+ * May be called from any thread, including the task's own callback.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_executor_schedule(ChiakiExecutor *executor, ChiakiExecutorTask *task, uint64_t delay_ms, uint64_t interval_ms);
+
+/**
+ * Unschedule task and wait until it is not running anymore, so it can be freed afterwards.
+ * Must not be called from the task's own callback.
+ */
+CHIAKI_EXPORT void chiaki_executor_cancel(ChiakiExecutor *executor, ChiakiExecutorTask *task);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_EXECUTOR_H
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_FRAMEMAILBOX_H
+#define CHIAKI_FRAMEMAILBOX_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_FRAME_MAILBOX_SLOTS 3
+
+/**
+ * Lock-free triple buffer handing decoded frames from one producer thread to one consumer thread,
+ * for frontends that render from a loop of their own. The frames themselves live in an array of
+ * CHIAKI_FRAME_MAILBOX_SLOTS owned by the frontend, the mailbox only passes slot indices around.
+ *
+ * At any time, each slot belongs to exactly one party:
+ * - the producer's write slot, which it fills and then hands over with chiaki_frame_mailbox_publish(),
+ * - the consumer's read slot, which it may read from until its next chiaki_frame_mailbox_acquire(),
+ * - the mailbox slot in between, holding the latest published frame.
+ * Publishing and acquiring swap one's own slot with the mailbox slot, so neither side ever waits.
+ * A published frame that is replaced before the consumer took it is counted as dropped.
+ */
+typedef struct chiaki_frame_mailbox_t
+{
+	uint32_t mailbox; // slot index | MAILBOX_FRESH, exchanged atomically by both sides
+	uint32_t write_slot; // producer only
+	uint32_t read_slot; // consumer only
+	bool read_valid; // consumer only
+
+	// statistics, each written by one side only and read atomically
+	uint64_t published; // producer
+	uint64_t dropped; // producer
+	uint64_t consumed; // consumer
+} ChiakiFrameMailbox;
+
+CHIAKI_EXPORT void chiaki_frame_mailbox_init(ChiakiFrameMailbox *mailbox);
+
+/**
+ * Producer side.
+ * @return the slot to decode the next frame into, owned by the producer until chiaki_frame_mailbox_publish()
+ */
+static inline unsigned int chiaki_frame_mailbox_write_slot(ChiakiFrameMailbox *mailbox) { return mailbox->write_slot; }
+
+/**
+ * Producer side. Hand the write slot to the consumer, replacing any frame it has not taken yet.
+ */
+CHIAKI_EXPORT void chiaki_frame_mailbox_publish(ChiakiFrameMailbox *mailbox);
+
+/**
+ * Consumer side. Take the latest published frame if there is a new one, otherwise keep the current one.
+ * @param fresh if not NULL, set to whether the returned slot holds a frame that was not returned before
+ * @return the slot to read from until the next call, or -1 if nothing was published yet
+ */
+CHIAKI_EXPORT int chiaki_frame_mailbox_acquire(ChiakiFrameMailbox *mailbox, bool *fresh);
+
+/**
+ * May be called from any thread, each value is consistent on its own.
+ * Once both sides are done and the consumer acquired a last time, published == consumed + dropped.
+ */
+CHIAKI_EXPORT void chiaki_frame_mailbox_get_stats(ChiakiFrameMailbox *mailbox, uint64_t *published, uint64_t *dropped, uint64_t *consumed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_FRAMEMAILBOX_H
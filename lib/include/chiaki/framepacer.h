@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_FRAMEPACER_H
+#define CHIAKI_FRAMEPACER_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_FRAME_PACER_QUEUE_MAX 8
+#define CHIAKI_FRAME_PACER_QUEUE_DEPTH_DEFAULT 2
+
+/**
+ * Vsyncs a backlog of one frame is tolerated before it is dropped to get the latency back down.
+ */
+#define CHIAKI_FRAME_PACER_CATCHUP_VSYNCS_DEFAULT 30
+
+/**
+ * @return monotonic time in us
+ */
+typedef uint64_t (*ChiakiFramePacerClockCb)(void *user);
+
+typedef struct chiaki_frame_pacer_frame_t
+{
+	uint64_t id;
+	uint64_t pts_us;
+	uint64_t arrival_us;
+} ChiakiFramePacerFrame;
+
+typedef enum
+{
+	CHIAKI_FRAME_PACER_HOLD, // keep showing the current frame for this refresh
+	CHIAKI_FRAME_PACER_PRESENT
+} ChiakiFramePacerAction;
+
+typedef struct chiaki_frame_pacer_decision_t
+{
+	ChiakiFramePacerAction action;
+	ChiakiFramePacerFrame frame; // for CHIAKI_FRAME_PACER_PRESENT
+	unsigned int dropped; // queued frames skipped in favor of frame
+} ChiakiFramePacerDecision;
+
+typedef struct chiaki_frame_pacer_stats_t
+{
+	uint64_t frames_arrived;
+	uint64_t frames_presented;
+	uint64_t frames_dropped;
+	uint64_t vsyncs_held; // refreshes that repeated the previous frame
+	uint64_t latency_sum_us; // arrival to the refresh the frame was shown on
+	uint64_t latency_max_us;
+	uint64_t judder_sum_us; // |on-screen interval - pts interval| between consecutive presented frames
+	uint64_t judder_max_us;
+	uint64_t judder_count;
+} ChiakiFramePacerStats;
+
+/**
+ * Decides for every display refresh whether to show a new frame, which one, and which to drop.
+ *
+ * Frames are handed in with chiaki_frame_pacer_push() as they come out of the decoder,
+ * refreshes are signalled with chiaki_frame_pacer_vsync() by whatever knows about them,
+ * i.e. the swapchain in the GUI or a simulated display in tests. Time is taken from the
+ * clock callback, so the whole engine can run on a fake clock.
+ *
+ * Frames are shown in order. If the source runs faster than the display, everything but the newest
+ * ready frame is dropped right away. Otherwise a backlog of one frame, as caused by a frame
+ * arriving just after a refresh, is kept to avoid a visible skip and only dropped once it persisted
+ * for catchup_vsyncs refreshes, trading a single skip for getting the latency back down.
+ *
+ * The struct also carries the present throttling state and submit cost estimate used by the renderer
+ * when it paces presents by a fixed interval instead of by vsync events.
+ */
+typedef struct chiaki_frame_pacer_t
+{
+	ChiakiFramePacerClockCb clock_cb;
+	void *clock_user;
+	unsigned int queue_depth_limit;
+	unsigned int catchup_vsyncs;
+
+	ChiakiFramePacerFrame queue[CHIAKI_FRAME_PACER_QUEUE_MAX];
+	unsigned int queue_begin;
+	unsigned int queue_count;
+
+	uint64_t last_pts_us;
+	double source_interval_us;
+	uint64_t last_vsync_us;
+	double refresh_interval_us;
+	unsigned int backlog_vsyncs;
+
+	bool presented;
+	uint64_t last_present_vsync_us;
+	uint64_t last_present_pts_us;
+
+	uint64_t throttle_interval_us;
+	uint64_t throttle_target_us;
+	int64_t submit_swap_estimate_us; // accessed atomically, may be updated from a swap thread
+
+	ChiakiFramePacerStats stats;
+} ChiakiFramePacer;
+
+/**
+ * @param clock_cb may be NULL to use chiaki_time_now_monotonic_us()
+ * @param queue_depth_limit frames that may wait for presentation, 0 for CHIAKI_FRAME_PACER_QUEUE_DEPTH_DEFAULT
+ */
+CHIAKI_EXPORT void chiaki_frame_pacer_init(ChiakiFramePacer *pacer, ChiakiFramePacerClockCb clock_cb, void *clock_user, unsigned int queue_depth_limit);
+
+/**
+ * Forget all queued frames and timing history, e.g. on a stream reset. Stats are kept.
+ */
+CHIAKI_EXPORT void chiaki_frame_pacer_reset(ChiakiFramePacer *pacer);
+
+/**
+ * Queue a newly decoded frame. If the queue is full, the oldest frame is dropped to make room.
+ *
+ * @param dropped if not NULL, receives the dropped frame
+ * @return true if a frame was dropped
+ */
+CHIAKI_EXPORT bool chiaki_frame_pacer_push(ChiakiFramePacer *pacer, uint64_t id, uint64_t pts_us, ChiakiFramePacerFrame *dropped);
+
+/**
+ * Signal a display refresh and get what to show on it.
+ */
+CHIAKI_EXPORT void chiaki_frame_pacer_vsync(ChiakiFramePacer *pacer, uint64_t vsync_us, ChiakiFramePacerDecision *decision);
+
+static inline unsigned int chiaki_frame_pacer_queued(ChiakiFramePacer *pacer) { return pacer->queue_count; }
+
+/**
+ * Fixed interval present throttling.
+ * Returns the time to wake up at, which is the next present target minus lead_us (the expected cost
+ * of getting the frame to the screen, see chiaki_frame_pacer_submit_swap_estimate()), or now if that is already past.
+ * A changed interval restarts the schedule.
+ *
+ * @param target_us if not NULL, receives the present target
+ */
+CHIAKI_EXPORT uint64_t chiaki_frame_pacer_throttle_wakeup(ChiakiFramePacer *pacer, uint64_t interval_us, uint64_t lead_us, uint64_t *target_us);
+
+/**
+ * Move on to the next present target after a throttled present.
+ */
+CHIAKI_EXPORT void chiaki_frame_pacer_throttle_advance(ChiakiFramePacer *pacer);
+
+CHIAKI_EXPORT void chiaki_frame_pacer_throttle_reset(ChiakiFramePacer *pacer);
+
+/**
+ * Feed an observed submit + swap duration into the running estimate, may be called from any thread.
+ */
+CHIAKI_EXPORT void chiaki_frame_pacer_submit_swap_observed(ChiakiFramePacer *pacer, int64_t observed_us);
+
+CHIAKI_EXPORT int64_t chiaki_frame_pacer_submit_swap_estimate(ChiakiFramePacer *pacer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_FRAMEPACER_H
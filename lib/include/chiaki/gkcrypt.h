@@ -6,6 +6,7 @@
 #include "common.h"
 #include "log.h"
 #include "thread.h"
+#include "executor.h"
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -25,6 +26,16 @@ typedef struct chiaki_key_state_t
    uint64_t prev;
 } ChiakiKeyState;
 
+typedef struct chiaki_gkcrypt_stats_t
+{
+	uint64_t key_buf_hits; // requests served from key_buf
+	uint64_t key_buf_misses; // requests that had to generate synchronously
+	uint64_t key_buf_miss_us_total; // time spent generating synchronously on misses
+	uint64_t key_buf_miss_us_max;
+	uint64_t key_buf_generated; // bytes generated ahead into key_buf
+	uint64_t key_rate; // observed key stream consumption in bytes per second
+} ChiakiGKCryptStats;
+
 typedef struct chiaki_gkcrypt_t {
 	uint8_t index;
 
@@ -34,10 +45,17 @@ typedef struct chiaki_gkcrypt_t {
 	uint64_t key_buf_key_pos_min; // minimal key pos currently in key_buf
 	size_t key_buf_start_offset; // offset in key_buf of the minimal key pos
 	uint64_t last_key_pos;        // last key pos that has been requested
+	uint64_t key_rate_pos;        // last_key_pos at key_rate_ms
+	uint64_t key_rate_ms;
 	bool key_buf_thread_stop;
 	ChiakiMutex key_buf_mutex;
 	ChiakiCond key_buf_cond;
-	ChiakiThread key_buf_thread;
+	ChiakiThread key_buf_thread; // only used without executor
+	ChiakiExecutor *executor; // if set, key_buf is refilled by key_buf_task instead of key_buf_thread
+	ChiakiExecutorTask key_buf_task;
+	bool key_buf_task_scheduled;
+	void *key_buf_cipher; // cipher context kept by the generator across chunks
+	ChiakiGKCryptStats stats;
 
 	uint8_t iv[CHIAKI_GKCRYPT_BLOCK_SIZE];
 	uint8_t key_base[CHIAKI_GKCRYPT_BLOCK_SIZE];
@@ -50,9 +68,10 @@ typedef struct chiaki_gkcrypt_t {
 struct chiaki_session_t;
 
 /**
- * @param key_buf_chunks if > 0, use a thread to generate the ctr mode key stream
+ * @param key_buf_chunks if > 0, generate the ctr mode key stream ahead of time
+ * @param executor if not NULL, generate the key stream on this executor instead of a thread of its own
  */
-CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret);
+CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, size_t key_buf_chunks, ChiakiExecutor *executor, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret);
 
 CHIAKI_EXPORT void chiaki_gkcrypt_fini(ChiakiGKCrypt *gkcrypt);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_gen_key_stream(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, uint8_t *buf, size_t buf_size);
@@ -63,13 +82,14 @@ CHIAKI_EXPORT void chiaki_gkcrypt_gen_gmac_key(uint64_t index, const uint8_t *ke
 CHIAKI_EXPORT void chiaki_gkcrypt_gen_new_gmac_key(ChiakiGKCrypt *gkcrypt, uint64_t index);
 CHIAKI_EXPORT void chiaki_gkcrypt_gen_tmp_gmac_key(ChiakiGKCrypt *gkcrypt, uint64_t index, uint8_t *key_out);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_gmac(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, const uint8_t *buf, size_t buf_size, uint8_t *gmac_out);
+CHIAKI_EXPORT void chiaki_gkcrypt_get_stats(ChiakiGKCrypt *gkcrypt, ChiakiGKCryptStats *stats);
 
-static inline ChiakiGKCrypt *chiaki_gkcrypt_new(ChiakiLog *log, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
+static inline ChiakiGKCrypt *chiaki_gkcrypt_new(ChiakiLog *log, size_t key_buf_chunks, ChiakiExecutor *executor, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
 {
 	ChiakiGKCrypt *gkcrypt = CHIAKI_NEW(ChiakiGKCrypt);
 	if(!gkcrypt)
 		return NULL;
-	ChiakiErrorCode err = chiaki_gkcrypt_init(gkcrypt, log, key_buf_chunks, index, handshake_key, ecdh_secret);
+	ChiakiErrorCode err = chiaki_gkcrypt_init(gkcrypt, log, key_buf_chunks, executor, index, handshake_key, ecdh_secret);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		free(gkcrypt);
@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_HAPTICS_H
+#define CHIAKI_HAPTICS_H
+
+#include "common.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Haptics PCM as received from the console: interleaved signed 16 bit stereo.
+ */
+#define CHIAKI_HAPTICS_SAMPLE_RATE 3000
+#define CHIAKI_HAPTICS_PACKET_FRAMES_MAX 64
+
+/**
+ * Kernels for processing haptics PCM, shared by all frontends.
+ * They use SSE2 or NEON where available, the integer kernels give bit-identical results to the scalar fallback.
+ * Samples are scaled as (int32_t)(sample * gain) and saturated to int16.
+ */
+
+/**
+ * @param out may be the same as in
+ */
+CHIAKI_EXPORT void chiaki_haptics_gain(int16_t *out, const int16_t *in, size_t samples, float gain);
+
+/**
+ * Split stereo frames into one buffer per channel, applying gain.
+ */
+CHIAKI_EXPORT void chiaki_haptics_split(int16_t *left, int16_t *right, const int16_t *in, size_t frames, float gain);
+
+/**
+ * Remix stereo frames to 4 channels with the haptics on channels 3 and 4 and 1 and 2 silent,
+ * which is how the DualSense exposes its actuators as an audio device.
+ * @param out room for frames * 4 samples
+ */
+CHIAKI_EXPORT void chiaki_haptics_remix_4ch(int16_t *out, const int16_t *in, size_t frames, float gain);
+
+/**
+ * Envelope of stereo frames as the mean absolute amplitude of each channel.
+ */
+CHIAKI_EXPORT void chiaki_haptics_envelope(const int16_t *in, size_t frames, uint32_t *left, uint32_t *right);
+
+#define CHIAKI_HAPTICS_FREQ_MIN 100.0f
+#define CHIAKI_HAPTICS_FREQ_MAX 1000.0f
+
+/**
+ * Estimate the dominant frequency of stereo frames from the autocorrelation of both channels mixed,
+ * searching between CHIAKI_HAPTICS_FREQ_MIN and CHIAKI_HAPTICS_FREQ_MAX.
+ *
+ * @param amplitude if not NULL, set to the peak amplitude of a sine with the same energy
+ * @return frequency in Hz or 0 if there is no periodic signal
+ */
+CHIAKI_EXPORT float chiaki_haptics_dominant_freq(const int16_t *in, size_t frames, unsigned int sample_rate, float *amplitude);
+
+/**
+ * Turns haptics packets into a 4 channel stream at an output rate that is an integer multiple of the input rate,
+ * interpolating linearly across packet boundaries.
+ */
+typedef struct chiaki_haptics_processor_t
+{
+	unsigned int upsample; // output frames per input frame
+	int16_t prev[2]; // last input frame, start of the next interpolation
+} ChiakiHapticsProcessor;
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_haptics_processor_init(ChiakiHapticsProcessor *processor, unsigned int in_rate, unsigned int out_rate);
+CHIAKI_EXPORT void chiaki_haptics_processor_reset(ChiakiHapticsProcessor *processor);
+
+static inline size_t chiaki_haptics_processor_output_frames(ChiakiHapticsProcessor *processor, size_t in_frames)
+{
+	return in_frames * processor->upsample;
+}
+
+/**
+ * @param in stereo frames, at most CHIAKI_HAPTICS_PACKET_FRAMES_MAX
+ * @param out 4 channel frames as in chiaki_haptics_remix_4ch(), room for out_frames_max
+ * @return number of frames written to out
+ */
+CHIAKI_EXPORT size_t chiaki_haptics_processor_process(ChiakiHapticsProcessor *processor, const int16_t *in, size_t frames, float gain, int16_t *out, size_t out_frames_max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_HAPTICS_H
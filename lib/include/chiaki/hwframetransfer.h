@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_HW_FRAME_TRANSFER_H
+#define CHIAKI_HW_FRAME_TRANSFER_H
+
+#include <chiaki/common.h>
+#include <chiaki/log.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+
+typedef struct chiaki_hw_frame_transfer_stats_t
+{
+	uint64_t mapped; // frames handed out as a CPU mapping of the hardware surface
+	uint64_t copied; // frames downloaded into a pooled buffer
+	uint64_t failed;
+	uint64_t pool_allocs; // buffers allocated by the pool, stays flat once it has warmed up
+	uint64_t download_us_total; // time spent in mapping and copying
+	uint64_t download_us_max;
+} ChiakiHwFrameTransferStats;
+
+/**
+ * Brings hardware decoded frames into memory the renderer can read, for when it can't use the surfaces directly.
+ *
+ * Mapping the surface (av_hwframe_map()) is preferred, as it saves a full copy of every frame.
+ * If the hardware context can't map, or a map fails, frames are copied into buffers from an AVBufferPool instead
+ * of a freshly allocated frame each time. The software format is negotiated once per hardware frames context
+ * with av_hwframe_transfer_get_formats(), keeping the decoder's own sw_format if it is offered.
+ *
+ * Not thread-safe, use it from the thread that pulls the frames from the decoder.
+ */
+typedef struct chiaki_hw_frame_transfer_t
+{
+	ChiakiLog *log;
+	bool allow_map;
+
+	// hardware frames the negotiation below is for
+	enum AVPixelFormat hw_format;
+	enum AVPixelFormat hw_sw_format;
+	int hw_width;
+	int hw_height;
+	enum AVPixelFormat sw_format; // AV_PIX_FMT_NONE if nothing is negotiated
+	bool map_failed;
+
+	AVBufferPool *pool;
+	enum AVPixelFormat pool_format;
+	int pool_width;
+	int pool_height;
+
+	ChiakiHwFrameTransferStats stats;
+} ChiakiHwFrameTransfer;
+
+/**
+ * @param allow_map whether frames may be handed out as mappings of the hardware surfaces.
+ * Those keep the surface referenced for as long as the frame is alive, just like direct rendering does.
+ */
+CHIAKI_EXPORT void chiaki_hw_frame_transfer_init(ChiakiHwFrameTransfer *transfer, ChiakiLog *log, bool allow_map);
+CHIAKI_EXPORT void chiaki_hw_frame_transfer_fini(ChiakiHwFrameTransfer *transfer);
+
+/**
+ * Forget the negotiated format and drop the pool, e.g. for a new session. The stats are kept.
+ * Frames handed out before stay valid.
+ */
+CHIAKI_EXPORT void chiaki_hw_frame_transfer_reset(ChiakiHwFrameTransfer *transfer, ChiakiLog *log, bool allow_map);
+
+/**
+ * Get a software frame of the given format and size, backed by the pool.
+ * Only format, width, height and the planes are set.
+ *
+ * @return NULL on failure
+ */
+CHIAKI_EXPORT AVFrame *chiaki_hw_frame_transfer_get_buffer(ChiakiHwFrameTransfer *transfer, enum AVPixelFormat format, int width, int height);
+
+/**
+ * Replace *frame by a software frame with the same content and properties.
+ * Frames without hw_frames_ctx are left as they are.
+ *
+ * On failure, *frame is left untouched.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_hw_frame_transfer_download(ChiakiHwFrameTransfer *transfer, AVFrame **frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_HW_FRAME_TRANSFER_H
@@ -29,24 +29,115 @@ CHIAKI_EXPORT void chiaki_orientation_init(ChiakiOrientation *orient);
 CHIAKI_EXPORT void chiaki_orientation_update(ChiakiOrientation *orient,
 		float gx, float gy, float gz, float ax, float ay, float az, float beta, float time_step_sec);
 
+#define CHIAKI_MOTION_SAMPLE_GYRO (1 << 0)
+#define CHIAKI_MOTION_SAMPLE_ACCEL (1 << 1)
+
+/**
+ * One reading of a controller's IMU.
+ * Sensors that report gyro and accel separately give one sample per reading with only that flag set.
+ */
+typedef struct chiaki_motion_sample_t
+{
+	uint64_t timestamp_us;
+	uint32_t flags; // CHIAKI_MOTION_SAMPLE_*
+	float gyro_x, gyro_y, gyro_z; // rad/s
+	float accel_x, accel_y, accel_z; // g
+} ChiakiMotionSample;
+
+typedef struct chiaki_motion_fusion_state_t
+{
+	ChiakiOrientation orient;
+	uint64_t timestamp_us;
+	uint32_t flags; // sensors seen so far
+	float gyro_x, gyro_y, gyro_z; // last reading, bias not removed
+	float accel_x, accel_y, accel_z;
+	float bias_x, bias_y, bias_z;
+	// low passed readings and their deviation, to detect when the controller rests
+	float gyro_mean_x, gyro_mean_y, gyro_mean_z;
+	float accel_mean_x, accel_mean_y, accel_mean_z;
+	float gyro_dev, accel_dev;
+	float rest_sec;
+} ChiakiMotionFusionState;
+
+#define CHIAKI_MOTION_FUSION_QUEUE_SIZE 64
+#define CHIAKI_MOTION_FUSION_REORDER_US 20000
+
+/**
+ * Sensor fusion for samples that arrive in batches, late or out of order.
+ *
+ * Samples are held for CHIAKI_MOTION_FUSION_REORDER_US after the newest one and then integrated in timestamp order.
+ * Gyro is integrated at its native rate with a bias that is learned while the controller rests,
+ * the accelerometer corrects the tilt.
+ * The orientation can be taken at any time after the last sample, it is extrapolated from the latest gyro reading.
+ * Uses the same frame as chiaki_orientation_update().
+ */
+typedef struct chiaki_motion_fusion_t
+{
+	ChiakiMotionFusionState state; // everything up to state.timestamp_us is integrated
+	ChiakiMotionSample queue[CHIAKI_MOTION_FUSION_QUEUE_SIZE]; // sorted by timestamp
+	size_t queue_count;
+	uint64_t dropped; // samples that arrived after their time was integrated
+} ChiakiMotionFusion;
+
+CHIAKI_EXPORT void chiaki_motion_fusion_init(ChiakiMotionFusion *fusion);
+CHIAKI_EXPORT void chiaki_motion_fusion_push(ChiakiMotionFusion *fusion, const ChiakiMotionSample *sample);
+
+/**
+ * @param timestamp_us time to resample the orientation at, in the clock of the samples.
+ * Anything before the newest sample gives the orientation at the newest sample.
+ * @return false if no sample was pushed yet, orient is the initial orientation then
+ */
+CHIAKI_EXPORT bool chiaki_motion_fusion_get(ChiakiMotionFusion *fusion, uint64_t timestamp_us, ChiakiOrientation *orient);
+
 /**
- * Extension of ChiakiOrientation, also tracking an absolute timestamp and the current gyro/accel state
+ * Motion state of one controller for ChiakiControllerState, fusing its samples with ChiakiMotionFusion
  */
 typedef struct chiaki_orientation_tracker_t
 {
 	float gyro_x, gyro_y, gyro_z;
 	float accel_x, accel_y, accel_z;
-	ChiakiOrientation orient;
+	ChiakiOrientation orient; // at the newest sample
 	uint32_t timestamp;
+	uint64_t timestamp_us; // unwrapped from timestamp
 	uint64_t sample_index;
+	ChiakiMotionFusion fusion;
 } ChiakiOrientationTracker;
 
 CHIAKI_EXPORT void chiaki_orientation_tracker_init(ChiakiOrientationTracker *tracker);
+
+/**
+ * Update with gyro and accel read together, timestamp_us may wrap around.
+ * Don't mix with chiaki_orientation_tracker_update_sample() on the same tracker, their timestamps differ.
+ */
 CHIAKI_EXPORT void chiaki_orientation_tracker_update(ChiakiOrientationTracker *tracker,
 		float gx, float gy, float gz, float ax, float ay, float az,
 		ChiakiAccelNewZero *accel_zero, bool accel_zero_applied, uint32_t timestamp_us);
+
+/**
+ * @param accel_zero subtracted from the accel of the sample, may be NULL
+ */
+CHIAKI_EXPORT void chiaki_orientation_tracker_update_sample(ChiakiOrientationTracker *tracker,
+		const ChiakiMotionSample *sample, ChiakiAccelNewZero *accel_zero);
+
+/**
+ * Start over from gyro and accel read together, as after chiaki_orientation_tracker_init()
+ * @param accel_zero subtracted from the accel, may be NULL
+ */
+CHIAKI_EXPORT void chiaki_orientation_tracker_reset(ChiakiOrientationTracker *tracker,
+		float gx, float gy, float gz, float ax, float ay, float az,
+		ChiakiAccelNewZero *accel_zero, uint64_t timestamp_us);
+
+/**
+ * Apply the orientation at the newest sample
+ */
 CHIAKI_EXPORT void chiaki_orientation_tracker_apply_to_controller_state(ChiakiOrientationTracker *tracker,
 		ChiakiControllerState *state);
+
+/**
+ * Apply the orientation resampled at timestamp_us, which is in the clock of the samples
+ */
+CHIAKI_EXPORT void chiaki_orientation_tracker_apply_to_controller_state_at(ChiakiOrientationTracker *tracker,
+		ChiakiControllerState *state, uint64_t timestamp_us);
 CHIAKI_EXPORT void chiaki_accel_new_zero_set_inactive(ChiakiAccelNewZero *accel_zero, bool real_accel);
 CHIAKI_EXPORT void chiaki_accel_new_zero_set_active(ChiakiAccelNewZero *accel_zero, float accel_x, float accel_y, float accel_z, bool real_accel);
 
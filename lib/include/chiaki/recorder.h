@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_RECORDER_H
+#define CHIAKI_RECORDER_H
+
+#include <chiaki/audio.h>
+#include <chiaki/common.h>
+#include <chiaki/log.h>
+#include <chiaki/thread.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_RECORDER_MEMORY_MAX_DEFAULT (64 * 1024 * 1024)
+#define CHIAKI_RECORDER_PARAM_SETS_MAX 1024
+
+typedef struct chiaki_recorder_settings_t
+{
+	/**
+	 * Output file. With rotate_ms, "-NNN" is inserted before the extension of every file,
+	 * otherwise only of the ones following a parameter set change.
+	 * Unused if buffer_ms is set.
+	 */
+	const char *path;
+	const char *format; // libavformat short name like "matroska" or "mp4", NULL to guess from the path
+	ChiakiCodec codec;
+	unsigned int width; // only used if the size can't be parsed from the stream's parameter sets
+	unsigned int height;
+	unsigned int max_fps;
+	uint64_t rotate_ms; // if not 0, start a new file at the first key frame after this long
+	uint64_t buffer_ms; // if not 0, only keep about the last buffer_ms in memory and write it on chiaki_recorder_save()
+	/**
+	 * Bytes of packet data held at most, queued, being written or buffered together, 0 for CHIAKI_RECORDER_MEMORY_MAX_DEFAULT.
+	 * With buffer_ms, the buffer takes up to 3/4 of it.
+	 */
+	size_t memory_max;
+} ChiakiRecorderSettings;
+
+typedef struct chiaki_recorder_stats_t
+{
+	uint64_t video_packets;
+	uint64_t audio_packets;
+	uint64_t packets_dropped; // over memory_max, video before the first key frame of a file, or audio ahead of its arrival time
+	uint64_t frames_corrupt; // written after a loss that was not recovered, until the next key frame
+	uint64_t files_written;
+	uint64_t errors;
+} ChiakiRecorderStats;
+
+typedef struct recorder_packet_t RecorderPacket;
+typedef struct recorder_file_t RecorderFile;
+
+/**
+ * Muxes the video samples and Opus packets of a session into Matroska/MP4 files without re-encoding.
+ *
+ * The session's callbacks only copy the data into a queue, all parsing and muxing happens on a thread of its own.
+ * Files always start at a key frame and a new one is started when the parameter sets change,
+ * because containers can only carry one set per track.
+ */
+typedef struct chiaki_recorder_t
+{
+	ChiakiLog *log;
+	ChiakiRecorderSettings settings; // path and format are owned copies
+	ChiakiThread thread;
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+
+	// protected by mutex
+	bool should_stop;
+	RecorderPacket *queue_head;
+	RecorderPacket *queue_tail;
+	size_t bytes; // packet data queued, being written or in the ring, counted against memory_max
+	char *save_path; // pending chiaki_recorder_save()
+	ChiakiRecorderStats stats;
+	bool video_dropped; // the next video packet follows dropped ones
+	int64_t video_pts_last;
+	bool audio_started;
+	bool audio_ahead; // dropping audio until its arrival time catches up with audio_pts_next
+	int64_t audio_pts_next;
+	int64_t audio_frame_duration_us;
+	uint64_t start_us;
+
+	// writer thread only
+	struct
+	{
+		uint8_t param_sets[CHIAKI_RECORDER_PARAM_SETS_MAX];
+		size_t param_sets_size;
+		bool corrupt;
+		ChiakiAudioHeader audio_header;
+		bool audio_header_valid;
+		unsigned int file_index;
+		RecorderPacket *ring_head;
+		RecorderPacket *ring_tail;
+		size_t ring_bytes;
+		size_t bytes_freed; // subtracted from bytes after every batch
+		RecorderFile *file; // current output file if not buffering
+		ChiakiRecorderStats stats; // merged into stats after every batch
+	} writer;
+} ChiakiRecorder;
+
+/**
+ * Start the writer thread. Nothing is written before the first key frame.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_recorder_init(ChiakiRecorder *recorder, ChiakiLog *log, const ChiakiRecorderSettings *settings);
+
+/**
+ * Write everything still queued, including a pending save, finish the files and join the thread.
+ */
+CHIAKI_EXPORT void chiaki_recorder_fini(ChiakiRecorder *recorder);
+
+/**
+ * Queue a video sample as passed to ChiakiVideoSampleCallback, timestamped with now_us (monotonic).
+ */
+CHIAKI_EXPORT void chiaki_recorder_push_video(ChiakiRecorder *recorder, const uint8_t *buf, size_t buf_size,
+		int32_t frames_lost, bool frame_recovered, uint64_t now_us);
+
+/**
+ * Queue an Opus packet as passed to ChiakiAudioSinkFrame, buf NULL for a lost one.
+ */
+CHIAKI_EXPORT void chiaki_recorder_push_audio(ChiakiRecorder *recorder, const uint8_t *buf, size_t buf_size, uint64_t now_us);
+
+CHIAKI_EXPORT void chiaki_recorder_push_audio_header(ChiakiRecorder *recorder, const ChiakiAudioHeader *header);
+
+/**
+ * Can be chained into the session's ChiakiVideoSampleCallback with the recorder as user.
+ */
+CHIAKI_EXPORT bool chiaki_recorder_video_sample_cb(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered, void *user);
+CHIAKI_EXPORT void chiaki_recorder_audio_header_cb(ChiakiAudioHeader *header, void *user);
+CHIAKI_EXPORT void chiaki_recorder_audio_frame_cb(uint8_t *buf, size_t buf_size, void *user);
+
+/**
+ * Only with buffer_ms set: write the buffered packets, starting at a key frame, to path.
+ * Happens asynchronously on the writer thread, see files_written and errors in the stats.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_recorder_save(ChiakiRecorder *recorder, const char *path);
+
+CHIAKI_EXPORT void chiaki_recorder_get_stats(ChiakiRecorder *recorder, ChiakiRecorderStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_RECORDER_H
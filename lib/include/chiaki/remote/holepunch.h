@@ -30,6 +30,7 @@
 #include "../log.h"
 #include "../random.h"
 #include "../sock.h"
+#include "pathcache.h"
 
 #include <stdint.h>
 #ifdef _WIN32
@@ -228,6 +229,22 @@ CHIAKI_EXPORT void chiaki_holepunch_session_set_port_guessing_ports(
 CHIAKI_EXPORT void chiaki_holepunch_session_set_port_guessing_socks(
     ChiakiHolepunchSession session, int count);
 
+/**
+ * Use a cache of what was learned about the local network during earlier connections.
+ *
+ * If the current network has an entry, UPnP discovery, fetching STUN server lists and
+ * the NAT allocation test start from the cached results, and the console candidate that
+ * connected last time is tried first. The entry is updated with the results of this
+ * session and the cache saved when the session is finalized.
+ *
+ * Must be called before `chiaki_holepunch_upnp_discover`. The cache must outlive the session.
+ *
+ * @param[in] session Handle to the holepunching session
+ * @param[in] cache The cache to use, may be shared between sessions
+ */
+CHIAKI_EXPORT void chiaki_holepunch_session_set_path_cache(
+    ChiakiHolepunchSession session, ChiakiNetworkPathCache *cache);
+
 /**
  * Create a remote play session on the PSN server.
  *
@@ -254,6 +271,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_start(
     ChiakiHolepunchConsoleType console_type);
 
 /** Discovers UPNP if available
+ *
+ * Discovery and the STUN requests for the local candidates run in the background while
+ * the PSN session is set up, `chiaki_holepunch_session_punch_hole` waits for their results.
+ *
  * @param session The Session intance.
 */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_upnp_discover(ChiakiHolepunchSession session);
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_HTTPCLIENT_H
+#define CHIAKI_HTTPCLIENT_H
+
+#include "../common.h"
+#include "../log.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_HTTP_CLIENT_POOL_SIZE 4
+#define CHIAKI_HTTP_DEFAULT_TIMEOUT_SEC 10
+
+/**
+ * HTTPS client that keeps connections, DNS results and TLS sessions between requests,
+ * so only the first request to a host pays for the TCP and TLS handshakes.
+ * All requests, also those from different threads, run on one connection cache for the lifetime of the client.
+ * HTTP/2 is negotiated where the server supports it, letting concurrent requests share a connection.
+ * All functions are thread-safe.
+ */
+typedef struct chiaki_http_client_t ChiakiHttpClient;
+
+typedef struct chiaki_http_request_t
+{
+	const char *method; // NULL for GET, or POST if body is set
+	const char *url;
+	const char **headers; // "Name: value" strings terminated by NULL, may be NULL
+	const char *body; // may be NULL
+	size_t body_size;
+	long timeout_sec; // 0 for CHIAKI_HTTP_DEFAULT_TIMEOUT_SEC
+
+	// set by chiaki_http_client_perform(), response must be released with chiaki_http_request_fini()
+	// or is released when the request is performed again, so requests must be zero-initialized
+	ChiakiErrorCode err; // CHIAKI_ERR_HTTP_NONOK for status codes >= 400, CHIAKI_ERR_NETWORK for transfer errors
+	long http_code;
+	const char *error; // transfer error description, NULL on success
+	char *response; // always null-terminated if not NULL
+	size_t response_size;
+} ChiakiHttpRequest;
+
+typedef struct chiaki_http_client_stats_t
+{
+	uint64_t requests;
+	uint64_t connects; // new connections that had to be opened for these requests
+} ChiakiHttpClientStats;
+
+CHIAKI_EXPORT ChiakiHttpClient *chiaki_http_client_new(ChiakiLog *log);
+CHIAKI_EXPORT void chiaki_http_client_free(ChiakiHttpClient *client);
+
+/**
+ * Verify servers against the certificates in file instead of the system store.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_http_client_set_ca_file(ChiakiHttpClient *client, const char *file);
+
+/**
+ * Perform a single request, blocking until it finished.
+ *
+ * @return req->err
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_http_client_perform(ChiakiHttpClient *client, ChiakiHttpRequest *req);
+
+/**
+ * Perform independent requests concurrently, blocking until all of them finished.
+ * Each request gets its own result, the return value is the first error among them.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_http_client_perform_all(ChiakiHttpClient *client, ChiakiHttpRequest *reqs, size_t count);
+
+CHIAKI_EXPORT void chiaki_http_client_get_stats(ChiakiHttpClient *client, ChiakiHttpClientStats *stats);
+
+/**
+ * Free the response of a performed request, so the request can be performed again.
+ */
+CHIAKI_EXPORT void chiaki_http_request_fini(ChiakiHttpRequest *req);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_HTTPCLIENT_H
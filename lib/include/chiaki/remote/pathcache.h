@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_PATHCACHE_H
+#define CHIAKI_PATHCACHE_H
+
+#include "../common.h"
+#include "../log.h"
+#include "../thread.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_NETWORK_PATH_CACHE_ENTRIES_MAX 16
+#define CHIAKI_NETWORK_PATH_STUN_SERVERS_MAX 4
+#define CHIAKI_NETWORK_ID_SIZE 17 // 64 bit hash as hex + terminator
+#define CHIAKI_NETWORK_PATH_URL_SIZE 256
+#define CHIAKI_NETWORK_PATH_HOST_SIZE 256
+#define CHIAKI_NETWORK_PATH_ADDR_SIZE 46 // INET6_ADDRSTRLEN
+#define CHIAKI_NETWORK_PATH_CONSOLE_UID_SIZE 65 // 32 bytes as hex + terminator
+
+/**
+ * Entries older than this are not used for connecting anymore, but probed from scratch.
+ */
+#define CHIAKI_NETWORK_PATH_MAX_AGE_SEC (7 * 24 * 60 * 60)
+
+typedef enum
+{
+	CHIAKI_NETWORK_PATH_UPNP_UNKNOWN = 0,
+	CHIAKI_NETWORK_PATH_UPNP_NONE, // discovery found no gateway
+	CHIAKI_NETWORK_PATH_UPNP_FOUND
+} ChiakiNetworkPathUpnp;
+
+typedef struct chiaki_network_path_stun_server_t
+{
+	char host[CHIAKI_NETWORK_PATH_HOST_SIZE];
+	uint16_t port;
+} ChiakiNetworkPathStunServer;
+
+/**
+ * What was learned about getting out of a local network during the last successful connection from it.
+ */
+typedef struct chiaki_network_path_t
+{
+	char network_id[CHIAKI_NETWORK_ID_SIZE];
+	uint64_t updated; // unix time in seconds
+
+	bool allocation_known;
+	int32_t allocation_increment;
+	bool random_allocation;
+
+	ChiakiNetworkPathUpnp upnp;
+	char upnp_root_desc_url[CHIAKI_NETWORK_PATH_URL_SIZE]; // for CHIAKI_NETWORK_PATH_UPNP_FOUND
+
+	ChiakiNetworkPathStunServer stun_servers[CHIAKI_NETWORK_PATH_STUN_SERVERS_MAX]; // that answered, fastest first
+	size_t stun_servers_count;
+
+	// console side of the last candidate pair that connected
+	char console_uid[CHIAKI_NETWORK_PATH_CONSOLE_UID_SIZE];
+	int candidate_type;
+	char candidate_addr[CHIAKI_NETWORK_PATH_ADDR_SIZE];
+	uint16_t candidate_port;
+} ChiakiNetworkPath;
+
+/**
+ * On-disk cache of ChiakiNetworkPath entries, keyed by local network identity.
+ * May be shared between sessions, all functions are thread-safe.
+ */
+typedef struct chiaki_network_path_cache_t
+{
+	ChiakiLog *log;
+	ChiakiMutex mutex;
+	char *file;
+	ChiakiNetworkPath entries[CHIAKI_NETWORK_PATH_CACHE_ENTRIES_MAX];
+	size_t entries_count;
+} ChiakiNetworkPathCache;
+
+/**
+ * Init the cache and load the entries stored in file. A missing or corrupt file results in an empty cache.
+ *
+ * @param file path of the file to load from and save to, may be NULL for a cache that only lives in memory
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_network_path_cache_init(ChiakiNetworkPathCache *cache, const char *file, ChiakiLog *log);
+CHIAKI_EXPORT void chiaki_network_path_cache_fini(ChiakiNetworkPathCache *cache);
+
+/**
+ * Write all entries to the file given on init, replacing it atomically.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_network_path_cache_save(ChiakiNetworkPathCache *cache);
+
+/**
+ * @param max_age_sec entries last updated longer ago than this are ignored, 0 to accept any age
+ * @param[out] path receives a copy of the entry
+ * @return true if an entry was found
+ */
+CHIAKI_EXPORT bool chiaki_network_path_cache_lookup(ChiakiNetworkPathCache *cache, const char *network_id, uint64_t max_age_sec, ChiakiNetworkPath *path);
+
+/**
+ * Insert or replace the entry for path->network_id, evicting the least recently updated one if the cache is full.
+ * path->updated is set to now.
+ */
+CHIAKI_EXPORT void chiaki_network_path_cache_store(ChiakiNetworkPathCache *cache, ChiakiNetworkPath *path);
+
+/**
+ * Remember a STUN server that answered, keeping the list ordered by recency and bounded.
+ */
+CHIAKI_EXPORT void chiaki_network_path_add_stun_server(ChiakiNetworkPath *path, const char *host, uint16_t port);
+
+/**
+ * Compute an identifier for the network this host is currently connected to.
+ *
+ * It is derived from the interface carrying the default route, its subnet, and the address and hardware address
+ * of the gateway where the platform exposes them, then hashed so that no addresses are stored on disk.
+ *
+ * @param[out] out at least CHIAKI_NETWORK_ID_SIZE bytes
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_network_identity(ChiakiLog *log, char *out);
+
+/**
+ * Hash a network descriptor string into a network id, exposed for platforms that determine identity themselves.
+ *
+ * @param[out] out at least CHIAKI_NETWORK_ID_SIZE bytes
+ */
+CHIAKI_EXPORT void chiaki_network_identity_from_descriptor(const char *descriptor, char *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_PATHCACHE_H
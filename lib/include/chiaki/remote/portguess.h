@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_PORTGUESS_H
+#define CHIAKI_PORTGUESS_H
+
+#include "../common.h"
+#include "../log.h"
+#include "../sock.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_PORT_GUESSER_WATCH_MAX 4
+#define CHIAKI_PORT_WINDOW_MAX 1024
+
+typedef struct chiaki_port_guesser_stats_t
+{
+	uint64_t probes_sent;
+	uint64_t send_calls; // syscalls it took to send them
+	uint64_t sockets_closed; // because sending on them failed
+} ChiakiPortGuesserStats;
+
+/**
+ * Set of UDP sockets probing a NAT with random port allocation.
+ *
+ * Every socket gets its own external mapping, so opening many of them makes it likely that one of
+ * the mappings is a port the peer is probing. Probes are sent in bursts with one sendmmsg() per socket
+ * where available and all sockets are watched through one epoll or poll set, so the number of
+ * sockets is not limited by FD_SETSIZE.
+ */
+typedef struct chiaki_port_guesser_t
+{
+	ChiakiLog *log;
+	chiaki_socket_t *socks; // owned, invalid entries were closed
+	size_t socks_count;
+	size_t socks_open;
+	chiaki_socket_t watched[CHIAKI_PORT_GUESSER_WATCH_MAX]; // not owned
+	size_t watched_count;
+#if defined(__linux__)
+	int epoll_fd;
+#else
+	void *pollfds;
+	size_t pollfds_count;
+	size_t poll_next; // ready sockets are reported round robin starting here
+#endif
+	ChiakiPortGuesserStats stats;
+} ChiakiPortGuesser;
+
+/**
+ * Open up to socks_count non-blocking IPv4 UDP sockets bound to ephemeral ports.
+ * With socks_count 0 the guesser only waits for sockets added with chiaki_port_guesser_watch().
+ *
+ * @param ttl initial IP TTL of the sockets, low enough for probes to open mappings in the local NAT
+ * without reaching the peer, see chiaki_port_guesser_socket_ready()
+ * @return CHIAKI_ERR_NETWORK if sockets were requested, but not a single one could be opened
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_port_guesser_init(ChiakiPortGuesser *guesser, ChiakiLog *log, size_t socks_count, int ttl);
+
+/**
+ * Close all sockets that are still owned by the guesser.
+ */
+CHIAKI_EXPORT void chiaki_port_guesser_fini(ChiakiPortGuesser *guesser);
+
+/**
+ * Additionally watch a socket that is not owned by the guesser in chiaki_port_guesser_wait().
+ * Invalid sockets are ignored.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_port_guesser_watch(ChiakiPortGuesser *guesser, chiaki_socket_t sock);
+
+CHIAKI_EXPORT bool chiaki_port_guesser_owns(ChiakiPortGuesser *guesser, chiaki_socket_t sock);
+
+/**
+ * Send the same probe from every owned socket to every IPv4 address in addrs, other families are skipped.
+ * A socket that fails to send is closed.
+ *
+ * @return number of probes sent
+ */
+CHIAKI_EXPORT size_t chiaki_port_guesser_burst(ChiakiPortGuesser *guesser, const uint8_t *buf, size_t buf_size,
+		const struct sockaddr_storage *addrs, const socklen_t *lens, size_t addrs_count);
+
+/**
+ * Wait until one of the owned or watched sockets is readable.
+ *
+ * @param[out] ready the readable socket, subsequent calls report other readable sockets first
+ * @return CHIAKI_ERR_TIMEOUT if nothing arrived within timeout_ms
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_port_guesser_wait(ChiakiPortGuesser *guesser, uint64_t timeout_ms, chiaki_socket_t *ready);
+
+/**
+ * Restore the TTL of an owned socket that received something, so replies on it reach the peer.
+ * The socket is closed if that fails.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_port_guesser_socket_ready(ChiakiPortGuesser *guesser, chiaki_socket_t sock);
+
+/**
+ * Close an owned socket and stop watching it.
+ */
+CHIAKI_EXPORT void chiaki_port_guesser_close(ChiakiPortGuesser *guesser, chiaki_socket_t sock);
+
+/**
+ * Hand an owned socket over to the caller, it is not watched or closed by the guesser anymore.
+ */
+CHIAKI_EXPORT void chiaki_port_guesser_release(ChiakiPortGuesser *guesser, chiaki_socket_t sock);
+
+/**
+ * Window of ports around a predicted mapping, guessed nearest first.
+ */
+typedef struct chiaki_port_window_t
+{
+	uint16_t center;
+	size_t size; // ports guessed so far
+	size_t max_size;
+} ChiakiPortWindow;
+
+/**
+ * The index-th guess around center: center, center + 1, center - 1, center + 2, ...
+ * Guesses leaving the range of ports NATs allocate from wrap around, skipping the well-known ports.
+ */
+CHIAKI_EXPORT uint16_t chiaki_port_window_port(uint16_t center, size_t index);
+
+CHIAKI_EXPORT void chiaki_port_window_init(ChiakiPortWindow *window, uint16_t center, size_t max_size);
+
+/**
+ * Grow the window, doubling it every time it is widened.
+ *
+ * @param[out] ports receives the ports that were not guessed before
+ * @return number of new ports, 0 if the window is at max_size
+ */
+CHIAKI_EXPORT size_t chiaki_port_window_widen(ChiakiPortWindow *window, size_t initial_size, uint16_t *ports, size_t ports_max);
+
+/**
+ * Restart the window around a port the peer was actually seen on.
+ *
+ * @return false if port is already the center
+ */
+CHIAKI_EXPORT bool chiaki_port_window_recenter(ChiakiPortWindow *window, uint16_t port);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_PORTGUESS_H
@@ -47,7 +47,15 @@ typedef enum rudp_packet_type_t
     FINISH = 0xC000,
 } RudpPacketType;
 
-/** Rudp Message */
+#define CHIAKI_RUDP_HEADER_SIZE 8
+#define CHIAKI_RUDP_DATAGRAM_SIZE_MAX 1500
+#define CHIAKI_RUDP_MESSAGES_MAX 16
+
+/**
+ * Rudp Message
+ *
+ * A parsed message does not own anything, data and subMessage point into the datagram it was parsed from.
+ */
 struct rudp_message_t
 {
     uint8_t subtype;
@@ -60,6 +68,43 @@ struct rudp_message_t
     uint16_t subMessage_size;
 };
 
+/**
+ * Received datagram together with the messages parsed from it.
+ * messages[0] is the first message, the following ones are chained as its sub messages.
+ */
+typedef struct chiaki_rudp_datagram_t
+{
+    uint8_t buf[CHIAKI_RUDP_DATAGRAM_SIZE_MAX];
+    size_t size;
+    RudpMessage messages[CHIAKI_RUDP_MESSAGES_MAX];
+    size_t messages_count;
+} ChiakiRudpDatagram;
+
+/**
+ * Parse a serialized message and its sub messages without copying or modifying buf
+ *
+ * @param[in] buf The serialized message, must outlive the parsed messages
+ * @param[in] buf_size The size of the serialized message
+ * @param[out] messages Receives the message followed by its sub messages, sub messages beyond messages_max are ignored
+ * @param[in] messages_max The number of entries in messages
+ * @param[out] messages_count The number of messages parsed
+ * @return CHIAKI_ERR_SUCCESS on success, CHIAKI_ERR_BUF_TOO_SMALL if buf does not hold a header
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_message_parse(uint8_t *buf, size_t buf_size,
+    RudpMessage *messages, size_t messages_max, size_t *messages_count);
+
+/**
+ * Serialize a message and its sub messages into a caller-provided buffer
+ *
+ * @param[in] message The message to serialize
+ * @param[out] buf The buffer to serialize into
+ * @param[in] buf_size The size of buf
+ * @param[out] msg_size The size of the serialized message
+ * @return CHIAKI_ERR_SUCCESS on success, CHIAKI_ERR_BUF_TOO_SMALL if the message does not fit into buf
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_message_serialize(const RudpMessage *message,
+    uint8_t *buf, size_t buf_size, size_t *msg_size);
+
 /**
  * Create rudp instance
  *
@@ -157,7 +202,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_raw(ChiakiRudp rudp,
  * Used for initial rudp sequences.
  *
  * @param rudp Pointer to the rudp instance to use
- * @param message Pointer to the rudp message that will be filled in during the receive
+ * @param datagram The datagram to receive into
+ * @param[out] message Set to the message of recv_type inside datagram
  * @param[in] buf The buf to send as part of the data of the rudp message or NULL if not used
  * @param[in] buf_size The size of the sbuf or 0 if buf not used for the message type
  * @param[in] remote_counter The remote counter of the message this message is being sent in response to or 0 if not used for the message type
@@ -168,7 +214,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_raw(ChiakiRudp rudp,
  *
 */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_recv(ChiakiRudp rudp,
-    RudpMessage *message, uint8_t *buf, size_t buf_size,
+    ChiakiRudpDatagram *datagram, RudpMessage **message, uint8_t *buf, size_t buf_size,
     uint16_t remote_counter, RudpPacketType send_type,
     RudpPacketType recv_type, size_t min_data_size, size_t tries);
 
@@ -176,23 +222,23 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_recv(ChiakiRudp rudp,
  * Selects an incoming message from the queue and receives the rudp message
  *
  * @param rudp Pointer to the Rudp instance to use
- * @param[in] buf_size The size of the received message
- * @param[out] message The Rudp message returned
+ * @param[in] buf_size The maximum size of the received message
+ * @param[out] datagram The received datagram and the Rudp messages parsed from it
  * @return CHIAKI_ERR_SUCCESS on success, otherwise another error code
  *
 */
-CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_select_recv(ChiakiRudp rudp, size_t buf_size, RudpMessage *message);
+CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_select_recv(ChiakiRudp rudp, size_t buf_size, ChiakiRudpDatagram *datagram);
 
 /**
  * Receives the rudp message. Must use select separately from this function
  *
  * @param rudp Pointer to the Rudp instance to use
- * @param[in] buf_size The size of the received message
- * @param[out] message The Rudp message returned
+ * @param[in] buf_size The maximum size of the received message
+ * @param[out] datagram The received datagram and the Rudp messages parsed from it
  * @return CHIAKI_ERR_SUCCESS on success, otherwise another error code
  * 
 */
-CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_recv_only(ChiakiRudp rudp, size_t buf_size,  RudpMessage *message);
+CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_recv_only(ChiakiRudp rudp, size_t buf_size, ChiakiRudpDatagram *datagram);
 
 /**
  * Selects a rudp message using the given stop pipe and timeout
@@ -205,12 +251,6 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_recv_only(ChiakiRudp rudp, size_t buf_
 */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_stop_pipe_select_single(ChiakiRudp rudp, ChiakiStopPipe *stop_pipe, uint64_t timeout);
 
-/**
- * Frees rudp message pointers if present (data and subMessage)
- *
- * @param message Pointer to the Rudp message with the data to free
-*/
-
 /**
  * Acknowledge received ack for rudp packet
  *
@@ -232,8 +272,6 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_ack_packet(ChiakiRudp rudp, uint16_t c
 */
 CHIAKI_EXPORT void chiaki_rudp_print_message(ChiakiRudp rudp, RudpMessage *message);
 
-CHIAKI_EXPORT void chiaki_rudp_message_pointers_free(RudpMessage *message);
-
 /**
  * Terminate rudp instance
  *
@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_STUNCLIENT_H
+#define CHIAKI_STUNCLIENT_H
+
+#include "../common.h"
+#include "../log.h"
+#include "../sock.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_STUN_ADDRESS_SIZE 46 // INET6_ADDRSTRLEN
+#define CHIAKI_STUN_SERVERS_MAX 32
+
+typedef struct chiaki_stun_server_t
+{
+	char *host;
+	uint16_t port;
+} ChiakiStunServer;
+
+typedef struct chiaki_stun_race_params_t
+{
+	bool ipv4;
+
+	/**
+	 * Number of servers with an unanswered request at the same time.
+	 * A server that didn't answer within request_timeout_ms is replaced by the next one in the list.
+	 */
+	size_t parallel;
+
+	/**
+	 * The race is over as soon as this many responses reporting the same external address are in.
+	 */
+	size_t responses_wanted;
+
+	uint64_t retransmit_ms; // first retransmission of an unanswered request, doubled for every further one
+	uint64_t request_timeout_ms;
+	uint64_t timeout_ms; // for the whole race
+} ChiakiStunRaceParams;
+
+typedef struct chiaki_stun_response_t
+{
+	size_t server_index; // into the servers passed to chiaki_stun_race()
+	/**
+	 * Position of the server's first request among all servers a request was sent to.
+	 * Every new destination gets a new mapping on a NAT with address dependent mapping, so this is
+	 * the order ports are allocated in, even if the responses arrive in a different one.
+	 */
+	size_t send_index;
+	char address[CHIAKI_STUN_ADDRESS_SIZE];
+	uint16_t port;
+	uint64_t rtt_ms; // since the first request to this server
+} ChiakiStunResponse;
+
+typedef struct chiaki_stun_race_result_t
+{
+	ChiakiStunResponse responses[CHIAKI_STUN_SERVERS_MAX];
+	size_t responses_count; // in order of arrival
+	size_t sent_count; // number of servers a request was sent to
+	uint64_t elapsed_ms;
+} ChiakiStunRaceResult;
+
+CHIAKI_EXPORT void chiaki_stun_race_params_default(ChiakiStunRaceParams *params, bool ipv4);
+
+/**
+ * Query several STUN servers concurrently from the same socket.
+ *
+ * All servers are resolved concurrently. Binding requests go out as soon as params->parallel of them are resolved,
+ * every unanswered request is retransmitted with backoff and a server that stays silent for too long or couldn't
+ * be resolved is replaced by the next one to finish resolving. Returns only after all lookups finished. Responses are matched by transaction id, so unrelated packets arriving on sock are ignored.
+ *
+ * @param sock checked for being invalid between receives, so the race can be canceled by closing it from
+ * another thread. It is closed and set to invalid if sending fails.
+ * @param servers at most CHIAKI_STUN_SERVERS_MAX are used, servers resolving to an address already queried are skipped
+ * @return CHIAKI_ERR_SUCCESS if responses_wanted consistent responses were received,
+ * CHIAKI_ERR_TIMEOUT if the race ended with fewer (result still contains them),
+ * CHIAKI_ERR_CANCELED if sock became invalid
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_stun_race(ChiakiLog *log, chiaki_socket_t *sock, const ChiakiStunServer *servers, size_t servers_count,
+		const ChiakiStunRaceParams *params, ChiakiStunRaceResult *result);
+
+/**
+ * Derive the external address and the NAT's port allocation behaviour from the responses of a race.
+ *
+ * Only responses reporting the most common address are considered. Port differences between them are divided
+ * by the difference of their send_index, so servers that never answered still count as an allocation.
+ *
+ * @param[out] address receives the external address, at least CHIAKI_STUN_ADDRESS_SIZE bytes
+ * @param[out] port receives the predicted mapped port of the last request sent
+ * @param[out] allocation_increment receives the port increment per new destination, 0 if mapping is endpoint independent
+ * @param[out] random_allocation set to true if increments were inconsistent, left untouched otherwise
+ * @return false if there are no responses
+ */
+CHIAKI_EXPORT bool chiaki_stun_allocation_derive(ChiakiLog *log, const ChiakiStunRaceResult *result,
+		char *address, uint16_t *port, int32_t *allocation_increment, bool *random_allocation);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_STUNCLIENT_H
@@ -17,6 +17,7 @@
 #include "remote/holepunch.h"
 #include "remote/rudp.h"
 #include "regist.h"
+#include "executor.h"
 
 #include <stdint.h>
 
@@ -89,6 +90,8 @@ typedef struct chiaki_connect_info_t
 	uint8_t psn_account_id[CHIAKI_PSN_ACCOUNT_ID_SIZE];
 	double packet_loss_max;
 	bool enable_idr_on_fec_failure;
+	bool wakeup; // wake the console from rest mode first and request the session as soon as it is ready
+	ChiakiExecutor *executor; // optional, runs the periodic jobs of the session instead of threads of its own, may be shared by many sessions
 } ChiakiConnectInfo;
 
 
@@ -151,6 +154,7 @@ typedef struct chiaki_video_fec_failure_event_t
 {
 	int32_t frame_index;
 	bool idr_request_sent;
+	bool idr_deferred; // no IDR was requested because valid references remain to recover from
 } ChiakiVideoFecFailureEvent;
 
 typedef enum {
@@ -227,6 +231,8 @@ typedef struct chiaki_session_t
 		bool enable_dualsense;
 		uint8_t psn_account_id[CHIAKI_PSN_ACCOUNT_ID_SIZE];
 		bool enable_idr_on_fec_failure;
+		bool wakeup;
+		ChiakiExecutor *executor;
 	} connect_info;
 
 	ChiakiTarget target;
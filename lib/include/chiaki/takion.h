@@ -117,6 +117,7 @@ typedef struct chiaki_takion_connect_info_t
 	bool enable_dualsense;
 	uint8_t protocol_version;
 	bool close_socket; // close socket when finishing takion
+	ChiakiExecutor *executor; // optional, runs the send buffer resends
 } ChiakiTakionConnectInfo;
 
 
@@ -167,6 +168,7 @@ typedef struct chiaki_takion_t
 	uint32_t tag_local;
 	uint32_t tag_remote;
 	bool close_socket;
+	ChiakiExecutor *executor;
 
 	ChiakiSeqNum32 seq_num_local;
 	ChiakiMutex seq_num_local_mutex;
@@ -7,6 +7,7 @@
 #include "log.h"
 #include "thread.h"
 #include "seqnum.h"
+#include "executor.h"
 
 #include <stdbool.h>
 
@@ -30,12 +31,15 @@ typedef struct chiaki_takion_send_buffer_t
 	ChiakiMutex mutex;
 	ChiakiCond cond;
 	bool should_stop;
-	ChiakiThread thread;
+	ChiakiThread thread; // only used without executor
+	ChiakiExecutor *executor;
+	ChiakiExecutorTask resend_task;
 } ChiakiTakionSendBuffer;
 
 
 /**
  * Init a Send Buffer and start a thread that automatically re-sends packets on takion.
+ * If takion has an executor, re-sending is scheduled on it instead of a thread of its own.
  *
  * @param takion if NULL, the Send Buffer thread will effectively do nothing (for unit testing)
  * @param size number of packet slots
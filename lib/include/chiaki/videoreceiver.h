@@ -9,6 +9,7 @@
 #include "takion.h"
 #include "frameprocessor.h"
 #include "bitstream.h"
+#include "dpb.h"
 #include "thread.h"
 
 #ifdef __cplusplus
@@ -33,7 +34,11 @@ typedef struct chiaki_video_receiver_t
 
 	int32_t frames_lost;
 	int32_t frames_lost_total;
-	int32_t reference_frames[16];
+	int32_t frames_recovered_total; // frames decoded by retargeting to another reference
+	int32_t idr_requests_total;
+	int32_t idr_requests_avoided_total; // losses where an IDR was not requested because a valid reference remained
+	bool idr_deferred; // an IDR request was skipped after a loss and no frame has been decoded since
+	ChiakiDpb dpb;
 	ChiakiBitstream bitstream;
 	ChiakiMutex waiting_for_idr_mutex;
 	bool waiting_for_idr;
@@ -57,6 +62,15 @@ CHIAKI_EXPORT void chiaki_video_receiver_set_waiting_for_idr(ChiakiVideoReceiver
 CHIAKI_EXPORT bool chiaki_video_receiver_get_waiting_for_idr(ChiakiVideoReceiver *video_receiver);
 CHIAKI_EXPORT int32_t chiaki_video_receiver_get_frames_lost_total(ChiakiVideoReceiver *video_receiver);
 
+typedef struct chiaki_video_receiver_recovery_stats_t
+{
+	int32_t frames_recovered_total;
+	int32_t idr_requests_total;
+	int32_t idr_requests_avoided_total;
+} ChiakiVideoReceiverRecoveryStats;
+
+CHIAKI_EXPORT void chiaki_video_receiver_get_recovery_stats(ChiakiVideoReceiver *video_receiver, ChiakiVideoReceiverRecoveryStats *stats);
+
 static inline ChiakiVideoReceiver *chiaki_video_receiver_new(struct chiaki_session_t *session, ChiakiPacketStats *packet_stats)
 {
 	ChiakiVideoReceiver *video_receiver = CHIAKI_NEW(ChiakiVideoReceiver);
@@ -3,11 +3,16 @@
 #include <chiaki/audioreceiver.h>
 #include <chiaki/session.h>
 
+#include <chiaki/time.h>
+
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define CHIAKI_AUDIO_JITTER_PREFILL 3
-#define CHIAKI_AUDIO_JITTER_BUFFER_SIZE 8
+#define CHIAKI_AUDIO_FRAME_DURATION_DEFAULT_US 10000
+#define CHIAKI_AUDIO_JITTER_GAIN 3.0
+#define CHIAKI_AUDIO_JITTER_HOLD_US 2000000
+#define CHIAKI_AUDIO_JITTER_SHRINK_INTERVAL_US 500000
 
 static void chiaki_audio_receiver_frame(ChiakiAudioReceiver *audio_receiver, ChiakiSeqNum16 frame_index, bool is_haptics, uint8_t *buf, size_t buf_size);
 static void chiaki_audio_receiver_clear_jitter_buffer(ChiakiAudioReceiver *audio_receiver);
@@ -16,6 +21,60 @@ static int chiaki_audio_receiver_find_audio_slot(const ChiakiAudioReceiver *audi
 static int chiaki_audio_receiver_find_oldest_audio_slot(const ChiakiAudioReceiver *audio_receiver);
 static int chiaki_audio_receiver_find_newest_audio_slot(const ChiakiAudioReceiver *audio_receiver);
 
+CHIAKI_EXPORT void chiaki_audio_jitter_estimator_init(ChiakiAudioJitterEstimator *estimator, uint64_t frame_duration_us)
+{
+	estimator->frame_duration_us = frame_duration_us ? frame_duration_us : CHIAKI_AUDIO_FRAME_DURATION_DEFAULT_US;
+	estimator->have_prev = false;
+	estimator->frame_index_prev = 0;
+	estimator->arrival_prev_us = 0;
+	estimator->jitter_us = 0.0;
+	estimator->target = CHIAKI_AUDIO_JITTER_TARGET_INITIAL;
+	estimator->shrink_at_us = 0;
+}
+
+CHIAKI_EXPORT unsigned chiaki_audio_jitter_estimator_push(ChiakiAudioJitterEstimator *estimator, ChiakiSeqNum16 frame_index, uint64_t arrival_us)
+{
+	if(!estimator->have_prev)
+	{
+		estimator->have_prev = true;
+		estimator->frame_index_prev = frame_index;
+		estimator->arrival_prev_us = arrival_us;
+		estimator->shrink_at_us = arrival_us + CHIAKI_AUDIO_JITTER_HOLD_US;
+		return estimator->target;
+	}
+
+	// difference of relative transit times of this and the previous packet
+	int16_t frames_delta = (int16_t)(frame_index - estimator->frame_index_prev);
+	double d = ((double)arrival_us - (double)estimator->arrival_prev_us)
+		- (double)frames_delta * (double)estimator->frame_duration_us;
+	estimator->jitter_us += (fabs(d) - estimator->jitter_us) / 16.0;
+
+	if(frames_delta > 0)
+	{
+		estimator->frame_index_prev = frame_index;
+		estimator->arrival_prev_us = arrival_us;
+	}
+
+	double desired_f = 1.0 + floor(CHIAKI_AUDIO_JITTER_GAIN * estimator->jitter_us / (double)estimator->frame_duration_us + 0.5);
+	unsigned desired = desired_f > CHIAKI_AUDIO_JITTER_TARGET_MAX ? CHIAKI_AUDIO_JITTER_TARGET_MAX : (unsigned)desired_f;
+	if(desired < CHIAKI_AUDIO_JITTER_TARGET_MIN)
+		desired = CHIAKI_AUDIO_JITTER_TARGET_MIN;
+
+	if(desired >= estimator->target)
+	{
+		// grow right away and keep the target for a while after jitter last required it
+		estimator->target = desired;
+		estimator->shrink_at_us = arrival_us + CHIAKI_AUDIO_JITTER_HOLD_US;
+	}
+	else if(arrival_us >= estimator->shrink_at_us)
+	{
+		estimator->target--;
+		estimator->shrink_at_us = arrival_us + CHIAKI_AUDIO_JITTER_SHRINK_INTERVAL_US;
+	}
+
+	return estimator->target;
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_receiver_init(ChiakiAudioReceiver *audio_receiver, ChiakiSession *session, ChiakiPacketStats *packet_stats)
 {
 	audio_receiver->session = session;
@@ -29,6 +88,9 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_receiver_init(ChiakiAudioReceiver *au
 	audio_receiver->frame_index_startup = true;
 	audio_receiver->jitter_buffer_count = 0;
 	memset(audio_receiver->jitter_buffer, 0, sizeof(audio_receiver->jitter_buffer));
+	chiaki_audio_jitter_estimator_init(&audio_receiver->jitter, 0);
+	audio_receiver->frames_concealed = 0;
+	audio_receiver->frames_fec_recovered = 0;
 
 	ChiakiErrorCode err = chiaki_mutex_init(&audio_receiver->mutex, false);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -71,6 +133,8 @@ CHIAKI_EXPORT void chiaki_audio_receiver_stream_info(ChiakiAudioReceiver *audio_
 	audio_receiver->playback_started = false;
 	audio_receiver->frame_index_startup = true;
 	chiaki_audio_receiver_clear_jitter_buffer(audio_receiver);
+	uint64_t frame_duration_us = audio_header->rate ? (uint64_t)audio_header->frame_size * 1000000 / audio_header->rate : 0;
+	chiaki_audio_jitter_estimator_init(&audio_receiver->jitter, frame_duration_us);
 
 	if(header_cb)
 		header_cb(audio_header, header_cb_user);
@@ -118,6 +182,12 @@ CHIAKI_EXPORT void chiaki_audio_receiver_av_packet(ChiakiAudioReceiver *audio_re
 	if(packet->frame_index > (1 << 15))
 		audio_receiver->frame_index_startup = false;
 
+	if(!packet->is_haptics && chiaki_mutex_lock(&audio_receiver->mutex) == CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_audio_jitter_estimator_push(&audio_receiver->jitter, packet->frame_index, chiaki_time_now_monotonic_us());
+		chiaki_mutex_unlock(&audio_receiver->mutex);
+	}
+
 	for(size_t i = 0; i < source_units_count + fec_units_count; i++)
 	{
 		ChiakiSeqNum16 frame_index;
@@ -138,6 +208,19 @@ CHIAKI_EXPORT void chiaki_audio_receiver_av_packet(ChiakiAudioReceiver *audio_re
 		chiaki_packet_stats_push_seq(audio_receiver->packet_stats, packet->frame_index);
 }
 
+CHIAKI_EXPORT void chiaki_audio_receiver_get_stats(ChiakiAudioReceiver *audio_receiver, ChiakiAudioReceiverStats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if(chiaki_mutex_lock(&audio_receiver->mutex) != CHIAKI_ERR_SUCCESS)
+		return;
+	stats->jitter_ms = audio_receiver->jitter.jitter_us / 1000.0;
+	stats->target_frames = audio_receiver->jitter.target;
+	stats->buffered_frames = audio_receiver->jitter_buffer_count;
+	stats->frames_concealed = audio_receiver->frames_concealed;
+	stats->frames_fec_recovered = audio_receiver->frames_fec_recovered;
+	chiaki_mutex_unlock(&audio_receiver->mutex);
+}
+
 static void chiaki_audio_receiver_frame(ChiakiAudioReceiver *audio_receiver, ChiakiSeqNum16 frame_index, bool is_haptics, uint8_t *buf, size_t buf_size)
 {
 	while(true)
@@ -187,7 +270,8 @@ static void chiaki_audio_receiver_frame(ChiakiAudioReceiver *audio_receiver, Chi
 			buf_size = 0;
 		}
 
-		if(!audio_receiver->playback_started && audio_receiver->jitter_buffer_count >= CHIAKI_AUDIO_JITTER_PREFILL)
+		unsigned jitter_target = audio_receiver->jitter.target;
+		if(!audio_receiver->playback_started && audio_receiver->jitter_buffer_count >= jitter_target)
 		{
 			int oldest = chiaki_audio_receiver_find_oldest_audio_slot(audio_receiver);
 			if(oldest >= 0)
@@ -224,9 +308,9 @@ static void chiaki_audio_receiver_frame(ChiakiAudioReceiver *audio_receiver, Chi
 				bool can_conceal_loss = false;
 				if(newer_audio_buffered && newest >= 0)
 				{
-					if(audio_receiver->jitter_buffer_count >= CHIAKI_AUDIO_JITTER_PREFILL)
+					if(audio_receiver->jitter_buffer_count >= jitter_target)
 					{
-						ChiakiSeqNum16 required_lookahead = audio_receiver->next_frame_index + CHIAKI_AUDIO_JITTER_PREFILL;
+						ChiakiSeqNum16 required_lookahead = audio_receiver->next_frame_index + jitter_target;
 						can_conceal_loss = chiaki_seq_num_16_gt(audio_receiver->jitter_buffer[newest].frame_index, required_lookahead - 1);
 					}
 					else
@@ -240,6 +324,24 @@ static void chiaki_audio_receiver_frame(ChiakiAudioReceiver *audio_receiver, Chi
 					frame_cb_user = audio_receiver->session->audio_sink.user;
 					deliver_buf = NULL;
 					deliver_buf_size = 0;
+					int next_slot = chiaki_audio_receiver_find_audio_slot(audio_receiver, audio_receiver->next_frame_index + 1);
+					if(next_slot >= 0 && audio_receiver->session->audio_sink.fec_frame_cb && audio_receiver->jitter_buffer[next_slot].buf_size)
+					{
+						// the next frame stays buffered for regular decoding, so hand out a copy
+						size_t next_buf_size = audio_receiver->jitter_buffer[next_slot].buf_size;
+						deliver_buf = malloc(next_buf_size);
+						if(deliver_buf)
+						{
+							memcpy(deliver_buf, audio_receiver->jitter_buffer[next_slot].buf, next_buf_size);
+							deliver_buf_size = next_buf_size;
+							deliver_owned_buf = true;
+							frame_cb = audio_receiver->session->audio_sink.fec_frame_cb;
+						}
+					}
+					if(deliver_buf)
+						audio_receiver->frames_fec_recovered++;
+					else
+						audio_receiver->frames_concealed++;
 					audio_receiver->frame_index_prev = audio_receiver->next_frame_index;
 					audio_receiver->next_frame_index++;
 				}
@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/audioresampler.h>
+
+#include <math.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define TAPS CHIAKI_AUDIO_RESAMPLER_TAPS
+#define PHASES CHIAKI_AUDIO_RESAMPLER_PHASES
+#define CENTER (TAPS / 2 - 1)
+
+#define DRIFT_FILL_TAU_S 1.0
+#define DRIFT_KP (CHIAKI_AUDIO_DRIFT_PPM_MAX * 1e-6) // full correction when off by the whole target
+#define DRIFT_TI_S 30.0
+
+static double kernel_value(double x)
+{
+	// sinc windowed by a Blackman window spanning all taps
+	double half_width = TAPS / 2;
+	if(x <= -half_width || x >= half_width)
+		return 0.0;
+	double sinc = x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+	double window = 0.42 + 0.5 * cos(M_PI * x / half_width) + 0.08 * cos(2.0 * M_PI * x / half_width);
+	return sinc * window;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_resampler_init(ChiakiAudioResampler *resampler, unsigned int channels)
+{
+	if(!channels || channels > CHIAKI_AUDIO_RESAMPLER_CHANNELS_MAX)
+		return CHIAKI_ERR_INVALID_DATA;
+	resampler->channels = channels;
+	resampler->step = 1.0;
+
+	for(unsigned int p=0; p<=PHASES; p++)
+	{
+		double phase = (double)p / PHASES;
+		double sum = 0.0;
+		for(unsigned int k=0; k<TAPS; k++)
+		{
+			double v = kernel_value((double)k - CENTER - phase);
+			resampler->kernel[p][k] = (float)v;
+			sum += v;
+		}
+		// unity gain at DC for every phase
+		for(unsigned int k=0; k<TAPS; k++)
+			resampler->kernel[p][k] = (float)(resampler->kernel[p][k] / sum);
+	}
+
+	chiaki_audio_resampler_reset(resampler);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_audio_resampler_reset(ChiakiAudioResampler *resampler)
+{
+	memset(resampler->history, 0, sizeof(resampler->history));
+	resampler->history_pos = 0;
+	resampler->phase = 0.0;
+}
+
+CHIAKI_EXPORT void chiaki_audio_resampler_set_ratio(ChiakiAudioResampler *resampler, double ratio)
+{
+	if(ratio < 1.0 - CHIAKI_AUDIO_RESAMPLER_RATIO_RANGE)
+		ratio = 1.0 - CHIAKI_AUDIO_RESAMPLER_RATIO_RANGE;
+	else if(ratio > 1.0 + CHIAKI_AUDIO_RESAMPLER_RATIO_RANGE)
+		ratio = 1.0 + CHIAKI_AUDIO_RESAMPLER_RATIO_RANGE;
+	resampler->step = 1.0 / ratio;
+}
+
+static int16_t clamp_s16(float v)
+{
+	v = v < 0.0f ? v - 0.5f : v + 0.5f;
+	if(v >= 32767.0f)
+		return 32767;
+	if(v <= -32768.0f)
+		return -32768;
+	return (int16_t)v;
+}
+
+CHIAKI_EXPORT size_t chiaki_audio_resampler_process(ChiakiAudioResampler *resampler, const int16_t *in, size_t in_frames, int16_t *out, size_t out_frames_max)
+{
+	unsigned int channels = resampler->channels;
+	size_t out_frames = 0;
+	for(size_t i=0; i<in_frames; i++)
+	{
+		unsigned int pos = resampler->history_pos;
+		for(unsigned int c=0; c<channels; c++)
+		{
+			float v = (float)in[i * channels + c];
+			resampler->history[c][pos] = v;
+			resampler->history[c][pos + TAPS] = v;
+		}
+		resampler->history_pos = (pos + 1) % TAPS;
+
+		// the window of the last TAPS frames, oldest first, now starts at history_pos
+		while(resampler->phase < 1.0)
+		{
+			if(out_frames < out_frames_max)
+			{
+				double fp = resampler->phase * PHASES;
+				unsigned int p = (unsigned int)fp;
+				float frac = (float)(fp - p);
+				const float *k0 = resampler->kernel[p];
+				const float *k1 = resampler->kernel[p + 1];
+				for(unsigned int c=0; c<channels; c++)
+				{
+					const float *window = resampler->history[c] + resampler->history_pos;
+					float a = 0.0f, b = 0.0f;
+					for(unsigned int k=0; k<TAPS; k++)
+					{
+						a += window[k] * k0[k];
+						b += window[k] * k1[k];
+					}
+					out[out_frames * channels + c] = clamp_s16(a + (b - a) * frac);
+				}
+				out_frames++;
+			}
+			resampler->phase += resampler->step;
+		}
+		resampler->phase -= 1.0;
+	}
+	return out_frames;
+}
+
+CHIAKI_EXPORT void chiaki_audio_drift_controller_init(ChiakiAudioDriftController *controller, size_t target_frames)
+{
+	controller->target = target_frames ? (double)target_frames : 1.0;
+	controller->fill = controller->target;
+	controller->integral = 0.0;
+	controller->ratio = 1.0;
+	controller->last_us = 0;
+	controller->started = false;
+}
+
+CHIAKI_EXPORT double chiaki_audio_drift_controller_update(ChiakiAudioDriftController *controller, size_t buffered_frames, uint64_t now_us)
+{
+	if(!controller->started)
+	{
+		controller->started = true;
+		controller->last_us = now_us;
+		return controller->ratio;
+	}
+	if(now_us <= controller->last_us)
+		return controller->ratio;
+	double dt = (double)(now_us - controller->last_us) * 1e-6;
+	controller->last_us = now_us;
+	if(dt > DRIFT_FILL_TAU_S)
+		dt = DRIFT_FILL_TAU_S; // e.g. after a stall, don't let a single sample dominate
+
+	controller->fill += (dt / (DRIFT_FILL_TAU_S + dt)) * ((double)buffered_frames - controller->fill);
+	double error = (controller->fill - controller->target) / controller->target;
+
+	// only integrate while not saturated, so we don't wind up during long stalls or bursts
+	const double max = CHIAKI_AUDIO_DRIFT_PPM_MAX * 1e-6;
+	double integral = controller->integral + error * dt;
+	double correction = DRIFT_KP * (error + integral / DRIFT_TI_S);
+	if(correction > max)
+		correction = max;
+	else if(correction < -max)
+		correction = -max;
+	else
+		controller->integral = integral;
+
+	controller->ratio = 1.0 - correction;
+	return controller->ratio;
+}
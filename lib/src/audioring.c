@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/audioring.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// All supported toolchains (gcc, clang and clang-cl) provide these builtins,
+// using them instead of <stdatomic.h> keeps the struct usable from C++.
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+#define RING_MIN_MS 100
+#define VOLUME_MAX 128
+
+static size_t ms_to_bytes(ChiakiAudioRing *ring, unsigned int ms)
+{
+	return ((size_t)ring->rate * ms / 1000) * ring->frame_size;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_ring_init(ChiakiAudioRing *ring, size_t frame_size, unsigned int rate, unsigned int target_ms)
+{
+	memset(ring, 0, sizeof(*ring));
+	if(!frame_size || !rate || !target_ms)
+		return CHIAKI_ERR_INVALID_DATA;
+	ring->frame_size = frame_size;
+	ring->rate = rate;
+	ring->target = ms_to_bytes(ring, target_ms);
+	if(!ring->target)
+		ring->target = frame_size;
+	size_t min_size = ring->target * 4;
+	if(min_size < ms_to_bytes(ring, RING_MIN_MS))
+		min_size = ms_to_bytes(ring, RING_MIN_MS);
+	// a power of two divides the range of the free-running positions, so they may wrap around
+	ring->size = 1;
+	while(ring->size < min_size)
+		ring->size <<= 1;
+	ring->buf = malloc(ring->size);
+	if(!ring->buf)
+		return CHIAKI_ERR_MEMORY;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_audio_ring_fini(ChiakiAudioRing *ring)
+{
+	free(ring->buf);
+	ring->buf = NULL;
+}
+
+/**
+ * Reserve space for up to buf_size bytes (whole sample frames only) at the producer side.
+ * The reserved region may wrap around, so it is returned as two segments.
+ */
+static size_t write_reserve(ChiakiAudioRing *ring, size_t buf_size, size_t *offset, size_t *first)
+{
+	size_t write_pos = ring->write_pos; // only written by us
+	size_t read_pos = LOAD_ACQUIRE(&ring->read_pos);
+	size_t free_size = ring->size - (write_pos - read_pos);
+	if(buf_size > free_size)
+		buf_size = free_size;
+	buf_size -= buf_size % ring->frame_size;
+	*offset = write_pos & (ring->size - 1);
+	*first = ring->size - *offset;
+	if(*first > buf_size)
+		*first = buf_size;
+	return buf_size;
+}
+
+CHIAKI_EXPORT size_t chiaki_audio_ring_write(ChiakiAudioRing *ring, const uint8_t *buf, size_t buf_size)
+{
+	size_t offset, first;
+	buf_size = write_reserve(ring, buf_size, &offset, &first);
+	memcpy(ring->buf + offset, buf, first);
+	memcpy(ring->buf, buf + first, buf_size - first);
+	STORE_RELEASE(&ring->write_pos, ring->write_pos + buf_size);
+	return buf_size;
+}
+
+static void copy_s16_volume(uint8_t *dst, const int16_t *src, size_t samples, int volume)
+{
+	if(volume >= VOLUME_MAX)
+	{
+		memcpy(dst, src, samples * sizeof(int16_t));
+		return;
+	}
+	for(size_t i=0; i<samples; i++)
+	{
+		int16_t s = (int16_t)(((int32_t)src[i] * volume) / VOLUME_MAX);
+		memcpy(dst + i * sizeof(int16_t), &s, sizeof(s));
+	}
+}
+
+CHIAKI_EXPORT size_t chiaki_audio_ring_write_s16(ChiakiAudioRing *ring, const int16_t *buf, size_t samples_count, int volume)
+{
+	if(volume < 0)
+		volume = 0;
+	size_t offset, first;
+	size_t buf_size = write_reserve(ring, samples_count * sizeof(int16_t), &offset, &first);
+	size_t first_samples = first / sizeof(int16_t);
+	copy_s16_volume(ring->buf + offset, buf, first_samples, volume);
+	copy_s16_volume(ring->buf, buf + first_samples, buf_size / sizeof(int16_t) - first_samples, volume);
+	STORE_RELEASE(&ring->write_pos, ring->write_pos + buf_size);
+	return buf_size;
+}
+
+CHIAKI_EXPORT void chiaki_audio_ring_read(ChiakiAudioRing *ring, uint8_t *buf, size_t buf_size)
+{
+	size_t read_pos = ring->read_pos; // only written by us
+	size_t buffered = LOAD_ACQUIRE(&ring->write_pos) - read_pos;
+
+	if(!ring->primed)
+	{
+		size_t prime = ring->target;
+		if(prime < buf_size)
+			prime = buf_size;
+		if(buffered < prime)
+		{
+			memset(buf, 0, buf_size);
+			ring->silence_bytes += buf_size;
+			return;
+		}
+		ring->primed = true;
+	}
+
+	// whatever is left after this read is our latency, bring it back to the target if it ran away
+	if(buffered > buf_size && buffered - buf_size > ring->target * 2)
+	{
+		size_t drop = buffered - buf_size - ring->target;
+		drop -= drop % ring->frame_size;
+		read_pos += drop;
+		buffered -= drop;
+		ring->dropped_bytes += drop;
+	}
+
+	size_t size = buf_size < buffered ? buf_size : buffered;
+	size_t offset = read_pos & (ring->size - 1);
+	size_t first = ring->size - offset;
+	if(first > size)
+		first = size;
+	memcpy(buf, ring->buf + offset, first);
+	memcpy(buf + first, ring->buf, size - first);
+	STORE_RELEASE(&ring->read_pos, read_pos + size);
+
+	if(size < buf_size)
+	{
+		memset(buf + size, 0, buf_size - size);
+		ring->silence_bytes += buf_size - size;
+		ring->underruns++;
+		ring->primed = false;
+	}
+}
+
+CHIAKI_EXPORT size_t chiaki_audio_ring_buffered(ChiakiAudioRing *ring)
+{
+	size_t read_pos = LOAD_ACQUIRE(&ring->read_pos);
+	return LOAD_ACQUIRE(&ring->write_pos) - read_pos;
+}
+
+CHIAKI_EXPORT unsigned int chiaki_audio_ring_buffered_ms(ChiakiAudioRing *ring)
+{
+	return (unsigned int)((uint64_t)chiaki_audio_ring_buffered(ring) / ring->frame_size * 1000 / ring->rate);
+}
+
+CHIAKI_EXPORT void chiaki_audio_ring_flush(ChiakiAudioRing *ring)
+{
+	STORE_RELEASE(&ring->read_pos, LOAD_ACQUIRE(&ring->write_pos));
+	ring->primed = false;
+}
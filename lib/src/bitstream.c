@@ -54,14 +54,17 @@ static bool header_h264(ChiakiBitstream *bitstream, uint8_t *data, unsigned size
 
 	vl_rbsp_ue(&rbsp); // seq_parameter_set_id
 
+	unsigned chroma_format_idc = 1;
+	unsigned separate_colour_plane_flag = 0;
 	if(profile_idc == 100 || profile_idc == 110 ||
 		profile_idc == 122 || profile_idc == 244 || profile_idc == 44 ||
 		profile_idc == 83 || profile_idc == 86 || profile_idc == 118 ||
 		profile_idc == 128 || profile_idc == 138 || profile_idc == 139 ||
 		profile_idc == 134 || profile_idc == 135)
 	{
-		if (vl_rbsp_ue(&rbsp) == 3) // chroma_format_idc
-			vl_rbsp_u(&rbsp, 1); // separate_colour_plane_flag
+		chroma_format_idc = vl_rbsp_ue(&rbsp);
+		if (chroma_format_idc == 3)
+			separate_colour_plane_flag = vl_rbsp_u(&rbsp, 1);
 
 		vl_rbsp_ue(&rbsp); // bit_depth_luma_minus8
 		vl_rbsp_ue(&rbsp); // bit_depth_chroma_minus8
@@ -78,6 +81,64 @@ static bool header_h264(ChiakiBitstream *bitstream, uint8_t *data, unsigned size
 		return false;
 	}
 
+	bitstream->h264.sps.pic_order_cnt_type = vl_rbsp_ue(&rbsp);
+	if(bitstream->h264.sps.pic_order_cnt_type == 0)
+	{
+		bitstream->h264.sps.log2_max_pic_order_cnt_lsb_minus4 = vl_rbsp_ue(&rbsp);
+		if(bitstream->h264.sps.log2_max_pic_order_cnt_lsb_minus4 > 12)
+		{
+			CHIAKI_LOGW(bitstream->log, "parse_sps_h264: Unexpected log2_max_pic_order_cnt_lsb_minus4 value %u", bitstream->h264.sps.log2_max_pic_order_cnt_lsb_minus4);
+			return false;
+		}
+	}
+	else if(bitstream->h264.sps.pic_order_cnt_type == 1)
+	{
+		vl_rbsp_u(&rbsp, 1); // delta_pic_order_always_zero_flag
+		vl_rbsp_se(&rbsp); // offset_for_non_ref_pic
+		vl_rbsp_se(&rbsp); // offset_for_top_to_bottom_field
+		unsigned num_ref_frames_in_pic_order_cnt_cycle = vl_rbsp_ue(&rbsp);
+		if(num_ref_frames_in_pic_order_cnt_cycle > 255)
+		{
+			CHIAKI_LOGW(bitstream->log, "parse_sps_h264: Unexpected num_ref_frames_in_pic_order_cnt_cycle value %u", num_ref_frames_in_pic_order_cnt_cycle);
+			return false;
+		}
+		for(unsigned i=0; i<num_ref_frames_in_pic_order_cnt_cycle; i++)
+			vl_rbsp_se(&rbsp); // offset_for_ref_frame[i]
+	}
+
+	bitstream->h264.sps.max_num_ref_frames = vl_rbsp_ue(&rbsp);
+
+	vl_rbsp_u(&rbsp, 1); // gaps_in_frame_num_value_allowed_flag
+	unsigned pic_width_in_mbs_minus1 = vl_rbsp_ue(&rbsp);
+	unsigned pic_height_in_map_units_minus1 = vl_rbsp_ue(&rbsp);
+	unsigned frame_mbs_only_flag = vl_rbsp_u(&rbsp, 1);
+	if(!frame_mbs_only_flag)
+		vl_rbsp_u(&rbsp, 1); // mb_adaptive_frame_field_flag
+	vl_rbsp_u(&rbsp, 1); // direct_8x8_inference_flag
+	unsigned width = (pic_width_in_mbs_minus1 + 1) * 16;
+	unsigned height = (2 - frame_mbs_only_flag) * (pic_height_in_map_units_minus1 + 1) * 16;
+	if(vl_rbsp_u(&rbsp, 1)) // frame_cropping_flag
+	{
+		unsigned crop_unit_x = 1;
+		unsigned crop_unit_y = 2 - frame_mbs_only_flag;
+		if(chroma_format_idc != 0 && !separate_colour_plane_flag)
+		{
+			crop_unit_x *= chroma_format_idc == 3 ? 1 : 2; // SubWidthC
+			crop_unit_y *= chroma_format_idc == 1 ? 2 : 1; // SubHeightC
+		}
+		unsigned left = vl_rbsp_ue(&rbsp);
+		unsigned right = vl_rbsp_ue(&rbsp);
+		unsigned top = vl_rbsp_ue(&rbsp);
+		unsigned bottom = vl_rbsp_ue(&rbsp);
+		if(crop_unit_x * (left + right) < width && crop_unit_y * (top + bottom) < height)
+		{
+			width -= crop_unit_x * (left + right);
+			height -= crop_unit_y * (top + bottom);
+		}
+	}
+	bitstream->h264.sps.width = width;
+	bitstream->h264.sps.height = height;
+
 	return true;
 }
 
@@ -110,7 +171,7 @@ sps_start:
 	vl_rbsp_init(&rbsp, &vlc, ~0);
 
 	vl_rbsp_u(&rbsp, 4); // sps_video_parameter_set_id
-	vl_rbsp_u(&rbsp, 3); // sps_max_sub_layers_minus1
+	unsigned sps_max_sub_layers_minus1 = vl_rbsp_u(&rbsp, 3);
 	vl_rbsp_u(&rbsp, 1); // sps_temporal_id_nesting_flag
 
 	vl_rbsp_u(&rbsp, 2); // general_profile_space
@@ -126,18 +187,34 @@ sps_start:
 	vl_rbsp_u(&rbsp, 8); // general_level_idc
 
 	vl_rbsp_ue(&rbsp); // sps_seq_parameter_set_id
-	if(vl_rbsp_ue(&rbsp) == 3) // chroma_format_idc
-		vl_rbsp_u(&rbsp, 1); // separate_colour_plane_flag
+	unsigned chroma_format_idc = vl_rbsp_ue(&rbsp);
+	unsigned separate_colour_plane_flag = 0;
+	if(chroma_format_idc == 3)
+		separate_colour_plane_flag = vl_rbsp_u(&rbsp, 1);
 
-	vl_rbsp_ue(&rbsp); // pic_width_in_luma_samples
-	vl_rbsp_ue(&rbsp); // pic_height_in_luma_samples
+	unsigned pic_width_in_luma_samples = vl_rbsp_ue(&rbsp);
+	unsigned pic_height_in_luma_samples = vl_rbsp_ue(&rbsp);
+	bitstream->h265.sps.width = pic_width_in_luma_samples;
+	bitstream->h265.sps.height = pic_height_in_luma_samples;
 
 	if(vl_rbsp_u(&rbsp, 1)) // conformance_window_flag
 	{
-		vl_rbsp_ue(&rbsp); // conf_win_left_offset
-		vl_rbsp_ue(&rbsp); // conf_win_right_offset
-		vl_rbsp_ue(&rbsp); // conf_win_top_offset
-		vl_rbsp_ue(&rbsp); // conf_win_bottom_offset
+		unsigned sub_width = 1;
+		unsigned sub_height = 1;
+		if(chroma_format_idc != 0 && !separate_colour_plane_flag)
+		{
+			sub_width = chroma_format_idc == 3 ? 1 : 2;
+			sub_height = chroma_format_idc == 1 ? 2 : 1;
+		}
+		unsigned left = vl_rbsp_ue(&rbsp);
+		unsigned right = vl_rbsp_ue(&rbsp);
+		unsigned top = vl_rbsp_ue(&rbsp);
+		unsigned bottom = vl_rbsp_ue(&rbsp);
+		if(sub_width * (left + right) < pic_width_in_luma_samples && sub_height * (top + bottom) < pic_height_in_luma_samples)
+		{
+			bitstream->h265.sps.width -= sub_width * (left + right);
+			bitstream->h265.sps.height -= sub_height * (top + bottom);
+		}
 	}
 
 	vl_rbsp_ue(&rbsp); // bit_depth_luma_minus8
@@ -150,6 +227,29 @@ sps_start:
 		return false;
 	}
 
+	unsigned sps_sub_layer_ordering_info_present_flag = vl_rbsp_u(&rbsp, 1);
+	for(unsigned i=sps_sub_layer_ordering_info_present_flag ? 0 : sps_max_sub_layers_minus1; i<=sps_max_sub_layers_minus1; i++)
+	{
+		bitstream->h265.sps.max_dec_pic_buffering_minus1 = vl_rbsp_ue(&rbsp);
+		vl_rbsp_ue(&rbsp); // sps_max_num_reorder_pics[i]
+		vl_rbsp_ue(&rbsp); // sps_max_latency_increase_plus1[i]
+	}
+
+	unsigned log2_min_luma_coding_block_size_minus3 = vl_rbsp_ue(&rbsp);
+	unsigned log2_diff_max_min_luma_coding_block_size = vl_rbsp_ue(&rbsp);
+	unsigned ctb_log2_size = log2_min_luma_coding_block_size_minus3 + 3 + log2_diff_max_min_luma_coding_block_size;
+	if(ctb_log2_size > 6)
+	{
+		CHIAKI_LOGW(bitstream->log, "parse_sps_h265: Unexpected CTB size 2^%u", ctb_log2_size);
+		return false;
+	}
+	unsigned ctb_size = 1 << ctb_log2_size;
+	unsigned pic_size_in_ctbs = ((pic_width_in_luma_samples + ctb_size - 1) >> ctb_log2_size)
+		* ((pic_height_in_luma_samples + ctb_size - 1) >> ctb_log2_size);
+	bitstream->h265.sps.slice_segment_address_bits = 0;
+	while((1u << bitstream->h265.sps.slice_segment_address_bits) < pic_size_in_ctbs)
+		bitstream->h265.sps.slice_segment_address_bits++;
+
 	return true;
 }
 
@@ -192,6 +292,8 @@ static bool slice_h264(ChiakiBitstream *bitstream, uint8_t *data, unsigned size,
 			break;
 	}
 
+	slice->ref_pics_count = 0;
+	slice->reference_frame_bits = 0;
 	if(nal_unit_type == 1)
 	{
 		slice->reference_frame = 0;
@@ -207,7 +309,10 @@ static bool slice_h264(ChiakiBitstream *bitstream, uint8_t *data, unsigned size,
 			while(i++<3)
 			{
 				if(modification_of_pic_nums_idc == 0)
+				{
 					slice->reference_frame = vl_rbsp_ue(&rbsp); // abs_diff_pic_num_minus1
+					slice->reference_frame_bits = chiaki_bitstream_ue_len(slice->reference_frame);
+				}
 				else if(modification_of_pic_nums_idc < 3)
 					vl_rbsp_ue(&rbsp); // abs_diff_pic_num_minus1 or long_term_pic_num
 				else if(modification_of_pic_nums_idc == 3)
@@ -269,6 +374,8 @@ static bool slice_h265(ChiakiBitstream *bitstream, uint8_t *data, unsigned size,
 			break;
 	}
 
+	slice->ref_pics_count = 0;
+	slice->reference_frame_bits = 0;
 	if(nal_unit_type == 1)
 	{
 		slice->reference_frame = 0xff;
@@ -282,14 +389,14 @@ static bool slice_h265(ChiakiBitstream *bitstream, uint8_t *data, unsigned size,
 				return false;
 			}
 			vl_rbsp_ue(&rbsp); // num_positive_pics
+			unsigned distance = 0;
 			for(unsigned i=0; i<num_negative_pics; i++)
 			{
-				vl_rbsp_ue(&rbsp); // delta_poc_s0_minus1[i]
-				if(vl_rbsp_u(&rbsp, 1)) // used_by_curr_pic_s0_flag[i]
-				{
+				distance += vl_rbsp_ue(&rbsp) + 1; // delta_poc_s0_minus1[i]
+				slice->ref_pics[i] = distance > UINT8_MAX ? UINT8_MAX : distance;
+				slice->ref_pics_count = i + 1;
+				if(vl_rbsp_u(&rbsp, 1) && slice->reference_frame == 0xff) // used_by_curr_pic_s0_flag[i]
 					slice->reference_frame = i;
-					break;
-				}
 			}
 		}
 		if(slice->reference_frame == 0xff)
@@ -299,76 +406,271 @@ static bool slice_h265(ChiakiBitstream *bitstream, uint8_t *data, unsigned size,
 	return true;
 }
 
-static bool slice_set_reference_frame_h265(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, unsigned reference_frame)
+/**
+ * Bit cursor over the raw bytes of a single NAL unit (starting at the NAL header).
+ * Unlike vl_rbsp, it keeps track of the exact position inside the escaped data,
+ * so it can be used to rewrite syntax elements in place.
+ */
+typedef struct nal_cursor_t
 {
-	struct vl_vlc vlc = {0};
-	vl_vlc_init(&vlc, data, size);
-	if(!skip_startcode(&vlc))
+	uint8_t *data;
+	unsigned size;
+	unsigned pos; // byte offset into data
+	unsigned bit; // bits consumed of data[pos]
+	unsigned zeros; // number of consecutive zero bytes before pos
+	bool overflow;
+} NalCursor;
+
+static void nal_cursor_init(NalCursor *cursor, uint8_t *data, unsigned size)
+{
+	cursor->data = data;
+	cursor->size = size;
+	cursor->pos = 0;
+	cursor->bit = 0;
+	cursor->zeros = 0;
+	cursor->overflow = false;
+}
+
+static bool nal_cursor_enter_byte(NalCursor *cursor)
+{
+	if(cursor->bit == 0 && cursor->zeros >= 2 && cursor->pos < cursor->size && cursor->data[cursor->pos] == 3)
 	{
-		CHIAKI_LOGW(bitstream->log, "slice_set_reference_frame_h265: No startcode found");
+		// emulation_prevention_three_byte
+		cursor->pos++;
+		cursor->zeros = 0;
+	}
+	if(cursor->pos >= cursor->size)
+	{
+		cursor->overflow = true;
 		return false;
 	}
+	return true;
+}
 
-	vl_vlc_eatbits(&vlc, 1); // forbidden_zero_bit
-	unsigned nal_unit_type = vl_vlc_get_uimsbf(&vlc, 6);
-	vl_vlc_eatbits(&vlc, 6); // nuh_layer_id
-	vl_vlc_eatbits(&vlc, 3); // nuh_temporal_id_plus1
+static void nal_cursor_advance(NalCursor *cursor)
+{
+	if(++cursor->bit < 8)
+		return;
+	cursor->zeros = cursor->data[cursor->pos] == 0 ? cursor->zeros + 1 : 0;
+	cursor->bit = 0;
+	cursor->pos++;
+}
 
-	if(nal_unit_type != 1)
+static unsigned nal_cursor_u(NalCursor *cursor, unsigned bits)
+{
+	unsigned r = 0;
+	for(unsigned i=0; i<bits; i++)
+	{
+		if(!nal_cursor_enter_byte(cursor))
+			return 0;
+		r = (r << 1) | ((cursor->data[cursor->pos] >> (7 - cursor->bit)) & 1);
+		nal_cursor_advance(cursor);
+	}
+	return r;
+}
+
+static unsigned nal_cursor_ue(NalCursor *cursor, unsigned *len)
+{
+	unsigned leading_zeros = 0;
+	while(!nal_cursor_u(cursor, 1))
 	{
-		CHIAKI_LOGW(bitstream->log, "slice_set_reference_frame_h265: Unexpected NAL unit type %u", nal_unit_type);
+		if(cursor->overflow || ++leading_zeros > 31)
+		{
+			cursor->overflow = true;
+			return 0;
+		}
+	}
+	if(len)
+		*len = leading_zeros * 2 + 1;
+	return (1u << leading_zeros) - 1 + nal_cursor_u(cursor, leading_zeros);
+}
+
+static bool start_code_emulated(const uint8_t *data, unsigned i, unsigned size)
+{
+	return i + 2 < size && data[i] == 0 && data[i+1] == 0 && data[i+2] <= 3;
+}
+
+/**
+ * Write value with the given number of bits at the position of cursor.
+ * The write is reverted if it would introduce a new start code or emulation prevention pattern.
+ */
+static bool nal_cursor_write(NalCursor *cursor, unsigned value, unsigned bits)
+{
+	NalCursor c = *cursor;
+	if(!nal_cursor_enter_byte(&c))
 		return false;
+	unsigned first = c.pos >= 2 ? c.pos - 2 : 0;
+	uint8_t backup[8];
+	unsigned backup_size = cursor->size - first < sizeof(backup) ? cursor->size - first : sizeof(backup);
+	memcpy(backup, cursor->data + first, backup_size);
+
+	c = *cursor;
+	for(unsigned i=0; i<bits; i++)
+	{
+		if(!nal_cursor_enter_byte(&c) || c.pos - first + 3 > backup_size)
+			goto revert;
+		uint8_t mask = 1 << (7 - c.bit);
+		if((value >> (bits - 1 - i)) & 1)
+			c.data[c.pos] |= mask;
+		else
+			c.data[c.pos] &= ~mask;
+		nal_cursor_advance(&c);
 	}
 
-	struct vl_rbsp rbsp;
-	vl_rbsp_init(&rbsp, &vlc, ~0);
-	unsigned first_slice_segment_in_pic_flag = vl_rbsp_u(&rbsp, 1);
+	for(unsigned i=0; i+2<backup_size; i++)
+	{
+		if(start_code_emulated(cursor->data + first, i, backup_size) && !start_code_emulated(backup, i, backup_size))
+			goto revert;
+	}
+	*cursor = c;
+	return true;
+revert:
+	memcpy(cursor->data + first, backup, backup_size);
+	return false;
+}
 
-	vl_rbsp_ue(&rbsp); // slice_pic_parameter_set_id
-	if(!first_slice_segment_in_pic_flag)
-		vl_rbsp_ue(&rbsp); // slice_segment_address
+static bool nal_set_reference_frame_h264(ChiakiBitstream *bitstream, NalCursor *cursor, unsigned reference_frame)
+{
+	nal_cursor_u(cursor, 1); // forbidden_zero_bit
+	nal_cursor_u(cursor, 2); // nal_ref_idc
+	unsigned nal_unit_type = nal_cursor_u(cursor, 5);
+	if(nal_unit_type != 1)
+		return false;
 
-	if(vl_rbsp_ue(&rbsp) != 1)
+	nal_cursor_ue(cursor, NULL); // first_mb_in_slice
+	unsigned slice_type = nal_cursor_ue(cursor, NULL);
+	if(slice_type != 0 && slice_type != 5)
+		return false;
+	nal_cursor_ue(cursor, NULL); // pic_parameter_set_id
+	nal_cursor_u(cursor, bitstream->h264.sps.log2_max_frame_num_minus4 + 4); // frame_num
+	if(bitstream->h264.sps.pic_order_cnt_type == 0)
+		nal_cursor_u(cursor, bitstream->h264.sps.log2_max_pic_order_cnt_lsb_minus4 + 4); // pic_order_cnt_lsb
+	if(nal_cursor_u(cursor, 1)) // num_ref_idx_active_override_flag
+		nal_cursor_ue(cursor, NULL); // num_ref_idx_l0_active_minus1
+	if(!nal_cursor_u(cursor, 1)) // ref_pic_list_modification_flag_l0
 	{
-		CHIAKI_LOGW(bitstream->log, "slice_set_reference_frame_h265: Not P slice");
+		CHIAKI_LOGV(bitstream->log, "slice_set_reference_frame_h264: Slice has no ref_pic_list_modification");
 		return false;
 	}
-
-	vl_rbsp_u(&rbsp, bitstream->h265.sps.log2_max_pic_order_cnt_lsb_minus4 + 4); // slice_pic_order_cnt_lsb
-	if(!vl_rbsp_u(&rbsp, 1)) // short_term_ref_pic_set_sps_flag
+	for(unsigned i=0; i<3 && !cursor->overflow; i++)
 	{
-		unsigned num_negative_pics = vl_rbsp_ue(&rbsp);
-		if(num_negative_pics > 16)
+		unsigned modification_of_pic_nums_idc = nal_cursor_ue(cursor, NULL);
+		if(modification_of_pic_nums_idc == 0)
 		{
-			CHIAKI_LOGW(bitstream->log, "slice_set_reference_frame_h265: Unexpected num_negative_pics %u", num_negative_pics);
-			return false;
-		}
-		vl_rbsp_ue(&rbsp); // num_positive_pics
-		for(unsigned i=0; i<num_negative_pics; i++)
-		{
-			vl_rbsp_ue(&rbsp); // delta_poc_s0_minus1[i]
-			uint32_t *d = (uint32_t*)rbsp.nal.data;
-			uint64_t hi = ntohl(d[-2]);
-			uint64_t lo = ntohl(d[-1]);
-			uint64_t buffer = lo | (hi << 32);
-			uint64_t mask = (uint64_t)1 << (64 - 1 - (64 - (32 - rbsp.nal.invalid_bits)));
-			if (i == reference_frame)
-				buffer |= mask; // set 1
-			else
-				buffer &= ~mask; // set 0
-			hi = htonl(buffer >> 32);
-			lo = htonl(buffer & 0xffffffff);
-			d[-2] = hi;
-			d[-1] = lo;
-			if (i == reference_frame)
+			NalCursor value_cursor = *cursor;
+			unsigned len;
+			unsigned abs_diff_pic_num_minus1 = nal_cursor_ue(cursor, &len);
+			if(cursor->overflow)
+				return false;
+			if(abs_diff_pic_num_minus1 == reference_frame)
 				return true;
-			vl_rbsp_u(&rbsp, 1); // used_by_curr_pic_s0_flag[i]
+			if(chiaki_bitstream_ue_len(reference_frame) != len)
+			{
+				CHIAKI_LOGV(bitstream->log, "slice_set_reference_frame_h264: Can't rewrite abs_diff_pic_num_minus1 %u -> %u in place",
+						abs_diff_pic_num_minus1, reference_frame);
+				return false;
+			}
+			return nal_cursor_write(&value_cursor, reference_frame + 1, len);
 		}
+		else if(modification_of_pic_nums_idc < 3)
+			nal_cursor_ue(cursor, NULL); // abs_diff_pic_num_minus1 or long_term_pic_num
+		else
+			break;
 	}
-
 	return false;
 }
 
+static bool nal_set_reference_frame_h265(ChiakiBitstream *bitstream, NalCursor *cursor, unsigned reference_frame)
+{
+	nal_cursor_u(cursor, 1); // forbidden_zero_bit
+	unsigned nal_unit_type = nal_cursor_u(cursor, 6);
+	nal_cursor_u(cursor, 6); // nuh_layer_id
+	nal_cursor_u(cursor, 3); // nuh_temporal_id_plus1
+	if(nal_unit_type != 1)
+		return false;
+
+	unsigned first_slice_segment_in_pic_flag = nal_cursor_u(cursor, 1);
+	nal_cursor_ue(cursor, NULL); // slice_pic_parameter_set_id
+	if(!first_slice_segment_in_pic_flag)
+		nal_cursor_u(cursor, bitstream->h265.sps.slice_segment_address_bits); // slice_segment_address
+	if(nal_cursor_ue(cursor, NULL) != 1) // slice_type
+		return false;
+
+	nal_cursor_u(cursor, bitstream->h265.sps.log2_max_pic_order_cnt_lsb_minus4 + 4); // slice_pic_order_cnt_lsb
+	if(nal_cursor_u(cursor, 1)) // short_term_ref_pic_set_sps_flag
+		return false;
+	unsigned num_negative_pics = nal_cursor_ue(cursor, NULL);
+	if(num_negative_pics > 16 || reference_frame >= num_negative_pics)
+		return false;
+	nal_cursor_ue(cursor, NULL); // num_positive_pics
+	for(unsigned i=0; i<num_negative_pics && !cursor->overflow; i++)
+	{
+		nal_cursor_ue(cursor, NULL); // delta_poc_s0_minus1[i]
+		// used_by_curr_pic_s0_flag[i]
+		NalCursor flag_cursor = *cursor;
+		unsigned used = nal_cursor_u(cursor, 1);
+		// all others are cleared, including the ones after it, so exactly one picture stays used
+		if(used != (i == reference_frame) && !nal_cursor_write(&flag_cursor, i == reference_frame, 1))
+			return false;
+	}
+	return !cursor->overflow;
+}
+
+static bool nal_is_p_slice(ChiakiBitstream *bitstream, uint8_t nal_header)
+{
+	if(bitstream->codec == CHIAKI_CODEC_H264)
+		return (nal_header & 0x1f) == 1;
+	else
+		return ((nal_header >> 1) & 0x3f) == 1;
+}
+
+/**
+ * Find the next NAL unit in data starting at *offset.
+ * On success, *offset points at the NAL header and *nal_size is the size up to the next start code.
+ */
+static bool next_nal(uint8_t *data, unsigned size, unsigned *offset, unsigned *nal_size)
+{
+	unsigned i = *offset;
+	while(i + 3 <= size && !(data[i] == 0 && data[i+1] == 0 && data[i+2] == 1))
+		i++;
+	if(i + 3 >= size)
+		return false;
+	unsigned start = i + 3;
+	unsigned end = start;
+	while(end + 3 <= size && !(data[end] == 0 && data[end+1] == 0 && (data[end+2] == 1 || (data[end+2] == 0 && end + 3 < size && data[end+3] == 1))))
+		end++;
+	if(end + 3 > size)
+		end = size;
+	*offset = start;
+	*nal_size = end - start;
+	return true;
+}
+
+static bool set_reference_frame(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, unsigned reference_frame, bool all_slices)
+{
+	unsigned offset = 0;
+	unsigned nal_size;
+	unsigned changed = 0;
+	while(next_nal(data, size, &offset, &nal_size))
+	{
+		if(nal_is_p_slice(bitstream, data[offset]))
+		{
+			NalCursor cursor;
+			nal_cursor_init(&cursor, data + offset, nal_size);
+			bool succ = bitstream->codec == CHIAKI_CODEC_H264
+				? nal_set_reference_frame_h264(bitstream, &cursor, reference_frame)
+				: nal_set_reference_frame_h265(bitstream, &cursor, reference_frame);
+			if(!succ)
+				return false;
+			changed++;
+			if(!all_slices)
+				break;
+		}
+		offset += nal_size;
+	}
+	return changed > 0;
+}
+
 void chiaki_bitstream_init(ChiakiBitstream *bitstream, ChiakiLog *log, ChiakiCodec codec)
 {
 	bitstream->log = log;
@@ -398,9 +700,41 @@ bool chiaki_bitstream_slice(ChiakiBitstream *bitstream, uint8_t *data, unsigned
 }
 
 bool chiaki_bitstream_slice_set_reference_frame(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, unsigned reference_frame)
+{
+	return set_reference_frame(bitstream, data, size, reference_frame, false);
+}
+
+unsigned chiaki_bitstream_ue_len(unsigned value)
+{
+	unsigned leading_zeros = 0;
+	while((value + 1) >> (leading_zeros + 1))
+		leading_zeros++;
+	return leading_zeros * 2 + 1;
+}
+
+unsigned chiaki_bitstream_max_ref_frames(ChiakiBitstream *bitstream)
 {
 	if(bitstream->codec == CHIAKI_CODEC_H264)
-		return false;
+		return bitstream->h264.sps.max_num_ref_frames;
+	else
+		return bitstream->h265.sps.max_dec_pic_buffering_minus1;
+}
+
+void chiaki_bitstream_size(ChiakiBitstream *bitstream, unsigned *width, unsigned *height)
+{
+	if(bitstream->codec == CHIAKI_CODEC_H264)
+	{
+		*width = bitstream->h264.sps.width;
+		*height = bitstream->h264.sps.height;
+	}
 	else
-		return slice_set_reference_frame_h265(bitstream, data, size, reference_frame);
+	{
+		*width = bitstream->h265.sps.width;
+		*height = bitstream->h265.sps.height;
+	}
+}
+
+bool chiaki_bitstream_frame_set_reference_frame(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, unsigned reference_frame)
+{
+	return set_reference_frame(bitstream, data, size, reference_frame, true);
 }
@@ -4,6 +4,29 @@
 
 #define CONGESTION_CONTROL_INTERVAL_MS 200
 
+static void congestion_control_send(void *user)
+{
+	ChiakiCongestionControl *control = user;
+	uint64_t received;
+	uint64_t lost;
+	chiaki_packet_stats_get(control->stats, true, &received, &lost);
+	ChiakiTakionCongestionPacket packet = { 0 };
+	uint64_t total = received + lost;
+	control->packet_loss = total > 0 ? (double)lost / total : 0;
+	if(control->packet_loss > control->packet_loss_max)
+	{
+		CHIAKI_LOGD(control->takion->log, "Clamping reported packet loss: measured=%.1f%% reported_max=%.1f%%",
+			control->packet_loss * 100.0, control->packet_loss_max * 100.0);
+		lost = total * control->packet_loss_max;
+		received = total - lost;
+	}
+	packet.received = (uint16_t)received;
+	packet.lost = (uint16_t)lost;
+	CHIAKI_LOGV(control->takion->log, "Sending Congestion Control Packet, received: %u, lost: %u",
+		(unsigned int)packet.received, (unsigned int)packet.lost);
+	chiaki_takion_send_congestion(control->takion, &packet);
+}
+
 static void *congestion_control_thread_func(void *user)
 {
 	ChiakiCongestionControl *control = user;
@@ -19,24 +42,7 @@ static void *congestion_control_thread_func(void *user)
 		if(err != CHIAKI_ERR_TIMEOUT)
 			break;
 
-		uint64_t received;
-		uint64_t lost;
-		chiaki_packet_stats_get(control->stats, true, &received, &lost);
-		ChiakiTakionCongestionPacket packet = { 0 };
-		uint64_t total = received + lost;
-		control->packet_loss = total > 0 ? (double)lost / total : 0;
-		if(control->packet_loss > control->packet_loss_max)
-		{
-			CHIAKI_LOGD(control->takion->log, "Clamping reported packet loss: measured=%.1f%% reported_max=%.1f%%",
-				control->packet_loss * 100.0, control->packet_loss_max * 100.0);
-			lost = total * control->packet_loss_max;
-			received = total - lost;
-		}
-		packet.received = (uint16_t)received;
-		packet.lost = (uint16_t)lost;
-		CHIAKI_LOGV(control->takion->log, "Sending Congestion Control Packet, received: %u, lost: %u",
-			(unsigned int)packet.received, (unsigned int)packet.lost);
-		chiaki_takion_send_congestion(control->takion, &packet);
+		congestion_control_send(control);
 	}
 
 	chiaki_bool_pred_cond_unlock(&control->stop_cond);
@@ -49,6 +55,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionCo
 	control->stats = stats;
 	control->packet_loss_max = packet_loss_max;
 	control->packet_loss = 0;
+	control->executor = takion->executor;
+
+	if(control->executor)
+	{
+		chiaki_executor_task_init(&control->task, congestion_control_send, control);
+		return chiaki_executor_schedule(control->executor, &control->task, CONGESTION_CONTROL_INTERVAL_MS, CONGESTION_CONTROL_INTERVAL_MS);
+	}
 
 	ChiakiErrorCode err = chiaki_bool_pred_cond_init(&control->stop_cond);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -68,6 +81,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionCo
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_stop(ChiakiCongestionControl *control)
 {
+	if(control->executor)
+	{
+		chiaki_executor_cancel(control->executor, &control->task);
+		control->executor = NULL;
+		return CHIAKI_ERR_SUCCESS;
+	}
+
 	ChiakiErrorCode err = chiaki_bool_pred_cond_signal(&control->stop_cond);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return err;
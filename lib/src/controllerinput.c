@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/controllerinput.h>
+
+#include <string.h>
+
+static void *controller_input_thread_func(void *user);
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_controller_input_init(ChiakiControllerInput *input)
+{
+	memset(input, 0, sizeof(*input));
+	chiaki_controller_state_set_idle(&input->state);
+	return chiaki_mutex_init(&input->mutex, false);
+}
+
+CHIAKI_EXPORT void chiaki_controller_input_fini(ChiakiControllerInput *input)
+{
+	chiaki_mutex_fini(&input->mutex);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_controller_input_start(ChiakiControllerInput *input, ChiakiControllerInputPollCb poll_cb, void *poll_cb_user)
+{
+	if(input->thread_running)
+		return CHIAKI_ERR_INVALID_DATA;
+	input->poll_cb = poll_cb;
+	input->poll_cb_user = poll_cb_user;
+	input->should_stop = false;
+
+	ChiakiErrorCode err = chiaki_thread_create(&input->thread, controller_input_thread_func, input);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	chiaki_thread_set_name(&input->thread, "Chiaki Input");
+	input->thread_running = true;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_controller_input_stop(ChiakiControllerInput *input)
+{
+	if(!input->thread_running)
+		return;
+	chiaki_mutex_lock(&input->mutex);
+	input->should_stop = true;
+	chiaki_mutex_unlock(&input->mutex);
+	chiaki_thread_join(&input->thread, NULL);
+	input->thread_running = false;
+}
+
+static bool controller_input_should_stop(ChiakiControllerInput *input)
+{
+	chiaki_mutex_lock(&input->mutex);
+	bool r = input->should_stop;
+	chiaki_mutex_unlock(&input->mutex);
+	return r;
+}
+
+static void *controller_input_thread_func(void *user)
+{
+	ChiakiControllerInput *input = user;
+	chiaki_thread_set_affinity(CHIAKI_THREAD_NAME_INPUT);
+	while(!controller_input_should_stop(input))
+		input->poll_cb(input, CHIAKI_CONTROLLER_INPUT_POLL_TIMEOUT_MS, input->poll_cb_user);
+	return NULL;
+}
+
+/**
+ * Merge all sources and push the result to the sink if it changed.
+ * Must be called with the mutex locked.
+ */
+static void controller_input_update_locked(ChiakiControllerInput *input)
+{
+	ChiakiControllerState state;
+	chiaki_controller_state_set_idle(&state);
+	for(size_t i=0; i<CHIAKI_CONTROLLER_INPUT_SOURCES_MAX; i++)
+	{
+		if(input->sources_used[i])
+			chiaki_controller_state_or(&state, &state, &input->sources[i]);
+	}
+	if(chiaki_controller_state_equals(&state, &input->state))
+		return;
+	input->state = state;
+	if(input->sink_cb)
+		input->sink_cb(&input->state, input->sink_cb_user);
+}
+
+CHIAKI_EXPORT int chiaki_controller_input_add_source(ChiakiControllerInput *input)
+{
+	chiaki_mutex_lock(&input->mutex);
+	int r = -1;
+	for(int i=0; i<CHIAKI_CONTROLLER_INPUT_SOURCES_MAX; i++)
+	{
+		if(input->sources_used[i])
+			continue;
+		input->sources_used[i] = true;
+		chiaki_controller_state_set_idle(&input->sources[i]);
+		r = i;
+		break;
+	}
+	chiaki_mutex_unlock(&input->mutex);
+	return r;
+}
+
+CHIAKI_EXPORT void chiaki_controller_input_remove_source(ChiakiControllerInput *input, int source)
+{
+	if(source < 0 || source >= CHIAKI_CONTROLLER_INPUT_SOURCES_MAX)
+		return;
+	chiaki_mutex_lock(&input->mutex);
+	input->sources_used[source] = false;
+	controller_input_update_locked(input);
+	chiaki_mutex_unlock(&input->mutex);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_controller_input_set_source(ChiakiControllerInput *input, int source, const ChiakiControllerState *state)
+{
+	if(source < 0 || source >= CHIAKI_CONTROLLER_INPUT_SOURCES_MAX)
+		return CHIAKI_ERR_INVALID_DATA;
+	ChiakiErrorCode err = chiaki_mutex_lock(&input->mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	if(!input->sources_used[source])
+	{
+		chiaki_mutex_unlock(&input->mutex);
+		return CHIAKI_ERR_INVALID_DATA;
+	}
+	input->sources[source] = *state;
+	controller_input_update_locked(input);
+	chiaki_mutex_unlock(&input->mutex);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_controller_input_get(ChiakiControllerInput *input, ChiakiControllerState *state)
+{
+	chiaki_mutex_lock(&input->mutex);
+	*state = input->state;
+	chiaki_mutex_unlock(&input->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_controller_input_set_sink(ChiakiControllerInput *input, ChiakiControllerInputSinkCb cb, void *user)
+{
+	chiaki_mutex_lock(&input->mutex);
+	input->sink_cb = cb;
+	input->sink_cb_user = user;
+	if(cb)
+		cb(&input->state, user);
+	chiaki_mutex_unlock(&input->mutex);
+}
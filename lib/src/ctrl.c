@@ -514,49 +514,50 @@ static void *ctrl_thread_func(void *user)
 		CHIAKI_SSIZET_TYPE received = 0;
 		if(ctrl->session->rudp)
 		{
-			RudpMessage message;
+			ChiakiRudpDatagram datagram;
 			uint16_t remote_counter = 0;
 			uint16_t ack_counter = 0;
-			err = chiaki_rudp_recv_only(ctrl->session->rudp, sizeof(ctrl->rudp_recv_buf) - ctrl->recv_buf_size, &message);
+			err = chiaki_rudp_recv_only(ctrl->session->rudp, sizeof(ctrl->rudp_recv_buf) - ctrl->recv_buf_size, &datagram);
 			if(err != CHIAKI_ERR_SUCCESS)
 			{
 				CHIAKI_LOGE(ctrl->session->log, "Failed to receive Rudp ctrl packet");
 				ctrl_failed(ctrl, CHIAKI_QUIT_REASON_CTRL_UNKNOWN);
 				break;
 			}
-			if(message.data_size < 4)
+			RudpMessage *message = &datagram.messages[0];
+			if(message->data_size < 4)
 			{
 				CHIAKI_LOGE(ctrl->session->log, "Rudp ctrl message response too small");
-				chiaki_rudp_print_message(ctrl->session->rudp, &message);
+				chiaki_rudp_print_message(ctrl->session->rudp, message);
 				ctrl_failed(ctrl, CHIAKI_QUIT_REASON_CTRL_UNKNOWN);
 				break;
 			}
-			remote_counter = message.remote_counter;
+			remote_counter = message->remote_counter;
 			while(true)
 			{
-				switch(message.subtype) // wrong but works ...
+				switch(message->subtype) // wrong but works ...
 				{
 					case 0x12:
 					case 0x26:
 					case 0x36:
-						ack_counter = ntohs(*((chiaki_unaligned_uint16_t *)(message.data + 2)));
+						ack_counter = ntohs(*((chiaki_unaligned_uint16_t *)(message->data + 2)));
 						chiaki_rudp_ack_packet(ctrl->session->rudp, ack_counter);
 					case 0x02:
 						chiaki_rudp_send_ack_message(ctrl->session->rudp, remote_counter);
-						int offset = rudp_packet_type_data_offset(message.subtype);
+						int offset = rudp_packet_type_data_offset(message->subtype);
 						// ctrl message header is 8 bytes
-						if((message.data_size - offset) < 8)
+						if((message->data_size - offset) < 8)
 							break;
 						// check if message is ctrl message by making sure the payload size (size of message - 8 byte header is correct)
-						uint32_t ctrl_payload_size = ntohl(*(uint32_t*)(message.data + offset));
-						if((message.data_size - offset - 8) == ctrl_payload_size)
+						uint32_t ctrl_payload_size = ntohl(*(uint32_t*)(message->data + offset));
+						if((message->data_size - offset - 8) == ctrl_payload_size)
 						{
-							memcpy(ctrl->recv_buf + ctrl->recv_buf_size, message.data + offset, message.data_size - offset);
-							ctrl->recv_buf_size += message.data_size - offset;
+							memcpy(ctrl->recv_buf + ctrl->recv_buf_size, message->data + offset, message->data_size - offset);
+							ctrl->recv_buf_size += message->data_size - offset;
 						}
 						break;
 					case 0x24:
-						ack_counter = ntohs(*((chiaki_unaligned_uint16_t *)(message.data + 2)));
+						ack_counter = ntohs(*((chiaki_unaligned_uint16_t *)(message->data + 2)));
 						chiaki_rudp_ack_packet(ctrl->session->rudp, ack_counter);
 						break;
 					case 0xC0:
@@ -564,38 +565,25 @@ static void *ctrl_thread_func(void *user)
 						ctrl_failed(ctrl, CHIAKI_QUIT_REASON_CTRL_UNKNOWN);
 						break;
 					default:
-						CHIAKI_LOGI(ctrl->session->log, "Received message of unknown type: 0x%04x", message.type);
+						CHIAKI_LOGI(ctrl->session->log, "Received message of unknown type: 0x%04x", message->type);
 						chiaki_rudp_ack_packet(ctrl->session->rudp, ack_counter);
 						chiaki_rudp_send_ack_message(ctrl->session->rudp, remote_counter);
 						// we already checked before if data size was at least 4
 						int offset2 = 4;
 						// ctrl message header is 8 bytes
-						if((message.data_size - offset2) < 8)
+						if((message->data_size - offset2) < 8)
 							break;
-						uint32_t ctrl_payload_size2 = ntohl(*(uint32_t*)(message.data + offset2));
-						if((message.data_size - offset2 - 8) == ctrl_payload_size2)
+						uint32_t ctrl_payload_size2 = ntohl(*(uint32_t*)(message->data + offset2));
+						if((message->data_size - offset2 - 8) == ctrl_payload_size2)
 						{
-							memcpy(ctrl->recv_buf + ctrl->recv_buf_size, message.data + offset2, message.data_size - offset2);
-							ctrl->recv_buf_size += message.data_size - offset2;
+							memcpy(ctrl->recv_buf + ctrl->recv_buf_size, message->data + offset2, message->data_size - offset2);
+							ctrl->recv_buf_size += message->data_size - offset2;
 						}
 						break;
 				}
-				if(message.subMessage)
-				{
-					if(message.data)
-					{
-						free(message.data);
-						message.data = NULL;
-					}
-					RudpMessage *tmp = message.subMessage;
-					memcpy(&message, message.subMessage, sizeof(RudpMessage));
-					free(tmp);
-				}
-				else
-				{
-					chiaki_rudp_message_pointers_free(&message);
+				if(!message->subMessage)
 					break;
-				}
+				message = message->subMessage;
 			}
 		}
 		else
@@ -1165,25 +1153,24 @@ static ChiakiErrorCode ctrl_connect(ChiakiCtrl *ctrl)
 	if(session->rudp)
 	{
 		CHIAKI_LOGI(session->log, "CTRL - Starting RUDP session");
-		RudpMessage message;
-		ChiakiErrorCode err = chiaki_rudp_send_recv(session->rudp, &message, NULL, 0, 0, INIT_REQUEST, INIT_RESPONSE, 8, 3);
+		ChiakiRudpDatagram datagram;
+		RudpMessage *message;
+		ChiakiErrorCode err = chiaki_rudp_send_recv(session->rudp, &datagram, &message, NULL, 0, 0, INIT_REQUEST, INIT_RESPONSE, 8, 3);
 		if(err != CHIAKI_ERR_SUCCESS)
 		{
 			CHIAKI_LOGE(session->log, "CTRL - Failed to init rudp");
 			goto error;
 		}
-		size_t init_response_size = message.data_size - 8;
+		size_t init_response_size = message->data_size - 8;
 		uint8_t init_response[init_response_size];
-		memcpy(init_response, message.data + 8, init_response_size);
-		chiaki_rudp_message_pointers_free(&message);
-		err = chiaki_rudp_send_recv(session->rudp, &message, init_response, init_response_size, 0, COOKIE_REQUEST, COOKIE_RESPONSE, 2, 3);
+		memcpy(init_response, message->data + 8, init_response_size);
+		err = chiaki_rudp_send_recv(session->rudp, &datagram, &message, init_response, init_response_size, 0, COOKIE_REQUEST, COOKIE_RESPONSE, 2, 3);
 		if(err != CHIAKI_ERR_SUCCESS)
 		{
 			CHIAKI_LOGE(session->log, "CTRL - Failed to pass rudp cookie");
 			goto error;
 		}
-		remote_counter = message.remote_counter;
-		chiaki_rudp_message_pointers_free(&message);
+		remote_counter = message->remote_counter;
 	}
 	else
 	{
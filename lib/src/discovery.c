@@ -5,6 +5,7 @@
 #include <chiaki/discovery.h>
 #include <chiaki/http.h>
 #include <chiaki/log.h>
+#include <chiaki/time.h>
 
 #include <string.h>
 #include <stdio.h>
@@ -498,3 +499,142 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_wakeup(ChiakiLog *log, ChiakiDisc
 
 	return err;
 }
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_regist_key_credential(const char *regist_key, size_t regist_key_size, uint64_t *credential)
+{
+	size_t len = strnlen(regist_key, regist_key_size);
+	if(!len || len > 8)
+		return CHIAKI_ERR_INVALID_DATA;
+	uint64_t r = 0;
+	for(size_t i=0; i<len; i++)
+	{
+		char c = regist_key[i];
+		uint8_t v;
+		if(c >= '0' && c <= '9')
+			v = c - '0';
+		else if(c >= 'a' && c <= 'f')
+			v = c - 'a' + 0xa;
+		else if(c >= 'A' && c <= 'F')
+			v = c - 'A' + 0xa;
+		else
+			return CHIAKI_ERR_INVALID_DATA;
+		r = (r << 4) | v;
+	}
+	*credential = r;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_discovery_wake_options_default(ChiakiDiscoveryWakeOptions *options, uint64_t user_credential, bool ps5)
+{
+	memset(options, 0, sizeof(*options));
+	options->user_credential = user_credential;
+	options->ps5 = ps5;
+	options->probe_initial_ms = 50;
+	options->probe_max_ms = 1000;
+	options->wakeup_resend_ms = 5000;
+	options->timeout_ms = 35000;
+}
+
+static bool sockaddr_same_host(const struct sockaddr *a, const struct sockaddr *b)
+{
+	if(a->sa_family != b->sa_family)
+		return false;
+	if(a->sa_family == AF_INET)
+		return ((const struct sockaddr_in *)a)->sin_addr.s_addr == ((const struct sockaddr_in *)b)->sin_addr.s_addr;
+	if(a->sa_family == AF_INET6)
+		return !memcmp(&((const struct sockaddr_in6 *)a)->sin6_addr, &((const struct sockaddr_in6 *)b)->sin6_addr, sizeof(struct in6_addr));
+	return false;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_wake_wait_ready(ChiakiDiscovery *discovery, ChiakiStopPipe *stop_pipe,
+		const struct sockaddr *addr, socklen_t addr_len, const ChiakiDiscoveryWakeOptions *options)
+{
+	struct sockaddr_storage console_addr;
+	if(addr_len > sizeof(console_addr))
+		return CHIAKI_ERR_INVALID_DATA;
+	memcpy(&console_addr, addr, addr_len);
+	uint16_t port = options->port ? options->port : (options->ps5 ? CHIAKI_DISCOVERY_PORT_PS5 : CHIAKI_DISCOVERY_PORT_PS4);
+	if(console_addr.ss_family == AF_INET)
+		((struct sockaddr_in *)&console_addr)->sin_port = htons(port);
+	else if(console_addr.ss_family == AF_INET6)
+		((struct sockaddr_in6 *)&console_addr)->sin6_port = htons(port);
+	else
+		return CHIAKI_ERR_INVALID_DATA;
+
+	const char *protocol_version = options->ps5 ? CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS5 : CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS4;
+	ChiakiDiscoveryPacket wakeup_packet = { 0 };
+	wakeup_packet.cmd = CHIAKI_DISCOVERY_CMD_WAKEUP;
+	wakeup_packet.protocol_version = (char *)protocol_version;
+	wakeup_packet.user_credential = options->user_credential;
+	ChiakiDiscoveryPacket srch_packet = { 0 };
+	srch_packet.cmd = CHIAKI_DISCOVERY_CMD_SRCH;
+	srch_packet.protocol_version = (char *)protocol_version;
+
+	uint64_t start_ms = chiaki_time_now_monotonic_ms();
+	uint64_t wakeup_ms = start_ms;
+	ChiakiErrorCode err = chiaki_discovery_send(discovery, &wakeup_packet, (struct sockaddr *)&console_addr, addr_len);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(discovery->log, "Discovery failed to send wakeup: %s", chiaki_error_string(err));
+		return err;
+	}
+	CHIAKI_LOGI(discovery->log, "Discovery sent wakeup, probing until the console is ready");
+
+	uint64_t probe_interval_ms = options->probe_initial_ms ? options->probe_initial_ms : 1;
+	uint64_t next_probe_ms = start_ms;
+	size_t probes = 0;
+	while(true)
+	{
+		uint64_t now_ms = chiaki_time_now_monotonic_ms();
+		if(now_ms - start_ms >= options->timeout_ms)
+		{
+			CHIAKI_LOGE(discovery->log, "Discovery gave up waiting for the console to become ready after %zu probes", probes);
+			return CHIAKI_ERR_TIMEOUT;
+		}
+		if(options->wakeup_resend_ms && now_ms - wakeup_ms >= options->wakeup_resend_ms)
+		{
+			wakeup_ms = now_ms;
+			chiaki_discovery_send(discovery, &wakeup_packet, (struct sockaddr *)&console_addr, addr_len);
+		}
+		if(now_ms >= next_probe_ms)
+		{
+			chiaki_discovery_send(discovery, &srch_packet, (struct sockaddr *)&console_addr, addr_len);
+			probes++;
+			next_probe_ms = now_ms + probe_interval_ms;
+			probe_interval_ms *= 2;
+			if(options->probe_max_ms && probe_interval_ms > options->probe_max_ms)
+				probe_interval_ms = options->probe_max_ms;
+		}
+
+		uint64_t wait_ms = next_probe_ms - now_ms;
+		if(wait_ms > options->timeout_ms - (now_ms - start_ms))
+			wait_ms = options->timeout_ms - (now_ms - start_ms);
+		err = chiaki_stop_pipe_select_single(stop_pipe, discovery->socket, false, wait_ms);
+		if(err == CHIAKI_ERR_TIMEOUT)
+			continue;
+		if(err != CHIAKI_ERR_SUCCESS)
+			return err;
+
+		char buf[512];
+		struct sockaddr_storage client_addr;
+		socklen_t client_addr_size = sizeof(client_addr);
+		CHIAKI_SSIZET_TYPE n = recvfrom(discovery->socket, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&client_addr, &client_addr_size);
+		if(n <= 0)
+			continue;
+		buf[n] = '\00';
+		if(!sockaddr_same_host((struct sockaddr *)&client_addr, (struct sockaddr *)&console_addr))
+			continue;
+
+		char addr_buf[64];
+		ChiakiDiscoveryHost response;
+		err = chiaki_discovery_srch_response_parse(&response, (struct sockaddr *)&client_addr, addr_buf, sizeof(addr_buf), buf, n);
+		if(err != CHIAKI_ERR_SUCCESS)
+			continue;
+		if(response.state == CHIAKI_DISCOVERY_HOST_STATE_READY)
+		{
+			CHIAKI_LOGI(discovery->log, "Console is ready after %llu ms and %zu probes",
+					(unsigned long long)(chiaki_time_now_monotonic_ms() - start_ms), probes);
+			return CHIAKI_ERR_SUCCESS;
+		}
+	}
+}
@@ -1,23 +1,39 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
+#if defined(__linux__)
+#define _GNU_SOURCE // sendmmsg()
+#endif
+
+#include "utils.h"
+
 #include <chiaki/discoveryservice.h>
+#include <chiaki/time.h>
 
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <errno.h>
 
 #ifdef _WIN32
 #include <ws2tcpip.h>
 #else
 #include <netinet/in.h>
 #include <netdb.h>
-#include <netinet/in.h>
+#include <sys/socket.h>
 #endif
 
+#define DISCOVERY_SERVICE_SEND_BATCH 32
+
 static void *discovery_service_thread_func(void *user);
+static void *discovery_service_resolve_thread_func(void *user);
+static ChiakiErrorCode discovery_service_resolve_start(ChiakiDiscoveryService *service);
+static void discovery_service_resolve_finished(ChiakiDiscoveryService *service);
+static void discovery_service_ping_targets_update(ChiakiDiscoveryService *service);
 static void discovery_service_ping(ChiakiDiscoveryService *service);
 static void discovery_service_drop_old_hosts(ChiakiDiscoveryService *service);
-static void discovery_service_host_received(ChiakiDiscoveryHost *host, void *user);
+static bool discovery_service_receive(ChiakiDiscoveryService *service);
+static bool discovery_service_host_received(ChiakiDiscoveryService *service, ChiakiDiscoveryHost *host);
+static void discovery_service_host_table_rebuild(ChiakiDiscoveryService *service);
 static void discovery_service_report_state(ChiakiDiscoveryService *service);
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_init(ChiakiDiscoveryService *service, ChiakiDiscoveryServiceOptions *options, ChiakiLog *log)
@@ -25,6 +41,11 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_init(ChiakiDiscoveryServi
 	service->log = log;
 	service->options = *options;
 	service->ping_index = 0;
+	service->stopping = false;
+	service->resolve_thread_joinable = false;
+	service->resolve_state = CHIAKI_DISCOVERY_SERVICE_RESOLVE_NONE;
+	service->ping_targets = NULL;
+	service->ping_targets_count = 0;
 
 	service->hosts = calloc(service->options.hosts_max, sizeof(ChiakiDiscoveryHost));
 	if(!service->hosts)
@@ -40,19 +61,42 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_init(ChiakiDiscoveryServi
 
 	service->hosts_count = 0;
 
+	// keep the table at most half full so probe sequences stay short
+	service->host_table_size = 4;
+	while(service->host_table_size < service->options.hosts_max * 2)
+		service->host_table_size *= 2;
+	service->host_table = malloc(service->host_table_size * sizeof(size_t));
+	if(!service->host_table)
+	{
+		err = CHIAKI_ERR_MEMORY;
+		goto error_host_discovery_infos;
+	}
+	discovery_service_host_table_rebuild(service);
+
 	err = chiaki_mutex_init(&service->state_mutex, false);
 	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_host_discovery_infos;
+		goto error_host_table;
 
-	service->options.send_addr = malloc(service->options.send_addr_size);
+	service->options.send_addr = malloc(sizeof(struct sockaddr_storage));
 	if(!service->options.send_addr)
 	{
 		err = CHIAKI_ERR_MEMORY;
 		goto error_state_mutex;
 	}
+	memset(service->options.send_addr, 0, sizeof(struct sockaddr_storage));
 	memcpy(service->options.send_addr, options->send_addr, service->options.send_addr_size);
 
 	service->options.broadcast_addrs = NULL;
+	if(service->options.send_host)
+	{
+		service->options.send_host = strdup(service->options.send_host);
+		if(!service->options.send_host)
+		{
+			err = CHIAKI_ERR_MEMORY;
+			goto error_send_addr;
+		}
+	}
+
 	service->options.broadcast_num = options->broadcast_num;
 	if(options->broadcast_num > 0)
 	{
@@ -60,46 +104,78 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_init(ChiakiDiscoveryServi
 		if(!service->options.broadcast_addrs)
 		{
 			err = CHIAKI_ERR_MEMORY;
-			goto error_state_mutex;
+			goto error_send_addr;
 		}
 		memcpy(service->options.broadcast_addrs, options->broadcast_addrs, service->options.broadcast_num * sizeof(struct sockaddr_storage));
 	}
 
-	if(service->options.send_host)
+	// send_addr plus the extra broadcast addrs, each for PS4 and PS5
+	service->ping_targets = calloc((1 + service->options.broadcast_num) * 2, sizeof(ChiakiDiscoveryServicePingTarget));
+	if(!service->ping_targets)
 	{
-		service->options.send_host = strdup(service->options.send_host);
-		if(!service->options.send_host)
+		err = CHIAKI_ERR_MEMORY;
+		goto error_send_addr;
+	}
+
+	ChiakiDiscoveryPacket packet = { 0 };
+	packet.cmd = CHIAKI_DISCOVERY_CMD_SRCH;
+	for(size_t i=0; i<2; i++)
+	{
+		packet.protocol_version = i ? CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS5 : CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS4;
+		int len = chiaki_discovery_packet_fmt(service->ping_packets[i], sizeof(service->ping_packets[i]), &packet);
+		if(len < 0 || (size_t)len >= sizeof(service->ping_packets[i]))
 		{
-			err = CHIAKI_ERR_MEMORY;
+			err = CHIAKI_ERR_BUF_TOO_SMALL;
 			goto error_send_addr;
 		}
+		service->ping_packets_size[i] = (size_t)len + 1;
 	}
 
 	err = chiaki_discovery_init(&service->discovery, log, ((struct sockaddr *)service->options.send_addr)->sa_family);
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_send_addr;
 
-	err = chiaki_bool_pred_cond_init(&service->stop_cond);
+	// responses are drained until the socket would block
+	err = chiaki_socket_set_nonblock(service->discovery.socket, true);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_discovery;
+
+	err = chiaki_stop_pipe_init(&service->stop_pipe);
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_discovery;
 
+	discovery_service_ping_targets_update(service);
+
+	if(service->options.send_host)
+	{
+		err = discovery_service_resolve_start(service);
+		if(err != CHIAKI_ERR_SUCCESS)
+			goto error_stop_pipe;
+	}
+
 	err = chiaki_thread_create(&service->thread, discovery_service_thread_func, service);
 	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_stop_cond;
+		goto error_resolve_thread;
 
 	chiaki_thread_set_name(&service->thread, "Chiaki Discovery Service");
 
 	return CHIAKI_ERR_SUCCESS;
-error_stop_cond:
-	chiaki_bool_pred_cond_fini(&service->stop_cond);
+error_resolve_thread:
+	if(service->resolve_thread_joinable)
+		chiaki_thread_join(&service->resolve_thread, NULL);
+error_stop_pipe:
+	chiaki_stop_pipe_fini(&service->stop_pipe);
 error_discovery:
 	chiaki_discovery_fini(&service->discovery);
 error_send_addr:
+	free(service->ping_targets);
 	free(service->options.broadcast_addrs);
 	free(service->options.send_addr);
 	free(service->options.send_host);
 error_state_mutex:
 	chiaki_mutex_fini(&service->state_mutex);
+error_host_table:
+	free(service->host_table);
 error_host_discovery_infos:
 	free(service->host_discovery_infos);
 error_hosts:
@@ -109,11 +185,19 @@ error_hosts:
 
 CHIAKI_EXPORT void chiaki_discovery_service_fini(ChiakiDiscoveryService *service)
 {
-	chiaki_bool_pred_cond_signal(&service->stop_cond);
+	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+	service->stopping = true;
+	chiaki_mutex_unlock(&service->state_mutex);
+	chiaki_stop_pipe_stop(&service->stop_pipe);
 	chiaki_thread_join(&service->thread, NULL);
-	chiaki_bool_pred_cond_fini(&service->stop_cond);
+	// a pending lookup can not be canceled, getaddrinfo() has to give up on its own
+	if(service->resolve_thread_joinable)
+		chiaki_thread_join(&service->resolve_thread, NULL);
+	chiaki_stop_pipe_fini(&service->stop_pipe);
 	chiaki_discovery_fini(&service->discovery);
 	chiaki_mutex_fini(&service->state_mutex);
+	free(service->ping_targets);
 	free(service->options.send_addr);
 	free(service->options.send_host);
 	if(service->options.broadcast_addrs)
@@ -127,6 +211,7 @@ CHIAKI_EXPORT void chiaki_discovery_service_fini(ChiakiDiscoveryService *service
 #undef FREE_STRING
 	}
 
+	free(service->host_table);
 	free(service->host_discovery_infos);
 	free(service->hosts);
 }
@@ -136,131 +221,297 @@ static void *discovery_service_thread_func(void *user)
 	ChiakiDiscoveryService *service = user;
 	chiaki_thread_set_affinity(CHIAKI_THREAD_NAME_DISCOVERY_SVC);
 
-	ChiakiErrorCode err = chiaki_bool_pred_cond_lock(&service->stop_cond);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return NULL;
-
-	ChiakiDiscoveryThread discovery_thread;
-	err = chiaki_discovery_thread_start(&discovery_thread, &service->discovery, discovery_service_host_received, service);
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto beach;
+	uint64_t next_ping_ms = chiaki_time_now_monotonic_ms() + service->options.ping_initial_ms;
+	while(true)
+	{
+		uint64_t now_ms = chiaki_time_now_monotonic_ms();
+		if(now_ms >= next_ping_ms)
+		{
+			discovery_service_ping(service);
+			next_ping_ms = now_ms + service->options.ping_ms;
+		}
 
-	err = chiaki_bool_pred_cond_timedwait(&service->stop_cond, service->options.ping_initial_ms);
+		ChiakiErrorCode err = chiaki_stop_pipe_select_single(&service->stop_pipe, service->discovery.socket, false, next_ping_ms - now_ms);
+		if(err == CHIAKI_ERR_TIMEOUT)
+			continue;
+		if(err == CHIAKI_ERR_CANCELED)
+		{
+			err = chiaki_mutex_lock(&service->state_mutex);
+			assert(err == CHIAKI_ERR_SUCCESS);
+			bool stopping = service->stopping;
+			chiaki_mutex_unlock(&service->state_mutex);
+			if(stopping)
+				break;
+
+			// woken up by the resolve thread
+			chiaki_stop_pipe_reset(&service->stop_pipe);
+			discovery_service_resolve_finished(service);
+			continue;
+		}
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(service->log, "Discovery Service failed to select");
+			break;
+		}
 
-	while(err == CHIAKI_ERR_TIMEOUT)
-	{
-		discovery_service_ping(service);
-		err = chiaki_bool_pred_cond_timedwait(&service->stop_cond, service->options.ping_ms);
+		if(!discovery_service_receive(service))
+			break;
 	}
 
-	chiaki_discovery_thread_stop(&discovery_thread);
-
-beach:
-	chiaki_bool_pred_cond_unlock(&service->stop_cond);
 	return NULL;
 }
 
-static void discovery_service_ping(ChiakiDiscoveryService *service)
+static void *discovery_service_resolve_thread_func(void *user)
 {
-	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
-	assert(err == CHIAKI_ERR_SUCCESS);
-
-	service->ping_index++;
-	discovery_service_drop_old_hosts(service);
-
-	chiaki_mutex_unlock(&service->state_mutex);
+	ChiakiDiscoveryService *service = user;
 
-	if(service->options.send_host)
+	// send_host and the family of send_addr are not touched by the service thread while this is running
+	struct addrinfo *host_addrinfos;
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_family = ((struct sockaddr *)service->options.send_addr)->sa_family;
+	int r = getaddrinfo(service->options.send_host, NULL, &hints, &host_addrinfos);
+
+	struct sockaddr_storage addr;
+	bool ok = false;
+	if(r != 0)
+		CHIAKI_LOGE(service->log, "getaddrinfo failed");
+	else
 	{
-		struct addrinfo *host_addrinfos;
-		struct addrinfo hints;
-		memset(&hints, 0, sizeof(hints));
-		hints.ai_socktype = SOCK_DGRAM;
-		hints.ai_family = ((struct sockaddr *)service->options.send_addr)->sa_family;
-		int r = getaddrinfo(service->options.send_host, NULL, &hints, &host_addrinfos);
-		if(r != 0)
-		{
-			CHIAKI_LOGE(service->log, "getaddrinfo failed");
-			return;
-		}
-
-		bool ok = false;
 		for(struct addrinfo *ai=host_addrinfos; ai; ai=ai->ai_next)
 		{
 			if(ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
 				continue;
+			if(ai->ai_addrlen > sizeof(addr))
+				continue;
 			ok = true;
-			memcpy(service->options.send_addr, ai->ai_addr, ai->ai_addrlen);
+			memset(&addr, 0, sizeof(addr));
+			memcpy(&addr, ai->ai_addr, ai->ai_addrlen);
 		}
 		freeaddrinfo(host_addrinfos);
-
 		if(!ok)
-		{
 			CHIAKI_LOGE(service->log, "Failed to get addr for hostname");
-			return;
-		}
+	}
 
-		free(service->options.send_host);
-		service->options.send_host = NULL;
+	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+	if(ok)
+	{
+		service->resolved_addr = addr;
+		service->resolve_state = CHIAKI_DISCOVERY_SERVICE_RESOLVE_DONE;
 	}
+	else
+		service->resolve_state = CHIAKI_DISCOVERY_SERVICE_RESOLVE_FAILED;
+	chiaki_mutex_unlock(&service->state_mutex);
 
-	// CHIAKI_LOGV(service->log, "Discovery Service sending ping");
-	ChiakiDiscoveryPacket packet = { 0 };
-	bool send_extra_broadcast = false;
-	packet.cmd = CHIAKI_DISCOVERY_CMD_SRCH;
-	packet.protocol_version = CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS4;
-	if(((struct sockaddr *)service->options.send_addr)->sa_family == AF_INET)
+	if(ok)
+		chiaki_stop_pipe_stop(&service->stop_pipe);
+	return NULL;
+}
+
+static ChiakiErrorCode discovery_service_resolve_start(ChiakiDiscoveryService *service)
+{
+	// service->state_mutex must not be locked
+	if(service->resolve_thread_joinable)
 	{
-		((struct sockaddr_in *)service->options.send_addr)->sin_port = htons(CHIAKI_DISCOVERY_PORT_PS4);
-		if(((struct sockaddr_in *)service->options.send_addr)->sin_addr.s_addr == 0xffffffff)
-			send_extra_broadcast = true;
+		chiaki_thread_join(&service->resolve_thread, NULL);
+		service->resolve_thread_joinable = false;
 	}
-	else if(((struct sockaddr *)service->options.send_addr)->sa_family == AF_INET6)
-		((struct sockaddr_in6 *)service->options.send_addr)->sin6_port = htons(CHIAKI_DISCOVERY_PORT_PS4);
+
+	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+	service->resolve_state = CHIAKI_DISCOVERY_SERVICE_RESOLVE_RUNNING;
+	chiaki_mutex_unlock(&service->state_mutex);
+
+	err = chiaki_thread_create(&service->resolve_thread, discovery_service_resolve_thread_func, service);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(service->log, "Discovery Service failed to start resolve thread");
+		chiaki_mutex_lock(&service->state_mutex);
+		service->resolve_state = CHIAKI_DISCOVERY_SERVICE_RESOLVE_FAILED;
+		chiaki_mutex_unlock(&service->state_mutex);
+		return err;
+	}
+	chiaki_thread_set_name(&service->resolve_thread, "Chiaki Discovery Resolve");
+	service->resolve_thread_joinable = true;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static void discovery_service_resolve_finished(ChiakiDiscoveryService *service)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+	bool done = service->resolve_state == CHIAKI_DISCOVERY_SERVICE_RESOLVE_DONE;
+	chiaki_mutex_unlock(&service->state_mutex);
+	if(!done || !service->options.send_host)
+		return;
+
+	chiaki_thread_join(&service->resolve_thread, NULL);
+	service->resolve_thread_joinable = false;
+	memcpy(service->options.send_addr, &service->resolved_addr, sizeof(struct sockaddr_storage));
+	free(service->options.send_host);
+	service->options.send_host = NULL;
+	discovery_service_ping_targets_update(service);
+
+	// don't let the host wait for the next regular ping
+	discovery_service_ping(service);
+}
+
+static void ping_target_set(ChiakiDiscoveryServicePingTarget *target, const struct sockaddr_storage *addr, size_t addr_size, uint16_t port, size_t packet)
+{
+	memcpy(&target->addr, addr, sizeof(target->addr));
+	target->addr_size = (socklen_t)addr_size;
+	target->packet = packet;
+	if(target->addr.ss_family == AF_INET)
+		((struct sockaddr_in *)&target->addr)->sin_port = htons(port);
 	else
+		((struct sockaddr_in6 *)&target->addr)->sin6_port = htons(port);
+}
+
+static void discovery_service_ping_targets_update(ChiakiDiscoveryService *service)
+{
+	service->ping_targets_count = 0;
+	if(service->options.send_host)
+		return;
+
+	struct sockaddr_storage *send_addr = service->options.send_addr;
+	if(send_addr->ss_family != AF_INET && send_addr->ss_family != AF_INET6)
 	{
 		CHIAKI_LOGE(service->log, "Discovery Service send_addr has unknown sa_family");
 		return;
 	}
-	err = chiaki_discovery_send(&service->discovery, &packet, (struct sockaddr *)service->options.send_addr, service->options.send_addr_size);
-	if(err != CHIAKI_ERR_SUCCESS)
-		CHIAKI_LOGE(service->log, "Discovery Service failed to send ping for PS4");
-	if(send_extra_broadcast)
+	if(send_addr->ss_family != ((struct sockaddr *)&service->discovery.local_addr)->sa_family)
 	{
-		for(int i = 0; i < service->options.broadcast_num; i++)
+		CHIAKI_LOGE(service->log, "Discovery Service send_addr does not match the family of the discovery socket");
+		return;
+	}
+
+	bool send_extra_broadcast = send_addr->ss_family == AF_INET
+		&& ((struct sockaddr_in *)send_addr)->sin_addr.s_addr == 0xffffffff;
+
+	uint16_t ports[2] = {
+		service->options.ps4_port ? service->options.ps4_port : CHIAKI_DISCOVERY_PORT_PS4,
+		service->options.ps5_port ? service->options.ps5_port : CHIAKI_DISCOVERY_PORT_PS5
+	};
+	for(size_t packet=0; packet<2; packet++)
+	{
+		ping_target_set(&service->ping_targets[service->ping_targets_count++], send_addr, service->options.send_addr_size, ports[packet], packet);
+		if(!send_extra_broadcast)
+			continue;
+		for(size_t i=0; i<service->options.broadcast_num; i++)
 		{
-			((struct sockaddr_in *)(&service->options.broadcast_addrs[i]))->sin_port = htons(CHIAKI_DISCOVERY_PORT_PS4);
-			err = chiaki_discovery_send(&service->discovery, &packet, (struct sockaddr *)&service->options.broadcast_addrs[i], service->options.send_addr_size);
-			if(err != CHIAKI_ERR_SUCCESS)
-				CHIAKI_LOGE(service->log, "Discovery Service failed to send extra broadcast ping for PS4");
-			else
-			{
-				char addr_string[INET_ADDRSTRLEN];
-				if (!inet_ntop(((struct sockaddr_in *)(&service->options.broadcast_addrs[i]))->sin_family, &(((struct sockaddr_in *)(&service->options.broadcast_addrs[i]))->sin_addr), addr_string, sizeof(addr_string)))
-					CHIAKI_LOGE(service->log, "Discovery Service error with inet_ntop");
-				// else
-				// 	CHIAKI_LOGV(service->log, "Discovery Service pinged %s", addr_string);
-			}
+			if(service->options.broadcast_addrs[i].ss_family != AF_INET)
+				continue;
+			ping_target_set(&service->ping_targets[service->ping_targets_count++], &service->options.broadcast_addrs[i], service->options.send_addr_size, ports[packet], packet);
 		}
 	}
-	packet.protocol_version = CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS5;
-	if(((struct sockaddr *)service->options.send_addr)->sa_family == AF_INET)
-		((struct sockaddr_in *)service->options.send_addr)->sin_port = htons(CHIAKI_DISCOVERY_PORT_PS5);
-	else if(((struct sockaddr *)service->options.send_addr)->sa_family == AF_INET6)
-		((struct sockaddr_in6 *)service->options.send_addr)->sin6_port = htons(CHIAKI_DISCOVERY_PORT_PS5);
-	err = chiaki_discovery_send(&service->discovery, &packet, (struct sockaddr *)service->options.send_addr, service->options.send_addr_size);
-	if(err != CHIAKI_ERR_SUCCESS)
-		CHIAKI_LOGE(service->log, "Discovery Service failed to send ping for PS5");
-	if(send_extra_broadcast)
+}
+
+static void discovery_service_ping(ChiakiDiscoveryService *service)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+
+	service->ping_index++;
+	discovery_service_drop_old_hosts(service);
+	bool resolve_failed = service->resolve_state == CHIAKI_DISCOVERY_SERVICE_RESOLVE_FAILED;
+
+	chiaki_mutex_unlock(&service->state_mutex);
+
+	if(service->options.send_host)
+	{
+		// nothing to ping until the host is resolved, retry failed lookups on every ping
+		if(resolve_failed)
+			discovery_service_resolve_start(service);
+		return;
+	}
+
+	// CHIAKI_LOGV(service->log, "Discovery Service sending ping");
+#if defined(__linux__)
+	struct mmsghdr msgs[DISCOVERY_SERVICE_SEND_BATCH];
+	struct iovec iovs[2];
+	for(size_t i=0; i<2; i++)
+	{
+		iovs[i].iov_base = service->ping_packets[i];
+		iovs[i].iov_len = service->ping_packets_size[i];
+	}
+	for(size_t start=0; start<service->ping_targets_count;)
 	{
-		for(int i = 0; i < service->options.broadcast_num; i++)
+		size_t count = service->ping_targets_count - start;
+		if(count > DISCOVERY_SERVICE_SEND_BATCH)
+			count = DISCOVERY_SERVICE_SEND_BATCH;
+		memset(msgs, 0, sizeof(struct mmsghdr) * count);
+		for(size_t i=0; i<count; i++)
+		{
+			ChiakiDiscoveryServicePingTarget *target = &service->ping_targets[start + i];
+			msgs[i].msg_hdr.msg_name = &target->addr;
+			msgs[i].msg_hdr.msg_namelen = target->addr_size;
+			msgs[i].msg_hdr.msg_iov = &iovs[target->packet];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int r = sendmmsg(service->discovery.socket, msgs, (unsigned int)count, 0);
+		if(r < 0 && errno == EINTR)
+			continue;
+		if(r <= 0)
 		{
-			((struct sockaddr_in *)(&service->options.broadcast_addrs[i]))->sin_port = htons(CHIAKI_DISCOVERY_PORT_PS5);
-			err = chiaki_discovery_send(&service->discovery, &packet, (struct sockaddr *)&service->options.broadcast_addrs[i], service->options.send_addr_size);
-			if(err != CHIAKI_ERR_SUCCESS)
-				CHIAKI_LOGE(service->log, "Discovery Service failed to send extra broadcast ping for PS5");
+			// sendmmsg() only reports an error for the first message, skip the one that failed
+			ChiakiDiscoveryServicePingTarget *target = &service->ping_targets[start];
+			if(target->addr.ss_family == AF_INET)
+				CHIAKI_LOGE(service->log, "Discovery Service failed to send ping for %s: %s",
+						target->packet ? "PS5" : "PS4", strerror(errno));
+			start++;
+			continue;
 		}
+		start += (size_t)r;
 	}
+#else
+	for(size_t i=0; i<service->ping_targets_count; i++)
+	{
+		ChiakiDiscoveryServicePingTarget *target = &service->ping_targets[i];
+		int r = sendto_broadcast(service->log, service->discovery.socket,
+				service->ping_packets[target->packet], service->ping_packets_size[target->packet], 0,
+				(struct sockaddr *)&target->addr, target->addr_size);
+		if(r < 0 && target->addr.ss_family == AF_INET)
+			CHIAKI_LOGE(service->log, "Discovery Service failed to send ping for %s", target->packet ? "PS5" : "PS4");
+	}
+#endif
+}
+
+static uint64_t host_id_hash(const char *host_id)
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(const char *c=host_id; *c; c++)
+	{
+		hash ^= (uint8_t)*c;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/**
+ * @return the index into service->host_table where host_id is or would be inserted
+ */
+static size_t discovery_service_host_table_find(ChiakiDiscoveryService *service, const char *host_id)
+{
+	size_t mask = service->host_table_size - 1;
+	size_t slot = (size_t)host_id_hash(host_id) & mask;
+	while(true)
+	{
+		size_t index = service->host_table[slot];
+		if(index == SIZE_MAX || strcmp(service->hosts[index].host_id, host_id) == 0)
+			return slot;
+		slot = (slot + 1) & mask;
+	}
+}
+
+static void discovery_service_host_table_rebuild(ChiakiDiscoveryService *service)
+{
+	for(size_t i=0; i<service->host_table_size; i++)
+		service->host_table[i] = SIZE_MAX;
+	for(size_t i=0; i<service->hosts_count; i++)
+		service->host_table[discovery_service_host_table_find(service, service->hosts[i].host_id)] = i;
 }
 
 static void discovery_service_drop_old_hosts(ChiakiDiscoveryService *service)
@@ -269,80 +520,133 @@ static void discovery_service_drop_old_hosts(ChiakiDiscoveryService *service)
 
 	bool change = false;
 
-	for(size_t i=0; i<service->hosts_count; i++)
+	for(size_t i=0; i<service->hosts_count;)
 	{
 		if(service->host_discovery_infos[i].last_ping_index + service->options.host_drop_pings >= service->ping_index)
+		{
+			i++;
 			continue;
+		}
 
 		ChiakiDiscoveryHost *host = &service->hosts[i];
 		CHIAKI_LOGI(service->log, "Discovery Service: Host with id %s is no longer available", host->host_id ? host->host_id : "");
 
+		if(service->options.host_cb)
+			service->options.host_cb(CHIAKI_DISCOVERY_SERVICE_HOST_REMOVED, host, service->options.cb_user);
+
 #define FREE_STRING(name) do { free((char *)host->name); } while(0)
 		CHIAKI_DISCOVERY_HOST_STRING_FOREACH(FREE_STRING)
 #undef FREE_STRING
 
-		if(i < service->hosts_count - 1)
+		// order does not matter, fill the gap with the last host
+		service->hosts_count--;
+		if(i < service->hosts_count)
 		{
-			memmove(service->host_discovery_infos + i,
-					service->host_discovery_infos + i + 1,
-					sizeof(ChiakiDiscoveryServiceHostDiscoveryInfo) * (service->hosts_count - i - 1));
-
-			memmove(service->hosts + i,
-					service->hosts + i + 1,
-					sizeof(ChiakiDiscoveryHost) * (service->hosts_count - i - 1));
+			service->hosts[i] = service->hosts[service->hosts_count];
+			service->host_discovery_infos[i] = service->host_discovery_infos[service->hosts_count];
 		}
-
 		change = true;
-		if(i > 0)
-			i--;
-		service->hosts_count--;
 	}
 
 	if(change)
+	{
+		discovery_service_host_table_rebuild(service);
 		discovery_service_report_state(service);
+	}
 }
 
-static void discovery_service_host_received(ChiakiDiscoveryHost *host, void *user)
+/**
+ * Read all pending responses and report the changes they made at once.
+ * @return false if the socket failed
+ */
+static bool discovery_service_receive(ChiakiDiscoveryService *service)
 {
-	ChiakiDiscoveryService *service = user;
-
 	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
 
-	if(!host->host_id)
-	{
-		CHIAKI_LOGE(service->log, "Discovery Service received host without id");
-		chiaki_mutex_unlock(&service->state_mutex);
-		return;
-	}
-	// CHIAKI_LOGV(service->log, "Discovery Service Received host with id %s", host->host_id);
-
+	bool ok = true;
 	bool change = false;
-
-	size_t index = SIZE_MAX;
-	for(size_t i=0; i<service->hosts_count; i++)
+	while(true)
 	{
-		if(!service->hosts[i].host_id)
+		char buf[512];
+		struct sockaddr_storage client_addr;
+		socklen_t client_addr_size = sizeof(client_addr);
+		CHIAKI_SSIZET_TYPE n = recvfrom(service->discovery.socket, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&client_addr, &client_addr_size);
+		if(n < 0)
+		{
+#ifdef _WIN32
+			int errsv = WSAGetLastError();
+			if(errsv == WSAEWOULDBLOCK)
+				break;
+			// an ICMP port unreachable from one of the pings
+			if(errsv == WSAECONNRESET)
+				continue;
+#else
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if(errno == EINTR || errno == ECONNREFUSED)
+				continue;
+#endif
+			CHIAKI_LOGE(service->log, "Discovery Service failed to read from socket");
+			ok = false;
+			break;
+		}
+
+		if(n == 0)
 			continue;
 
-		if(strcmp(service->hosts[i].host_id, host->host_id) == 0)
+		buf[n] = '\00';
+
+		char addr_buf[64];
+		ChiakiDiscoveryHost response;
+		err = chiaki_discovery_srch_response_parse(&response, (struct sockaddr *)&client_addr, addr_buf, sizeof(addr_buf), buf, n);
+		if(err != CHIAKI_ERR_SUCCESS)
 		{
-			index = i;
-			break;
+			CHIAKI_LOGI(service->log, "Discovery Response invalid");
+			continue;
 		}
+
+		if(discovery_service_host_received(service, &response))
+			change = true;
 	}
 
+	if(change)
+		discovery_service_report_state(service);
+
+	chiaki_mutex_unlock(&service->state_mutex);
+	return ok;
+}
+
+/**
+ * @return whether anything changed
+ */
+static bool discovery_service_host_received(ChiakiDiscoveryService *service, ChiakiDiscoveryHost *host)
+{
+	// service->state_mutex must be locked
+
+	if(!host->host_id)
+	{
+		CHIAKI_LOGE(service->log, "Discovery Service received host without id");
+		return false;
+	}
+	// CHIAKI_LOGV(service->log, "Discovery Service Received host with id %s", host->host_id);
+
+	bool added = false;
+	bool change = false;
+
+	size_t slot = discovery_service_host_table_find(service, host->host_id);
+	size_t index = service->host_table[slot];
 	if(index == SIZE_MAX)
 	{
 		if(service->hosts_count == service->options.hosts_max)
 		{
 			CHIAKI_LOGE(service->log, "Discovery Service received new host, but no space available");
-			goto rzcon;
+			return false;
 		}
 
 		CHIAKI_LOGI(service->log, "Discovery Service detected new host with id %s", host->host_id);
 
-		change = true;
+		added = true;
 		index = service->hosts_count++;
 		memset(&service->hosts[index], 0, sizeof(ChiakiDiscoveryHost));
 	}
@@ -375,11 +679,25 @@ static void discovery_service_host_received(ChiakiDiscoveryHost *host, void *use
 
 #undef UPDATE_STRING
 
-	if(change)
-		discovery_service_report_state(service);
+#define FREE_STRING(name) do { free((char *)host_slot->name); } while(0)
+	if(added)
+	{
+		if(!host_slot->host_id)
+		{
+			// strdup failed, forget about the host instead of keeping one without an id
+			CHIAKI_DISCOVERY_HOST_STRING_FOREACH(FREE_STRING)
+			service->hosts_count--;
+			return false;
+		}
+		service->host_table[slot] = index;
+	}
+#undef FREE_STRING
 
-rzcon:
-	chiaki_mutex_unlock(&service->state_mutex);
+	if((added || change) && service->options.host_cb)
+		service->options.host_cb(added ? CHIAKI_DISCOVERY_SERVICE_HOST_ADDED : CHIAKI_DISCOVERY_SERVICE_HOST_CHANGED,
+				host_slot, service->options.cb_user);
+
+	return added || change;
 }
 
 static void discovery_service_report_state(ChiakiDiscoveryService *service)
@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/dpb.h>
+
+#define SLOT(frame_index) ((frame_index) % CHIAKI_DPB_SIZE)
+
+CHIAKI_EXPORT void chiaki_dpb_init(ChiakiDpb *dpb, ChiakiCodec codec)
+{
+	dpb->codec = codec;
+	dpb->max_ref_frames = CHIAKI_DPB_SIZE;
+	dpb->h264_reference_bits = 0;
+	chiaki_dpb_reset(dpb);
+}
+
+CHIAKI_EXPORT void chiaki_dpb_reset(ChiakiDpb *dpb)
+{
+	dpb->valid = 0;
+	for(size_t i=0; i<CHIAKI_DPB_SIZE; i++)
+		dpb->frames[i] = 0;
+}
+
+CHIAKI_EXPORT void chiaki_dpb_set_max_ref_frames(ChiakiDpb *dpb, unsigned max_ref_frames)
+{
+	if(max_ref_frames == 0 || max_ref_frames > CHIAKI_DPB_SIZE)
+		max_ref_frames = CHIAKI_DPB_SIZE;
+	dpb->max_ref_frames = max_ref_frames;
+}
+
+static bool in_window(ChiakiDpb *dpb, ChiakiSeqNum16 frame_index, ChiakiSeqNum16 ref_frame_index)
+{
+	ChiakiSeqNum16 distance = frame_index - ref_frame_index;
+	return distance > 0 && distance <= dpb->max_ref_frames;
+}
+
+static void apply_rps(ChiakiDpb *dpb, ChiakiSeqNum16 frame_index, const ChiakiBitstreamSlice *slice)
+{
+	uint32_t keep = 0;
+	for(unsigned i=0; i<slice->ref_pics_count; i++)
+	{
+		ChiakiSeqNum16 ref_frame_index = frame_index - slice->ref_pics[i];
+		if(chiaki_dpb_has(dpb, ref_frame_index))
+			keep |= 1u << SLOT(ref_frame_index);
+	}
+	dpb->valid &= keep;
+}
+
+CHIAKI_EXPORT void chiaki_dpb_add(ChiakiDpb *dpb, ChiakiSeqNum16 frame_index, const ChiakiBitstreamSlice *slice)
+{
+	if(slice && slice->slice_type == CHIAKI_BITSTREAM_SLICE_I)
+		chiaki_dpb_reset(dpb);
+	else if(slice && dpb->codec != CHIAKI_CODEC_H264 && slice->ref_pics_count)
+		apply_rps(dpb, frame_index, slice);
+	else if(slice && dpb->codec == CHIAKI_CODEC_H264 && slice->slice_type == CHIAKI_BITSTREAM_SLICE_P)
+		dpb->h264_reference_bits = slice->reference_frame_bits;
+
+	dpb->frames[SLOT(frame_index)] = frame_index;
+	dpb->valid |= 1u << SLOT(frame_index);
+}
+
+CHIAKI_EXPORT bool chiaki_dpb_has(ChiakiDpb *dpb, ChiakiSeqNum16 frame_index)
+{
+	return (dpb->valid & (1u << SLOT(frame_index))) && dpb->frames[SLOT(frame_index)] == frame_index;
+}
+
+CHIAKI_EXPORT ChiakiSeqNum16 chiaki_dpb_reference_frame_index(ChiakiDpb *dpb, ChiakiSeqNum16 frame_index,
+		const ChiakiBitstreamSlice *slice, unsigned reference_frame)
+{
+	if(dpb->codec != CHIAKI_CODEC_H264 && reference_frame < slice->ref_pics_count)
+		return frame_index - slice->ref_pics[reference_frame];
+	return frame_index - reference_frame - 1;
+}
+
+CHIAKI_EXPORT size_t chiaki_dpb_reference_candidates(ChiakiDpb *dpb, ChiakiSeqNum16 frame_index,
+		const ChiakiBitstreamSlice *slice, unsigned *candidates, size_t candidates_max)
+{
+	size_t count = 0;
+	if(dpb->codec != CHIAKI_CODEC_H264)
+	{
+		// only pictures in the RPS are still held by the encoder (and the decoder)
+		for(unsigned i=0; i<slice->ref_pics_count && count<candidates_max; i++)
+		{
+			if(chiaki_dpb_has(dpb, frame_index - slice->ref_pics[i]))
+				candidates[count++] = i;
+		}
+		return count;
+	}
+
+	for(unsigned i=0; i<dpb->max_ref_frames && count<candidates_max; i++)
+	{
+		if(chiaki_dpb_has(dpb, frame_index - i - 1))
+			candidates[count++] = i;
+	}
+	return count;
+}
+
+CHIAKI_EXPORT bool chiaki_dpb_can_recover(ChiakiDpb *dpb, ChiakiSeqNum16 frame_index)
+{
+	// H264 slices without ref_pic_list_modification can't be retargeted at all
+	if(dpb->codec == CHIAKI_CODEC_H264 && !dpb->h264_reference_bits)
+		return false;
+
+	ChiakiSeqNum16 next_frame_index = frame_index + 1;
+	for(size_t i=0; i<CHIAKI_DPB_SIZE; i++)
+	{
+		if(!(dpb->valid & (1u << i)) || !in_window(dpb, next_frame_index, dpb->frames[i]))
+			continue;
+		// abs_diff_pic_num_minus1 is only rewritten in place, so it must keep its code length
+		if(dpb->codec == CHIAKI_CODEC_H264
+			&& chiaki_bitstream_ue_len((ChiakiSeqNum16)(next_frame_index - dpb->frames[i] - 1)) != dpb->h264_reference_bits)
+			continue;
+		return true;
+	}
+	return false;
+}
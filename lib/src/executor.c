@@ -0,0 +1,260 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/executor.h>
+#include <chiaki/time.h>
+
+#include <stdlib.h>
+#include <assert.h>
+
+static void *executor_thread_func(void *user);
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_executor_init(ChiakiExecutor *executor, ChiakiLog *log, size_t threads_count)
+{
+	executor->log = log;
+	executor->threads_count = 0;
+	executor->heap = NULL;
+	executor->heap_count = 0;
+	executor->heap_size = 0;
+	executor->should_stop = false;
+
+	if(!threads_count)
+		threads_count = CHIAKI_EXECUTOR_THREADS_DEFAULT;
+
+	executor->threads = calloc(threads_count, sizeof(ChiakiThread));
+	if(!executor->threads)
+		return CHIAKI_ERR_MEMORY;
+
+	ChiakiErrorCode err = chiaki_mutex_init(&executor->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_threads;
+
+	err = chiaki_cond_init(&executor->cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+
+	err = chiaki_cond_init(&executor->idle_cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_cond;
+
+	for(; executor->threads_count<threads_count; executor->threads_count++)
+	{
+		err = chiaki_thread_create(&executor->threads[executor->threads_count], executor_thread_func, executor);
+		if(err != CHIAKI_ERR_SUCCESS)
+			goto error_run;
+		chiaki_thread_set_name(&executor->threads[executor->threads_count], "Chiaki Executor");
+	}
+
+	return CHIAKI_ERR_SUCCESS;
+error_run:
+	chiaki_executor_fini(executor);
+	return err;
+error_cond:
+	chiaki_cond_fini(&executor->cond);
+error_mutex:
+	chiaki_mutex_fini(&executor->mutex);
+error_threads:
+	free(executor->threads);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_executor_fini(ChiakiExecutor *executor)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&executor->mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+	if(executor->heap_count)
+		CHIAKI_LOGW(executor->log, "Executor stopped with %zu tasks still scheduled", executor->heap_count);
+	executor->should_stop = true;
+	chiaki_cond_broadcast(&executor->cond);
+	chiaki_mutex_unlock(&executor->mutex);
+
+	for(size_t i=0; i<executor->threads_count; i++)
+		chiaki_thread_join(&executor->threads[i], NULL);
+
+	chiaki_cond_fini(&executor->idle_cond);
+	chiaki_cond_fini(&executor->cond);
+	chiaki_mutex_fini(&executor->mutex);
+	free(executor->heap);
+	free(executor->threads);
+}
+
+CHIAKI_EXPORT void chiaki_executor_task_init(ChiakiExecutorTask *task, ChiakiExecutorTaskCb cb, void *user)
+{
+	task->cb = cb;
+	task->user = user;
+	task->due_ms = 0;
+	task->interval_ms = 0;
+	task->heap_index = SIZE_MAX;
+	task->running = false;
+	task->rescheduled = false;
+	task->runs = 0;
+}
+
+static void heap_set(ChiakiExecutor *executor, size_t index, ChiakiExecutorTask *task)
+{
+	executor->heap[index] = task;
+	task->heap_index = index;
+}
+
+static void heap_sift_up(ChiakiExecutor *executor, size_t index)
+{
+	ChiakiExecutorTask *task = executor->heap[index];
+	while(index > 0)
+	{
+		size_t parent = (index - 1) / 2;
+		if(executor->heap[parent]->due_ms <= task->due_ms)
+			break;
+		heap_set(executor, index, executor->heap[parent]);
+		index = parent;
+	}
+	heap_set(executor, index, task);
+}
+
+static void heap_sift_down(ChiakiExecutor *executor, size_t index)
+{
+	ChiakiExecutorTask *task = executor->heap[index];
+	while(true)
+	{
+		size_t child = index * 2 + 1;
+		if(child >= executor->heap_count)
+			break;
+		if(child + 1 < executor->heap_count && executor->heap[child + 1]->due_ms < executor->heap[child]->due_ms)
+			child++;
+		if(task->due_ms <= executor->heap[child]->due_ms)
+			break;
+		heap_set(executor, index, executor->heap[child]);
+		index = child;
+	}
+	heap_set(executor, index, task);
+}
+
+static ChiakiErrorCode heap_push(ChiakiExecutor *executor, ChiakiExecutorTask *task)
+{
+	if(executor->heap_count == executor->heap_size)
+	{
+		size_t size = executor->heap_size ? executor->heap_size * 2 : 16;
+		ChiakiExecutorTask **heap = realloc(executor->heap, size * sizeof(ChiakiExecutorTask *));
+		if(!heap)
+			return CHIAKI_ERR_MEMORY;
+		executor->heap = heap;
+		executor->heap_size = size;
+	}
+	heap_set(executor, executor->heap_count++, task);
+	heap_sift_up(executor, task->heap_index);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static void heap_remove(ChiakiExecutor *executor, ChiakiExecutorTask *task)
+{
+	size_t index = task->heap_index;
+	task->heap_index = SIZE_MAX;
+	executor->heap_count--;
+	if(index == executor->heap_count)
+		return;
+	ChiakiExecutorTask *moved = executor->heap[executor->heap_count];
+	heap_set(executor, index, moved);
+	heap_sift_down(executor, index);
+	heap_sift_up(executor, moved->heap_index);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_executor_schedule(ChiakiExecutor *executor, ChiakiExecutorTask *task, uint64_t delay_ms, uint64_t interval_ms)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&executor->mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	task->due_ms = chiaki_time_now_monotonic_ms() + delay_ms;
+	task->interval_ms = interval_ms;
+	if(task->running)
+	{
+		// pushed by the worker once the callback returned, so it never runs twice at once
+		task->rescheduled = true;
+	}
+	else if(task->heap_index != SIZE_MAX)
+	{
+		heap_sift_down(executor, task->heap_index);
+		heap_sift_up(executor, task->heap_index);
+	}
+	else
+		err = heap_push(executor, task);
+
+	if(err == CHIAKI_ERR_SUCCESS && task->heap_index == 0)
+		chiaki_cond_signal(&executor->cond);
+
+	chiaki_mutex_unlock(&executor->mutex);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_executor_cancel(ChiakiExecutor *executor, ChiakiExecutorTask *task)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&executor->mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+	task->interval_ms = 0;
+	task->rescheduled = false;
+	while(task->running)
+		chiaki_cond_wait(&executor->idle_cond, &executor->mutex);
+	// the callback may have scheduled itself again in the meantime
+	if(task->heap_index != SIZE_MAX)
+		heap_remove(executor, task);
+	chiaki_mutex_unlock(&executor->mutex);
+}
+
+static void *executor_thread_func(void *user)
+{
+	ChiakiExecutor *executor = user;
+	chiaki_thread_set_affinity(CHIAKI_THREAD_NAME_EXECUTOR);
+
+	ChiakiErrorCode err = chiaki_mutex_lock(&executor->mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return NULL;
+
+	while(!executor->should_stop)
+	{
+		if(!executor->heap_count)
+		{
+			chiaki_cond_wait(&executor->cond, &executor->mutex);
+			continue;
+		}
+
+		ChiakiExecutorTask *task = executor->heap[0];
+		uint64_t now_ms = chiaki_time_now_monotonic_ms();
+		if(task->due_ms > now_ms)
+		{
+			chiaki_cond_timedwait(&executor->cond, &executor->mutex, task->due_ms - now_ms);
+			continue;
+		}
+
+		heap_remove(executor, task);
+		task->running = true;
+		// another worker takes over waiting for the next task
+		if(executor->heap_count)
+			chiaki_cond_signal(&executor->cond);
+		chiaki_mutex_unlock(&executor->mutex);
+
+		task->cb(task->user);
+
+		chiaki_mutex_lock(&executor->mutex);
+		task->running = false;
+		task->runs++;
+		bool push = false;
+		if(task->rescheduled)
+		{
+			task->rescheduled = false;
+			push = true;
+		}
+		else if(task->interval_ms)
+		{
+			// keep the period, but don't try to catch up on runs that were missed
+			task->due_ms += task->interval_ms;
+			now_ms = chiaki_time_now_monotonic_ms();
+			if(task->due_ms < now_ms)
+				task->due_ms = now_ms;
+			push = true;
+		}
+		if(push && heap_push(executor, task) != CHIAKI_ERR_SUCCESS)
+			CHIAKI_LOGE(executor->log, "Executor failed to reschedule task");
+		chiaki_cond_broadcast(&executor->idle_cond);
+	}
+
+	chiaki_mutex_unlock(&executor->mutex);
+	return NULL;
+}
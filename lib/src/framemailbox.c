@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/framemailbox.h>
+
+#include <string.h>
+
+// same builtins as in audioring.c, see there
+#define LOAD_RELAXED(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define STORE_RELAXED(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+
+#define MAILBOX_FRESH 0x80000000u
+#define MAILBOX_SLOT_MASK 0x3u
+
+CHIAKI_EXPORT void chiaki_frame_mailbox_init(ChiakiFrameMailbox *mailbox)
+{
+	memset(mailbox, 0, sizeof(*mailbox));
+	mailbox->write_slot = 0;
+	mailbox->mailbox = 1;
+	mailbox->read_slot = 2;
+}
+
+CHIAKI_EXPORT void chiaki_frame_mailbox_publish(ChiakiFrameMailbox *mailbox)
+{
+	// release: the frame written to the slot is visible to whoever acquires it
+	uint32_t prev = __atomic_exchange_n(&mailbox->mailbox, mailbox->write_slot | MAILBOX_FRESH, __ATOMIC_ACQ_REL);
+	// acquire: the consumer is done reading the slot it put back into the mailbox
+	mailbox->write_slot = prev & MAILBOX_SLOT_MASK;
+	STORE_RELAXED(&mailbox->published, mailbox->published + 1);
+	if(prev & MAILBOX_FRESH)
+		STORE_RELAXED(&mailbox->dropped, mailbox->dropped + 1);
+}
+
+CHIAKI_EXPORT int chiaki_frame_mailbox_acquire(ChiakiFrameMailbox *mailbox, bool *fresh)
+{
+	if(fresh)
+		*fresh = false;
+	if(!(__atomic_load_n(&mailbox->mailbox, __ATOMIC_RELAXED) & MAILBOX_FRESH))
+		return mailbox->read_valid ? (int)mailbox->read_slot : -1;
+
+	// only the producer can change the mailbox in the meantime, and it always leaves a fresh frame in it
+	uint32_t prev = __atomic_exchange_n(&mailbox->mailbox, mailbox->read_slot, __ATOMIC_ACQ_REL);
+	mailbox->read_slot = prev & MAILBOX_SLOT_MASK;
+	mailbox->read_valid = true;
+	STORE_RELAXED(&mailbox->consumed, mailbox->consumed + 1);
+	if(fresh)
+		*fresh = true;
+	return (int)mailbox->read_slot;
+}
+
+CHIAKI_EXPORT void chiaki_frame_mailbox_get_stats(ChiakiFrameMailbox *mailbox, uint64_t *published, uint64_t *dropped, uint64_t *consumed)
+{
+	if(published)
+		*published = LOAD_RELAXED(&mailbox->published);
+	if(dropped)
+		*dropped = LOAD_RELAXED(&mailbox->dropped);
+	if(consumed)
+		*consumed = LOAD_RELAXED(&mailbox->consumed);
+}
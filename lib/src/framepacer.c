@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/framepacer.h>
+#include <chiaki/time.h>
+
+#include <string.h>
+
+#define SUBMIT_SWAP_ESTIMATE_INITIAL_US 1500
+#define INTERVAL_MAX_US 1000000 // larger gaps are pauses, not a frame or refresh interval
+
+static uint64_t default_clock(void *user)
+{
+	(void)user;
+	return chiaki_time_now_monotonic_us();
+}
+
+CHIAKI_EXPORT void chiaki_frame_pacer_init(ChiakiFramePacer *pacer, ChiakiFramePacerClockCb clock_cb, void *clock_user, unsigned int queue_depth_limit)
+{
+	memset(pacer, 0, sizeof(*pacer));
+	pacer->clock_cb = clock_cb ? clock_cb : default_clock;
+	pacer->clock_user = clock_user;
+	if(!queue_depth_limit)
+		queue_depth_limit = CHIAKI_FRAME_PACER_QUEUE_DEPTH_DEFAULT;
+	if(queue_depth_limit > CHIAKI_FRAME_PACER_QUEUE_MAX)
+		queue_depth_limit = CHIAKI_FRAME_PACER_QUEUE_MAX;
+	pacer->queue_depth_limit = queue_depth_limit;
+	pacer->catchup_vsyncs = CHIAKI_FRAME_PACER_CATCHUP_VSYNCS_DEFAULT;
+	pacer->submit_swap_estimate_us = SUBMIT_SWAP_ESTIMATE_INITIAL_US;
+}
+
+CHIAKI_EXPORT void chiaki_frame_pacer_reset(ChiakiFramePacer *pacer)
+{
+	pacer->queue_begin = 0;
+	pacer->queue_count = 0;
+	pacer->last_pts_us = 0;
+	pacer->source_interval_us = 0.0;
+	pacer->last_vsync_us = 0;
+	pacer->refresh_interval_us = 0.0;
+	pacer->backlog_vsyncs = 0;
+	pacer->presented = false;
+	chiaki_frame_pacer_throttle_reset(pacer);
+}
+
+static ChiakiFramePacerFrame *queue_at(ChiakiFramePacer *pacer, unsigned int i)
+{
+	return &pacer->queue[(pacer->queue_begin + i) % CHIAKI_FRAME_PACER_QUEUE_MAX];
+}
+
+static void queue_pop(ChiakiFramePacer *pacer, ChiakiFramePacerFrame *frame)
+{
+	if(frame)
+		*frame = *queue_at(pacer, 0);
+	pacer->queue_begin = (pacer->queue_begin + 1) % CHIAKI_FRAME_PACER_QUEUE_MAX;
+	pacer->queue_count--;
+}
+
+static void update_interval(double *interval, uint64_t prev, uint64_t now)
+{
+	if(!prev || now <= prev || now - prev > INTERVAL_MAX_US)
+		return;
+	double sample = (double)(now - prev);
+	*interval = *interval > 0.0 ? *interval + (sample - *interval) / 16.0 : sample;
+}
+
+CHIAKI_EXPORT bool chiaki_frame_pacer_push(ChiakiFramePacer *pacer, uint64_t id, uint64_t pts_us, ChiakiFramePacerFrame *dropped)
+{
+	bool drop = false;
+	if(pacer->queue_count >= pacer->queue_depth_limit)
+	{
+		queue_pop(pacer, dropped);
+		pacer->stats.frames_dropped++;
+		drop = true;
+	}
+
+	ChiakiFramePacerFrame *frame = queue_at(pacer, pacer->queue_count++);
+	frame->id = id;
+	frame->pts_us = pts_us;
+	frame->arrival_us = pacer->clock_cb(pacer->clock_user);
+
+	update_interval(&pacer->source_interval_us, pacer->last_pts_us, pts_us);
+	pacer->last_pts_us = pts_us;
+	pacer->stats.frames_arrived++;
+	return drop;
+}
+
+CHIAKI_EXPORT void chiaki_frame_pacer_vsync(ChiakiFramePacer *pacer, uint64_t vsync_us, ChiakiFramePacerDecision *decision)
+{
+	update_interval(&pacer->refresh_interval_us, pacer->last_vsync_us, vsync_us);
+	pacer->last_vsync_us = vsync_us;
+
+	memset(decision, 0, sizeof(*decision));
+	decision->action = CHIAKI_FRAME_PACER_HOLD;
+
+	unsigned int ready = 0;
+	while(ready < pacer->queue_count && queue_at(pacer, ready)->arrival_us <= vsync_us)
+		ready++;
+	if(!ready)
+	{
+		pacer->backlog_vsyncs = 0;
+		if(pacer->presented)
+			pacer->stats.vsyncs_held++;
+		return;
+	}
+
+	// A source faster than the display can never catch up, so always show the newest frame.
+	bool source_faster = pacer->source_interval_us > 0.0 && pacer->refresh_interval_us > 0.0
+		&& pacer->source_interval_us < pacer->refresh_interval_us * 0.9;
+	unsigned int backlog_allowed = source_faster ? 0 : 1;
+	unsigned int backlog = ready - 1;
+	unsigned int skip = 0;
+	if(backlog > backlog_allowed)
+		skip = backlog - backlog_allowed;
+	if(backlog > skip)
+	{
+		if(++pacer->backlog_vsyncs >= pacer->catchup_vsyncs)
+		{
+			skip++;
+			pacer->backlog_vsyncs = 0;
+		}
+	}
+	else
+		pacer->backlog_vsyncs = 0;
+
+	for(unsigned int i=0; i<skip; i++)
+		queue_pop(pacer, NULL);
+	pacer->stats.frames_dropped += skip;
+
+	decision->action = CHIAKI_FRAME_PACER_PRESENT;
+	decision->dropped = skip;
+	queue_pop(pacer, &decision->frame);
+
+	ChiakiFramePacerStats *stats = &pacer->stats;
+	stats->frames_presented++;
+	uint64_t latency = vsync_us - decision->frame.arrival_us;
+	stats->latency_sum_us += latency;
+	if(latency > stats->latency_max_us)
+		stats->latency_max_us = latency;
+	if(pacer->presented && decision->frame.pts_us > pacer->last_present_pts_us)
+	{
+		int64_t on_screen = (int64_t)(vsync_us - pacer->last_present_vsync_us);
+		int64_t pts_interval = (int64_t)(decision->frame.pts_us - pacer->last_present_pts_us);
+		uint64_t judder = (uint64_t)(on_screen > pts_interval ? on_screen - pts_interval : pts_interval - on_screen);
+		stats->judder_sum_us += judder;
+		stats->judder_count++;
+		if(judder > stats->judder_max_us)
+			stats->judder_max_us = judder;
+	}
+	pacer->presented = true;
+	pacer->last_present_vsync_us = vsync_us;
+	pacer->last_present_pts_us = decision->frame.pts_us;
+}
+
+CHIAKI_EXPORT uint64_t chiaki_frame_pacer_throttle_wakeup(ChiakiFramePacer *pacer, uint64_t interval_us, uint64_t lead_us, uint64_t *target_us)
+{
+	uint64_t now_us = pacer->clock_cb(pacer->clock_user);
+	if(interval_us != pacer->throttle_interval_us)
+	{
+		pacer->throttle_interval_us = interval_us;
+		pacer->throttle_target_us = 0;
+	}
+	if(!pacer->throttle_target_us)
+		pacer->throttle_target_us = now_us + interval_us;
+	if(pacer->throttle_target_us <= now_us && interval_us)
+		pacer->throttle_target_us += ((now_us - pacer->throttle_target_us) / interval_us + 1) * interval_us;
+	if(target_us)
+		*target_us = pacer->throttle_target_us;
+	uint64_t remaining_us = pacer->throttle_target_us > now_us ? pacer->throttle_target_us - now_us : 0;
+	return remaining_us > lead_us ? pacer->throttle_target_us - lead_us : now_us;
+}
+
+CHIAKI_EXPORT void chiaki_frame_pacer_throttle_advance(ChiakiFramePacer *pacer)
+{
+	pacer->throttle_target_us += pacer->throttle_interval_us;
+}
+
+CHIAKI_EXPORT void chiaki_frame_pacer_throttle_reset(ChiakiFramePacer *pacer)
+{
+	pacer->throttle_interval_us = 0;
+	pacer->throttle_target_us = 0;
+}
+
+CHIAKI_EXPORT void chiaki_frame_pacer_submit_swap_observed(ChiakiFramePacer *pacer, int64_t observed_us)
+{
+	if(observed_us <= 0)
+		return;
+	int64_t prev = __atomic_load_n(&pacer->submit_swap_estimate_us, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&pacer->submit_swap_estimate_us, (prev * 7 + observed_us) / 8, __ATOMIC_RELEASE);
+}
+
+CHIAKI_EXPORT int64_t chiaki_frame_pacer_submit_swap_estimate(ChiakiFramePacer *pacer)
+{
+	int64_t estimate = __atomic_load_n(&pacer->submit_swap_estimate_us, __ATOMIC_ACQUIRE);
+	return estimate > 0 ? estimate : 0;
+}
@@ -2,6 +2,7 @@
 
 #include <chiaki/gkcrypt.h>
 #include <chiaki/session.h>
+#include <chiaki/time.h>
 
 #include <string.h>
 #include <assert.h>
@@ -20,12 +21,18 @@
 #include "utils.h"
 
 #define KEY_BUF_CHUNK_SIZE 0x1000
+#define KEY_BUF_BATCH_CHUNKS_MAX 0x10 // generate up to 64KB per cipher call
+#define KEY_BUF_PREFETCH_MS 20 // how far ahead of the consumption rate to generate
+#define KEY_RATE_INTERVAL_MS 50
 
 static ChiakiErrorCode gkcrypt_gen_key_iv(ChiakiGKCrypt *gkcrypt, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret);
+static void *gkcrypt_cipher_new(ChiakiGKCrypt *gkcrypt);
+static void gkcrypt_cipher_free(void *cipher);
 
 static void *gkcrypt_thread_func(void *user);
+static void gkcrypt_key_buf_task(void *user);
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, size_t key_buf_chunks, ChiakiExecutor *executor, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
 {
 	gkcrypt->log = log;
 	gkcrypt->index = index;
@@ -35,7 +42,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, Chiaki
 	gkcrypt->key_buf_key_pos_min = 0;
 	gkcrypt->key_buf_start_offset = 0;
 	gkcrypt->last_key_pos = 0;
+	gkcrypt->key_rate_pos = 0;
+	gkcrypt->key_rate_ms = chiaki_time_now_monotonic_ms();
 	gkcrypt->key_buf_thread_stop = false;
+	gkcrypt->executor = executor;
+	gkcrypt->key_buf_task_scheduled = false;
+	gkcrypt->key_buf_cipher = NULL;
+	memset(&gkcrypt->stats, 0, sizeof(gkcrypt->stats));
 
 	ChiakiErrorCode err;
 	if(gkcrypt->key_buf_size)
@@ -72,15 +85,35 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, Chiaki
 
 	if(gkcrypt->key_buf)
 	{
-		err = chiaki_thread_create(&gkcrypt->key_buf_thread, gkcrypt_thread_func, gkcrypt);
-		if(err != CHIAKI_ERR_SUCCESS)
+		gkcrypt->key_buf_cipher = gkcrypt_cipher_new(gkcrypt);
+		if(!gkcrypt->key_buf_cipher)
+		{
+			err = CHIAKI_ERR_UNKNOWN;
 			goto error_key_buf_cond;
+		}
 
-		chiaki_thread_set_name(&gkcrypt->key_buf_thread, "Chiaki GKCrypt");
+		if(gkcrypt->executor)
+		{
+			chiaki_executor_task_init(&gkcrypt->key_buf_task, gkcrypt_key_buf_task, gkcrypt);
+			gkcrypt->key_buf_task_scheduled = true;
+			err = chiaki_executor_schedule(gkcrypt->executor, &gkcrypt->key_buf_task, 0, 0);
+			if(err != CHIAKI_ERR_SUCCESS)
+				goto error_key_buf_cipher;
+		}
+		else
+		{
+			err = chiaki_thread_create(&gkcrypt->key_buf_thread, gkcrypt_thread_func, gkcrypt);
+			if(err != CHIAKI_ERR_SUCCESS)
+				goto error_key_buf_cipher;
+
+			chiaki_thread_set_name(&gkcrypt->key_buf_thread, "Chiaki GKCrypt");
+		}
 	}
 
 	return CHIAKI_ERR_SUCCESS;
 
+error_key_buf_cipher:
+	gkcrypt_cipher_free(gkcrypt->key_buf_cipher);
 error_key_buf_cond:
 	if(gkcrypt->key_buf)
 		chiaki_cond_fini(&gkcrypt->key_buf_cond);
@@ -100,8 +133,14 @@ CHIAKI_EXPORT void chiaki_gkcrypt_fini(ChiakiGKCrypt *gkcrypt)
 		chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
 		gkcrypt->key_buf_thread_stop = true;
 		chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
-		chiaki_cond_signal(&gkcrypt->key_buf_cond);
-		chiaki_thread_join(&gkcrypt->key_buf_thread, NULL);
+		if(gkcrypt->executor)
+			chiaki_executor_cancel(gkcrypt->executor, &gkcrypt->key_buf_task);
+		else
+		{
+			chiaki_cond_signal(&gkcrypt->key_buf_cond);
+			chiaki_thread_join(&gkcrypt->key_buf_thread, NULL);
+		}
+		gkcrypt_cipher_free(gkcrypt->key_buf_cipher);
 		chiaki_cond_fini(&gkcrypt->key_buf_cond);
 		chiaki_mutex_fini(&gkcrypt->key_buf_mutex);
 		chiaki_aligned_free(gkcrypt->key_buf);
@@ -214,73 +253,148 @@ CHIAKI_EXPORT void chiaki_gkcrypt_gen_tmp_gmac_key(ChiakiGKCrypt *gkcrypt, uint6
 		memcpy(key_out, gkcrypt->key_gmac_base, sizeof(gkcrypt->key_gmac_base));
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_gen_key_stream(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, uint8_t *buf, size_t buf_size)
+static void *gkcrypt_cipher_new(ChiakiGKCrypt *gkcrypt)
 {
-	assert(key_pos % CHIAKI_GKCRYPT_BLOCK_SIZE == 0);
-	assert(buf_size % CHIAKI_GKCRYPT_BLOCK_SIZE == 0);
-
 #ifdef CHIAKI_LIB_ENABLE_MBEDTLS
-	// build mbedtls aes context
-	mbedtls_aes_context ctx;
-	mbedtls_aes_init(&ctx);
+	mbedtls_aes_context *ctx = malloc(sizeof(mbedtls_aes_context));
+	if(!ctx)
+		return NULL;
+	mbedtls_aes_init(ctx);
 
-	if(mbedtls_aes_setkey_enc(&ctx, gkcrypt->key_base, 128) != 0)
+	if(mbedtls_aes_setkey_enc(ctx, gkcrypt->key_base, 128) != 0)
 	{
-		mbedtls_aes_free(&ctx);
-		return CHIAKI_ERR_UNKNOWN;
+		mbedtls_aes_free(ctx);
+		free(ctx);
+		return NULL;
 	}
-
 #else
 	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
 	if(!ctx)
-		return CHIAKI_ERR_UNKNOWN;
+		return NULL;
 
 	if(!EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), NULL, gkcrypt->key_base, NULL))
 	{
 		EVP_CIPHER_CTX_free(ctx);
-		return CHIAKI_ERR_UNKNOWN;
+		return NULL;
 	}
 
 	if(!EVP_CIPHER_CTX_set_padding(ctx, 0))
 	{
 		EVP_CIPHER_CTX_free(ctx);
-		return CHIAKI_ERR_UNKNOWN;
+		return NULL;
 	}
 #endif
+	return ctx;
+}
+
+static void gkcrypt_cipher_free(void *cipher)
+{
+	if(!cipher)
+		return;
+#ifdef CHIAKI_LIB_ENABLE_MBEDTLS
+	mbedtls_aes_free(cipher);
+	free(cipher);
+#else
+	EVP_CIPHER_CTX_free(cipher);
+#endif
+}
+
+/**
+ * Generate the key stream with a cipher from gkcrypt_cipher_new().
+ * Larger buf_size means fewer calls into the cipher, which lets AES-NI/ARMv8-CE implementations interleave many blocks.
+ */
+static ChiakiErrorCode gkcrypt_cipher_gen_key_stream(ChiakiGKCrypt *gkcrypt, void *cipher, uint64_t key_pos, uint8_t *buf, size_t buf_size)
+{
+	assert(key_pos % CHIAKI_GKCRYPT_BLOCK_SIZE == 0);
+	assert(buf_size % CHIAKI_GKCRYPT_BLOCK_SIZE == 0);
+
 	uint64_t counter_offset = (key_pos / CHIAKI_GKCRYPT_BLOCK_SIZE);
 
 	for(uint8_t *cur = buf, *end = buf + buf_size; cur < end; cur += CHIAKI_GKCRYPT_BLOCK_SIZE)
 		counter_add(cur, gkcrypt->iv, counter_offset++);
 
 #ifdef CHIAKI_LIB_ENABLE_MBEDTLS
-	for(int i = 0; i < buf_size; i = i + 16)
+	for(size_t i = 0; i < buf_size; i += CHIAKI_GKCRYPT_BLOCK_SIZE)
 	{
 		// loop over all blocks of 16 bytes (128 bits)
-		if(mbedtls_aes_crypt_ecb(&ctx, MBEDTLS_AES_ENCRYPT, buf + i, buf + i) != 0)
-		{
-			mbedtls_aes_free(&ctx);
+		if(mbedtls_aes_crypt_ecb(cipher, MBEDTLS_AES_ENCRYPT, buf + i, buf + i) != 0)
 			return CHIAKI_ERR_UNKNOWN;
-		}
 	}
-
-	mbedtls_aes_free(&ctx);
 #else
 	int outl;
-	EVP_EncryptUpdate(ctx, buf, &outl, buf, (int)buf_size);
-	if(outl != buf_size)
-	{
-		EVP_CIPHER_CTX_free(ctx);
+	if(!EVP_EncryptUpdate(cipher, buf, &outl, buf, (int)buf_size) || outl != buf_size)
 		return CHIAKI_ERR_UNKNOWN;
-	}
-
-	EVP_CIPHER_CTX_free(ctx);
 #endif
 	return CHIAKI_ERR_SUCCESS;
 }
 
-static bool gkcrypt_key_buf_should_generate(ChiakiGKCrypt *gkcrypt)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_gen_key_stream(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, uint8_t *buf, size_t buf_size)
+{
+	void *cipher = gkcrypt_cipher_new(gkcrypt);
+	if(!cipher)
+		return CHIAKI_ERR_UNKNOWN;
+	ChiakiErrorCode err = gkcrypt_cipher_gen_key_stream(gkcrypt, cipher, key_pos, buf, buf_size);
+	gkcrypt_cipher_free(cipher);
+	return err;
+}
+
+/**
+ * How much of the key stream to keep generated beyond last_key_pos.
+ * Enough for KEY_BUF_PREFETCH_MS at the observed rate, but at least half of key_buf
+ * and never so much that packets arriving slightly out of order drop out of it.
+ */
+static uint64_t gkcrypt_key_buf_ahead_target(ChiakiGKCrypt *gkcrypt)
+{
+	uint64_t target = gkcrypt->stats.key_rate * KEY_BUF_PREFETCH_MS / 1000;
+	uint64_t target_min = gkcrypt->key_buf_size / 2;
+	uint64_t target_max = gkcrypt->key_buf_size - gkcrypt->key_buf_size / 4;
+	if(target < target_min)
+		return target_min;
+	if(target > target_max)
+		return target_max;
+	return target;
+}
+
+/**
+ * @return number of chunks the generator should produce next, 0 if key_buf is far enough ahead
+ */
+static size_t gkcrypt_key_buf_chunks_needed(ChiakiGKCrypt *gkcrypt)
 {
-	return gkcrypt->last_key_pos > gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_populated / 2;
+	uint64_t end = gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_populated;
+	if(gkcrypt->last_key_pos > end)
+		return 1; // the generator will skip ahead
+
+	uint64_t target_end = gkcrypt->last_key_pos + gkcrypt_key_buf_ahead_target(gkcrypt);
+	if(gkcrypt->key_buf_populated < gkcrypt->key_buf_size && target_end < gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_size)
+		target_end = gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_size;
+	if(target_end <= end)
+		return 0;
+
+	size_t chunks = (target_end - end + KEY_BUF_CHUNK_SIZE - 1) / KEY_BUF_CHUNK_SIZE;
+	if(chunks > KEY_BUF_BATCH_CHUNKS_MAX)
+		chunks = KEY_BUF_BATCH_CHUNKS_MAX;
+
+	// free chunks plus the ones that are completely behind the last requested key pos
+	size_t room = (gkcrypt->key_buf_size - gkcrypt->key_buf_populated) / KEY_BUF_CHUNK_SIZE;
+	if(gkcrypt->last_key_pos > gkcrypt->key_buf_key_pos_min)
+		room += (gkcrypt->last_key_pos - gkcrypt->key_buf_key_pos_min) / KEY_BUF_CHUNK_SIZE;
+	return chunks < room ? chunks : room;
+}
+
+static void gkcrypt_key_rate_update(ChiakiGKCrypt *gkcrypt)
+{
+	uint64_t now_ms = chiaki_time_now_monotonic_ms();
+	uint64_t elapsed_ms = now_ms - gkcrypt->key_rate_ms;
+	if(elapsed_ms < KEY_RATE_INTERVAL_MS)
+		return;
+	uint64_t rate = (gkcrypt->last_key_pos - gkcrypt->key_rate_pos) * 1000 / elapsed_ms;
+	// follow increases right away so the prefetch keeps up with bitrate jumps, but decay slowly
+	if(rate > gkcrypt->stats.key_rate)
+		gkcrypt->stats.key_rate = rate;
+	else
+		gkcrypt->stats.key_rate = (gkcrypt->stats.key_rate * 3 + rate) / 4;
+	gkcrypt->key_rate_ms = now_ms;
+	gkcrypt->key_rate_pos = gkcrypt->last_key_pos;
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_get_key_stream(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, uint8_t *buf, size_t buf_size)
@@ -292,7 +406,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_get_key_stream(ChiakiGKCrypt *gkcry
 
 	if(key_pos + buf_size > gkcrypt->last_key_pos)
 		gkcrypt->last_key_pos = key_pos + buf_size;
-	bool signal = gkcrypt_key_buf_should_generate(gkcrypt);
+	gkcrypt_key_rate_update(gkcrypt);
+	bool signal = gkcrypt_key_buf_chunks_needed(gkcrypt) > 0;
+	bool schedule = false;
+	if(signal && gkcrypt->executor && !gkcrypt->key_buf_task_scheduled)
+	{
+		gkcrypt->key_buf_task_scheduled = true;
+		schedule = true;
+	}
 
 	ChiakiErrorCode err;
 	if(key_pos < gkcrypt->key_buf_key_pos_min
@@ -308,7 +429,15 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_get_key_stream(ChiakiGKCrypt *gkcry
 				(unsigned long long)gkcrypt->key_buf_key_pos_min,
 				(unsigned long long)gkcrypt->last_key_pos);
 		chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
+		uint64_t start_us = chiaki_time_now_monotonic_us();
 		err = chiaki_gkcrypt_gen_key_stream(gkcrypt, key_pos, buf, buf_size);
+		uint64_t miss_us = chiaki_time_now_monotonic_us() - start_us;
+		chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
+		gkcrypt->stats.key_buf_misses++;
+		gkcrypt->stats.key_buf_miss_us_total += miss_us;
+		if(miss_us > gkcrypt->stats.key_buf_miss_us_max)
+			gkcrypt->stats.key_buf_miss_us_max = miss_us;
+		chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
 	}
 	else
 	{
@@ -323,11 +452,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_get_key_stream(ChiakiGKCrypt *gkcry
 		}
 		else
 			memcpy(buf, gkcrypt->key_buf + offset_in_buf, buf_size);
+		gkcrypt->stats.key_buf_hits++;
 		err = CHIAKI_ERR_SUCCESS;
 		chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
 	}
 
-	if(signal)
+	if(schedule)
+		chiaki_executor_schedule(gkcrypt->executor, &gkcrypt->key_buf_task, 0, 0);
+	else if(signal && !gkcrypt->executor)
 		chiaki_cond_signal(&gkcrypt->key_buf_cond);
 
 	return err;
@@ -462,38 +594,88 @@ fail:
 #endif
 }
 
+CHIAKI_EXPORT void chiaki_gkcrypt_get_stats(ChiakiGKCrypt *gkcrypt, ChiakiGKCryptStats *stats)
+{
+	if(!gkcrypt->key_buf)
+	{
+		*stats = gkcrypt->stats;
+		return;
+	}
+	chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
+	*stats = gkcrypt->stats;
+	chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
+}
+
 static bool key_buf_mutex_pred(void *user)
 {
 	ChiakiGKCrypt *gkcrypt = user;
 	if(gkcrypt->key_buf_thread_stop)
 		return true;
 
-	if(gkcrypt->key_buf_populated < gkcrypt->key_buf_size)
-		return true;
-
-	if(gkcrypt_key_buf_should_generate(gkcrypt))
-		return true;
-
-	return false;
+	return gkcrypt_key_buf_chunks_needed(gkcrypt) > 0;
 }
 
-static ChiakiErrorCode gkcrypt_generate_next_chunk(ChiakiGKCrypt *gkcrypt)
+/**
+ * Generate the next batch of chunks into key_buf.
+ * Must be called with key_buf_mutex locked, which is released while generating.
+ */
+static ChiakiErrorCode gkcrypt_key_buf_refill(ChiakiGKCrypt *gkcrypt)
 {
-	assert(gkcrypt->key_buf_populated + KEY_BUF_CHUNK_SIZE <= gkcrypt->key_buf_size);
+	/*
+	CHIAKI_LOGV(gkcrypt->log, "GKCrypt %d key buf size %#llx, start offset: %#llx, populated: %#llx, min key pos: %#llx, last key pos: %#llx, generating next chunk",
+				(int)gkcrypt->index,
+				(unsigned long long)gkcrypt->key_buf_size,
+				(unsigned long long)gkcrypt->key_buf_start_offset,
+				(unsigned long long)gkcrypt->key_buf_populated,
+				(unsigned long long)gkcrypt->key_buf_key_pos_min,
+				(unsigned long long)gkcrypt->last_key_pos);
+	*/
+
+	if(gkcrypt->last_key_pos > gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_populated)
+	{
+		// skip ahead if the last key pos is already beyond our buffer
+		uint64_t key_pos = (gkcrypt->last_key_pos / KEY_BUF_CHUNK_SIZE) * KEY_BUF_CHUNK_SIZE;
+		CHIAKI_LOGW(gkcrypt->log, "Already requested a higher key pos than in the buffer, skipping ahead from min %#llx to %#llx",
+					(unsigned long long)gkcrypt->key_buf_key_pos_min,
+					(unsigned long long)key_pos);
+		gkcrypt->key_buf_key_pos_min = key_pos;
+		gkcrypt->key_buf_start_offset = 0;
+		gkcrypt->key_buf_populated = 0;
+	}
+
+	size_t chunks = gkcrypt_key_buf_chunks_needed(gkcrypt);
+	if(!chunks)
+		return CHIAKI_ERR_SUCCESS;
+
+	size_t free_chunks = (gkcrypt->key_buf_size - gkcrypt->key_buf_populated) / KEY_BUF_CHUNK_SIZE;
+	if(chunks > free_chunks)
+	{
+		size_t drop = (chunks - free_chunks) * KEY_BUF_CHUNK_SIZE;
+		gkcrypt->key_buf_start_offset = (gkcrypt->key_buf_start_offset + drop) % gkcrypt->key_buf_size;
+		gkcrypt->key_buf_key_pos_min += drop;
+		gkcrypt->key_buf_populated -= drop;
+	}
+
 	size_t buf_offset = (gkcrypt->key_buf_start_offset + gkcrypt->key_buf_populated) % gkcrypt->key_buf_size;
+	if(buf_offset + chunks * KEY_BUF_CHUNK_SIZE > gkcrypt->key_buf_size)
+		chunks = (gkcrypt->key_buf_size - buf_offset) / KEY_BUF_CHUNK_SIZE; // the rest goes to the beginning next time
+	size_t size = chunks * KEY_BUF_CHUNK_SIZE;
 	uint64_t key_pos = gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_populated;
 	uint8_t *buf_start = gkcrypt->key_buf + buf_offset;
 
 	chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
 
-	ChiakiErrorCode err = chiaki_gkcrypt_gen_key_stream(gkcrypt, key_pos, buf_start, KEY_BUF_CHUNK_SIZE);
+	ChiakiErrorCode err = gkcrypt_cipher_gen_key_stream(gkcrypt, gkcrypt->key_buf_cipher, key_pos, buf_start, size);
 	if(err != CHIAKI_ERR_SUCCESS)
 		CHIAKI_LOGE(gkcrypt->log, "GKCrypt failed to generate key stream chunk");
 
 	chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
 
 	if(err == CHIAKI_ERR_SUCCESS)
-		gkcrypt->key_buf_populated += KEY_BUF_CHUNK_SIZE;
+	{
+		gkcrypt->key_buf_populated += size;
+		gkcrypt->stats.key_buf_generated += size;
+	}
 
 	return err;
 }
@@ -513,34 +695,7 @@ static void *gkcrypt_thread_func(void *user)
 		if(gkcrypt->key_buf_thread_stop || err != CHIAKI_ERR_SUCCESS)
 			break;
 
-		/*
-		CHIAKI_LOGV(gkcrypt->log, "GKCrypt %d key buf size %#llx, start offset: %#llx, populated: %#llx, min key pos: %#llx, last key pos: %#llx, generating next chunk",
-					(int)gkcrypt->index,
-					(unsigned long long)gkcrypt->key_buf_size,
-					(unsigned long long)gkcrypt->key_buf_start_offset,
-					(unsigned long long)gkcrypt->key_buf_populated,
-					(unsigned long long)gkcrypt->key_buf_key_pos_min,
-					(unsigned long long)gkcrypt->last_key_pos);
-		*/
-
-		if(gkcrypt->last_key_pos > gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_populated)
-		{
-			// skip ahead if the last key pos is already beyond our buffer
-			uint64_t key_pos = (gkcrypt->last_key_pos / KEY_BUF_CHUNK_SIZE) * KEY_BUF_CHUNK_SIZE;
-			CHIAKI_LOGW(gkcrypt->log, "Already requested a higher key pos than in the buffer, skipping ahead from min %#llx to %#llx",
-						(unsigned long long)gkcrypt->key_buf_key_pos_min,
-						(unsigned long long)key_pos);
-			gkcrypt->key_buf_key_pos_min = key_pos;
-			gkcrypt->key_buf_start_offset = 0;
-			gkcrypt->key_buf_populated = 0;
-		}
-		else if(gkcrypt->key_buf_populated == gkcrypt->key_buf_size)
-		{
-			gkcrypt->key_buf_start_offset = (gkcrypt->key_buf_start_offset + KEY_BUF_CHUNK_SIZE) % gkcrypt->key_buf_size;
-			gkcrypt->key_buf_key_pos_min += KEY_BUF_CHUNK_SIZE;
-			gkcrypt->key_buf_populated -= KEY_BUF_CHUNK_SIZE;
-		}
-		err = gkcrypt_generate_next_chunk(gkcrypt);
+		err = gkcrypt_key_buf_refill(gkcrypt);
 		if(err != CHIAKI_ERR_SUCCESS)
 			break;
 	}
@@ -549,6 +704,25 @@ static void *gkcrypt_thread_func(void *user)
 	return NULL;
 }
 
+static void gkcrypt_key_buf_task(void *user)
+{
+	ChiakiGKCrypt *gkcrypt = user;
+	chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
+
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	if(!gkcrypt->key_buf_thread_stop)
+		err = gkcrypt_key_buf_refill(gkcrypt);
+
+	// only one batch per run, so other sessions sharing the executor get their turn in between
+	gkcrypt->key_buf_task_scheduled = err == CHIAKI_ERR_SUCCESS
+		&& !gkcrypt->key_buf_thread_stop
+		&& gkcrypt_key_buf_chunks_needed(gkcrypt) > 0;
+	if(gkcrypt->key_buf_task_scheduled)
+		chiaki_executor_schedule(gkcrypt->executor, &gkcrypt->key_buf_task, 0, 0);
+
+	chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
+}
+
 CHIAKI_EXPORT void chiaki_key_state_init(ChiakiKeyState *state)
 {
 	state->prev = 0;
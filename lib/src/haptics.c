@@ -0,0 +1,342 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/haptics.h>
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAPTICS_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define HAPTICS_NEON
+#include <arm_neon.h>
+#endif
+
+#define ENVELOPE_BLOCK_FRAMES 0x1000 // flush the 32 bit accumulators well before they could overflow
+#define FREQ_ANALYSIS_FRAMES_MAX 0x100
+#define FREQ_SILENCE_ENERGY 1.0f // mean square below which there is nothing to analyse
+#define FREQ_PERIODIC_MIN 0.6f // normalized autocorrelation a peak needs to count as periodic
+#define FREQ_PEAK_RATIO 0.8f // take the shortest lag within this ratio of the best peak, avoids octave errors
+
+static inline int16_t gain_sample(int16_t sample, float gain)
+{
+	float v = (float)sample * gain;
+	if(v > 32767.0f)
+		v = 32767.0f;
+	else if(v < -32768.0f)
+		v = -32768.0f;
+	return (int16_t)(int32_t)v;
+}
+
+#if defined(HAPTICS_SSE2)
+static inline __m128 gain_clamp_ps(__m128 v, __m128 gain)
+{
+	v = _mm_mul_ps(v, gain);
+	v = _mm_max_ps(v, _mm_set1_ps(-32768.0f));
+	return _mm_min_ps(v, _mm_set1_ps(32767.0f));
+}
+
+static inline __m128i gain_8(__m128i x, __m128 gain)
+{
+	__m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+	__m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+	lo = gain_clamp_ps(lo, gain);
+	hi = gain_clamp_ps(hi, gain);
+	return _mm_packs_epi32(_mm_cvttps_epi32(lo), _mm_cvttps_epi32(hi));
+}
+#elif defined(HAPTICS_NEON)
+static inline int32x4_t gain_clamp_s32(int16x4_t x, float32x4_t gain)
+{
+	float32x4_t v = vmulq_f32(vcvtq_f32_s32(vmovl_s16(x)), gain);
+	v = vmaxq_f32(v, vdupq_n_f32(-32768.0f));
+	v = vminq_f32(v, vdupq_n_f32(32767.0f));
+	return vcvtq_s32_f32(v);
+}
+
+static inline int16x8_t gain_8(int16x8_t x, float32x4_t gain)
+{
+	return vcombine_s16(
+			vqmovn_s32(gain_clamp_s32(vget_low_s16(x), gain)),
+			vqmovn_s32(gain_clamp_s32(vget_high_s16(x), gain)));
+}
+#endif
+
+CHIAKI_EXPORT void chiaki_haptics_gain(int16_t *out, const int16_t *in, size_t samples, float gain)
+{
+	size_t i = 0;
+#if defined(HAPTICS_SSE2)
+	__m128 g = _mm_set1_ps(gain);
+	for(; i + 8 <= samples; i += 8)
+		_mm_storeu_si128((__m128i *)(out + i), gain_8(_mm_loadu_si128((const __m128i *)(in + i)), g));
+#elif defined(HAPTICS_NEON)
+	float32x4_t g = vdupq_n_f32(gain);
+	for(; i + 8 <= samples; i += 8)
+		vst1q_s16(out + i, gain_8(vld1q_s16(in + i), g));
+#endif
+	for(; i < samples; i++)
+		out[i] = gain_sample(in[i], gain);
+}
+
+CHIAKI_EXPORT void chiaki_haptics_split(int16_t *left, int16_t *right, const int16_t *in, size_t frames, float gain)
+{
+	size_t i = 0;
+#if defined(HAPTICS_SSE2)
+	__m128 g = _mm_set1_ps(gain);
+	for(; i + 8 <= frames; i += 8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)(in + i * 2));
+		__m128i b = _mm_loadu_si128((const __m128i *)(in + i * 2 + 8));
+		// every 32 bit lane holds one frame, left in the low half
+		__m128i la = _mm_cvttps_epi32(gain_clamp_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16)), g));
+		__m128i lb = _mm_cvttps_epi32(gain_clamp_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(b, 16), 16)), g));
+		__m128i ra = _mm_cvttps_epi32(gain_clamp_ps(_mm_cvtepi32_ps(_mm_srai_epi32(a, 16)), g));
+		__m128i rb = _mm_cvttps_epi32(gain_clamp_ps(_mm_cvtepi32_ps(_mm_srai_epi32(b, 16)), g));
+		_mm_storeu_si128((__m128i *)(left + i), _mm_packs_epi32(la, lb));
+		_mm_storeu_si128((__m128i *)(right + i), _mm_packs_epi32(ra, rb));
+	}
+#elif defined(HAPTICS_NEON)
+	float32x4_t g = vdupq_n_f32(gain);
+	for(; i + 8 <= frames; i += 8)
+	{
+		int16x8x2_t v = vld2q_s16(in + i * 2);
+		vst1q_s16(left + i, gain_8(v.val[0], g));
+		vst1q_s16(right + i, gain_8(v.val[1], g));
+	}
+#endif
+	for(; i < frames; i++)
+	{
+		left[i] = gain_sample(in[i * 2], gain);
+		right[i] = gain_sample(in[i * 2 + 1], gain);
+	}
+}
+
+CHIAKI_EXPORT void chiaki_haptics_remix_4ch(int16_t *out, const int16_t *in, size_t frames, float gain)
+{
+	size_t i = 0;
+#if defined(HAPTICS_SSE2)
+	__m128 g = _mm_set1_ps(gain);
+	__m128i zero = _mm_setzero_si128();
+	for(; i + 4 <= frames; i += 4)
+	{
+		__m128i v = gain_8(_mm_loadu_si128((const __m128i *)(in + i * 2)), g);
+		_mm_storeu_si128((__m128i *)(out + i * 4), _mm_unpacklo_epi32(zero, v));
+		_mm_storeu_si128((__m128i *)(out + i * 4 + 8), _mm_unpackhi_epi32(zero, v));
+	}
+#elif defined(HAPTICS_NEON)
+	float32x4_t g = vdupq_n_f32(gain);
+	int32x4_t zero = vdupq_n_s32(0);
+	for(; i + 4 <= frames; i += 4)
+	{
+		int32x4_t v = vreinterpretq_s32_s16(gain_8(vld1q_s16(in + i * 2), g));
+		int32x4x2_t z = vzipq_s32(zero, v);
+		vst1q_s16(out + i * 4, vreinterpretq_s16_s32(z.val[0]));
+		vst1q_s16(out + i * 4 + 8, vreinterpretq_s16_s32(z.val[1]));
+	}
+#endif
+	for(; i < frames; i++)
+	{
+		out[i * 4 + 0] = 0;
+		out[i * 4 + 1] = 0;
+		out[i * 4 + 2] = gain_sample(in[i * 2], gain);
+		out[i * 4 + 3] = gain_sample(in[i * 2 + 1], gain);
+	}
+}
+
+CHIAKI_EXPORT void chiaki_haptics_envelope(const int16_t *in, size_t frames, uint32_t *left, uint32_t *right)
+{
+	if(!frames)
+	{
+		*left = *right = 0;
+		return;
+	}
+
+	uint64_t sum_left = 0, sum_right = 0;
+	size_t i = 0;
+#if defined(HAPTICS_SSE2)
+	__m128i zero = _mm_setzero_si128();
+	while(i + 4 <= frames)
+	{
+		size_t block_end = i + ENVELOPE_BLOCK_FRAMES < frames ? i + ENVELOPE_BLOCK_FRAMES : frames;
+		__m128i acc = _mm_setzero_si128(); // lanes alternate left, right
+		for(; i + 4 <= block_end; i += 4)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i *)(in + i * 2));
+			__m128i sign = _mm_srai_epi16(x, 15);
+			__m128i a = _mm_sub_epi16(_mm_xor_si128(x, sign), sign); // |x| when read as unsigned, including -32768
+			acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(a, zero));
+			acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(a, zero));
+		}
+		uint32_t lanes[4];
+		_mm_storeu_si128((__m128i *)lanes, acc);
+		sum_left += (uint64_t)lanes[0] + lanes[2];
+		sum_right += (uint64_t)lanes[1] + lanes[3];
+	}
+#elif defined(HAPTICS_NEON)
+	int16x8_t zero = vdupq_n_s16(0);
+	while(i + 8 <= frames)
+	{
+		size_t block_end = i + ENVELOPE_BLOCK_FRAMES < frames ? i + ENVELOPE_BLOCK_FRAMES : frames;
+		uint32x4_t acc_left = vdupq_n_u32(0);
+		uint32x4_t acc_right = vdupq_n_u32(0);
+		for(; i + 8 <= block_end; i += 8)
+		{
+			int16x8x2_t v = vld2q_s16(in + i * 2);
+			// widening absolute difference to 0 does not saturate -32768 like vabsq_s16 would
+			acc_left = vreinterpretq_u32_s32(vabal_s16(vreinterpretq_s32_u32(acc_left), vget_low_s16(v.val[0]), vget_low_s16(zero)));
+			acc_left = vreinterpretq_u32_s32(vabal_s16(vreinterpretq_s32_u32(acc_left), vget_high_s16(v.val[0]), vget_high_s16(zero)));
+			acc_right = vreinterpretq_u32_s32(vabal_s16(vreinterpretq_s32_u32(acc_right), vget_low_s16(v.val[1]), vget_low_s16(zero)));
+			acc_right = vreinterpretq_u32_s32(vabal_s16(vreinterpretq_s32_u32(acc_right), vget_high_s16(v.val[1]), vget_high_s16(zero)));
+		}
+		uint32_t lanes[4];
+		vst1q_u32(lanes, acc_left);
+		sum_left += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		vst1q_u32(lanes, acc_right);
+		sum_right += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+#endif
+	for(; i < frames; i++)
+	{
+		int32_t l = in[i * 2];
+		int32_t r = in[i * 2 + 1];
+		sum_left += (uint64_t)(l < 0 ? -l : l);
+		sum_right += (uint64_t)(r < 0 ? -r : r);
+	}
+	*left = (uint32_t)(sum_left / frames);
+	*right = (uint32_t)(sum_right / frames);
+}
+
+static float dot(const float *a, const float *b, size_t n)
+{
+	size_t i = 0;
+	float sum = 0.0f;
+#if defined(HAPTICS_SSE2)
+	__m128 acc = _mm_setzero_ps();
+	for(; i + 4 <= n; i += 4)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+	float lanes[4];
+	_mm_storeu_ps(lanes, acc);
+	sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(HAPTICS_NEON)
+	float32x4_t acc = vdupq_n_f32(0.0f);
+	for(; i + 4 <= n; i += 4)
+		acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+	float32x2_t s = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+	sum = vget_lane_f32(vpadd_f32(s, s), 0);
+#endif
+	for(; i < n; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+CHIAKI_EXPORT float chiaki_haptics_dominant_freq(const int16_t *in, size_t frames, unsigned int sample_rate, float *amplitude)
+{
+	if(amplitude)
+		*amplitude = 0.0f;
+	if(frames > FREQ_ANALYSIS_FRAMES_MAX)
+		frames = FREQ_ANALYSIS_FRAMES_MAX;
+	if(frames < 4 || !sample_rate)
+		return 0.0f;
+
+	float mono[FREQ_ANALYSIS_FRAMES_MAX];
+	for(size_t i=0; i<frames; i++)
+		mono[i] = ((float)in[i * 2] + (float)in[i * 2 + 1]) * 0.5f;
+
+	float energy = dot(mono, mono, frames) / (float)frames;
+	if(amplitude)
+		*amplitude = sqrtf(2.0f * energy);
+	if(energy < FREQ_SILENCE_ENERGY)
+		return 0.0f;
+
+	// a lag needs at least half of the frames overlapping to say anything
+	size_t lag_min = (size_t)((float)sample_rate / CHIAKI_HAPTICS_FREQ_MAX);
+	size_t lag_max = (size_t)ceilf((float)sample_rate / CHIAKI_HAPTICS_FREQ_MIN);
+	if(lag_min < 2)
+		lag_min = 2;
+	if(lag_max > frames / 2)
+		lag_max = frames / 2;
+	if(lag_min > lag_max)
+		return 0.0f;
+
+	// normalized autocorrelation, one extra lag on each side for finding and interpolating peaks
+	float corr[FREQ_ANALYSIS_FRAMES_MAX / 2 + 2];
+	for(size_t lag = lag_min - 1; lag <= lag_max + 1; lag++)
+		corr[lag] = dot(mono, mono + lag, frames - lag) / ((float)(frames - lag) * energy);
+
+	// local maxima refined by a parabola through their neighbours, periods are rarely a whole number of samples
+	float peak_lag[FREQ_ANALYSIS_FRAMES_MAX / 2 + 2];
+	float peak_height[FREQ_ANALYSIS_FRAMES_MAX / 2 + 2];
+	size_t peaks_count = 0;
+	float best = 0.0f;
+	for(size_t lag = lag_min; lag <= lag_max; lag++)
+	{
+		float a = corr[lag - 1], b = corr[lag], c = corr[lag + 1];
+		if(b < a || b < c)
+			continue;
+		float denom = a - 2.0f * b + c;
+		float delta = denom < 0.0f ? 0.5f * (a - c) / denom : 0.0f;
+		if(delta > 0.5f)
+			delta = 0.5f;
+		else if(delta < -0.5f)
+			delta = -0.5f;
+		peak_lag[peaks_count] = (float)lag + delta;
+		peak_height[peaks_count] = b - 0.25f * (a - c) * delta;
+		if(peak_height[peaks_count] > best)
+			best = peak_height[peaks_count];
+		peaks_count++;
+	}
+	if(best < FREQ_PERIODIC_MIN)
+		return 0.0f;
+
+	size_t peak = 0;
+	while(peak_height[peak] < best * FREQ_PEAK_RATIO)
+		peak++;
+	return (float)sample_rate / peak_lag[peak];
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_haptics_processor_init(ChiakiHapticsProcessor *processor, unsigned int in_rate, unsigned int out_rate)
+{
+	if(!in_rate || out_rate < in_rate || out_rate % in_rate)
+		return CHIAKI_ERR_INVALID_DATA;
+	processor->upsample = out_rate / in_rate;
+	chiaki_haptics_processor_reset(processor);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_haptics_processor_reset(ChiakiHapticsProcessor *processor)
+{
+	processor->prev[0] = 0;
+	processor->prev[1] = 0;
+}
+
+CHIAKI_EXPORT size_t chiaki_haptics_processor_process(ChiakiHapticsProcessor *processor, const int16_t *in, size_t frames, float gain, int16_t *out, size_t out_frames_max)
+{
+	if(frames > CHIAKI_HAPTICS_PACKET_FRAMES_MAX)
+		frames = CHIAKI_HAPTICS_PACKET_FRAMES_MAX;
+	if(frames * processor->upsample > out_frames_max)
+		frames = out_frames_max / processor->upsample;
+
+	int16_t gained[CHIAKI_HAPTICS_PACKET_FRAMES_MAX * 2];
+	chiaki_haptics_gain(gained, in, frames * 2, gain);
+
+	// output lags one input frame behind, so every frame can be interpolated towards the next one
+	const int32_t up = (int32_t)processor->upsample;
+	int16_t *cur = out;
+	for(size_t i=0; i<frames; i++)
+	{
+		int32_t l = processor->prev[0];
+		int32_t r = processor->prev[1];
+		int32_t dl = gained[i * 2] - l;
+		int32_t dr = gained[i * 2 + 1] - r;
+		for(int32_t k=0; k<up; k++, cur += 4)
+		{
+			cur[0] = 0;
+			cur[1] = 0;
+			cur[2] = (int16_t)(l + dl * k / up);
+			cur[3] = (int16_t)(r + dr * k / up);
+		}
+		processor->prev[0] = gained[i * 2];
+		processor->prev[1] = gained[i * 2 + 1];
+	}
+	return frames * processor->upsample;
+}
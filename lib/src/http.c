@@ -228,18 +228,18 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_send_recv_http_header_psn(ChiakiRudp rudp,
 
 	*received_size = 0;
 	int received;
-	RudpMessage message;
+	ChiakiRudpDatagram datagram;
+	RudpMessage *message;
 	ChiakiErrorCode err;
-	err = chiaki_rudp_send_recv(rudp, &message, (uint8_t *)send_buf, send_buf_size, *remote_counter, SESSION_MESSAGE, CTRL_MESSAGE, 2, 3);
+	err = chiaki_rudp_send_recv(rudp, &datagram, &message, (uint8_t *)send_buf, send_buf_size, *remote_counter, SESSION_MESSAGE, CTRL_MESSAGE, 2, 3);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(log, "Didn't receive http session message response");
 		return err;
 	}
-	received = message.data_size - 2;
-	memcpy(buf, message.data + 2, received);
-	*remote_counter = message.remote_counter;
-	chiaki_rudp_message_pointers_free(&message);
+	received = message->data_size - 2;
+	memcpy(buf, message->data + 2, received);
+	*remote_counter = message->remote_counter;
 
 	if(received <= 0)
 		return received == 0 ? CHIAKI_ERR_DISCONNECTED : CHIAKI_ERR_NETWORK;
@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/hwframetransfer.h>
+#include <chiaki/time.h>
+
+#include <libavutil/hwcontext.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+
+#include <string.h>
+
+// line and plane alignment of the pooled frames, enough for any SIMD the renderers use to upload
+#define POOL_ALIGN 64
+
+#if LIBAVUTIL_VERSION_MAJOR < 57
+typedef int PoolSize;
+#else
+typedef size_t PoolSize;
+#endif
+
+CHIAKI_EXPORT void chiaki_hw_frame_transfer_init(ChiakiHwFrameTransfer *transfer, ChiakiLog *log, bool allow_map)
+{
+	memset(transfer, 0, sizeof(*transfer));
+	chiaki_hw_frame_transfer_reset(transfer, log, allow_map);
+}
+
+CHIAKI_EXPORT void chiaki_hw_frame_transfer_fini(ChiakiHwFrameTransfer *transfer)
+{
+	// buffers still out keep the pool alive until they are returned
+	av_buffer_pool_uninit(&transfer->pool);
+}
+
+CHIAKI_EXPORT void chiaki_hw_frame_transfer_reset(ChiakiHwFrameTransfer *transfer, ChiakiLog *log, bool allow_map)
+{
+	av_buffer_pool_uninit(&transfer->pool);
+	transfer->log = log;
+	transfer->allow_map = allow_map;
+	transfer->hw_format = AV_PIX_FMT_NONE;
+	transfer->hw_sw_format = AV_PIX_FMT_NONE;
+	transfer->hw_width = 0;
+	transfer->hw_height = 0;
+	transfer->sw_format = AV_PIX_FMT_NONE;
+	transfer->map_failed = false;
+	transfer->pool_format = AV_PIX_FMT_NONE;
+	transfer->pool_width = 0;
+	transfer->pool_height = 0;
+}
+
+static AVBufferRef *pool_alloc(void *opaque, PoolSize size)
+{
+	ChiakiHwFrameTransfer *transfer = opaque;
+	AVBufferRef *buf = av_buffer_alloc(size);
+	if(buf)
+		transfer->stats.pool_allocs++;
+	return buf;
+}
+
+CHIAKI_EXPORT AVFrame *chiaki_hw_frame_transfer_get_buffer(ChiakiHwFrameTransfer *transfer, enum AVPixelFormat format, int width, int height)
+{
+	if(!transfer->pool || transfer->pool_format != format || transfer->pool_width != width || transfer->pool_height != height)
+	{
+		av_buffer_pool_uninit(&transfer->pool);
+		int size = av_image_get_buffer_size(format, width, height, POOL_ALIGN);
+		if(size < 0)
+			return NULL;
+		transfer->pool = av_buffer_pool_init2(size, transfer, pool_alloc, NULL);
+		if(!transfer->pool)
+			return NULL;
+		transfer->pool_format = format;
+		transfer->pool_width = width;
+		transfer->pool_height = height;
+	}
+
+	AVFrame *frame = av_frame_alloc();
+	if(!frame)
+		return NULL;
+	frame->buf[0] = av_buffer_pool_get(transfer->pool);
+	if(!frame->buf[0])
+		goto error;
+	if(av_image_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data, format, width, height, POOL_ALIGN) < 0)
+		goto error;
+	frame->format = format;
+	frame->width = width;
+	frame->height = height;
+	return frame;
+error:
+	av_frame_free(&frame);
+	return NULL;
+}
+
+/**
+ * Pick the software format for frames of hw_frames_ctx, once per frames context.
+ */
+static bool negotiate(ChiakiHwFrameTransfer *transfer, AVBufferRef *hw_frames_ctx)
+{
+	AVHWFramesContext *frames = (AVHWFramesContext *)hw_frames_ctx->data;
+	if(transfer->hw_format == frames->format && transfer->hw_sw_format == frames->sw_format
+			&& transfer->hw_width == frames->width && transfer->hw_height == frames->height)
+		return transfer->sw_format != AV_PIX_FMT_NONE;
+
+	transfer->hw_format = frames->format;
+	transfer->hw_sw_format = frames->sw_format;
+	transfer->hw_width = frames->width;
+	transfer->hw_height = frames->height;
+	transfer->sw_format = AV_PIX_FMT_NONE;
+	transfer->map_failed = false;
+
+	enum AVPixelFormat *formats = NULL;
+	if(av_hwframe_transfer_get_formats(hw_frames_ctx, AV_HWFRAME_TRANSFER_DIRECTION_FROM, &formats, 0) < 0 || !formats)
+	{
+		CHIAKI_LOGE(transfer->log, "Hardware frames of format %s can't be downloaded",
+				av_get_pix_fmt_name(frames->format));
+		return false;
+	}
+	// the decoder's own format needs no conversion while downloading, everything else is the driver's preference
+	for(enum AVPixelFormat *f = formats; *f != AV_PIX_FMT_NONE; f++)
+	{
+		if(*f == frames->sw_format)
+		{
+			transfer->sw_format = *f;
+			break;
+		}
+	}
+	if(transfer->sw_format == AV_PIX_FMT_NONE)
+		transfer->sw_format = formats[0];
+	av_freep(&formats);
+
+	if(transfer->sw_format == AV_PIX_FMT_NONE)
+	{
+		CHIAKI_LOGE(transfer->log, "Hardware frames of format %s offer no download format",
+				av_get_pix_fmt_name(frames->format));
+		return false;
+	}
+	CHIAKI_LOGI(transfer->log, "Downloading %s frames as %s", av_get_pix_fmt_name(frames->format),
+			av_get_pix_fmt_name(transfer->sw_format));
+	return true;
+}
+
+static AVFrame *download_map(ChiakiHwFrameTransfer *transfer, AVFrame *src)
+{
+	AVFrame *dst = av_frame_alloc();
+	if(!dst)
+		return NULL;
+	dst->format = transfer->sw_format;
+	// map_from of the hardware contexts copies the properties itself
+	int r = av_hwframe_map(dst, src, AV_HWFRAME_MAP_READ);
+	if(r < 0)
+	{
+		char err[AV_ERROR_MAX_STRING_SIZE];
+		av_strerror(r, err, sizeof(err));
+		CHIAKI_LOGI(transfer->log, "Mapping %s frames failed (%s), copying them instead",
+				av_get_pix_fmt_name(src->format), err);
+		transfer->map_failed = true;
+		av_frame_free(&dst);
+		return NULL;
+	}
+	transfer->stats.mapped++;
+	return dst;
+}
+
+static AVFrame *download_copy(ChiakiHwFrameTransfer *transfer, AVFrame *src)
+{
+	AVFrame *dst = chiaki_hw_frame_transfer_get_buffer(transfer, transfer->sw_format, src->width, src->height);
+	if(!dst)
+		return NULL;
+	// dst has its buffers already, so this only copies into them
+	if(av_hwframe_transfer_data(dst, src, 0) < 0)
+		goto error;
+	if(av_frame_copy_props(dst, src) < 0)
+		goto error;
+	transfer->stats.copied++;
+	return dst;
+error:
+	av_frame_free(&dst);
+	return NULL;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_hw_frame_transfer_download(ChiakiHwFrameTransfer *transfer, AVFrame **frame)
+{
+	AVFrame *src = *frame;
+	if(!src || !src->hw_frames_ctx)
+		return CHIAKI_ERR_SUCCESS;
+
+	uint64_t start_us = chiaki_time_now_monotonic_us();
+	AVFrame *dst = NULL;
+	if(negotiate(transfer, src->hw_frames_ctx))
+	{
+		if(transfer->allow_map && !transfer->map_failed)
+			dst = download_map(transfer, src);
+		if(!dst)
+			dst = download_copy(transfer, src);
+	}
+	if(!dst)
+	{
+		transfer->stats.failed++;
+		return CHIAKI_ERR_UNKNOWN;
+	}
+
+	uint64_t us = chiaki_time_now_monotonic_us() - start_us;
+	transfer->stats.download_us_total += us;
+	if(us > transfer->stats.download_us_max)
+		transfer->stats.download_us_max = us;
+
+	av_frame_free(frame);
+	*frame = dst;
+	return CHIAKI_ERR_SUCCESS;
+}
@@ -11,6 +11,7 @@
 
 static void chiaki_opus_decoder_header(ChiakiAudioHeader *header, void *user);
 static void chiaki_opus_decoder_frame(uint8_t *buf, size_t buf_size, void *user);
+static void chiaki_opus_decoder_fec_frame(uint8_t *buf, size_t buf_size, void *user);
 
 CHIAKI_EXPORT void chiaki_opus_decoder_init(ChiakiOpusDecoder *decoder, ChiakiLog *log)
 {
@@ -38,6 +39,7 @@ CHIAKI_EXPORT void chiaki_opus_decoder_get_sink(ChiakiOpusDecoder *decoder, Chia
 	sink->user = decoder;
 	sink->header_cb = chiaki_opus_decoder_header;
 	sink->frame_cb = chiaki_opus_decoder_frame;
+	sink->fec_frame_cb = chiaki_opus_decoder_fec_frame;
 }
 
 static void chiaki_opus_decoder_header(ChiakiAudioHeader *header, void *user)
@@ -82,9 +84,8 @@ static void chiaki_opus_decoder_header(ChiakiAudioHeader *header, void *user)
 		decoder->settings_cb(header->channels, header->rate, decoder->cb_user);
 }
 
-static void chiaki_opus_decoder_frame(uint8_t *buf, size_t buf_size, void *user)
+static void opus_decoder_decode(ChiakiOpusDecoder *decoder, uint8_t *buf, size_t buf_size, bool fec)
 {
-	ChiakiOpusDecoder *decoder = user;
 	if(!decoder->opus_decoder)
 	{
 		CHIAKI_LOGE(decoder->log, "Received audio frame, but opus decoder is not initialized");
@@ -92,11 +93,23 @@ static void chiaki_opus_decoder_frame(uint8_t *buf, size_t buf_size, void *user)
 	}
 
 	const unsigned char *opus_buf = buf_size ? buf : NULL;
-	int r = opus_decode(decoder->opus_decoder, opus_buf, (opus_int32)buf_size, decoder->pcm_buf, decoder->audio_header.frame_size, 0);
+	// with decode_fec, the frame preceding buf is recovered from the LBRR data in buf,
+	// falling back to PLC by itself if buf contains none.
+	int r = opus_decode(decoder->opus_decoder, opus_buf, (opus_int32)buf_size, decoder->pcm_buf, decoder->audio_header.frame_size, fec ? 1 : 0);
 	if(r < 1)
 		CHIAKI_LOGE(decoder->log, "Decoding audio frame with opus failed: %s", opus_strerror(r));
 	else if(decoder->frame_cb)
 		decoder->frame_cb(decoder->pcm_buf, (size_t)r, decoder->cb_user);
 }
 
+static void chiaki_opus_decoder_frame(uint8_t *buf, size_t buf_size, void *user)
+{
+	opus_decoder_decode(user, buf, buf_size, false);
+}
+
+static void chiaki_opus_decoder_fec_frame(uint8_t *buf, size_t buf_size, void *user)
+{
+	opus_decoder_decode(user, buf, buf_size, true);
+}
+
 #endif
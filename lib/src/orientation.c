@@ -2,15 +2,28 @@
 
 #include <chiaki/orientation.h>
 #include <math.h>
+#include <string.h>
 
 #define SIN_1_4_PI      0.7071067811865475
 #define SIN_NEG_1_4_PI -0.7071067811865475
 #define COS_1_4_PI      0.7071067811865476
 #define COS_NEG_1_4_PI  0.7071067811865476
 
-#define WARMUP_SAMPLES_COUNT 30
-#define BETA_WARMUP 20.0f
-#define BETA_DEFAULT 0.05f
+// accel correction gain of the fusion in rad/s per unit of tilt error
+#define FUSION_KP 0.5f
+// accel readings this far from 1g are moving too much to tell where gravity is
+#define FUSION_ACCEL_TOLERANCE 0.2f
+// gaps between samples longer than this are not integrated
+#define FUSION_DT_MAX_SEC 0.1f
+#define FUSION_PREDICT_MAX_US 20000
+
+// rest detection and gyro bias estimation
+#define REST_TAU_SEC 0.2f
+#define REST_GYRO_DEV_MAX 0.02f
+#define REST_ACCEL_DEV_MAX 0.03f
+#define REST_MIN_SEC 0.5f
+#define BIAS_MAX 0.05f
+#define BIAS_TAU_SEC 0.5f
 
 #define ORIENT_FUZZ 0.0007f
 #define FUZZ_FILTER_PREV_WEIGHT 0.75f
@@ -148,6 +161,247 @@ static float inv_sqrt(float x)
 #endif
 }
 
+static void quat_normalize(ChiakiOrientation *q)
+{
+	float recip_norm = inv_sqrt(q->w * q->w + q->x * q->x + q->y * q->y + q->z * q->z);
+	q->w *= recip_norm;
+	q->x *= recip_norm;
+	q->y *= recip_norm;
+	q->z *= recip_norm;
+}
+
+/**
+ * Rotate by the body rates g over dt exactly instead of the first order step of chiaki_orientation_update(),
+ * which loses accuracy on fast rotations at low sample rates.
+ */
+static void quat_integrate(ChiakiOrientation *q, float gx, float gy, float gz, float dt)
+{
+	float rate = sqrtf(gx * gx + gy * gy + gz * gz);
+	if(rate * dt < 1e-9f)
+		return;
+	float half = 0.5f * rate * dt;
+	float s = sinf(half) / rate;
+	float dw = cosf(half), dx = gx * s, dy = gy * s, dz = gz * s;
+	ChiakiOrientation r;
+	r.w = q->w * dw - q->x * dx - q->y * dy - q->z * dz;
+	r.x = q->w * dx + q->x * dw + q->y * dz - q->z * dy;
+	r.y = q->w * dy - q->x * dz + q->y * dw + q->z * dx;
+	r.z = q->w * dz + q->x * dy - q->y * dx + q->z * dw;
+	*q = r;
+	quat_normalize(q);
+}
+
+/**
+ * Orientation with zero yaw that has gravity along the accel reading,
+ * i.e. the shortest rotation from the accel to the earth's z axis.
+ */
+static void quat_from_gravity(ChiakiOrientation *q, float ax, float ay, float az)
+{
+	float norm = sqrtf(ax * ax + ay * ay + az * az);
+	if(norm < 1e-6f)
+	{
+		chiaki_orientation_init(q);
+		return;
+	}
+	ax /= norm;
+	ay /= norm;
+	az /= norm;
+	if(az < -0.999999f)
+	{
+		// upside down, any axis in the xy plane works
+		q->w = 0.0f;
+		q->x = 1.0f;
+		q->y = 0.0f;
+		q->z = 0.0f;
+		return;
+	}
+	q->w = 1.0f + az;
+	q->x = ay;
+	q->y = -ax;
+	q->z = 0.0f;
+	quat_normalize(q);
+}
+
+static void fusion_state_init(ChiakiMotionFusionState *state)
+{
+	memset(state, 0, sizeof(*state));
+	chiaki_orientation_init(&state->orient);
+}
+
+static void fusion_update_rest(ChiakiMotionFusionState *state, float dt)
+{
+	float alpha = dt / (REST_TAU_SEC + dt);
+	state->gyro_mean_x += alpha * (state->gyro_x - state->gyro_mean_x);
+	state->gyro_mean_y += alpha * (state->gyro_y - state->gyro_mean_y);
+	state->gyro_mean_z += alpha * (state->gyro_z - state->gyro_mean_z);
+	state->accel_mean_x += alpha * (state->accel_x - state->accel_mean_x);
+	state->accel_mean_y += alpha * (state->accel_y - state->accel_mean_y);
+	state->accel_mean_z += alpha * (state->accel_z - state->accel_mean_z);
+	float gyro_dev = fabsf(state->gyro_x - state->gyro_mean_x)
+		+ fabsf(state->gyro_y - state->gyro_mean_y)
+		+ fabsf(state->gyro_z - state->gyro_mean_z);
+	float accel_dev = fabsf(state->accel_x - state->accel_mean_x)
+		+ fabsf(state->accel_y - state->accel_mean_y)
+		+ fabsf(state->accel_z - state->accel_mean_z);
+	state->gyro_dev += alpha * (gyro_dev - state->gyro_dev);
+	state->accel_dev += alpha * (accel_dev - state->accel_dev);
+
+	// a slow steady rotation looks just like bias, so only rates that a bias could have are learned
+	bool rest = state->gyro_dev < REST_GYRO_DEV_MAX && state->accel_dev < REST_ACCEL_DEV_MAX
+		&& fabsf(state->gyro_mean_x) < BIAS_MAX && fabsf(state->gyro_mean_y) < BIAS_MAX && fabsf(state->gyro_mean_z) < BIAS_MAX;
+	if(!rest)
+	{
+		state->rest_sec = 0.0f;
+		return;
+	}
+	state->rest_sec += dt;
+	if(state->rest_sec < REST_MIN_SEC)
+		return;
+	float beta = dt / (BIAS_TAU_SEC + dt);
+	state->bias_x += beta * (state->gyro_mean_x - state->bias_x);
+	state->bias_y += beta * (state->gyro_mean_y - state->bias_y);
+	state->bias_z += beta * (state->gyro_mean_z - state->bias_z);
+}
+
+/**
+ * Body rates to integrate with, bias removed and the accel correction added.
+ */
+static void fusion_rates(ChiakiMotionFusionState *state, float gx, float gy, float gz, float *rx, float *ry, float *rz)
+{
+	gx -= state->bias_x;
+	gy -= state->bias_y;
+	gz -= state->bias_z;
+	if(state->flags & CHIAKI_MOTION_SAMPLE_ACCEL)
+	{
+		float ax = state->accel_x, ay = state->accel_y, az = state->accel_z;
+		float norm = sqrtf(ax * ax + ay * ay + az * az);
+		if(fabsf(norm - 1.0f) < FUSION_ACCEL_TOLERANCE)
+		{
+			ax /= norm;
+			ay /= norm;
+			az /= norm;
+			// gravity as expected from the orientation, error is its cross product with the measured one
+			const ChiakiOrientation *q = &state->orient;
+			float vx = 2.0f * (q->x * q->z - q->w * q->y);
+			float vy = 2.0f * (q->w * q->x + q->y * q->z);
+			float vz = q->w * q->w - q->x * q->x - q->y * q->y + q->z * q->z;
+			gx += FUSION_KP * (ay * vz - az * vy);
+			gy += FUSION_KP * (az * vx - ax * vz);
+			gz += FUSION_KP * (ax * vy - ay * vx);
+		}
+	}
+	*rx = gx;
+	*ry = gy;
+	*rz = gz;
+}
+
+static void fusion_step(ChiakiMotionFusionState *state, const ChiakiMotionSample *sample)
+{
+	if(!state->flags)
+		state->timestamp_us = sample->timestamp_us;
+	float dt = (float)(sample->timestamp_us - state->timestamp_us) / 1000000.0f;
+	state->timestamp_us = sample->timestamp_us;
+
+	if(dt > 0.0f && dt <= FUSION_DT_MAX_SEC && (state->flags & CHIAKI_MOTION_SAMPLE_GYRO))
+	{
+		// the rate changed linearly between the readings as far as we know
+		float gx = state->gyro_x, gy = state->gyro_y, gz = state->gyro_z;
+		if(sample->flags & CHIAKI_MOTION_SAMPLE_GYRO)
+		{
+			gx = 0.5f * (gx + sample->gyro_x);
+			gy = 0.5f * (gy + sample->gyro_y);
+			gz = 0.5f * (gz + sample->gyro_z);
+		}
+		float rx, ry, rz;
+		fusion_rates(state, gx, gy, gz, &rx, &ry, &rz);
+		quat_integrate(&state->orient, rx, ry, rz, dt);
+	}
+
+	if(sample->flags & CHIAKI_MOTION_SAMPLE_ACCEL)
+	{
+		if(!(state->flags & CHIAKI_MOTION_SAMPLE_ACCEL))
+		{
+			// start out level with gravity instead of converging towards it
+			quat_from_gravity(&state->orient, sample->accel_x, sample->accel_y, sample->accel_z);
+			state->accel_mean_x = sample->accel_x;
+			state->accel_mean_y = sample->accel_y;
+			state->accel_mean_z = sample->accel_z;
+		}
+		state->accel_x = sample->accel_x;
+		state->accel_y = sample->accel_y;
+		state->accel_z = sample->accel_z;
+	}
+	if(sample->flags & CHIAKI_MOTION_SAMPLE_GYRO)
+	{
+		state->gyro_x = sample->gyro_x;
+		state->gyro_y = sample->gyro_y;
+		state->gyro_z = sample->gyro_z;
+	}
+	state->flags |= sample->flags;
+
+	if(dt > 0.0f && dt <= FUSION_DT_MAX_SEC
+			&& (state->flags & (CHIAKI_MOTION_SAMPLE_GYRO | CHIAKI_MOTION_SAMPLE_ACCEL)) == (CHIAKI_MOTION_SAMPLE_GYRO | CHIAKI_MOTION_SAMPLE_ACCEL))
+		fusion_update_rest(state, dt);
+}
+
+static void fusion_commit_first(ChiakiMotionFusion *fusion)
+{
+	fusion_step(&fusion->state, &fusion->queue[0]);
+	fusion->queue_count--;
+	memmove(fusion->queue, fusion->queue + 1, fusion->queue_count * sizeof(fusion->queue[0]));
+}
+
+CHIAKI_EXPORT void chiaki_motion_fusion_init(ChiakiMotionFusion *fusion)
+{
+	fusion_state_init(&fusion->state);
+	fusion->queue_count = 0;
+	fusion->dropped = 0;
+}
+
+CHIAKI_EXPORT void chiaki_motion_fusion_push(ChiakiMotionFusion *fusion, const ChiakiMotionSample *sample)
+{
+	if(!(sample->flags & (CHIAKI_MOTION_SAMPLE_GYRO | CHIAKI_MOTION_SAMPLE_ACCEL)))
+		return;
+	if(fusion->state.flags && sample->timestamp_us < fusion->state.timestamp_us)
+	{
+		fusion->dropped++;
+		return;
+	}
+	if(fusion->queue_count == CHIAKI_MOTION_FUSION_QUEUE_SIZE)
+		fusion_commit_first(fusion);
+
+	size_t i = fusion->queue_count;
+	while(i > 0 && fusion->queue[i - 1].timestamp_us > sample->timestamp_us)
+		i--;
+	memmove(fusion->queue + i + 1, fusion->queue + i, (fusion->queue_count - i) * sizeof(fusion->queue[0]));
+	fusion->queue[i] = *sample;
+	fusion->queue_count++;
+
+	uint64_t newest_us = fusion->queue[fusion->queue_count - 1].timestamp_us;
+	while(fusion->queue_count && fusion->queue[0].timestamp_us + CHIAKI_MOTION_FUSION_REORDER_US <= newest_us)
+		fusion_commit_first(fusion);
+}
+
+CHIAKI_EXPORT bool chiaki_motion_fusion_get(ChiakiMotionFusion *fusion, uint64_t timestamp_us, ChiakiOrientation *orient)
+{
+	// samples still waiting for stragglers are integrated on a copy, so they are used right away
+	ChiakiMotionFusionState state = fusion->state;
+	for(size_t i=0; i<fusion->queue_count; i++)
+		fusion_step(&state, &fusion->queue[i]);
+
+	if((state.flags & CHIAKI_MOTION_SAMPLE_GYRO) && timestamp_us > state.timestamp_us)
+	{
+		uint64_t ahead_us = timestamp_us - state.timestamp_us;
+		if(ahead_us > FUSION_PREDICT_MAX_US)
+			ahead_us = FUSION_PREDICT_MAX_US;
+		float rx, ry, rz;
+		fusion_rates(&state, state.gyro_x, state.gyro_y, state.gyro_z, &rx, &ry, &rz);
+		quat_integrate(&state.orient, rx, ry, rz, (float)ahead_us / 1000000.0f);
+	}
+	*orient = state.orient;
+	return state.flags != 0;
+}
+
 CHIAKI_EXPORT void chiaki_orientation_tracker_init(ChiakiOrientationTracker *tracker)
 {
 	tracker->accel_x = 0.0f;
@@ -156,43 +410,85 @@ CHIAKI_EXPORT void chiaki_orientation_tracker_init(ChiakiOrientationTracker *tra
 	tracker->gyro_x = tracker->gyro_y = tracker->gyro_z = 0.0f;
 	chiaki_orientation_init(&tracker->orient);
 	tracker->timestamp = 0;
+	tracker->timestamp_us = 0;
 	tracker->sample_index = 0;
+	chiaki_motion_fusion_init(&tracker->fusion);
 }
 
 CHIAKI_EXPORT void chiaki_orientation_tracker_update(ChiakiOrientationTracker *tracker,
 		float gx, float gy, float gz, float ax, float ay, float az,
 		ChiakiAccelNewZero *accel_zero, bool accel_zero_applied, uint32_t timestamp_us)
 {
-	tracker->gyro_x = gx;
-	tracker->gyro_y = gy;
-	tracker->gyro_z = gz;
-	if(!accel_zero_applied)
+	if(!tracker->sample_index)
+		tracker->timestamp_us = timestamp_us;
+	else
 	{
-		ax -= accel_zero->accel_x;
-		ay -= accel_zero->accel_y;
-		az -= accel_zero->accel_z;
+		// signed difference, so the timestamp may wrap and samples may come out of order
+		int64_t delta_us = (int32_t)(timestamp_us - tracker->timestamp);
+		if(delta_us < 0 && (uint64_t)-delta_us > tracker->timestamp_us)
+			delta_us = -(int64_t)tracker->timestamp_us;
+		tracker->timestamp_us += delta_us;
 	}
-	tracker->accel_x = ax;
-	tracker->accel_y = ay;
-	tracker->accel_z = az;
-	tracker->sample_index++;
-	if(tracker->sample_index <= 1)
+	tracker->timestamp = timestamp_us;
+
+	ChiakiMotionSample sample;
+	sample.timestamp_us = tracker->timestamp_us;
+	sample.flags = CHIAKI_MOTION_SAMPLE_GYRO | CHIAKI_MOTION_SAMPLE_ACCEL;
+	sample.gyro_x = gx;
+	sample.gyro_y = gy;
+	sample.gyro_z = gz;
+	sample.accel_x = ax;
+	sample.accel_y = ay;
+	sample.accel_z = az;
+	chiaki_orientation_tracker_update_sample(tracker, &sample, accel_zero_applied ? NULL : accel_zero);
+}
+
+CHIAKI_EXPORT void chiaki_orientation_tracker_update_sample(ChiakiOrientationTracker *tracker,
+		const ChiakiMotionSample *sample, ChiakiAccelNewZero *accel_zero)
+{
+	ChiakiMotionSample s = *sample;
+	if(s.flags & CHIAKI_MOTION_SAMPLE_GYRO)
 	{
-		tracker->timestamp = timestamp_us;
-		return;
+		tracker->gyro_x = s.gyro_x;
+		tracker->gyro_y = s.gyro_y;
+		tracker->gyro_z = s.gyro_z;
 	}
-	uint64_t delta_us = timestamp_us;
-	if(delta_us < tracker->timestamp)
-		delta_us += (1ULL << 32);
-	delta_us -= tracker->timestamp;
-	tracker->timestamp = timestamp_us;
-	chiaki_orientation_update(&tracker->orient, gx, gy, gz, ax, ay, az,
-			tracker->sample_index < WARMUP_SAMPLES_COUNT ? BETA_WARMUP : BETA_DEFAULT,
-			(float)delta_us / 1000000.0f);
+	if(s.flags & CHIAKI_MOTION_SAMPLE_ACCEL)
+	{
+		if(accel_zero)
+		{
+			s.accel_x -= accel_zero->accel_x;
+			s.accel_y -= accel_zero->accel_y;
+			s.accel_z -= accel_zero->accel_z;
+		}
+		tracker->accel_x = s.accel_x;
+		tracker->accel_y = s.accel_y;
+		tracker->accel_z = s.accel_z;
+	}
+	tracker->sample_index++;
+	chiaki_motion_fusion_push(&tracker->fusion, &s);
+	chiaki_motion_fusion_get(&tracker->fusion, 0, &tracker->orient);
 }
 
-CHIAKI_EXPORT void chiaki_orientation_tracker_apply_to_controller_state(ChiakiOrientationTracker *tracker,
-		ChiakiControllerState *state)
+CHIAKI_EXPORT void chiaki_orientation_tracker_reset(ChiakiOrientationTracker *tracker,
+		float gx, float gy, float gz, float ax, float ay, float az,
+		ChiakiAccelNewZero *accel_zero, uint64_t timestamp_us)
+{
+	chiaki_orientation_tracker_init(tracker);
+	ChiakiMotionSample sample;
+	sample.timestamp_us = timestamp_us;
+	sample.flags = CHIAKI_MOTION_SAMPLE_GYRO | CHIAKI_MOTION_SAMPLE_ACCEL;
+	sample.gyro_x = gx;
+	sample.gyro_y = gy;
+	sample.gyro_z = gz;
+	sample.accel_x = ax;
+	sample.accel_y = ay;
+	sample.accel_z = az;
+	chiaki_orientation_tracker_update_sample(tracker, &sample, accel_zero);
+}
+
+static void orientation_apply_to_controller_state(ChiakiOrientationTracker *tracker,
+		const ChiakiOrientation *orient, ChiakiControllerState *state)
 {
 	state->gyro_x = tracker->gyro_x;
 	state->gyro_y = tracker->gyro_y;
@@ -201,10 +497,24 @@ CHIAKI_EXPORT void chiaki_orientation_tracker_apply_to_controller_state(ChiakiOr
 	state->accel_y = tracker->accel_y;
 	state->accel_z = tracker->accel_z;
 	// -90 deg rotation around x from Madgwick
-	state->orient_w = COS_NEG_1_4_PI * tracker->orient.w - SIN_NEG_1_4_PI * tracker->orient.x;
-	state->orient_x = COS_NEG_1_4_PI * tracker->orient.x + SIN_NEG_1_4_PI * tracker->orient.w;
-	state->orient_y = COS_NEG_1_4_PI * tracker->orient.y - SIN_NEG_1_4_PI * tracker->orient.z;
-	state->orient_z = COS_NEG_1_4_PI * tracker->orient.z + SIN_NEG_1_4_PI * tracker->orient.y;
+	state->orient_w = COS_NEG_1_4_PI * orient->w - SIN_NEG_1_4_PI * orient->x;
+	state->orient_x = COS_NEG_1_4_PI * orient->x + SIN_NEG_1_4_PI * orient->w;
+	state->orient_y = COS_NEG_1_4_PI * orient->y - SIN_NEG_1_4_PI * orient->z;
+	state->orient_z = COS_NEG_1_4_PI * orient->z + SIN_NEG_1_4_PI * orient->y;
+}
+
+CHIAKI_EXPORT void chiaki_orientation_tracker_apply_to_controller_state(ChiakiOrientationTracker *tracker,
+		ChiakiControllerState *state)
+{
+	orientation_apply_to_controller_state(tracker, &tracker->orient, state);
+}
+
+CHIAKI_EXPORT void chiaki_orientation_tracker_apply_to_controller_state_at(ChiakiOrientationTracker *tracker,
+		ChiakiControllerState *state, uint64_t timestamp_us)
+{
+	ChiakiOrientation orient;
+	chiaki_motion_fusion_get(&tracker->fusion, timestamp_us, &orient);
+	orientation_apply_to_controller_state(tracker, &orient, state);
 }
 
 CHIAKI_EXPORT void chiaki_accel_new_zero_set_inactive(ChiakiAccelNewZero *accel_zero, bool real_accel)
@@ -0,0 +1,806 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/recorder.h>
+#include <chiaki/bitstream.h>
+#include <chiaki/time.h>
+
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define US_TIME_BASE ((AVRational){ 1, 1000000 })
+
+// audio timestamps follow the Opus frame count, unless they drift this far from the arrival time
+#define AUDIO_RESYNC_US 200000
+
+typedef enum
+{
+	RECORDER_PACKET_VIDEO,
+	RECORDER_PACKET_AUDIO,
+	RECORDER_PACKET_AUDIO_HEADER
+} RecorderPacketType;
+
+struct recorder_packet_t
+{
+	RecorderPacket *next;
+	RecorderPacketType type;
+	int64_t pts_us;
+	int64_t duration_us;
+	bool discontinuity; // video: frames before this one are missing
+	bool recovered; // video: decodable despite the discontinuity
+	bool key; // set by the writer
+	uint8_t *param_sets; // set by the writer for key frames held in the ring
+	size_t param_sets_size;
+	size_t size;
+	uint8_t data[];
+};
+
+struct recorder_file_t
+{
+	AVFormatContext *fmt;
+	AVStream *video;
+	AVStream *audio;
+	int64_t start_us;
+	uint8_t param_sets[CHIAKI_RECORDER_PARAM_SETS_MAX];
+	size_t param_sets_size;
+};
+
+static void *recorder_thread_func(void *user);
+
+static char *recorder_strdup(const char *str)
+{
+	if(!str)
+		return NULL;
+	size_t len = strlen(str);
+	char *r = malloc(len + 1);
+	if(r)
+		memcpy(r, str, len + 1);
+	return r;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_recorder_init(ChiakiRecorder *recorder, ChiakiLog *log, const ChiakiRecorderSettings *settings)
+{
+	memset(recorder, 0, sizeof(*recorder));
+	recorder->log = log;
+	recorder->settings = *settings;
+	if(!recorder->settings.memory_max)
+		recorder->settings.memory_max = CHIAKI_RECORDER_MEMORY_MAX_DEFAULT;
+	if(!recorder->settings.buffer_ms && !settings->path)
+		return CHIAKI_ERR_INVALID_DATA;
+	recorder->settings.path = recorder_strdup(settings->path);
+	recorder->settings.format = recorder_strdup(settings->format);
+	recorder->start_us = chiaki_time_now_monotonic_us();
+	recorder->video_pts_last = -1;
+
+	ChiakiErrorCode err = chiaki_mutex_init(&recorder->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_settings;
+	err = chiaki_cond_init(&recorder->cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+	err = chiaki_thread_create(&recorder->thread, recorder_thread_func, recorder);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_cond;
+	chiaki_thread_set_name(&recorder->thread, "Chiaki Recorder");
+	return CHIAKI_ERR_SUCCESS;
+
+error_cond:
+	chiaki_cond_fini(&recorder->cond);
+error_mutex:
+	chiaki_mutex_fini(&recorder->mutex);
+error_settings:
+	free((char *)recorder->settings.path);
+	free((char *)recorder->settings.format);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_recorder_fini(ChiakiRecorder *recorder)
+{
+	chiaki_mutex_lock(&recorder->mutex);
+	recorder->should_stop = true;
+	chiaki_cond_signal(&recorder->cond);
+	chiaki_mutex_unlock(&recorder->mutex);
+	chiaki_thread_join(&recorder->thread, NULL);
+
+	chiaki_cond_fini(&recorder->cond);
+	chiaki_mutex_fini(&recorder->mutex);
+	free((char *)recorder->settings.path);
+	free((char *)recorder->settings.format);
+}
+
+static void recorder_push(ChiakiRecorder *recorder, RecorderPacketType type, const uint8_t *buf, size_t buf_size,
+		int32_t frames_lost, bool frame_recovered, uint64_t now_us)
+{
+	// copy outside of the lock, this is all the receiving thread pays for recording
+	RecorderPacket *packet = malloc(sizeof(RecorderPacket) + buf_size);
+	if(packet)
+	{
+		memset(packet, 0, sizeof(RecorderPacket));
+		packet->type = type;
+		packet->size = buf_size;
+		if(buf_size)
+			memcpy(packet->data, buf, buf_size);
+	}
+
+	chiaki_mutex_lock(&recorder->mutex);
+	int64_t arrival_us = (int64_t)(now_us - recorder->start_us);
+	if(type == RECORDER_PACKET_AUDIO && recorder->audio_frame_duration_us)
+	{
+		if(!recorder->audio_started || recorder->audio_pts_next < arrival_us - AUDIO_RESYNC_US)
+		{
+			recorder->audio_pts_next = arrival_us;
+			recorder->audio_started = true;
+			recorder->audio_ahead = false;
+		}
+		else if(recorder->audio_ahead || recorder->audio_pts_next > arrival_us + AUDIO_RESYNC_US)
+		{
+			// Timestamps must not go backwards, so drop frames until the arrival time caught up,
+			// e.g. after a burst of frames that were held back while the timestamps already resynced.
+			recorder->audio_ahead = recorder->audio_pts_next > arrival_us;
+			if(recorder->audio_ahead)
+			{
+				recorder->stats.packets_dropped++;
+				chiaki_mutex_unlock(&recorder->mutex);
+				free(packet);
+				return;
+			}
+		}
+		if(packet)
+		{
+			packet->pts_us = recorder->audio_pts_next;
+			packet->duration_us = recorder->audio_frame_duration_us;
+		}
+		// lost frames still take their time
+		recorder->audio_pts_next += recorder->audio_frame_duration_us;
+	}
+
+	if(!packet || (type != RECORDER_PACKET_AUDIO_HEADER && recorder->bytes + buf_size > recorder->settings.memory_max))
+	{
+		if(type == RECORDER_PACKET_VIDEO)
+			recorder->video_dropped = true;
+		recorder->stats.packets_dropped++;
+		chiaki_mutex_unlock(&recorder->mutex);
+		free(packet);
+		return;
+	}
+
+	if(type == RECORDER_PACKET_VIDEO)
+	{
+		packet->pts_us = arrival_us > recorder->video_pts_last ? arrival_us : recorder->video_pts_last + 1;
+		recorder->video_pts_last = packet->pts_us;
+		packet->discontinuity = frames_lost > 0 || recorder->video_dropped;
+		packet->recovered = frame_recovered && !recorder->video_dropped;
+		recorder->video_dropped = false;
+	}
+
+	if(recorder->queue_tail)
+		recorder->queue_tail->next = packet;
+	else
+		recorder->queue_head = packet;
+	recorder->queue_tail = packet;
+	recorder->bytes += buf_size;
+	chiaki_cond_signal(&recorder->cond);
+	chiaki_mutex_unlock(&recorder->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_recorder_push_video(ChiakiRecorder *recorder, const uint8_t *buf, size_t buf_size,
+		int32_t frames_lost, bool frame_recovered, uint64_t now_us)
+{
+	recorder_push(recorder, RECORDER_PACKET_VIDEO, buf, buf_size, frames_lost, frame_recovered, now_us);
+}
+
+CHIAKI_EXPORT void chiaki_recorder_push_audio(ChiakiRecorder *recorder, const uint8_t *buf, size_t buf_size, uint64_t now_us)
+{
+	if(!buf)
+	{
+		// only advances the timestamps
+		chiaki_mutex_lock(&recorder->mutex);
+		if(recorder->audio_started && !recorder->audio_ahead)
+			recorder->audio_pts_next += recorder->audio_frame_duration_us;
+		chiaki_mutex_unlock(&recorder->mutex);
+		return;
+	}
+	recorder_push(recorder, RECORDER_PACKET_AUDIO, buf, buf_size, 0, false, now_us);
+}
+
+CHIAKI_EXPORT void chiaki_recorder_push_audio_header(ChiakiRecorder *recorder, const ChiakiAudioHeader *header)
+{
+	chiaki_mutex_lock(&recorder->mutex);
+	recorder->audio_frame_duration_us = header->rate ? (int64_t)header->frame_size * 1000000 / header->rate : 0;
+	recorder->audio_started = false;
+	chiaki_mutex_unlock(&recorder->mutex);
+	recorder_push(recorder, RECORDER_PACKET_AUDIO_HEADER, (const uint8_t *)header, sizeof(*header), 0, false, chiaki_time_now_monotonic_us());
+}
+
+CHIAKI_EXPORT bool chiaki_recorder_video_sample_cb(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered, void *user)
+{
+	chiaki_recorder_push_video(user, buf, buf_size, frames_lost, frame_recovered, chiaki_time_now_monotonic_us());
+	return true;
+}
+
+CHIAKI_EXPORT void chiaki_recorder_audio_header_cb(ChiakiAudioHeader *header, void *user)
+{
+	chiaki_recorder_push_audio_header(user, header);
+}
+
+CHIAKI_EXPORT void chiaki_recorder_audio_frame_cb(uint8_t *buf, size_t buf_size, void *user)
+{
+	chiaki_recorder_push_audio(user, buf, buf_size, chiaki_time_now_monotonic_us());
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_recorder_save(ChiakiRecorder *recorder, const char *path)
+{
+	if(!recorder->settings.buffer_ms)
+		return CHIAKI_ERR_INVALID_DATA;
+	char *save_path = recorder_strdup(path);
+	if(!save_path)
+		return CHIAKI_ERR_MEMORY;
+	chiaki_mutex_lock(&recorder->mutex);
+	free(recorder->save_path);
+	recorder->save_path = save_path;
+	chiaki_cond_signal(&recorder->cond);
+	chiaki_mutex_unlock(&recorder->mutex);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_recorder_get_stats(ChiakiRecorder *recorder, ChiakiRecorderStats *stats)
+{
+	chiaki_mutex_lock(&recorder->mutex);
+	*stats = recorder->stats;
+	chiaki_mutex_unlock(&recorder->mutex);
+}
+
+static void recorder_packet_free(ChiakiRecorder *recorder, RecorderPacket *packet)
+{
+	recorder->writer.bytes_freed += packet->size;
+	free(packet->param_sets);
+	free(packet);
+}
+
+/**
+ * @return pointer behind the next Annex B start code or end
+ */
+static const uint8_t *recorder_nal_next(const uint8_t *p, const uint8_t *end)
+{
+	while(end - p >= 3)
+	{
+		if(p[0] == 0 && p[1] == 0 && p[2] == 1)
+			return p + 3;
+		p++;
+	}
+	return end;
+}
+
+/**
+ * Find out whether a sample contains a picture and whether it is a key frame,
+ * and collect its parameter sets (with start codes) into param_sets, if any.
+ */
+static void recorder_scan(ChiakiCodec codec, const uint8_t *buf, size_t size, bool *vcl, bool *key,
+		uint8_t *param_sets, size_t *param_sets_size)
+{
+	*vcl = false;
+	*key = false;
+	size_t ps_size = 0;
+	bool ps_overflow = false;
+	const uint8_t *end = buf + size;
+	const uint8_t *nal = recorder_nal_next(buf, end);
+	while(nal < end)
+	{
+		const uint8_t *next = recorder_nal_next(nal, end);
+		const uint8_t *nal_end = next == end ? end : next - 3;
+		while(nal_end > nal && nal_end[-1] == 0) // trailing zeros and the first byte of 4-byte start codes
+			nal_end--;
+		if(nal_end > nal)
+		{
+			bool ps;
+			if(chiaki_codec_is_h265(codec))
+			{
+				unsigned int type = (nal[0] >> 1) & 0x3f;
+				if(type < 32)
+				{
+					*vcl = true;
+					if(type >= 16 && type <= 23) // IRAP
+						*key = true;
+				}
+				ps = type >= 32 && type <= 34; // VPS, SPS, PPS
+			}
+			else
+			{
+				unsigned int type = nal[0] & 0x1f;
+				if(type >= 1 && type <= 5)
+				{
+					*vcl = true;
+					if(type == 5) // IDR
+						*key = true;
+				}
+				ps = type == 7 || type == 8; // SPS, PPS
+			}
+
+			size_t nal_size = nal_end - nal;
+			if(ps && ps_size + 4 + nal_size <= CHIAKI_RECORDER_PARAM_SETS_MAX)
+			{
+				static const uint8_t start_code[] = { 0, 0, 0, 1 };
+				memcpy(param_sets + ps_size, start_code, sizeof(start_code));
+				memcpy(param_sets + ps_size + 4, nal, nal_size);
+				ps_size += 4 + nal_size;
+			}
+			else if(ps)
+				ps_overflow = true;
+		}
+		nal = next;
+	}
+	*param_sets_size = ps_overflow ? 0 : ps_size;
+}
+
+/**
+ * Insert "-NNN" before the extension of path.
+ */
+static char *recorder_segment_path(const char *path, unsigned int index)
+{
+	const char *slash = strrchr(path, '/');
+	const char *dot = strrchr(path, '.');
+	if(!dot || (slash && dot < slash))
+		dot = path + strlen(path);
+	size_t size = strlen(path) + 16;
+	char *r = malloc(size);
+	if(r)
+		snprintf(r, size, "%.*s-%03u%s", (int)(dot - path), path, index, dot);
+	return r;
+}
+
+static void recorder_file_close(ChiakiRecorder *recorder, RecorderFile *file)
+{
+	if(!file->fmt)
+		return;
+	int r = av_write_trailer(file->fmt);
+	if(r < 0)
+	{
+		CHIAKI_LOGE(recorder->log, "Recorder failed to finish file: %s", av_err2str(r));
+		recorder->writer.stats.errors++;
+	}
+	if(!(file->fmt->oformat->flags & AVFMT_NOFILE))
+		avio_closep(&file->fmt->pb);
+	avformat_free_context(file->fmt);
+	file->fmt = NULL;
+	file->video = NULL;
+	file->audio = NULL;
+	if(r >= 0)
+		recorder->writer.stats.files_written++;
+}
+
+/**
+ * The size of the pictures as the parameter sets of file signal it,
+ * which is what the console actually streams, or the one from the settings if they can't be parsed.
+ */
+static void recorder_file_size(ChiakiRecorder *recorder, RecorderFile *file, int *width, int *height)
+{
+	*width = (int)recorder->settings.width;
+	*height = (int)recorder->settings.height;
+	if(!file->param_sets_size)
+		return;
+	ChiakiBitstream bitstream;
+	chiaki_bitstream_init(&bitstream, recorder->log, recorder->settings.codec);
+	if(!chiaki_bitstream_header(&bitstream, file->param_sets, (unsigned)file->param_sets_size))
+		return;
+	unsigned sps_width, sps_height;
+	chiaki_bitstream_size(&bitstream, &sps_width, &sps_height);
+	if(!sps_width || !sps_height)
+		return;
+	*width = (int)sps_width;
+	*height = (int)sps_height;
+}
+
+static bool recorder_file_open(ChiakiRecorder *recorder, RecorderFile *file, const char *path, int64_t start_us,
+		const uint8_t *param_sets, size_t param_sets_size)
+{
+	memset(file, 0, sizeof(*file));
+	file->start_us = start_us;
+	memcpy(file->param_sets, param_sets, param_sets_size);
+	file->param_sets_size = param_sets_size;
+
+	int r = avformat_alloc_output_context2(&file->fmt, NULL, recorder->settings.format, path);
+	if(r < 0 || !file->fmt)
+	{
+		CHIAKI_LOGE(recorder->log, "Recorder failed to create output for %s: %s", path, av_err2str(r));
+		file->fmt = NULL;
+		goto error;
+	}
+
+	file->video = avformat_new_stream(file->fmt, NULL);
+	if(!file->video)
+		goto error_fmt;
+	file->video->time_base = US_TIME_BASE;
+	file->video->avg_frame_rate = (AVRational){ recorder->settings.max_fps, 1 };
+	AVCodecParameters *par = file->video->codecpar;
+	par->codec_type = AVMEDIA_TYPE_VIDEO;
+	par->codec_id = chiaki_codec_is_h265(recorder->settings.codec) ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+	recorder_file_size(recorder, file, &par->width, &par->height);
+	// Annex B parameter sets, the muxers convert them to avcC/hvcC
+	par->extradata = av_mallocz(param_sets_size + AV_INPUT_BUFFER_PADDING_SIZE);
+	if(!par->extradata)
+		goto error_fmt;
+	memcpy(par->extradata, param_sets, param_sets_size);
+	par->extradata_size = (int)param_sets_size;
+
+	if(recorder->writer.audio_header_valid)
+	{
+		ChiakiAudioHeader *header = &recorder->writer.audio_header;
+		file->audio = avformat_new_stream(file->fmt, NULL);
+		if(!file->audio)
+			goto error_fmt;
+		file->audio->time_base = US_TIME_BASE;
+		par = file->audio->codecpar;
+		par->codec_type = AVMEDIA_TYPE_AUDIO;
+		par->codec_id = AV_CODEC_ID_OPUS;
+		par->sample_rate = header->rate;
+		par->frame_size = header->frame_size;
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 24, 100)
+		av_channel_layout_default(&par->ch_layout, header->channels);
+#else
+		par->channels = header->channels;
+		par->channel_layout = av_get_default_channel_layout(header->channels);
+#endif
+
+		// OpusHead, RFC 7845 5.1
+		static const size_t opus_head_size = 19;
+		par->extradata = av_mallocz(opus_head_size + AV_INPUT_BUFFER_PADDING_SIZE);
+		if(!par->extradata)
+			goto error_fmt;
+		uint8_t *head = par->extradata;
+		memcpy(head, "OpusHead", 8);
+		head[8] = 1; // version
+		head[9] = header->channels;
+		// pre-skip 0 at 10, output gain 0 at 16, mapping family 0 at 18
+		head[12] = header->rate & 0xff;
+		head[13] = (header->rate >> 8) & 0xff;
+		head[14] = (header->rate >> 16) & 0xff;
+		head[15] = (header->rate >> 24) & 0xff;
+		par->extradata_size = (int)opus_head_size;
+	}
+
+	if(!(file->fmt->oformat->flags & AVFMT_NOFILE))
+	{
+		r = avio_open(&file->fmt->pb, path, AVIO_FLAG_WRITE);
+		if(r < 0)
+		{
+			CHIAKI_LOGE(recorder->log, "Recorder failed to open %s: %s", path, av_err2str(r));
+			goto error_fmt;
+		}
+	}
+
+	AVDictionary *options = NULL;
+	// fragmented, so a session ending abruptly still leaves a playable file
+	if(strcmp(file->fmt->oformat->name, "mp4") == 0 || strcmp(file->fmt->oformat->name, "mov") == 0)
+	{
+		av_dict_set(&options, "movflags", "+frag_keyframe+empty_moov+default_base_moof", 0);
+		// Opus in MP4 is refused as experimental before FFmpeg 4.3
+		if(file->audio)
+			av_dict_set(&options, "strict", "experimental", 0);
+	}
+	r = avformat_write_header(file->fmt, &options);
+	av_dict_free(&options);
+	if(r < 0)
+	{
+		CHIAKI_LOGE(recorder->log, "Recorder failed to write header of %s: %s", path, av_err2str(r));
+		goto error_pb;
+	}
+
+	CHIAKI_LOGI(recorder->log, "Recording to %s", path);
+	return true;
+
+error_pb:
+	if(!(file->fmt->oformat->flags & AVFMT_NOFILE))
+		avio_closep(&file->fmt->pb);
+error_fmt:
+	avformat_free_context(file->fmt);
+	file->fmt = NULL;
+error:
+	file->video = NULL;
+	file->audio = NULL;
+	recorder->writer.stats.errors++;
+	return false;
+}
+
+static void recorder_file_write(ChiakiRecorder *recorder, RecorderFile *file, RecorderPacket *packet, bool corrupt)
+{
+	AVStream *stream = packet->type == RECORDER_PACKET_VIDEO ? file->video : file->audio;
+	if(!file->fmt || !stream || packet->pts_us < file->start_us)
+		return;
+
+	AVPacket *pkt = av_packet_alloc();
+	if(!pkt)
+	{
+		recorder->writer.stats.errors++;
+		return;
+	}
+	// not refcounted, the muxer copies what it keeps for interleaving
+	pkt->data = packet->data;
+	pkt->size = (int)packet->size;
+	pkt->stream_index = stream->index;
+	pkt->pts = pkt->dts = packet->pts_us - file->start_us; // no B-frames in the stream
+	pkt->duration = packet->duration_us;
+	if(packet->key)
+		pkt->flags |= AV_PKT_FLAG_KEY;
+	if(corrupt)
+		pkt->flags |= AV_PKT_FLAG_CORRUPT;
+	av_packet_rescale_ts(pkt, US_TIME_BASE, stream->time_base);
+
+	int r = av_interleaved_write_frame(file->fmt, pkt);
+	av_packet_free(&pkt);
+	if(r < 0)
+	{
+		CHIAKI_LOGE(recorder->log, "Recorder failed to write packet: %s", av_err2str(r));
+		recorder->writer.stats.errors++;
+		return;
+	}
+	if(packet->type == RECORDER_PACKET_VIDEO)
+	{
+		recorder->writer.stats.video_packets++;
+		if(corrupt)
+			recorder->writer.stats.frames_corrupt++;
+	}
+	else
+		recorder->writer.stats.audio_packets++;
+}
+
+static bool recorder_param_sets_differ(RecorderFile *file, const uint8_t *param_sets, size_t param_sets_size)
+{
+	return file->param_sets_size != param_sets_size || memcmp(file->param_sets, param_sets, param_sets_size) != 0;
+}
+
+/**
+ * Drop packets from the front of the ring, so it still covers buffer_ms and starts with a key frame.
+ */
+static void recorder_ring_trim(ChiakiRecorder *recorder)
+{
+	int64_t buffer_us = (int64_t)recorder->settings.buffer_ms * 1000;
+	while(recorder->writer.ring_head)
+	{
+		RecorderPacket *newest = recorder->writer.ring_tail;
+		RecorderPacket *next_key = NULL;
+		for(RecorderPacket *p = recorder->writer.ring_head->next; p; p = p->next)
+		{
+			if(p->type == RECORDER_PACKET_VIDEO && p->key)
+			{
+				next_key = p;
+				break;
+			}
+		}
+		bool too_old = next_key && newest->pts_us - next_key->pts_us >= buffer_us;
+		// the ring counts against memory_max too, leave a quarter of it for the queue
+		bool too_big = recorder->writer.ring_bytes > recorder->settings.memory_max / 4 * 3;
+		if(!too_old && !too_big)
+			break;
+
+		// a key frame with different parameter sets also starts over
+		RecorderPacket *stop = next_key;
+		while(recorder->writer.ring_head != stop)
+		{
+			RecorderPacket *p = recorder->writer.ring_head;
+			recorder->writer.ring_head = p->next;
+			recorder->writer.ring_bytes -= p->size;
+			recorder_packet_free(recorder, p);
+		}
+		if(!recorder->writer.ring_head)
+			recorder->writer.ring_tail = NULL;
+	}
+}
+
+static void recorder_ring_push(ChiakiRecorder *recorder, RecorderPacket *packet)
+{
+	if(!recorder->writer.ring_head)
+	{
+		// the ring always starts with a key frame
+		if(packet->type != RECORDER_PACKET_VIDEO || !packet->key)
+		{
+			if(packet->type == RECORDER_PACKET_VIDEO)
+				recorder->writer.stats.packets_dropped++;
+			recorder_packet_free(recorder, packet);
+			return;
+		}
+	}
+	else if(packet->type == RECORDER_PACKET_VIDEO && packet->key
+			&& (recorder->writer.ring_head->param_sets_size != packet->param_sets_size
+				|| memcmp(recorder->writer.ring_head->param_sets, packet->param_sets, packet->param_sets_size) != 0))
+	{
+		// can't go into the same file as what is buffered
+		while(recorder->writer.ring_head)
+		{
+			RecorderPacket *p = recorder->writer.ring_head;
+			recorder->writer.ring_head = p->next;
+			recorder_packet_free(recorder, p);
+		}
+		recorder->writer.ring_tail = NULL;
+		recorder->writer.ring_bytes = 0;
+	}
+
+	packet->next = NULL;
+	if(recorder->writer.ring_tail)
+		recorder->writer.ring_tail->next = packet;
+	else
+		recorder->writer.ring_head = packet;
+	recorder->writer.ring_tail = packet;
+	recorder->writer.ring_bytes += packet->size;
+	recorder_ring_trim(recorder);
+}
+
+static void recorder_ring_save(ChiakiRecorder *recorder, const char *path)
+{
+	RecorderPacket *head = recorder->writer.ring_head;
+	if(!head)
+	{
+		CHIAKI_LOGW(recorder->log, "Recorder has nothing buffered to save yet");
+		recorder->writer.stats.errors++;
+		return;
+	}
+	RecorderFile file;
+	if(!recorder_file_open(recorder, &file, path, head->pts_us, head->param_sets, head->param_sets_size))
+		return;
+	bool corrupt = false;
+	for(RecorderPacket *p = head; p; p = p->next)
+	{
+		if(p->type == RECORDER_PACKET_VIDEO)
+		{
+			if(p->key)
+				corrupt = false;
+			else if(p->discontinuity && !p->recovered)
+				corrupt = true;
+		}
+		recorder_file_write(recorder, &file, p, corrupt && p->type == RECORDER_PACKET_VIDEO);
+	}
+	recorder_file_close(recorder, &file);
+}
+
+/**
+ * Takes ownership of packet.
+ */
+static void recorder_process(ChiakiRecorder *recorder, RecorderPacket *packet)
+{
+	if(packet->type == RECORDER_PACKET_AUDIO_HEADER)
+	{
+		memcpy(&recorder->writer.audio_header, packet->data, sizeof(ChiakiAudioHeader));
+		recorder->writer.audio_header_valid = true;
+		recorder_packet_free(recorder, packet);
+		return;
+	}
+
+	if(packet->type == RECORDER_PACKET_VIDEO)
+	{
+		bool vcl;
+		uint8_t param_sets[CHIAKI_RECORDER_PARAM_SETS_MAX];
+		size_t param_sets_size;
+		recorder_scan(recorder->settings.codec, packet->data, packet->size, &vcl, &packet->key, param_sets, &param_sets_size);
+		if(param_sets_size)
+		{
+			memcpy(recorder->writer.param_sets, param_sets, param_sets_size);
+			recorder->writer.param_sets_size = param_sets_size;
+		}
+		if(!vcl)
+		{
+			// only parameter sets, like the stream header at the start
+			recorder_packet_free(recorder, packet);
+			return;
+		}
+		if(packet->key)
+			recorder->writer.corrupt = false;
+		else if(packet->discontinuity && !packet->recovered)
+			recorder->writer.corrupt = true;
+	}
+
+	if(recorder->settings.buffer_ms)
+	{
+		if(packet->type == RECORDER_PACKET_VIDEO && packet->key)
+		{
+			packet->param_sets = malloc(recorder->writer.param_sets_size);
+			if(packet->param_sets)
+			{
+				memcpy(packet->param_sets, recorder->writer.param_sets, recorder->writer.param_sets_size);
+				packet->param_sets_size = recorder->writer.param_sets_size;
+			}
+		}
+		recorder_ring_push(recorder, packet);
+		return;
+	}
+
+	RecorderFile *file = recorder->writer.file;
+	if(packet->type == RECORDER_PACKET_VIDEO && packet->key)
+	{
+		int64_t rotate_us = (int64_t)recorder->settings.rotate_ms * 1000;
+		bool param_sets_changed = file->fmt && recorder_param_sets_differ(file, recorder->writer.param_sets, recorder->writer.param_sets_size);
+		if(!file->fmt || param_sets_changed || (rotate_us && packet->pts_us - file->start_us >= rotate_us))
+		{
+			if(param_sets_changed)
+				CHIAKI_LOGI(recorder->log, "Recorder starting a new file for changed parameter sets");
+			bool rotating = file->fmt || recorder->writer.file_index > 0;
+			recorder_file_close(recorder, file);
+			char *path = NULL;
+			if(rotating || rotate_us)
+				path = recorder_segment_path(recorder->settings.path, recorder->writer.file_index);
+			recorder->writer.file_index++;
+			recorder_file_open(recorder, file, path ? path : recorder->settings.path, packet->pts_us,
+					recorder->writer.param_sets, recorder->writer.param_sets_size);
+			free(path);
+		}
+	}
+
+	if(!file->fmt)
+	{
+		if(packet->type == RECORDER_PACKET_VIDEO)
+			recorder->writer.stats.packets_dropped++;
+	}
+	else
+		recorder_file_write(recorder, file, packet, packet->type == RECORDER_PACKET_VIDEO && recorder->writer.corrupt);
+	recorder_packet_free(recorder, packet);
+}
+
+/**
+ * Hand what the writer counted over to the stats, with the mutex held.
+ */
+static void recorder_stats_merge(ChiakiRecorder *recorder)
+{
+	ChiakiRecorderStats *w = &recorder->writer.stats;
+	recorder->stats.video_packets += w->video_packets;
+	recorder->stats.audio_packets += w->audio_packets;
+	recorder->stats.packets_dropped += w->packets_dropped;
+	recorder->stats.frames_corrupt += w->frames_corrupt;
+	recorder->stats.files_written += w->files_written;
+	recorder->stats.errors += w->errors;
+	memset(w, 0, sizeof(*w));
+}
+
+static void *recorder_thread_func(void *user)
+{
+	ChiakiRecorder *recorder = user;
+	RecorderFile file = { 0 };
+	recorder->writer.file = &file;
+
+	chiaki_mutex_lock(&recorder->mutex);
+	while(true)
+	{
+		while(!recorder->should_stop && !recorder->queue_head && !recorder->save_path)
+			chiaki_cond_wait(&recorder->cond, &recorder->mutex);
+
+		RecorderPacket *queue = recorder->queue_head;
+		recorder->queue_head = NULL;
+		recorder->queue_tail = NULL;
+		char *save_path = recorder->save_path;
+		recorder->save_path = NULL;
+		bool stop = recorder->should_stop;
+		chiaki_mutex_unlock(&recorder->mutex);
+
+		while(queue)
+		{
+			RecorderPacket *next = queue->next;
+			recorder_process(recorder, queue);
+			queue = next;
+		}
+		if(save_path)
+		{
+			recorder_ring_save(recorder, save_path);
+			free(save_path);
+		}
+		if(stop)
+			recorder_file_close(recorder, &file);
+
+		chiaki_mutex_lock(&recorder->mutex);
+		recorder->bytes -= recorder->writer.bytes_freed;
+		recorder->writer.bytes_freed = 0;
+		recorder_stats_merge(recorder);
+		if(stop)
+			break;
+	}
+	chiaki_mutex_unlock(&recorder->mutex);
+
+	while(recorder->writer.ring_head)
+	{
+		RecorderPacket *p = recorder->writer.ring_head;
+		recorder->writer.ring_head = p->next;
+		recorder_packet_free(recorder, p);
+	}
+	recorder->writer.ring_tail = NULL;
+	recorder->writer.file = NULL;
+	return NULL;
+}
@@ -280,25 +280,24 @@ static void *regist_thread_func(void *user)
 	if(psn)
 	{
 		CHIAKI_LOGI(regist->log, "REGIST - Starting RUDP session");
-		RudpMessage message;
-		err = chiaki_rudp_send_recv(regist->info.rudp, &message, NULL, 0, 0, INIT_REQUEST, INIT_RESPONSE, 8, 3);
+		ChiakiRudpDatagram datagram;
+		RudpMessage *message;
+		err = chiaki_rudp_send_recv(regist->info.rudp, &datagram, &message, NULL, 0, 0, INIT_REQUEST, INIT_RESPONSE, 8, 3);
 		if(err != CHIAKI_ERR_SUCCESS)
 		{
 			CHIAKI_LOGE(regist->log, "REGIST - Failed to init rudp");
 			goto fail;
 		}
-		size_t init_response_size = message.data_size - 8;
+		size_t init_response_size = message->data_size - 8;
 		uint8_t init_response[init_response_size];
-		memcpy(init_response, message.data + 8, init_response_size);
-		chiaki_rudp_message_pointers_free(&message);
-		err = chiaki_rudp_send_recv(regist->info.rudp, &message, init_response, init_response_size, 0, COOKIE_REQUEST, COOKIE_RESPONSE, 2, 3);
+		memcpy(init_response, message->data + 8, init_response_size);
+		err = chiaki_rudp_send_recv(regist->info.rudp, &datagram, &message, init_response, init_response_size, 0, COOKIE_REQUEST, COOKIE_RESPONSE, 2, 3);
 		if(err != CHIAKI_ERR_SUCCESS)
 		{
 			CHIAKI_LOGE(regist->log, "REGIST - Failed to pass rudp cookie");
 			goto fail;
 		}
-		remote_counter = message.remote_counter;
-		chiaki_rudp_message_pointers_free(&message);
+		remote_counter = message->remote_counter;
 	}
 	else
 	{
@@ -693,12 +692,11 @@ static ChiakiErrorCode regist_recv_response(ChiakiRegist *regist, ChiakiRegister
 
 	if(regist->info.holepunch_info)
 	{
-		RudpMessage message;
-		err = chiaki_rudp_send_recv(regist->info.rudp, &message, NULL, 0, remote_counter, ACK, FINISH, 0, 3);
+		ChiakiRudpDatagram datagram;
+		RudpMessage *message;
+		err = chiaki_rudp_send_recv(regist->info.rudp, &datagram, &message, NULL, 0, remote_counter, ACK, FINISH, 0, 3);
 		if(err != CHIAKI_ERR_SUCCESS)
 			CHIAKI_LOGW(regist->log, "REGIST - Failed to finish rudp, continuing...");
-		else
-			chiaki_rudp_message_pointers_free(&message);
 	}
 
 	CHIAKI_LOGV(regist->log, "Regist response HTTP header:");
@@ -38,7 +38,6 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <net/if.h>
-#include <poll.h>
 #else
 #include <unistd.h>
 #include <netinet/in.h>
@@ -51,9 +50,6 @@
 #endif
 
 #include <curl/curl.h>
-#if !defined(__SWITCH__) && !defined(__ANDROID__)
-#include <event2/event.h>
-#endif
 #include <json-c/json_object.h>
 #include <json-c/json_tokener.h>
 #include <json-c/json_pointer.h>
@@ -62,6 +58,8 @@
 #include <miniupnpc/upnperrors.h>
 
 #include <chiaki/remote/holepunch.h>
+#include <chiaki/remote/httpclient.h>
+#include <chiaki/remote/portguess.h>
 #include <chiaki/stoppipe.h>
 #include <chiaki/thread.h>
 #include <chiaki/base64.h>
@@ -91,6 +89,9 @@
 #define MSG_TYPE_REQ 0x06000000
 #define MSG_TYPE_RESP 0x07000000
 #define EXTRA_CANDIDATE_ADDRESSES 3
+#define NAT_PROBING_TTL 2
+#define CHECK_CANDIDATES_WINDOW_INITIAL 16
+#define CHECK_CANDIDATES_WINDOW_MAX 128
 #define ENABLE_IPV6 false
 
 static const char oauth_header_fmt[] = "Authorization: Bearer %s";
@@ -193,9 +194,12 @@ typedef enum notification_type_t
     NOTIFICATION_TYPE_SESSION_DELETED = 1 << 5
 } NotificationType;
 
+#define NOTIFICATION_TYPE_SLOTS 7 // NOTIFICATION_TYPE_UNKNOWN + one per type bit
+
 typedef struct notification_t
 {
     struct notification_t *next;
+    uint64_t seq; // order of arrival over all types
 
     NotificationType type;
     json_object* json;
@@ -203,10 +207,17 @@ typedef struct notification_t
     size_t json_buf_size;
 } Notification;
 
+/**
+ * Notifications are queued in one FIFO per type, so waiting for some types
+ * only looks at the front of their queues instead of walking past all others.
+ */
 typedef struct notification_queue_t
 {
-    Notification *front, *rear;
-
+    struct
+    {
+        Notification *front, *rear;
+    } types[NOTIFICATION_TYPE_SLOTS];
+    uint64_t next_seq;
 } NotificationQueue;
 
 typedef enum session_state_t
@@ -254,12 +265,6 @@ typedef enum session_message_action_t
     SESSION_MESSAGE_ACTION_TERMINATE = 1 << 4,
 } SessionMessageAction;
 
-typedef struct http_response_data_t
-{
-    char* data;
-    size_t size;
-} HttpResponseData;
-
 typedef enum candidate_type_t
 {
     CANDIDATE_TYPE_STATIC = 0,
@@ -336,6 +341,24 @@ typedef struct session_t
     UPNPGatewayStatus gw_status;
     ChiakiThread upnp_thread;
     bool upnp_thread_running;
+    bool upnp_thread_joinable;
+    uint64_t upnp_discover_started_ms;
+
+    // STUN for the control offer, run alongside UPnP discovery and PSN session creation
+    ChiakiThread stun_prefetch_thread;
+    bool stun_prefetch_started;
+    bool stun_prefetch_ok;
+    uint16_t stun_prefetch_local_port;
+    char stun_prefetch_addr[INET6_ADDRSTRLEN];
+    uint16_t stun_prefetch_port;
+
+    ChiakiNetworkPathCache *path_cache;
+    ChiakiNetworkPath path;
+    bool path_cached;
+    ChiakiThread path_refresh_thread;
+    bool path_refresh_started;
+    ChiakiNetworkPathUpnp path_refresh_upnp;
+    char path_refresh_upnp_url[CHIAKI_NETWORK_PATH_URL_SIZE];
 
     uint8_t data1[16];
     uint8_t data2[16];
@@ -344,7 +367,7 @@ typedef struct session_t
     uint16_t ctrl_port;
     char client_local_ip[INET6_ADDRSTRLEN];
 
-    CURLSH* curl_share;
+    ChiakiHttpClient *http;
 
     char* ws_fqdn;
     ChiakiThread ws_thread;
@@ -378,8 +401,6 @@ static ChiakiErrorCode make_oauth2_header(char** out, const char* token);
 static ChiakiErrorCode make_session_id_header(char ** out, const char* session_id);
 static ChiakiErrorCode get_websocket_fqdn(
     Session *session, char **fqdn);
-static inline size_t curl_write_cb(
-    void* ptr, size_t size, size_t nmemb, void* userdata);
 static ChiakiErrorCode hex_to_bytes(const char* hex_str, uint8_t* bytes, size_t max_len);
 static void bytes_to_hex(const uint8_t* bytes, size_t len, char* hex_str, size_t max_len);
 static void random_uuidv4(char* out);
@@ -394,10 +415,13 @@ static ChiakiErrorCode http_send_session_message(Session *session, SessionMessag
 static ChiakiErrorCode http_ps4_session_wakeup(Session *session);
 static ChiakiErrorCode get_client_addr_local(Session *session, Candidate *local_console_candidate, char *out, size_t out_len);
 static ChiakiErrorCode upnp_get_gateway_info(ChiakiLog *log, UPNPGatewayInfo *info);
+static ChiakiErrorCode upnp_get_gateway_info_from_url(ChiakiLog *log, const char *url, UPNPGatewayInfo *info);
 static bool get_client_addr_remote_upnp(ChiakiLog *log, UPNPGatewayInfo *gw_info, char *out);
 static bool upnp_add_udp_port_mapping(ChiakiLog *log, UPNPGatewayInfo *gw_info, uint16_t port_internal, uint16_t port_external);
 static bool upnp_delete_udp_port_mapping(ChiakiLog *log, UPNPGatewayInfo *gw_info, uint16_t port_external);
 static bool get_client_addr_remote_stun(Session *session, char *address, uint16_t *port, chiaki_socket_t *sock, bool ipv4);
+static ChiakiErrorCode offer_sockets_open(Session *session, uint16_t *local_port);
+static void offer_sockets_close(Session *session);
 static ChiakiErrorCode get_stun_servers(Session *session);
 // static bool get_mac_addr(ChiakiLog *log, uint8_t *mac_addr);
 static void log_session_state(Session *session);
@@ -415,8 +439,10 @@ static ChiakiErrorCode clear_notification(
     Session *session, Notification *notification);
 static void notification_queue_free(NotificationQueue* queue);
 static NotificationQueue *createNq();
-static void dequeueNq(NotificationQueue *nq);
 static void enqueueNq(NotificationQueue *nq, Notification *notif);
+static Notification *notification_queue_find(NotificationQueue *nq, uint16_t types);
+static size_t notification_type_slot(NotificationType type);
+static void notification_free(Notification *notif);
 static Notification* newNotification(NotificationType type, json_object *json, char* json_buf, size_t json_buf_size);
 static void remove_substring(char *str, char *substring);
 
@@ -447,81 +473,51 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_list_devices(
     ChiakiHolepunchDeviceInfo **devices, size_t *device_count,
     ChiakiLog *log)
 {
-    CURL *curl = curl_easy_init();
-    if(!curl)
-    {
-        CHIAKI_LOGE(log, "Curl could not init");
-        return CHIAKI_ERR_MEMORY;
-    }
     char url[133];
     char platform[4];
     if (console_type != CHIAKI_HOLEPUNCH_CONSOLE_TYPE_PS5) {
         CHIAKI_LOGW(log, "Only PS5 is supported by the list devices function!");
-        curl_easy_cleanup(curl);
         return CHIAKI_ERR_INVALID_DATA;
     }
     snprintf(platform, sizeof(platform), "%s", "PS5");
     snprintf(url, sizeof(url), device_list_url_fmt, platform);
 
+    ChiakiHttpClient *http = chiaki_http_client_new(log);
+    if(!http)
+    {
+        CHIAKI_LOGE(log, "HTTP client could not init");
+        return CHIAKI_ERR_MEMORY;
+    }
     char* oauth_header = NULL;
     ChiakiErrorCode err = make_oauth2_header(&oauth_header, psn_oauth2_token);
     if(err != CHIAKI_ERR_SUCCESS)
     {
-        curl_easy_cleanup(curl);
+        chiaki_http_client_free(http);
         return err;
     }
 
-    HttpResponseData response_data = {
-        .data = malloc(0),
-        .size = 0,
+    const char *headers[] = { "Accept-Language: jp", oauth_header, NULL };
+    ChiakiHttpRequest req = {
+        .url = url,
+        .headers = headers,
+        .timeout_sec = 5,
     };
-
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Accept-Language: jp");
-    headers = curl_slist_append(headers, oauth_header);
-
-    CURLcode res = curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(log, "chiaki_holepunch_list_devices: CURL setopt CURLOPT_FAILONERROR failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, 5L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(log, "chiaki_holepunch_list_devices: CURL setopt CURLOPT_TIMEOUT failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_URL, url);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(log, "chiaki_holepunch_list_devices: CURL setopt CURLOPT_URL failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(log, "chiaki_holepunch_list_devices: CURL setopt CURLOPT_HTTPHEADER failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(log, "chiaki_holepunch_list_devices: CURL setopt CURLOPT_WRITEFUNCTION failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&response_data);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(log, "chiaki_holepunch_list_devices: CURL setopt CURLOPT_WRITEDATA failed with CURL error %s", curl_easy_strerror(res));
-
-    res = curl_easy_perform(curl);
-    curl_slist_free_all(headers);
-    if (res != CURLE_OK)
+    err = chiaki_http_client_perform(http, &req);
+    if (err != CHIAKI_ERR_SUCCESS)
     {
-        if (res == CURLE_HTTP_RETURNED_ERROR)
+        if (err == CHIAKI_ERR_HTTP_NONOK)
         {
-            long http_code = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-            CHIAKI_LOGE(log, "chiaki_holepunch_list_devices: Fetching device list from %s failed with HTTP code %ld", url, http_code);
-            CHIAKI_LOGV(log, "Response Body: %.*s.", (int)response_data.size, response_data.data);
-            err = CHIAKI_ERR_HTTP_NONOK;
+            CHIAKI_LOGE(log, "chiaki_holepunch_list_devices: Fetching device list from %s failed with HTTP code %ld", url, req.http_code);
+            CHIAKI_LOGV(log, "Response Body: %.*s.", (int)req.response_size, req.response);
         } else {
-            CHIAKI_LOGE(log, "chiaki_holepunch_list_devices: Fetching device list from %s failed with CURL error %s", url, curl_easy_strerror(res));
-            err = CHIAKI_ERR_NETWORK;
+            CHIAKI_LOGE(log, "chiaki_holepunch_list_devices: Fetching device list from %s failed with error %s", url, req.error ? req.error : chiaki_error_string(err));
         }
         goto cleanup;
     }
 
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    if (http_code != 200)
+    if (req.http_code != 200)
     {
-        CHIAKI_LOGE(log, "chiaki_holepunch_list_devices: Fetching device list from %s failed with HTTP code %ld", url, http_code);
+        CHIAKI_LOGE(log, "chiaki_holepunch_list_devices: Fetching device list from %s failed with HTTP code %ld", url, req.http_code);
         err = CHIAKI_ERR_HTTP_NONOK;
         goto cleanup;
     }
@@ -531,7 +527,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_list_devices(
         CHIAKI_LOGE(log, "Couldn't create new json tokener");
         goto cleanup;
     }
-    json_object *json = json_tokener_parse_ex(tok, response_data.data, response_data.size);
+    json_object *json = json_tokener_parse_ex(tok, req.response, req.response_size);
     if (json == NULL)
     {
         CHIAKI_LOGE(log, "chiaki_holepunch_list_devices: Parsing JSON failed");
@@ -650,8 +646,8 @@ cleanup_json_tokener:
     json_tokener_free(tok);
 cleanup:
     free(oauth_header);
-    free(response_data.data);
-    curl_easy_cleanup(curl);
+    chiaki_http_request_fini(&req);
+    chiaki_http_client_free(http);
     return err;
 }
 
@@ -774,6 +770,15 @@ CHIAKI_EXPORT Session* chiaki_holepunch_session_init(
     session->gw.data = NULL;
     session->gw_status = GATEWAY_STATUS_UNKNOWN;
     session->upnp_thread_running = false;
+    session->upnp_thread_joinable = false;
+    session->upnp_discover_started_ms = 0;
+    session->stun_prefetch_started = false;
+    session->stun_prefetch_ok = false;
+    session->path_cache = NULL;
+    memset(&session->path, 0, sizeof(session->path));
+    session->path_cached = false;
+    session->path_refresh_started = false;
+    session->path_refresh_upnp = CHIAKI_NETWORK_PATH_UPNP_UNKNOWN;
 
     ChiakiErrorCode err;
     err = chiaki_mutex_init(&session->notif_mutex, false);
@@ -791,8 +796,8 @@ CHIAKI_EXPORT Session* chiaki_holepunch_session_init(
     err = chiaki_cond_init(&session->state_cond);
     assert(err == CHIAKI_ERR_SUCCESS);
 
-    session->curl_share = curl_share_init();
-    assert(session->curl_share != NULL);
+    session->http = chiaki_http_client_new(session->log);
+    assert(session->http != NULL);
 
     chiaki_mutex_lock(&session->stop_mutex);
     session->main_should_stop = false;
@@ -813,12 +818,88 @@ CHIAKI_EXPORT Session* chiaki_holepunch_session_init(
     return session;
 }
 
+CHIAKI_EXPORT void chiaki_holepunch_session_set_path_cache(Session *session, ChiakiNetworkPathCache *cache)
+{
+    session->path_cache = cache;
+    memset(&session->path, 0, sizeof(session->path));
+    session->path_cached = false;
+    if(!cache)
+        return;
+    if(chiaki_network_identity(session->log, session->path.network_id) != CHIAKI_ERR_SUCCESS)
+    {
+        // can't tell networks apart, so nothing may be cached
+        session->path_cache = NULL;
+        return;
+    }
+    session->path_cached = chiaki_network_path_cache_lookup(cache, session->path.network_id, CHIAKI_NETWORK_PATH_MAX_AGE_SEC, &session->path);
+    if(session->path_cached)
+        CHIAKI_LOGI(session->log, "Using cached network path for network %s", session->path.network_id);
+    else
+        CHIAKI_LOGI(session->log, "No cached network path for network %s", session->path.network_id);
+}
+
+static void path_record_upnp(Session *session)
+{
+    if(session->gw_status == GATEWAY_STATUS_FOUND && session->gw.urls && session->gw.urls->rootdescURL)
+    {
+        session->path.upnp = CHIAKI_NETWORK_PATH_UPNP_FOUND;
+        snprintf(session->path.upnp_root_desc_url, sizeof(session->path.upnp_root_desc_url), "%s", session->gw.urls->rootdescURL);
+    }
+    else if(session->gw_status == GATEWAY_STATUS_NOT_FOUND)
+    {
+        session->path.upnp = CHIAKI_NETWORK_PATH_UPNP_NONE;
+        session->path.upnp_root_desc_url[0] = '\0';
+    }
+}
+
+/**
+ * Redo the discovery the cache allowed us to skip, so a gateway that appeared since is used next time.
+ * Only records the result, the session itself continues without UPnP.
+ */
+static void *path_refresh_thread_func(void *arg)
+{
+    Session *session = (Session *)arg;
+    UPNPGatewayInfo gw;
+    memset(&gw, 0, sizeof(gw));
+    gw.data = calloc(1, sizeof(struct IGDdatas));
+    gw.urls = calloc(1, sizeof(struct UPNPUrls));
+    if(gw.data && gw.urls)
+    {
+        if(upnp_get_gateway_info(session->log, &gw) == CHIAKI_ERR_SUCCESS && gw.urls->rootdescURL)
+        {
+            session->path_refresh_upnp = CHIAKI_NETWORK_PATH_UPNP_FOUND;
+            snprintf(session->path_refresh_upnp_url, sizeof(session->path_refresh_upnp_url), "%s", gw.urls->rootdescURL);
+        }
+        else
+            session->path_refresh_upnp = CHIAKI_NETWORK_PATH_UPNP_NONE;
+        FreeUPNPUrls(gw.urls);
+    }
+    free(gw.data);
+    free(gw.urls);
+    return NULL;
+}
+
 #define UPNP_DISCOVER_TIMEOUT_MS 7000
 
 static void *upnp_discover_thread_func(void *arg)
 {
     Session *session = (Session *)arg;
-    ChiakiErrorCode err = upnp_get_gateway_info(session->log, &session->gw);
+    ChiakiErrorCode err = CHIAKI_ERR_NETWORK;
+    if(session->path_cached && session->path.upnp == CHIAKI_NETWORK_PATH_UPNP_FOUND)
+    {
+        err = upnp_get_gateway_info_from_url(session->log, session->path.upnp_root_desc_url, &session->gw);
+        if(err == CHIAKI_ERR_SUCCESS)
+            CHIAKI_LOGI(session->log, "Using cached UPnP gateway %s", session->path.upnp_root_desc_url);
+        else
+        {
+            CHIAKI_LOGI(session->log, "Cached UPnP gateway is gone, discovering");
+            FreeUPNPUrls(session->gw.urls);
+            memset(session->gw.urls, 0, sizeof(struct UPNPUrls));
+            memset(session->gw.data, 0, sizeof(struct IGDdatas));
+        }
+    }
+    if(err != CHIAKI_ERR_SUCCESS)
+        err = upnp_get_gateway_info(session->log, &session->gw);
 
     chiaki_mutex_lock(&session->state_mutex);
     if (err == CHIAKI_ERR_SUCCESS)
@@ -837,8 +918,81 @@ static void *upnp_discover_thread_func(void *arg)
     return NULL;
 }
 
+static void *stun_prefetch_thread_func(void *arg)
+{
+    Session *session = (Session *)arg;
+    session->stun_prefetch_ok = get_client_addr_remote_stun(
+        session, session->stun_prefetch_addr, &session->stun_prefetch_port, &session->ipv4_sock, true);
+    return NULL;
+}
+
+/**
+ * Open the sockets for the control offer now and run STUN on them in the background,
+ * so the round trips to the STUN servers overlap with UPnP discovery and PSN session creation.
+ */
+static void stun_prefetch_start(Session *session)
+{
+    if(!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock) || session->local_port_ctrl != 0)
+        return;
+    if(offer_sockets_open(session, &session->stun_prefetch_local_port) != CHIAKI_ERR_SUCCESS)
+        return;
+    if(chiaki_thread_create(&session->stun_prefetch_thread, stun_prefetch_thread_func, session) != CHIAKI_ERR_SUCCESS)
+    {
+        CHIAKI_LOGW(session->log, "Failed to create STUN thread, running STUN with the offer");
+        offer_sockets_close(session);
+        return;
+    }
+    session->stun_prefetch_started = true;
+}
+
+/**
+ * Wait for the discovery started by chiaki_holepunch_upnp_discover(),
+ * giving up UPNP_DISCOVER_TIMEOUT_MS after it was started.
+ */
+static void upnp_discover_wait(Session *session)
+{
+    if(!session->upnp_thread_joinable)
+        return;
+    uint64_t deadline = session->upnp_discover_started_ms + UPNP_DISCOVER_TIMEOUT_MS;
+    chiaki_mutex_lock(&session->state_mutex);
+    while(session->upnp_thread_running)
+    {
+        uint64_t now = chiaki_time_now_monotonic_ms();
+        if(now >= deadline)
+            break;
+        chiaki_cond_timedwait(&session->state_cond, &session->state_mutex, deadline - now);
+    }
+
+    if(session->upnp_thread_running)
+    {
+        // leave the thread to finish on its own, it is joined in fini
+        session->gw_status = GATEWAY_STATUS_NOT_FOUND;
+        chiaki_mutex_unlock(&session->state_mutex);
+        CHIAKI_LOGW(session->log, "UPnP discovery timed out after %d ms, skipping", UPNP_DISCOVER_TIMEOUT_MS);
+        return;
+    }
+    chiaki_mutex_unlock(&session->state_mutex);
+
+    chiaki_thread_join(&session->upnp_thread, NULL);
+    session->upnp_thread_joinable = false;
+    CHIAKI_LOGV(session->log, "UPnP discovery finished %" PRIu64 " ms after it was started",
+        chiaki_time_now_monotonic_ms() - session->upnp_discover_started_ms);
+    path_record_upnp(session);
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_upnp_discover(Session *session)
 {
+    stun_prefetch_start(session);
+
+    if(session->path_cached && session->path.upnp == CHIAKI_NETWORK_PATH_UPNP_NONE)
+    {
+        CHIAKI_LOGI(session->log, "No UPnP gateway on this network last time, skipping discovery");
+        session->gw_status = GATEWAY_STATUS_NOT_FOUND;
+        if(chiaki_thread_create(&session->path_refresh_thread, path_refresh_thread_func, session) == CHIAKI_ERR_SUCCESS)
+            session->path_refresh_started = true;
+        return CHIAKI_ERR_SUCCESS;
+    }
+
     session->gw.data = calloc(1, sizeof(struct IGDdatas));
     if(!session->gw.data)
     {
@@ -848,47 +1002,21 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_upnp_discover(Session *session)
     if(!session->gw.urls)
     {
         free(session->gw.data);
+        session->gw.data = NULL;
         return CHIAKI_ERR_MEMORY;
     }
 
     session->upnp_thread_running = true;
+    session->upnp_discover_started_ms = chiaki_time_now_monotonic_ms();
     ChiakiErrorCode err = chiaki_thread_create(&session->upnp_thread, upnp_discover_thread_func, session);
     if(err != CHIAKI_ERR_SUCCESS)
     {
         CHIAKI_LOGE(session->log, "Failed to create UPnP discovery thread, falling back to synchronous");
-        session->upnp_thread_running = false;
-        err = upnp_get_gateway_info(session->log, &session->gw);
-        if (err == CHIAKI_ERR_SUCCESS)
-            session->gw_status = GATEWAY_STATUS_FOUND;
-        else
-        {
-            session->gw_status = GATEWAY_STATUS_NOT_FOUND;
-            free(session->gw.data);
-            session->gw.data = NULL;
-            free(session->gw.urls);
-            session->gw.urls = NULL;
-        }
-        return CHIAKI_ERR_SUCCESS;
-    }
-
-    chiaki_mutex_lock(&session->state_mutex);
-    while(session->upnp_thread_running)
-    {
-        err = chiaki_cond_timedwait(&session->state_cond, &session->state_mutex, UPNP_DISCOVER_TIMEOUT_MS);
-        if(err == CHIAKI_ERR_TIMEOUT)
-            break;
-    }
-
-    if(session->upnp_thread_running)
-    {
-        chiaki_mutex_unlock(&session->state_mutex);
-        CHIAKI_LOGW(session->log, "UPnP discovery timed out after %d ms, skipping", UPNP_DISCOVER_TIMEOUT_MS);
-        session->gw_status = GATEWAY_STATUS_NOT_FOUND;
+        upnp_discover_thread_func(session);
+        path_record_upnp(session);
         return CHIAKI_ERR_SUCCESS;
     }
-    chiaki_mutex_unlock(&session->state_mutex);
-
-    chiaki_thread_join(&session->upnp_thread, NULL);
+    session->upnp_thread_joinable = true;
     return CHIAKI_ERR_SUCCESS;
 }
 
@@ -1225,63 +1353,28 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_start(
 */
 static ChiakiErrorCode http_ps4_session_wakeup(Session *session)
 {
-    HttpResponseData response_data = {
-        .data = malloc(0),
-        .size = 0,
+    const char *headers[] = {
+        session->oauth_header,
+        "Host: asm.np.community.playstation.net",
+        "Connection: Keep-Alive",
+        "Content-Type: application/json; charset=utf-8",
+        "User-Agent: RpNetHttpUtilImpl",
+        NULL
     };
-
-    CURL *curl = curl_easy_init();
-    if(!curl)
-    {
-        CHIAKI_LOGE(session->log, "Curl could not init");
-        return CHIAKI_ERR_MEMORY;
-    }
-
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, session->oauth_header);
-    headers = curl_slist_append(headers, "Host: asm.np.community.playstation.net");
-    headers = curl_slist_append(headers, "Connection: Keep-Alive");
-    headers = curl_slist_append(headers, "Content-Type: application/json; charset=utf-8");
-    headers = curl_slist_append(headers, "User-Agent: RpNetHttpUtilImpl");
-
-    CURLcode res = curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_SHARE failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_FAILONERROR failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_TIMEOUT failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_URL, user_profile_url);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_URL failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_HTTPHEADER failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_WRITEFUNCTION failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&response_data);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_WRITEDATA failed with CURL error %s", curl_easy_strerror(res));
-
-    ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
-    res = curl_easy_perform(curl);
-    curl_slist_free_all(headers);
-    CHIAKI_LOGV(session->log, "http_ps4_session_wakeup: Received JSON:\n%.*s", (int)response_data.size, response_data.data);
-    if (res != CURLE_OK)
+    ChiakiHttpRequest req = {
+        .url = user_profile_url,
+        .headers = headers,
+    };
+    ChiakiErrorCode err = chiaki_http_client_perform(session->http, &req);
+    CHIAKI_LOGV(session->log, "http_ps4_session_wakeup: Received JSON:\n%.*s", (int)req.response_size, req.response);
+    if (err != CHIAKI_ERR_SUCCESS)
     {
-        if (res == CURLE_HTTP_RETURNED_ERROR)
+        if (err == CHIAKI_ERR_HTTP_NONOK)
         {
-            long http_code = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-            CHIAKI_LOGE(session->log, "http_ps4_session_wakeup: Retrieving profile information for PS4 wakeup command failed with HTTP code %ld.", http_code);
-            CHIAKI_LOGV(session->log, "Response Body: %.*s.", (int)response_data.size, response_data.data);
-            err = CHIAKI_ERR_HTTP_NONOK;
+            CHIAKI_LOGE(session->log, "http_ps4_session_wakeup: Retrieving profile information for PS4 wakeup command failed with HTTP code %ld.", req.http_code);
+            CHIAKI_LOGV(session->log, "Response Body: %.*s.", (int)req.response_size, req.response);
         } else {
-            CHIAKI_LOGE(session->log, "http_ps4_session_wakeup: Retrieving profile information for PS4 wakeup command failed with CURL error %s", curl_easy_strerror(res));
-            err = CHIAKI_ERR_NETWORK;
+            CHIAKI_LOGE(session->log, "http_ps4_session_wakeup: Retrieving profile information for PS4 wakeup command failed with error %s", req.error ? req.error : chiaki_error_string(err));
         }
         goto cleanup;
     }
@@ -1292,7 +1385,7 @@ static ChiakiErrorCode http_ps4_session_wakeup(Session *session)
         CHIAKI_LOGE(session->log, "Couldn't create new json tokener");
         goto cleanup;
     }
-    json_object *json = json_tokener_parse_ex(tok, response_data.data, response_data.size);
+    json_object *json = json_tokener_parse_ex(tok, req.response, req.response_size);
     if (json == NULL)
     {
         CHIAKI_LOGE(session->log, "http_ps4_session_wakeup: Parsing JSON failed");
@@ -1344,11 +1437,6 @@ static ChiakiErrorCode http_ps4_session_wakeup(Session *session)
     if(!(ptr == (host_url_starter + strlen(host_url_starter))))
         strcpy(host_url, ptr);
 
-    curl_easy_cleanup(curl);
-    free(response_data.data);
-    response_data.data = malloc(0);
-    response_data.size = 0;
-    headers = NULL;
     char url[128] = {0};
     snprintf(url, sizeof(url), wakeup_url_fmt, user_profile_url, session->online_id);
 
@@ -1373,71 +1461,43 @@ static ChiakiErrorCode http_ps4_session_wakeup(Session *session)
         data2_base64,
         session->session_id);
 
-    curl = curl_easy_init();
-    if(!curl)
-    {
-        CHIAKI_LOGE(session->log, "Curl could not init");
-        json_object_put(json);
-        json_tokener_free(tok);
-        return CHIAKI_ERR_MEMORY;
-    }
-
     char host_url_string[134];
     snprintf(host_url_string, sizeof(host_url_string), "Host: %s", host_url);
-    headers = curl_slist_append(headers, session->oauth_header);
-    headers = curl_slist_append(headers, host_url_string);
-    headers = curl_slist_append(headers, "Connection: Keep-Alive");
-    headers = curl_slist_append(headers, "Content-Type: application/json; charset=utf-8");
-    headers = curl_slist_append(headers, "User-Agent: RpNetHttpUtilImpl");
-
-    res = curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_SHARE failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_FAILONERROR failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_TIMEOUT failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_URL, url);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_URL failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_HTTPHEADER failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, envelope_buf);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_POSTFIELDS failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_WRITEFUNCTION failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&response_data);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_WRITEDATA failed with CURL error %s", curl_easy_strerror(res));
+    const char *wakeup_headers[] = {
+        session->oauth_header,
+        host_url_string,
+        "Connection: Keep-Alive",
+        "Content-Type: application/json; charset=utf-8",
+        "User-Agent: RpNetHttpUtilImpl",
+        NULL
+    };
+    ChiakiHttpRequest wakeup_req = {
+        .url = url,
+        .headers = wakeup_headers,
+        .body = envelope_buf,
+        .body_size = strlen(envelope_buf),
+    };
 
     CHIAKI_LOGV(session->log, "http_ps4_session_wakeup: Sending JSON:\n%s", envelope_buf);
 
-    res = curl_easy_perform(curl);
-    curl_slist_free_all(headers);
-    CHIAKI_LOGV(session->log, "http_ps4_session_wakeup: Received JSON:\n%.*s", (int)response_data.size, response_data.data);
-    if (res != CURLE_OK)
+    err = chiaki_http_client_perform(session->http, &wakeup_req);
+    CHIAKI_LOGV(session->log, "http_ps4_session_wakeup: Received JSON:\n%.*s", (int)wakeup_req.response_size, wakeup_req.response);
+    if (err != CHIAKI_ERR_SUCCESS)
     {
-        if (res == CURLE_HTTP_RETURNED_ERROR)
+        if (err == CHIAKI_ERR_HTTP_NONOK)
         {
-            long http_code = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-            CHIAKI_LOGE(session->log, "http_ps4_session_wakeup: Waking up ps4 console failed with HTTP code %ld.", http_code);
+            CHIAKI_LOGE(session->log, "http_ps4_session_wakeup: Waking up ps4 console failed with HTTP code %ld.", wakeup_req.http_code);
             CHIAKI_LOGV(session->log, "Request Body: %s.", envelope_buf);
-            CHIAKI_LOGV(session->log, "Response Body: %.*s.", (int)response_data.size, response_data.data);
-            if(http_code == 404)
+            CHIAKI_LOGV(session->log, "Response Body: %.*s.", (int)wakeup_req.response_size, wakeup_req.response);
+            if(wakeup_req.http_code == 404)
                 CHIAKI_LOGE(session->log, "http_ps4_session_wakeup: Please make sure PS4 is registered to your account and on or in rest mode.");
-            err = CHIAKI_ERR_HTTP_NONOK;
         } else {
-            CHIAKI_LOGE(session->log, "http_ps4_session_wakeup: Waking up ps4 console failed with CURL error %s", curl_easy_strerror(res));
-            err = CHIAKI_ERR_NETWORK;
+            CHIAKI_LOGE(session->log, "http_ps4_session_wakeup: Waking up ps4 console failed with error %s", wakeup_req.error ? wakeup_req.error : chiaki_error_string(err));
         }
+        chiaki_http_request_fini(&wakeup_req);
         goto cleanup_json;
     }
+    chiaki_http_request_fini(&wakeup_req);
 
     chiaki_mutex_lock(&session->state_mutex);
     session->state |= SESSION_STATE_DATA_SENT;
@@ -1449,12 +1509,45 @@ cleanup_json:
 cleanup_json_tokener:
     json_tokener_free(tok);
 cleanup:
-    curl_easy_cleanup(curl);
-    free(response_data.data);
+    chiaki_http_request_fini(&req);
 
     return err;
 }
 
+/**
+ * Move the candidate the console was reached at last time to the front, so it is probed first.
+ */
+static void path_prefer_candidate(Session *session, Candidate *candidates, size_t num_candidates)
+{
+    if(!session->path_cached || !session->path.console_uid[0])
+        return;
+    char console_uid[CHIAKI_NETWORK_PATH_CONSOLE_UID_SIZE];
+    bytes_to_hex(session->console_uid, sizeof(session->console_uid), console_uid, sizeof(console_uid));
+    if(strcmp(console_uid, session->path.console_uid) != 0)
+        return;
+    for(size_t i = 0; i < num_candidates; i++)
+    {
+        if((int)candidates[i].type != session->path.candidate_type || strcmp(candidates[i].addr, session->path.candidate_addr) != 0)
+            continue;
+        if(i > 0)
+        {
+            Candidate preferred = candidates[i];
+            memmove(&candidates[1], &candidates[0], i * sizeof(Candidate));
+            candidates[0] = preferred;
+        }
+        CHIAKI_LOGI(session->log, "Trying cached candidate %s:%d first", candidates[0].addr, candidates[0].port);
+        return;
+    }
+}
+
+static void path_record_candidate(Session *session, Candidate *candidate)
+{
+    bytes_to_hex(session->console_uid, sizeof(session->console_uid), session->path.console_uid, sizeof(session->path.console_uid));
+    session->path.candidate_type = candidate->type;
+    snprintf(session->path.candidate_addr, sizeof(session->path.candidate_addr), "%s", candidate->addr);
+    session->path.candidate_port = candidate->port;
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_punch_hole(Session* session, ChiakiHolepunchPortType port_type)
 {
     ChiakiErrorCode err;
@@ -1563,6 +1656,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_punch_hole(Session* sessi
     {
         print_candidate(session->log, &console_req->candidates[i]);
     }
+    path_prefer_candidate(session, console_req->candidates, console_req->num_candidates);
     Candidate selected_candidate;
     err = check_candidates(session, session->local_candidates, console_req->candidates, console_req->num_candidates, &sock, &selected_candidate);
     if (err != CHIAKI_ERR_SUCCESS)
@@ -1651,6 +1745,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_punch_hole(Session* sessi
         session->state |= SESSION_STATE_CTRL_ESTABLISHED;
         session->ctrl_sock = sock;
         session->ctrl_port = selected_candidate.port;
+        path_record_candidate(session, &selected_candidate);
         CHIAKI_LOGV(session->log, "chiaki_holepunch_session_punch_holes: Control connection established.");
     }
     else
@@ -1778,12 +1873,37 @@ CHIAKI_EXPORT void chiaki_holepunch_session_fini(Session* session)
         chiaki_stop_pipe_stop(&session->select_pipe);
         chiaki_thread_join(&session->ws_thread, NULL);
     }
-    if(session->upnp_thread_running)
+    if(session->upnp_thread_joinable)
     {
         CHIAKI_LOGI(session->log, "Waiting for UPnP discovery thread to finish...");
         chiaki_thread_join(&session->upnp_thread, NULL);
+        session->upnp_thread_joinable = false;
         session->upnp_thread_running = false;
     }
+    if(session->stun_prefetch_started)
+    {
+        // no offer was created, so the sockets STUN ran on are still ours
+        chiaki_thread_join(&session->stun_prefetch_thread, NULL);
+        session->stun_prefetch_started = false;
+        offer_sockets_close(session);
+    }
+    if(session->path_refresh_started)
+    {
+        chiaki_thread_join(&session->path_refresh_thread, NULL);
+        session->path_refresh_started = false;
+        if(session->path_refresh_upnp != CHIAKI_NETWORK_PATH_UPNP_UNKNOWN)
+        {
+            session->path.upnp = session->path_refresh_upnp;
+            snprintf(session->path.upnp_root_desc_url, sizeof(session->path.upnp_root_desc_url), "%s",
+                session->path_refresh_upnp == CHIAKI_NETWORK_PATH_UPNP_FOUND ? session->path_refresh_upnp_url : "");
+        }
+    }
+    // only networks we actually got a connection through are worth remembering
+    if(session->path_cache && session->path.console_uid[0])
+    {
+        chiaki_network_path_cache_store(session->path_cache, &session->path);
+        chiaki_network_path_cache_save(session->path_cache);
+    }
     if(session->gw.data)
     {
         if(session->local_port_ctrl != 0)
@@ -1809,8 +1929,8 @@ CHIAKI_EXPORT void chiaki_holepunch_session_fini(Session* session)
         free(session->session_id_header);
     if (session->online_id)
         free(session->online_id);
-    if (session->curl_share)
-        curl_share_cleanup(session->curl_share);
+    if (session->http)
+        chiaki_http_client_free(session->http);
     if (session->ws_fqdn)
         free(session->ws_fqdn);
     if (session->ws_notification_queue)
@@ -1853,9 +1973,15 @@ CHIAKI_EXPORT void chiaki_holepunch_main_thread_cancel(Session *session, bool st
 
 void notification_queue_free(NotificationQueue *nq)
 {
-    while(nq->front != NULL)
+    for(size_t slot = 0; slot < NOTIFICATION_TYPE_SLOTS; slot++)
     {
-        dequeueNq(nq);
+        while(nq->types[slot].front != NULL)
+        {
+            Notification *notif = nq->types[slot].front;
+            nq->types[slot].front = notif->next;
+            notification_free(notif);
+        }
+        nq->types[slot].rear = NULL;
     }
 }
 
@@ -1890,57 +2016,18 @@ static ChiakiErrorCode make_session_id_header(char **out, const char* session_id
 */
 static ChiakiErrorCode get_websocket_fqdn(Session *session, char **fqdn)
 {
-    HttpResponseData response_data = {
-        .data = malloc(0),
-        .size = 0,
+    const char *headers[] = { session->oauth_header, NULL };
+    ChiakiHttpRequest req = {
+        .url = ws_fqdn_api_url,
+        .headers = headers,
     };
-
-    CURL *curl = curl_easy_init();
-    if(!curl)
-    {
-        CHIAKI_LOGE(session->log, "Curl could not init");
-        return CHIAKI_ERR_MEMORY;
-    }
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, session->oauth_header);
-
-    CURLcode res = curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_websocket_fqdn: CURL setopt CURLOPT_SHARE failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_websocket_fqdn: CURL setopt CURLOPT_FAILONERROR failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_websocket_fqdn: CURL setopt CURLOPT_TIMEOUT failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_URL, ws_fqdn_api_url);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_websocket_fqdn: CURL setopt CURLOPT_URL failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_websocket_fqdn: CURL setopt CURLOPT_HTTPHEADER failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_websocket_fqdn: CURL setopt CURLOPT_WRITEFUNCTION failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&response_data);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_websocket_fqdn: CURL setopt CURLOPT_WRITEDATA failed with CURL error %s", curl_easy_strerror(res));
-
-    res = curl_easy_perform(curl);
-    curl_slist_free_all(headers);
-    ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
-    if (res != CURLE_OK)
+    ChiakiErrorCode err = chiaki_http_client_perform(session->http, &req);
+    if (err != CHIAKI_ERR_SUCCESS)
     {
-        if (res == CURLE_HTTP_RETURNED_ERROR)
-        {
-            long http_code = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-            CHIAKI_LOGE(session->log, "get_websocket_fqdn: Fetching websocket FQDN from %s failed with HTTP code %ld", ws_fqdn_api_url, http_code);
-            err = CHIAKI_ERR_HTTP_NONOK;
-        } else {
-            CHIAKI_LOGE(session->log, "get_websocket_fqdn: Fetching websocket FQDN from %s failed with CURL error %s", ws_fqdn_api_url, curl_easy_strerror(res));
-            err = CHIAKI_ERR_NETWORK;
-        }
+        if (err == CHIAKI_ERR_HTTP_NONOK)
+            CHIAKI_LOGE(session->log, "get_websocket_fqdn: Fetching websocket FQDN from %s failed with HTTP code %ld", ws_fqdn_api_url, req.http_code);
+        else
+            CHIAKI_LOGE(session->log, "get_websocket_fqdn: Fetching websocket FQDN from %s failed with error %s", ws_fqdn_api_url, req.error ? req.error : chiaki_error_string(err));
         goto cleanup;
     }
 
@@ -1950,7 +2037,7 @@ static ChiakiErrorCode get_websocket_fqdn(Session *session, char **fqdn)
         CHIAKI_LOGE(session->log, "Couldn't create new json tokener");
         goto cleanup;
     }
-    json_object *json = json_tokener_parse_ex(tok, response_data.data, response_data.size);
+    json_object *json = json_tokener_parse_ex(tok, req.response, req.response_size);
     if (json == NULL)
     {
         CHIAKI_LOGE(session->log, "get_websocket_fqdn: Parsing JSON failed");
@@ -1976,43 +2063,10 @@ cleanup_json:
 cleanup_json_tokener:
     json_tokener_free(tok);
 cleanup:
-    curl_easy_cleanup(curl);
-    free(response_data.data);
+    chiaki_http_request_fini(&req);
     return err;
 }
 
-/**
- * Write callback for CURL calls.
- *
- * @param[in] ptr Pointer to the data to write
- * @param[in] size Size of each element
- * @param[in] nmemb Number of elements
- * @param[in] userdata Pointer to a HttpResponseData struct
- * @return Number of bytes written
-*/
-static inline size_t curl_write_cb(
-    void* ptr, size_t size, size_t nmemb, void* userdata)
-{
-    size_t realsize = size * nmemb;
-    HttpResponseData* response_data = (HttpResponseData*) userdata;
-    char* tmp = NULL;
-    tmp = realloc(response_data->data, response_data->size + realsize + 1);
-    if (tmp)
-        response_data->data = tmp;
-    else
-    {
-        free(response_data->data);
-        // TODO: Use Chiaki logger!
-        fprintf(stderr, "curl_write_cb: realloc failed\n");
-        return 0;
-    }
-    memcpy(&(response_data->data[response_data->size]), ptr, realsize);
-    response_data->size += realsize;
-    response_data->data[response_data->size] = 0;
-
-    return realsize;
-}
-
 static ChiakiErrorCode hex_to_bytes(const char* hex_str, uint8_t* bytes, size_t max_len) {
     size_t len = strlen(hex_str);
     if (len > max_len * 2) {
@@ -2089,9 +2143,6 @@ static void* websocket_thread_func(void *user) {
     CURLcode res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
     if(res != CURLE_OK)
         CHIAKI_LOGW(session->log, "websocket_thread_func: CURL setopt CURLOPT_HTTPHEADER failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "websocket_thread_func: CURL setopt CURLOPT_SHAREfailed with CURL error %s", curl_easy_strerror(res));
     res = curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
     if(res != CURLE_OK)
         CHIAKI_LOGW(session->log, "websocket_thread_func: CURL setopt CURLOPT_FAILONERROR failed with CURL error %s", curl_easy_strerror(res));
@@ -2363,25 +2414,18 @@ static NotificationType parse_notification_type(
 }
 
 
-CHIAKI_EXPORT ChiakiErrorCode holepunch_session_create_offer(Session *session)
+/**
+ * Create and bind the sockets for an offer, the ipv6 one on the same port as the ipv4 one.
+ *
+ * @param[out] local_port the local port both sockets are bound to
+ */
+static ChiakiErrorCode offer_sockets_open(Session *session, uint16_t *local_port)
 {
-    if(session->our_offer_msg)
-    {
-        CHIAKI_LOGW(session->log, "Overwriting previously unsent offer message. Make sure you're punching the control hole before the data hole!");
-        session_message_free(session->our_offer_msg);
-        session->our_offer_msg = NULL;
-    }
-    if(session->local_candidates)
-    {
-        CHIAKI_LOGW(session->log, "Overwriting previously unused message. Make sure you're punching the control hole before the data hole!");
-        free(session->local_candidates);
-        session->local_candidates = NULL;
-    }
     // Create socket with available local port for connection
     session->ipv4_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock))
     {
-        CHIAKI_LOGE(session->log, "holepunch_session_create_offer: Creating ipv4 socket failed");
+        CHIAKI_LOGE(session->log, "offer_sockets_open: Creating ipv4 socket failed");
         return CHIAKI_ERR_UNKNOWN;
     }
     struct sockaddr_in client_addr;
@@ -2391,87 +2435,119 @@ CHIAKI_EXPORT ChiakiErrorCode holepunch_session_create_offer(Session *session)
     client_addr.sin_port = 0;
     socklen_t client_addr_len = sizeof(client_addr);
     const int enable = 1;
-    ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
 #if defined(SO_REUSEPORT)
-        if (setsockopt(session->ipv4_sock, SOL_SOCKET, SO_REUSEPORT, (const void *)&enable, sizeof(int)) < 0)
-        {
-            CHIAKI_LOGE(session->log, "holepunch_session_create_offer: setsockopt(SO_REUSEPORT) for ipv4 socket failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-            return CHIAKI_ERR_UNKNOWN;
-        }
+    if (setsockopt(session->ipv4_sock, SOL_SOCKET, SO_REUSEPORT, (const void *)&enable, sizeof(int)) < 0)
+    {
+        CHIAKI_LOGE(session->log, "offer_sockets_open: setsockopt(SO_REUSEPORT) for ipv4 socket failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+        goto error;
+    }
 #else
-        if (setsockopt(session->ipv4_sock, SOL_SOCKET, SO_REUSEADDR, (const void *)&enable, sizeof(int)) < 0)
-        {
-            CHIAKI_LOGE(session->log, "holepunch_session_create_offer: setsockopt(SO_REUSEADDR) for ipv4 socket failed with error" CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-            err = CHIAKI_ERR_UNKNOWN;
-            goto cleanup_socket;
-        }
+    if (setsockopt(session->ipv4_sock, SOL_SOCKET, SO_REUSEADDR, (const void *)&enable, sizeof(int)) < 0)
+    {
+        CHIAKI_LOGE(session->log, "offer_sockets_open: setsockopt(SO_REUSEADDR) for ipv4 socket failed with error" CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+        goto error;
+    }
 #endif
     if (bind(session->ipv4_sock, (struct sockaddr*)&client_addr, client_addr_len) < 0)
     {
-        CHIAKI_LOGE(session->log, "holepunch_session_create_offer: Binding ipv4 socket failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-        if(!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock))
-        {
-            CHIAKI_SOCKET_CLOSE(session->ipv4_sock);
-            session->ipv4_sock = CHIAKI_INVALID_SOCKET;
-        }
-        err = CHIAKI_ERR_UNKNOWN;
-        goto cleanup_socket;
+        CHIAKI_LOGE(session->log, "offer_sockets_open: Binding ipv4 socket failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+        goto error;
     }
     if(getsockname(session->ipv4_sock, (struct sockaddr*)&client_addr, &client_addr_len) < 0)
     {
-        CHIAKI_LOGE(session->log, "holepunch_session_create_offer: Getting ipv4 socket name failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-        if(!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock))
-        {
-            CHIAKI_SOCKET_CLOSE(session->ipv4_sock);
-            session->ipv4_sock = CHIAKI_INVALID_SOCKET;
-        }
-        err = CHIAKI_ERR_UNKNOWN;
-        goto cleanup_socket;
+        CHIAKI_LOGE(session->log, "offer_sockets_open: Getting ipv4 socket name failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+        goto error;
     }
 
-    uint16_t local_port = ntohs(client_addr.sin_port);
+    *local_port = ntohs(client_addr.sin_port);
 #ifndef __SWITCH__
     // Switch doesn't support IPv6 - skip IPv6 socket creation
     session->ipv6_sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
     if (CHIAKI_SOCKET_IS_INVALID(session->ipv6_sock))
     {
-        CHIAKI_LOGE(session->log, "holepunch_session_create_offer: Creating ipv6 socket failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-        err = CHIAKI_ERR_UNKNOWN;
-        goto cleanup_socket;
+        CHIAKI_LOGE(session->log, "offer_sockets_open: Creating ipv6 socket failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+        goto error;
     }
     struct sockaddr_in6 client_addr_ipv6;
     memset(&client_addr_ipv6, 0, sizeof(client_addr_ipv6));
     client_addr_ipv6.sin6_family = AF_INET6;
     client_addr_ipv6.sin6_addr = in6addr_any;
-    client_addr_ipv6.sin6_port = htons(local_port);
+    client_addr_ipv6.sin6_port = htons(*local_port);
     socklen_t client_addr_ipv6_len = sizeof(client_addr_ipv6);
 #if defined(SO_REUSEPORT)
     if (setsockopt(session->ipv6_sock, SOL_SOCKET, SO_REUSEPORT, (const void *)&enable, sizeof(int)) < 0)
     {
-        CHIAKI_LOGE(session->log, "holepunch_session_create_offer: setsockopt(SO_REUSEPORT) for ipv6 socket failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-        err = CHIAKI_ERR_UNKNOWN;
-        goto cleanup_socket;
+        CHIAKI_LOGE(session->log, "offer_sockets_open: setsockopt(SO_REUSEPORT) for ipv6 socket failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+        goto error;
     }
 #else
     if (setsockopt(session->ipv6_sock, SOL_SOCKET, SO_REUSEADDR, (const void *)&enable, sizeof(int)) < 0)
     {
-        CHIAKI_LOGE(session->log, "holepunch_session_create_offer: setsockopt(SO_REUSEADDR) for ipv6 socket failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-        err = CHIAKI_ERR_UNKNOWN;
-        goto cleanup_socket;
+        CHIAKI_LOGE(session->log, "offer_sockets_open: setsockopt(SO_REUSEADDR) for ipv6 socket failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+        goto error;
     }
 #endif
     if (bind(session->ipv6_sock, (struct sockaddr*)&client_addr_ipv6, client_addr_ipv6_len) < 0)
     {
-        CHIAKI_LOGE(session->log, "holepunch_session_create_offer: Binding ipv6 socket failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-        if(!CHIAKI_SOCKET_IS_INVALID(session->ipv6_sock))
-        {
-            CHIAKI_SOCKET_CLOSE(session->ipv6_sock);
-            session->ipv6_sock = CHIAKI_INVALID_SOCKET;
-        }
-        err = CHIAKI_ERR_UNKNOWN;
-        goto cleanup_socket;
+        CHIAKI_LOGE(session->log, "offer_sockets_open: Binding ipv6 socket failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+        goto error;
     }
 #endif // __SWITCH__
+    return CHIAKI_ERR_SUCCESS;
+
+error:
+    offer_sockets_close(session);
+    return CHIAKI_ERR_UNKNOWN;
+}
+
+static void offer_sockets_close(Session *session)
+{
+    if(!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock))
+    {
+        CHIAKI_SOCKET_CLOSE(session->ipv4_sock);
+        session->ipv4_sock = CHIAKI_INVALID_SOCKET;
+    }
+    if(!CHIAKI_SOCKET_IS_INVALID(session->ipv6_sock))
+    {
+        CHIAKI_SOCKET_CLOSE(session->ipv6_sock);
+        session->ipv6_sock = CHIAKI_INVALID_SOCKET;
+    }
+}
+
+CHIAKI_EXPORT ChiakiErrorCode holepunch_session_create_offer(Session *session)
+{
+    if(session->our_offer_msg)
+    {
+        CHIAKI_LOGW(session->log, "Overwriting previously unsent offer message. Make sure you're punching the control hole before the data hole!");
+        session_message_free(session->our_offer_msg);
+        session->our_offer_msg = NULL;
+    }
+    if(session->local_candidates)
+    {
+        CHIAKI_LOGW(session->log, "Overwriting previously unused message. Make sure you're punching the control hole before the data hole!");
+        free(session->local_candidates);
+        session->local_candidates = NULL;
+    }
+    uint16_t local_port = 0;
+    ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+    bool stun_prefetched = false;
+    if(session->stun_prefetch_started)
+    {
+        chiaki_thread_join(&session->stun_prefetch_thread, NULL);
+        session->stun_prefetch_started = false;
+        // STUN closes the socket on errors, start over with a fresh one then
+        stun_prefetched = !CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock);
+        if(stun_prefetched)
+            local_port = session->stun_prefetch_local_port;
+        else
+            offer_sockets_close(session);
+    }
+    if(!stun_prefetched)
+    {
+        err = offer_sockets_open(session, &local_port);
+        if(err != CHIAKI_ERR_SUCCESS)
+            return err;
+    }
 
     size_t our_offer_msg_req_id = session->local_req_id;
     session->local_req_id++;
@@ -2526,6 +2602,7 @@ CHIAKI_EXPORT ChiakiErrorCode holepunch_session_create_offer(Session *session)
     bool have_addr = false;
     Candidate *candidate_remote = &msg.conn_request->candidates[1];
     candidate_remote->type = CANDIDATE_TYPE_STATIC;
+    upnp_discover_wait(session);
     switch(session->gw_status)
     {
         case GATEWAY_STATUS_UNKNOWN:
@@ -2548,6 +2625,12 @@ CHIAKI_EXPORT ChiakiErrorCode holepunch_session_create_offer(Session *session)
         }
     }
     memcpy(session->client_local_ip, candidate_local->addr, sizeof(candidate_local->addr));
+    if (have_addr && stun_prefetched)
+    {
+        // Reachable through the UPnP mapping, so punch holes as if STUN had never run
+        session->stun_allocation_increment = -1;
+        session->stun_random_allocation = false;
+    }
     if (!have_addr)
     {
         // Move current candidates behind STUN candidates so when the console reaches out to our STUN candidate it will be using the correct port if behind symmetric NAT
@@ -2555,7 +2638,17 @@ CHIAKI_EXPORT ChiakiErrorCode holepunch_session_create_offer(Session *session)
         candidate_stun->type = CANDIDATE_TYPE_STUN;
         memcpy(candidate_stun->addr_mapped, "0.0.0.0", 8);
         candidate_stun->port_mapped = 0;
-        have_addr = get_client_addr_remote_stun(session, candidate_stun->addr, &candidate_stun->port, &session->ipv4_sock, true);
+        if(stun_prefetched)
+        {
+            have_addr = session->stun_prefetch_ok;
+            if(have_addr)
+            {
+                memcpy(candidate_stun->addr, session->stun_prefetch_addr, sizeof(candidate_stun->addr));
+                candidate_stun->port = session->stun_prefetch_port;
+            }
+        }
+        else
+            have_addr = get_client_addr_remote_stun(session, candidate_stun->addr, &candidate_stun->port, &session->ipv4_sock, true);
         if(have_addr)
         {
             memcpy(candidate_remote->addr, candidate_stun->addr, sizeof(candidate_stun->addr));
@@ -2617,26 +2710,14 @@ CHIAKI_EXPORT ChiakiErrorCode holepunch_session_create_offer(Session *session)
                     int guess_count = session->port_guessing_count;
                     // Setup session->port_guessing_count STUN candidates because we have a random allocation and usually 64 port blocks are minimum
                     CHIAKI_LOGI(session->log, "Initiating random allocation guesses with %d guesses", guess_count);
-                    int32_t base_port = candidate_stun->port;
+                    uint16_t base_port = candidate_stun->port;
                     for(int i=0; i<guess_count; i++)
                     {
-                        int delta;
-                        if(i == 0)
-                            delta = 0;
-                        else if(i % 2 == 1)
-                            delta = (i + 1) / 2;
-                        else
-                            delta = -(i / 2);
-                        int32_t port = base_port + delta;
-                        if(port > UINT16_MAX)
-                            port = 49152 + (port - UINT16_MAX - 1);
-                        else if(port < 1024)
-                            port = UINT16_MAX - (1024 - port);
                         Candidate *candidate_stun2 = &msg.conn_request->candidates[i];
                         candidate_stun2->type = CANDIDATE_TYPE_STUN;
                         memcpy(candidate_stun2->addr_mapped, "0.0.0.0", 8);
                         candidate_stun2->port_mapped = 0;
-                        candidate_stun2->port = port;
+                        candidate_stun2->port = chiaki_port_window_port(base_port, i);
                         memcpy(candidate_stun2->addr, candidate_stun->addr, sizeof(candidate_stun->addr));
                     }
                     memcpy(&msg.conn_request->candidates[session->port_guessing_count], &original_candidates[1], sizeof(Candidate));
@@ -2680,26 +2761,14 @@ CHIAKI_EXPORT ChiakiErrorCode holepunch_session_create_offer(Session *session)
                         err = CHIAKI_ERR_MEMORY;
                         goto cleanup;
                     }
-                    int32_t base_port = candidate_stun->port;
+                    uint16_t base_port = candidate_stun->port;
                     for(int i=0; i<guess_count; i++)
                     {
-                        int delta;
-                        if(i == 0)
-                            delta = 0;
-                        else if(i % 2 == 1)
-                            delta = (i + 1) / 2;
-                        else
-                            delta = -(i / 2);
-                        int32_t port = base_port + delta;
-                        if(port > UINT16_MAX)
-                            port = 49152 + (port - UINT16_MAX - 1);
-                        else if(port < 1024)
-                            port = UINT16_MAX - (1024 - port);
                         Candidate *candidate_stun2 = &msg.conn_request->candidates[i];
                         candidate_stun2->type = CANDIDATE_TYPE_STUN;
                         memcpy(candidate_stun2->addr_mapped, "0.0.0.0", 8);
                         candidate_stun2->port_mapped = 0;
-                        candidate_stun2->port = port;
+                        candidate_stun2->port = chiaki_port_window_port(base_port, i);
                         memcpy(candidate_stun2->addr, candidate_stun->addr, sizeof(candidate_stun->addr));
                     }
                     memcpy(&msg.conn_request->candidates[guess_count], &original_candidates[1], sizeof(Candidate));
@@ -2910,63 +2979,20 @@ static ChiakiErrorCode http_create_session(Session *session)
     snprintf(session_create_json, session_create_json_len, session_create_json_fmt, session->pushctx_id);
     CHIAKI_LOGV(session->log, "http_create_session: Sending JSON:\n%s", session_create_json);
 
-    HttpResponseData response_data = {
-        .data = malloc(0),
-        .size = 0,
+    const char *headers[] = { session->oauth_header, "Content-Type: application/json; charset=utf-8", NULL };
+    ChiakiHttpRequest req = {
+        .url = session_create_url,
+        .headers = headers,
+        .body = session_create_json,
+        .body_size = strlen(session_create_json),
     };
-
-    CURL* curl = curl_easy_init();
-    if(!curl)
-    {
-        free(response_data.data);
-        free(session_create_json);
-        CHIAKI_LOGE(session->log, "Curl could not init");
-        return CHIAKI_ERR_MEMORY;
-    }
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, session->oauth_header);
-    headers = curl_slist_append(headers, "Content-Type: application/json; charset=utf-8");
-
-    CURLcode res = curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_create_session: CURL setopt CURLOPT_SHARE failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_create_session: CURL setopt CURLOPT_FAILONERROR failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_URL, session_create_url);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_create_session: CURL setopt CURLOPT_URL failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_create_session: CURL setopt CURLOPT_TIMEOUT failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_create_session: CURL setopt CURLOPT_HTTPHEADER failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, session_create_json);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_create_session: CURL setopt CURLOPT_POSTFIELDS failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_create_session: CURL setopt CURLOPT_WRITEFUNCTION failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&response_data);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_create_session: CURL setopt CURLOPT_WRITEDATA failed with CURL error %s", curl_easy_strerror(res));
-
-    ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
-    res = curl_easy_perform(curl);
-    curl_slist_free_all(headers);
-    if (res != CURLE_OK)
+    ChiakiErrorCode err = chiaki_http_client_perform(session->http, &req);
+    if (err != CHIAKI_ERR_SUCCESS)
     {
-        if (res == CURLE_HTTP_RETURNED_ERROR)
-        {
-            long http_code = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-            CHIAKI_LOGE(session->log, "http_create_session: Creating holepunch session failed with HTTP code %ld", http_code);
-            err = CHIAKI_ERR_HTTP_NONOK;
-        } else {
-            CHIAKI_LOGE(session->log, "http_create_session: Creating holepunch session failed with CURL error %s", curl_easy_strerror(res));
-            err = CHIAKI_ERR_NETWORK;
-        }
+        if (err == CHIAKI_ERR_HTTP_NONOK)
+            CHIAKI_LOGE(session->log, "http_create_session: Creating holepunch session failed with HTTP code %ld", req.http_code);
+        else
+            CHIAKI_LOGE(session->log, "http_create_session: Creating holepunch session failed with error %s", req.error ? req.error : chiaki_error_string(err));
         goto cleanup;
     }
 
@@ -2976,8 +3002,8 @@ static ChiakiErrorCode http_create_session(Session *session)
         CHIAKI_LOGE(session->log, "Couldn't create new json tokener");
         goto cleanup;
     }
-    CHIAKI_LOGV(session->log, "http_create_session: Received JSON:\n%s", response_data.data);
-    json_object *json = json_tokener_parse_ex(tok, response_data.data, response_data.size);
+    CHIAKI_LOGV(session->log, "http_create_session: Received JSON:\n%s", req.response);
+    json_object *json = json_tokener_parse_ex(tok, req.response, req.response_size);
     if (json == NULL)
     {
         CHIAKI_LOGE(session->log, "http_create_session: Parsing JSON failed");
@@ -3022,8 +3048,7 @@ cleanup_json_tokener:
     json_tokener_free(tok);
 cleanup:
     free(session_create_json);
-    free(response_data.data);
-    curl_easy_cleanup(curl);
+    chiaki_http_request_fini(&req);
 
     return err;
 }
@@ -3036,59 +3061,18 @@ cleanup:
 */
 static ChiakiErrorCode http_check_session(Session *session, bool viewurl)
 {
-    HttpResponseData response_data = {
-        .data = malloc(0),
-        .size = 0,
+    const char *headers[] = { session->oauth_header, session->session_id_header, NULL };
+    ChiakiHttpRequest req = {
+        .url = viewurl ? session_view_url : session_create_url,
+        .headers = headers,
     };
-
-    CURL* curl = curl_easy_init();
-    if(!curl)
-    {
-        free(response_data.data);
-        CHIAKI_LOGE(session->log, "Curl could not init");
-        return CHIAKI_ERR_MEMORY;
-    }
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, session->oauth_header);
-    headers = curl_slist_append(headers, session->session_id_header);
-
-    CURLcode res = curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_check_session: CURL setopt CURLOPT_SHARE failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_check_session: CURL setopt CURLOPT_FAILONERROR failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_URL, viewurl ? session_view_url : session_create_url);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_check_session: CURL setopt CURLOPT_URL failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_check_session: CURL setopt CURLOPT_TIMEOUT failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_check_session: CURL setopt CURLOPT_HTTPHEADER failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_check_session: CURL setopt CURLOPT_WRITEFUNCTION failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&response_data);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_check_session: CURL setopt CURLOPT_WRITEDATA failed with CURL error %s", curl_easy_strerror(res));
-
-    ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
-    res = curl_easy_perform(curl);
-    curl_slist_free_all(headers);
-    if (res != CURLE_OK)
+    ChiakiErrorCode err = chiaki_http_client_perform(session->http, &req);
+    if (err != CHIAKI_ERR_SUCCESS)
     {
-        if (res == CURLE_HTTP_RETURNED_ERROR)
-        {
-            long http_code = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-            CHIAKI_LOGE(session->log, "http_check_session: Creating holepunch session failed with HTTP code %ld", http_code);
-            err = CHIAKI_ERR_HTTP_NONOK;
-        } else {
-            CHIAKI_LOGE(session->log, "http_check_session: Creating holepunch session failed with CURL error %s", curl_easy_strerror(res));
-            err = CHIAKI_ERR_NETWORK;
-        }
+        if (err == CHIAKI_ERR_HTTP_NONOK)
+            CHIAKI_LOGE(session->log, "http_check_session: Creating holepunch session failed with HTTP code %ld", req.http_code);
+        else
+            CHIAKI_LOGE(session->log, "http_check_session: Creating holepunch session failed with error %s", req.error ? req.error : chiaki_error_string(err));
         goto cleanup;
     }
     json_tokener *tok = json_tokener_new();
@@ -3097,7 +3081,7 @@ static ChiakiErrorCode http_check_session(Session *session, bool viewurl)
         CHIAKI_LOGE(session->log, "http_check_session: Couldn't create new json tokener");
         goto cleanup;
     }
-    json_object *json = json_tokener_parse_ex(tok, response_data.data, response_data.size);
+    json_object *json = json_tokener_parse_ex(tok, req.response, req.response_size);
     if (json == NULL)
     {
         CHIAKI_LOGE(session->log, "http_check_session: Parsing JSON failed");
@@ -3111,8 +3095,7 @@ static ChiakiErrorCode http_check_session(Session *session, bool viewurl)
     cleanup_json_tokener:
         json_tokener_free(tok);
     cleanup:
-        free(response_data.data);
-        curl_easy_cleanup(curl);
+        chiaki_http_request_fini(&req);
         return err;
 }
 /**
@@ -3155,68 +3138,32 @@ static ChiakiErrorCode http_start_session(Session *session)
         payload_buf,
         session->console_type == CHIAKI_HOLEPUNCH_CONSOLE_TYPE_PS4 ? "PS4" : "PS5");
 
-    HttpResponseData response_data = {
-        .data = malloc(0),
-        .size = 0,
+    const char *headers[] = {
+        session->oauth_header,
+        "Content-Type: application/json; charset=utf-8",
+        "User-Agent: RpNetHttpUtilImpl",
+        NULL
+    };
+    ChiakiHttpRequest req = {
+        .url = session_command_url,
+        .headers = headers,
+        .body = envelope_buf,
+        .body_size = strlen(envelope_buf),
     };
-
-    CURL *curl = curl_easy_init();
-    if(!curl)
-    {
-        free(response_data.data);
-        CHIAKI_LOGE(session->log, "Curl could not init");
-        err = CHIAKI_ERR_MEMORY;
-        goto offer_cleanup;
-    }
-
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, session->oauth_header);
-    headers = curl_slist_append(headers, "Content-Type: application/json; charset=utf-8");
-    headers = curl_slist_append(headers, "User-Agent: RpNetHttpUtilImpl");
-
-    CURLcode res = curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_start_session: CURL setopt CURLOPT_SHARE failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_start_session: CURL setopt CURLOPT_FAILONERROR failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_URL, session_command_url);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_start_session: CURL setopt CURLOPT_URL failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_start_session: CURL setopt CURLOPT_TIMEOUT failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_start_session: CURL setopt CURLOPT_HTTPHEADER failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, envelope_buf);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_start_session: CURL setopt CURLOPT_POSTFIELDS failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_start_session: CURL setopt CURLOPT_WRITEFUNCTION failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&response_data);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_start_session: CURL setopt CURLOPT_WRITEDATA failed with CURL error %s", curl_easy_strerror(res));
 
     CHIAKI_LOGV(session->log, "http_start_session: Sending JSON:\n%s", envelope_buf);
 
-    res = curl_easy_perform(curl);
-    curl_slist_free_all(headers);
-    CHIAKI_LOGV(session->log, "http_start_session: Received JSON:\n%.*s", (int)response_data.size, response_data.data);
-    if (res != CURLE_OK)
+    err = chiaki_http_client_perform(session->http, &req);
+    CHIAKI_LOGV(session->log, "http_start_session: Received JSON:\n%.*s", (int)req.response_size, req.response);
+    if (err != CHIAKI_ERR_SUCCESS)
     {
-        if (res == CURLE_HTTP_RETURNED_ERROR)
+        if (err == CHIAKI_ERR_HTTP_NONOK)
         {
-            long http_code = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-            CHIAKI_LOGE(session->log, "http_start_session: Starting holepunch session failed with HTTP code %ld.", http_code);
+            CHIAKI_LOGE(session->log, "http_start_session: Starting holepunch session failed with HTTP code %ld.", req.http_code);
             CHIAKI_LOGV(session->log, "Request Body: %s.", envelope_buf);
-            CHIAKI_LOGV(session->log, "Response Body: %.*s.", (int)response_data.size, response_data.data);
-            err = CHIAKI_ERR_HTTP_NONOK;
+            CHIAKI_LOGV(session->log, "Response Body: %.*s.", (int)req.response_size, req.response);
         } else {
-            CHIAKI_LOGE(session->log, "http_start_session: Starting holepunch session failed with CURL error %s.", curl_easy_strerror(res));
-            err = CHIAKI_ERR_NETWORK;
+            CHIAKI_LOGE(session->log, "http_start_session: Starting holepunch session failed with error %s.", req.error ? req.error : chiaki_error_string(err));
         }
         goto cleanup;
     }
@@ -3227,8 +3174,7 @@ static ChiakiErrorCode http_start_session(Session *session)
     chiaki_mutex_unlock(&session->state_mutex);
 
 cleanup:
-    curl_easy_cleanup(curl);
-    free(response_data.data);
+    chiaki_http_request_fini(&req);
 offer_cleanup:
     if(err != CHIAKI_ERR_SUCCESS)
     {
@@ -3257,11 +3203,6 @@ static ChiakiErrorCode http_send_session_message(Session *session, SessionMessag
 {
     ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
 
-    HttpResponseData response_data = {
-        .data = malloc(0),
-        .size = 0,
-    };
-
     char url[128] = {0};
     snprintf(url, sizeof(url), session_message_url_fmt, session->session_id);
 
@@ -3281,66 +3222,29 @@ static ChiakiErrorCode http_send_session_message(Session *session, SessionMessag
         session->console_type == CHIAKI_HOLEPUNCH_CONSOLE_TYPE_PS4 ? "PS4" : "PS5"
     );
     CHIAKI_LOGV(session->log, "Message to send: %s", msg_buf);
-    CURL *curl = curl_easy_init();
-    if(!curl)
-    {
-        free(payload_str);
-        free(response_data.data);
-        CHIAKI_LOGE(session->log, "Curl could not init");
-        return CHIAKI_ERR_MEMORY;
-    }
-
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, session->oauth_header);
-    headers = curl_slist_append(headers, "Content-Type: application/json; charset=utf-8");
-
-    CURLcode res = curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_send_session_message: CURL setopt CURLOPT_SHARE failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_send_session_message: CURL setopt CURLOPT_FAILONERROR failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_URL, url);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_send_session_message: CURL setopt CURLOPT_URL failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_send_session_message: CURL setopt CURLOPT_TIMEOUT failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_send_session_message: CURL setopt CURLOPT_HTTPHEADER failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, msg_buf);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_send_session_message: CURL setopt CURLOPT_POSTFIELDS failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_send_session_message: CURL setopt CURLOPT_WRITEFUNCTION failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&response_data);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "http_send_session_message: CURL setopt CURLOPT_WRITEDATA failed with CURL error %s", curl_easy_strerror(res));
-
-    res = curl_easy_perform(curl);
-    curl_slist_free_all(headers);
-    if (res != CURLE_OK)
+    const char *headers[] = { session->oauth_header, "Content-Type: application/json; charset=utf-8", NULL };
+    ChiakiHttpRequest req = {
+        .url = url,
+        .headers = headers,
+        .body = msg_buf,
+        .body_size = strlen(msg_buf),
+    };
+    err = chiaki_http_client_perform(session->http, &req);
+    if (err != CHIAKI_ERR_SUCCESS)
     {
-        if (res == CURLE_HTTP_RETURNED_ERROR)
+        if (err == CHIAKI_ERR_HTTP_NONOK)
         {
-            long http_code = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-            CHIAKI_LOGE(session->log, "http_send_session_message: Sending holepunch session message failed with HTTP code %ld.", http_code);
+            CHIAKI_LOGE(session->log, "http_send_session_message: Sending holepunch session message failed with HTTP code %ld.", req.http_code);
             CHIAKI_LOGV(session->log, "Request Body: %s.", msg_buf);
-            err = CHIAKI_ERR_HTTP_NONOK;
         } else {
-            CHIAKI_LOGE(session->log, "http_send_session_message: Sending holepunch session message failed with CURL error %s.", curl_easy_strerror(res));
-            err = CHIAKI_ERR_NETWORK;
+            CHIAKI_LOGE(session->log, "http_send_session_message: Sending holepunch session message failed with error %s.", req.error ? req.error : chiaki_error_string(err));
         }
         goto cleanup;
     }
 
 cleanup:
-    curl_easy_cleanup(curl);
+    chiaki_http_request_fini(&req);
     free(payload_str);
-    free(response_data.data);
     return err;
 }
 
@@ -3354,71 +3258,27 @@ static ChiakiErrorCode deleteSession(Session *session)
 {
     ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
 
-    HttpResponseData response_data = {
-        .data = malloc(0),
-        .size = 0,
-    };
-
     char url[128] = {0};
     snprintf(url, sizeof(url), delete_messsage_url_fmt, session->session_id);
 
-    CURL *curl = curl_easy_init();
-    if(!curl)
-    {
-        free(response_data.data);
-        CHIAKI_LOGE(session->log, "Curl could not init");
-        return CHIAKI_ERR_MEMORY;
-    }
-
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, session->oauth_header);
-    headers = curl_slist_append(headers, "Content-Type: application/json; charset=utf-8");
-
-    CURLcode res = curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "delete_session: CURL setopt CURLOPT_SHARE failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "delete_session: CURL setopt CURLOPT_FAILONERROR failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_URL, url);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "delete_session: CURL setopt CURLOPT_URL failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "delete_session: CURL setopt CURLOPT_TIMEOUT failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "delete_session: CURL setopt CURLOPT_HTTPHEADER failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "delete_session: CURL setopt CURLOPT_CUSTOMREQUEST failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "delete_session: CURL setopt CURLOPT_WRITEFUNCTION failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&response_data);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "delete_session: CURL setopt CURLOPT_WRITEDATA failed with CURL error %s", curl_easy_strerror(res));
-
-    res = curl_easy_perform(curl);
-    curl_slist_free_all(headers);
-    if (res != CURLE_OK)
+    const char *headers[] = { session->oauth_header, "Content-Type: application/json; charset=utf-8", NULL };
+    ChiakiHttpRequest req = {
+        .method = "DELETE",
+        .url = url,
+        .headers = headers,
+    };
+    err = chiaki_http_client_perform(session->http, &req);
+    if (err != CHIAKI_ERR_SUCCESS)
     {
-        if (res == CURLE_HTTP_RETURNED_ERROR)
-        {
-            long http_code = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-            CHIAKI_LOGE(session->log, "http_send_session_message: Sending holepunch session message failed with HTTP code %ld.", http_code);
-            err = CHIAKI_ERR_HTTP_NONOK;
-        } else {
-            CHIAKI_LOGE(session->log, "http_send_session_message: Sending holepunch session message failed with CURL error %s.", curl_easy_strerror(res));
-            err = CHIAKI_ERR_NETWORK;
-        }
+        if (err == CHIAKI_ERR_HTTP_NONOK)
+            CHIAKI_LOGE(session->log, "http_send_session_message: Sending holepunch session message failed with HTTP code %ld.", req.http_code);
+        else
+            CHIAKI_LOGE(session->log, "http_send_session_message: Sending holepunch session message failed with error %s.", req.error ? req.error : chiaki_error_string(err));
         goto cleanup;
     }
 
 cleanup:
-    curl_easy_cleanup(curl);
-    free(response_data.data);
+    chiaki_http_request_fini(&req);
     return err;
 }
 
@@ -3592,6 +3452,23 @@ static ChiakiErrorCode upnp_get_gateway_info(ChiakiLog *log, UPNPGatewayInfo *in
     return err;
 }
 
+/**
+ * Retrieves the gateway information from a known root description URL, skipping SSDP discovery.
+ *
+ * @param log The ChiakiLog instance for logging.
+ * @param url The root description URL of the gateway found by an earlier discovery.
+ * @param[out] info Pointer to the UPNPGatewayInfo structure to store the retrieved information.
+ */
+static ChiakiErrorCode upnp_get_gateway_info_from_url(ChiakiLog *log, const char *url, UPNPGatewayInfo *info)
+{
+    int igd_ret = UPNP_GetIGDFromUrl(url, info->urls, info->data, info->lan_ip, sizeof(info->lan_ip));
+    if (igd_ret != 1) {
+        CHIAKI_LOGI(log, "Failed to get internet gateway from %s via UPnP: err=%d", url, igd_ret);
+        return CHIAKI_ERR_NETWORK;
+    }
+    return CHIAKI_ERR_SUCCESS;
+}
+
 /**
  * Retrieves the external IP address of the gateway.
  *
@@ -3666,21 +3543,44 @@ static bool get_client_addr_remote_stun(Session *session, char *address, uint16_
     // run STUN test if it hasn't been run yet
     if(session->stun_allocation_increment == -1)
     {
-        ChiakiErrorCode err = get_stun_servers(session);
-        if(err != CHIAKI_ERR_SUCCESS)
+        if(session->path_cached && session->path.stun_servers_count > 0 && session->num_stun_servers == 0)
         {
-            CHIAKI_LOGW(session->log, "Getting stun servers returned error %s", chiaki_error_string(err));
+            // servers that answered from this network last time, no need to fetch a list of online ones
+            for(size_t i = 0; i < session->path.stun_servers_count && i < sizeof(session->stun_server_list) / sizeof(session->stun_server_list[0]); i++)
+            {
+                StunServer *server = &session->stun_server_list[session->num_stun_servers];
+                server->host = strdup(session->path.stun_servers[i].host);
+                if(!server->host)
+                    break;
+                server->port = session->path.stun_servers[i].port;
+                session->num_stun_servers++;
+            }
         }
-        if (!stun_port_allocation_test(session->log, address, port, &session->stun_allocation_increment, &session->stun_random_allocation, session->stun_server_list, session->num_stun_servers, sock))
+        if(session->num_stun_servers == 0)
+        {
+            ChiakiErrorCode err = get_stun_servers(session);
+            if(err != CHIAKI_ERR_SUCCESS)
+            {
+                CHIAKI_LOGW(session->log, "Getting stun servers returned error %s", chiaki_error_string(err));
+            }
+        }
+        if (!stun_port_allocation_test(session->log, address, port, &session->stun_allocation_increment, &session->stun_random_allocation, session->stun_server_list, session->num_stun_servers, sock, &session->path))
         {
             CHIAKI_LOGE(session->log, "get_client_addr_remote_stun: Failed to get external address");
             return false;
         }
+        if(session->path_cached && session->path.allocation_known
+            && (session->path.allocation_increment != session->stun_allocation_increment
+                || session->path.random_allocation != session->stun_random_allocation))
+            CHIAKI_LOGI(session->log, "NAT port allocation changed since this network was cached");
+        session->path.allocation_known = true;
+        session->path.allocation_increment = session->stun_allocation_increment;
+        session->path.random_allocation = session->stun_random_allocation;
         return true;
     }
     if(ipv4)
     {
-        if (!stun_get_external_address(session->log, address, port, session->stun_server_list, session->num_stun_servers, sock, ipv4))
+        if (!stun_get_external_address(session->log, address, port, session->stun_server_list, session->num_stun_servers, sock, ipv4, &session->path))
         {
             CHIAKI_LOGE(session->log, "get_client_addr_remote_stun: Failed to get external address");
             return false;
@@ -3688,7 +3588,7 @@ static bool get_client_addr_remote_stun(Session *session, char *address, uint16_
     }
     else
     {
-        if (!stun_get_external_address(session->log, address, port, session->stun_server_list_ipv6, session->num_stun_servers_ipv6, sock, ipv4))
+        if (!stun_get_external_address(session->log, address, port, session->stun_server_list_ipv6, session->num_stun_servers_ipv6, sock, ipv4, NULL))
         {
             CHIAKI_LOGE(session->log, "get_client_addr_remote_stun: Failed to get external address");
             return false;
@@ -3756,45 +3656,6 @@ static bool get_client_addr_remote_stun(Session *session, char *address, uint16_
  * @param[in] candidates Candidates for the console to check against
  * @param[out] out Pointer to the socket where the connection was established with the selected candidate
 */
-
-#if !defined(__SWITCH__) && !defined(__ANDROID__)
-typedef struct {
-    struct event_base *base;
-    struct event **events;
-    size_t events_capacity;
-    size_t events_count;
-    bool event_triggered;
-    chiaki_socket_t ready_sock;
-} CandidateEventContext;
-
-static void candidate_event_cb(evutil_socket_t fd, short events, void *arg)
-{
-    (void)events;
-    CandidateEventContext *ctx = arg;
-    ctx->ready_sock = (chiaki_socket_t)fd;
-    ctx->event_triggered = true;
-    if (ctx->base)
-        event_base_loopexit(ctx->base, NULL);
-}
-
-static bool candidate_event_add_socket(CandidateEventContext *ctx, chiaki_socket_t sock)
-{
-    if (CHIAKI_SOCKET_IS_INVALID(sock))
-        return true;
-    if (!ctx || ctx->events_count >= ctx->events_capacity)
-        return false;
-    struct event *ev = event_new(ctx->base, sock, EV_READ | EV_PERSIST, candidate_event_cb, ctx);
-    if (!ev)
-        return false;
-    if (event_add(ev, NULL) < 0) {
-        event_free(ev);
-        return false;
-    }
-    ctx->events[ctx->events_count++] = ev;
-    return true;
-}
-#endif
-
 static ChiakiErrorCode check_candidates(
     Session *session, Candidate* local_candidates, Candidate *candidates_received, size_t num_candidates, chiaki_socket_t *out,
     Candidate *out_candidate)
@@ -3827,13 +3688,6 @@ static ChiakiErrorCode check_candidates(
     Candidate candidates[num_candidates + EXTRA_CANDIDATE_ADDRESSES];
     memcpy(candidates, candidates_received, num_candidates * sizeof(Candidate));
     int responses_received[num_candidates + EXTRA_CANDIDATE_ADDRESSES];
-#ifdef __SWITCH__
-    // Use poll() on Switch — select() fails when FD numbers >= FD_SETSIZE (256)
-    struct pollfd *pollfds = NULL;
-#endif
-#ifdef __ANDROID__
-    fd_set fds;
-#endif
     bool failed = true;
     char service_remote[6];
     struct addrinfo hints;
@@ -3841,101 +3695,42 @@ static ChiakiErrorCode check_candidates(
     hints.ai_socktype = SOCK_DGRAM;
     hints.ai_family = AF_UNSPEC;
     struct addrinfo *addr_remote;
-    int socks_count = 0;
-    int socks_capacity = 0;
-    chiaki_socket_t *socks = NULL;
-
-    if(session->stun_random_allocation)
+    // One readiness set for the session sockets and, with random allocation, the NAT probing sockets
+    ChiakiPortGuesser guesser;
+    bool guesser_init = false;
+    chiaki_socket_t released_sock = CHIAKI_INVALID_SOCKET;
+    // Destinations of the NAT probing sockets: the console's candidates, then guesses around its STUN candidate port
+    struct sockaddr_storage *burst_addrs = NULL;
+    socklen_t *burst_lens = NULL;
+    size_t burst_count = 0;
+    size_t burst_base = 0;
+    ChiakiPortWindow window;
+    int window_candidate = -1;
+
+    burst_addrs = calloc(num_candidates + CHECK_CANDIDATES_WINDOW_MAX, sizeof(struct sockaddr_storage));
+    burst_lens = calloc(num_candidates + CHECK_CANDIDATES_WINDOW_MAX, sizeof(socklen_t));
+    if(!burst_addrs || !burst_lens)
     {
-        socks_capacity = session->port_guessing_socks;
-        socks = calloc(socks_capacity, sizeof(chiaki_socket_t));
-        if(!socks)
-        {
-            err = CHIAKI_ERR_MEMORY;
-            goto cleanup_sockets;
-        }
-        for(int i = 0; i < socks_capacity; i++)
-            socks[i] = CHIAKI_INVALID_SOCKET;
-        int socks_to_open = socks_capacity;
-        for (int i=0; i < socks_to_open; i++)
-        {
-            socks[i] = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-            if (CHIAKI_SOCKET_IS_INVALID(socks[i]))
-            {
-                CHIAKI_LOGE(session->log, "check_candidates: Creating ipv4 socket %d failed, stopping (opened %d sockets)", i, socks_count);
-                break;
-            }
-            struct sockaddr_in client_addr;
-            memset(&client_addr, 0, sizeof(client_addr));
-            client_addr.sin_family = AF_INET;
-            client_addr.sin_addr.s_addr = INADDR_ANY;
-            client_addr.sin_port = 0;
-            socklen_t client_addr_len = sizeof(client_addr);
-            const int enable = 1;
-#if defined(SO_REUSEPORT)
-            if (setsockopt(socks[i], SOL_SOCKET, SO_REUSEPORT, (const void *)&enable, sizeof(int)) < 0)
-            {
-                CHIAKI_LOGE(session->log, "check_candidates: setsockopt(SO_REUSEPORT) failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-                if (CHIAKI_SOCKET_IS_INVALID(socks[i]))
-                {
-                    CHIAKI_SOCKET_CLOSE(socks[i]);
-                    socks[i] = CHIAKI_INVALID_SOCKET;
-                }
-                continue;
-            }
-#else
-            if (setsockopt(socks[i], SOL_SOCKET, SO_REUSEADDR, (const void *)&enable, sizeof(int)) < 0)
-            {
-                CHIAKI_LOGE(session->log, "check_candidates: setsockopt(SO_REUSEADDR) failed with error" CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-                if (!CHIAKI_SOCKET_IS_INVALID(socks[i]))
-                {
-                    CHIAKI_SOCKET_CLOSE(socks[i]);
-                    socks[i] = CHIAKI_INVALID_SOCKET;
-                }
-                continue;
-            }
-#endif
-                // set low ttl so packets just punch hole in NAT
-#ifdef _WIN32
-            DWORD ttl = 2;
-#else
-            int ttl = 2;
-#endif
-            if (setsockopt(socks[i], IPPROTO_IP, IP_TTL, (const CHIAKI_SOCKET_BUF_TYPE)&ttl, sizeof(ttl)) < 0)
-            {
-                CHIAKI_LOGE(session->log, "check_candidates: setsockopt(IP_TTL) failed with error" CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-                if (!CHIAKI_SOCKET_IS_INVALID(socks[i]))
-                {
-                    CHIAKI_SOCKET_CLOSE(socks[i]);
-                    socks[i] = CHIAKI_INVALID_SOCKET;
-                }
-                continue;
-            }
-            if(bind(socks[i], (struct sockaddr*)&client_addr, client_addr_len) < 0)
-            {
-                CHIAKI_LOGE(session->log, "check_candidates: Binding ipv4 socket failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-                if(!CHIAKI_SOCKET_IS_INVALID(socks[i]))
-                {
-                    CHIAKI_SOCKET_CLOSE(socks[i]);
-                    socks[i] = CHIAKI_INVALID_SOCKET;
-                }
-                continue;
-            }
-            err = chiaki_socket_set_nonblock(socks[i], true);
-            if(err != CHIAKI_ERR_SUCCESS)
-            {
-                CHIAKI_LOGE(session->log, "check_candidates: Failed to set ipv4 socket %d to non-blocking: %s", i, chiaki_error_string(err));
-                if (!CHIAKI_SOCKET_IS_INVALID(socks[i]))
-                {
-                    CHIAKI_SOCKET_CLOSE(socks[i]);
-                    socks[i] = CHIAKI_INVALID_SOCKET;
-                }
-                continue;
-            }
-            socks_count++;
-        }
-        CHIAKI_LOGI(session->log, "check_candidates: Opened %d NAT probing sockets", socks_count);
+        err = CHIAKI_ERR_MEMORY;
+        goto cleanup_sockets;
+    }
+    err = chiaki_port_guesser_init(&guesser, session->log, session->stun_random_allocation ? session->port_guessing_socks : 0, NAT_PROBING_TTL);
+    if(err == CHIAKI_ERR_NETWORK)
+    {
+        CHIAKI_LOGW(session->log, "check_candidates: Couldn't open any NAT probing sockets, continuing without");
+        err = chiaki_port_guesser_init(&guesser, session->log, 0, NAT_PROBING_TTL);
+    }
+    if(err != CHIAKI_ERR_SUCCESS)
+    {
+        CHIAKI_LOGE(session->log, "check_candidates: Creating port guesser failed: %s", chiaki_error_string(err));
+        goto cleanup_sockets;
     }
+    guesser_init = true;
+    err = chiaki_port_guesser_watch(&guesser, session->ipv4_sock);
+    if(err == CHIAKI_ERR_SUCCESS)
+        err = chiaki_port_guesser_watch(&guesser, session->ipv6_sock);
+    if(err != CHIAKI_ERR_SUCCESS)
+        goto cleanup_sockets;
     for (int i=0; i < num_candidates; i++)
     {
         Candidate *candidate = &candidates[i];
@@ -3951,7 +3746,6 @@ static ChiakiErrorCode check_candidates(
         }
         memcpy((struct sockaddr *)&addrs[i], addr_remote->ai_addr, addr_remote->ai_addrlen);
         lens[i] = addr_remote->ai_addrlen;
-        bool sent = false;
         switch(((struct sockaddr *)&addrs[i])->sa_family)
         {
             case AF_INET:
@@ -3965,24 +3759,13 @@ static ChiakiErrorCode check_candidates(
                         continue;
                     }
                 }
-                if(session->stun_random_allocation && ((candidate->type == CANDIDATE_TYPE_STATIC && !sent) || candidate->type == CANDIDATE_TYPE_STUN))
+                if(guesser.socks_open > 0 && (candidate->type == CANDIDATE_TYPE_STATIC || candidate->type == CANDIDATE_TYPE_STUN))
                 {
-                    for (int j=0; j<socks_count; j++)
-                    {
-                        if(CHIAKI_SOCKET_IS_INVALID(socks[j]))
-                            continue;
-                        if (sendto(socks[j], (CHIAKI_SOCKET_BUF_TYPE) request_buf[0], sizeof(request_buf[0]), 0, (struct sockaddr *)&addrs[i], lens[i]) < 0)
-                        {
-                            CHIAKI_LOGW(session->log, "check_candidates: Sending request for socket %d failed for %s:%d with error, closing socket: " CHIAKI_SOCKET_ERROR_FMT, j, candidate->addr, candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
-                            if (!CHIAKI_SOCKET_IS_INVALID(socks[j]))
-                            {
-                                CHIAKI_SOCKET_CLOSE(socks[j]);
-                                socks[j] = CHIAKI_INVALID_SOCKET;
-                            }
-                            continue;
-                        }
-                        sent = true;
-                    }
+                    memcpy(&burst_addrs[burst_count], &addrs[i], lens[i]);
+                    burst_lens[burst_count] = lens[i];
+                    burst_count++;
+                    if(candidate->type == CANDIDATE_TYPE_STUN && window_candidate < 0)
+                        window_candidate = i;
                 }
                 break;
             case AF_INET6:
@@ -4001,257 +3784,46 @@ static ChiakiErrorCode check_candidates(
                 CHIAKI_LOGW(session->log, "Unsupported address family, skipping...");
         }
         failed = false;
-        freeaddrinfo(addr_remote);
-    }
-    if(failed)
-    {
-        err = CHIAKI_ERR_NETWORK;
-        goto cleanup_sockets;
-    }
-
-    // Wait for responses
-    uint8_t response_buf[88];
-
-    chiaki_socket_t selected_sock = CHIAKI_INVALID_SOCKET;
-    Candidate *selected_candidate = NULL;
-    bool received_response = false;
-    bool responded = false;
-    bool connecting = false;
-    int retry_counter = 0;
-#if !defined(__SWITCH__) && !defined(__ANDROID__)
-    CandidateEventContext poll_ctx = {0};
-    size_t socket_slots = 0;
-    if (!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock))
-        socket_slots++;
-    if (!CHIAKI_SOCKET_IS_INVALID(session->ipv6_sock))
-        socket_slots++;
-    if (session->stun_random_allocation)
-        socket_slots += socks_count;
-    if (socket_slots == 0)
-    {
-        err = CHIAKI_ERR_NETWORK;
-        goto cleanup_sockets;
-    }
-    poll_ctx.base = event_base_new();
-    if (!poll_ctx.base)
-    {
-        err = CHIAKI_ERR_MEMORY;
-        goto cleanup_sockets;
-    }
-    poll_ctx.events = calloc(socket_slots, sizeof(struct event *));
-    if (!poll_ctx.events)
-    {
-        err = CHIAKI_ERR_MEMORY;
-        goto cleanup_sockets;
-    }
-    poll_ctx.events_capacity = socket_slots;
-    if (!candidate_event_add_socket(&poll_ctx, session->ipv4_sock) ||
-        !candidate_event_add_socket(&poll_ctx, session->ipv6_sock))
-    {
-        err = CHIAKI_ERR_MEMORY;
-        goto cleanup_sockets;
-    }
-    if (session->stun_random_allocation)
-    {
-        for (int i = 0; i < socks_count; i++)
-        {
-            if (CHIAKI_SOCKET_IS_INVALID(socks[i]))
-                continue;
-            if (!candidate_event_add_socket(&poll_ctx, socks[i]))
-            {
-                err = CHIAKI_ERR_MEMORY;
-                goto cleanup_sockets;
-            }
-        }
+        freeaddrinfo(addr_remote);
     }
-#endif
-#ifdef __SWITCH__
-    int poll_capacity = 0;
-    if(!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock))
-        poll_capacity++;
-    if(!CHIAKI_SOCKET_IS_INVALID(session->ipv6_sock))
-        poll_capacity++;
-    if(session->stun_random_allocation)
-        poll_capacity += socks_count;
-    if(poll_capacity == 0)
+    if(failed)
     {
         err = CHIAKI_ERR_NETWORK;
         goto cleanup_sockets;
     }
-    pollfds = calloc(poll_capacity, sizeof(struct pollfd));
-    if(!pollfds)
+    if(guesser.socks_open > 0)
     {
-        err = CHIAKI_ERR_MEMORY;
-        goto cleanup_sockets;
+        burst_base = burst_count;
+        if(window_candidate >= 0)
+            chiaki_port_window_init(&window, candidates[window_candidate].port, CHECK_CANDIDATES_WINDOW_MAX);
+        size_t probes = chiaki_port_guesser_burst(&guesser, request_buf[0], sizeof(request_buf[0]), burst_addrs, burst_lens, burst_count);
+        CHIAKI_LOGI(session->log, "check_candidates: Sent %zu NAT probes from %zu sockets", probes, guesser.socks_open);
     }
-#endif
+
+    // Wait for responses
+    uint8_t response_buf[88];
+
+    chiaki_socket_t selected_sock = CHIAKI_INVALID_SOCKET;
+    Candidate *selected_candidate = NULL;
+    bool received_response = false;
+    bool responded = false;
+    bool connecting = false;
+    int retry_counter = 0;
 
     while (!selected_candidate)
     {
-        bool timed_out = false;
         chiaki_socket_t ready_sock = CHIAKI_INVALID_SOCKET;
-#if !defined(__SWITCH__)
-        struct timeval timeout;
-#endif
-#ifdef __SWITCH__
-        nfds_t npollfds = 0;
-        if(!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock))
-        {
-            pollfds[npollfds].fd = session->ipv4_sock;
-            pollfds[npollfds].events = POLLIN;
-            pollfds[npollfds].revents = 0;
-            npollfds++;
-        }
-        if(!CHIAKI_SOCKET_IS_INVALID(session->ipv6_sock))
-        {
-            pollfds[npollfds].fd = session->ipv6_sock;
-            pollfds[npollfds].events = POLLIN;
-            pollfds[npollfds].revents = 0;
-            npollfds++;
-        }
-        if(session->stun_random_allocation)
-        {
-            for(int i=0; i<socks_count; i++)
-            {
-                if(CHIAKI_SOCKET_IS_INVALID(socks[i]))
-                    continue;
-                pollfds[npollfds].fd = socks[i];
-                pollfds[npollfds].events = POLLIN;
-                pollfds[npollfds].revents = 0;
-                npollfds++;
-            }
-        }
-        int timeout_ms = connecting
+        uint64_t timeout_ms = connecting
             ? SELECT_CANDIDATE_CONNECTION_SEC * 1000
-            : (int)(SELECT_CANDIDATE_TIMEOUT_SEC * 1000);
-
-        int ret = poll(pollfds, npollfds, timeout_ms);
-        if (ret < 0 && errno != EINTR)
-        {
-            CHIAKI_LOGE(session->log, "check_candidates: poll() failed with error: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-            err = CHIAKI_ERR_NETWORK;
-            goto cleanup_sockets;
-        }
-        else if (ret == 0)
-        {
-            timed_out = true;
-        }
-        else
-        {
-            for(nfds_t pi = 0; pi < npollfds; pi++)
-            {
-                if(!(pollfds[pi].revents & POLLIN))
-                    continue;
-                ready_sock = pollfds[pi].fd;
-                break;
-            }
-        }
-#elif defined(__ANDROID__)
-        chiaki_socket_t maxfd = -1;
-        FD_ZERO(&fds);
-        if(!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock))
-        {
-            FD_SET(session->ipv4_sock, &fds);
-            maxfd = session->ipv4_sock;
-        }
-        if(!CHIAKI_SOCKET_IS_INVALID(session->ipv6_sock))
-        {
-            FD_SET(session->ipv6_sock, &fds);
-            if(session->ipv6_sock > maxfd)
-                maxfd = session->ipv6_sock;
-        }
-        if(session->stun_random_allocation)
-        {
-            for(int i=0; i<socks_count; i++)
-            {
-                if(CHIAKI_SOCKET_IS_INVALID(socks[i]))
-                    continue;
-                if(socks[i] > maxfd)
-                    maxfd = socks[i];
-                FD_SET(socks[i], &fds);
-            }
-        }
-        maxfd = maxfd + 1;
-        if(connecting)
-        {
-            timeout.tv_sec = SELECT_CANDIDATE_CONNECTION_SEC;
-            timeout.tv_usec = 0;
-        }
-        else
-        {
-            timeout.tv_usec = (int)(SELECT_CANDIDATE_TIMEOUT_SEC * SECOND_US);
-            timeout.tv_sec = 0;
-        }
-        int ret = select(maxfd, &fds, NULL, NULL, &timeout);
-        if (ret < 0 && errno != EINTR)
-        {
-            CHIAKI_LOGE(session->log, "check_candidates: Select failed with error: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-            err = CHIAKI_ERR_NETWORK;
-            goto cleanup_sockets;
-        }
-        else if (ret == 0)
-        {
-            timed_out = true;
-        }
-        else
-        {
-            if (!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock) && FD_ISSET(session->ipv4_sock, &fds))
-            {
-                ready_sock = session->ipv4_sock;
-            }
-            else if (!CHIAKI_SOCKET_IS_INVALID(session->ipv6_sock) && FD_ISSET(session->ipv6_sock, &fds))
-            {
-                ready_sock = session->ipv6_sock;
-            }
-            else
-            {
-                for(int i=0; i<socks_count; i++)
-                {
-                    if(CHIAKI_SOCKET_IS_INVALID(socks[i]))
-                        continue;
-                    if(!FD_ISSET(socks[i], &fds))
-                        continue;
-                    ready_sock = socks[i];
-                    int ttl = 64;
-                    if (setsockopt(ready_sock, IPPROTO_IP, IP_TTL, (const CHIAKI_SOCKET_BUF_TYPE)&ttl, sizeof(ttl)) < 0)
-                    {
-                        CHIAKI_LOGE(session->log, "setsockopt(IP_TTL) failed with error" CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-                        if (!CHIAKI_SOCKET_IS_INVALID(socks[i]))
-                        {
-                            CHIAKI_SOCKET_CLOSE(socks[i]);
-                            socks[i] = CHIAKI_INVALID_SOCKET;
-                        }
-                        err = CHIAKI_ERR_UNKNOWN;
-                        goto cleanup_sockets;
-                    }
-                    break;
-                }
-            }
-        }
-#else
-        if (connecting)
-        {
-            timeout.tv_sec = SELECT_CANDIDATE_CONNECTION_SEC;
-            timeout.tv_usec = 0;
-        }
-        else
-        {
-            timeout.tv_sec = 0;
-            timeout.tv_usec = (int)(SELECT_CANDIDATE_TIMEOUT_SEC * SECOND_US);
-        }
-        poll_ctx.event_triggered = false;
-        poll_ctx.ready_sock = CHIAKI_INVALID_SOCKET;
-        event_base_loopexit(poll_ctx.base, &timeout);
-        int ret = event_base_dispatch(poll_ctx.base);
-        if (ret < 0)
+            : (uint64_t)(SELECT_CANDIDATE_TIMEOUT_SEC * 1000);
+        err = chiaki_port_guesser_wait(&guesser, timeout_ms, &ready_sock);
+        if (err != CHIAKI_ERR_SUCCESS && err != CHIAKI_ERR_TIMEOUT)
         {
-            CHIAKI_LOGE(session->log, "check_candidates: event_base_dispatch failed");
-            err = CHIAKI_ERR_NETWORK;
+            CHIAKI_LOGE(session->log, "check_candidates: Waiting for candidate responses failed");
             goto cleanup_sockets;
         }
-        timed_out = !poll_ctx.event_triggered;
-        ready_sock = poll_ctx.ready_sock;
-#endif
+        bool timed_out = err == CHIAKI_ERR_TIMEOUT;
+        err = CHIAKI_ERR_SUCCESS;
         if (timed_out)
         {
             if (CHIAKI_SOCKET_IS_INVALID(selected_sock))
@@ -4282,6 +3854,26 @@ static ChiakiErrorCode check_candidates(
                             continue;
                         }
                     }
+                    if(guesser.socks_open > 0)
+                    {
+                        // nothing got through yet, widen the guesses in case the console's NAT didn't keep its STUN port
+                        size_t guesses = 0;
+                        if(window_candidate >= 0)
+                        {
+                            uint16_t ports[CHECK_CANDIDATES_WINDOW_MAX];
+                            guesses = chiaki_port_window_widen(&window, CHECK_CANDIDATES_WINDOW_INITIAL, ports, CHECK_CANDIDATES_WINDOW_MAX - (burst_count - burst_base));
+                            for(size_t g=0; g<guesses; g++)
+                            {
+                                memcpy(&burst_addrs[burst_count], &addrs[window_candidate], lens[window_candidate]);
+                                ((struct sockaddr_in *)&burst_addrs[burst_count])->sin_port = htons(ports[g]);
+                                burst_lens[burst_count] = lens[window_candidate];
+                                burst_count++;
+                            }
+                        }
+                        size_t probes = chiaki_port_guesser_burst(&guesser, request_buf[0], sizeof(request_buf[0]), burst_addrs, burst_lens, burst_base);
+                        probes += chiaki_port_guesser_burst(&guesser, request_buf[0], sizeof(request_buf[0]), burst_addrs + burst_count - guesses, burst_lens + burst_count - guesses, guesses);
+                        CHIAKI_LOGI(session->log, "check_candidates: Sent %zu NAT probes, %zu new port guesses around %u", probes, guesses, window_candidate >= 0 ? (unsigned int)window.center : 0u);
+                    }
                     continue;
                 }
                 else if(received_response && !connecting)
@@ -4307,36 +3899,15 @@ static ChiakiErrorCode check_candidates(
         {
             recv_len = sizeof(struct sockaddr_in6);
         }
-        else if(session->stun_random_allocation)
+        else if(chiaki_port_guesser_owns(&guesser, candidate_sock))
         {
-            bool found = false;
-            for(int j=0; j<socks_count; j++)
-            {
-                if(socks[j] != candidate_sock)
-                    continue;
-                found = true;
-                recv_len = sizeof(struct sockaddr_in);
-#ifdef _WIN32
-                DWORD ttl = 64;
-#else
-                int ttl = 64;
-#endif
-                if (setsockopt(candidate_sock, IPPROTO_IP, IP_TTL, (const CHIAKI_SOCKET_BUF_TYPE)&ttl, sizeof(ttl)) < 0)
-                {
-                    CHIAKI_LOGE(session->log, "setsockopt(IP_TTL) failed with error" CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-                    if (!CHIAKI_SOCKET_IS_INVALID(socks[j]))
-                    {
-                        CHIAKI_SOCKET_CLOSE(socks[j]);
-                        socks[j] = CHIAKI_INVALID_SOCKET;
-                    }
-                    err = CHIAKI_ERR_UNKNOWN;
-                    goto cleanup_sockets;
-                }
-                break;
-            }
-            if (!found)
-                candidate_sock = CHIAKI_INVALID_SOCKET;
+            recv_len = sizeof(struct sockaddr_in);
+            err = chiaki_port_guesser_socket_ready(&guesser, candidate_sock);
+            if(err != CHIAKI_ERR_SUCCESS)
+                goto cleanup_sockets;
         }
+        else
+            candidate_sock = CHIAKI_INVALID_SOCKET;
         if(CHIAKI_SOCKET_IS_INVALID(candidate_sock))
         {
             CHIAKI_LOGE(session->log, "check_candidates: Waiting loop returned but no socket has data!");
@@ -4434,6 +4005,14 @@ static ChiakiErrorCode check_candidates(
                 lens[i] = recv_len;
                 extra_addresses_used++;
                 CHIAKI_LOGI(session->log, "check_candidates: Received new candidate at %s:%d", candidate->addr, candidate->port);
+                if(window_candidate >= 0 && recv_address->sa_family == AF_INET
+                    && strcmp(candidate->addr, candidates[window_candidate].addr) == 0
+                    && chiaki_port_window_recenter(&window, recv_address_port))
+                {
+                    // the console's NAT maps it to this port, further guesses are more likely to hit around it
+                    burst_count = burst_base;
+                    CHIAKI_LOGI(session->log, "check_candidates: Moving port guesses to %u", recv_address_port);
+                }
             }
             free(recv_address);
         }
@@ -4516,6 +4095,13 @@ static ChiakiErrorCode check_candidates(
     }
     *out = selected_sock;
     // Close non-chosen sockets
+    if(chiaki_port_guesser_owns(&guesser, selected_sock))
+    {
+        chiaki_port_guesser_release(&guesser, selected_sock);
+        released_sock = selected_sock;
+    }
+    chiaki_port_guesser_fini(&guesser);
+    guesser_init = false;
     if (session->ipv4_sock != *out && (!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock)))
     {
         CHIAKI_SOCKET_CLOSE(session->ipv4_sock);
@@ -4526,17 +4112,6 @@ static ChiakiErrorCode check_candidates(
         CHIAKI_SOCKET_CLOSE(session->ipv6_sock);
         session->ipv6_sock = CHIAKI_INVALID_SOCKET;
     }
-    if(session->stun_random_allocation)
-    {
-        for(int j=0; j<socks_count; j++)
-        {
-            if(!CHIAKI_SOCKET_IS_INVALID(socks[j]) && socks[j] != selected_sock)
-            {
-                CHIAKI_SOCKET_CLOSE(socks[j]);
-                socks[j] = CHIAKI_INVALID_SOCKET;
-            }
-        }
-    }
 
     err = receive_request_send_response_ps(session, out, selected_candidate, WAIT_RESPONSE_TIMEOUT_SEC);
     if(err == CHIAKI_ERR_TIMEOUT)
@@ -4547,18 +4122,6 @@ static ChiakiErrorCode check_candidates(
     else if(err != CHIAKI_ERR_SUCCESS)
         goto cleanup_sockets;
 
-#if !defined(__SWITCH__) && !defined(__ANDROID__)
-    for (size_t i = 0; i < poll_ctx.events_count; i++)
-        event_free(poll_ctx.events[i]);
-    free(poll_ctx.events);
-    poll_ctx.events = NULL;
-    if (poll_ctx.base)
-    {
-        event_base_free(poll_ctx.base);
-        poll_ctx.base = NULL;
-    }
-#endif
-
     memset(selected_candidate->addr_mapped, 0, sizeof(selected_candidate->addr_mapped));
     bool local = false;
     if(selected_candidate->type == CANDIDATE_TYPE_DERIVED)
@@ -4610,28 +4173,15 @@ static ChiakiErrorCode check_candidates(
     memcpy(out_candidate, selected_candidate, sizeof(Candidate));
     session->ipv4_sock = CHIAKI_INVALID_SOCKET;
     session->ipv6_sock = CHIAKI_INVALID_SOCKET;
-#ifdef __SWITCH__
-    free(pollfds);
-#endif
-    free(socks);
+    free(burst_addrs);
+    free(burst_lens);
     return CHIAKI_ERR_SUCCESS;
 
 cleanup_sockets:
-#if !defined(__SWITCH__) && !defined(__ANDROID__)
-    for (size_t i = 0; poll_ctx.events && i < poll_ctx.events_count; i++)
-        event_free(poll_ctx.events[i]);
-    free(poll_ctx.events);
-    poll_ctx.events = NULL;
-    if (poll_ctx.base)
-    {
-        event_base_free(poll_ctx.base);
-        poll_ctx.base = NULL;
-    }
-#endif
-#ifdef __SWITCH__
-    free(pollfds);
-    pollfds = NULL;
-#endif
+    if(guesser_init)
+        chiaki_port_guesser_fini(&guesser);
+    if(!CHIAKI_SOCKET_IS_INVALID(released_sock))
+        CHIAKI_SOCKET_CLOSE(released_sock);
     if(!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock))
     {
         CHIAKI_SOCKET_CLOSE(session->ipv4_sock);
@@ -4642,18 +4192,8 @@ cleanup_sockets:
         CHIAKI_SOCKET_CLOSE(session->ipv6_sock);
         session->ipv6_sock = CHIAKI_INVALID_SOCKET;
     }
-    if(session->stun_random_allocation)
-    {
-        for(int j=0; j<socks_count; j++)
-        {
-            if(!CHIAKI_SOCKET_IS_INVALID(socks[j]))
-            {
-                CHIAKI_SOCKET_CLOSE(socks[j]);
-                socks[j] = CHIAKI_INVALID_SOCKET;
-            }
-        }
-    }
-    free(socks);
+    free(burst_addrs);
+    free(burst_lens);
     return err;
 }
 
@@ -5020,57 +4560,39 @@ static ChiakiErrorCode wait_for_notification(
     Session *session, Notification** out,
     uint16_t types, uint64_t timeout_ms)
 {
-    uint64_t waiting_since = chiaki_time_now_monotonic_us();
-    uint64_t now = waiting_since;
-    Notification *last_known = NULL;
+    uint64_t deadline = chiaki_time_now_monotonic_ms() + timeout_ms;
 
     ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
     chiaki_mutex_lock(&session->notif_mutex);
     while (true) {
-        while (session->ws_notification_queue->rear == last_known || session->ws_notification_queue->rear == NULL)
+        Notification *notif = notification_queue_find(session->ws_notification_queue, types);
+        if (notif)
         {
-            err = chiaki_cond_timedwait(&session->notif_cond, &session->notif_mutex, timeout_ms);
-            if (err == CHIAKI_ERR_TIMEOUT)
-            {
-                now = chiaki_time_now_monotonic_us();
-                if ((now - waiting_since) > (timeout_ms * MILLISECONDS_US))
-                {
-                    CHIAKI_LOGE(session->log, "wait_for_notification: Timed out waiting for holepunch session messages");
-                    err = CHIAKI_ERR_TIMEOUT;
-                    goto cleanup;
-                }
-            }
-            assert(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_TIMEOUT);
-            chiaki_mutex_lock(&session->stop_mutex);
-            if(session->main_should_stop)
-            {
-                session->main_should_stop = false;
-                chiaki_mutex_unlock(&session->stop_mutex);
-                err = CHIAKI_ERR_CANCELED;
-                goto cleanup;
-            }
-            chiaki_mutex_unlock(&session->stop_mutex);
+            CHIAKI_LOGV(session->log, "wait_for_notification: Found notification of type %d", notif->type);
+            *out = notif;
+            err = CHIAKI_ERR_SUCCESS;
+            break;
         }
-        Notification *notif;
-        if(last_known)
-            notif = last_known->next;
-        else
-            notif = session->ws_notification_queue->front;
-        while (notif != NULL && notif != last_known)
+        uint64_t now = chiaki_time_now_monotonic_ms();
+        if (now >= deadline)
         {
-            if (notif->type & types)
-            {
-                CHIAKI_LOGV(session->log, "wait_for_notification: Found notification of type %d", notif->type);
-                *out = notif;
-                err = CHIAKI_ERR_SUCCESS;
-                goto cleanup;
-            }
-            last_known = notif;
-            notif = notif->next;
+            CHIAKI_LOGE(session->log, "wait_for_notification: Timed out waiting for holepunch session messages");
+            err = CHIAKI_ERR_TIMEOUT;
+            break;
+        }
+        err = chiaki_cond_timedwait(&session->notif_cond, &session->notif_mutex, deadline - now);
+        assert(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_TIMEOUT);
+        chiaki_mutex_lock(&session->stop_mutex);
+        if(session->main_should_stop)
+        {
+            session->main_should_stop = false;
+            chiaki_mutex_unlock(&session->stop_mutex);
+            err = CHIAKI_ERR_CANCELED;
+            break;
         }
+        chiaki_mutex_unlock(&session->stop_mutex);
     }
 
-cleanup:
     chiaki_mutex_unlock(&session->notif_mutex);
     return err;
 }
@@ -5080,8 +4602,10 @@ static ChiakiErrorCode clear_notification(
 {
     NotificationQueue *nq = session->ws_notification_queue;
     chiaki_mutex_lock(&session->notif_mutex);
+    size_t slot = notification_type_slot(notification->type);
+    // Notifications are almost always cleared right after being waited for, i.e. from the front
     Notification *prev = NULL;
-    Notification *curr = nq->front;
+    Notification *curr = nq->types[slot].front;
     while (curr != NULL && curr != notification)
     {
         prev = curr;
@@ -5097,16 +4621,12 @@ static ChiakiErrorCode clear_notification(
     if (prev)
         prev->next = curr->next;
     else
-        nq->front = curr->next;
+        nq->types[slot].front = curr->next;
 
-    if (curr == nq->rear)
-        nq->rear = prev;
+    if (curr == nq->types[slot].rear)
+        nq->types[slot].rear = prev;
 
-    json_object_put(curr->json);
-    curr->json = NULL;
-    free(curr->json_buf);
-    curr->json_buf = NULL;
-    free(curr);
+    notification_free(curr);
 
     chiaki_mutex_unlock(&session->notif_mutex);
     return CHIAKI_ERR_SUCCESS;
@@ -5716,53 +5236,29 @@ static ChiakiErrorCode get_stun_servers(Session *session)
 {
     ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
     const char STUN_HOSTS_URL[] = "https://raw.githubusercontent.com/pradt2/always-online-stun/master/valid_hosts.txt";
-    CURL *curl = curl_easy_init();
-    if(!curl)
-    {
-        CHIAKI_LOGE(session->log, "Curl could not init");
-        return CHIAKI_ERR_MEMORY;
-    }
-
-    HttpResponseData response_data = {
-        .data = malloc(0),
-        .size = 0,
+    const char STUN_HOSTS_URL_IPV6[] = "https://raw.githubusercontent.com/pradt2/always-online-stun/master/valid_ipv6s.txt";
+    // both lists are independent, fetch them concurrently
+    ChiakiHttpRequest reqs[2] = {
+        { .url = STUN_HOSTS_URL },
+        { .url = STUN_HOSTS_URL_IPV6 },
     };
-
-    CURLcode res = curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_stun_servers: CURL setopt CURLOPT_FAILONERROR failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_stun_servers: CURL setopt CURLOPT_TIMEOUT failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_URL, STUN_HOSTS_URL);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_stun_servers: CURL setopt CURLOPT_URL failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_stun_servers: CURL setopt CURLOPT_WRITEFUNCTION failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&response_data);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_stun_servers: CURL setopt CURLOPT_WRITEDATA failed with CURL error %s", curl_easy_strerror(res));
-
-    res = curl_easy_perform(curl);
-    if (res != CURLE_OK)
+    chiaki_http_client_perform_all(session->http, reqs, 2);
+    ChiakiHttpRequest *req = &reqs[0];
+    err = req->err;
+    if (err != CHIAKI_ERR_SUCCESS)
     {
-        if (res == CURLE_HTTP_RETURNED_ERROR)
+        if (err == CHIAKI_ERR_HTTP_NONOK)
         {
-            long http_code = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-            CHIAKI_LOGE(session->log, "Getting stun servers from %s failed with HTTP code %ld", STUN_HOSTS_URL, http_code);
-            CHIAKI_LOGV(session->log, "Response Body: %.*s.", (int)response_data.size, response_data.data);
-            err = CHIAKI_ERR_HTTP_NONOK;
+            CHIAKI_LOGE(session->log, "Getting stun servers from %s failed with HTTP code %ld", STUN_HOSTS_URL, req->http_code);
+            CHIAKI_LOGV(session->log, "Response Body: %.*s.", (int)req->response_size, req->response);
         } else {
-            CHIAKI_LOGE(session->log, "Getting stun servers from %s failed with CURL error %s", STUN_HOSTS_URL, curl_easy_strerror(res));
-            err = CHIAKI_ERR_NETWORK;
+            CHIAKI_LOGE(session->log, "Getting stun servers from %s failed with error %s", STUN_HOSTS_URL, req->error ? req->error : chiaki_error_string(err));
         }
         goto cleanup;
     }
     // hostname has max of 253 chars + 1 char for colon : + port has max of 4 chars + 1 char for null termination
     char server_strings[10][259];
-    char *ptr = strtok(response_data.data, "\n");
+    char *ptr = req->response ? strtok(req->response, "\n") : NULL;
     while(ptr != NULL && session->num_stun_servers <= 9)
     {
         strcpy(server_strings[session->num_stun_servers], ptr);
@@ -5777,14 +5273,16 @@ static ChiakiErrorCode get_stun_servers(Session *session)
         {
             CHIAKI_LOGW(session->log, "Problem reading stun server list host");
             session->num_stun_servers = i;
-            return CHIAKI_ERR_INVALID_DATA;
+            err = CHIAKI_ERR_INVALID_DATA;
+            goto cleanup;
         }
         session->stun_server_list[i].host = malloc((strlen(ptr) + 1) * sizeof(char));
         if(!session->stun_server_list[i].host)
         {
             CHIAKI_LOGW(session->log, "Problem allocating memory for stun server list host");
             session->num_stun_servers = i;
-            return CHIAKI_ERR_MEMORY;
+            err = CHIAKI_ERR_MEMORY;
+            goto cleanup;
         }
         strcpy(session->stun_server_list[i].host, ptr);
         ptr = strtok(NULL, ":");
@@ -5792,60 +5290,29 @@ static ChiakiErrorCode get_stun_servers(Session *session)
         {
             CHIAKI_LOGW(session->log, "Problem reading stun server list port");
             session->num_stun_servers = i;
-            return CHIAKI_ERR_INVALID_DATA;
+            err = CHIAKI_ERR_INVALID_DATA;
+            goto cleanup;
         }
         session->stun_server_list[i].port = strtol(ptr, NULL, 10);
         ptr = NULL;
     }
 
-    free(response_data.data);
-    response_data.data = malloc(0);
-    response_data.size = 0;
-    curl_easy_cleanup(curl);
-    curl = NULL;
-    const char STUN_HOSTS_URL_IPV6[] = "https://raw.githubusercontent.com/pradt2/always-online-stun/master/valid_ipv6s.txt";
-    curl = curl_easy_init();
-    if(!curl)
-    {
-        CHIAKI_LOGE(session->log, "Curl could not init");
-        return CHIAKI_ERR_MEMORY;
-    }
-
-    res = curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_stun_servers: CURL setopt CURLOPT_FAILONERROR failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_stun_servers: CURL setopt CURLOPT_TIMEOUT failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_URL, STUN_HOSTS_URL_IPV6);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_stun_servers: CURL setopt CURLOPT_URL failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_stun_servers: CURL setopt CURLOPT_WRITEFUNCTION failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&response_data);
-    if(res != CURLE_OK)
-        CHIAKI_LOGW(session->log, "get_stun_servers: CURL setopt CURLOPT_WRITEDATA failed with CURL error %s", curl_easy_strerror(res));
-
-    res = curl_easy_perform(curl);
-    if (res != CURLE_OK)
+    req = &reqs[1];
+    err = req->err;
+    if (err != CHIAKI_ERR_SUCCESS)
     {
-        if (res == CURLE_HTTP_RETURNED_ERROR)
+        if (err == CHIAKI_ERR_HTTP_NONOK)
         {
-            long http_code = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-            CHIAKI_LOGE(session->log, "Getting IPV6 stun servers from %s failed with HTTP code %ld", STUN_HOSTS_URL, http_code);
-            CHIAKI_LOGV(session->log, "Response Body: %.*s.", (int)response_data.size, response_data.data);
-            err = CHIAKI_ERR_HTTP_NONOK;
+            CHIAKI_LOGE(session->log, "Getting IPV6 stun servers from %s failed with HTTP code %ld", STUN_HOSTS_URL_IPV6, req->http_code);
+            CHIAKI_LOGV(session->log, "Response Body: %.*s.", (int)req->response_size, req->response);
         } else {
-            CHIAKI_LOGE(session->log, "Getting IPV6 stun servers from %s failed with CURL error %s", STUN_HOSTS_URL, curl_easy_strerror(res));
-            err = CHIAKI_ERR_NETWORK;
+            CHIAKI_LOGE(session->log, "Getting IPV6 stun servers from %s failed with error %s", STUN_HOSTS_URL_IPV6, req->error ? req->error : chiaki_error_string(err));
         }
         goto cleanup;
     }
     // ipv6 string has max of 45 chars: 39 chars + 2 chars for [] + 1 char for colon : + port has max of 4 chars + 1 char for null termination
     char server_strings_ipv6[10][47];
-    ptr = strtok(response_data.data, "\n");
+    ptr = req->response ? strtok(req->response, "\n") : NULL;
     while(ptr != NULL && session->num_stun_servers_ipv6 <= 9)
     {
         // omit leading [
@@ -5861,14 +5328,16 @@ static ChiakiErrorCode get_stun_servers(Session *session)
         {
             CHIAKI_LOGW(session->log, "Problem reading stun server list host");
             session->num_stun_servers_ipv6 = i;
-            return CHIAKI_ERR_INVALID_DATA;
+            err = CHIAKI_ERR_INVALID_DATA;
+            goto cleanup;
         }
         session->stun_server_list_ipv6[i].host = malloc((strlen(ptr) + 1) * sizeof(char));
         if(!session->stun_server_list_ipv6[i].host)
         {
             CHIAKI_LOGW(session->log, "Problem allocating memory for stun server list host");
             session->num_stun_servers_ipv6 = i;
-            return CHIAKI_ERR_MEMORY;
+            err = CHIAKI_ERR_MEMORY;
+            goto cleanup;
         }
         strcpy(session->stun_server_list_ipv6[i].host, ptr);
         ptr = strtok(NULL, "]");
@@ -5876,7 +5345,8 @@ static ChiakiErrorCode get_stun_servers(Session *session)
         {
             CHIAKI_LOGW(session->log, "Problem reading stun server list port");
             session->num_stun_servers_ipv6 = i;
-            return CHIAKI_ERR_INVALID_DATA;
+            err = CHIAKI_ERR_INVALID_DATA;
+            goto cleanup;
         }
         // omit :
         session->stun_server_list_ipv6[i].port = strtol(ptr + 1, NULL, 10);
@@ -5884,8 +5354,8 @@ static ChiakiErrorCode get_stun_servers(Session *session)
     }
 
 cleanup:
-    free(response_data.data);
-    curl_easy_cleanup(curl);
+    chiaki_http_request_fini(&reqs[0]);
+    chiaki_http_request_fini(&reqs[1]);
     return err;
 }
 
@@ -5974,33 +5444,21 @@ static void print_candidate(ChiakiLog *log, Candidate *candidate)
  * @return nq Pointer to a NotificationQueue to be used for the session.
 */
 
-static NotificationQueue *createNq()
-{
-    NotificationQueue *nq = (NotificationQueue*)malloc(sizeof(NotificationQueue));
-    if(!nq)
-        return NULL;
-    nq->front = nq->rear = NULL;
-    return nq;
-}
-
 /**
- * Delete a notification from the queue
- *
- * @param nq the notification queue to dequeue from
+ * Index into NotificationQueue.types for a notification type
 */
-
-static void dequeueNq(NotificationQueue *nq)
+static size_t notification_type_slot(NotificationType type)
 {
-    if(nq->front == NULL)
-        return;
-
-    Notification *notif = nq->front;
-
-    nq->front = nq->front->next;
-
-    if(nq->front == NULL)
-        nq->rear = NULL;
+    for(size_t slot = 1; slot < NOTIFICATION_TYPE_SLOTS; slot++)
+    {
+        if(type & (1 << (slot - 1)))
+            return slot;
+    }
+    return 0;
+}
 
+static void notification_free(Notification *notif)
+{
     json_object_put(notif->json);
     notif->json = NULL;
     free(notif->json_buf);
@@ -6008,6 +5466,14 @@ static void dequeueNq(NotificationQueue *nq)
     free(notif);
 }
 
+static NotificationQueue *createNq()
+{
+    NotificationQueue *nq = (NotificationQueue*)calloc(1, sizeof(NotificationQueue));
+    if(!nq)
+        return NULL;
+    return nq;
+}
+
 /**
  * Adds a notification to the queue.
  *
@@ -6017,13 +5483,37 @@ static void dequeueNq(NotificationQueue *nq)
 
 static void enqueueNq(NotificationQueue *nq, Notification*notif)
 {
-    if(nq->rear == NULL)
+    size_t slot = notification_type_slot(notif->type);
+    notif->seq = nq->next_seq++;
+    notif->next = NULL;
+    if(nq->types[slot].rear == NULL)
     {
-        nq->front = nq->rear = notif;
+        nq->types[slot].front = nq->types[slot].rear = notif;
         return;
     }
-    nq->rear->next = notif;
-    nq->rear = notif;
+    nq->types[slot].rear->next = notif;
+    nq->types[slot].rear = notif;
+}
+
+/**
+ * Find the oldest notification of any of the given types
+ *
+ * @param nq the notification queue to search
+ * @param types the types to look for (ORed together if multiple)
+ * @return the notification, still owned by the queue, or NULL if there is none
+*/
+static Notification *notification_queue_find(NotificationQueue *nq, uint16_t types)
+{
+    Notification *found = NULL;
+    for(size_t slot = 1; slot < NOTIFICATION_TYPE_SLOTS; slot++)
+    {
+        if(!(types & (1 << (slot - 1))))
+            continue;
+        Notification *front = nq->types[slot].front;
+        if(front && (!found || front->seq < found->seq))
+            found = front;
+    }
+    return found;
 }
 
 /**
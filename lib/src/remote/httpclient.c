@@ -0,0 +1,445 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/remote/httpclient.h>
+#include <chiaki/thread.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <curl/curl.h>
+
+#define HTTP_CLIENT_POLL_TIMEOUT_MS 1000
+
+typedef struct http_transfer_t
+{
+	ChiakiHttpRequest *req;
+	CURL *curl;
+	struct curl_slist *headers;
+	bool done; // protected by the client's mutex
+	struct http_transfer_t *next; // in the client's queue or active list
+} HttpTransfer;
+
+/**
+ * All transfers go through one multi handle that lives as long as the client, so its connections
+ * are kept between calls and concurrent requests to the same host multiplex on one HTTP/2 connection.
+ * A multi handle may only be used by one thread at a time, so whichever thread is waiting for its
+ * requests drives it for everyone. Other threads queue their transfers and wake it up.
+ */
+struct chiaki_http_client_t
+{
+	ChiakiLog *log;
+	CURLSH *share;
+	ChiakiMutex share_mutex[CURL_LOCK_DATA_LAST];
+	CURLM *multi;
+	HttpTransfer *active; // added to multi, only accessed by the driving thread
+
+	ChiakiMutex mutex; // for everything below
+	ChiakiCond cond; // broadcast when a transfer is done or nobody is driving anymore
+	bool driving;
+	HttpTransfer *queued; // waiting to be added to multi by the driving thread
+	char *ca_file;
+	CURL *pool[CHIAKI_HTTP_CLIENT_POOL_SIZE]; // idle handles
+	size_t pool_count;
+	ChiakiHttpClientStats stats;
+};
+
+static void share_lock_cb(CURL *handle, curl_lock_data data, curl_lock_access access, void *user)
+{
+	(void)handle; (void)access;
+	ChiakiHttpClient *client = user;
+	chiaki_mutex_lock(&client->share_mutex[data]);
+}
+
+static void share_unlock_cb(CURL *handle, curl_lock_data data, void *user)
+{
+	(void)handle;
+	ChiakiHttpClient *client = user;
+	chiaki_mutex_unlock(&client->share_mutex[data]);
+}
+
+CHIAKI_EXPORT ChiakiHttpClient *chiaki_http_client_new(ChiakiLog *log)
+{
+	ChiakiHttpClient *client = calloc(1, sizeof(ChiakiHttpClient));
+	if(!client)
+		return NULL;
+	client->log = log;
+
+	size_t share_mutexes = 0;
+	for(; share_mutexes < CURL_LOCK_DATA_LAST; share_mutexes++)
+	{
+		if(chiaki_mutex_init(&client->share_mutex[share_mutexes], false) != CHIAKI_ERR_SUCCESS)
+			goto error_share_mutexes;
+	}
+	if(chiaki_mutex_init(&client->mutex, false) != CHIAKI_ERR_SUCCESS)
+		goto error_share_mutexes;
+	if(chiaki_cond_init(&client->cond) != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+
+	client->multi = curl_multi_init();
+	if(!client->multi)
+		goto error_cond;
+	client->share = curl_share_init();
+	if(!client->share)
+		goto error_multi;
+	curl_share_setopt(client->share, CURLSHOPT_LOCKFUNC, share_lock_cb);
+	curl_share_setopt(client->share, CURLSHOPT_UNLOCKFUNC, share_unlock_cb);
+	curl_share_setopt(client->share, CURLSHOPT_USERDATA, client);
+	curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	// connections are kept by the multi handle
+	curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	return client;
+
+error_multi:
+	curl_multi_cleanup(client->multi);
+error_cond:
+	chiaki_cond_fini(&client->cond);
+error_mutex:
+	chiaki_mutex_fini(&client->mutex);
+error_share_mutexes:
+	while(share_mutexes > 0)
+		chiaki_mutex_fini(&client->share_mutex[--share_mutexes]);
+	free(client);
+	return NULL;
+}
+
+CHIAKI_EXPORT void chiaki_http_client_free(ChiakiHttpClient *client)
+{
+	if(!client)
+		return;
+	curl_multi_cleanup(client->multi);
+	for(size_t i = 0; i < client->pool_count; i++)
+		curl_easy_cleanup(client->pool[i]);
+	curl_share_cleanup(client->share);
+	free(client->ca_file);
+	chiaki_cond_fini(&client->cond);
+	chiaki_mutex_fini(&client->mutex);
+	for(size_t i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		chiaki_mutex_fini(&client->share_mutex[i]);
+	free(client);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_http_client_set_ca_file(ChiakiHttpClient *client, const char *file)
+{
+	char *dup = file ? strdup(file) : NULL;
+	if(file && !dup)
+		return CHIAKI_ERR_MEMORY;
+	chiaki_mutex_lock(&client->mutex);
+	free(client->ca_file);
+	client->ca_file = dup;
+	chiaki_mutex_unlock(&client->mutex);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static CURL *handle_acquire(ChiakiHttpClient *client)
+{
+	CURL *curl = NULL;
+	chiaki_mutex_lock(&client->mutex);
+	if(client->pool_count > 0)
+		curl = client->pool[--client->pool_count];
+	chiaki_mutex_unlock(&client->mutex);
+	if(!curl)
+		curl = curl_easy_init();
+	return curl;
+}
+
+static void handle_release(ChiakiHttpClient *client, CURL *curl)
+{
+	curl_easy_reset(curl);
+	chiaki_mutex_lock(&client->mutex);
+	if(client->pool_count < CHIAKI_HTTP_CLIENT_POOL_SIZE)
+	{
+		client->pool[client->pool_count++] = curl;
+		curl = NULL;
+	}
+	chiaki_mutex_unlock(&client->mutex);
+	if(curl)
+		curl_easy_cleanup(curl);
+}
+
+static size_t write_cb(void *ptr, size_t size, size_t nmemb, void *user)
+{
+	ChiakiHttpRequest *req = user;
+	size_t len = size * nmemb;
+	char *response = realloc(req->response, req->response_size + len + 1);
+	if(!response)
+		return 0;
+	memcpy(response + req->response_size, ptr, len);
+	req->response = response;
+	req->response_size += len;
+	req->response[req->response_size] = '\0';
+	return len;
+}
+
+static void request_reset(ChiakiHttpRequest *req, ChiakiErrorCode err)
+{
+	req->err = err;
+	req->http_code = 0;
+	req->error = NULL;
+	chiaki_http_request_fini(req);
+}
+
+static ChiakiErrorCode request_setup(ChiakiHttpClient *client, CURL *curl, ChiakiHttpRequest *req, struct curl_slist **headers, HttpTransfer *transfer)
+{
+	request_reset(req, CHIAKI_ERR_UNKNOWN);
+	*headers = NULL;
+	if(req->headers)
+	{
+		for(const char **header = req->headers; *header; header++)
+		{
+			struct curl_slist *appended = curl_slist_append(*headers, *header);
+			if(!appended)
+			{
+				curl_slist_free_all(*headers);
+				*headers = NULL;
+				return CHIAKI_ERR_MEMORY;
+			}
+			*headers = appended;
+		}
+	}
+
+	curl_easy_setopt(curl, CURLOPT_SHARE, client->share);
+	curl_easy_setopt(curl, CURLOPT_URL, req->url);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, req->timeout_sec ? req->timeout_sec : (long)CHIAKI_HTTP_DEFAULT_TIMEOUT_SEC);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, *headers);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, req);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+	// rather wait for a connection that is being set up to multiplex on than open another one
+	curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+	if(req->body)
+	{
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)req->body_size);
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, req->body);
+	}
+	if(req->method)
+		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, req->method);
+
+	chiaki_mutex_lock(&client->mutex);
+	if(client->ca_file)
+		curl_easy_setopt(curl, CURLOPT_CAINFO, client->ca_file);
+	chiaki_mutex_unlock(&client->mutex);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static void request_finish(ChiakiHttpClient *client, CURL *curl, ChiakiHttpRequest *req, CURLcode res)
+{
+	long connects = 0;
+	curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &req->http_code);
+	if(res != CURLE_OK)
+	{
+		req->err = res == CURLE_OUT_OF_MEMORY ? CHIAKI_ERR_MEMORY : CHIAKI_ERR_NETWORK;
+		req->error = curl_easy_strerror(res);
+	}
+	else if(req->http_code >= 400)
+		req->err = CHIAKI_ERR_HTTP_NONOK;
+	else
+		req->err = CHIAKI_ERR_SUCCESS;
+
+	chiaki_mutex_lock(&client->mutex);
+	client->stats.requests++;
+	client->stats.connects += (uint64_t)connects;
+	chiaki_mutex_unlock(&client->mutex);
+}
+
+static void transfer_done(ChiakiHttpClient *client, HttpTransfer *transfer)
+{
+	chiaki_mutex_lock(&client->mutex);
+	transfer->done = true;
+	chiaki_mutex_unlock(&client->mutex);
+	chiaki_cond_broadcast(&client->cond);
+}
+
+static bool transfers_done(HttpTransfer *transfers, size_t count)
+{
+	for(size_t i = 0; i < count; i++)
+		if(!transfers[i].done)
+			return false;
+	return true;
+}
+
+static void active_remove(ChiakiHttpClient *client, HttpTransfer *transfer)
+{
+	for(HttpTransfer **t = &client->active; *t; t = &(*t)->next)
+	{
+		if(*t == transfer)
+		{
+			*t = transfer->next;
+			break;
+		}
+	}
+	curl_multi_remove_handle(client->multi, transfer->curl);
+}
+
+/**
+ * Run the multi handle until all of transfers are done, finishing other threads' transfers along the way.
+ * Called with client->driving set by the caller, without the mutex held.
+ */
+static void multi_drive(ChiakiHttpClient *client, HttpTransfer *transfers, size_t count)
+{
+	while(true)
+	{
+		chiaki_mutex_lock(&client->mutex);
+		HttpTransfer *queued = client->queued;
+		client->queued = NULL;
+		bool done = transfers_done(transfers, count);
+		chiaki_mutex_unlock(&client->mutex);
+
+		while(queued)
+		{
+			HttpTransfer *transfer = queued;
+			queued = transfer->next;
+			if(curl_multi_add_handle(client->multi, transfer->curl) != CURLM_OK)
+			{
+				request_reset(transfer->req, CHIAKI_ERR_UNKNOWN);
+				transfer_done(client, transfer);
+				continue;
+			}
+			transfer->next = client->active;
+			client->active = transfer;
+		}
+		if(done)
+			break;
+
+		int running = 0;
+		CURLMcode mres = curl_multi_perform(client->multi, &running);
+		CURLMsg *msg;
+		int msgs_left;
+		while((msg = curl_multi_info_read(client->multi, &msgs_left)))
+		{
+			if(msg->msg != CURLMSG_DONE)
+				continue;
+			HttpTransfer *transfer = NULL;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&transfer);
+			if(!transfer)
+				continue;
+			request_finish(client, transfer->curl, transfer->req, msg->data.result);
+			active_remove(client, transfer);
+			transfer_done(client, transfer);
+		}
+		chiaki_mutex_lock(&client->mutex);
+		done = transfers_done(transfers, count);
+		chiaki_mutex_unlock(&client->mutex);
+		if(done)
+			break;
+		if(mres == CURLM_OK)
+			mres = curl_multi_poll(client->multi, NULL, 0, HTTP_CLIENT_POLL_TIMEOUT_MS, NULL);
+		if(mres != CURLM_OK)
+		{
+			CHIAKI_LOGE(client->log, "HTTP client multi transfer failed: %s", curl_multi_strerror(mres));
+			while(client->active)
+			{
+				HttpTransfer *transfer = client->active;
+				active_remove(client, transfer);
+				request_reset(transfer->req, CHIAKI_ERR_UNKNOWN);
+				transfer_done(client, transfer);
+			}
+		}
+	}
+
+	chiaki_mutex_lock(&client->mutex);
+	client->driving = false;
+	chiaki_mutex_unlock(&client->mutex);
+	chiaki_cond_broadcast(&client->cond);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_http_client_perform(ChiakiHttpClient *client, ChiakiHttpRequest *req)
+{
+	return chiaki_http_client_perform_all(client, req, 1);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_http_client_perform_all(ChiakiHttpClient *client, ChiakiHttpRequest *reqs, size_t count)
+{
+	if(count == 0)
+		return CHIAKI_ERR_SUCCESS;
+
+	HttpTransfer *transfers = calloc(count, sizeof(HttpTransfer));
+	if(!transfers)
+	{
+		for(size_t i = 0; i < count; i++)
+			request_reset(&reqs[i], CHIAKI_ERR_MEMORY);
+		return CHIAKI_ERR_MEMORY;
+	}
+
+	HttpTransfer *queue = NULL;
+	for(size_t i = count; i-- > 0;)
+	{
+		HttpTransfer *transfer = &transfers[i];
+		transfer->req = &reqs[i];
+		transfer->curl = handle_acquire(client);
+		if(!transfer->curl)
+		{
+			request_reset(transfer->req, CHIAKI_ERR_MEMORY);
+			transfer->done = true;
+			continue;
+		}
+		ChiakiErrorCode err = request_setup(client, transfer->curl, transfer->req, &transfer->headers, transfer);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			transfer->req->err = err;
+			handle_release(client, transfer->curl);
+			transfer->curl = NULL;
+			transfer->done = true;
+			continue;
+		}
+		transfer->next = queue;
+		queue = transfer;
+	}
+
+	chiaki_mutex_lock(&client->mutex);
+	if(queue)
+	{
+		HttpTransfer *last = queue;
+		while(last->next)
+			last = last->next;
+		last->next = client->queued;
+		client->queued = queue;
+		if(client->driving)
+			curl_multi_wakeup(client->multi);
+	}
+	while(!transfers_done(transfers, count))
+	{
+		if(!client->driving)
+		{
+			client->driving = true;
+			chiaki_mutex_unlock(&client->mutex);
+			multi_drive(client, transfers, count);
+			chiaki_mutex_lock(&client->mutex);
+			continue;
+		}
+		chiaki_cond_wait(&client->cond, &client->mutex);
+	}
+	chiaki_mutex_unlock(&client->mutex);
+
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	for(size_t i = 0; i < count; i++)
+	{
+		HttpTransfer *transfer = &transfers[i];
+		if(transfer->curl)
+		{
+			curl_slist_free_all(transfer->headers);
+			handle_release(client, transfer->curl);
+		}
+		if(err == CHIAKI_ERR_SUCCESS)
+			err = reqs[i].err;
+	}
+	free(transfers);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_http_client_get_stats(ChiakiHttpClient *client, ChiakiHttpClientStats *stats)
+{
+	chiaki_mutex_lock(&client->mutex);
+	*stats = client->stats;
+	chiaki_mutex_unlock(&client->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_http_request_fini(ChiakiHttpRequest *req)
+{
+	free(req->response);
+	req->response = NULL;
+	req->response_size = 0;
+}
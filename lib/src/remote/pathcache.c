@@ -0,0 +1,471 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/remote/pathcache.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <iphlpapi.h>
+#elif defined(__SWITCH__)
+#include <unistd.h>
+#include <arpa/inet.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#endif
+
+#include <json-c/json_object.h>
+#include <json-c/json_tokener.h>
+
+#define PATH_CACHE_FILE_VERSION 1
+#define PATH_CACHE_FILE_SIZE_MAX (1024 * 1024)
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_network_path_cache_init(ChiakiNetworkPathCache *cache, const char *file, ChiakiLog *log)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->log = log;
+	ChiakiErrorCode err = chiaki_mutex_init(&cache->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	if(!file)
+		return CHIAKI_ERR_SUCCESS;
+	cache->file = strdup(file);
+	if(!cache->file)
+	{
+		chiaki_mutex_fini(&cache->mutex);
+		return CHIAKI_ERR_MEMORY;
+	}
+
+	FILE *f = fopen(file, "rb");
+	if(!f)
+		return CHIAKI_ERR_SUCCESS; // nothing cached yet
+	char *buf = malloc(PATH_CACHE_FILE_SIZE_MAX + 1);
+	if(!buf)
+	{
+		fclose(f);
+		return CHIAKI_ERR_SUCCESS;
+	}
+	size_t size = fread(buf, 1, PATH_CACHE_FILE_SIZE_MAX, f);
+	fclose(f);
+	buf[size] = '\0';
+	json_object *root = json_tokener_parse(buf);
+	free(buf);
+
+	json_object *version = NULL;
+	json_object *paths = NULL;
+	if(!root
+			|| !json_object_object_get_ex(root, "version", &version)
+			|| json_object_get_int64(version) != PATH_CACHE_FILE_VERSION
+			|| !json_object_object_get_ex(root, "paths", &paths)
+			|| !json_object_is_type(paths, json_type_array))
+	{
+		CHIAKI_LOGW(log, "Network path cache %s is invalid, starting over", file);
+		if(root)
+			json_object_put(root);
+		return CHIAKI_ERR_SUCCESS;
+	}
+
+	size_t count = json_object_array_length(paths);
+	for(size_t i=0; i<count && cache->entries_count < CHIAKI_NETWORK_PATH_CACHE_ENTRIES_MAX; i++)
+	{
+		json_object *entry = json_object_array_get_idx(paths, i);
+		json_object *val = NULL;
+		if(!json_object_object_get_ex(entry, "network_id", &val) || !json_object_is_type(val, json_type_string))
+			continue;
+		ChiakiNetworkPath *path = &cache->entries[cache->entries_count++];
+		memset(path, 0, sizeof(*path));
+		snprintf(path->network_id, sizeof(path->network_id), "%s", json_object_get_string(val));
+		if(json_object_object_get_ex(entry, "updated", &val))
+			path->updated = (uint64_t)json_object_get_int64(val);
+
+		json_object *allocation = NULL;
+		if(json_object_object_get_ex(entry, "allocation", &allocation))
+		{
+			path->allocation_known = true;
+			if(json_object_object_get_ex(allocation, "increment", &val))
+				path->allocation_increment = (int32_t)json_object_get_int64(val);
+			if(json_object_object_get_ex(allocation, "random", &val))
+				path->random_allocation = json_object_get_boolean(val);
+		}
+
+		if(json_object_object_get_ex(entry, "upnp", &val))
+		{
+			const char *upnp = json_object_get_string(val);
+			if(upnp && strcmp(upnp, "none") == 0)
+				path->upnp = CHIAKI_NETWORK_PATH_UPNP_NONE;
+			else if(upnp && strcmp(upnp, "found") == 0
+					&& json_object_object_get_ex(entry, "upnp_root_desc_url", &val))
+			{
+				path->upnp = CHIAKI_NETWORK_PATH_UPNP_FOUND;
+				snprintf(path->upnp_root_desc_url, sizeof(path->upnp_root_desc_url), "%s", json_object_get_string(val));
+			}
+		}
+
+		json_object *servers = NULL;
+		if(json_object_object_get_ex(entry, "stun_servers", &servers) && json_object_is_type(servers, json_type_array))
+		{
+			size_t servers_count = json_object_array_length(servers);
+			for(size_t j=0; j<servers_count && path->stun_servers_count < CHIAKI_NETWORK_PATH_STUN_SERVERS_MAX; j++)
+			{
+				json_object *server = json_object_array_get_idx(servers, j);
+				json_object *host = NULL, *port = NULL;
+				if(!json_object_object_get_ex(server, "host", &host) || !json_object_object_get_ex(server, "port", &port))
+					continue;
+				ChiakiNetworkPathStunServer *s = &path->stun_servers[path->stun_servers_count++];
+				snprintf(s->host, sizeof(s->host), "%s", json_object_get_string(host));
+				s->port = (uint16_t)json_object_get_int64(port);
+			}
+		}
+
+		json_object *candidate = NULL;
+		if(json_object_object_get_ex(entry, "candidate", &candidate))
+		{
+			if(json_object_object_get_ex(candidate, "console_uid", &val))
+				snprintf(path->console_uid, sizeof(path->console_uid), "%s", json_object_get_string(val));
+			if(json_object_object_get_ex(candidate, "type", &val))
+				path->candidate_type = (int)json_object_get_int64(val);
+			if(json_object_object_get_ex(candidate, "addr", &val))
+				snprintf(path->candidate_addr, sizeof(path->candidate_addr), "%s", json_object_get_string(val));
+			if(json_object_object_get_ex(candidate, "port", &val))
+				path->candidate_port = (uint16_t)json_object_get_int64(val);
+		}
+	}
+	json_object_put(root);
+	CHIAKI_LOGV(log, "Loaded %zu cached network paths from %s", cache->entries_count, file);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_network_path_cache_fini(ChiakiNetworkPathCache *cache)
+{
+	free(cache->file);
+	cache->file = NULL;
+	chiaki_mutex_fini(&cache->mutex);
+}
+
+static json_object *path_to_json(const ChiakiNetworkPath *path)
+{
+	json_object *entry = json_object_new_object();
+	json_object_object_add(entry, "network_id", json_object_new_string(path->network_id));
+	json_object_object_add(entry, "updated", json_object_new_int64((int64_t)path->updated));
+	if(path->allocation_known)
+	{
+		json_object *allocation = json_object_new_object();
+		json_object_object_add(allocation, "increment", json_object_new_int64(path->allocation_increment));
+		json_object_object_add(allocation, "random", json_object_new_boolean(path->random_allocation));
+		json_object_object_add(entry, "allocation", allocation);
+	}
+	if(path->upnp == CHIAKI_NETWORK_PATH_UPNP_NONE)
+		json_object_object_add(entry, "upnp", json_object_new_string("none"));
+	else if(path->upnp == CHIAKI_NETWORK_PATH_UPNP_FOUND)
+	{
+		json_object_object_add(entry, "upnp", json_object_new_string("found"));
+		json_object_object_add(entry, "upnp_root_desc_url", json_object_new_string(path->upnp_root_desc_url));
+	}
+	json_object *servers = json_object_new_array();
+	for(size_t i=0; i<path->stun_servers_count; i++)
+	{
+		json_object *server = json_object_new_object();
+		json_object_object_add(server, "host", json_object_new_string(path->stun_servers[i].host));
+		json_object_object_add(server, "port", json_object_new_int64(path->stun_servers[i].port));
+		json_object_array_add(servers, server);
+	}
+	json_object_object_add(entry, "stun_servers", servers);
+	if(path->console_uid[0])
+	{
+		json_object *candidate = json_object_new_object();
+		json_object_object_add(candidate, "console_uid", json_object_new_string(path->console_uid));
+		json_object_object_add(candidate, "type", json_object_new_int64(path->candidate_type));
+		json_object_object_add(candidate, "addr", json_object_new_string(path->candidate_addr));
+		json_object_object_add(candidate, "port", json_object_new_int64(path->candidate_port));
+		json_object_object_add(entry, "candidate", candidate);
+	}
+	return entry;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_network_path_cache_save(ChiakiNetworkPathCache *cache)
+{
+	if(!cache->file)
+		return CHIAKI_ERR_SUCCESS;
+
+	chiaki_mutex_lock(&cache->mutex);
+	json_object *root = json_object_new_object();
+	json_object_object_add(root, "version", json_object_new_int64(PATH_CACHE_FILE_VERSION));
+	json_object *paths = json_object_new_array();
+	for(size_t i=0; i<cache->entries_count; i++)
+		json_object_array_add(paths, path_to_json(&cache->entries[i]));
+	json_object_object_add(root, "paths", paths);
+	chiaki_mutex_unlock(&cache->mutex);
+
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	size_t tmp_size = strlen(cache->file) + 5;
+	char *tmp = malloc(tmp_size);
+	if(!tmp)
+	{
+		json_object_put(root);
+		return CHIAKI_ERR_MEMORY;
+	}
+	snprintf(tmp, tmp_size, "%s.tmp", cache->file);
+	FILE *f = fopen(tmp, "wb");
+	if(!f)
+	{
+		CHIAKI_LOGW(cache->log, "Failed to open %s for writing network path cache", tmp);
+		err = CHIAKI_ERR_UNKNOWN;
+		goto beach;
+	}
+	const char *str = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PRETTY);
+	size_t len = strlen(str);
+	bool written = fwrite(str, 1, len, f) == len;
+	written = fclose(f) == 0 && written;
+	if(!written)
+	{
+		CHIAKI_LOGW(cache->log, "Failed to write network path cache to %s", tmp);
+		remove(tmp);
+		err = CHIAKI_ERR_UNKNOWN;
+		goto beach;
+	}
+#ifdef _WIN32
+	if(!MoveFileExA(tmp, cache->file, MOVEFILE_REPLACE_EXISTING))
+#else
+	if(rename(tmp, cache->file) != 0)
+#endif
+	{
+		CHIAKI_LOGW(cache->log, "Failed to replace network path cache %s", cache->file);
+		remove(tmp);
+		err = CHIAKI_ERR_UNKNOWN;
+	}
+beach:
+	free(tmp);
+	json_object_put(root);
+	return err;
+}
+
+CHIAKI_EXPORT bool chiaki_network_path_cache_lookup(ChiakiNetworkPathCache *cache, const char *network_id, uint64_t max_age_sec, ChiakiNetworkPath *path)
+{
+	uint64_t now = (uint64_t)time(NULL);
+	bool found = false;
+	chiaki_mutex_lock(&cache->mutex);
+	for(size_t i=0; i<cache->entries_count; i++)
+	{
+		ChiakiNetworkPath *entry = &cache->entries[i];
+		if(strcmp(entry->network_id, network_id) != 0)
+			continue;
+		if(max_age_sec && (entry->updated > now || now - entry->updated > max_age_sec))
+			break;
+		*path = *entry;
+		found = true;
+		break;
+	}
+	chiaki_mutex_unlock(&cache->mutex);
+	return found;
+}
+
+CHIAKI_EXPORT void chiaki_network_path_cache_store(ChiakiNetworkPathCache *cache, ChiakiNetworkPath *path)
+{
+	path->updated = (uint64_t)time(NULL);
+	chiaki_mutex_lock(&cache->mutex);
+	ChiakiNetworkPath *slot = NULL;
+	for(size_t i=0; i<cache->entries_count; i++)
+	{
+		if(strcmp(cache->entries[i].network_id, path->network_id) == 0)
+		{
+			slot = &cache->entries[i];
+			break;
+		}
+	}
+	if(!slot && cache->entries_count < CHIAKI_NETWORK_PATH_CACHE_ENTRIES_MAX)
+		slot = &cache->entries[cache->entries_count++];
+	if(!slot)
+	{
+		slot = &cache->entries[0];
+		for(size_t i=1; i<cache->entries_count; i++)
+			if(cache->entries[i].updated < slot->updated)
+				slot = &cache->entries[i];
+	}
+	*slot = *path;
+	chiaki_mutex_unlock(&cache->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_network_path_add_stun_server(ChiakiNetworkPath *path, const char *host, uint16_t port)
+{
+	size_t i = 0;
+	for(; i<path->stun_servers_count; i++)
+		if(path->stun_servers[i].port == port && strcmp(path->stun_servers[i].host, host) == 0)
+			break;
+	if(i == path->stun_servers_count)
+	{
+		if(path->stun_servers_count < CHIAKI_NETWORK_PATH_STUN_SERVERS_MAX)
+			path->stun_servers_count++;
+		i = path->stun_servers_count - 1;
+	}
+	memmove(&path->stun_servers[1], &path->stun_servers[0], i * sizeof(path->stun_servers[0]));
+	snprintf(path->stun_servers[0].host, sizeof(path->stun_servers[0].host), "%s", host);
+	path->stun_servers[0].port = port;
+}
+
+CHIAKI_EXPORT void chiaki_network_identity_from_descriptor(const char *descriptor, char *out)
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for(const char *c = descriptor; *c; c++)
+	{
+		hash ^= (uint8_t)*c;
+		hash *= 0x100000001b3ull;
+	}
+	snprintf(out, CHIAKI_NETWORK_ID_SIZE, "%016llx", (unsigned long long)hash);
+}
+
+#if defined(__linux__)
+/**
+ * Find the interface and gateway of the default route in /proc/net/route.
+ */
+static bool linux_default_route(char *ifname, size_t ifname_size, char *gateway, size_t gateway_size)
+{
+	FILE *f = fopen("/proc/net/route", "r");
+	if(!f)
+		return false;
+	char line[256];
+	bool found = false;
+	while(fgets(line, sizeof(line), f))
+	{
+		char iface[64];
+		unsigned int dest, gw, flags;
+		if(sscanf(line, "%63s %x %x %x", iface, &dest, &gw, &flags) != 4)
+			continue; // header
+		if(dest != 0 || !(flags & 0x1) || !(flags & 0x2)) // RTF_UP, RTF_GATEWAY
+			continue;
+		struct in_addr addr;
+		addr.s_addr = gw; // already in network byte order
+		snprintf(ifname, ifname_size, "%s", iface);
+		inet_ntop(AF_INET, &addr, gateway, (socklen_t)gateway_size);
+		found = true;
+		break;
+	}
+	fclose(f);
+	return found;
+}
+
+static bool linux_neighbor_mac(const char *ip, char *mac, size_t mac_size)
+{
+	FILE *f = fopen("/proc/net/arp", "r");
+	if(!f)
+		return false;
+	char line[256];
+	bool found = false;
+	while(fgets(line, sizeof(line), f))
+	{
+		char entry_ip[64], entry_mac[64];
+		unsigned int hw_type, flags;
+		if(sscanf(line, "%63s 0x%x 0x%x %63s", entry_ip, &hw_type, &flags, entry_mac) != 4)
+			continue;
+		if(strcmp(entry_ip, ip) != 0 || !(flags & 0x2)) // ATF_COM
+			continue;
+		snprintf(mac, mac_size, "%s", entry_mac);
+		found = true;
+		break;
+	}
+	fclose(f);
+	return found;
+}
+#endif
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_network_identity(ChiakiLog *log, char *out)
+{
+	char descriptor[512];
+	descriptor[0] = '\0';
+#ifdef _WIN32
+	ULONG buf_size = sizeof(IP_ADAPTER_INFO) * 8;
+	IP_ADAPTER_INFO *adapters = malloc(buf_size);
+	if(!adapters)
+		return CHIAKI_ERR_MEMORY;
+	DWORD r = GetAdaptersInfo(adapters, &buf_size);
+	if(r == ERROR_BUFFER_OVERFLOW)
+	{
+		free(adapters);
+		adapters = malloc(buf_size);
+		if(!adapters)
+			return CHIAKI_ERR_MEMORY;
+		r = GetAdaptersInfo(adapters, &buf_size);
+	}
+	if(r == NO_ERROR)
+	{
+		// same adapter choice as for the local candidate: the first usable one, preferring wifi
+		for(IP_ADAPTER_INFO *adapter = adapters; adapter; adapter = adapter->Next)
+		{
+			if(adapter->Type != IF_TYPE_IEEE80211 && adapter->Type != MIB_IF_TYPE_ETHERNET)
+				continue;
+			const char *gateway = adapter->GatewayList.IpAddress.String;
+			if(!gateway[0] || strcmp(gateway, "0.0.0.0") == 0)
+				continue;
+			char gateway_mac[18] = "";
+			ULONG mac[2];
+			ULONG mac_len = 6;
+			IPAddr gateway_addr;
+			if(inet_pton(AF_INET, gateway, &gateway_addr) == 1 && SendARP(gateway_addr, 0, mac, &mac_len) == NO_ERROR && mac_len == 6)
+			{
+				uint8_t *m = (uint8_t *)mac;
+				snprintf(gateway_mac, sizeof(gateway_mac), "%02x:%02x:%02x:%02x:%02x:%02x", m[0], m[1], m[2], m[3], m[4], m[5]);
+			}
+			snprintf(descriptor, sizeof(descriptor), "gw=%s;gwmac=%s;mask=%s",
+					gateway, gateway_mac, adapter->IpAddressList.IpMask.String);
+			if(adapter->Type == IF_TYPE_IEEE80211)
+				break;
+		}
+	}
+	free(adapters);
+#elif defined(__SWITCH__)
+	struct in_addr addr;
+	addr.s_addr = gethostid();
+	char host[INET_ADDRSTRLEN];
+	if(inet_ntop(AF_INET, &addr, host, sizeof(host)))
+		snprintf(descriptor, sizeof(descriptor), "host=%s", host);
+#else
+	char ifname[64] = "";
+	char gateway[INET_ADDRSTRLEN] = "";
+	char gateway_mac[64] = "";
+#if defined(__linux__)
+	if(linux_default_route(ifname, sizeof(ifname), gateway, sizeof(gateway)))
+		linux_neighbor_mac(gateway, gateway_mac, sizeof(gateway_mac));
+#endif
+	struct ifaddrs *addrs;
+	if(getifaddrs(&addrs) == 0)
+	{
+		for(struct ifaddrs *a = addrs; a; a = a->ifa_next)
+		{
+			if(!a->ifa_addr || a->ifa_addr->sa_family != AF_INET || !a->ifa_netmask)
+				continue;
+			if((a->ifa_flags & (IFF_UP | IFF_RUNNING | IFF_LOOPBACK)) != (IFF_UP | IFF_RUNNING))
+				continue;
+			if(ifname[0] && strcmp(a->ifa_name, ifname) != 0)
+				continue;
+			struct in_addr subnet;
+			subnet.s_addr = ((struct sockaddr_in *)a->ifa_addr)->sin_addr.s_addr & ((struct sockaddr_in *)a->ifa_netmask)->sin_addr.s_addr;
+			char subnet_str[INET_ADDRSTRLEN];
+			char mask_str[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, &subnet, subnet_str, sizeof(subnet_str));
+			inet_ntop(AF_INET, &((struct sockaddr_in *)a->ifa_netmask)->sin_addr, mask_str, sizeof(mask_str));
+			snprintf(descriptor, sizeof(descriptor), "if=%s;net=%s/%s;gw=%s;gwmac=%s",
+					a->ifa_name, subnet_str, mask_str, gateway, gateway_mac);
+			break;
+		}
+		freeifaddrs(addrs);
+	}
+#endif
+	if(!descriptor[0])
+	{
+		CHIAKI_LOGW(log, "Couldn't determine the identity of the local network");
+		return CHIAKI_ERR_NETWORK;
+	}
+	chiaki_network_identity_from_descriptor(descriptor, out);
+	return CHIAKI_ERR_SUCCESS;
+}
@@ -0,0 +1,450 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#if defined(__linux__)
+#define _GNU_SOURCE // sendmmsg()
+#endif
+
+#include <chiaki/remote/portguess.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+#endif
+
+#define PORT_GUESSER_BATCH 64
+#define PORT_GUESSER_TTL_CONNECTED 64
+#define PORT_WINDOW_WRAP_LOW 1024
+#define PORT_WINDOW_WRAP_HIGH 49152
+
+#ifdef _WIN32
+typedef WSAPOLLFD PortGuesserPollFd;
+#define port_guesser_poll WSAPoll
+#elif !defined(__linux__)
+typedef struct pollfd PortGuesserPollFd;
+#define port_guesser_poll poll
+#endif
+
+static chiaki_socket_t port_guesser_socket_open(ChiakiPortGuesser *guesser, int ttl)
+{
+	chiaki_socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if(CHIAKI_SOCKET_IS_INVALID(sock))
+	{
+		CHIAKI_LOGE(guesser->log, "Port guesser: Creating socket failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+		return CHIAKI_INVALID_SOCKET;
+	}
+	const int enable = 1;
+#if defined(SO_REUSEPORT)
+	if(setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const void *)&enable, sizeof(enable)) < 0)
+#else
+	if(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const void *)&enable, sizeof(enable)) < 0)
+#endif
+	{
+		CHIAKI_LOGE(guesser->log, "Port guesser: Setting socket reuse failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+		goto error;
+	}
+#ifdef _WIN32
+	DWORD ttl_val = ttl;
+#else
+	int ttl_val = ttl;
+#endif
+	if(setsockopt(sock, IPPROTO_IP, IP_TTL, (const CHIAKI_SOCKET_BUF_TYPE)&ttl_val, sizeof(ttl_val)) < 0)
+	{
+		CHIAKI_LOGE(guesser->log, "Port guesser: setsockopt(IP_TTL) failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+		goto error;
+	}
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = INADDR_ANY;
+	addr.sin_port = 0;
+	if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		CHIAKI_LOGE(guesser->log, "Port guesser: Binding socket failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+		goto error;
+	}
+	ChiakiErrorCode err = chiaki_socket_set_nonblock(sock, true);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(guesser->log, "Port guesser: Setting socket to non-blocking failed: %s", chiaki_error_string(err));
+		goto error;
+	}
+	return sock;
+error:
+	CHIAKI_SOCKET_CLOSE(sock);
+	return CHIAKI_INVALID_SOCKET;
+}
+
+static ChiakiErrorCode port_guesser_set_add(ChiakiPortGuesser *guesser, chiaki_socket_t sock)
+{
+#if defined(__linux__)
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = sock;
+	if(epoll_ctl(guesser->epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0)
+	{
+		CHIAKI_LOGE(guesser->log, "Port guesser: Adding socket to epoll set failed with error %s", strerror(errno));
+		return CHIAKI_ERR_UNKNOWN;
+	}
+#else
+	PortGuesserPollFd *pollfds = guesser->pollfds;
+	pollfds[guesser->pollfds_count].fd = sock;
+	pollfds[guesser->pollfds_count].events = POLLIN;
+	pollfds[guesser->pollfds_count].revents = 0;
+	guesser->pollfds_count++;
+#endif
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static void port_guesser_set_remove(ChiakiPortGuesser *guesser, chiaki_socket_t sock)
+{
+#if defined(__linux__)
+	epoll_ctl(guesser->epoll_fd, EPOLL_CTL_DEL, sock, NULL);
+#else
+	PortGuesserPollFd *pollfds = guesser->pollfds;
+	for(size_t i=0; i<guesser->pollfds_count; i++)
+	{
+		if(pollfds[i].fd != sock)
+			continue;
+		pollfds[i] = pollfds[--guesser->pollfds_count];
+		break;
+	}
+#endif
+}
+
+static bool port_guesser_find(ChiakiPortGuesser *guesser, chiaki_socket_t sock, size_t *index)
+{
+	if(CHIAKI_SOCKET_IS_INVALID(sock))
+		return false;
+	for(size_t i=0; i<guesser->socks_count; i++)
+	{
+		if(guesser->socks[i] != sock)
+			continue;
+		*index = i;
+		return true;
+	}
+	return false;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_port_guesser_init(ChiakiPortGuesser *guesser, ChiakiLog *log, size_t socks_count, int ttl)
+{
+	memset(guesser, 0, sizeof(*guesser));
+	guesser->log = log;
+	guesser->socks = calloc(socks_count ? socks_count : 1, sizeof(chiaki_socket_t));
+	if(!guesser->socks)
+		return CHIAKI_ERR_MEMORY;
+#if defined(__linux__)
+	guesser->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(guesser->epoll_fd < 0)
+	{
+		CHIAKI_LOGE(log, "Port guesser: Creating epoll set failed with error %s", strerror(errno));
+		free(guesser->socks);
+		return CHIAKI_ERR_UNKNOWN;
+	}
+#else
+	guesser->pollfds = calloc(socks_count + CHIAKI_PORT_GUESSER_WATCH_MAX, sizeof(PortGuesserPollFd));
+	if(!guesser->pollfds)
+	{
+		free(guesser->socks);
+		return CHIAKI_ERR_MEMORY;
+	}
+#endif
+
+	for(size_t i=0; i<socks_count; i++)
+	{
+		chiaki_socket_t sock = port_guesser_socket_open(guesser, ttl);
+		if(CHIAKI_SOCKET_IS_INVALID(sock))
+		{
+			// usually the fd limit, more attempts would fail the same way
+			break;
+		}
+		if(port_guesser_set_add(guesser, sock) != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_SOCKET_CLOSE(sock);
+			break;
+		}
+		guesser->socks[guesser->socks_count++] = sock;
+	}
+	guesser->socks_open = guesser->socks_count;
+	if(!socks_count)
+		return CHIAKI_ERR_SUCCESS;
+	if(!guesser->socks_open)
+	{
+		chiaki_port_guesser_fini(guesser);
+		return CHIAKI_ERR_NETWORK;
+	}
+	CHIAKI_LOGI(log, "Port guesser: Opened %zu of %zu NAT probing sockets", guesser->socks_open, socks_count);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_port_guesser_fini(ChiakiPortGuesser *guesser)
+{
+	for(size_t i=0; i<guesser->socks_count; i++)
+	{
+		if(!CHIAKI_SOCKET_IS_INVALID(guesser->socks[i]))
+			CHIAKI_SOCKET_CLOSE(guesser->socks[i]);
+	}
+	free(guesser->socks);
+	guesser->socks = NULL;
+	guesser->socks_count = 0;
+	guesser->socks_open = 0;
+#if defined(__linux__)
+	if(guesser->epoll_fd >= 0)
+		close(guesser->epoll_fd);
+	guesser->epoll_fd = -1;
+#else
+	free(guesser->pollfds);
+	guesser->pollfds = NULL;
+	guesser->pollfds_count = 0;
+#endif
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_port_guesser_watch(ChiakiPortGuesser *guesser, chiaki_socket_t sock)
+{
+	if(CHIAKI_SOCKET_IS_INVALID(sock))
+		return CHIAKI_ERR_SUCCESS;
+	if(guesser->watched_count >= CHIAKI_PORT_GUESSER_WATCH_MAX)
+		return CHIAKI_ERR_OVERFLOW;
+	ChiakiErrorCode err = port_guesser_set_add(guesser, sock);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	guesser->watched[guesser->watched_count++] = sock;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT bool chiaki_port_guesser_owns(ChiakiPortGuesser *guesser, chiaki_socket_t sock)
+{
+	size_t index;
+	return port_guesser_find(guesser, sock, &index);
+}
+
+#if defined(__linux__)
+static size_t port_guesser_send_batch(ChiakiPortGuesser *guesser, chiaki_socket_t sock, struct mmsghdr *msgs, size_t count)
+{
+	size_t sent = 0;
+	while(sent < count)
+	{
+		int ret = sendmmsg(sock, msgs + sent, (unsigned int)(count - sent), 0);
+		guesser->stats.send_calls++;
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				// send buffer is full, the rest of this burst is dropped like it would be by the network
+				return count;
+			}
+			return sent;
+		}
+		sent += (size_t)ret;
+	}
+	return sent;
+}
+#endif
+
+CHIAKI_EXPORT size_t chiaki_port_guesser_burst(ChiakiPortGuesser *guesser, const uint8_t *buf, size_t buf_size,
+		const struct sockaddr_storage *addrs, const socklen_t *lens, size_t addrs_count)
+{
+	size_t dests[PORT_GUESSER_BATCH];
+	size_t probes = 0;
+	for(size_t start=0; start<addrs_count;)
+	{
+		// collect the next batch of IPv4 destinations
+		size_t dests_count = 0;
+		for(; start<addrs_count && dests_count<PORT_GUESSER_BATCH; start++)
+		{
+			if(addrs[start].ss_family == AF_INET)
+				dests[dests_count++] = start;
+		}
+		if(!dests_count)
+			break;
+
+#if defined(__linux__)
+		struct iovec iov = { (void *)buf, buf_size };
+		struct mmsghdr msgs[PORT_GUESSER_BATCH];
+		memset(msgs, 0, sizeof(msgs[0]) * dests_count);
+		for(size_t d=0; d<dests_count; d++)
+		{
+			msgs[d].msg_hdr.msg_name = (void *)&addrs[dests[d]];
+			msgs[d].msg_hdr.msg_namelen = lens[dests[d]];
+			msgs[d].msg_hdr.msg_iov = &iov;
+			msgs[d].msg_hdr.msg_iovlen = 1;
+		}
+#endif
+		for(size_t i=0; i<guesser->socks_count; i++)
+		{
+			chiaki_socket_t sock = guesser->socks[i];
+			if(CHIAKI_SOCKET_IS_INVALID(sock))
+				continue;
+			bool failed = false;
+#if defined(__linux__)
+			size_t sent = port_guesser_send_batch(guesser, sock, msgs, dests_count);
+			probes += sent;
+			failed = sent < dests_count;
+#else
+			for(size_t d=0; d<dests_count; d++)
+			{
+				guesser->stats.send_calls++;
+				if(sendto(sock, (CHIAKI_SOCKET_BUF_TYPE)buf, buf_size, 0, (const struct sockaddr *)&addrs[dests[d]], lens[dests[d]]) < 0)
+				{
+					failed = true;
+					break;
+				}
+				probes++;
+			}
+#endif
+			if(failed)
+			{
+				CHIAKI_LOGW(guesser->log, "Port guesser: Sending probes on socket %zu failed with error " CHIAKI_SOCKET_ERROR_FMT ", closing it", i, CHIAKI_SOCKET_ERROR_VALUE);
+				chiaki_port_guesser_close(guesser, sock);
+				guesser->stats.sockets_closed++;
+			}
+		}
+	}
+	guesser->stats.probes_sent += probes;
+	return probes;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_port_guesser_wait(ChiakiPortGuesser *guesser, uint64_t timeout_ms, chiaki_socket_t *ready)
+{
+	int timeout = timeout_ms > INT32_MAX ? -1 : (int)timeout_ms;
+#if defined(__linux__)
+	struct epoll_event ev;
+	int ret;
+	do
+		ret = epoll_wait(guesser->epoll_fd, &ev, 1, timeout);
+	while(ret < 0 && errno == EINTR);
+	if(ret < 0)
+	{
+		CHIAKI_LOGE(guesser->log, "Port guesser: epoll_wait failed with error %s", strerror(errno));
+		return CHIAKI_ERR_NETWORK;
+	}
+	if(ret == 0)
+		return CHIAKI_ERR_TIMEOUT;
+	// level triggered epoll moves reported sockets to the end of its ready list, so others get their turn next time
+	*ready = ev.data.fd;
+	return CHIAKI_ERR_SUCCESS;
+#else
+	PortGuesserPollFd *pollfds = guesser->pollfds;
+	if(!guesser->pollfds_count)
+		return CHIAKI_ERR_NETWORK;
+	int ret = port_guesser_poll(pollfds, guesser->pollfds_count, timeout);
+	if(ret < 0)
+	{
+		CHIAKI_LOGE(guesser->log, "Port guesser: poll failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+		return CHIAKI_ERR_NETWORK;
+	}
+	if(ret == 0)
+		return CHIAKI_ERR_TIMEOUT;
+	for(size_t n=0; n<guesser->pollfds_count; n++)
+	{
+		size_t i = (guesser->poll_next + n) % guesser->pollfds_count;
+		if(!(pollfds[i].revents & (POLLIN | POLLERR | POLLHUP)))
+			continue;
+		guesser->poll_next = i + 1;
+		*ready = pollfds[i].fd;
+		return CHIAKI_ERR_SUCCESS;
+	}
+	return CHIAKI_ERR_TIMEOUT;
+#endif
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_port_guesser_socket_ready(ChiakiPortGuesser *guesser, chiaki_socket_t sock)
+{
+	if(!chiaki_port_guesser_owns(guesser, sock))
+		return CHIAKI_ERR_INVALID_DATA;
+#ifdef _WIN32
+	DWORD ttl = PORT_GUESSER_TTL_CONNECTED;
+#else
+	int ttl = PORT_GUESSER_TTL_CONNECTED;
+#endif
+	if(setsockopt(sock, IPPROTO_IP, IP_TTL, (const CHIAKI_SOCKET_BUF_TYPE)&ttl, sizeof(ttl)) < 0)
+	{
+		CHIAKI_LOGE(guesser->log, "Port guesser: setsockopt(IP_TTL) failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+		chiaki_port_guesser_close(guesser, sock);
+		return CHIAKI_ERR_UNKNOWN;
+	}
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_port_guesser_close(ChiakiPortGuesser *guesser, chiaki_socket_t sock)
+{
+	size_t index;
+	if(!port_guesser_find(guesser, sock, &index))
+		return;
+	port_guesser_set_remove(guesser, sock);
+	CHIAKI_SOCKET_CLOSE(sock);
+	guesser->socks[index] = CHIAKI_INVALID_SOCKET;
+	guesser->socks_open--;
+}
+
+CHIAKI_EXPORT void chiaki_port_guesser_release(ChiakiPortGuesser *guesser, chiaki_socket_t sock)
+{
+	size_t index;
+	if(!port_guesser_find(guesser, sock, &index))
+		return;
+	port_guesser_set_remove(guesser, sock);
+	guesser->socks[index] = CHIAKI_INVALID_SOCKET;
+	guesser->socks_open--;
+}
+
+CHIAKI_EXPORT uint16_t chiaki_port_window_port(uint16_t center, size_t index)
+{
+	int32_t delta;
+	if(index == 0)
+		delta = 0;
+	else if(index % 2 == 1)
+		delta = (int32_t)((index + 1) / 2);
+	else
+		delta = -(int32_t)(index / 2);
+	int32_t port = (int32_t)center + delta;
+	if(port > UINT16_MAX)
+		port = PORT_WINDOW_WRAP_HIGH + (port - UINT16_MAX - 1);
+	else if(port < PORT_WINDOW_WRAP_LOW)
+		port = UINT16_MAX - (PORT_WINDOW_WRAP_LOW - port);
+	return (uint16_t)port;
+}
+
+CHIAKI_EXPORT void chiaki_port_window_init(ChiakiPortWindow *window, uint16_t center, size_t max_size)
+{
+	window->center = center;
+	window->size = 0;
+	window->max_size = max_size > CHIAKI_PORT_WINDOW_MAX ? CHIAKI_PORT_WINDOW_MAX : max_size;
+}
+
+CHIAKI_EXPORT size_t chiaki_port_window_widen(ChiakiPortWindow *window, size_t initial_size, uint16_t *ports, size_t ports_max)
+{
+	size_t size = window->size ? window->size * 2 : initial_size;
+	if(size > window->max_size)
+		size = window->max_size;
+	if(size > window->size + ports_max)
+		size = window->size + ports_max;
+	size_t count = 0;
+	for(size_t i=window->size; i<size; i++)
+		ports[count++] = chiaki_port_window_port(window->center, i);
+	window->size = size;
+	return count;
+}
+
+CHIAKI_EXPORT bool chiaki_port_window_recenter(ChiakiPortWindow *window, uint16_t port)
+{
+	if(window->center == port)
+		return false;
+	window->center = port;
+	window->size = 0;
+	return true;
+}
@@ -27,10 +27,8 @@ typedef struct rudp_t
 } RudpInstance;
 
 static uint16_t get_then_increase_counter(RudpInstance *rudp);
-static ChiakiErrorCode chiaki_rudp_message_parse(uint8_t *serialized_msg, size_t msg_size, RudpMessage *message);
-static void rudp_message_serialize(RudpMessage *message, uint8_t *serialized_msg, size_t *msg_size);
 static void print_rudp_message_type(RudpInstance *rudp, RudpPacketType type);
-static bool assign_submessage_to_message(RudpMessage *message);
+static ChiakiErrorCode rudp_recv_datagram(RudpInstance *rudp, size_t buf_size, ChiakiRudpDatagram *datagram);
 
 
 CHIAKI_EXPORT RudpInstance *chiaki_rudp_init(chiaki_socket_t *sock, ChiakiLog *log)
@@ -91,12 +89,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_init_message(RudpInstance *rudp)
     message.data_size = 14;
     uint8_t data[message.data_size];
     size_t alloc_size = 8 + message.data_size;
-    uint8_t *serialized_msg = malloc(alloc_size * sizeof(uint8_t));
-    if(!serialized_msg)
-    {
-        CHIAKI_LOGE(rudp->log, "Error allocating memory for rudp message");
-        return CHIAKI_ERR_MEMORY;
-    }
+    uint8_t serialized_msg[alloc_size];
     size_t msg_size = 0;
     message.size = (0xC << 12) | alloc_size;
     const uint8_t after_header[0x2] = { 0x05, 0x82 };
@@ -106,10 +99,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_init_message(RudpInstance *rudp)
     *(chiaki_unaligned_uint32_t *)(data + 8) = htonl(rudp->header);
     memcpy(data + 12, after_header, sizeof(after_header));
     message.data = data;
-    rudp_message_serialize(&message, serialized_msg, &msg_size);
-    ChiakiErrorCode err = chiaki_rudp_send_raw(rudp, serialized_msg, msg_size);
-    free(serialized_msg);
-    return err;
+    ChiakiErrorCode err = chiaki_rudp_message_serialize(&message, serialized_msg, sizeof(serialized_msg), &msg_size);
+    if(err != CHIAKI_ERR_SUCCESS)
+        return err;
+    return chiaki_rudp_send_raw(rudp, serialized_msg, msg_size);
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_cookie_message(RudpInstance *rudp, uint8_t *response_buf, size_t response_size)
@@ -120,12 +113,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_cookie_message(RudpInstance *rudp
     message.subMessage = NULL;
     message.data_size = 14 + response_size;
     size_t alloc_size = 8 + message.data_size;
-    uint8_t *serialized_msg = malloc(alloc_size * sizeof(uint8_t));
-    if(!serialized_msg)
-    {
-        CHIAKI_LOGE(rudp->log, "Error allocating memory for rudp message");
-        return CHIAKI_ERR_MEMORY;
-    }
+    uint8_t serialized_msg[alloc_size];
     size_t msg_size = 0;
     message.size = (0xC << 12) | alloc_size;
     uint8_t data[message.data_size];
@@ -137,10 +125,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_cookie_message(RudpInstance *rudp
     memcpy(data + 12, after_header, sizeof(after_header));
     memcpy(data + 14, response_buf, response_size);
     message.data = data;
-    rudp_message_serialize(&message, serialized_msg, &msg_size);
-    ChiakiErrorCode err = chiaki_rudp_send_raw(rudp, serialized_msg, msg_size);
-    free(serialized_msg);
-    return err;
+    ChiakiErrorCode err = chiaki_rudp_message_serialize(&message, serialized_msg, sizeof(serialized_msg), &msg_size);
+    if(err != CHIAKI_ERR_SUCCESS)
+        return err;
+    return chiaki_rudp_send_raw(rudp, serialized_msg, msg_size);
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_session_message(RudpInstance *rudp, uint16_t remote_counter, uint8_t *session_msg, size_t session_msg_size)
@@ -161,22 +149,17 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_session_message(RudpInstance *rud
     message.subMessage = &subMessage;
     message.data_size = 4;
     size_t alloc_size = 8 + message.data_size + 8 + subMessage.data_size;
-    uint8_t *serialized_msg = malloc(alloc_size * sizeof(uint8_t));
-    if(!serialized_msg)
-    {
-        CHIAKI_LOGE(rudp->log, "Error allocating memory for rudp message");
-        return CHIAKI_ERR_MEMORY;
-    }
+    uint8_t serialized_msg[alloc_size];
     size_t msg_size = 0;
     message.size = (0xC << 12) | (8 + message.data_size);
     uint8_t data[message.data_size];
     *(chiaki_unaligned_uint16_t *)(data) = htons(local_counter);
     *(chiaki_unaligned_uint16_t *)(data + 2) = htons(remote_counter);
     message.data = data;
-    rudp_message_serialize(&message, serialized_msg, &msg_size);
-    ChiakiErrorCode err = chiaki_rudp_send_raw(rudp, serialized_msg, msg_size);
-    free(serialized_msg);
-    return err;
+    ChiakiErrorCode err = chiaki_rudp_message_serialize(&message, serialized_msg, sizeof(serialized_msg), &msg_size);
+    if(err != CHIAKI_ERR_SUCCESS)
+        return err;
+    return chiaki_rudp_send_raw(rudp, serialized_msg, msg_size);
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_ack_message(RudpInstance *rudp, uint16_t remote_counter)
@@ -187,12 +170,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_ack_message(RudpInstance *rudp, u
     message.subMessage = NULL;
     message.data_size = 6;
     size_t alloc_size = 8 + message.data_size;
-    uint8_t *serialized_msg = malloc(alloc_size * sizeof(uint8_t));
-    if(!serialized_msg)
-    {
-        CHIAKI_LOGE(rudp->log, "Error allocating memory for rudp message");
-        return CHIAKI_ERR_MEMORY;
-    }
+    uint8_t serialized_msg[alloc_size];
     size_t msg_size = 0;
     message.size = (0xC << 12) | alloc_size;
     uint8_t data[message.data_size];
@@ -201,10 +179,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_ack_message(RudpInstance *rudp, u
     *(chiaki_unaligned_uint16_t *)(data + 2) = htons(remote_counter);
     memcpy(data + 4, after_counters, sizeof(after_counters));
     message.data = data;
-    rudp_message_serialize(&message, serialized_msg, &msg_size);
-    ChiakiErrorCode err = chiaki_rudp_send_raw(rudp, serialized_msg, msg_size);
-    free(serialized_msg);
-    return err;
+    ChiakiErrorCode err = chiaki_rudp_message_serialize(&message, serialized_msg, sizeof(serialized_msg), &msg_size);
+    if(err != CHIAKI_ERR_SUCCESS)
+        return err;
+    return chiaki_rudp_send_raw(rudp, serialized_msg, msg_size);
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_ctrl_message(RudpInstance *rudp, uint8_t *ctrl_message, size_t ctrl_message_size)
@@ -216,6 +194,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_ctrl_message(RudpInstance *rudp,
     message.subMessage = NULL;
     message.data_size = 2 + ctrl_message_size;
     size_t alloc_size = 8 + message.data_size;
+    // the send buffer takes ownership of the serialized message for retransmission
     uint8_t *serialized_msg = malloc(alloc_size * sizeof(uint8_t));
     if(!serialized_msg)
     {
@@ -228,8 +207,9 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_ctrl_message(RudpInstance *rudp,
     *(chiaki_unaligned_uint16_t *)(data) = htons(counter);
     memcpy(data + 2, ctrl_message, ctrl_message_size);
     message.data = data;
-    rudp_message_serialize(&message, serialized_msg, &msg_size);
-    ChiakiErrorCode err = chiaki_rudp_send_raw(rudp, serialized_msg, msg_size);
+    ChiakiErrorCode err = chiaki_rudp_message_serialize(&message, serialized_msg, alloc_size, &msg_size);
+    if(err == CHIAKI_ERR_SUCCESS)
+        err = chiaki_rudp_send_raw(rudp, serialized_msg, msg_size);
     if(err != CHIAKI_ERR_SUCCESS)
     {
         free(serialized_msg);
@@ -248,6 +228,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_switch_to_stream_connection_messa
     message.subMessage = NULL;
     message.data_size = 26;
     size_t alloc_size = 8 + message.data_size;
+    // the send buffer takes ownership of the serialized message for retransmission
     uint8_t *serialized_msg = malloc(alloc_size * sizeof(uint8_t));
     if(!serialized_msg)
     {
@@ -265,8 +246,9 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_switch_to_stream_connection_messa
     memcpy(data + 2, before_buf, sizeof(before_buf));
     memcpy(data + 10, buf, buf_size);
     message.data = data;
-    rudp_message_serialize(&message, serialized_msg, &msg_size);
-    ChiakiErrorCode err = chiaki_rudp_send_raw(rudp, serialized_msg, msg_size);
+    ChiakiErrorCode err = chiaki_rudp_message_serialize(&message, serialized_msg, alloc_size, &msg_size);
+    if(err == CHIAKI_ERR_SUCCESS)
+        err = chiaki_rudp_send_raw(rudp, serialized_msg, msg_size);
     if(err != CHIAKI_ERR_SUCCESS)
     {
         free(serialized_msg);
@@ -276,78 +258,71 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_switch_to_stream_connection_messa
     return err;
 }
 
-/**
- * Serializes rudp message into byte array
- *
- * @param[in] message The rudp message to serialize
- * @param[out] serialized_msg The serialized message
- * @param[out] msg_size The size of the serialized message
- * 
-*/
-static void rudp_message_serialize(
-    RudpMessage *message, uint8_t *serialized_msg, size_t *msg_size)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_message_serialize(const RudpMessage *message, uint8_t *buf, size_t buf_size, size_t *msg_size)
 {
-    *(chiaki_unaligned_uint16_t *)(serialized_msg) = htons(message->size);
-    *(chiaki_unaligned_uint32_t *)(serialized_msg + 2) = htonl(RUDP_CONSTANT);
-    *(chiaki_unaligned_uint16_t *)(serialized_msg + 6) = htons(message->type);
-    memcpy(serialized_msg + 8, message->data, message->data_size);
-    *msg_size += 8 + message->data_size;
-    if(message->subMessage)
+    size_t size = 0;
+    for(; message; message = message->subMessage)
     {
-        rudp_message_serialize(message->subMessage, serialized_msg + 8 + message->data_size, msg_size);
+        if(buf_size - size < CHIAKI_RUDP_HEADER_SIZE + message->data_size)
+            return CHIAKI_ERR_BUF_TOO_SMALL;
+        uint8_t *serialized_msg = buf + size;
+        *(chiaki_unaligned_uint16_t *)(serialized_msg) = htons(message->size);
+        *(chiaki_unaligned_uint32_t *)(serialized_msg + 2) = htonl(RUDP_CONSTANT);
+        *(chiaki_unaligned_uint16_t *)(serialized_msg + 6) = htons(message->type);
+        if(message->data_size)
+            memcpy(serialized_msg + CHIAKI_RUDP_HEADER_SIZE, message->data, message->data_size);
+        size += CHIAKI_RUDP_HEADER_SIZE + message->data_size;
     }
+    *msg_size = size;
+    return CHIAKI_ERR_SUCCESS;
 }
 
-/**
- * Parse serialized message into rudp message
- *
- * @param[in] serialized_msg The serialized message to transform to a rudp message
- * @param[in] msg_size The size of the serialized message
- * @param[out] RudpMessage The parsed rudp message
- * @return CHIAKI_ERR_SUCCESS on sucess or error code on failure
- * 
-*/
-static ChiakiErrorCode chiaki_rudp_message_parse(
-    uint8_t *serialized_msg, size_t msg_size, RudpMessage *message)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_message_parse(uint8_t *buf, size_t buf_size, RudpMessage *messages, size_t messages_max, size_t *messages_count)
 {
-    ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
-    message->data = NULL;
-    message->subMessage = NULL;
-    message->subMessage_size = 0;
-    message->data_size = 0;
-    message->size = ntohs(*(chiaki_unaligned_uint16_t *)(serialized_msg));
-    message->type = ntohs(*(chiaki_unaligned_uint16_t *)(serialized_msg + 6));
-    message->subtype = serialized_msg[6] & 0xFF;
-    // Eliminate 0xC before length (size of header + data but not submessage)
-    serialized_msg[0] = serialized_msg[0] & 0x0F;
-    message->remote_counter = 0;
-    uint16_t length = ntohs(*(chiaki_unaligned_uint16_t *)(serialized_msg));
-    int remaining = msg_size - 8;
-    int data_size = 0;
-    if(length > 8)
-    {
-        data_size = length - 8;
-        if(remaining < data_size)
-            data_size = remaining;
-        message->data_size = data_size;
-        message->data = malloc(message->data_size * sizeof(uint8_t));
-        if(!message->data)
-            return CHIAKI_ERR_MEMORY;
-        memcpy(message->data, serialized_msg + 8, data_size);
-        if(data_size >= 2)
-            message->remote_counter = ntohs(*(chiaki_unaligned_uint16_t *)(message->data)) + 1;
-    }
+    *messages_count = 0;
+    if(buf_size < CHIAKI_RUDP_HEADER_SIZE || !messages_max)
+        return CHIAKI_ERR_BUF_TOO_SMALL;
 
-    remaining = remaining - data_size;
-    if (remaining >= 8)
+    size_t count = 0;
+    RudpMessage *prev = NULL;
+    while(buf_size >= CHIAKI_RUDP_HEADER_SIZE && count < messages_max)
     {
-        message->subMessage = malloc(1 * sizeof(RudpMessage));
-        if(!message->subMessage)
-            return CHIAKI_ERR_MEMORY;
-        message->subMessage_size = remaining;
-        err = chiaki_rudp_message_parse(serialized_msg + 8 + data_size, remaining, message->subMessage);
+        RudpMessage *message = &messages[count++];
+        message->data = NULL;
+        message->subMessage = NULL;
+        message->subMessage_size = 0;
+        message->data_size = 0;
+        message->remote_counter = 0;
+        message->size = ntohs(*(chiaki_unaligned_uint16_t *)(buf));
+        message->type = ntohs(*(chiaki_unaligned_uint16_t *)(buf + 6));
+        message->subtype = buf[6];
+        if(prev)
+        {
+            prev->subMessage = message;
+            prev->subMessage_size = buf_size;
+        }
+
+        // Eliminate 0xC before length (size of header + data but not submessage)
+        size_t length = message->size & 0x0FFF;
+        size_t remaining = buf_size - CHIAKI_RUDP_HEADER_SIZE;
+        size_t data_size = 0;
+        if(length > CHIAKI_RUDP_HEADER_SIZE)
+        {
+            data_size = length - CHIAKI_RUDP_HEADER_SIZE;
+            if(remaining < data_size)
+                data_size = remaining;
+            if(data_size)
+                message->data = buf + CHIAKI_RUDP_HEADER_SIZE;
+            message->data_size = data_size;
+            if(data_size >= 2)
+                message->remote_counter = ntohs(*(chiaki_unaligned_uint16_t *)(message->data)) + 1;
+        }
+        buf += CHIAKI_RUDP_HEADER_SIZE + data_size;
+        buf_size = remaining - data_size;
+        prev = message;
     }
-    return err;
+    *messages_count = count;
+    return CHIAKI_ERR_SUCCESS;
 }
 
 /**
@@ -391,9 +366,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_raw(RudpInstance *rudp, uint8_t *
 	return CHIAKI_ERR_SUCCESS;
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_select_recv(RudpInstance *rudp, size_t buf_size,  RudpMessage *message)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_select_recv(RudpInstance *rudp, size_t buf_size, ChiakiRudpDatagram *datagram)
 {
-    uint8_t buf[buf_size]; 
 	ChiakiErrorCode err = chiaki_stop_pipe_select_single(&rudp->stop_pipe, rudp->sock, false, RUDP_EXPECT_TIMEOUT_MS);
 	if(err == CHIAKI_ERR_TIMEOUT || err == CHIAKI_ERR_CANCELED)
 		return err;
@@ -402,28 +376,21 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_select_recv(RudpInstance *rudp, size_t
 		CHIAKI_LOGE(rudp->log, "Rudp select failed: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
 		return err;
 	}
+	return rudp_recv_datagram(rudp, buf_size, datagram);
+}
 
-	CHIAKI_SSIZET_TYPE received_sz = recv(rudp->sock, (CHIAKI_SOCKET_BUF_TYPE) buf, buf_size, 0);
-	if(received_sz <= 8)
-	{
-		if(received_sz < 0)
-			CHIAKI_LOGE(rudp->log, "Rudp recv failed: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-		else
-			CHIAKI_LOGE(rudp->log, "Rudp recv returned less than the required 8 byte RUDP header");
-		return CHIAKI_ERR_NETWORK;
-	}
-    CHIAKI_LOGV(rudp->log, "Receiving message:");
-    chiaki_log_hexdump(rudp->log, CHIAKI_LOG_VERBOSE, buf, received_sz);
-
-    err = chiaki_rudp_message_parse(buf, received_sz, message);
-    
-	return err;
+CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_recv_only(RudpInstance *rudp, size_t buf_size, ChiakiRudpDatagram *datagram)
+{
+	return rudp_recv_datagram(rudp, buf_size, datagram);
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_recv_only(RudpInstance *rudp, size_t buf_size,  RudpMessage *message)
+static ChiakiErrorCode rudp_recv_datagram(RudpInstance *rudp, size_t buf_size, ChiakiRudpDatagram *datagram)
 {
-    uint8_t buf[buf_size];
-	CHIAKI_SSIZET_TYPE received_sz = recv(rudp->sock, (CHIAKI_SOCKET_BUF_TYPE) buf, buf_size, 0);
+	datagram->size = 0;
+	datagram->messages_count = 0;
+	if(buf_size > sizeof(datagram->buf))
+		buf_size = sizeof(datagram->buf);
+	CHIAKI_SSIZET_TYPE received_sz = recv(rudp->sock, (CHIAKI_SOCKET_BUF_TYPE) datagram->buf, buf_size, 0);
 	if(received_sz <= 8)
 	{
 		if(received_sz < 0)
@@ -432,12 +399,11 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_recv_only(RudpInstance *rudp, size_t b
 			CHIAKI_LOGE(rudp->log, "Rudp recv returned less than the required 8 byte RUDP header");
 		return CHIAKI_ERR_NETWORK;
 	}
+	datagram->size = received_sz;
     CHIAKI_LOGV(rudp->log, "Receiving message:");
-    chiaki_log_hexdump(rudp->log, CHIAKI_LOG_VERBOSE, buf, received_sz);
+    chiaki_log_hexdump(rudp->log, CHIAKI_LOG_VERBOSE, datagram->buf, datagram->size);
 
-    ChiakiErrorCode err = chiaki_rudp_message_parse(buf, received_sz, message);
-
-	return err;
+    return chiaki_rudp_message_parse(datagram->buf, datagram->size, datagram->messages, CHIAKI_RUDP_MESSAGES_MAX, &datagram->messages_count);
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_stop_pipe_select_single(RudpInstance *rudp, ChiakiStopPipe *stop_pipe, uint64_t timeout)
@@ -453,7 +419,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_stop_pipe_select_single(RudpInstance *
     return CHIAKI_ERR_SUCCESS;
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_recv(RudpInstance *rudp, RudpMessage *message, uint8_t *buf, size_t buf_size, uint16_t remote_counter, RudpPacketType send_type, RudpPacketType recv_type, size_t min_data_size, size_t tries)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_recv(RudpInstance *rudp, ChiakiRudpDatagram *datagram, RudpMessage **message_out, uint8_t *buf, size_t buf_size, uint16_t remote_counter, RudpPacketType send_type, RudpPacketType recv_type, size_t min_data_size, size_t tries)
 {
     bool success = false;
     for(int i = 0; i < tries; i++)
@@ -476,11 +442,12 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_recv(RudpInstance *rudp, RudpMess
                 CHIAKI_LOGE(rudp->log, "Selected RudpPacketType 0x%04x to send that is not supported by rudp send receive.", send_type);
                 return CHIAKI_ERR_INVALID_DATA;
         }
-        ChiakiErrorCode err = chiaki_rudp_select_recv(rudp, 1500, message);
+        ChiakiErrorCode err = chiaki_rudp_select_recv(rudp, CHIAKI_RUDP_DATAGRAM_SIZE_MAX, datagram);
         if(err == CHIAKI_ERR_TIMEOUT)
             continue;
         if(err != CHIAKI_ERR_SUCCESS)
             return err;
+        RudpMessage *message = &datagram->messages[0];
         bool found = true;
         while(true)
         {
@@ -489,11 +456,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_recv(RudpInstance *rudp, RudpMess
                 case INIT_RESPONSE:
                     if(message->subtype != 0xD0)
                     {
-                        if(assign_submessage_to_message(message))
+                        if(message->subMessage)
+                        {
+                            message = message->subMessage;
                             continue;
+                        }
                         CHIAKI_LOGE(rudp->log, "Expected INIT RESPONSE with subtype 0xD0.\nReceived unexpected RUDP message ... retrying");
                         chiaki_rudp_print_message(rudp, message);
-                        chiaki_rudp_message_pointers_free(message);
                         found = false;
                         break;
                     }
@@ -501,11 +470,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_recv(RudpInstance *rudp, RudpMess
                 case COOKIE_RESPONSE:
                     if(message->subtype != 0xA0)
                     {
-                        if(assign_submessage_to_message(message))
+                        if(message->subMessage)
+                        {
+                            message = message->subMessage;
                             continue;
+                        }
                         CHIAKI_LOGE(rudp->log, "Expected COOKIE RESPONSE with subtype 0xA0.\nReceived unexpected RUDP message ... retrying");
                         chiaki_rudp_print_message(rudp, message);
-                        chiaki_rudp_message_pointers_free(message);
                         found = false;
                         break;
                     }
@@ -513,11 +484,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_recv(RudpInstance *rudp, RudpMess
                 case CTRL_MESSAGE:
                     if((message->subtype & 0x0F) != 0x2 && (message->subtype & 0x0F) != 0x6)
                     {
-                        if(assign_submessage_to_message(message))
+                        if(message->subMessage)
+                        {
+                            message = message->subMessage;
                             continue;
+                        }
                         CHIAKI_LOGE(rudp->log, "Expected CTRL MESSAGE with subtype 0x2 or 0x36.\nReceived unexpected RUDP message ... retrying");
                         chiaki_rudp_print_message(rudp, message);
-                        chiaki_rudp_message_pointers_free(message);
                         found = false;
                         break;
                     }
@@ -525,18 +498,19 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_recv(RudpInstance *rudp, RudpMess
                 case FINISH:
                     if(message->subtype != 0xC0)
                     {
-                        if(assign_submessage_to_message(message))
+                        if(message->subMessage)
+                        {
+                            message = message->subMessage;
                             continue;
+                        }
                         CHIAKI_LOGE(rudp->log, "Expected FINISH MESSAGE with subtype 0xC0 .\nReceived unexpected RUDP message ... retrying");
                         chiaki_rudp_print_message(rudp, message);
-                        chiaki_rudp_message_pointers_free(message);
                         found = false;
                         break;
                     }
                     break;
                 default:
                     CHIAKI_LOGE(rudp->log, "Selected RudpPacketType 0x%04x to receive that is not supported by rudp send receive.", send_type);
-                    chiaki_rudp_message_pointers_free(message);
                     return CHIAKI_ERR_INVALID_DATA;
             }
             break;
@@ -545,10 +519,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_recv(RudpInstance *rudp, RudpMess
             continue;
         if(message->data_size < min_data_size)
         {
-            chiaki_rudp_message_pointers_free(message);
             CHIAKI_LOGE(rudp->log, "Received message with too small of data size");
             continue;
         }
+        *message_out = message;
         success = true;
         break;
     }
@@ -562,22 +536,6 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_recv(RudpInstance *rudp, RudpMess
     }
 }
 
-static bool assign_submessage_to_message(RudpMessage *message)
-{
-    if(message->subMessage)
-    {
-        if(message->data)
-        {
-            free(message->data);
-            message->data = NULL;
-        }
-        RudpMessage *tmp = message->subMessage;
-        memcpy(message, message->subMessage, sizeof(RudpMessage));
-        free(tmp);
-        return true;
-    }
-    return false;
-}
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_ack_packet(RudpInstance *rudp, uint16_t counter_to_ack)
 {
 	ChiakiSeqNum16 acked_seq_nums[RUDP_SEND_BUFFER_SIZE];
@@ -601,21 +559,6 @@ CHIAKI_EXPORT void chiaki_rudp_print_message(RudpInstance *rudp, RudpMessage *me
         chiaki_rudp_print_message(rudp, message->subMessage);
 }
 
-CHIAKI_EXPORT void chiaki_rudp_message_pointers_free(RudpMessage *message)
-{
-    if(message->data)
-    {
-        free(message->data);
-        message->data = NULL;
-    }
-    if(message->subMessage)
-    {
-        chiaki_rudp_message_pointers_free(message->subMessage);
-        free(message->subMessage);
-        message->subMessage = NULL;
-    }
-}
-
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_fini(RudpInstance *rudp)
 {
     ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
@@ -0,0 +1,610 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/remote/stunclient.h>
+#include <chiaki/random.h>
+#include <chiaki/stoppipe.h>
+#include <chiaki/thread.h>
+#include <chiaki/time.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#endif
+
+#define STUN_HEADER_SIZE 20
+#define STUN_MSG_TYPE_BINDING_REQUEST 0x0001
+#define STUN_MSG_TYPE_BINDING_RESPONSE 0x0101
+#define STUN_MAGIC_COOKIE 0x2112A442UL
+#define STUN_TRANSACTION_ID_OFFSET 8
+#define STUN_TRANSACTION_ID_LENGTH 12
+#define STUN_ATTRIB_MAPPED_ADDRESS 0x0001
+#define STUN_ATTRIB_XOR_MAPPED_ADDRESS 0x0020
+#define STUN_MAPPED_ADDR_FAMILY_IPV4 0x01
+#define STUN_MAPPED_ADDR_FAMILY_IPV6 0x02
+
+#define STUN_RACE_PARALLEL_IPV4 4
+#define STUN_RACE_PARALLEL_IPV6 2
+#define STUN_RACE_RETRANSMIT_MS 250
+#define STUN_RACE_REQUEST_TIMEOUT_MS 1000
+#define STUN_RACE_TIMEOUT_MS 5000
+
+typedef enum
+{
+	STUN_REQUEST_IDLE,
+	STUN_REQUEST_PENDING,
+	STUN_REQUEST_EXPIRED, // replaced by another server, but a late response is still taken
+	STUN_REQUEST_ANSWERED,
+	STUN_REQUEST_FAILED
+} StunRequestState;
+
+typedef struct stun_request_t
+{
+	StunRequestState state;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	uint8_t msg[STUN_HEADER_SIZE];
+	size_t send_index;
+	uint64_t first_sent_ms;
+	uint64_t next_send_ms;
+	uint64_t retransmit_ms;
+} StunRequest;
+
+CHIAKI_EXPORT void chiaki_stun_race_params_default(ChiakiStunRaceParams *params, bool ipv4)
+{
+	params->ipv4 = ipv4;
+	params->parallel = ipv4 ? STUN_RACE_PARALLEL_IPV4 : STUN_RACE_PARALLEL_IPV6;
+	params->responses_wanted = 1;
+	params->retransmit_ms = STUN_RACE_RETRANSMIT_MS;
+	params->request_timeout_ms = STUN_RACE_REQUEST_TIMEOUT_MS;
+	params->timeout_ms = STUN_RACE_TIMEOUT_MS;
+}
+
+static uint16_t read_u16(const uint8_t *buf)
+{
+	return (uint16_t)((buf[0] << 8) | buf[1]);
+}
+
+static uint32_t read_u32(const uint8_t *buf)
+{
+	return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | (uint32_t)buf[3];
+}
+
+static void binding_request_build(uint8_t *msg)
+{
+	memset(msg, 0, STUN_HEADER_SIZE);
+	msg[0] = (uint8_t)(STUN_MSG_TYPE_BINDING_REQUEST >> 8);
+	msg[1] = (uint8_t)STUN_MSG_TYPE_BINDING_REQUEST;
+	// length 0
+	msg[4] = (uint8_t)(STUN_MAGIC_COOKIE >> 24);
+	msg[5] = (uint8_t)(STUN_MAGIC_COOKIE >> 16);
+	msg[6] = (uint8_t)(STUN_MAGIC_COOKIE >> 8);
+	msg[7] = (uint8_t)STUN_MAGIC_COOKIE;
+	chiaki_random_bytes_crypt(msg + STUN_TRANSACTION_ID_OFFSET, STUN_TRANSACTION_ID_LENGTH);
+}
+
+/**
+ * Extract the mapped address from a binding response whose header has already been validated.
+ * XOR-MAPPED-ADDRESS is preferred, because some NATs rewrite addresses they find in plain MAPPED-ADDRESS.
+ */
+static bool binding_response_parse(ChiakiLog *log, const uint8_t *resp, size_t resp_size, const uint8_t *req, char *address, uint16_t *port)
+{
+	bool found = false;
+	size_t pos = STUN_HEADER_SIZE;
+	while(pos + 4 <= resp_size)
+	{
+		uint16_t attr_type = read_u16(resp + pos);
+		uint16_t attr_length = read_u16(resp + pos + 2);
+		const uint8_t *attr = resp + pos + 4;
+		if(attr_length > resp_size - pos - 4)
+		{
+			CHIAKI_LOGE(log, "STUN response with invalid attribute length");
+			return false;
+		}
+		pos += 4 + ((attr_length + 3) & ~3);
+
+		bool xored = attr_type == STUN_ATTRIB_XOR_MAPPED_ADDRESS;
+		if(!xored && (attr_type != STUN_ATTRIB_MAPPED_ADDRESS || found))
+			continue;
+		if(attr_length < 4)
+		{
+			CHIAKI_LOGE(log, "STUN response with truncated mapped address");
+			return false;
+		}
+		uint8_t family = attr[1];
+		uint16_t p = read_u16(attr + 2);
+		if(xored)
+			p ^= (uint16_t)(STUN_MAGIC_COOKIE >> 16);
+		if(family == STUN_MAPPED_ADDR_FAMILY_IPV4)
+		{
+			if(attr_length != 8)
+			{
+				CHIAKI_LOGE(log, "STUN response with invalid IPv4 mapped address length %u", (unsigned int)attr_length);
+				return false;
+			}
+			uint32_t a = read_u32(attr + 4);
+			if(xored)
+				a ^= STUN_MAGIC_COOKIE;
+			uint8_t a_bytes[4] = { (uint8_t)(a >> 24), (uint8_t)(a >> 16), (uint8_t)(a >> 8), (uint8_t)a };
+			inet_ntop(AF_INET, a_bytes, address, CHIAKI_STUN_ADDRESS_SIZE);
+		}
+		else if(family == STUN_MAPPED_ADDR_FAMILY_IPV6)
+		{
+			if(attr_length != 20)
+			{
+				CHIAKI_LOGE(log, "STUN response with invalid IPv6 mapped address length %u", (unsigned int)attr_length);
+				return false;
+			}
+			uint8_t a_bytes[16];
+			for(size_t i=0; i<16; i++)
+				a_bytes[i] = attr[4 + i] ^ (xored ? req[4 + i] : 0); // magic cookie followed by transaction id
+			inet_ntop(AF_INET6, a_bytes, address, CHIAKI_STUN_ADDRESS_SIZE);
+		}
+		else
+		{
+			CHIAKI_LOGE(log, "STUN response with invalid address family %u", (unsigned int)family);
+			return false;
+		}
+		*port = p;
+		found = true;
+		if(xored)
+			break;
+	}
+	return found;
+}
+
+static StunRequest *request_for_response(StunRequest *requests, size_t count, const uint8_t *resp, size_t resp_size)
+{
+	if(resp_size < STUN_HEADER_SIZE
+			|| read_u16(resp) != STUN_MSG_TYPE_BINDING_RESPONSE
+			|| (size_t)read_u16(resp + 2) + STUN_HEADER_SIZE != resp_size
+			|| read_u32(resp + 4) != STUN_MAGIC_COOKIE)
+		return NULL;
+	for(size_t i=0; i<count; i++)
+	{
+		StunRequest *req = &requests[i];
+		if(req->state != STUN_REQUEST_PENDING && req->state != STUN_REQUEST_EXPIRED)
+			continue;
+		if(memcmp(req->msg + STUN_TRANSACTION_ID_OFFSET, resp + STUN_TRANSACTION_ID_OFFSET, STUN_TRANSACTION_ID_LENGTH) == 0)
+			return req;
+	}
+	return NULL;
+}
+
+static bool request_send(StunRequest *req, chiaki_socket_t sock)
+{
+	CHIAKI_SSIZET_TYPE sent = sendto(sock, (CHIAKI_SOCKET_BUF_TYPE)req->msg, sizeof(req->msg), 0, (struct sockaddr *)&req->addr, req->addr_len);
+	return sent == sizeof(req->msg);
+}
+
+typedef struct stun_resolver_t StunResolver;
+
+typedef struct stun_resolve_t
+{
+	StunResolver *resolver;
+	ChiakiThread thread;
+	bool thread_valid;
+	bool done; // protected by resolver->mutex
+	StunRequest *req;
+	const ChiakiStunServer *server;
+	bool ipv4;
+} StunResolve;
+
+/**
+ * Resolves all servers concurrently while the race is already running, so the requests go out as soon as
+ * enough servers are resolved and a slow lookup only holds up its own server.
+ */
+struct stun_resolver_t
+{
+	ChiakiMutex mutex;
+	ChiakiStopPipe wakeup; // signalled whenever a lookup finishes
+	StunResolve resolves[CHIAKI_STUN_SERVERS_MAX];
+	size_t count;
+};
+
+/**
+ * Resolve server into req->addr, req->addr_len is left at 0 if that fails.
+ */
+static void *request_resolve_thread_func(void *user)
+{
+	StunResolve *resolve = user;
+	StunRequest *req = resolve->req;
+	req->addr_len = 0;
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = resolve->ipv4 ? AF_INET : AF_INET6;
+	if(!resolve->ipv4)
+		hints.ai_flags = AI_ADDRCONFIG;
+	hints.ai_socktype = SOCK_DGRAM;
+	char service[6];
+	snprintf(service, sizeof(service), "%u", (unsigned int)resolve->server->port);
+	struct addrinfo *resolved;
+	if(getaddrinfo(resolve->server->host, service, &hints, &resolved) == 0)
+	{
+		if(resolved->ai_addrlen <= sizeof(req->addr))
+		{
+			memcpy(&req->addr, resolved->ai_addr, resolved->ai_addrlen);
+			req->addr_len = (socklen_t)resolved->ai_addrlen;
+		}
+		freeaddrinfo(resolved);
+	}
+
+	StunResolver *resolver = resolve->resolver;
+	chiaki_mutex_lock(&resolver->mutex);
+	resolve->done = true;
+	chiaki_mutex_unlock(&resolver->mutex);
+	chiaki_stop_pipe_stop(&resolver->wakeup);
+	return NULL;
+}
+
+static ChiakiErrorCode resolver_start(StunResolver *resolver, StunRequest *requests, const ChiakiStunServer *servers, size_t count, bool ipv4)
+{
+	ChiakiErrorCode err = chiaki_mutex_init(&resolver->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	err = chiaki_stop_pipe_init(&resolver->wakeup);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_mutex_fini(&resolver->mutex);
+		return err;
+	}
+	resolver->count = count;
+	for(size_t i=0; i<count; i++)
+	{
+		StunResolve *resolve = &resolver->resolves[i];
+		resolve->resolver = resolver;
+		resolve->done = false;
+		resolve->req = &requests[i];
+		resolve->server = &servers[i];
+		resolve->ipv4 = ipv4;
+		resolve->thread_valid = chiaki_thread_create(&resolve->thread, request_resolve_thread_func, resolve) == CHIAKI_ERR_SUCCESS;
+		if(!resolve->thread_valid)
+			request_resolve_thread_func(resolve);
+	}
+	return CHIAKI_ERR_SUCCESS;
+}
+
+/**
+ * Waits for lookups that are still running, they write into the requests.
+ */
+static void resolver_fini(StunResolver *resolver)
+{
+	for(size_t i=0; i<resolver->count; i++)
+	{
+		if(resolver->resolves[i].thread_valid)
+			chiaki_thread_join(&resolver->resolves[i].thread, NULL);
+	}
+	chiaki_stop_pipe_fini(&resolver->wakeup);
+	chiaki_mutex_fini(&resolver->mutex);
+}
+
+/**
+ * @param resolved if not NULL, set to the number of finished lookups, successful or not
+ * @return index of the first request that is resolved but not launched yet, or SIZE_MAX if there is none
+ */
+static size_t resolver_next(StunResolver *resolver, StunRequest *requests, size_t *resolved)
+{
+	size_t next = SIZE_MAX;
+	size_t done = 0;
+	chiaki_mutex_lock(&resolver->mutex);
+	for(size_t i=0; i<resolver->count; i++)
+	{
+		if(!resolver->resolves[i].done)
+			continue;
+		done++;
+		if(requests[i].state == STUN_REQUEST_IDLE && next == SIZE_MAX)
+			next = i;
+	}
+	chiaki_mutex_unlock(&resolver->mutex);
+	if(resolved)
+		*resolved = done;
+	return next;
+}
+
+/**
+ * @return false if the request could not be sent at all, i.e. the socket is unusable
+ */
+static bool request_launch(ChiakiLog *log, StunRequest *requests, size_t count, size_t index, const ChiakiStunServer *server, chiaki_socket_t sock,
+		const ChiakiStunRaceParams *params, size_t *sent_count, uint64_t now_ms)
+{
+	StunRequest *req = &requests[index];
+	req->state = STUN_REQUEST_FAILED;
+	if(!req->addr_len)
+	{
+		CHIAKI_LOGW(log, "Failed to resolve STUN server %s:%u", server->host, (unsigned int)server->port);
+		return true;
+	}
+
+	// A second request to the same destination reuses its mapping, which would throw off the allocation order.
+	for(size_t i=0; i<count; i++)
+	{
+		StunRequest *other = &requests[i];
+		if(i == index
+				|| (other->state != STUN_REQUEST_PENDING && other->state != STUN_REQUEST_EXPIRED && other->state != STUN_REQUEST_ANSWERED)
+				|| other->addr_len != req->addr_len)
+			continue;
+		if(memcmp(&other->addr, &req->addr, req->addr_len) == 0)
+		{
+			CHIAKI_LOGV(log, "Skipping STUN server %s:%u, resolves to an address already queried", server->host, (unsigned int)server->port);
+			return true;
+		}
+	}
+
+	binding_request_build(req->msg);
+	if(!request_send(req, sock))
+	{
+		CHIAKI_LOGE(log, "Failed to send STUN request to %s:%u, error was " CHIAKI_SOCKET_ERROR_FMT, server->host, (unsigned int)server->port, CHIAKI_SOCKET_ERROR_VALUE);
+		return false;
+	}
+	req->state = STUN_REQUEST_PENDING;
+	req->send_index = (*sent_count)++;
+	req->first_sent_ms = now_ms;
+	req->retransmit_ms = params->retransmit_ms;
+	req->next_send_ms = now_ms + req->retransmit_ms;
+	return true;
+}
+
+static size_t consistent_count(const ChiakiStunRaceResult *result, const char *address)
+{
+	size_t count = 0;
+	for(size_t i=0; i<result->responses_count; i++)
+		if(strcmp(result->responses[i].address, address) == 0)
+			count++;
+	return count;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_stun_race(ChiakiLog *log, chiaki_socket_t *sock, const ChiakiStunServer *servers, size_t servers_count,
+		const ChiakiStunRaceParams *params, ChiakiStunRaceResult *result)
+{
+	memset(result, 0, sizeof(*result));
+	if(servers_count > CHIAKI_STUN_SERVERS_MAX)
+		servers_count = CHIAKI_STUN_SERVERS_MAX;
+	size_t parallel = params->parallel ? params->parallel : 1;
+	size_t wanted = params->responses_wanted ? params->responses_wanted : 1;
+
+	StunRequest requests[CHIAKI_STUN_SERVERS_MAX];
+	for(size_t i=0; i<servers_count; i++)
+	{
+		requests[i].state = STUN_REQUEST_IDLE;
+		requests[i].addr_len = 0;
+	}
+	uint64_t start_ms = chiaki_time_now_monotonic_ms();
+	StunResolver resolver;
+	ChiakiErrorCode err = resolver_start(&resolver, requests, servers, servers_count, params->ipv4);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log, "Failed to start resolving STUN servers");
+		return err;
+	}
+
+	bool started = false;
+	size_t pending = 0;
+	size_t best_consistent = 0;
+	err = CHIAKI_ERR_TIMEOUT;
+	while(true)
+	{
+		if(CHIAKI_SOCKET_IS_INVALID(*sock))
+		{
+			err = CHIAKI_ERR_CANCELED;
+			break;
+		}
+		// Lookups finishing from here on signal again, so none is missed between this and the wait below.
+		chiaki_stop_pipe_reset(&resolver.wakeup);
+		uint64_t now_ms = chiaki_time_now_monotonic_ms();
+
+		for(size_t i=0; i<servers_count; i++)
+		{
+			StunRequest *req = &requests[i];
+			if(req->state != STUN_REQUEST_PENDING)
+				continue;
+			if(now_ms - req->first_sent_ms >= params->request_timeout_ms)
+			{
+				CHIAKI_LOGW(log, "No response from STUN server %s:%u after %llums, trying another one",
+						servers[i].host, (unsigned int)servers[i].port, (unsigned long long)params->request_timeout_ms);
+				req->state = STUN_REQUEST_EXPIRED;
+				pending--;
+			}
+			else if(now_ms >= req->next_send_ms)
+			{
+				request_send(req, *sock); // if this fails, a later retransmission or another server may still succeed
+				req->retransmit_ms *= 2;
+				req->next_send_ms = now_ms + req->retransmit_ms;
+			}
+		}
+
+		// The first requests go out together as soon as enough servers are resolved, in list order.
+		// Servers resolved later are fed in as replacements for failed or silent ones.
+		size_t resolved = 0;
+		resolver_next(&resolver, requests, &resolved);
+		if(!started && resolved >= (parallel < servers_count ? parallel : servers_count))
+			started = true;
+		while(started && pending < parallel)
+		{
+			size_t index = resolver_next(&resolver, requests, &resolved);
+			if(index == SIZE_MAX)
+				break;
+			if(!request_launch(log, requests, servers_count, index, &servers[index], *sock, params, &result->sent_count, now_ms))
+			{
+				if(!CHIAKI_SOCKET_IS_INVALID(*sock))
+				{
+					CHIAKI_SOCKET_CLOSE(*sock);
+					*sock = CHIAKI_INVALID_SOCKET;
+				}
+				err = CHIAKI_ERR_NETWORK;
+				goto beach;
+			}
+			if(requests[index].state == STUN_REQUEST_PENDING)
+				pending++;
+		}
+
+		bool any_outstanding = pending > 0 || resolved < servers_count;
+		for(size_t i=0; i<servers_count && !any_outstanding; i++)
+			any_outstanding = requests[i].state == STUN_REQUEST_EXPIRED;
+		if(!any_outstanding)
+		{
+			CHIAKI_LOGE(log, "All STUN servers failed");
+			break;
+		}
+		if(now_ms - start_ms >= params->timeout_ms)
+			break;
+
+		uint64_t wakeup_ms = start_ms + params->timeout_ms;
+		for(size_t i=0; i<servers_count; i++)
+		{
+			StunRequest *req = &requests[i];
+			if(req->state != STUN_REQUEST_PENDING)
+				continue;
+			if(req->next_send_ms < wakeup_ms)
+				wakeup_ms = req->next_send_ms;
+			if(req->first_sent_ms + params->request_timeout_ms < wakeup_ms)
+				wakeup_ms = req->first_sent_ms + params->request_timeout_ms;
+		}
+		uint64_t wait_ms = wakeup_ms > now_ms ? wakeup_ms - now_ms : 0;
+
+		ChiakiErrorCode wait_err = chiaki_stop_pipe_select_single(&resolver.wakeup, *sock, false, wait_ms);
+		if(wait_err == CHIAKI_ERR_CANCELED || wait_err == CHIAKI_ERR_TIMEOUT)
+			continue; // a lookup finished or a request is due
+		if(wait_err != CHIAKI_ERR_SUCCESS)
+		{
+			if(CHIAKI_SOCKET_IS_INVALID(*sock))
+				continue;
+			CHIAKI_LOGE(log, "Waiting for STUN responses failed, error was " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+			err = CHIAKI_ERR_NETWORK;
+			break;
+		}
+
+		uint8_t resp[512];
+		CHIAKI_SSIZET_TYPE received = recvfrom(*sock, (CHIAKI_SOCKET_BUF_TYPE)resp, sizeof(resp), 0, NULL, NULL);
+		if(received < 0)
+			continue; // e.g. ICMP port unreachable from one of the servers on Windows
+		StunRequest *req = request_for_response(requests, servers_count, resp, (size_t)received);
+		if(!req)
+			continue; // not ours, the socket may carry other traffic
+		size_t index = (size_t)(req - requests);
+		ChiakiStunResponse *response = &result->responses[result->responses_count];
+		if(!binding_response_parse(log, resp, (size_t)received, req->msg, response->address, &response->port))
+			continue;
+		if(req->state == STUN_REQUEST_PENDING)
+			pending--;
+		req->state = STUN_REQUEST_ANSWERED;
+		response->server_index = index;
+		response->send_index = req->send_index;
+		response->rtt_ms = chiaki_time_now_monotonic_ms() - req->first_sent_ms;
+		result->responses_count++;
+		CHIAKI_LOGV(log, "STUN server %s:%u reported %s:%u after %llums", servers[index].host, (unsigned int)servers[index].port,
+				response->address, (unsigned int)response->port, (unsigned long long)response->rtt_ms);
+
+		size_t consistent = consistent_count(result, response->address);
+		if(consistent > best_consistent)
+			best_consistent = consistent;
+		if(best_consistent >= wanted)
+		{
+			err = CHIAKI_ERR_SUCCESS;
+			break;
+		}
+	}
+
+beach:
+	result->elapsed_ms = chiaki_time_now_monotonic_ms() - start_ms;
+	resolver_fini(&resolver);
+	if(err == CHIAKI_ERR_TIMEOUT && result->responses_count)
+		CHIAKI_LOGW(log, "Only got %zu consistent STUN responses out of %zu wanted", best_consistent, wanted);
+	return err;
+}
+
+CHIAKI_EXPORT bool chiaki_stun_allocation_derive(ChiakiLog *log, const ChiakiStunRaceResult *result,
+		char *address, uint16_t *port, int32_t *allocation_increment, bool *random_allocation)
+{
+	if(!result->responses_count)
+		return false;
+
+	// the address most servers agree on, the earliest response wins a tie
+	const ChiakiStunResponse *best = &result->responses[0];
+	size_t best_count = 0;
+	for(size_t i=0; i<result->responses_count; i++)
+	{
+		size_t count = consistent_count(result, result->responses[i].address);
+		if(count > best_count)
+		{
+			best = &result->responses[i];
+			best_count = count;
+		}
+	}
+	if(best_count < result->responses_count)
+		CHIAKI_LOGW(log, "STUN servers reported different addresses, using %s reported by %zu of %zu",
+				best->address, best_count, result->responses_count);
+
+	// responses for that address in allocation order
+	const ChiakiStunResponse *group[CHIAKI_STUN_SERVERS_MAX];
+	size_t group_count = 0;
+	for(size_t i=0; i<result->responses_count; i++)
+	{
+		const ChiakiStunResponse *response = &result->responses[i];
+		if(strcmp(response->address, best->address) != 0)
+			continue;
+		size_t j = group_count++;
+		for(; j>0 && group[j-1]->send_index > response->send_index; j--)
+			group[j] = group[j-1];
+		group[j] = response;
+	}
+
+	memcpy(address, best->address, CHIAKI_STUN_ADDRESS_SIZE);
+	const ChiakiStunResponse *last = group[group_count - 1];
+	if(group_count < 2)
+	{
+		CHIAKI_LOGW(log, "Couldn't determine packet allocation because not enough STUN servers responded with the same address.");
+		*port = last->port;
+		*allocation_increment = 0;
+		return true;
+	}
+
+	int32_t increments[CHIAKI_STUN_SERVERS_MAX - 1];
+	size_t increments_count = group_count - 1;
+	for(size_t i=0; i<increments_count; i++)
+	{
+		int32_t port_diff = (int32_t)group[i+1]->port - (int32_t)group[i]->port;
+		int32_t send_diff = (int32_t)(group[i+1]->send_index - group[i]->send_index);
+		increments[i] = port_diff / send_diff;
+	}
+
+	int32_t increment = increments[0];
+	size_t increment_votes = 0;
+	for(size_t i=0; i<increments_count; i++)
+	{
+		size_t votes = 0;
+		for(size_t j=0; j<increments_count; j++)
+			if(increments[j] == increments[i])
+				votes++;
+		if(votes > increment_votes)
+		{
+			increment = increments[i];
+			increment_votes = votes;
+		}
+	}
+
+	if(increments_count == 1 || increment_votes >= 2)
+	{
+		CHIAKI_LOGI(log, "Calculating packet allocation based on %zu responses with the same address, increment %d (%zu of %zu agree)",
+				group_count, (int)increment, increment_votes, increments_count);
+		*allocation_increment = increment;
+		// extrapolate to the mapping of the last request sent, which is where the next allocation follows
+		int32_t predicted = (int32_t)last->port + increment * (int32_t)(result->sent_count - 1 - last->send_index);
+		*port = (uint16_t)predicted;
+	}
+	else
+	{
+		*random_allocation = true;
+		*allocation_increment = increments[0];
+		for(size_t i=0; i<increments_count && !*allocation_increment; i++)
+			*allocation_increment = increments[i];
+		CHIAKI_LOGW(log, "Got different allocation increment calculations from %zu responses with the same address, assuming random allocation", group_count);
+		*port = last->port;
+	}
+	return true;
+}
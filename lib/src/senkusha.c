@@ -133,6 +133,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, uint
 
 	ChiakiTakionConnectInfo takion_info;
 	takion_info.log = senkusha->log;
+	takion_info.executor = NULL;
 	if(!socket)
 	{
 		takion_info.close_socket = true;
@@ -6,6 +6,7 @@
 #include <chiaki/http.h>
 #include <chiaki/base64.h>
 #include <chiaki/random.h>
+#include <chiaki/discovery.h>
 
 #include <stdlib.h>
 #include <string.h>
@@ -35,6 +36,8 @@
 static void *session_thread_func(void *arg);
 static void regist_cb(ChiakiRegistEvent *event, void *user);
 static ChiakiErrorCode session_thread_request_session(ChiakiSession *session, ChiakiTarget *target_out);
+static ChiakiErrorCode session_thread_wakeup(ChiakiSession *session);
+static ChiakiErrorCode session_prepare_crypto(ChiakiSession *session);
 
 const char *chiaki_rp_application_reason_string(uint32_t reason)
 {
@@ -264,6 +267,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, Chiaki
 	session->connect_info.enable_keyboard = connect_info->enable_keyboard;
 	session->connect_info.enable_dualsense = connect_info->enable_dualsense;
 	session->connect_info.enable_idr_on_fec_failure = connect_info->enable_idr_on_fec_failure;
+	session->connect_info.wakeup = connect_info->wakeup && !session->holepunch_session;
+	session->connect_info.executor = connect_info->executor;
 
 	return CHIAKI_ERR_SUCCESS;
 
@@ -432,6 +437,7 @@ static void *session_thread_func(void *arg)
 	ChiakiSession *session = (ChiakiSession *)arg;
 	chiaki_thread_set_affinity(CHIAKI_THREAD_NAME_SESSION);
 
+	bool crypto_prepared = false;
 	chiaki_mutex_lock(&session->state_mutex);
 
 #define QUIT(quit_label) do { \
@@ -484,6 +490,21 @@ static void *session_thread_func(void *arg)
 		session->quit_reason = CHIAKI_QUIT_REASON_STOPPED;
 		QUIT(quit);
 	}
+	if(session->connect_info.wakeup)
+	{
+		// the console takes seconds to wake up, get the keys out of the way now
+		if(session_prepare_crypto(session) != CHIAKI_ERR_SUCCESS)
+			QUIT(quit);
+		crypto_prepared = true;
+		if(session_thread_wakeup(session) != CHIAKI_ERR_SUCCESS)
+		{
+			CHECK_STOP(quit);
+			session->quit_reason = CHIAKI_QUIT_REASON_SESSION_REQUEST_UNKNOWN;
+			QUIT(quit);
+		}
+		CHECK_STOP(quit);
+	}
+
 	CHIAKI_LOGI(session->log, "Starting session request for %s", session->connect_info.ps5 ? "PS5" : "PS4");
 
 	ChiakiTarget server_target = CHIAKI_TARGET_PS4_UNKNOWN;
@@ -664,18 +685,12 @@ ctrl_failed:
 		CHIAKI_LOGI(session->log, "Received Switch to Stream Connection Ack... Switching to Stream Connection now");
 	}
 
-	err = chiaki_random_bytes_crypt(session->handshake_key, sizeof(session->handshake_key));
-	if(err != CHIAKI_ERR_SUCCESS)
+	if(!crypto_prepared)
 	{
-		CHIAKI_LOGE(session->log, "Session failed to generate handshake key");
-		QUIT(quit_ctrl);
-	}
-
-	err = chiaki_ecdh_init(&session->ecdh);
-	if(err != CHIAKI_ERR_SUCCESS)
-	{
-		CHIAKI_LOGE(session->log, "Session failed to initialize ECDH");
-		QUIT(quit_ctrl);
+		err = session_prepare_crypto(session);
+		if(err != CHIAKI_ERR_SUCCESS)
+			QUIT(quit_ctrl);
+		crypto_prepared = true;
 	}
 
 	chiaki_mutex_unlock(&session->state_mutex);
@@ -703,6 +718,7 @@ ctrl_failed:
 
 	chiaki_mutex_unlock(&session->state_mutex);
 	chiaki_ecdh_fini(&session->ecdh);
+	crypto_prepared = false;
 
 quit_ctrl:
 	chiaki_ctrl_stop(&session->ctrl);
@@ -711,6 +727,8 @@ quit_ctrl:
 
 	ChiakiEvent quit_event;
 quit:
+	if(crypto_prepared)
+		chiaki_ecdh_fini(&session->ecdh);
 
 	CHIAKI_LOGI(session->log, "Session has quit");
 	chiaki_mutex_lock(&session->state_mutex);
@@ -754,6 +772,57 @@ static void parse_session_response(SessionResponse *response, ChiakiHttpResponse
 }
 
 
+static ChiakiErrorCode session_prepare_crypto(ChiakiSession *session)
+{
+	ChiakiErrorCode err = chiaki_random_bytes_crypt(session->handshake_key, sizeof(session->handshake_key));
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(session->log, "Session failed to generate handshake key");
+		return err;
+	}
+
+	err = chiaki_ecdh_init(&session->ecdh);
+	if(err != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGE(session->log, "Session failed to initialize ECDH");
+	return err;
+}
+
+/**
+ * Wake the console and return as soon as it reports ready, must be called with state_mutex locked
+ */
+static ChiakiErrorCode session_thread_wakeup(ChiakiSession *session)
+{
+	uint64_t credential;
+	ChiakiErrorCode err = chiaki_discovery_regist_key_credential(session->connect_info.regist_key, sizeof(session->connect_info.regist_key), &credential);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(session->log, "Session can't wake up the console with an invalid regist key");
+		return err;
+	}
+
+	struct addrinfo *ai = session->connect_info.host_addrinfos;
+	while(ai && ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
+		ai = ai->ai_next;
+	if(!ai)
+		return CHIAKI_ERR_PARSE_ADDR;
+
+	ChiakiDiscovery discovery;
+	err = chiaki_discovery_init(&discovery, session->log, ai->ai_family);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(session->log, "Session failed to init discovery for wakeup");
+		return err;
+	}
+
+	ChiakiDiscoveryWakeOptions options;
+	chiaki_discovery_wake_options_default(&options, credential, session->connect_info.ps5);
+	chiaki_mutex_unlock(&session->state_mutex);
+	err = chiaki_discovery_wake_wait_ready(&discovery, &session->stop_pipe, ai->ai_addr, (socklen_t)ai->ai_addrlen, &options);
+	chiaki_mutex_lock(&session->state_mutex);
+	chiaki_discovery_fini(&discovery);
+	return err;
+}
+
 /**
  * @param target_out if NULL, version mismatch means to fail the entire session, otherwise report the target here
  */
@@ -764,25 +833,24 @@ static ChiakiErrorCode session_thread_request_session(ChiakiSession *session, Ch
 	if(session->rudp)
 	{
 		CHIAKI_LOGI(session->log, "SESSION START THREAD - Starting RUDP session");
-		RudpMessage message;
-		ChiakiErrorCode err = chiaki_rudp_send_recv(session->rudp, &message, NULL, 0, 0, INIT_REQUEST, INIT_RESPONSE, 8, 3);
+		ChiakiRudpDatagram datagram;
+		RudpMessage *message;
+		ChiakiErrorCode err = chiaki_rudp_send_recv(session->rudp, &datagram, &message, NULL, 0, 0, INIT_REQUEST, INIT_RESPONSE, 8, 3);
 		if(err != CHIAKI_ERR_SUCCESS)
 		{
 			CHIAKI_LOGE(session->log, "SESSION START THREAD - Failed to init rudp");
 			return err;
 		}
-		size_t init_response_size = message.data_size - 8;
+		size_t init_response_size = message->data_size - 8;
 		uint8_t init_response[init_response_size];
-		memcpy(init_response, message.data + 8, init_response_size);
-		chiaki_rudp_message_pointers_free(&message);
-		err = chiaki_rudp_send_recv(session->rudp, &message, init_response, init_response_size, 0, COOKIE_REQUEST, COOKIE_RESPONSE, 2, 3);
+		memcpy(init_response, message->data + 8, init_response_size);
+		err = chiaki_rudp_send_recv(session->rudp, &datagram, &message, init_response, init_response_size, 0, COOKIE_REQUEST, COOKIE_RESPONSE, 2, 3);
 		if(err != CHIAKI_ERR_SUCCESS)
 		{
 			CHIAKI_LOGE(session->log, "SESSION START THREAD - Failed to pass rudp cookie");
 			return err;
 		}
-		remote_counter = message.remote_counter;
-		chiaki_rudp_message_pointers_free(&message);
+		remote_counter = message->remote_counter;
 	}
 	else
 	{
@@ -1006,12 +1074,11 @@ static ChiakiErrorCode session_thread_request_session(ChiakiSession *session, Ch
 	}
 	if(session->rudp)
 	{
-		RudpMessage message;
-		err = chiaki_rudp_send_recv(session->rudp, &message, NULL, 0, remote_counter, ACK, FINISH, 0, 3);
+		ChiakiRudpDatagram datagram;
+		RudpMessage *message;
+		err = chiaki_rudp_send_recv(session->rudp, &datagram, &message, NULL, 0, remote_counter, ACK, FINISH, 0, 3);
 		if(err != CHIAKI_ERR_SUCCESS)
 			CHIAKI_LOGW(session->log, "SESSION START THREAD - Failed to finish rudp, continuing...");
-		else
-			chiaki_rudp_message_pointers_free(&message);
 	}
 
 	ChiakiHttpResponse http_response;
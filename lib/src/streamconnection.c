@@ -73,6 +73,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnecti
 	stream_connection->streaminfo_early_buf = NULL;
 	stream_connection->streaminfo_early_buf_size = 0;
 	stream_connection->player_index = 0;
+	stream_connection->congestion_control.executor = NULL;
 	memset(stream_connection->led_state, 0, sizeof(stream_connection->led_state));
 
 	stream_connection->haptic_intensity = Strong;
@@ -121,11 +122,22 @@ CHIAKI_EXPORT void chiaki_stream_connection_fini(ChiakiStreamConnection *stream_
 {
 	free(stream_connection->remote_disconnect_reason);
 
+	if(stream_connection->gkcrypt_remote)
+	{
+		ChiakiGKCryptStats stats;
+		chiaki_gkcrypt_get_stats(stream_connection->gkcrypt_remote, &stats);
+		CHIAKI_LOGI(stream_connection->log, "StreamConnection key stream: %llu hits, %llu misses taking %llu us total and %llu us max",
+				(unsigned long long)stats.key_buf_hits,
+				(unsigned long long)stats.key_buf_misses,
+				(unsigned long long)stats.key_buf_miss_us_total,
+				(unsigned long long)stats.key_buf_miss_us_max);
+	}
+
 	chiaki_gkcrypt_free(stream_connection->gkcrypt_remote);
 	chiaki_gkcrypt_free(stream_connection->gkcrypt_local);
 
 	free(stream_connection->ecdh_secret);
-	if (stream_connection->congestion_control.thread.thread)
+	if (stream_connection->congestion_control.thread.thread || stream_connection->congestion_control.executor)
 		chiaki_congestion_control_stop(&stream_connection->congestion_control);
 
 	chiaki_packet_stats_fini(&stream_connection->packet_stats);
@@ -151,6 +163,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 	takion_info.log = stream_connection->log;
 	takion_info.disable_audio_video = stream_connection->session->connect_info.disable_audio_video;
 	takion_info.close_socket = true;
+	takion_info.executor = session->connect_info.executor;
 	if(!socket)
 	{
 		takion_info.sa_len = session->connect_info.host_addrinfo_selected->ai_addrlen;
@@ -722,13 +735,13 @@ static ChiakiErrorCode stream_connection_init_crypt(ChiakiStreamConnection *stre
 {
 	ChiakiSession *session = stream_connection->session;
 
-	stream_connection->gkcrypt_local = chiaki_gkcrypt_new(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, 2, session->handshake_key, stream_connection->ecdh_secret);
+	stream_connection->gkcrypt_local = chiaki_gkcrypt_new(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, session->connect_info.executor, 2, session->handshake_key, stream_connection->ecdh_secret);
 	if(!stream_connection->gkcrypt_local)
 	{
 		CHIAKI_LOGE(stream_connection->log, "StreamConnection failed to initialize local GKCrypt with index 2");
 		return CHIAKI_ERR_UNKNOWN;
 	}
-	stream_connection->gkcrypt_remote = chiaki_gkcrypt_new(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, 3, session->handshake_key, stream_connection->ecdh_secret);
+	stream_connection->gkcrypt_remote = chiaki_gkcrypt_new(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, session->connect_info.executor, 3, session->handshake_key, stream_connection->ecdh_secret);
 	if(!stream_connection->gkcrypt_remote)
 	{
 		CHIAKI_LOGE(stream_connection->log, "StreamConnection failed to initialize remote GKCrypt with index 3");
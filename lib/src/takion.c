@@ -196,6 +196,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 
 	takion->log = info->log;
 	takion->close_socket = info->close_socket;
+	takion->executor = info->executor;
 	takion->version = info->protocol_version;
 	takion->disable_audio_video = info->disable_audio_video;
 
@@ -28,11 +28,13 @@ struct chiaki_takion_send_buffer_packet_t
 #ifndef CHIAKI_UNIT_TEST
 
 static void *takion_send_buffer_thread_func(void *user);
+static void takion_send_buffer_resend_task(void *user);
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_init(ChiakiTakionSendBuffer *send_buffer, ChiakiTakion *takion, size_t size)
 {
 	send_buffer->takion = takion;
 	send_buffer->log = takion ? takion->log : NULL;
+	send_buffer->executor = takion ? takion->executor : NULL;
 
 	send_buffer->packets = calloc(size, sizeof(ChiakiTakionSendBufferPacket));
 	if(!send_buffer->packets)
@@ -50,6 +52,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_init(ChiakiTakionSendBuf
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_mutex;
 
+	if(send_buffer->executor)
+	{
+		// scheduled whenever there are packets waiting for an ack
+		chiaki_executor_task_init(&send_buffer->resend_task, takion_send_buffer_resend_task, send_buffer);
+		return CHIAKI_ERR_SUCCESS;
+	}
+
 	err = chiaki_thread_create(&send_buffer->thread, takion_send_buffer_thread_func, send_buffer);
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_cond;
@@ -68,11 +77,16 @@ error_packets:
 
 CHIAKI_EXPORT void chiaki_takion_send_buffer_fini(ChiakiTakionSendBuffer *send_buffer)
 {
-	send_buffer->should_stop = true;
-	ChiakiErrorCode err = chiaki_cond_signal(&send_buffer->cond);
-	assert(err == CHIAKI_ERR_SUCCESS);
-	err = chiaki_thread_join(&send_buffer->thread, NULL);
-	assert(err == CHIAKI_ERR_SUCCESS);
+	if(send_buffer->executor)
+		chiaki_executor_cancel(send_buffer->executor, &send_buffer->resend_task);
+	else
+	{
+		send_buffer->should_stop = true;
+		ChiakiErrorCode err = chiaki_cond_signal(&send_buffer->cond);
+		assert(err == CHIAKI_ERR_SUCCESS);
+		err = chiaki_thread_join(&send_buffer->thread, NULL);
+		assert(err == CHIAKI_ERR_SUCCESS);
+	}
 
 	for(size_t i=0; i<send_buffer->packets_count; i++)
 		free(send_buffer->packets[i].buf);
@@ -117,7 +131,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_push(ChiakiTakionSendBuf
 	if(send_buffer->packets_count == 1)
 	{
 		// buffer was empty before, so it will sleep without timeout => WAKE UP!!
-		chiaki_cond_signal(&send_buffer->cond);
+		if(send_buffer->executor)
+			chiaki_executor_schedule(send_buffer->executor, &send_buffer->resend_task, TAKION_DATA_RESEND_WAKEUP_TIMEOUT_MS, 0);
+		else
+			chiaki_cond_signal(&send_buffer->cond);
 	}
 
 beach:
@@ -232,6 +249,18 @@ static void *takion_send_buffer_thread_func(void *user)
 	return NULL;
 }
 
+static void takion_send_buffer_resend_task(void *user)
+{
+	ChiakiTakionSendBuffer *send_buffer = user;
+	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return;
+	takion_send_buffer_resend(send_buffer);
+	if(send_buffer->packets_count)
+		chiaki_executor_schedule(send_buffer->executor, &send_buffer->resend_task, TAKION_DATA_RESEND_WAKEUP_TIMEOUT_MS, 0);
+	chiaki_mutex_unlock(&send_buffer->mutex);
+}
+
 static void takion_send_buffer_resend(ChiakiTakionSendBuffer *send_buffer)
 {
 	if(!send_buffer->takion)
@@ -7,30 +7,20 @@
 
 static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *video_receiver);
 
-static void add_ref_frame(ChiakiVideoReceiver *video_receiver, int32_t frame)
+static bool video_receiver_request_idr(ChiakiVideoReceiver *video_receiver)
 {
-	if(video_receiver->reference_frames[0] != -1)
+	ChiakiErrorCode err = stream_connection_send_idr_request(&video_receiver->session->stream_connection);
+	if(err != CHIAKI_ERR_SUCCESS)
 	{
-		memmove(&video_receiver->reference_frames[1], &video_receiver->reference_frames[0], sizeof(int32_t) * 15);
-		video_receiver->reference_frames[0] = frame;
-		return;
+		CHIAKI_LOGW(video_receiver->log, "IDR request could not be sent: %s", chiaki_error_string(err));
+		return false;
 	}
-	for(int i=15; i>=0; i--)
-	{
-		if(video_receiver->reference_frames[i] == -1)
-		{
-			video_receiver->reference_frames[i] = frame;
-			return;
-		}
-	}
-}
-
-static bool have_ref_frame(ChiakiVideoReceiver *video_receiver, int32_t frame)
-{
-	for(int i=0; i<16; i++)
-		if(video_receiver->reference_frames[i] == frame)
-			return true;
-	return false;
+	chiaki_video_receiver_set_waiting_for_idr(video_receiver, true);
+	video_receiver->idr_deferred = false;
+	chiaki_mutex_lock(&video_receiver->frames_lost_mutex);
+	video_receiver->idr_requests_total++;
+	chiaki_mutex_unlock(&video_receiver->frames_lost_mutex);
+	return true;
 }
 
 CHIAKI_EXPORT void chiaki_video_receiver_init(ChiakiVideoReceiver *video_receiver, struct chiaki_session_t *session, ChiakiPacketStats *packet_stats)
@@ -50,7 +40,11 @@ CHIAKI_EXPORT void chiaki_video_receiver_init(ChiakiVideoReceiver *video_receive
 
 	video_receiver->frames_lost = 0;
 	video_receiver->frames_lost_total = 0;
-	memset(video_receiver->reference_frames, -1, sizeof(video_receiver->reference_frames));
+	video_receiver->frames_recovered_total = 0;
+	video_receiver->idr_requests_total = 0;
+	video_receiver->idr_requests_avoided_total = 0;
+	video_receiver->idr_deferred = false;
+	chiaki_dpb_init(&video_receiver->dpb, video_receiver->session->connect_info.video_profile.codec);
 	chiaki_bitstream_init(&video_receiver->bitstream, video_receiver->log, video_receiver->session->connect_info.video_profile.codec);
 	chiaki_mutex_init(&video_receiver->waiting_for_idr_mutex, false);
 	video_receiver->waiting_for_idr = false;
@@ -91,6 +85,15 @@ CHIAKI_EXPORT int32_t chiaki_video_receiver_get_frames_lost_total(ChiakiVideoRec
 	return total;
 }
 
+CHIAKI_EXPORT void chiaki_video_receiver_get_recovery_stats(ChiakiVideoReceiver *video_receiver, ChiakiVideoReceiverRecoveryStats *stats)
+{
+	chiaki_mutex_lock(&video_receiver->frames_lost_mutex);
+	stats->frames_recovered_total = video_receiver->frames_recovered_total;
+	stats->idr_requests_total = video_receiver->idr_requests_total;
+	stats->idr_requests_avoided_total = video_receiver->idr_requests_avoided_total;
+	chiaki_mutex_unlock(&video_receiver->frames_lost_mutex);
+}
+
 CHIAKI_EXPORT void chiaki_video_receiver_stream_info(ChiakiVideoReceiver *video_receiver, ChiakiVideoProfile *profiles, size_t profiles_count)
 {
 	if(video_receiver->profiles_count > 0)
@@ -141,6 +144,8 @@ CHIAKI_EXPORT void chiaki_video_receiver_av_packet(ChiakiVideoReceiver *video_re
 			video_receiver->session->video_sample_cb(profile->header, profile->header_sz, 0, false, video_receiver->session->video_sample_cb_user);
 		if(!chiaki_bitstream_header(&video_receiver->bitstream, profile->header, profile->header_sz))
 			CHIAKI_LOGW(video_receiver->log, "Failed to parse video header");
+		chiaki_dpb_reset(&video_receiver->dpb);
+		chiaki_dpb_set_max_ref_frames(&video_receiver->dpb, chiaki_bitstream_max_ref_frames(&video_receiver->bitstream));
 	}
 
 	// next frame?
@@ -205,18 +210,23 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 			{
 				bool waiting_for_idr = chiaki_video_receiver_get_waiting_for_idr(video_receiver);
 				bool idr_request_sent = waiting_for_idr;
+				bool idr_deferred = false;
 				if(!waiting_for_idr)
 				{
-					ChiakiErrorCode err = stream_connection_send_idr_request(&video_receiver->session->stream_connection);
-					idr_request_sent = err == CHIAKI_ERR_SUCCESS;
-					if(err == CHIAKI_ERR_SUCCESS)
+					if(chiaki_dpb_can_recover(&video_receiver->dpb, video_receiver->frame_index_cur))
 					{
-						chiaki_video_receiver_set_waiting_for_idr(video_receiver, true);
-						CHIAKI_LOGI(video_receiver->log, "FEC failed, waiting for IDR frame");
+						// following frames can still be retargeted to a reference we have, only request an IDR if that fails
+						idr_deferred = true;
+						video_receiver->idr_deferred = true;
+						CHIAKI_LOGI(video_receiver->log, "FEC failed, valid references remain, deferring IDR request");
 					}
 					else
 					{
-						CHIAKI_LOGW(video_receiver->log, "FEC failed and IDR request could not be sent: %s", chiaki_error_string(err));
+						idr_request_sent = video_receiver_request_idr(video_receiver);
+						if(idr_request_sent)
+							CHIAKI_LOGI(video_receiver->log, "FEC failed, waiting for IDR frame");
+						else
+							CHIAKI_LOGW(video_receiver->log, "FEC failed and IDR request could not be sent");
 					}
 				}
 				else
@@ -227,6 +237,7 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 				event.type = CHIAKI_EVENT_VIDEO_FEC_FAILURE;
 				event.video_fec_failure.frame_index = video_receiver->frame_index_cur;
 				event.video_fec_failure.idr_request_sent = idr_request_sent;
+				event.video_fec_failure.idr_deferred = idr_deferred;
 				chiaki_session_send_event(video_receiver->session, &event);
 			}
 		int32_t lost = video_receiver->frame_index_cur - next_frame_expected + 1;
@@ -244,7 +255,8 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 	bool recovered = false;
 
 	ChiakiBitstreamSlice slice;
-	if(chiaki_bitstream_slice(&video_receiver->bitstream, frame, frame_size, &slice))
+	bool have_slice = chiaki_bitstream_slice(&video_receiver->bitstream, frame, frame_size, &slice);
+	if(have_slice)
 	{
 		if(chiaki_video_receiver_get_waiting_for_idr(video_receiver))
 		{
@@ -261,21 +273,21 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 			}
 		}
 
-		if(slice.slice_type == CHIAKI_BITSTREAM_SLICE_P)
+		if(slice.slice_type == CHIAKI_BITSTREAM_SLICE_P && slice.reference_frame != 0xff)
 		{
-			ChiakiSeqNum16 ref_frame_index = video_receiver->frame_index_cur - slice.reference_frame - 1;
-			if(slice.reference_frame != 0xff && !have_ref_frame(video_receiver, ref_frame_index))
+			ChiakiSeqNum16 ref_frame_index = chiaki_dpb_reference_frame_index(&video_receiver->dpb, video_receiver->frame_index_cur, &slice, slice.reference_frame);
+			if(!chiaki_dpb_has(&video_receiver->dpb, ref_frame_index))
 			{
-				for(unsigned i=slice.reference_frame+1; i<16; i++)
+				unsigned candidates[CHIAKI_DPB_SIZE];
+				size_t candidates_count = chiaki_dpb_reference_candidates(&video_receiver->dpb, video_receiver->frame_index_cur,
+						&slice, candidates, CHIAKI_DPB_SIZE);
+				for(size_t i=0; i<candidates_count; i++)
 				{
-					ChiakiSeqNum16 ref_frame_index_new = video_receiver->frame_index_cur - i - 1;
-					if(have_ref_frame(video_receiver, ref_frame_index_new))
+					if(chiaki_bitstream_frame_set_reference_frame(&video_receiver->bitstream, frame, frame_size, candidates[i]))
 					{
-						if(chiaki_bitstream_slice_set_reference_frame(&video_receiver->bitstream, frame, frame_size, i))
-						{
-							recovered = true;
-							CHIAKI_LOGW(video_receiver->log, "Missing reference frame %d for decoding frame %d -> changed to %d", (int)ref_frame_index, (int)video_receiver->frame_index_cur, (int)ref_frame_index_new);
-						}
+						recovered = true;
+						CHIAKI_LOGW(video_receiver->log, "Missing reference frame %d for decoding frame %d -> changed to %d", (int)ref_frame_index, (int)video_receiver->frame_index_cur,
+								(int)chiaki_dpb_reference_frame_index(&video_receiver->dpb, video_receiver->frame_index_cur, &slice, candidates[i]));
 						break;
 					}
 				}
@@ -286,7 +298,11 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 					video_receiver->frames_lost++;
 					video_receiver->frames_lost_total++;
 					chiaki_mutex_unlock(&video_receiver->frames_lost_mutex);
-					CHIAKI_LOGW(video_receiver->log, "Missing reference frame %d for decoding frame %d", (int)ref_frame_index, (int)video_receiver->frame_index_cur);
+					CHIAKI_LOGW(video_receiver->log, "Missing reference frame %d for decoding frame %d, no valid reference left", (int)ref_frame_index, (int)video_receiver->frame_index_cur);
+					if(video_receiver->session->connect_info.enable_idr_on_fec_failure
+						&& !chiaki_video_receiver_get_waiting_for_idr(video_receiver)
+						&& video_receiver_request_idr(video_receiver))
+						CHIAKI_LOGI(video_receiver->log, "Waiting for IDR frame");
 				}
 			}
 		}
@@ -305,8 +321,15 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 		}
 		else
 		{
-			add_ref_frame(video_receiver, video_receiver->frame_index_cur);
+			chiaki_dpb_add(&video_receiver->dpb, video_receiver->frame_index_cur, have_slice ? &slice : NULL);
 			CHIAKI_LOGV(video_receiver->log, "Added reference %c frame %d", slice.slice_type == CHIAKI_BITSTREAM_SLICE_I ? 'I' : 'P', (int)video_receiver->frame_index_cur);
+			chiaki_mutex_lock(&video_receiver->frames_lost_mutex);
+			if(recovered)
+				video_receiver->frames_recovered_total++;
+			if(video_receiver->idr_deferred)
+				video_receiver->idr_requests_avoided_total++;
+			chiaki_mutex_unlock(&video_receiver->frames_lost_mutex);
+			video_receiver->idr_deferred = false;
 		}
 	}
 
@@ -59,6 +59,11 @@ typedef uint64_t SetsuButton;
 typedef struct setsu_event_t
 {
 	SetsuEventType type;
+
+	/* Kernel timestamp of the SYN_REPORT that completed the frame this event belongs to,
+	 * in microseconds of CLOCK_MONOTONIC. 0 for device added/removed events. */
+	uint64_t time_us;
+
 	union
 	{
 		struct
@@ -89,10 +94,25 @@ typedef struct setsu_event_t
 } SetsuEvent;
 
 typedef void (*SetsuEventCb)(SetsuEvent *event, void *user);
+typedef void (*SetsuNotifyCb)(void *user);
 
 Setsu *setsu_new();
 void setsu_free(Setsu *setsu);
 void setsu_poll(Setsu *setsu, SetsuEventCb cb, void *user);
+
+/* Start a thread that blocks on udev and all connected devices at once,
+ * reads events as soon as they arrive and queues them for setsu_dispatch().
+ * notify is called from that thread when new events are queued after the last setsu_dispatch(),
+ * it should only wake up whoever calls setsu_dispatch().
+ * While the thread runs, setsu_dispatch(), setsu_connect() and setsu_disconnect()
+ * must all be called from the same thread.
+ * Returns 0 on success. */
+int setsu_thread_start(Setsu *setsu, SetsuNotifyCb notify, void *user);
+void setsu_thread_stop(Setsu *setsu);
+
+/* Deliver all events queued by the thread, or call setsu_poll() if it is not running. */
+void setsu_dispatch(Setsu *setsu, SetsuEventCb cb, void *user);
+
 SetsuDevice *setsu_connect(Setsu *setsu, const char *path, SetsuDeviceType type);
 void setsu_disconnect(Setsu *setsu, SetsuDevice *dev);
 const char *setsu_device_get_path(SetsuDevice *dev);
@@ -12,6 +12,12 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
 
 #include <stdio.h>
 
@@ -25,6 +31,16 @@
 
 #define DEG2RAD (2.0f * M_PI / 360.0f)
 
+// for kernel headers older than 4.16
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+#define QUEUE_SIZE 1024 // events between the input thread and setsu_dispatch(), power of 2
+#define QUEUE_PATH_SIZE 128
+#define EPOLL_EVENTS_MAX 16
+
 typedef struct setsu_avail_device_t
 {
 	struct setsu_avail_device_t *next;
@@ -32,6 +48,7 @@ typedef struct setsu_avail_device_t
 	char *path;
 	bool connect_dirty; // whether the connect has not been sent as an event yet
 	bool disconnect_dirty; // whether the disconnect has not been sent as an event yet
+	bool disconnect_queued; // disconnect event is waiting in the queue for setsu_dispatch()
 } SetsuAvailDevice;
 
 #define SLOTS_COUNT 16
@@ -43,6 +60,8 @@ typedef struct setsu_device_t
 	SetsuDeviceType type;
 	int fd;
 	struct libevdev *evdev;
+	uint64_t frame_time_us; // timestamp of the last SYN_REPORT
+	bool polled; // registered with the input thread's epoll set
 
 	union
 	{
@@ -80,12 +99,37 @@ typedef struct setsu_device_t
 	};
 } SetsuDevice;
 
+typedef struct setsu_queued_event_t
+{
+	SetsuEvent event;
+	char path[QUEUE_PATH_SIZE]; // copy of event.path for device added/removed
+} SetsuQueuedEvent;
+
 struct setsu_t
 {
 	struct udev *udev;
 	struct udev_monitor *udev_mon;
 	SetsuAvailDevice *avail_dev;
 	SetsuDevice *dev;
+
+	// input thread, see setsu_thread_start()
+	// the lists above are only changed with the mutex held while it runs,
+	// it holds the mutex itself while reading devices
+	bool thread_running;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	int epoll_fd;
+	int wake_fd;
+	atomic_bool should_stop;
+	SetsuNotifyCb notify;
+	void *notify_user;
+	atomic_bool notify_armed;
+
+	// single producer (input thread), single consumer (setsu_dispatch())
+	SetsuQueuedEvent *queue;
+	atomic_size_t queue_head;
+	atomic_size_t queue_tail;
+	bool queue_overflow_logged;
 };
 
 bool get_dev_ids(const char *path, uint32_t *vendor_id, uint32_t *model_id);
@@ -93,7 +137,7 @@ static void scan_udev(Setsu *setsu);
 static void update_udev_device(Setsu *setsu, struct udev_device *dev);
 static SetsuDevice *connect(Setsu *setsu, const char *path);
 static void disconnect(Setsu *setsu, SetsuDevice *dev);
-static void poll_device(Setsu *setsu, SetsuDevice *dev, SetsuEventCb cb, void *user);
+static int poll_device(Setsu *setsu, SetsuDevice *dev, SetsuEventCb cb, void *user);
 static void device_event(Setsu *setsu, SetsuDevice *dev, struct input_event *ev, SetsuEventCb cb, void *user);
 static void device_drain(Setsu *setsu, SetsuDevice *dev, SetsuEventCb cb, void *user);
 
@@ -110,6 +154,10 @@ Setsu *setsu_new()
 		return NULL;
 	}
 
+	setsu->epoll_fd = -1;
+	setsu->wake_fd = -1;
+	pthread_mutex_init(&setsu->mutex, NULL);
+
 	setsu->udev_mon = udev_monitor_new_from_netlink(setsu->udev, "udev");
 	if(setsu->udev_mon)
 	{
@@ -128,6 +176,7 @@ void setsu_free(Setsu *setsu)
 {
 	if(!setsu)
 		return;
+	setsu_thread_stop(setsu);
 	while(setsu->dev)
 		setsu_disconnect(setsu, setsu->dev);
 	if(setsu->udev_mon)
@@ -140,6 +189,7 @@ void setsu_free(Setsu *setsu)
 		free(adev->path);
 		free(adev);
 	}
+	pthread_mutex_destroy(&setsu->mutex);
 	free(setsu);
 }
 
@@ -335,6 +385,10 @@ SetsuDevice *setsu_connect(Setsu *setsu, const char *path, SetsuDeviceType type)
 		goto error;
 	}
 
+	// timestamps on the same clock as everything else instead of wall time
+	if(libevdev_set_clock_id(dev->evdev, CLOCK_MONOTONIC) < 0)
+		SETSU_LOG("Failed to set monotonic clock for %s\n", dev->path);
+
 	switch(type)
 	{
 		case SETSU_DEVICE_TYPE_TOUCHPAD:
@@ -360,8 +414,23 @@ SetsuDevice *setsu_connect(Setsu *setsu, const char *path, SetsuDeviceType type)
 			break;
 	}
 
+	pthread_mutex_lock(&setsu->mutex);
+	if(setsu->thread_running)
+	{
+		struct epoll_event ev = { 0 };
+		ev.events = EPOLLIN;
+		ev.data.ptr = dev;
+		if(epoll_ctl(setsu->epoll_fd, EPOLL_CTL_ADD, dev->fd, &ev) < 0)
+		{
+			pthread_mutex_unlock(&setsu->mutex);
+			SETSU_LOG("Failed to add %s to epoll\n", dev->path);
+			goto error;
+		}
+		dev->polled = true;
+	}
 	dev->next = setsu->dev;
 	setsu->dev = dev;
+	pthread_mutex_unlock(&setsu->mutex);
 	return dev;
 error:
 	if(dev->evdev)
@@ -373,8 +442,18 @@ error:
 	return NULL;
 }
 
+static void device_unpoll(Setsu *setsu, SetsuDevice *dev)
+{
+	if(!dev->polled)
+		return;
+	epoll_ctl(setsu->epoll_fd, EPOLL_CTL_DEL, dev->fd, NULL);
+	dev->polled = false;
+}
+
 void setsu_disconnect(Setsu *setsu, SetsuDevice *dev)
 {
+	pthread_mutex_lock(&setsu->mutex);
+	device_unpoll(setsu, dev);
 	if(setsu->dev == dev)
 		setsu->dev = dev->next;
 	else
@@ -388,6 +467,7 @@ void setsu_disconnect(Setsu *setsu, SetsuDevice *dev)
 			}
 		}
 	}
+	pthread_mutex_unlock(&setsu->mutex);
 	libevdev_free(dev->evdev);
 	close(dev->fd);
 	free(dev->path);
@@ -427,6 +507,7 @@ void kill_avail_device(Setsu *setsu, SetsuAvailDevice *adev)
 		dev = dev->next;
 	}
 
+	pthread_mutex_lock(&setsu->mutex);
 	if(setsu->avail_dev == adev)
 		setsu->avail_dev = adev->next;
 	else
@@ -440,6 +521,7 @@ void kill_avail_device(Setsu *setsu, SetsuAvailDevice *adev)
 			}
 		}
 	}
+	pthread_mutex_unlock(&setsu->mutex);
 	free(adev->path);
 	free(adev);
 }
@@ -479,8 +561,282 @@ void setsu_poll(Setsu *setsu, SetsuEventCb cb, void *user)
 		poll_device(setsu, dev, cb, user);
 }
 
-static void poll_device(Setsu *setsu, SetsuDevice *dev, SetsuEventCb cb, void *user)
+static void queue_event_cb(SetsuEvent *event, void *user)
+{
+	Setsu *setsu = user;
+	size_t head = atomic_load_explicit(&setsu->queue_head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&setsu->queue_tail, memory_order_acquire);
+	if(head - tail >= QUEUE_SIZE)
+	{
+		if(!setsu->queue_overflow_logged)
+		{
+			SETSU_LOG("Event queue full, dropping events\n");
+			setsu->queue_overflow_logged = true;
+		}
+		return;
+	}
+	SetsuQueuedEvent *qev = &setsu->queue[head & (QUEUE_SIZE - 1)];
+	qev->event = *event;
+	if(event->type == SETSU_EVENT_DEVICE_ADDED || event->type == SETSU_EVENT_DEVICE_REMOVED)
+	{
+		strncpy(qev->path, event->path, sizeof(qev->path) - 1);
+		qev->path[sizeof(qev->path) - 1] = '\0';
+		qev->event.path = NULL;
+	}
+	atomic_store_explicit(&setsu->queue_head, head + 1, memory_order_release);
+}
+
+/* Queue added/removed events for devices that udev reported.
+ * Removed devices are only killed by setsu_dispatch() after delivering the event,
+ * until then they are just not read anymore. */
+static void queue_avail_devices(Setsu *setsu)
+{
+	for(SetsuAvailDevice *adev = setsu->avail_dev; adev; adev = adev->next)
+	{
+		if(adev->connect_dirty)
+		{
+			SetsuEvent event = { 0 };
+			event.type = SETSU_EVENT_DEVICE_ADDED;
+			event.path = adev->path;
+			event.dev_type = adev->type;
+			queue_event_cb(&event, setsu);
+			adev->connect_dirty = false;
+		}
+		if(adev->disconnect_dirty && !adev->disconnect_queued)
+		{
+			for(SetsuDevice *dev = setsu->dev; dev; dev = dev->next)
+			{
+				if(!strcmp(dev->path, adev->path))
+					device_unpoll(setsu, dev);
+			}
+			SetsuEvent event = { 0 };
+			event.type = SETSU_EVENT_DEVICE_REMOVED;
+			event.path = adev->path;
+			event.dev_type = adev->type;
+			queue_event_cb(&event, setsu);
+			adev->disconnect_queued = true;
+		}
+	}
+}
+
+static bool device_connected(Setsu *setsu, SetsuDevice *dev)
+{
+	for(SetsuDevice *cdev = setsu->dev; cdev; cdev = cdev->next)
+	{
+		if(cdev == dev)
+			return true;
+	}
+	return false;
+}
+
+static void *thread_func(void *user)
+{
+	Setsu *setsu = user;
+	struct epoll_event events[EPOLL_EVENTS_MAX];
+	prctl(PR_SET_NAME, "Setsu Input");
+
+	pthread_mutex_lock(&setsu->mutex);
+	queue_avail_devices(setsu);
+	pthread_mutex_unlock(&setsu->mutex);
+	size_t notified_head = 0;
+
+	while(!atomic_load(&setsu->should_stop))
+	{
+		size_t head = atomic_load_explicit(&setsu->queue_head, memory_order_relaxed);
+		if(head != notified_head && atomic_exchange(&setsu->notify_armed, false))
+		{
+			notified_head = head;
+			setsu->notify(setsu->notify_user);
+		}
+
+		int count = epoll_wait(setsu->epoll_fd, events, EPOLL_EVENTS_MAX, -1);
+		if(count < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			perror("setsu epoll_wait");
+			break;
+		}
+
+		pthread_mutex_lock(&setsu->mutex);
+		for(int i=0; i<count; i++)
+		{
+			void *ptr = events[i].data.ptr;
+			if(ptr == &setsu->wake_fd)
+			{
+				uint64_t v;
+				while(read(setsu->wake_fd, &v, sizeof(v)) > 0);
+				continue;
+			}
+			if(ptr == setsu->udev_mon)
+			{
+				poll_udev_monitor(setsu);
+				queue_avail_devices(setsu);
+				continue;
+			}
+			// the device may have been disconnected since epoll_wait() returned
+			SetsuDevice *dev = ptr;
+			if(!device_connected(setsu, dev) || !dev->polled)
+				continue;
+			if(poll_device(setsu, dev, queue_event_cb, setsu) < 0 || (events[i].events & (EPOLLHUP | EPOLLERR)))
+			{
+				// gone, stop waking up for it until udev tells us
+				device_unpoll(setsu, dev);
+			}
+		}
+		pthread_mutex_unlock(&setsu->mutex);
+	}
+	return NULL;
+}
+
+int setsu_thread_start(Setsu *setsu, SetsuNotifyCb notify, void *user)
+{
+	if(setsu->thread_running)
+		return -1;
+
+	setsu->queue = calloc(QUEUE_SIZE, sizeof(SetsuQueuedEvent));
+	if(!setsu->queue)
+		return -1;
+	atomic_store(&setsu->queue_head, 0);
+	atomic_store(&setsu->queue_tail, 0);
+	setsu->queue_overflow_logged = false;
+	setsu->notify = notify;
+	setsu->notify_user = user;
+	atomic_store(&setsu->notify_armed, true);
+	atomic_store(&setsu->should_stop, false);
+
+	setsu->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(setsu->epoll_fd < 0)
+		goto error;
+	setsu->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(setsu->wake_fd < 0)
+		goto error;
+
+	struct epoll_event ev = { 0 };
+	ev.events = EPOLLIN;
+	ev.data.ptr = &setsu->wake_fd;
+	if(epoll_ctl(setsu->epoll_fd, EPOLL_CTL_ADD, setsu->wake_fd, &ev) < 0)
+		goto error;
+	if(setsu->udev_mon)
+	{
+		ev.data.ptr = setsu->udev_mon;
+		if(epoll_ctl(setsu->epoll_fd, EPOLL_CTL_ADD, udev_monitor_get_fd(setsu->udev_mon), &ev) < 0)
+			goto error;
+	}
+	for(SetsuDevice *dev = setsu->dev; dev; dev = dev->next)
+	{
+		ev.data.ptr = dev;
+		if(epoll_ctl(setsu->epoll_fd, EPOLL_CTL_ADD, dev->fd, &ev) < 0)
+			goto error;
+		dev->polled = true;
+	}
+
+	setsu->thread_running = true;
+	if(pthread_create(&setsu->thread, NULL, thread_func, setsu) != 0)
+	{
+		setsu->thread_running = false;
+		goto error;
+	}
+	return 0;
+error:
+	perror("setsu_thread_start");
+	for(SetsuDevice *dev = setsu->dev; dev; dev = dev->next)
+		dev->polled = false;
+	if(setsu->wake_fd >= 0)
+		close(setsu->wake_fd);
+	if(setsu->epoll_fd >= 0)
+		close(setsu->epoll_fd);
+	setsu->wake_fd = setsu->epoll_fd = -1;
+	free(setsu->queue);
+	setsu->queue = NULL;
+	return -1;
+}
+
+void setsu_thread_stop(Setsu *setsu)
+{
+	if(!setsu->thread_running)
+		return;
+	atomic_store(&setsu->should_stop, true);
+	uint64_t v = 1;
+	if(write(setsu->wake_fd, &v, sizeof(v)) < 0)
+		perror("setsu_thread_stop");
+	pthread_join(setsu->thread, NULL);
+
+	pthread_mutex_lock(&setsu->mutex);
+	setsu->thread_running = false;
+	for(SetsuDevice *dev = setsu->dev; dev; dev = dev->next)
+		dev->polled = false;
+	close(setsu->wake_fd);
+	close(setsu->epoll_fd);
+	setsu->wake_fd = setsu->epoll_fd = -1;
+	// removals that were queued but never delivered go back to the state setsu_poll() expects
+	for(SetsuAvailDevice *adev = setsu->avail_dev; adev; adev = adev->next)
+		adev->disconnect_queued = false;
+	pthread_mutex_unlock(&setsu->mutex);
+
+	free(setsu->queue);
+	setsu->queue = NULL;
+}
+
+static void kill_avail_device_path(Setsu *setsu, const char *path)
+{
+	pthread_mutex_lock(&setsu->mutex);
+	SetsuAvailDevice *adev = setsu->avail_dev;
+	for(; adev; adev = adev->next)
+	{
+		if(adev->disconnect_queued && !strcmp(adev->path, path))
+			break;
+	}
+	pthread_mutex_unlock(&setsu->mutex);
+	// only setsu_dispatch() frees avail devices while the thread runs, so it stays valid
+	if(adev)
+		kill_avail_device(setsu, adev);
+}
+
+void setsu_dispatch(Setsu *setsu, SetsuEventCb cb, void *user)
+{
+	if(!setsu->thread_running)
+	{
+		setsu_poll(setsu, cb, user);
+		return;
+	}
+
+	// anything queued from here on notifies again
+	atomic_store(&setsu->notify_armed, true);
+	size_t tail = atomic_load_explicit(&setsu->queue_tail, memory_order_relaxed);
+	while(true)
+	{
+		size_t head = atomic_load_explicit(&setsu->queue_head, memory_order_acquire);
+		if(tail == head)
+			break;
+		SetsuQueuedEvent qev = setsu->queue[tail & (QUEUE_SIZE - 1)];
+		atomic_store_explicit(&setsu->queue_tail, ++tail, memory_order_release);
+
+		switch(qev.event.type)
+		{
+			case SETSU_EVENT_DEVICE_ADDED:
+				qev.event.path = qev.path;
+				cb(&qev.event, user);
+				break;
+			case SETSU_EVENT_DEVICE_REMOVED:
+				qev.event.path = qev.path;
+				cb(&qev.event, user);
+				// kill the device only after sending the event
+				kill_avail_device_path(setsu, qev.path);
+				break;
+			default:
+				// frames read before the device was disconnected
+				if(!device_connected(setsu, qev.event.dev))
+					break;
+				cb(&qev.event, user);
+				break;
+		}
+	}
+}
+
+static int poll_device(Setsu *setsu, SetsuDevice *dev, SetsuEventCb cb, void *user)
 {
+	// libevdev refills its queue with as many events as the kernel has in one read()
 	bool sync = false;
 	while(true)
 	{
@@ -499,7 +855,7 @@ static void poll_device(Setsu *setsu, SetsuDevice *dev, SetsuEventCb cb, void *u
 			device_event(setsu, dev, &ev, cb, user);
 		else if(r == LIBEVDEV_READ_STATUS_SYNC)
 			sync = true;
-		else if(r == -ENODEV) { break; } // device probably disconnected, udev remove event should follow soon
+		else if(r == -ENODEV) { return -1; } // device probably disconnected, udev remove event should follow soon
 		else
 		{
 			char buf[256];
@@ -508,6 +864,7 @@ static void poll_device(Setsu *setsu, SetsuDevice *dev, SetsuEventCb cb, void *u
 			break;
 		}
 	}
+	return 0;
 }
 
 static uint64_t button_from_evdev(int key)
@@ -531,6 +888,7 @@ static void device_event(Setsu *setsu, SetsuDevice *dev, struct input_event *ev,
 #endif
 	if(ev->type == EV_SYN && ev->code == SYN_REPORT)
 	{
+		dev->frame_time_us = (uint64_t)ev->input_event_sec * 1000000 + (uint64_t)ev->input_event_usec;
 		device_drain(setsu, dev, cb, user);
 		return;
 	}
@@ -634,7 +992,7 @@ static void device_event(Setsu *setsu, SetsuDevice *dev, struct input_event *ev,
 static void device_drain(Setsu *setsu, SetsuDevice *dev, SetsuEventCb cb, void *user)
 {
 	SetsuEvent event;
-#define BEGIN_EVENT(tp) do { memset(&event, 0, sizeof(event)); event.dev = dev; event.type = tp; } while(0)
+#define BEGIN_EVENT(tp) do { memset(&event, 0, sizeof(event)); event.dev = dev; event.type = tp; event.time_us = dev->frame_time_us; } while(0)
 #define SEND_EVENT() do { cb(&event, user); } while (0)
 	switch(dev->type)
 	{
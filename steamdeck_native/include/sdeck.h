@@ -12,9 +12,29 @@ extern "C" {
 
 typedef struct sdeck_t SDeck;
 
-double * hann_init(int N);
-void hann_apply(double *data, double *han, int N);
-int compute_freq(double *data, int N, const double sampling_rate, double * frequency, double max_freq);
+// log spaced bins from 50 Hz to 400 Hz, 4 per octave
+#define SDECK_FREQ_TRACKER_BINS 13
+
+// Streaming estimate of the dominant frequency and amplitude of haptics pcm, kept across buffers.
+// Each bin is a damped Goertzel resonator, the loudest one is refined from the period of its output.
+typedef struct sdeck_freq_tracker_t
+{
+    double sampling_rate;
+    double freq[SDECK_FREQ_TRACKER_BINS]; // center frequency of each bin
+    double coeff[SDECK_FREQ_TRACKER_BINS]; // 2 * r * cos(w)
+    double decay2[SDECK_FREQ_TRACKER_BINS]; // r^2, also the weight of the history in the averages
+    double gain[SDECK_FREQ_TRACKER_BINS]; // resonator gain at its center frequency
+    double s1[SDECK_FREQ_TRACKER_BINS], s2[SDECK_FREQ_TRACKER_BINS];
+    double power[SDECK_FREQ_TRACKER_BINS]; // average of s^2
+    double corr[SDECK_FREQ_TRACKER_BINS]; // average of s1 * (s + s2)
+    double energy[SDECK_FREQ_TRACKER_BINS]; // average of s1^2
+} SDeckFreqTracker;
+
+void sdeck_freq_tracker_init(SDeckFreqTracker *tracker, double sampling_rate);
+void sdeck_freq_tracker_reset(SDeckFreqTracker *tracker);
+void sdeck_freq_tracker_update(SDeckFreqTracker *tracker, const int16_t *buf, int num_elements);
+// returns 0 and sets frequency in Hz and the amplitude of the dominant tone or -1 if there is no signal
+int sdeck_freq_tracker_get(SDeckFreqTracker *tracker, double *frequency, double *amplitude);
 
 enum SDHapticPos
 {
@@ -110,7 +130,7 @@ void sdeck_read(SDeck *sdeck, SDeckEventCb cb, void *user);
 int sdeck_haptic(SDeck *sdeck, uint8_t position, double frequency, uint32_t interval, const uint16_t repeat);
 int sdeck_haptic_ratio(SDeck *sdeck, uint8_t position, double frequency, uint32_t interval, double ratio, const uint16_t repeat);
 int send_haptic(SDeck* sdeck, uint8_t position, uint16_t period_high, uint16_t period_low, uint16_t repeat_count);
-int sdeck_haptic_init(SDeck * sdeck, int samples);
+int sdeck_haptic_init(SDeck * sdeck, int sampling_rate);
 void sdeck_haptic_fini(SDeck * sdeck);
 int play_pcm_haptic(SDeck *sdeck, uint8_t position, int16_t *buf, const int32_t num_elements, const int sampling_rate);
 
@@ -6,7 +6,6 @@
 #include <hidapi.h>
 #include <math.h>
 #include <unistd.h>
-#include <fftw3.h>
 #define ENABLE_LOG
 
 #ifdef ENABLE_LOG
@@ -32,16 +31,11 @@
 #define STEAM_DECK_HAPTIC_COMMAND 0x8f
 #define STEAM_DECK_HAPTIC_LENGTH 0x07
 #define STEAM_DECK_HAPTIC_INTENSITY 0.38f
-#define STEAM_DECK_CUTOFF_FREQ 250.0f
-#define STEAM_DECK_HAPTIC_SAMPLING_FREQ 3000.0f
-
-typedef struct freq_t
-{
-	int N;
-	fftw_plan fft;
-	double *hann, *butterworth, *pcm_data;
-	fftw_complex *freq_data;
-} FreqFinder;
+// don't play samples whose dominant tone is below ~0.1% of full scale
+#define STEAM_DECK_HAPTIC_AMPLITUDE_MIN 40.0
+// band of the trackpad actuators covered by the frequency tracker
+#define STEAM_DECK_HAPTIC_FREQ_MIN 50.0
+#define STEAM_DECK_HAPTIC_BINS_PER_OCTAVE 4
 
 struct sdeck_t
 {
@@ -50,18 +44,13 @@ struct sdeck_t
 	SDeckMotion prev_motion;
 	int gyro;
 	bool motion_dirty;
-	FreqFinder *freqfinder;
+	bool haptic_ready;
+	SDeckFreqTracker freqtracker[2]; // one per trackpad
 };
 
 hid_device *is_steam_deck();
 void movemult_accel(float *accel, float mult);
-void calc_powers(fftw_complex *data, int N);
-void max_power_freq(const int N, const double sampling_rate, double *frequency, double *freq_power, fftw_complex *power);
 void generate_event(SDeck *sdeck, SDeckEventType type, SDeckEventCb cb, void *user);
-double * butterworth_init();
-void lpf_apply(double * pcm_data, double * butterworth, int N);
-FreqFinder *freqfinder_new(int samples);
-void haptic_free(FreqFinder *freqfinder);
 
 SDeck *sdeck_new()
 {
@@ -86,15 +75,17 @@ SDeck *sdeck_new()
 	memset(&sdeck->prev_motion, 0, sizeof(SDeckMotion));
 	sdeck->motion_dirty = false;
 	sdeck->gyro = STEAM_DECK_MOTION_COOLDOWN;
-	sdeck->freqfinder = NULL;
+	sdeck->haptic_ready = false;
 	return sdeck;
 }
 
-int sdeck_haptic_init(SDeck *sdeck, int samples)
+int sdeck_haptic_init(SDeck *sdeck, int sampling_rate)
 {
-	sdeck->freqfinder = freqfinder_new(samples);
-	if (!sdeck->freqfinder)
+	if (sampling_rate <= 0)
 		return -1;
+	sdeck_freq_tracker_init(&sdeck->freqtracker[TRACKPAD_RIGHT], sampling_rate);
+	sdeck_freq_tracker_init(&sdeck->freqtracker[TRACKPAD_LEFT], sampling_rate);
+	sdeck->haptic_ready = true;
 	return 0;
 }
 
@@ -102,35 +93,7 @@ void sdeck_haptic_fini(SDeck *sdeck)
 {
 	if (!sdeck)
 		return;
-	if (sdeck->freqfinder) {
-		haptic_free(sdeck->freqfinder);
-		sdeck->freqfinder = NULL;
-	}
-}
-
-FreqFinder *freqfinder_new(int samples)
-{
-	FreqFinder *freqfinder = fftw_malloc(sizeof(FreqFinder));
-	freqfinder->N = samples;
-	freqfinder->hann = hann_init(samples);
-	freqfinder->butterworth = butterworth_init();
-	freqfinder->pcm_data = fftw_malloc(2 * samples * sizeof(double));
-	freqfinder->freq_data = fftw_malloc((samples + 1) * sizeof(fftw_complex));
-	freqfinder->fft = fftw_plan_dft_r2c_1d(2 * samples, freqfinder->pcm_data, freqfinder->freq_data, FFTW_MEASURE);
-	return freqfinder;
-}
-
-void haptic_free(FreqFinder *freqfinder)
-{
-	fftw_destroy_plan(freqfinder->fft);
-
-	fftw_free(freqfinder->hann);
-	fftw_free(freqfinder->butterworth);
-	fftw_free(freqfinder->pcm_data);
-	fftw_free(freqfinder->freq_data);
-	fftw_free(freqfinder);
-
-	fftw_cleanup();
+	sdeck->haptic_ready = false;
 }
 
 void sdeck_free(SDeck *sdeck)
@@ -228,120 +191,92 @@ void print_steam_deck_controls(SDControls *sdc)
 	printf("\n");
 }
 
-double *hann_init(int N) // calc hann coefficients (once per array size and can then be reused)
+void sdeck_freq_tracker_init(SDeckFreqTracker *tracker, double sampling_rate)
 {
-	double *han = fftw_malloc(N * sizeof(double));
-	for (int i = 0; i < N; i++)
-		han[i] = 0.5 * (1 - cos(2 * M_PI * i / (N - 1)));
-	return han;
-}
-double *butterworth_init()
-{
-	double *butterworth = fftw_malloc(5 * sizeof(double));
-	const double ff = STEAM_DECK_CUTOFF_FREQ / STEAM_DECK_HAPTIC_SAMPLING_FREQ;
-	const double ita = 1.0/tan(M_PI * ff);
-	const double q = sqrt(2.0);
-	butterworth[0] = 1.0 / (1.0 + q*ita + ita*ita);
-	butterworth[1] = 2 * butterworth[0];
-	butterworth[2] = butterworth[0];
-	butterworth[3] = 2.0 * (ita * ita - 1.0) * butterworth[0];
-	butterworth[4] = -(1.0 - q * ita + ita * ita) * butterworth[0];
-	return butterworth;
-}
-
-void lpf_apply(double *buf, double * butterworth, int buf_count)
-{
-	double holder_buffer[buf_count];
-	holder_buffer[0] = buf[0];
-	holder_buffer[1] = buf[1];
-	for (int i = 2; i < buf_count; i++)
-		holder_buffer[i] = butterworth[0] * buf[i] + butterworth[1] * buf[i - 1] + butterworth[2] * buf[i - 2] + butterworth[3] * holder_buffer[i - 1] + butterworth[4] * holder_buffer[i - 2];
-	for (int i = 2; i < buf_count; i++)
+	const double spacing = pow(2.0, 1.0 / STEAM_DECK_HAPTIC_BINS_PER_OCTAVE);
+	tracker->sampling_rate = sampling_rate;
+	for (int k = 0; k < SDECK_FREQ_TRACKER_BINS; k++)
 	{
-		buf[i] = holder_buffer[i];
+		const double freq = STEAM_DECK_HAPTIC_FREQ_MIN * pow(spacing, k);
+		const double w = 2.0 * M_PI * freq / sampling_rate;
+		// bandwidth of each resonator is about the distance to its neighbors,
+		// so low bins average over more samples than high ones
+		const double r = 1.0 - M_PI * freq * (spacing - 1.0) / sampling_rate;
+		tracker->freq[k] = freq;
+		tracker->coeff[k] = 2.0 * r * cos(w);
+		tracker->decay2[k] = r * r;
+		// |1 / (1 - coeff * e^-jw + r^2 * e^-2jw)|
+		const double re = 1.0 - tracker->coeff[k] * cos(w) + tracker->decay2[k] * cos(2.0 * w);
+		const double im = tracker->coeff[k] * sin(w) - tracker->decay2[k] * sin(2.0 * w);
+		tracker->gain[k] = 1.0 / sqrt(re * re + im * im);
 	}
+	sdeck_freq_tracker_reset(tracker);
 }
 
-void hann_apply(double *data, double *han, int N) // apply hann window to data
+void sdeck_freq_tracker_reset(SDeckFreqTracker *tracker)
 {
-	for (int i = 0; i < N; i++)
-		data[i] = data[i] * han[i];
+	memset(tracker->s1, 0, sizeof(tracker->s1));
+	memset(tracker->s2, 0, sizeof(tracker->s2));
+	memset(tracker->power, 0, sizeof(tracker->power));
+	memset(tracker->corr, 0, sizeof(tracker->corr));
+	memset(tracker->energy, 0, sizeof(tracker->energy));
 }
 
-void zero_pad(double *data, int N)
+void sdeck_freq_tracker_update(SDeckFreqTracker *tracker, const int16_t *buf, int num_elements)
 {
-	for (int i = N; i < 2 * N; i++)
-		data[i] = 0;
-}
-
-void calc_powers(fftw_complex *data, int N)
-{
-	// multiply each element by complex conjugate => real^2 + imaginary^2
-	for (int i = 0; i < N; i++) // round N/2 up
+	for (int k = 0; k < SDECK_FREQ_TRACKER_BINS; k++)
 	{
-		data[i][0] = data[i][0] * data[i][0] + data[i][1] * data[i][1]; // real component
-		data[i][1] = 0;													// imaginary component
-	}
-}
-
-int compute_freq(double *data, int N, const double sampling_rate, double *frequency, double max_freq)
-{
-	// lowest freq we can detect is sampling_rate / 2 => period of 2 / sampling_rate
-	int max_pos = 2;
-	for (int i = 3; i < N/2 + 1; i++)
-	{
-		if (data[i] > data[max_pos])
-			max_pos = i;
+		const double coeff = tracker->coeff[k];
+		const double decay2 = tracker->decay2[k];
+		double s1 = tracker->s1[k], s2 = tracker->s2[k];
+		double power = tracker->power[k], corr = tracker->corr[k], energy = tracker->energy[k];
+		for (int i = 0; i < num_elements; i++)
+		{
+			const double s = buf[i] + coeff * s1 - decay2 * s2;
+			power = decay2 * power + (1.0 - decay2) * s * s;
+			// a sinusoid of frequency w satisfies s + s2 = 2 * cos(w) * s1
+			corr = decay2 * corr + s1 * (s + s2);
+			energy = decay2 * energy + s1 * s1;
+			s2 = s1;
+			s1 = s;
+		}
+		// let silence settle on zero instead of decaying into denormals
+		if (power < 1e-6)
+			s1 = s2 = power = corr = energy = 0;
+		tracker->s1[k] = s1;
+		tracker->s2[k] = s2;
+		tracker->power[k] = power;
+		tracker->corr[k] = corr;
+		tracker->energy[k] = energy;
 	}
-	// check for next harmonic masquerading as fundamental
-	if ((max_pos < N/4 + 1) && (data[max_pos * 2] > 0.8 * data[max_pos]))
-		max_pos *= 2;
-	double period = (double)max_pos / (double)sampling_rate;
-	double temp_freq = (1 / period);
-	if (temp_freq > max_freq)
-		return -1;
-	*frequency = temp_freq;
-	return 0;
 }
 
-void max_power_freq(const int N, const double sampling_rate, double *frequency, double *freq_power, fftw_complex *power)
+int sdeck_freq_tracker_get(SDeckFreqTracker *tracker, double *frequency, double *amplitude)
 {
-	int max_pos = 0;
-	for (int i = 1; i < N; i++)
+	int max_bin = -1;
+	double max_amplitude = 0;
+	for (int k = 0; k < SDECK_FREQ_TRACKER_BINS; k++)
 	{
-		if (power[i][0] > power[max_pos][0])
-			max_pos = i;
+		// peak amplitude of a sine at the center frequency producing this power
+		const double bin_amplitude = sqrt(2.0 * tracker->power[k]) / tracker->gain[k];
+		if (bin_amplitude > max_amplitude)
+		{
+			max_amplitude = bin_amplitude;
+			max_bin = k;
+		}
 	}
-	if (max_pos == 0)
-		return;
-	const int originalN = 2 * N - 2;
-	*frequency = ((max_pos * sampling_rate) / originalN);
-	*freq_power = ((2 * sqrt(power[max_pos][0])) / originalN);
-}
-
-void calc_freqs(FreqFinder *freqfinder, const int sampling_rate, double *freq, double *freq_power)
-{
-	int N = freqfinder->N;
-	int complexN = freqfinder->N + 1;
-	lpf_apply(freqfinder->pcm_data, freqfinder->butterworth, N);
-	hann_apply(freqfinder->pcm_data, freqfinder->hann, N);
-	zero_pad(freqfinder->pcm_data, N);
-	fftw_execute(freqfinder->fft);
-	calc_powers(freqfinder->freq_data, complexN);
-	max_power_freq(complexN, sampling_rate, freq, freq_power, freqfinder->freq_data);
-}
-
-int get_data(FreqFinder *freqfinder, int16_t *buf, const int num_elements)
-{
-	if (freqfinder->N != num_elements)
-	{
-		SDECK_LOG("\nBuffer size mismatch...initialized buffer is not right size!\n");
+	if (max_bin < 0 || tracker->energy[max_bin] <= 0)
 		return -1;
-	}
-	for (int i = 0; i < num_elements; i++)
-	{
-		freqfinder->pcm_data[i] = buf[i];
-	}
+	const double spacing = pow(2.0, 1.0 / STEAM_DECK_HAPTIC_BINS_PER_OCTAVE);
+	const double freq_min = tracker->freq[max_bin] / spacing;
+	const double freq_max = tracker->freq[max_bin] * spacing;
+	double cos_w = tracker->corr[max_bin] / (2.0 * tracker->energy[max_bin]);
+	cos_w = (cos_w > 1.0) ? 1.0 : ((cos_w < -1.0) ? -1.0 : cos_w);
+	double freq = acos(cos_w) * tracker->sampling_rate / (2.0 * M_PI);
+	// the resonator still ringing at its own frequency can pull the estimate off, stay next to the bin
+	freq = (freq < freq_min) ? freq_min : ((freq > freq_max) ? freq_max : freq);
+	*frequency = freq;
+	*amplitude = max_amplitude;
 	return 0;
 }
 
@@ -385,19 +320,20 @@ void find_repeat(double * data, const int num_samples, const double frequency, c
 int play_pcm_haptic(SDeck *sdeck, uint8_t position, int16_t *buf, const int num_elements, const int sampling_rate)
 {
 	uint32_t interval = 0;
-	const int avg_min = 50; // don't play samples that are less than 1% volume
 	int repeat = 0;
 	int32_t playtime = 0;
-	double freq = 0, avg = 0, ratio = 0, freq_power = 0;
-	if (get_data(sdeck->freqfinder, buf, num_elements))
+	double freq = 0, amplitude = 0;
+	if (!sdeck->haptic_ready || position > TRACKPAD_LEFT)
 		return -1;
+	SDeckFreqTracker *tracker = &sdeck->freqtracker[position];
+	if (tracker->sampling_rate != sampling_rate)
+		sdeck_freq_tracker_init(tracker, sampling_rate);
 	// interval in microseconds
 	interval = 1000000 * ((double)num_elements / (double)sampling_rate);
-	calc_freqs(sdeck->freqfinder, sampling_rate, &freq, &freq_power);
-	if (!freq)
+	sdeck_freq_tracker_update(tracker, buf, num_elements);
+	if (sdeck_freq_tracker_get(tracker, &freq, &amplitude) < 0)
 		return 0;
-	avg = 5 * freq_power;
-	if (avg < avg_min)
+	if (amplitude < STEAM_DECK_HAPTIC_AMPLITUDE_MIN)
 		return 0;
 	repeat = (STEAM_DECK_HAPTIC_INTENSITY * num_elements * freq) / (double)sampling_rate;
 	repeat = (repeat > 1) ? repeat : 1;
@@ -39,7 +39,7 @@ class HostInterface : public brls::List
 		void Register();
 		void Wakeup(brls::View *view);
 		void Connect(brls::View *view);
-		void ConnectSession();
+		void ConnectSession(bool wakeup = false);
 		void Disconnect();
 		void Stream();
 		void EnterPin(bool isError);
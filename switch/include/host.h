@@ -101,7 +101,7 @@ class Host
 		~Host();
 		int Register(int pin);
 		int Wakeup();
-		int InitSession(IO *);
+		int InitSession(IO *, bool wakeup = false);
 		int FiniSession();
 		void StopSession();
 		void StartSession();
@@ -45,6 +45,7 @@ extern "C"
 }
 
 #include <chiaki/controller.h>
+#include <chiaki/framemailbox.h>
 #include <chiaki/log.h>
 
 #include "exception.h"
@@ -62,7 +63,7 @@ class IO
 		int video_width;
 		int video_height;
 		bool quit = false;
-		static const int MAX_FRAME_COUNT = 3;
+		static const int MAX_FRAME_COUNT = CHIAKI_FRAME_MAILBOX_SLOTS;
 		static const int MAX_NV12_PLANE_COUNT = 2;
 		GLint m_texture_uniform[MAX_NV12_PLANE_COUNT];
 		// opengl reader writer
@@ -73,9 +74,11 @@ class IO
 		int screen_height = 720;
 		const AVCodec *codec;
 		AVCodecContext *codec_context;
-		AVFrame **frames;
+		AVFrame **frames = nullptr;
 		uintptr_t origin_ptr[MAX_FRAME_COUNT][MAX_NV12_PLANE_COUNT];
 		AVFrame *tmp_frame;
+		// hands frames from the decoder to the render loop, indices into frames
+		ChiakiFrameMailbox frame_mailbox;
 		SDL_AudioDeviceID sdl_audio_device_id = 0;
 		SDL_Event sdl_event;
 		SDL_Joystick *sdl_joystick_ptr[SDL_JOYSTICK_COUNT] = {0};
@@ -105,6 +108,7 @@ class IO
 		GLuint CreateAndCompileShader(GLenum type, const char *source);
 		void SetOpenGlYUVPixels(AVFrame *frame);
 		void SetOpenGlNV12Pixels(AVFrame *frame);
+		int PullFrames();
 		bool ReadGameKeys(SDL_Event *event, ChiakiControllerState *state);
 		bool ReadGameTouchScreen(ChiakiControllerState *state, std::map<uint32_t, int8_t> *finger_id_touch_id);
 		bool ReadGameSixAxis(ChiakiControllerState *state);
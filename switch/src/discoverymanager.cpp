@@ -59,6 +59,7 @@ void DiscoveryManager::SetService(bool enable)
 		options.hosts_max = HOSTS_MAX;
 		options.host_drop_pings = DROP_PINGS;
 		options.cb = Discovery;
+		options.host_cb = nullptr;
 		options.cb_user = this;
 
 		sockaddr_in addr_broadcast = {};
@@ -77,6 +78,8 @@ void DiscoveryManager::SetService(bool enable)
 		options.send_addr = &addr;
 		options.send_addr_size = sizeof(in_addr);
 		options.send_host = nullptr;
+		options.ps4_port = 0;
+		options.ps5_port = 0;
 
 		ChiakiErrorCode err = chiaki_discovery_service_init(&this->service, &options, log);
 		if(err != CHIAKI_ERR_SUCCESS)
@@ -137,7 +137,7 @@ void HostInterface::Register(Host *host, std::function<void()> success_cb)
 void HostInterface::Register()
 {
 	// use Connect just after the registration to save user inputs
-	HostInterface::Register(this->host, std::bind(&HostInterface::ConnectSession, this));
+	HostInterface::Register(this->host, [this]() { this->ConnectSession(); });
 }
 
 void HostInterface::Wakeup(brls::View *view)
@@ -172,34 +172,34 @@ void HostInterface::Connect(brls::View *view)
 	}
 
 	// ignore state for remote hosts
-	if(this->host->IsDiscovered() && !this->host->IsReady())
-	{
-		// host in standby mode
-		DIALOG(ptoyp, "Your PlayStation is off, please turn it on");
-		return;
-	}
-
+	bool standby = this->host->IsDiscovered() && !this->host->IsReady();
 	if(!this->host->HasRPkey())
 	{
+		if(standby)
+		{
+			// registration needs the host to be up
+			DIALOG(ptoyp, "Your PlayStation is off, please turn it on");
+			return;
+		}
 		this->Register();
 	}
 	else
 	{
 		// the host is already registered
-		// start session directly
-		ConnectSession();
+		// start session directly, waking it up first if it is in standby mode
+		ConnectSession(standby);
 	}
 }
 
-void HostInterface::ConnectSession()
+void HostInterface::ConnectSession(bool wakeup)
 {
 	// ignore all user inputs (avoid double connect)
 	// user inputs are restored with the CloseStream
 	brls::Application::blockInputs();
 
 	// connect host sesssion
-	this->host->InitSession(this->io);
-	CHIAKI_LOGI(this->log, "Session initiated");
+	this->host->InitSession(this->io, wakeup);
+	CHIAKI_LOGI(this->log, "Session initiated%s", wakeup ? ", waking up the host" : "");
 	this->host->StartSession();
 }
 
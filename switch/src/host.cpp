@@ -140,14 +140,14 @@ int Host::Register(int pin)
 	return HOST_REGISTER_OK;
 }
 
-int Host::InitSession(IO *user)
+int Host::InitSession(IO *user, bool wakeup)
 {
 	chiaki_connect_video_profile_preset(&(this->video_profile),
 		this->video_resolution, this->video_fps);
 	// Build chiaki ps4 stream session
 	chiaki_opus_decoder_init(&(this->opus_decoder), this->log);
 	ChiakiAudioSink audio_sink;
-	ChiakiAudioSink haptics_sink;
+	ChiakiAudioSink haptics_sink = {};
 	haptics_sink.user = user;
 	haptics_sink.frame_cb = HapticsFrameCb;
 	ChiakiConnectInfo chiaki_connect_info = {};
@@ -168,6 +168,8 @@ int Host::InitSession(IO *user)
 	}
 
 	chiaki_connect_info.ps5 = this->IsPS5();
+	// the session wakes the console and connects as soon as it is up
+	chiaki_connect_info.wakeup = wakeup;
 
 	if(!user->InitAVCodec(this->IsPS5()))
 	{
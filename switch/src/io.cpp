@@ -3,6 +3,8 @@
 #include "io.h"
 #include "settings.h"
 
+#include <chiaki/haptics.h>
+
 #include <chrono>
 #include <thread>
 
@@ -79,9 +81,6 @@ void main()
 }
 )glsl";
 
-int current_frame = 0;
-int next_frame = 0;
-
 bool haptic_lock = false;
 int haptic_val = 0;
 std::chrono::system_clock::time_point haptic_lock_time;
@@ -220,12 +219,11 @@ send_packet:
 	{
 		if(r == AVERROR(EAGAIN))
 		{
-			CHIAKI_LOGE(this->log, "AVCodec internal buffer is full removing frames before pushing");
-			r = avcodec_receive_frame(this->codec_context, this->tmp_frame);
-			// send decoded frame for sdl texture update
-			if(r != 0)
+			// hand the pending frames to the renderer rather than discarding them,
+			// it only shows the latest one anyway
+			CHIAKI_LOGV(this->log, "AVCodec internal buffer is full, pulling frames before pushing");
+			if(PullFrames() <= 0)
 			{
-				CHIAKI_LOGE(this->log, "Failed to pull frame");
 				av_packet_free(&packet);
 				return false;
 			}
@@ -242,29 +240,45 @@ send_packet:
 	}
 
 	// Pull
-	if (enableHWAccl) {
-		r = avcodec_receive_frame(this->codec_context, this->tmp_frame);
-		if (r == 0) {
-			if (av_hwframe_transfer_data(this->frames[next_frame], this->tmp_frame, 0) < 0) {
-				CHIAKI_LOGI(this->log, "transfer error");
-			}
-			if (av_frame_copy_props(this->frames[next_frame], this->tmp_frame) < 0) {
-				CHIAKI_LOGI(this->log, "copy error");
+	PullFrames();
+
+	av_packet_free(&packet);
+	return true;
+}
+
+int IO::PullFrames()
+{
+	// take everything the decoder has ready, a frame published before the
+	// render loop picked up the previous one is counted as dropped by the mailbox
+	int pulled = 0;
+	while(true)
+	{
+		AVFrame *frame = this->frames[chiaki_frame_mailbox_write_slot(&this->frame_mailbox)];
+		int r;
+		if (enableHWAccl) {
+			r = avcodec_receive_frame(this->codec_context, this->tmp_frame);
+			if (r == 0) {
+				if (av_hwframe_transfer_data(frame, this->tmp_frame, 0) < 0) {
+					CHIAKI_LOGI(this->log, "transfer error");
+				}
+				if (av_frame_copy_props(frame, this->tmp_frame) < 0) {
+					CHIAKI_LOGI(this->log, "copy error");
+				}
 			}
+		} else {
+			r = avcodec_receive_frame(this->codec_context, frame);
 		}
-	} else {
-		r = avcodec_receive_frame(this->codec_context, this->frames[next_frame]);
-	}
 
-	if(r != 0) {
-		CHIAKI_LOGE(this->log, "Failed to pull frame");
-	} else {
-		current_frame = next_frame;
-		next_frame = (next_frame + 1) % MAX_FRAME_COUNT;
+		if(r == AVERROR(EAGAIN) || r == AVERROR_EOF)
+			return pulled;
+		if(r != 0)
+		{
+			CHIAKI_LOGE(this->log, "Failed to pull frame");
+			return -1;
+		}
+		chiaki_frame_mailbox_publish(&this->frame_mailbox);
+		pulled++;
 	}
-
-	av_packet_free(&packet);
-	return true;
 }
 
 void IO::InitAudioCB(unsigned int channels, unsigned int rate)
@@ -352,6 +366,7 @@ bool IO::InitVideo(int video_width, int video_height, int screen_width, int scre
 
 	this->screen_width = screen_width;
 	this->screen_height = screen_height;
+	chiaki_frame_mailbox_init(&this->frame_mailbox);
 	this->frames = (AVFrame**)malloc(MAX_FRAME_COUNT * sizeof(AVFrame*));
 
 	for (int i = 0; i < MAX_FRAME_COUNT; i++) {
@@ -397,6 +412,10 @@ bool IO::FreeVideo()
 	}
 
 	if (this->frames != NULL) {
+		uint64_t published, dropped, consumed;
+		chiaki_frame_mailbox_get_stats(&this->frame_mailbox, &published, &dropped, &consumed);
+		CHIAKI_LOGI(this->log, "Video frames decoded: %llu, dropped before display: %llu, displayed: %llu",
+			(unsigned long long)published, (unsigned long long)dropped, (unsigned long long)consumed);
 		for (int i = 0; i < MAX_FRAME_COUNT; i++) {
 			if(this->frames[i]) {
 				for (int j = 0; j < MAX_NV12_PLANE_COUNT; j++) {
@@ -407,6 +426,7 @@ bool IO::FreeVideo()
 			}
 		}
 		free(this->frames); // allocted via malloc
+		this->frames = NULL;
 	}
 
 	if(this->tmp_frame)
@@ -525,22 +545,11 @@ void IO::SetRumble(uint8_t left, uint8_t right)
 }
 
 void IO::HapticCB(uint8_t *buf, size_t buf_size) {
-		int16_t amplitudel = 0, amplituder = 0;
-		int32_t suml = 0, sumr = 0;
-		const size_t sample_size = 2 * sizeof(int16_t); // stereo samples
-
-		size_t buf_count = buf_size / sample_size;
-		for (size_t i = 0; i < buf_count; i++){
-			size_t cur = i * sample_size;
-
-			memcpy(&amplitudel, buf + cur, sizeof(int16_t));
-			memcpy(&amplituder, buf + cur + sizeof(int16_t), sizeof(int16_t));
-			suml += amplitudel;
-			sumr += amplituder;
-		}
-		uint16_t left = 0, right = 0;
-		left = suml / buf_count;
-		right = sumr / buf_count;
+		uint32_t envelope_left = 0, envelope_right = 0;
+		chiaki_haptics_envelope((const int16_t *)buf, buf_size / (2 * sizeof(int16_t)), &envelope_left, &envelope_right);
+		// scale the mean absolute amplitude down to the 8 bit rumble range
+		uint8_t left = envelope_left / 128 > UINT8_MAX ? UINT8_MAX : envelope_left / 128;
+		uint8_t right = envelope_right / 128 > UINT8_MAX ? UINT8_MAX : envelope_right / 128;
 		SetHapticRumble(left, right);
 		if ((left != 0 || right != 0) && !haptic_lock) {
 			haptic_lock = true;
@@ -1143,11 +1152,16 @@ inline void IO::OpenGlDraw()
 {
 	glClear(GL_COLOR_BUFFER_BIT);
 
-	if (enableHWAccl) {
-		SetOpenGlNV12Pixels(this->frames[current_frame]);
-	} else {
-		// send to OpenGl
-		SetOpenGlYUVPixels(this->frames[current_frame]);
+	// the slot stays ours until the next acquire, without a new frame the textures still hold the last one
+	bool fresh;
+	int slot = chiaki_frame_mailbox_acquire(&this->frame_mailbox, &fresh);
+	if (slot >= 0 && fresh) {
+		if (enableHWAccl) {
+			SetOpenGlNV12Pixels(this->frames[slot]);
+		} else {
+			// send to OpenGl
+			SetOpenGlYUVPixels(this->frames[slot]);
+		}
 	}
 
 	//avcodec_flush_buffers(this->codec_context);
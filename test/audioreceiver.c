@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/audioreceiver.h>
+#include <chiaki/session.h>
+
+#include <string.h>
+
+#include "test_log.h"
+
+#define FRAME_DURATION_US 10000
+
+static MunitResult test_jitter_estimator_clean(const MunitParameter params[], void *user)
+{
+	ChiakiAudioJitterEstimator estimator;
+	chiaki_audio_jitter_estimator_init(&estimator, FRAME_DURATION_US);
+	munit_assert_uint(estimator.target, ==, CHIAKI_AUDIO_JITTER_TARGET_INITIAL);
+
+	// perfectly paced frames for 10s, the target shrinks down to the minimum
+	uint64_t t = 1000000;
+	for(ChiakiSeqNum16 i=0; i<1000; i++, t += FRAME_DURATION_US)
+		chiaki_audio_jitter_estimator_push(&estimator, i, t);
+
+	munit_assert_double(estimator.jitter_us, <, 1.0);
+	munit_assert_uint(estimator.target, ==, CHIAKI_AUDIO_JITTER_TARGET_MIN);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_jitter_estimator_jittery(const MunitParameter params[], void *user)
+{
+	ChiakiAudioJitterEstimator estimator;
+	chiaki_audio_jitter_estimator_init(&estimator, FRAME_DURATION_US);
+
+	// Wi-Fi like bursts: frames arrive in clumps of 4, delayed by up to 30ms
+	uint64_t t = 1000000;
+	for(ChiakiSeqNum16 i=0; i<400; i++)
+	{
+		uint64_t send_t = t + (uint64_t)i * FRAME_DURATION_US;
+		uint64_t arrival = send_t + (3 - (i % 4)) * FRAME_DURATION_US;
+		chiaki_audio_jitter_estimator_push(&estimator, i, arrival);
+	}
+	unsigned jittery_target = estimator.target;
+	munit_assert_double(estimator.jitter_us, >, 5000.0);
+	munit_assert_uint(jittery_target, >, CHIAKI_AUDIO_JITTER_TARGET_INITIAL);
+	munit_assert_uint(jittery_target, <=, CHIAKI_AUDIO_JITTER_TARGET_MAX);
+
+	// back to clean, the target must not drop right away, but eventually
+	t += 400 * FRAME_DURATION_US + 3 * FRAME_DURATION_US;
+	for(ChiakiSeqNum16 i=400; i<450; i++, t += FRAME_DURATION_US)
+		chiaki_audio_jitter_estimator_push(&estimator, i, t);
+	munit_assert_uint(estimator.target, ==, jittery_target);
+	for(ChiakiSeqNum16 i=450; i<1500; i++, t += FRAME_DURATION_US)
+		chiaki_audio_jitter_estimator_push(&estimator, i, t);
+	munit_assert_uint(estimator.target, ==, CHIAKI_AUDIO_JITTER_TARGET_MIN);
+
+	return MUNIT_OK;
+}
+
+typedef struct sink_record_t
+{
+	uint8_t frames[64];
+	bool fec[64];
+	size_t count;
+} SinkRecord;
+
+static void record_frame(uint8_t *buf, size_t buf_size, bool fec, SinkRecord *record)
+{
+	if(record->count >= sizeof(record->frames))
+		return;
+	record->frames[record->count] = buf_size ? buf[0] : 0xff;
+	record->fec[record->count] = fec;
+	record->count++;
+}
+
+static void sink_frame(uint8_t *buf, size_t buf_size, void *user)
+{
+	record_frame(buf, buf_size, false, user);
+}
+
+static void sink_fec_frame(uint8_t *buf, size_t buf_size, void *user)
+{
+	record_frame(buf, buf_size, true, user);
+}
+
+static void push_frame(ChiakiAudioReceiver *receiver, ChiakiSeqNum16 frame_index)
+{
+	uint8_t data[4] = { (uint8_t)frame_index, 0, 0, 0 };
+	ChiakiTakionAVPacket packet = { 0 };
+	packet.codec = 5;
+	packet.frame_index = frame_index;
+	packet.units_in_frame_total = 1;
+	packet.units_in_frame_fec = (sizeof(data) << 8) | 1; // 1 source unit, 0 fec units
+	packet.data = data;
+	packet.data_size = sizeof(data);
+	chiaki_audio_receiver_av_packet(receiver, &packet);
+}
+
+static MunitResult test_audio_receiver_fec(const MunitParameter params[], void *user)
+{
+	static ChiakiSession session;
+	memset(&session, 0, sizeof(session));
+	session.log = get_test_log();
+
+	SinkRecord record = { 0 };
+	session.audio_sink.user = &record;
+	session.audio_sink.frame_cb = sink_frame;
+	session.audio_sink.fec_frame_cb = sink_fec_frame;
+
+	ChiakiAudioReceiver receiver;
+	munit_assert_int(chiaki_audio_receiver_init(&receiver, &session, NULL), ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiAudioHeader header;
+	chiaki_audio_header_set(&header, 2, 16, 48000, 480);
+	chiaki_audio_receiver_stream_info(&receiver, &header);
+
+	// frame 5 is lost, all others arrive in order
+	for(ChiakiSeqNum16 i=1; i<=30; i++)
+	{
+		if(i != 5)
+			push_frame(&receiver, i);
+	}
+
+	munit_assert_size(record.count, >=, 25);
+	for(size_t i=0; i<record.count; i++)
+	{
+		if(i == 4)
+		{
+			// recovered from the fec data of the following frame
+			munit_assert(record.fec[i]);
+			munit_assert_uint8(record.frames[i], ==, 6);
+		}
+		else
+		{
+			munit_assert(!record.fec[i]);
+			munit_assert_uint8(record.frames[i], ==, i + 1);
+		}
+	}
+
+	ChiakiAudioReceiverStats stats;
+	chiaki_audio_receiver_get_stats(&receiver, &stats);
+	munit_assert_uint64(stats.frames_fec_recovered, ==, 1);
+	munit_assert_uint64(stats.frames_concealed, ==, 0);
+
+	// without a fec callback, the sink gets a NULL frame for PLC
+	session.audio_sink.fec_frame_cb = NULL;
+	memset(&record, 0, sizeof(record));
+	chiaki_audio_receiver_stream_info(&receiver, &header);
+	for(ChiakiSeqNum16 i=1; i<=30; i++)
+	{
+		if(i != 5)
+			push_frame(&receiver, i);
+	}
+	munit_assert_uint8(record.frames[4], ==, 0xff);
+	chiaki_audio_receiver_get_stats(&receiver, &stats);
+	munit_assert_uint64(stats.frames_concealed, ==, 1);
+
+	chiaki_audio_receiver_fini(&receiver);
+	return MUNIT_OK;
+}
+
+MunitTest tests_audio_receiver[] = {
+	{
+		"/jitter_estimator_clean",
+		test_jitter_estimator_clean,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/jitter_estimator_jittery",
+		test_jitter_estimator_jittery,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/fec",
+		test_audio_receiver_fec,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
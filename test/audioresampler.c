@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/audioresampler.h>
+#include <chiaki/audioring.h>
+
+#include <math.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// delay of the resampler in input frames
+#define DELAY (CHIAKI_AUDIO_RESAMPLER_TAPS / 2)
+
+static MunitResult test_passthrough(const MunitParameter params[], void *user)
+{
+	ChiakiAudioResampler resampler;
+	ChiakiErrorCode err = chiaki_audio_resampler_init(&resampler, 2);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	int16_t in[480 * 2];
+	int16_t out[480 * 2];
+	int16_t prev[DELAY * 2] = { 0 };
+	for(int chunk=0; chunk<10; chunk++)
+	{
+		for(size_t i=0; i<480 * 2; i++)
+			in[i] = (int16_t)munit_rand_int_range(-32768, 32767);
+		size_t frames = chiaki_audio_resampler_process(&resampler, in, 480, out, 480);
+		munit_assert_size(frames, ==, 480);
+		munit_assert_memory_equal(sizeof(prev), out, prev);
+		munit_assert_memory_equal(sizeof(out) - sizeof(prev), out + DELAY * 2, in);
+		memcpy(prev, in + (480 - DELAY) * 2, sizeof(prev));
+	}
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_sine(const MunitParameter params[], void *user)
+{
+	ChiakiAudioResampler resampler;
+	chiaki_audio_resampler_init(&resampler, 1);
+	const double ratio = 1.0015;
+	chiaki_audio_resampler_set_ratio(&resampler, ratio);
+
+	// 1kHz at 48kHz, in odd sized chunks
+	const double freq = 1000.0 / 48000.0;
+	static int16_t in[48000];
+	static int16_t out[48000 + 48000 / 64 + 2];
+	for(size_t i=0; i<48000; i++)
+		in[i] = (int16_t)(16384.0 * sin(2.0 * M_PI * freq * i));
+	size_t in_pos = 0, out_frames = 0;
+	while(in_pos < 48000)
+	{
+		size_t chunk = 48000 - in_pos < 333 ? 48000 - in_pos : 333;
+		out_frames += chiaki_audio_resampler_process(&resampler, in + in_pos, chunk,
+				out + out_frames, chiaki_audio_resampler_output_max(chunk));
+		in_pos += chunk;
+	}
+	munit_assert_double(fabs((double)out_frames - 48000.0 * ratio), <=, 2.0);
+
+	// output frame n lies at input time n / ratio - DELAY
+	double err = 0.0, sig = 0.0;
+	for(size_t n=DELAY * 2; n<out_frames; n++)
+	{
+		double expected = 16384.0 * sin(2.0 * M_PI * freq * ((double)n / ratio - DELAY));
+		err += (out[n] - expected) * (out[n] - expected);
+		sig += expected * expected;
+	}
+	double snr_db = 10.0 * log10(sig / err);
+	munit_assert_double(snr_db, >, 70.0);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_drift_controller_converge(const MunitParameter params[], void *user)
+{
+	// Producer at 8kHz mono running 500ppm fast into a ring drained by a device at exactly 8kHz,
+	// all driven by a fake clock in 10ms packets over 10 minutes.
+	const unsigned int rate = 8000;
+	const unsigned int target_ms = 40;
+	const size_t packet_frames = 80;
+	const size_t period_frames = 64;
+	const double drift = 1.0005;
+
+	ChiakiAudioRing ring;
+	chiaki_audio_ring_init(&ring, sizeof(int16_t), rate, target_ms);
+	ChiakiAudioResampler resampler;
+	chiaki_audio_resampler_init(&resampler, 1);
+	ChiakiAudioDriftController controller;
+	chiaki_audio_drift_controller_init(&controller, rate * target_ms / 1000);
+
+	int16_t packet[80];
+	for(size_t i=0; i<packet_frames; i++)
+		packet[i] = (int16_t)(i * 100);
+	int16_t resampled[80 + 80 / 64 + 2];
+	int16_t period[64];
+
+	const uint64_t packet_ns = (uint64_t)(packet_frames * 1000000000ull / rate / drift);
+	const uint64_t period_ns = period_frames * 1000000000ull / rate;
+	uint64_t next_packet = 0, next_period = 0;
+	double late_fill_sum = 0.0;
+	size_t late_fill_count = 0;
+	for(uint64_t now_ms=0; now_ms<10*60*1000; now_ms++)
+	{
+		uint64_t now = now_ms * 1000000;
+		for(; next_packet <= now; next_packet += packet_ns)
+		{
+			double ratio = chiaki_audio_drift_controller_update(&controller,
+					chiaki_audio_ring_buffered(&ring) / sizeof(int16_t), now / 1000);
+			chiaki_audio_resampler_set_ratio(&resampler, ratio);
+			size_t frames = chiaki_audio_resampler_process(&resampler, packet, packet_frames,
+					resampled, chiaki_audio_resampler_output_max(packet_frames));
+			chiaki_audio_ring_write(&ring, (const uint8_t *)resampled, frames * sizeof(int16_t));
+		}
+		for(; next_period <= now; next_period += period_ns)
+		{
+			chiaki_audio_ring_read(&ring, (uint8_t *)period, sizeof(period));
+			if(now_ms > 5*60*1000)
+			{
+				late_fill_sum += chiaki_audio_ring_buffered_ms(&ring);
+				late_fill_count++;
+			}
+		}
+	}
+
+	// the drift was absorbed by the resampler, not by dropping audio, and latency settled at the target
+	munit_assert_uint64(ring.underruns, ==, 0);
+	munit_assert_uint64(ring.dropped_bytes, ==, 0);
+	munit_assert_double(fabs(controller.ratio * drift - 1.0), <, 50e-6);
+	double late_fill_ms = late_fill_sum / late_fill_count;
+	munit_assert_double(late_fill_ms, >, target_ms * 0.75);
+	munit_assert_double(late_fill_ms, <, target_ms * 1.25);
+
+	chiaki_audio_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+static MunitResult test_drift_controller_clamp(const MunitParameter params[], void *user)
+{
+	ChiakiAudioDriftController controller;
+	chiaki_audio_drift_controller_init(&controller, 1920);
+
+	// hugely overfull for a long time, the correction must stay inaudible
+	uint64_t t = 0;
+	for(int i=0; i<10000; i++, t += 10000)
+		chiaki_audio_drift_controller_update(&controller, 1920 * 10, t);
+	munit_assert_double(controller.ratio, >=, 1.0 - CHIAKI_AUDIO_DRIFT_PPM_MAX * 1e-6 - 1e-12);
+
+	// and it must not have wound up, so it recovers quickly once back at the target
+	for(int i=0; i<1000; i++, t += 10000)
+		chiaki_audio_drift_controller_update(&controller, 1920, t);
+	munit_assert_double(fabs(controller.ratio - 1.0), <, 100e-6);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_audio_resampler[] = {
+	{
+		"/passthrough",
+		test_passthrough,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/sine",
+		test_sine,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/drift_controller_converge",
+		test_drift_controller_converge,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/drift_controller_clamp",
+		test_drift_controller_clamp,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,236 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/audioring.h>
+
+#include <string.h>
+
+#define RATE 48000
+#define CHANNELS 2
+#define FRAME_SIZE (CHANNELS * sizeof(int16_t))
+#define TARGET_MS 40
+#define PACKET_SAMPLES 480 // 10ms Opus frames
+#define PERIOD_SAMPLES 256 // device callback size, deliberately not aligned with the packets
+
+static MunitResult test_roundtrip(const MunitParameter params[], void *user)
+{
+	ChiakiAudioRing ring;
+	ChiakiErrorCode err = chiaki_audio_ring_init(&ring, FRAME_SIZE, RATE, TARGET_MS);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(ring.size & (ring.size - 1), ==, 0);
+
+	// push and pull enough to wrap around the buffer several times
+	int16_t in[PACKET_SAMPLES * CHANNELS];
+	int16_t out[PACKET_SAMPLES * CHANNELS];
+	int16_t next_in = 0, next_out = 0;
+	for(int i=0; i<100; i++)
+	{
+		for(size_t j=0; j<PACKET_SAMPLES * CHANNELS; j++)
+			in[j] = next_in++;
+		size_t written = chiaki_audio_ring_write(&ring, (const uint8_t *)in, sizeof(in));
+		munit_assert_size(written, ==, sizeof(in));
+		if(i < TARGET_MS / 10 - 1)
+			continue; // nothing comes out until the target is buffered
+		chiaki_audio_ring_read(&ring, (uint8_t *)out, sizeof(out));
+		for(size_t j=0; j<PACKET_SAMPLES * CHANNELS; j++)
+			munit_assert_int16(out[j], ==, next_out++);
+	}
+	munit_assert_uint64(ring.underruns, ==, 0);
+	munit_assert_uint64(ring.dropped_bytes, ==, 0);
+
+	// volume is applied while writing
+	chiaki_audio_ring_flush(&ring);
+	for(size_t j=0; j<PACKET_SAMPLES * CHANNELS; j++)
+		in[j] = (j % 2) ? -1000 : 1000;
+	for(int i=0; i<4; i++)
+		chiaki_audio_ring_write_s16(&ring, in, PACKET_SAMPLES * CHANNELS, 64);
+	chiaki_audio_ring_read(&ring, (uint8_t *)out, sizeof(out));
+	munit_assert_int16(out[0], ==, 500);
+	munit_assert_int16(out[1], ==, -500);
+
+	chiaki_audio_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+static MunitResult test_wrap(const MunitParameter params[], void *user)
+{
+	ChiakiAudioRing ring;
+	// 6 byte frames, so the ring can never be a multiple of the frame size
+	ChiakiErrorCode err = chiaki_audio_ring_init(&ring, 3 * sizeof(int16_t), RATE, TARGET_MS);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// positions right before they overflow, as after a long session on 32 bit
+	ring.write_pos = ring.read_pos = SIZE_MAX - 3 * PACKET_SAMPLES * 3 * sizeof(int16_t) + 1;
+
+	int16_t in[PACKET_SAMPLES * 3];
+	int16_t out[PACKET_SAMPLES * 3];
+	int16_t next_in = 0, next_out = 0;
+	for(int i=0; i<20; i++)
+	{
+		for(size_t j=0; j<PACKET_SAMPLES * 3; j++)
+			in[j] = next_in++;
+		munit_assert_size(chiaki_audio_ring_write(&ring, (const uint8_t *)in, sizeof(in)), ==, sizeof(in));
+		if(i < TARGET_MS / 10 - 1)
+			continue;
+		munit_assert_size(chiaki_audio_ring_buffered(&ring), ==, (size_t)(TARGET_MS / 10) * sizeof(in));
+		chiaki_audio_ring_read(&ring, (uint8_t *)out, sizeof(out));
+		for(size_t j=0; j<PACKET_SAMPLES * 3; j++)
+			munit_assert_int16(out[j], ==, next_out++);
+	}
+	munit_assert_size(ring.write_pos, <, 20 * sizeof(in)); // wrapped around
+	munit_assert_uint64(ring.underruns, ==, 0);
+	munit_assert_uint64(ring.dropped_bytes, ==, 0);
+
+	chiaki_audio_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+/**
+ * Drives producer and consumer from a fake clock in 1ms steps.
+ * The producer delivers 10ms packets in bursts of burst_packets every burst_packets * 10ms,
+ * running at producer_ppm relative to the device clock.
+ * The consumer is an audio callback pulling PERIOD_SAMPLES at the device rate.
+ * Packets are held back during [stall_start_ms, stall_end_ms) and delivered all at once afterwards.
+ */
+typedef struct sim_t
+{
+	unsigned burst_packets;
+	int producer_ppm;
+	uint64_t stall_start_ms, stall_end_ms;
+	unsigned max_buffered_ms; // output
+} Sim;
+
+static void simulate(ChiakiAudioRing *ring, Sim *sim, uint64_t duration_ms)
+{
+	int16_t packet[PACKET_SAMPLES * CHANNELS];
+	memset(packet, 0x11, sizeof(packet));
+	int16_t period[PERIOD_SAMPLES * CHANNELS];
+
+	// times in ns
+	const uint64_t packet_ns = (uint64_t)PACKET_SAMPLES * 1000000000ull / RATE * 1000000 / (uint64_t)(1000000 + sim->producer_ppm);
+	const uint64_t period_ns = (uint64_t)PERIOD_SAMPLES * 1000000000ull / RATE;
+	uint64_t packets_due = 0, packets_sent = 0;
+	uint64_t next_period = 0;
+	sim->max_buffered_ms = 0;
+
+	for(uint64_t now_ms=0; now_ms<duration_ms; now_ms++)
+	{
+		uint64_t now = now_ms * 1000000;
+
+		// the network hands us everything encoded so far, but only once a whole burst is ready
+		uint64_t encoded = now / packet_ns;
+		if(encoded >= packets_due + sim->burst_packets)
+			packets_due = encoded - encoded % sim->burst_packets;
+		bool stalled = now_ms >= sim->stall_start_ms && now_ms < sim->stall_end_ms;
+		for(; !stalled && packets_sent < packets_due; packets_sent++)
+			chiaki_audio_ring_write(ring, (const uint8_t *)packet, sizeof(packet));
+
+		for(; next_period <= now; next_period += period_ns)
+		{
+			chiaki_audio_ring_read(ring, (uint8_t *)period, sizeof(period));
+			unsigned buffered_ms = chiaki_audio_ring_buffered_ms(ring);
+			if(buffered_ms > sim->max_buffered_ms)
+				sim->max_buffered_ms = buffered_ms;
+		}
+	}
+}
+
+static MunitResult test_steady(const MunitParameter params[], void *user)
+{
+	ChiakiAudioRing ring;
+	chiaki_audio_ring_init(&ring, FRAME_SIZE, RATE, TARGET_MS);
+
+	Sim sim = { 0 };
+	sim.burst_packets = 2;
+	simulate(&ring, &sim, 10000);
+	munit_assert_uint64(ring.underruns, ==, 0);
+	munit_assert_uint64(ring.dropped_bytes, ==, 0);
+	munit_assert_uint(sim.max_buffered_ms, <=, TARGET_MS + 20);
+
+	chiaki_audio_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+static MunitResult test_drift(const MunitParameter params[], void *user)
+{
+	ChiakiAudioRing ring;
+	chiaki_audio_ring_init(&ring, FRAME_SIZE, RATE, TARGET_MS);
+
+	// the host runs 0.5% fast, without trimming we would pile up 300ms over the minute
+	Sim sim = { 0 };
+	sim.burst_packets = 1;
+	sim.producer_ppm = 5000;
+	simulate(&ring, &sim, 60000);
+	munit_assert_uint64(ring.underruns, ==, 0);
+	munit_assert_uint64(ring.dropped_bytes, >, 0);
+	munit_assert_uint(sim.max_buffered_ms, <=, TARGET_MS * 2);
+
+	chiaki_audio_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+static MunitResult test_stall(const MunitParameter params[], void *user)
+{
+	ChiakiAudioRing ring;
+	chiaki_audio_ring_init(&ring, FRAME_SIZE, RATE, TARGET_MS);
+
+	// 150ms of lost audio, followed by the burst of everything that was held back
+	Sim sim = { 0 };
+	sim.burst_packets = 1;
+	sim.stall_start_ms = 2000;
+	sim.stall_end_ms = 2150;
+	simulate(&ring, &sim, 5000);
+
+	// one gap, then playback recovers at the target without stuttering
+	munit_assert_uint64(ring.underruns, ==, 1);
+	munit_assert_uint(chiaki_audio_ring_buffered_ms(&ring), <=, TARGET_MS);
+	munit_assert_uint(sim.max_buffered_ms, <=, TARGET_MS * 2);
+
+	chiaki_audio_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+MunitTest tests_audio_ring[] = {
+	{
+		"/roundtrip",
+		test_roundtrip,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/wrap",
+		test_wrap,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/steady",
+		test_steady,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/drift",
+		test_drift,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/stall",
+		test_stall,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
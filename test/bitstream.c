@@ -22,6 +22,10 @@ static MunitResult test_bitstream_parse_h264(const MunitParameter params[], void
 	memset(&bs.h264, -1, sizeof(bs.h264));
 	munit_assert(chiaki_bitstream_header(&bs, header, ARRAY_SIZE(header)));
 	munit_assert(bs.h264.sps.log2_max_frame_num_minus4 == 3);
+	unsigned width, height;
+	chiaki_bitstream_size(&bs, &width, &height);
+	munit_assert_uint(width, ==, 1920);
+	munit_assert_uint(height, ==, 1080); // 1088 cropped
 
 	uint8_t slice_i[] = {
 		0x00, 0x00, 0x00, 0x01, 0x65, 0x88, 0x80, 0x82, 0x1f, 0x00, 0x49, 0xee, 0x03, 0x29, 0xff, 0xf8,
@@ -70,6 +74,10 @@ static MunitResult test_bitstream_parse_h265(const MunitParameter params[], void
 	memset(&bs.h265, -1, sizeof(bs.h265));
 	munit_assert(chiaki_bitstream_header(&bs, header, ARRAY_SIZE(header)));
 	munit_assert(bs.h265.sps.log2_max_pic_order_cnt_lsb_minus4 == 0);
+	unsigned width, height;
+	chiaki_bitstream_size(&bs, &width, &height);
+	munit_assert_uint(width, ==, 1920);
+	munit_assert_uint(height, ==, 1080); // 1088 cropped
 
 	uint8_t slice_i[] = {
 		0x00, 0x00, 0x00, 0x01, 0x28, 0x01, 0xac, 0x25, 0xcf, 0x83, 0xff, 0x23, 0x54, 0xab, 0x5c, 0xf5,
@@ -155,6 +163,8 @@ static MunitResult test_bitstream_set_ref_h265(const MunitParameter params[], vo
 	munit_assert(chiaki_bitstream_slice(&bs, slice_p, ARRAY_SIZE(slice_p), &slice));
 	munit_assert(slice.slice_type == CHIAKI_BITSTREAM_SLICE_P);
 	munit_assert(slice.reference_frame == 0);
+	uint8_t slice_p_direct[ARRAY_SIZE(slice_p)];
+	memcpy(slice_p_direct, slice_p, sizeof(slice_p));
 
 	for(unsigned i=0; i<9; i++)
 	{
@@ -167,6 +177,102 @@ static MunitResult test_bitstream_set_ref_h265(const MunitParameter params[], vo
 	// Slice have 9 reference frames
 	munit_assert(!chiaki_bitstream_slice_set_reference_frame(&bs, slice_p, ARRAY_SIZE(slice_p), 10));
 
+	// Going back to a lower index must clear the flag of the higher one, leaving exactly one picture used
+	munit_assert(chiaki_bitstream_slice_set_reference_frame(&bs, slice_p_direct, ARRAY_SIZE(slice_p_direct), 2));
+	munit_assert(chiaki_bitstream_slice_set_reference_frame(&bs, slice_p, ARRAY_SIZE(slice_p), 2));
+	munit_assert_memory_equal(sizeof(slice_p), slice_p, slice_p_direct);
+	memset(&slice, -1, sizeof(slice));
+	munit_assert(chiaki_bitstream_slice(&bs, slice_p, ARRAY_SIZE(slice_p), &slice));
+	munit_assert(slice.reference_frame == 2);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_bitstream_set_ref_h264(const MunitParameter params[], void *fixture)
+{
+	ChiakiBitstream bs;
+	ChiakiBitstreamSlice slice;
+
+	chiaki_bitstream_init(&bs, NULL, CHIAKI_CODEC_H264);
+
+	uint8_t header[] = {
+		0x00, 0x00, 0x00, 0x01, 0x67, 0x4d, 0x40, 0x32, 0x91, 0x8a, 0x01, 0xe0, 0x08, 0x9f, 0x97, 0x01,
+		0x6a, 0x02, 0x02, 0x02, 0x80, 0x00, 0x03, 0xe9, 0x00, 0x01, 0xd4, 0xc0, 0x44, 0xd0, 0xf1, 0xf1,
+		0x50, 0x00, 0x00, 0x00, 0x01, 0x68, 0xee, 0x3c, 0x80,
+	};
+	munit_assert(chiaki_bitstream_header(&bs, header, ARRAY_SIZE(header)));
+	munit_assert(bs.h264.sps.pic_order_cnt_type == 2);
+	munit_assert(chiaki_bitstream_max_ref_frames(&bs) == 9);
+
+	uint8_t slice_p_ref_5[] = {
+		0x00, 0x00, 0x00, 0x01, 0x41, 0x9b, 0xfd, 0x98, 0x89, 0xdf, 0x00, 0x03, 0x24, 0x60, 0x47, 0x1a,
+		0x90, 0x10, 0xb3, 0x2c, 0x4e, 0x45, 0xfc, 0xff, 0x45, 0x24, 0x8c, 0x79, 0xec, 0x12, 0xe5, 0x9b,
+	};
+	uint8_t orig[ARRAY_SIZE(slice_p_ref_5)];
+	memcpy(orig, slice_p_ref_5, sizeof(orig));
+
+	// abs_diff_pic_num_minus1 3-6 share the same code length and can be rewritten in place
+	for(unsigned i=3; i<=6; i++)
+	{
+		munit_assert(chiaki_bitstream_slice_set_reference_frame(&bs, slice_p_ref_5, ARRAY_SIZE(slice_p_ref_5), i));
+		memset(&slice, -1, sizeof(slice));
+		munit_assert(chiaki_bitstream_slice(&bs, slice_p_ref_5, ARRAY_SIZE(slice_p_ref_5), &slice));
+		munit_assert(slice.slice_type == CHIAKI_BITSTREAM_SLICE_P);
+		munit_assert(slice.reference_frame == i);
+	}
+
+	// everything else would change the size of the slice header
+	munit_assert(chiaki_bitstream_slice_set_reference_frame(&bs, slice_p_ref_5, ARRAY_SIZE(slice_p_ref_5), 5));
+	munit_assert(!chiaki_bitstream_slice_set_reference_frame(&bs, slice_p_ref_5, ARRAY_SIZE(slice_p_ref_5), 0));
+	munit_assert(!chiaki_bitstream_slice_set_reference_frame(&bs, slice_p_ref_5, ARRAY_SIZE(slice_p_ref_5), 7));
+	munit_assert_memory_equal(sizeof(orig), slice_p_ref_5, orig);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_bitstream_set_ref_frame_h265(const MunitParameter params[], void *fixture)
+{
+	ChiakiBitstream bs;
+	ChiakiBitstreamSlice slice;
+
+	chiaki_bitstream_init(&bs, NULL, CHIAKI_CODEC_H265);
+
+	uint8_t header[] = {
+		0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0c, 0x01, 0xff, 0xff, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
+		0xb0, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x96, 0x0a, 0xc0, 0x90, 0x00, 0x00, 0x00, 0x01,
+		0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0xb0, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
+		0x00, 0x96, 0xa0, 0x03, 0xc0, 0x80, 0x11, 0x07, 0xcb, 0xc2, 0xb9, 0x24, 0x29, 0x52, 0x70, 0x16,
+		0xa0, 0x20, 0x20, 0x20, 0x80, 0x00, 0x07, 0xd2, 0x00, 0x01, 0xd4, 0xc0, 0x20, 0xe5, 0xa1, 0xe3,
+		0xd0, 0x00, 0x00, 0x00, 0x01, 0x44, 0x01, 0xc0, 0xf3, 0xc0, 0x4c, 0x90,
+	};
+	munit_assert(chiaki_bitstream_header(&bs, header, ARRAY_SIZE(header)));
+	munit_assert(bs.h265.sps.slice_segment_address_bits == 9); // 1920x1088 in 64x64 CTBs
+	munit_assert(chiaki_bitstream_max_ref_frames(&bs) == 9);
+
+	// two slices of the same frame, both referencing the previous frame
+	uint8_t frame[] = {
+		0x00, 0x00, 0x00, 0x01, 0x02, 0x01, 0xd2, 0x85, 0x7a, 0xaa, 0xa6, 0x08, 0x60, 0x13, 0x55, 0x17,
+		0x6b, 0x71, 0x72, 0xf9, 0x6e, 0xd4, 0xf2, 0x66, 0x78, 0x0c, 0x12, 0xe7, 0x79, 0xf0, 0xbc, 0xc9,
+		0x00, 0x00, 0x00, 0x01, 0x02, 0x01, 0xd2, 0x85, 0x7a, 0xaa, 0xa6, 0x08, 0x60, 0x13, 0x55, 0x17,
+		0x6b, 0x71, 0x72, 0xf9, 0x6e, 0xd4, 0xf2, 0x66, 0x78, 0x0c, 0x12, 0xe7, 0x79, 0xf0, 0xbc, 0xc9,
+	};
+	memset(&slice, -1, sizeof(slice));
+	munit_assert(chiaki_bitstream_slice(&bs, frame, ARRAY_SIZE(frame), &slice));
+	munit_assert(slice.reference_frame == 0);
+	munit_assert(slice.ref_pics_count == 9);
+	for(unsigned i=0; i<slice.ref_pics_count; i++)
+		munit_assert(slice.ref_pics[i] == i + 1);
+
+	munit_assert(chiaki_bitstream_frame_set_reference_frame(&bs, frame, ARRAY_SIZE(frame), 4));
+	memset(&slice, -1, sizeof(slice));
+	munit_assert(chiaki_bitstream_slice(&bs, frame, 32, &slice));
+	munit_assert(slice.reference_frame == 4);
+	memset(&slice, -1, sizeof(slice));
+	munit_assert(chiaki_bitstream_slice(&bs, frame + 32, 32, &slice));
+	munit_assert(slice.reference_frame == 4);
+
+	munit_assert(!chiaki_bitstream_frame_set_reference_frame(&bs, frame, ARRAY_SIZE(frame), 9));
+
 	return MUNIT_OK;
 }
 
@@ -203,5 +309,21 @@ MunitTest tests_bitstream[] = {
 		MUNIT_TEST_OPTION_NONE,
 		NULL
 	},
+	{
+		"/bitstream_set_ref_h264",
+		test_bitstream_set_ref_h264,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/bitstream_set_ref_frame_h265",
+		test_bitstream_set_ref_frame_h265,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
 	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
@@ -0,0 +1,231 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki-cli.h>
+
+#include <string.h>
+
+#include "test_log.h"
+
+#define MORNING_HEX "000102030405060708090a0b0c0d0e0f"
+
+static bool parse_args(ChiakiCliStreamOptions *options, const char *args[], int argc)
+{
+	// argp wants mutable strings
+	char buf[32][64];
+	char *argv[32];
+	munit_assert_int(argc, <=, 32);
+	for(int i=0; i<argc; i++)
+	{
+		munit_assert_size(strlen(args[i]), <, sizeof(buf[i]));
+		strcpy(buf[i], args[i]);
+		argv[i] = buf[i];
+	}
+	bool r = chiaki_cli_stream_parse_args(options, argc, argv);
+	// the strings in options point into argv, which is gone now
+	options->connect_info.host = NULL;
+	options->output = NULL;
+	options->record = NULL;
+	options->input = NULL;
+	return r;
+}
+
+static MunitResult test_stream_args_defaults(const MunitParameter params[], void *user)
+{
+	const char *args[] = { "stream", "--host", "192.168.1.2", "--registkey", "abcd1234", "--morning", MORNING_HEX };
+	ChiakiCliStreamOptions options;
+	munit_assert_true(parse_args(&options, args, sizeof(args) / sizeof(args[0])));
+
+	munit_assert_true(options.connect_info.ps5);
+	munit_assert_string_equal(options.connect_info.regist_key, "abcd1234");
+	for(size_t i=0; i<sizeof(options.connect_info.morning); i++)
+		munit_assert_uint8(options.connect_info.morning[i], ==, i);
+	munit_assert_uint(options.connect_info.video_profile.width, ==, 1280);
+	munit_assert_uint(options.connect_info.video_profile.height, ==, 720);
+	munit_assert_uint(options.connect_info.video_profile.max_fps, ==, 60);
+	munit_assert_uint(options.connect_info.video_profile.bitrate, ==, 10000);
+	munit_assert_int(options.connect_info.video_profile.codec, ==, CHIAKI_CODEC_H264);
+	munit_assert_int(options.connect_info.audio_video_disabled, ==, CHIAKI_NONE_DISABLED);
+	munit_assert_int(options.video_sink, ==, CHIAKI_CLI_VIDEO_SINK_NULL);
+	munit_assert_false(options.input_loop);
+	munit_assert_uint64(options.duration_ms, ==, 0);
+	munit_assert_uint64(options.stats_interval_ms, ==, 1000);
+	return MUNIT_OK;
+}
+
+static MunitResult test_stream_args_all(const MunitParameter params[], void *user)
+{
+	const char *args[] = { "stream", "-h", "ps4.local", "-r", "abcd1234", "-m", MORNING_HEX, "--ps4",
+		"-R", "1080", "-f", "30", "-b", "12000", "-c", "h265", "-V", "file", "-o", "out.h265",
+		"-A", "-i", "script.txt", "-l", "-d", "2.5", "-s", "0" };
+	ChiakiCliStreamOptions options;
+	munit_assert_true(parse_args(&options, args, sizeof(args) / sizeof(args[0])));
+
+	munit_assert_false(options.connect_info.ps5);
+	munit_assert_uint(options.connect_info.video_profile.width, ==, 1920);
+	munit_assert_uint(options.connect_info.video_profile.height, ==, 1080);
+	munit_assert_uint(options.connect_info.video_profile.max_fps, ==, 30);
+	munit_assert_uint(options.connect_info.video_profile.bitrate, ==, 12000);
+	munit_assert_int(options.connect_info.video_profile.codec, ==, CHIAKI_CODEC_H265);
+	munit_assert_int(options.connect_info.audio_video_disabled, ==, CHIAKI_AUDIO_DISABLED);
+	munit_assert_int(options.video_sink, ==, CHIAKI_CLI_VIDEO_SINK_FILE);
+	munit_assert_true(options.input_loop);
+	munit_assert_uint64(options.duration_ms, ==, 2500);
+	munit_assert_uint64(options.stats_interval_ms, ==, 0);
+	return MUNIT_OK;
+}
+
+static MunitResult test_stream_args_invalid(const MunitParameter params[], void *user)
+{
+	ChiakiCliStreamOptions options;
+
+	const char *no_host[] = { "stream", "-r", "abcd1234", "-m", MORNING_HEX };
+	munit_assert_false(parse_args(&options, no_host, sizeof(no_host) / sizeof(no_host[0])));
+
+	const char *short_morning[] = { "stream", "-h", "host", "-r", "abcd1234", "-m", "0001020304" };
+	munit_assert_false(parse_args(&options, short_morning, sizeof(short_morning) / sizeof(short_morning[0])));
+
+	const char *bad_morning[] = { "stream", "-h", "host", "-r", "abcd1234", "-m", "000102030405060708090a0b0c0d0e0g" };
+	munit_assert_false(parse_args(&options, bad_morning, sizeof(bad_morning) / sizeof(bad_morning[0])));
+
+	const char *long_registkey[] = { "stream", "-h", "host", "-r", "abcd1234abcd1234abcd1234", "-m", MORNING_HEX };
+	munit_assert_false(parse_args(&options, long_registkey, sizeof(long_registkey) / sizeof(long_registkey[0])));
+
+	const char *bad_resolution[] = { "stream", "-h", "host", "-r", "abcd1234", "-m", MORNING_HEX, "-R", "480" };
+	munit_assert_false(parse_args(&options, bad_resolution, sizeof(bad_resolution) / sizeof(bad_resolution[0])));
+
+	const char *bad_fps[] = { "stream", "-h", "host", "-r", "abcd1234", "-m", MORNING_HEX, "-f", "120" };
+	munit_assert_false(parse_args(&options, bad_fps, sizeof(bad_fps) / sizeof(bad_fps[0])));
+
+	const char *bad_codec[] = { "stream", "-h", "host", "-r", "abcd1234", "-m", MORNING_HEX, "-c", "av1" };
+	munit_assert_false(parse_args(&options, bad_codec, sizeof(bad_codec) / sizeof(bad_codec[0])));
+
+	const char *bad_sink[] = { "stream", "-h", "host", "-r", "abcd1234", "-m", MORNING_HEX, "-V", "screen" };
+	munit_assert_false(parse_args(&options, bad_sink, sizeof(bad_sink) / sizeof(bad_sink[0])));
+
+	const char *file_no_output[] = { "stream", "-h", "host", "-r", "abcd1234", "-m", MORNING_HEX, "-V", "file" };
+	munit_assert_false(parse_args(&options, file_no_output, sizeof(file_no_output) / sizeof(file_no_output[0])));
+	return MUNIT_OK;
+}
+
+static ChiakiErrorCode read_script(ChiakiCliInputScript *script, const char *str)
+{
+	FILE *f = tmpfile();
+	munit_assert_not_null(f);
+	munit_assert_size(fwrite(str, 1, strlen(str), f), ==, strlen(str));
+	rewind(f);
+	ChiakiErrorCode err = chiaki_cli_input_script_read(script, get_test_log(), f);
+	fclose(f);
+	return err;
+}
+
+static MunitResult test_input_script(const MunitParameter params[], void *user)
+{
+	ChiakiCliInputScript script = { 0 };
+	ChiakiErrorCode err = read_script(&script,
+			"# comment\n"
+			"\n"
+			"500 cross+dpad_up\n"
+			"  100 none 255 0 -100 200 300 -400\n"
+			"0 circle+square+triangle+ps\n"
+			"20 moon+box+pyramid+l1+r1+l3+r3+options+share+touchpad\n");
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(script.steps_count, ==, 4);
+
+	munit_assert_uint64(script.steps[0].duration_ms, ==, 500);
+	munit_assert_uint32(script.steps[0].state.buttons, ==, CHIAKI_CONTROLLER_BUTTON_CROSS | CHIAKI_CONTROLLER_BUTTON_DPAD_UP);
+	munit_assert_uint8(script.steps[0].state.l2_state, ==, 0);
+	munit_assert_int16(script.steps[0].state.left_x, ==, 0);
+
+	munit_assert_uint64(script.steps[1].duration_ms, ==, 100);
+	munit_assert_uint32(script.steps[1].state.buttons, ==, 0);
+	munit_assert_uint8(script.steps[1].state.l2_state, ==, 255);
+	munit_assert_uint8(script.steps[1].state.r2_state, ==, 0);
+	munit_assert_int16(script.steps[1].state.left_x, ==, -100);
+	munit_assert_int16(script.steps[1].state.left_y, ==, 200);
+	munit_assert_int16(script.steps[1].state.right_x, ==, 300);
+	munit_assert_int16(script.steps[1].state.right_y, ==, -400);
+
+	uint32_t face = CHIAKI_CONTROLLER_BUTTON_MOON | CHIAKI_CONTROLLER_BUTTON_BOX | CHIAKI_CONTROLLER_BUTTON_PYRAMID;
+	munit_assert_uint64(script.steps[2].duration_ms, ==, 0);
+	munit_assert_uint32(script.steps[2].state.buttons, ==, face | CHIAKI_CONTROLLER_BUTTON_PS);
+	munit_assert_uint32(script.steps[3].state.buttons, ==, face
+			| CHIAKI_CONTROLLER_BUTTON_L1 | CHIAKI_CONTROLLER_BUTTON_R1
+			| CHIAKI_CONTROLLER_BUTTON_L3 | CHIAKI_CONTROLLER_BUTTON_R3
+			| CHIAKI_CONTROLLER_BUTTON_OPTIONS | CHIAKI_CONTROLLER_BUTTON_SHARE
+			| CHIAKI_CONTROLLER_BUTTON_TOUCHPAD);
+
+	// a second script is appended
+	err = read_script(&script, "1000 none\n");
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(script.steps_count, ==, 5);
+	munit_assert_uint64(script.steps[4].duration_ms, ==, 1000);
+
+	chiaki_cli_input_script_fini(&script);
+	munit_assert_null(script.steps);
+	munit_assert_size(script.steps_count, ==, 0);
+	return MUNIT_OK;
+}
+
+static MunitResult test_input_script_invalid(const MunitParameter params[], void *user)
+{
+	static const char *scripts[] = {
+		"100 jump\n",
+		"100 cross 1 2\n",
+		"cross 100\n",
+		"100\n",
+		"100 none\n200 circle+start\n"
+	};
+	for(size_t i=0; i<sizeof(scripts) / sizeof(scripts[0]); i++)
+	{
+		ChiakiCliInputScript script = { 0 };
+		munit_assert_int(read_script(&script, scripts[i]), ==, CHIAKI_ERR_INVALID_DATA);
+		chiaki_cli_input_script_fini(&script);
+	}
+	return MUNIT_OK;
+}
+
+MunitTest tests_cli[] = {
+	{
+		"/stream_args_defaults",
+		test_stream_args_defaults,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/stream_args_all",
+		test_stream_args_all,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/stream_args_invalid",
+		test_stream_args_invalid,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/input_script",
+		test_input_script,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/input_script_invalid",
+		test_input_script_invalid,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,270 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/controllerinput.h>
+#include <chiaki/feedbacksender.h>
+#include <chiaki/gkcrypt.h>
+#include <chiaki/stoppipe.h>
+#include <chiaki/time.h>
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "test_log.h"
+
+#define SCRIPT_STEPS 100
+#define SCRIPT_INTERVAL_US 2000
+#define FEEDBACK_STATE_PACKET_TYPE 6
+
+typedef struct sink_test_t
+{
+	ChiakiControllerState state;
+	size_t pushes;
+} SinkTest;
+
+static void sink_test_cb(ChiakiControllerState *state, void *user)
+{
+	SinkTest *test = user;
+	test->state = *state;
+	test->pushes++;
+}
+
+static MunitResult test_merge(const MunitParameter params[], void *user)
+{
+	ChiakiControllerInput input;
+	munit_assert_int(chiaki_controller_input_init(&input), ==, CHIAKI_ERR_SUCCESS);
+
+	int a = chiaki_controller_input_add_source(&input);
+	int b = chiaki_controller_input_add_source(&input);
+	munit_assert_int(a, >=, 0);
+	munit_assert_int(b, >=, 0);
+	munit_assert_int(a, !=, b);
+
+	// a new sink gets the current state
+	SinkTest test = { 0 };
+	chiaki_controller_input_set_sink(&input, sink_test_cb, &test);
+	munit_assert_size(test.pushes, ==, 1);
+	munit_assert_uint64(test.state.buttons, ==, 0);
+
+	ChiakiControllerState state;
+	chiaki_controller_state_set_idle(&state);
+	state.buttons = CHIAKI_CONTROLLER_BUTTON_CROSS;
+	state.left_x = 1000;
+	munit_assert_int(chiaki_controller_input_set_source(&input, a, &state), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(test.pushes, ==, 2);
+
+	chiaki_controller_state_set_idle(&state);
+	state.buttons = CHIAKI_CONTROLLER_BUTTON_MOON;
+	state.left_x = -2000;
+	munit_assert_int(chiaki_controller_input_set_source(&input, b, &state), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(test.pushes, ==, 3);
+	munit_assert_uint64(test.state.buttons, ==, CHIAKI_CONTROLLER_BUTTON_CROSS | CHIAKI_CONTROLLER_BUTTON_MOON);
+	munit_assert_int(test.state.left_x, ==, -2000);
+
+	// the same state again is not pushed
+	munit_assert_int(chiaki_controller_input_set_source(&input, b, &state), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(test.pushes, ==, 3);
+
+	// removing a controller releases everything it held
+	chiaki_controller_input_remove_source(&input, b);
+	munit_assert_size(test.pushes, ==, 4);
+	munit_assert_uint64(test.state.buttons, ==, CHIAKI_CONTROLLER_BUTTON_CROSS);
+	munit_assert_int(test.state.left_x, ==, 1000);
+	munit_assert_int(chiaki_controller_input_set_source(&input, b, &state), ==, CHIAKI_ERR_INVALID_DATA);
+
+	chiaki_controller_input_get(&input, &state);
+	munit_assert_true(chiaki_controller_state_equals(&state, &test.state));
+
+	chiaki_controller_input_set_sink(&input, NULL, NULL);
+	chiaki_controller_state_set_idle(&state);
+	chiaki_controller_input_set_source(&input, a, &state);
+	munit_assert_size(test.pushes, ==, 4);
+
+	for(int i=1; i<CHIAKI_CONTROLLER_INPUT_SOURCES_MAX; i++)
+		munit_assert_int(chiaki_controller_input_add_source(&input), >=, 0);
+	munit_assert_int(chiaki_controller_input_add_source(&input), ==, -1);
+
+	chiaki_controller_input_fini(&input);
+	return MUNIT_OK;
+}
+
+/**
+ * Virtual controller that moves its left stick every SCRIPT_INTERVAL_US,
+ * reported from the input thread like a real device would be.
+ */
+typedef struct scripted_controller_t
+{
+	ChiakiStopPipe *stop_pipe; // only for sleeping
+	int source;
+	size_t step;
+	uint64_t next_us;
+	uint64_t sent_us[SCRIPT_STEPS];
+} ScriptedController;
+
+static int16_t script_left_x(size_t step)
+{
+	return (int16_t)((step + 1) * 300);
+}
+
+static void scripted_controller_poll(ChiakiControllerInput *input, uint32_t timeout_ms, void *user)
+{
+	ScriptedController *controller = user;
+	if(controller->step >= SCRIPT_STEPS)
+	{
+		chiaki_stop_pipe_sleep(controller->stop_pipe, timeout_ms);
+		return;
+	}
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+	if(now_us < controller->next_us)
+	{
+		uint64_t wait_ms = (controller->next_us - now_us + 999) / 1000;
+		chiaki_stop_pipe_sleep(controller->stop_pipe, wait_ms < timeout_ms ? wait_ms : timeout_ms);
+		return;
+	}
+	ChiakiControllerState state;
+	chiaki_controller_state_set_idle(&state);
+	state.left_x = script_left_x(controller->step);
+	controller->sent_us[controller->step] = chiaki_time_now_monotonic_us();
+	chiaki_controller_input_set_source(input, controller->source, &state);
+	controller->step++;
+	controller->next_us = controller->sent_us[controller->step - 1] + SCRIPT_INTERVAL_US;
+}
+
+static void feedback_sink_cb(ChiakiControllerState *state, void *user)
+{
+	chiaki_feedback_sender_set_controller_state(user, state);
+}
+
+static chiaki_socket_t udp_socket_bind_local(struct sockaddr_in *addr)
+{
+	chiaki_socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert_false(CHIAKI_SOCKET_IS_INVALID(sock));
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	munit_assert_int(bind(sock, (struct sockaddr *)addr, sizeof(*addr)), ==, 0);
+	socklen_t addr_len = sizeof(*addr);
+	munit_assert_int(getsockname(sock, (struct sockaddr *)addr, &addr_len), ==, 0);
+	return sock;
+}
+
+static MunitResult test_latency(const MunitParameter params[], void *user)
+{
+	static const uint8_t handshake_key[] = { 0x54, 0x65, 0x4c, 0x34, 0x5c, 0xac, 0x56, 0xb8, 0xea, 0xe6, 0x15, 0x2a, 0xde, 0x1c, 0xe2, 0xe8 };
+	static const uint8_t ecdh_secret[] = { 0x00, 0x34, 0xf8, 0x21, 0xc7, 0xd9, 0xde, 0xa9, 0xe9, 0x11, 0xca, 0x5a, 0xd6, 0x7d, 0x11, 0xce, 0x4f, 0x02, 0xb1, 0xce, 0x1e, 0xe7, 0xc3, 0x8d, 0x54, 0x39, 0xfa, 0x64, 0xe3, 0xdb, 0xd8, 0x0d };
+
+	// local and remote share the key, so the receiving end can decrypt the packets
+	ChiakiGKCrypt gkcrypt;
+	munit_assert_int(chiaki_gkcrypt_init(&gkcrypt, get_test_log(), 0, NULL, 2, handshake_key, ecdh_secret), ==, CHIAKI_ERR_SUCCESS);
+
+	struct sockaddr_in recv_addr, send_addr;
+	chiaki_socket_t recv_sock = udp_socket_bind_local(&recv_addr);
+	chiaki_socket_t send_sock = udp_socket_bind_local(&send_addr);
+	munit_assert_int(connect(send_sock, (struct sockaddr *)&recv_addr, sizeof(recv_addr)), ==, 0);
+
+	// just the parts of a takion that sending feedback needs
+	ChiakiTakion takion;
+	memset(&takion, 0, sizeof(takion));
+	takion.log = get_test_log();
+	takion.version = 12;
+	takion.sock = send_sock;
+	takion.gkcrypt_local = &gkcrypt;
+	// recursive as in chiaki_takion_connect()
+	munit_assert_int(chiaki_mutex_init(&takion.gkcrypt_local_mutex, true), ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiFeedbackSender feedback_sender;
+	munit_assert_int(chiaki_feedback_sender_init(&feedback_sender, &takion), ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiStopPipe stop_pipe, sleep_pipe;
+	munit_assert_int(chiaki_stop_pipe_init(&stop_pipe), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_stop_pipe_init(&sleep_pipe), ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiControllerInput input;
+	munit_assert_int(chiaki_controller_input_init(&input), ==, CHIAKI_ERR_SUCCESS);
+	chiaki_controller_input_set_sink(&input, feedback_sink_cb, &feedback_sender);
+	ScriptedController controller;
+	memset(&controller, 0, sizeof(controller));
+	controller.stop_pipe = &sleep_pipe;
+	controller.source = chiaki_controller_input_add_source(&input);
+	munit_assert_int(controller.source, >=, 0);
+	munit_assert_int(chiaki_controller_input_start(&input, scripted_controller_poll, &controller), ==, CHIAKI_ERR_SUCCESS);
+
+	uint64_t recv_us[SCRIPT_STEPS] = { 0 };
+	while(!recv_us[SCRIPT_STEPS - 1])
+	{
+		ChiakiErrorCode err = chiaki_stop_pipe_select_single(&stop_pipe, recv_sock, false, 2000);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		uint8_t buf[0x100];
+		CHIAKI_SSIZET_TYPE received = recv(recv_sock, (CHIAKI_SOCKET_BUF_TYPE)buf, sizeof(buf), 0);
+		uint64_t now_us = chiaki_time_now_monotonic_us();
+		if(received < 0xc + 0x13 || buf[0] != FEEDBACK_STATE_PACKET_TYPE)
+			continue;
+		uint32_t key_pos = ntohl(*((chiaki_unaligned_uint32_t *)(buf + 4)));
+		munit_assert_int(chiaki_gkcrypt_decrypt(&gkcrypt, key_pos + CHIAKI_GKCRYPT_BLOCK_SIZE, buf + 0xc, received - 0xc), ==, CHIAKI_ERR_SUCCESS);
+		int16_t left_x = (int16_t)ntohs(*((chiaki_unaligned_uint16_t *)(buf + 0xc + 0x11)));
+		for(size_t i=0; i<SCRIPT_STEPS; i++)
+		{
+			if(script_left_x(i) == left_x && !recv_us[i])
+				recv_us[i] = now_us;
+		}
+	}
+
+	chiaki_controller_input_stop(&input);
+
+	// steps that came too close together for the sender may have been merged into one packet
+	size_t received_steps = 0;
+	uint64_t latency_sum_us = 0, latency_max_us = 0;
+	for(size_t i=0; i<SCRIPT_STEPS; i++)
+	{
+		if(!recv_us[i])
+			continue;
+		munit_assert_uint64(recv_us[i], >=, controller.sent_us[i]);
+		uint64_t latency_us = recv_us[i] - controller.sent_us[i];
+		latency_sum_us += latency_us;
+		if(latency_us > latency_max_us)
+			latency_max_us = latency_us;
+		received_steps++;
+	}
+	munit_logf(MUNIT_LOG_INFO, "Input to feedback packet latency avg %.1f us, max %llu us, %zu of %d steps sent",
+			(double)latency_sum_us / received_steps, (unsigned long long)latency_max_us, received_steps, SCRIPT_STEPS);
+	munit_assert_size(received_steps, >=, SCRIPT_STEPS * 9 / 10);
+	munit_assert_uint64(latency_max_us, <, 50000);
+
+	chiaki_controller_input_fini(&input);
+	chiaki_feedback_sender_fini(&feedback_sender);
+	chiaki_stop_pipe_fini(&sleep_pipe);
+	chiaki_stop_pipe_fini(&stop_pipe);
+	chiaki_mutex_fini(&takion.gkcrypt_local_mutex);
+	CHIAKI_SOCKET_CLOSE(send_sock);
+	CHIAKI_SOCKET_CLOSE(recv_sock);
+	chiaki_gkcrypt_fini(&gkcrypt);
+	return MUNIT_OK;
+}
+
+MunitTest tests_controller_input[] = {
+	{
+		"/merge",
+		test_merge,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/latency",
+		test_latency,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
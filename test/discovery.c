@@ -0,0 +1,259 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/discovery.h>
+#include <chiaki/stoppipe.h>
+#include <chiaki/thread.h>
+#include <chiaki/time.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "test_log.h"
+
+#define REGIST_KEY "12345678"
+#define REGIST_KEY_CREDENTIAL "305419896"
+
+/**
+ * Console in rest mode on loopback, which turns ready a fixed time after it was woken up.
+ * Its session socket only records when the first packet of the session arrives.
+ */
+typedef struct fake_console_t
+{
+	ChiakiStopPipe stop_pipe;
+	ChiakiThread thread;
+	chiaki_socket_t discovery_sock;
+	chiaki_socket_t session_sock;
+	struct sockaddr_in discovery_addr;
+	struct sockaddr_in session_addr;
+
+	uint64_t ready_delay_ms;
+	uint64_t wakeup_us;
+	uint64_t first_packet_us;
+	size_t wakeups;
+	size_t srchs;
+	bool credential_valid;
+} FakeConsole;
+
+static chiaki_socket_t udp_socket_bind_local(struct sockaddr_in *addr)
+{
+	chiaki_socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert_false(CHIAKI_SOCKET_IS_INVALID(sock));
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	munit_assert_int(bind(sock, (struct sockaddr *)addr, sizeof(*addr)), ==, 0);
+	socklen_t addr_len = sizeof(*addr);
+	munit_assert_int(getsockname(sock, (struct sockaddr *)addr, &addr_len), ==, 0);
+	return sock;
+}
+
+static void fake_console_discovery(FakeConsole *console)
+{
+	char req[512];
+	struct sockaddr_in from;
+	socklen_t from_len = sizeof(from);
+	CHIAKI_SSIZET_TYPE received = recvfrom(console->discovery_sock, (CHIAKI_SOCKET_BUF_TYPE)req, sizeof(req) - 1, 0, (struct sockaddr *)&from, &from_len);
+	if(received <= 0)
+		return;
+	req[received] = '\0';
+
+	if(!strncmp(req, "WAKEUP ", 7))
+	{
+		if(!console->wakeups++)
+			console->wakeup_us = chiaki_time_now_monotonic_us();
+		console->credential_valid = strstr(req, "user-credential:" REGIST_KEY_CREDENTIAL "\n") != NULL;
+		return;
+	}
+	if(strncmp(req, "SRCH ", 5))
+		return;
+	console->srchs++;
+
+	bool ready = console->wakeups
+		&& chiaki_time_now_monotonic_us() - console->wakeup_us >= console->ready_delay_ms * 1000;
+	char resp[256];
+	int len = snprintf(resp, sizeof(resp), "HTTP/1.1 %s\nhost-id:0123456789AB\nhost-type:PS5\nhost-name:Fake\n"
+			"device-discovery-protocol-version:" CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS5 "\n",
+			ready ? "200 Ok" : "620 Server Standby");
+	sendto(console->discovery_sock, (CHIAKI_SOCKET_BUF_TYPE)resp, (size_t)len + 1, 0, (struct sockaddr *)&from, from_len);
+}
+
+static void *fake_console_thread(void *user)
+{
+	FakeConsole *console = user;
+	while(true)
+	{
+		if(chiaki_stop_pipe_select_single(&console->stop_pipe, console->discovery_sock, false, 5) == CHIAKI_ERR_CANCELED)
+			break;
+		fake_console_discovery(console);
+
+		uint8_t buf[64];
+		if(recv(console->session_sock, (CHIAKI_SOCKET_BUF_TYPE)buf, sizeof(buf), 0) > 0 && !console->first_packet_us)
+			console->first_packet_us = chiaki_time_now_monotonic_us();
+	}
+	return NULL;
+}
+
+static void fake_console_start(FakeConsole *console, uint64_t ready_delay_ms)
+{
+	memset(console, 0, sizeof(*console));
+	munit_assert_int(chiaki_lib_init(), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_stop_pipe_init(&console->stop_pipe), ==, CHIAKI_ERR_SUCCESS);
+	console->ready_delay_ms = ready_delay_ms;
+	console->discovery_sock = udp_socket_bind_local(&console->discovery_addr);
+	munit_assert_int(chiaki_socket_set_nonblock(console->discovery_sock, true), ==, CHIAKI_ERR_SUCCESS);
+	console->session_sock = udp_socket_bind_local(&console->session_addr);
+	munit_assert_int(chiaki_socket_set_nonblock(console->session_sock, true), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_thread_create(&console->thread, fake_console_thread, console), ==, CHIAKI_ERR_SUCCESS);
+}
+
+static void fake_console_stop(FakeConsole *console)
+{
+	chiaki_stop_pipe_stop(&console->stop_pipe);
+	chiaki_thread_join(&console->thread, NULL);
+	chiaki_stop_pipe_fini(&console->stop_pipe);
+	CHIAKI_SOCKET_CLOSE(console->discovery_sock);
+	CHIAKI_SOCKET_CLOSE(console->session_sock);
+}
+
+static void wake_options(ChiakiDiscoveryWakeOptions *options, FakeConsole *console)
+{
+	uint64_t credential;
+	munit_assert_int(chiaki_discovery_regist_key_credential(REGIST_KEY, sizeof(REGIST_KEY), &credential), ==, CHIAKI_ERR_SUCCESS);
+	chiaki_discovery_wake_options_default(options, credential, true);
+	options->port = ntohs(console->discovery_addr.sin_port);
+	options->probe_initial_ms = 10;
+	options->probe_max_ms = 100;
+}
+
+static MunitResult test_wake_connect(const MunitParameter params[], void *user)
+{
+	FakeConsole console;
+	fake_console_start(&console, 300);
+
+	ChiakiDiscovery discovery;
+	munit_assert_int(chiaki_discovery_init(&discovery, get_test_log(), AF_INET), ==, CHIAKI_ERR_SUCCESS);
+	ChiakiStopPipe stop_pipe;
+	munit_assert_int(chiaki_stop_pipe_init(&stop_pipe), ==, CHIAKI_ERR_SUCCESS);
+	ChiakiDiscoveryWakeOptions options;
+	wake_options(&options, &console);
+
+	// the discovery port is taken from the options, whatever port the address carries
+	struct sockaddr_in addr = console.discovery_addr;
+	addr.sin_port = htons(9295);
+	ChiakiErrorCode err = chiaki_discovery_wake_wait_ready(&discovery, &stop_pipe, (struct sockaddr *)&addr, sizeof(addr), &options);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// what would be the session request
+	uint8_t first_packet[4] = { 0 };
+	munit_assert_int(sendto(discovery.socket, (CHIAKI_SOCKET_BUF_TYPE)first_packet, sizeof(first_packet), 0,
+			(struct sockaddr *)&console.session_addr, sizeof(console.session_addr)), ==, sizeof(first_packet));
+	uint64_t deadline_ms = chiaki_time_now_monotonic_ms() + 1000;
+	while(!console.first_packet_us && chiaki_time_now_monotonic_ms() < deadline_ms)
+		chiaki_stop_pipe_sleep(&stop_pipe, 5);
+	fake_console_stop(&console);
+	chiaki_stop_pipe_fini(&stop_pipe);
+	chiaki_discovery_fini(&discovery);
+
+	munit_assert_size(console.wakeups, ==, 1);
+	munit_assert_true(console.credential_valid);
+	munit_assert_uint64(console.first_packet_us, !=, 0);
+	uint64_t wake_to_first_packet_ms = (console.first_packet_us - console.wakeup_us) / 1000;
+	munit_logf(MUNIT_LOG_INFO, "wake to first packet %llu ms with the console ready after %llu ms, %zu probes",
+			(unsigned long long)wake_to_first_packet_ms, (unsigned long long)console.ready_delay_ms, console.srchs);
+	munit_assert_uint64(wake_to_first_packet_ms, >=, console.ready_delay_ms);
+	// noticed no later than one backed off probe interval after turning ready
+	munit_assert_uint64(wake_to_first_packet_ms, <, console.ready_delay_ms + options.probe_max_ms + 100);
+	return MUNIT_OK;
+}
+
+static MunitResult test_wake_timeout(const MunitParameter params[], void *user)
+{
+	FakeConsole console;
+	fake_console_start(&console, UINT32_MAX);
+
+	ChiakiDiscovery discovery;
+	munit_assert_int(chiaki_discovery_init(&discovery, get_test_log(), AF_INET), ==, CHIAKI_ERR_SUCCESS);
+	ChiakiStopPipe stop_pipe;
+	munit_assert_int(chiaki_stop_pipe_init(&stop_pipe), ==, CHIAKI_ERR_SUCCESS);
+	ChiakiDiscoveryWakeOptions options;
+	wake_options(&options, &console);
+	options.timeout_ms = 300;
+	options.wakeup_resend_ms = 200;
+
+	uint64_t start_ms = chiaki_time_now_monotonic_ms();
+	ChiakiErrorCode err = chiaki_discovery_wake_wait_ready(&discovery, &stop_pipe, (struct sockaddr *)&console.discovery_addr, sizeof(console.discovery_addr), &options);
+	uint64_t elapsed_ms = chiaki_time_now_monotonic_ms() - start_ms;
+	munit_assert_int(err, ==, CHIAKI_ERR_TIMEOUT);
+	munit_assert_uint64(elapsed_ms, >=, options.timeout_ms);
+	munit_assert_uint64(elapsed_ms, <, options.timeout_ms + 200);
+
+	// stopping interrupts the wait right away
+	chiaki_stop_pipe_stop(&stop_pipe);
+	options.timeout_ms = 10000;
+	start_ms = chiaki_time_now_monotonic_ms();
+	err = chiaki_discovery_wake_wait_ready(&discovery, &stop_pipe, (struct sockaddr *)&console.discovery_addr, sizeof(console.discovery_addr), &options);
+	munit_assert_int(err, ==, CHIAKI_ERR_CANCELED);
+	munit_assert_uint64(chiaki_time_now_monotonic_ms() - start_ms, <, 1000);
+
+	chiaki_stop_pipe_sleep(&console.stop_pipe, 20);
+	fake_console_stop(&console);
+	chiaki_stop_pipe_fini(&stop_pipe);
+	chiaki_discovery_fini(&discovery);
+
+	// 10, 20, 40, 80, 100, 100 ms: backed off instead of probing at the initial rate
+	munit_logf(MUNIT_LOG_INFO, "%zu probes and %zu wakeups until timeout", console.srchs, console.wakeups);
+	munit_assert_size(console.srchs, >=, 4);
+	munit_assert_size(console.srchs, <=, 10);
+	munit_assert_size(console.wakeups, >=, 2);
+	return MUNIT_OK;
+}
+
+static MunitResult test_regist_key_credential(const MunitParameter params[], void *user)
+{
+	uint64_t credential = 0;
+	char regist_key[16] = "0a1B2c3D";
+	munit_assert_int(chiaki_discovery_regist_key_credential(regist_key, sizeof(regist_key), &credential), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint64(credential, ==, 0x0a1b2c3d);
+	munit_assert_int(chiaki_discovery_regist_key_credential("", 1, &credential), ==, CHIAKI_ERR_INVALID_DATA);
+	munit_assert_int(chiaki_discovery_regist_key_credential("123456789", 10, &credential), ==, CHIAKI_ERR_INVALID_DATA);
+	munit_assert_int(chiaki_discovery_regist_key_credential("12x4", 5, &credential), ==, CHIAKI_ERR_INVALID_DATA);
+	return MUNIT_OK;
+}
+
+MunitTest tests_discovery[] = {
+	{
+		"/wake_connect",
+		test_wake_connect,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/wake_timeout",
+		test_wake_timeout,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/regist_key_credential",
+		test_regist_key_credential,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,324 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/discoveryservice.h>
+#include <chiaki/stoppipe.h>
+#include <chiaki/thread.h>
+#include <chiaki/time.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "test_log.h"
+
+#define FAKE_HOSTS_MAX 64
+
+/**
+ * Many consoles behind one socket on loopback, every PS5 search is answered by all present ones.
+ */
+typedef struct fake_hosts_t
+{
+	ChiakiStopPipe stop_pipe;
+	ChiakiThread thread;
+	ChiakiMutex mutex;
+	chiaki_socket_t sock;
+	struct sockaddr_in addr;
+	size_t count;
+	bool present[FAKE_HOSTS_MAX];
+	bool ready[FAKE_HOSTS_MAX];
+} FakeHosts;
+
+typedef struct host_events_t
+{
+	ChiakiMutex mutex;
+	size_t added;
+	size_t changed;
+	size_t removed;
+	size_t batches;
+	size_t hosts_count;
+	char last_changed_id[16];
+	ChiakiDiscoveryHostState last_changed_state;
+} HostEvents;
+
+static void fake_hosts_answer(FakeHosts *hosts)
+{
+	char req[512];
+	struct sockaddr_in from;
+	socklen_t from_len = sizeof(from);
+	CHIAKI_SSIZET_TYPE received = recvfrom(hosts->sock, (CHIAKI_SOCKET_BUF_TYPE)req, sizeof(req) - 1, 0, (struct sockaddr *)&from, &from_len);
+	if(received <= 0)
+		return;
+	req[received] = '\0';
+	if(strncmp(req, "SRCH ", 5) || !strstr(req, CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS5))
+		return;
+
+	chiaki_mutex_lock(&hosts->mutex);
+	for(size_t i=0; i<hosts->count; i++)
+	{
+		if(!hosts->present[i])
+			continue;
+		char resp[256];
+		int len = snprintf(resp, sizeof(resp), "HTTP/1.1 %s\nhost-id:0000000000%02X\nhost-type:PS5\nhost-name:Fake%zu\n"
+				"host-request-port:997\ndevice-discovery-protocol-version:" CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS5 "\n",
+				hosts->ready[i] ? "200 Ok" : "620 Server Standby", (unsigned int)i, i);
+		sendto(hosts->sock, (CHIAKI_SOCKET_BUF_TYPE)resp, (size_t)len + 1, 0, (struct sockaddr *)&from, from_len);
+	}
+	chiaki_mutex_unlock(&hosts->mutex);
+}
+
+static void *fake_hosts_thread(void *user)
+{
+	FakeHosts *hosts = user;
+	while(chiaki_stop_pipe_select_single(&hosts->stop_pipe, hosts->sock, false, UINT64_MAX) == CHIAKI_ERR_SUCCESS)
+		fake_hosts_answer(hosts);
+	return NULL;
+}
+
+static void fake_hosts_start(FakeHosts *hosts, size_t count)
+{
+	memset(hosts, 0, sizeof(*hosts));
+	munit_assert_int(chiaki_lib_init(), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_stop_pipe_init(&hosts->stop_pipe), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_mutex_init(&hosts->mutex, false), ==, CHIAKI_ERR_SUCCESS);
+	hosts->count = count;
+	for(size_t i=0; i<count; i++)
+		hosts->present[i] = true;
+
+	hosts->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert_false(CHIAKI_SOCKET_IS_INVALID(hosts->sock));
+	hosts->addr.sin_family = AF_INET;
+	hosts->addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	munit_assert_int(bind(hosts->sock, (struct sockaddr *)&hosts->addr, sizeof(hosts->addr)), ==, 0);
+	socklen_t addr_len = sizeof(hosts->addr);
+	munit_assert_int(getsockname(hosts->sock, (struct sockaddr *)&hosts->addr, &addr_len), ==, 0);
+	munit_assert_int(chiaki_socket_set_nonblock(hosts->sock, true), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_thread_create(&hosts->thread, fake_hosts_thread, hosts), ==, CHIAKI_ERR_SUCCESS);
+}
+
+static void fake_hosts_stop(FakeHosts *hosts)
+{
+	chiaki_stop_pipe_stop(&hosts->stop_pipe);
+	chiaki_thread_join(&hosts->thread, NULL);
+	chiaki_stop_pipe_fini(&hosts->stop_pipe);
+	chiaki_mutex_fini(&hosts->mutex);
+	CHIAKI_SOCKET_CLOSE(hosts->sock);
+}
+
+static void host_cb(ChiakiDiscoveryServiceHostEvent event, ChiakiDiscoveryHost *host, void *user)
+{
+	HostEvents *events = user;
+	chiaki_mutex_lock(&events->mutex);
+	switch(event)
+	{
+		case CHIAKI_DISCOVERY_SERVICE_HOST_ADDED:
+			events->added++;
+			break;
+		case CHIAKI_DISCOVERY_SERVICE_HOST_CHANGED:
+			events->changed++;
+			snprintf(events->last_changed_id, sizeof(events->last_changed_id), "%s", host->host_id);
+			events->last_changed_state = host->state;
+			break;
+		case CHIAKI_DISCOVERY_SERVICE_HOST_REMOVED:
+			events->removed++;
+			break;
+	}
+	chiaki_mutex_unlock(&events->mutex);
+}
+
+static void hosts_cb(ChiakiDiscoveryHost *hosts, size_t hosts_count, void *user)
+{
+	HostEvents *events = user;
+	chiaki_mutex_lock(&events->mutex);
+	events->batches++;
+	events->hosts_count = hosts_count;
+	chiaki_mutex_unlock(&events->mutex);
+}
+
+static void service_start(ChiakiDiscoveryService *service, FakeHosts *hosts, HostEvents *events, size_t hosts_max, const char *send_host)
+{
+	memset(events, 0, sizeof(*events));
+	munit_assert_int(chiaki_mutex_init(&events->mutex, false), ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiDiscoveryServiceOptions options = { 0 };
+	options.hosts_max = hosts_max;
+	options.host_drop_pings = 3;
+	options.ping_ms = 20;
+	options.ping_initial_ms = 0;
+	struct sockaddr_storage addr;
+	memset(&addr, 0, sizeof(addr));
+	memcpy(&addr, &hosts->addr, sizeof(hosts->addr));
+	options.send_addr = &addr;
+	options.send_addr_size = sizeof(hosts->addr);
+	options.send_host = (char *)send_host;
+	options.ps4_port = ntohs(hosts->addr.sin_port);
+	options.ps5_port = ntohs(hosts->addr.sin_port);
+	options.cb = hosts_cb;
+	options.host_cb = host_cb;
+	options.cb_user = events;
+	munit_assert_int(chiaki_discovery_service_init(service, &options, get_test_log()), ==, CHIAKI_ERR_SUCCESS);
+}
+
+static void service_stop(ChiakiDiscoveryService *service, HostEvents *events)
+{
+	chiaki_discovery_service_fini(service);
+	chiaki_mutex_fini(&events->mutex);
+}
+
+static void sleep_ms(uint64_t ms)
+{
+	ChiakiStopPipe sleep_pipe;
+	munit_assert_int(chiaki_stop_pipe_init(&sleep_pipe), ==, CHIAKI_ERR_SUCCESS);
+	chiaki_stop_pipe_sleep(&sleep_pipe, ms);
+	chiaki_stop_pipe_fini(&sleep_pipe);
+}
+
+static bool wait_for(HostEvents *events, size_t *counter, size_t value, uint64_t timeout_ms)
+{
+	uint64_t start = chiaki_time_now_monotonic_ms();
+	while(chiaki_time_now_monotonic_ms() - start < timeout_ms)
+	{
+		chiaki_mutex_lock(&events->mutex);
+		bool reached = *counter >= value;
+		chiaki_mutex_unlock(&events->mutex);
+		if(reached)
+			return true;
+		sleep_ms(5);
+	}
+	return false;
+}
+
+static MunitResult test_deltas(const MunitParameter params[], void *user)
+{
+	FakeHosts hosts;
+	fake_hosts_start(&hosts, FAKE_HOSTS_MAX);
+	HostEvents events;
+	ChiakiDiscoveryService service;
+	service_start(&service, &hosts, &events, FAKE_HOSTS_MAX + 16, NULL);
+
+	munit_assert_true(wait_for(&events, &events.added, FAKE_HOSTS_MAX, 2000));
+
+	// hosts answering the same on every ping are no news
+	sleep_ms(200);
+	chiaki_mutex_lock(&events.mutex);
+	munit_assert_size(events.added, ==, FAKE_HOSTS_MAX);
+	munit_assert_size(events.changed, ==, 0);
+	munit_assert_size(events.removed, ==, 0);
+	munit_assert_size(events.hosts_count, ==, FAKE_HOSTS_MAX);
+	munit_logf(MUNIT_LOG_INFO, "%d hosts were reported in %zu batches", FAKE_HOSTS_MAX, events.batches);
+	chiaki_mutex_unlock(&events.mutex);
+
+	chiaki_mutex_lock(&hosts.mutex);
+	hosts.ready[42] = true;
+	chiaki_mutex_unlock(&hosts.mutex);
+	munit_assert_true(wait_for(&events, &events.changed, 1, 1000));
+	sleep_ms(100);
+	chiaki_mutex_lock(&events.mutex);
+	munit_assert_size(events.changed, ==, 1);
+	munit_assert_string_equal(events.last_changed_id, "00000000002A");
+	munit_assert_int(events.last_changed_state, ==, CHIAKI_DISCOVERY_HOST_STATE_READY);
+	chiaki_mutex_unlock(&events.mutex);
+
+	chiaki_mutex_lock(&hosts.mutex);
+	for(size_t i=0; i<4; i++)
+		hosts.present[i * 16] = false;
+	chiaki_mutex_unlock(&hosts.mutex);
+	munit_assert_true(wait_for(&events, &events.removed, 4, 1000));
+	sleep_ms(100);
+	chiaki_mutex_lock(&events.mutex);
+	munit_assert_size(events.removed, ==, 4);
+	munit_assert_size(events.added, ==, FAKE_HOSTS_MAX);
+	munit_assert_size(events.changed, ==, 1);
+	munit_assert_size(events.hosts_count, ==, FAKE_HOSTS_MAX - 4);
+	chiaki_mutex_unlock(&events.mutex);
+
+	// hosts that moved around in the table after removals are still found by their id
+	chiaki_mutex_lock(&hosts.mutex);
+	hosts.present[16] = true;
+	hosts.ready[FAKE_HOSTS_MAX - 1] = true;
+	chiaki_mutex_unlock(&hosts.mutex);
+	munit_assert_true(wait_for(&events, &events.changed, 2, 1000));
+	munit_assert_true(wait_for(&events, &events.added, FAKE_HOSTS_MAX + 1, 1000));
+	sleep_ms(100);
+	chiaki_mutex_lock(&events.mutex);
+	munit_assert_size(events.added, ==, FAKE_HOSTS_MAX + 1);
+	munit_assert_size(events.changed, ==, 2);
+	munit_assert_size(events.hosts_count, ==, FAKE_HOSTS_MAX - 3);
+	chiaki_mutex_unlock(&events.mutex);
+
+	service_stop(&service, &events);
+	fake_hosts_stop(&hosts);
+	return MUNIT_OK;
+}
+
+static MunitResult test_hosts_max(const MunitParameter params[], void *user)
+{
+	FakeHosts hosts;
+	fake_hosts_start(&hosts, FAKE_HOSTS_MAX);
+	HostEvents events;
+	ChiakiDiscoveryService service;
+	service_start(&service, &hosts, &events, 16, NULL);
+
+	munit_assert_true(wait_for(&events, &events.added, 16, 2000));
+	sleep_ms(100);
+	chiaki_mutex_lock(&events.mutex);
+	munit_assert_size(events.added, ==, 16);
+	munit_assert_size(events.removed, ==, 0);
+	munit_assert_size(events.hosts_count, ==, 16);
+	chiaki_mutex_unlock(&events.mutex);
+
+	service_stop(&service, &events);
+	fake_hosts_stop(&hosts);
+	return MUNIT_OK;
+}
+
+static MunitResult test_resolve(const MunitParameter params[], void *user)
+{
+	FakeHosts hosts;
+	fake_hosts_start(&hosts, 1);
+	HostEvents events;
+	ChiakiDiscoveryService service;
+	service_start(&service, &hosts, &events, 4, "127.0.0.1");
+
+	munit_assert_true(wait_for(&events, &events.added, 1, 2000));
+
+	service_stop(&service, &events);
+	fake_hosts_stop(&hosts);
+	return MUNIT_OK;
+}
+
+MunitTest tests_discovery_service[] = {
+	{
+		"/deltas",
+		test_deltas,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/hosts_max",
+		test_hosts_max,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/resolve",
+		test_resolve,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
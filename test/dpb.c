@@ -0,0 +1,375 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/dpb.h>
+#include <chiaki/bitstream.h>
+#include <chiaki/videoreceiver.h>
+#include <chiaki/session.h>
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "test_log.h"
+
+#define ARRAY_SIZE(a) sizeof(a) / sizeof(a[0])
+
+static const uint8_t header_h265[] = {
+	0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0c, 0x01, 0xff, 0xff, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
+	0xb0, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x96, 0x0a, 0xc0, 0x90, 0x00, 0x00, 0x00, 0x01,
+	0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0xb0, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
+	0x00, 0x96, 0xa0, 0x03, 0xc0, 0x80, 0x11, 0x07, 0xcb, 0xc2, 0xb9, 0x24, 0x29, 0x52, 0x70, 0x16,
+	0xa0, 0x20, 0x20, 0x20, 0x80, 0x00, 0x07, 0xd2, 0x00, 0x01, 0xd4, 0xc0, 0x20, 0xe5, 0xa1, 0xe3,
+	0xd0, 0x00, 0x00, 0x00, 0x01, 0x44, 0x01, 0xc0, 0xf3, 0xc0, 0x4c, 0x90,
+};
+
+// P slice with an RPS of the 9 previous frames, referencing the previous one
+static const uint8_t slice_p_h265[] = {
+	0x00, 0x00, 0x00, 0x01, 0x02, 0x01, 0xd2, 0x85, 0x7a, 0xaa, 0xa6, 0x08, 0x60, 0x13, 0x55, 0x17,
+	0x6b, 0x71, 0x72, 0xf9, 0x6e, 0xd4, 0xf2, 0x66, 0x78, 0x0c, 0x12, 0xe7, 0x79, 0xf0, 0xbc, 0xc9,
+};
+
+static MunitResult test_dpb_window(const MunitParameter params[], void *fixture)
+{
+	ChiakiDpb dpb;
+	chiaki_dpb_init(&dpb, CHIAKI_CODEC_H264);
+	chiaki_dpb_set_max_ref_frames(&dpb, 4);
+
+	ChiakiBitstreamSlice slice_i = { 0 };
+	slice_i.slice_type = CHIAKI_BITSTREAM_SLICE_I;
+	ChiakiBitstreamSlice slice_p = { 0 };
+	slice_p.slice_type = CHIAKI_BITSTREAM_SLICE_P;
+	slice_p.reference_frame_bits = 3; // abs_diff_pic_num_minus1 1 and 2 can be rewritten in place
+
+	// wraps around
+	chiaki_dpb_add(&dpb, 0xfffe, &slice_i);
+	chiaki_dpb_add(&dpb, 0xffff, &slice_p);
+	chiaki_dpb_add(&dpb, 0, &slice_p);
+	munit_assert(chiaki_dpb_has(&dpb, 0xfffe));
+	munit_assert(chiaki_dpb_has(&dpb, 0));
+	munit_assert(!chiaki_dpb_has(&dpb, 1));
+	munit_assert(!chiaki_dpb_has(&dpb, (ChiakiSeqNum16)(0xfffe + CHIAKI_DPB_SIZE)));
+
+	// frame 1 lost, frame 2 can go back to 0, 0xffff or 0xfffe
+	unsigned candidates[CHIAKI_DPB_SIZE];
+	munit_assert(chiaki_dpb_can_recover(&dpb, 1));
+	munit_assert_size(chiaki_dpb_reference_candidates(&dpb, 2, &slice_p, candidates, CHIAKI_DPB_SIZE), ==, 3);
+	munit_assert_uint(candidates[0], ==, 1);
+	munit_assert_uint(candidates[1], ==, 2);
+	munit_assert_uint(candidates[2], ==, 3);
+	munit_assert_uint16(chiaki_dpb_reference_frame_index(&dpb, 2, &slice_p, candidates[0]), ==, 0);
+
+	// only 0 is still in the encoder's window for frame 4
+	munit_assert_size(chiaki_dpb_reference_candidates(&dpb, 4, &slice_p, candidates, CHIAKI_DPB_SIZE), ==, 1);
+	munit_assert(!chiaki_dpb_can_recover(&dpb, 4));
+
+	// frame 2 lost, frame 3 can go back to 0 (abs_diff_pic_num_minus1 2), but not to 0xffff (3, longer code)
+	munit_assert(chiaki_dpb_can_recover(&dpb, 2));
+	// slices without ref_pic_list_modification can't go anywhere
+	slice_p.reference_frame_bits = 0;
+	chiaki_dpb_add(&dpb, 0, &slice_p);
+	munit_assert(!chiaki_dpb_can_recover(&dpb, 1));
+
+	chiaki_dpb_add(&dpb, 1, &slice_i);
+	munit_assert(chiaki_dpb_has(&dpb, 1));
+	munit_assert(!chiaki_dpb_has(&dpb, 0));
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_dpb_rps(const MunitParameter params[], void *fixture)
+{
+	ChiakiDpb dpb;
+	chiaki_dpb_init(&dpb, CHIAKI_CODEC_H265);
+
+	ChiakiBitstreamSlice slice = { 0 };
+	slice.slice_type = CHIAKI_BITSTREAM_SLICE_I;
+	chiaki_dpb_add(&dpb, 10, &slice);
+
+	slice.slice_type = CHIAKI_BITSTREAM_SLICE_P;
+	slice.ref_pics_count = 1;
+	slice.ref_pics[0] = 1;
+	chiaki_dpb_add(&dpb, 11, &slice);
+	chiaki_dpb_add(&dpb, 12, &slice);
+
+	// the encoder only keeps what the RPS of the last frame lists
+	munit_assert(!chiaki_dpb_has(&dpb, 10));
+	munit_assert(chiaki_dpb_has(&dpb, 11));
+	munit_assert(chiaki_dpb_has(&dpb, 12));
+
+	slice.ref_pics_count = 3;
+	slice.ref_pics[0] = 1;
+	slice.ref_pics[1] = 2;
+	slice.ref_pics[2] = 4;
+	unsigned candidates[CHIAKI_DPB_SIZE];
+	munit_assert_size(chiaki_dpb_reference_candidates(&dpb, 14, &slice, candidates, CHIAKI_DPB_SIZE), ==, 1);
+	munit_assert_uint(candidates[0], ==, 1);
+
+	return MUNIT_OK;
+}
+
+// H265 IDR slice to answer IDR requests with
+static const uint8_t slice_i_h265[] = {
+	0x00, 0x00, 0x00, 0x01, 0x28, 0x01, 0xac, 0x25, 0xcf, 0x83, 0xff, 0x23, 0x54, 0xab, 0x5c, 0xf5,
+	0x7a, 0x06, 0x7c, 0x3f, 0x31, 0x9b, 0xe6, 0x10, 0x57, 0xe8, 0x0e, 0xcf, 0xdd, 0xda, 0xdb, 0x3f,
+};
+
+static const uint8_t header_h264[] = {
+	0x00, 0x00, 0x00, 0x01, 0x67, 0x4d, 0x40, 0x32, 0x91, 0x8a, 0x01, 0xe0, 0x08, 0x9f, 0x97, 0x01,
+	0x6a, 0x02, 0x02, 0x02, 0x80, 0x00, 0x03, 0xe9, 0x00, 0x01, 0xd4, 0xc0, 0x44, 0xd0, 0xf1, 0xf1,
+	0x50, 0x00, 0x00, 0x00, 0x01, 0x68, 0xee, 0x3c, 0x80,
+};
+
+static const uint8_t slice_i_h264[] = {
+	0x00, 0x00, 0x00, 0x01, 0x65, 0x88, 0x80, 0x82, 0x1f, 0x00, 0x49, 0xee, 0x03, 0x29, 0xff, 0xf8,
+	0x7f, 0x88, 0x46, 0x44, 0x77, 0x17, 0xe7, 0x6d, 0xb3, 0xad, 0x38, 0x19, 0x74, 0x5a, 0xf1, 0x51,
+};
+
+// P slice referencing the previous frame, without ref_pic_list_modification
+static const uint8_t slice_p_h264[] = {
+	0x00, 0x00, 0x00, 0x01, 0x41, 0x9a, 0x04, 0x44, 0x3f, 0x41, 0x5b, 0xf4, 0x65, 0xb4, 0x3e, 0x1a,
+	0xd3, 0xa0, 0x28, 0x1f, 0x83, 0x63, 0x0e, 0xc2, 0xfc, 0x9d, 0x7a, 0xc7, 0xc4, 0x7d, 0xf9, 0x18,
+};
+
+// every frame is sent as 2 source units and 1 fec unit, a lost frame only delivers its first unit
+#define REPLAY_UNIT_SLICE_SIZE 16
+#define REPLAY_UNITS_SOURCE 2
+
+typedef struct replay_t
+{
+	ChiakiSession session;
+	ChiakiVideoReceiver video_receiver;
+	chiaki_socket_t sock;
+	size_t samples;
+	size_t samples_recovered;
+	size_t fec_failures;
+	size_t fec_failures_idr_deferred;
+	size_t fec_failures_idr_sent;
+} Replay;
+
+static bool replay_video_sample_cb(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered, void *user)
+{
+	Replay *replay = user;
+	replay->samples++;
+	if(frame_recovered)
+		replay->samples_recovered++;
+	return true;
+}
+
+static void replay_event_cb(ChiakiEvent *event, void *user)
+{
+	Replay *replay = user;
+	if(event->type != CHIAKI_EVENT_VIDEO_FEC_FAILURE)
+		return;
+	replay->fec_failures++;
+	if(event->video_fec_failure.idr_deferred)
+		replay->fec_failures_idr_deferred++;
+	if(event->video_fec_failure.idr_request_sent)
+		replay->fec_failures_idr_sent++;
+}
+
+static void replay_init(Replay *replay, ChiakiCodec codec, const uint8_t *header, size_t header_size)
+{
+	memset(replay, 0, sizeof(*replay));
+	ChiakiSession *session = &replay->session;
+	session->log = get_test_log();
+	session->connect_info.video_profile.codec = codec;
+	session->connect_info.enable_idr_on_fec_failure = true;
+	chiaki_session_set_video_sample_cb(session, replay_video_sample_cb, replay);
+	chiaki_session_set_event_cb(session, replay_event_cb, replay);
+
+	// IDR requests and corrupt frame reports end up on a local socket talking to itself
+	replay->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert_false(CHIAKI_SOCKET_IS_INVALID(replay->sock));
+	struct sockaddr_in addr = { 0 };
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	munit_assert_int(bind(replay->sock, (struct sockaddr *)&addr, sizeof(addr)), ==, 0);
+	socklen_t addr_len = sizeof(addr);
+	munit_assert_int(getsockname(replay->sock, (struct sockaddr *)&addr, &addr_len), ==, 0);
+	munit_assert_int(connect(replay->sock, (struct sockaddr *)&addr, sizeof(addr)), ==, 0);
+
+	// just the parts of a takion that sending messages needs
+	ChiakiStreamConnection *stream_connection = &session->stream_connection;
+	stream_connection->log = session->log;
+	ChiakiTakion *takion = &stream_connection->takion;
+	takion->log = session->log;
+	takion->sock = replay->sock;
+	munit_assert_int(chiaki_mutex_init(&takion->gkcrypt_local_mutex, true), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_mutex_init(&takion->seq_num_local_mutex, false), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_takion_send_buffer_init(&takion->send_buffer, takion, 0x400), ==, CHIAKI_ERR_SUCCESS);
+
+	chiaki_video_receiver_init(&replay->video_receiver, session, NULL);
+	ChiakiVideoProfile profile = { 0 };
+	profile.width = 1920;
+	profile.height = 1080;
+	profile.header = malloc(header_size); // owned by the video receiver
+	munit_assert_not_null(profile.header);
+	memcpy(profile.header, header, header_size);
+	profile.header_sz = header_size;
+	chiaki_video_receiver_stream_info(&replay->video_receiver, &profile, 1);
+}
+
+static void replay_fini(Replay *replay)
+{
+	ChiakiTakion *takion = &replay->session.stream_connection.takion;
+	chiaki_video_receiver_fini(&replay->video_receiver);
+	chiaki_takion_send_buffer_fini(&takion->send_buffer);
+	chiaki_mutex_fini(&takion->seq_num_local_mutex);
+	chiaki_mutex_fini(&takion->gkcrypt_local_mutex);
+	CHIAKI_SOCKET_CLOSE(replay->sock);
+}
+
+static void replay_frame(Replay *replay, ChiakiSeqNum16 frame_index, const uint8_t *slice, bool lost)
+{
+	for(uint16_t unit_index=0; unit_index<(lost ? 1 : REPLAY_UNITS_SOURCE); unit_index++)
+	{
+		uint8_t unit[2 + REPLAY_UNIT_SLICE_SIZE] = { 0 }; // no padding
+		memcpy(unit + 2, slice + unit_index * REPLAY_UNIT_SLICE_SIZE, REPLAY_UNIT_SLICE_SIZE);
+
+		ChiakiTakionAVPacket packet = { 0 };
+		packet.is_video = true;
+		packet.frame_index = frame_index;
+		packet.unit_index = unit_index;
+		packet.units_in_frame_total = REPLAY_UNITS_SOURCE + 1;
+		packet.units_in_frame_fec = 1;
+		packet.data = unit;
+		packet.data_size = sizeof(unit);
+		chiaki_video_receiver_av_packet(&replay->video_receiver, &packet);
+	}
+}
+
+/**
+ * Replay recorded frames with injected loss through the video receiver and check
+ * that most losses are recovered by retargeting instead of requesting an IDR.
+ */
+static MunitResult test_dpb_replay_loss(const MunitParameter params[], void *fixture)
+{
+	static Replay replay;
+	replay_init(&replay, CHIAKI_CODEC_H265, header_h265, sizeof(header_h265));
+
+	size_t frames_lost = 0;
+	size_t frames_sent = 1;
+	uint32_t rng = 1337;
+
+	replay_frame(&replay, 1, slice_i_h265, false);
+	for(ChiakiSeqNum16 frame_index=2; frame_index<2000; frame_index++)
+	{
+		rng = rng * 1103515245 + 12345;
+		// ~3% random loss, plus a burst longer than the RPS
+		bool lost = ((rng >> 16) % 100) < 3 || (frame_index >= 1000 && frame_index < 1012);
+		if(lost)
+			frames_lost++;
+		else
+			frames_sent++;
+		// the encoder answers an IDR request with the next frame
+		bool idr = chiaki_video_receiver_get_waiting_for_idr(&replay.video_receiver);
+		replay_frame(&replay, frame_index, idr ? slice_i_h265 : slice_p_h265, lost);
+	}
+	// a loss is only detected once the next frame arrives
+	replay_frame(&replay, 2000, slice_p_h265, false);
+	frames_sent++;
+
+	ChiakiVideoReceiverRecoveryStats stats;
+	chiaki_video_receiver_get_recovery_stats(&replay.video_receiver, &stats);
+	munit_logf(MUNIT_LOG_INFO, "frames lost: %zu, recovered: %llu, IDR requests: %llu, IDR requests avoided: %llu",
+			frames_lost, (unsigned long long)stats.frames_recovered_total,
+			(unsigned long long)stats.idr_requests_total, (unsigned long long)stats.idr_requests_avoided_total);
+
+	munit_assert_size(frames_lost, >, 50);
+	munit_assert_size(replay.fec_failures, ==, frames_lost);
+	munit_assert_uint64(stats.frames_recovered_total, ==, replay.samples_recovered);
+	munit_assert_uint64(stats.frames_recovered_total, >, 0);
+	munit_assert_uint64(stats.idr_requests_avoided_total, >, 0);
+	// the burst exceeds the RPS, so at least that one must be an IDR
+	munit_assert_uint64(stats.idr_requests_total, >=, 1);
+	munit_assert_uint64(stats.idr_requests_total, <, frames_lost / 10);
+	// only frames skipped while waiting for an IDR don't reach the decoder
+	munit_assert_size(replay.samples, <=, frames_sent + 1); // + header
+	munit_assert_size(replay.samples, >=, frames_sent + 1 - stats.idr_requests_total * 2);
+
+	replay_fini(&replay);
+	return MUNIT_OK;
+}
+
+/**
+ * H264 slices without ref_pic_list_modification can't be retargeted,
+ * so the IDR must be requested right away when the frame is lost.
+ */
+static MunitResult test_dpb_replay_loss_h264(const MunitParameter params[], void *fixture)
+{
+	static Replay replay;
+	replay_init(&replay, CHIAKI_CODEC_H264, header_h264, sizeof(header_h264));
+
+	replay_frame(&replay, 1, slice_i_h264, false);
+	for(ChiakiSeqNum16 frame_index=2; frame_index<10; frame_index++)
+		replay_frame(&replay, frame_index, slice_p_h264, false);
+	munit_assert_size(replay.samples, ==, 10); // + header
+	munit_assert_false(chiaki_video_receiver_get_waiting_for_idr(&replay.video_receiver));
+
+	replay_frame(&replay, 10, slice_p_h264, true);
+	// the FEC failure of frame 10 is only detected once frame 11 arrives, which must not be decoded anymore
+	replay_frame(&replay, 11, slice_p_h264, false);
+	munit_assert_size(replay.fec_failures, ==, 1);
+	munit_assert_size(replay.fec_failures_idr_deferred, ==, 0);
+	munit_assert_size(replay.fec_failures_idr_sent, ==, 1);
+	munit_assert(chiaki_video_receiver_get_waiting_for_idr(&replay.video_receiver));
+	munit_assert_size(replay.samples, ==, 10);
+
+	replay_frame(&replay, 12, slice_i_h264, false);
+	replay_frame(&replay, 13, slice_p_h264, false);
+	munit_assert_false(chiaki_video_receiver_get_waiting_for_idr(&replay.video_receiver));
+	munit_assert_size(replay.samples, ==, 12);
+
+	ChiakiVideoReceiverRecoveryStats stats;
+	chiaki_video_receiver_get_recovery_stats(&replay.video_receiver, &stats);
+	munit_assert_uint64(stats.idr_requests_total, ==, 1);
+	munit_assert_uint64(stats.idr_requests_avoided_total, ==, 0);
+	munit_assert_uint64(stats.frames_recovered_total, ==, 0);
+
+	replay_fini(&replay);
+	return MUNIT_OK;
+}
+
+MunitTest tests_dpb[] = {
+	{
+		"/window",
+		test_dpb_window,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/rps",
+		test_dpb_rps,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/replay_loss",
+		test_dpb_replay_loss,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/replay_loss_h264",
+		test_dpb_replay_loss_h264,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,308 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/executor.h>
+#include <chiaki/stoppipe.h>
+#include <chiaki/time.h>
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "test_log.h"
+
+#define SESSIONS_MAX 64
+#define SESSION_CONGESTION_INTERVAL_MS 20
+#define SESSION_RESEND_INTERVAL_MS 10
+#define SESSION_RUN_MS 500
+
+static void sleep_ms(uint64_t ms)
+{
+	ChiakiStopPipe sleep_pipe;
+	munit_assert_int(chiaki_stop_pipe_init(&sleep_pipe), ==, CHIAKI_ERR_SUCCESS);
+	chiaki_stop_pipe_sleep(&sleep_pipe, ms);
+	chiaki_stop_pipe_fini(&sleep_pipe);
+}
+
+typedef struct order_task_t
+{
+	ChiakiExecutorTask task;
+	ChiakiMutex *mutex;
+	int *order;
+	size_t *order_count;
+	int id;
+} OrderTask;
+
+static void order_task_cb(void *user)
+{
+	OrderTask *t = user;
+	chiaki_mutex_lock(t->mutex);
+	t->order[(*t->order_count)++] = t->id;
+	chiaki_mutex_unlock(t->mutex);
+}
+
+static MunitResult test_order(const MunitParameter params[], void *user)
+{
+	ChiakiExecutor executor;
+	munit_assert_int(chiaki_executor_init(&executor, get_test_log(), 1), ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiMutex mutex;
+	chiaki_mutex_init(&mutex, false);
+	int order[8];
+	size_t order_count = 0;
+	const uint64_t delays[] = { 60, 20, 100, 40, 80 };
+	OrderTask tasks[5];
+	for(size_t i=0; i<5; i++)
+	{
+		tasks[i].mutex = &mutex;
+		tasks[i].order = order;
+		tasks[i].order_count = &order_count;
+		tasks[i].id = (int)i;
+		chiaki_executor_task_init(&tasks[i].task, order_task_cb, &tasks[i]);
+		munit_assert_int(chiaki_executor_schedule(&executor, &tasks[i].task, delays[i], 0), ==, CHIAKI_ERR_SUCCESS);
+	}
+	// moving a scheduled task replaces its old time
+	munit_assert_int(chiaki_executor_schedule(&executor, &tasks[2].task, 10, 0), ==, CHIAKI_ERR_SUCCESS);
+
+	sleep_ms(200);
+	chiaki_mutex_lock(&mutex);
+	munit_assert_size(order_count, ==, 5);
+	const int expected[] = { 2, 1, 3, 0, 4 };
+	for(size_t i=0; i<5; i++)
+		munit_assert_int(order[i], ==, expected[i]);
+	chiaki_mutex_unlock(&mutex);
+
+	for(size_t i=0; i<5; i++)
+	{
+		munit_assert_uint64(tasks[i].task.runs, ==, 1);
+		chiaki_executor_cancel(&executor, &tasks[i].task);
+	}
+	chiaki_executor_fini(&executor);
+	chiaki_mutex_fini(&mutex);
+	return MUNIT_OK;
+}
+
+typedef struct slow_task_t
+{
+	ChiakiExecutorTask task;
+	ChiakiExecutor *executor;
+	uint64_t self_reschedules;
+	volatile bool inside;
+	volatile bool overlapped;
+} SlowTask;
+
+static void slow_task_cb(void *user)
+{
+	SlowTask *t = user;
+	if(t->inside)
+		t->overlapped = true;
+	t->inside = true;
+	sleep_ms(5);
+	if(t->self_reschedules)
+	{
+		t->self_reschedules--;
+		chiaki_executor_schedule(t->executor, &t->task, 0, 0);
+	}
+	t->inside = false;
+}
+
+static MunitResult test_periodic_cancel(const MunitParameter params[], void *user)
+{
+	ChiakiExecutor executor;
+	munit_assert_int(chiaki_executor_init(&executor, get_test_log(), 4), ==, CHIAKI_ERR_SUCCESS);
+
+	// a periodic task that takes longer than its interval never runs on two threads at once
+	SlowTask periodic = { 0 };
+	periodic.executor = &executor;
+	chiaki_executor_task_init(&periodic.task, slow_task_cb, &periodic);
+	munit_assert_int(chiaki_executor_schedule(&executor, &periodic.task, 0, 1), ==, CHIAKI_ERR_SUCCESS);
+
+	SlowTask self = { 0 };
+	self.executor = &executor;
+	self.self_reschedules = 5;
+	chiaki_executor_task_init(&self.task, slow_task_cb, &self);
+	munit_assert_int(chiaki_executor_schedule(&executor, &self.task, 0, 0), ==, CHIAKI_ERR_SUCCESS);
+
+	sleep_ms(100);
+	chiaki_executor_cancel(&executor, &periodic.task);
+	munit_assert_false(periodic.inside);
+	uint64_t runs = periodic.task.runs;
+	munit_assert_uint64(runs, >=, 3);
+	munit_assert_false(periodic.overlapped);
+	sleep_ms(30);
+	munit_assert_uint64(periodic.task.runs, ==, runs);
+
+	munit_assert_uint64(self.task.runs, ==, 6);
+	munit_assert_false(self.overlapped);
+	chiaki_executor_cancel(&executor, &self.task);
+
+	chiaki_executor_fini(&executor);
+	return MUNIT_OK;
+}
+
+/**
+ * Stand-in for a session with the two periodic jobs it can hand to an executor,
+ * talking to a mock console on loopback.
+ */
+typedef struct mock_session_t
+{
+	chiaki_socket_t sock;
+	struct sockaddr_in console_addr;
+	ChiakiExecutorTask congestion_task;
+	ChiakiExecutorTask resend_task;
+	uint32_t id;
+	uint64_t lateness_max_ms;
+	uint64_t lateness_sum_ms;
+} MockSession;
+
+static void mock_session_run(MockSession *session, ChiakiExecutorTask *task)
+{
+	uint64_t lateness = chiaki_time_now_monotonic_ms() - task->due_ms;
+	if(lateness > session->lateness_max_ms)
+		session->lateness_max_ms = lateness;
+	session->lateness_sum_ms += lateness;
+	uint32_t msg = session->id;
+	sendto(session->sock, (CHIAKI_SOCKET_BUF_TYPE)&msg, sizeof(msg), 0, (struct sockaddr *)&session->console_addr, sizeof(session->console_addr));
+}
+
+static void mock_session_congestion(void *user)
+{
+	MockSession *session = user;
+	mock_session_run(session, &session->congestion_task);
+}
+
+static void mock_session_resend(void *user)
+{
+	MockSession *session = user;
+	mock_session_run(session, &session->resend_task);
+}
+
+static chiaki_socket_t udp_socket_bind_local(struct sockaddr_in *addr)
+{
+	chiaki_socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert_false(CHIAKI_SOCKET_IS_INVALID(sock));
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	munit_assert_int(bind(sock, (struct sockaddr *)addr, sizeof(*addr)), ==, 0);
+	socklen_t addr_len = sizeof(*addr);
+	munit_assert_int(getsockname(sock, (struct sockaddr *)addr, &addr_len), ==, 0);
+	return sock;
+}
+
+static void scaling_run(size_t sessions_count)
+{
+	ChiakiExecutor executor;
+	munit_assert_int(chiaki_executor_init(&executor, get_test_log(), 0), ==, CHIAKI_ERR_SUCCESS);
+
+	struct sockaddr_in console_addr;
+	chiaki_socket_t console = udp_socket_bind_local(&console_addr);
+	munit_assert_int(chiaki_socket_set_nonblock(console, true), ==, CHIAKI_ERR_SUCCESS);
+
+	MockSession *sessions = calloc(sessions_count, sizeof(MockSession));
+	munit_assert_not_null(sessions);
+	for(size_t i=0; i<sessions_count; i++)
+	{
+		MockSession *session = &sessions[i];
+		struct sockaddr_in addr;
+		session->sock = udp_socket_bind_local(&addr);
+		session->console_addr = console_addr;
+		session->id = (uint32_t)i;
+		chiaki_executor_task_init(&session->congestion_task, mock_session_congestion, session);
+		chiaki_executor_task_init(&session->resend_task, mock_session_resend, session);
+		munit_assert_int(chiaki_executor_schedule(&executor, &session->congestion_task, SESSION_CONGESTION_INTERVAL_MS, SESSION_CONGESTION_INTERVAL_MS), ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_int(chiaki_executor_schedule(&executor, &session->resend_task, SESSION_RESEND_INTERVAL_MS, SESSION_RESEND_INTERVAL_MS), ==, CHIAKI_ERR_SUCCESS);
+	}
+
+	// the mock console counts what arrives from every session
+	size_t received[SESSIONS_MAX] = { 0 };
+	ChiakiStopPipe stop_pipe;
+	munit_assert_int(chiaki_stop_pipe_init(&stop_pipe), ==, CHIAKI_ERR_SUCCESS);
+	uint64_t start_ms = chiaki_time_now_monotonic_ms();
+	uint64_t now_ms;
+	while((now_ms = chiaki_time_now_monotonic_ms()) - start_ms < SESSION_RUN_MS)
+	{
+		if(chiaki_stop_pipe_select_single(&stop_pipe, console, false, SESSION_RUN_MS - (now_ms - start_ms)) != CHIAKI_ERR_SUCCESS)
+			continue;
+		uint32_t msg;
+		while(recv(console, (CHIAKI_SOCKET_BUF_TYPE)&msg, sizeof(msg), 0) == sizeof(msg))
+		{
+			if(msg < sessions_count)
+				received[msg]++;
+		}
+	}
+	chiaki_stop_pipe_fini(&stop_pipe);
+
+	uint64_t lateness_max = 0;
+	uint64_t lateness_sum = 0;
+	uint64_t runs = 0;
+	size_t received_min = SIZE_MAX;
+	for(size_t i=0; i<sessions_count; i++)
+	{
+		MockSession *session = &sessions[i];
+		chiaki_executor_cancel(&executor, &session->congestion_task);
+		chiaki_executor_cancel(&executor, &session->resend_task);
+		CHIAKI_SOCKET_CLOSE(session->sock);
+		if(session->lateness_max_ms > lateness_max)
+			lateness_max = session->lateness_max_ms;
+		lateness_sum += session->lateness_sum_ms;
+		runs += session->congestion_task.runs + session->resend_task.runs;
+		if(received[i] < received_min)
+			received_min = received[i];
+	}
+
+	munit_logf(MUNIT_LOG_INFO, "%2zu sessions on %zu threads instead of %3zu: %llu runs, lateness avg %.2f ms max %llu ms, min packets per session %zu",
+			sessions_count, executor.threads_count, sessions_count * 2, (unsigned long long)runs,
+			runs ? (double)lateness_sum / (double)runs : 0.0, (unsigned long long)lateness_max, received_min);
+
+	// every session kept sending at roughly its rate
+	size_t expected = SESSION_RUN_MS / SESSION_CONGESTION_INTERVAL_MS + SESSION_RUN_MS / SESSION_RESEND_INTERVAL_MS;
+	munit_assert_size(received_min, >=, expected / 2);
+
+	free(sessions);
+	CHIAKI_SOCKET_CLOSE(console);
+	chiaki_executor_fini(&executor);
+}
+
+static MunitResult test_scaling(const MunitParameter params[], void *user)
+{
+	munit_assert_int(chiaki_lib_init(), ==, CHIAKI_ERR_SUCCESS);
+	for(size_t sessions_count=1; sessions_count<=SESSIONS_MAX; sessions_count*=4)
+		scaling_run(sessions_count);
+	return MUNIT_OK;
+}
+
+MunitTest tests_executor[] = {
+	{
+		"/order",
+		test_order,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/periodic_cancel",
+		test_periodic_cancel,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/scaling",
+		test_scaling,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/framemailbox.h>
+#include <chiaki/thread.h>
+
+#include <string.h>
+
+#define STRESS_FRAMES 200000
+#define FRAME_WORDS 256
+
+static MunitResult test_protocol(const MunitParameter params[], void *user)
+{
+	ChiakiFrameMailbox mailbox;
+	chiaki_frame_mailbox_init(&mailbox);
+
+	bool fresh = true;
+	munit_assert_int(chiaki_frame_mailbox_acquire(&mailbox, &fresh), ==, -1);
+	munit_assert_false(fresh);
+
+	unsigned int slot = chiaki_frame_mailbox_write_slot(&mailbox);
+	chiaki_frame_mailbox_publish(&mailbox);
+	munit_assert_uint(chiaki_frame_mailbox_write_slot(&mailbox), !=, slot);
+	munit_assert_int(chiaki_frame_mailbox_acquire(&mailbox, &fresh), ==, slot);
+	munit_assert_true(fresh);
+
+	// nothing new, keep reading the same slot
+	munit_assert_int(chiaki_frame_mailbox_acquire(&mailbox, &fresh), ==, slot);
+	munit_assert_false(fresh);
+
+	// two frames before the consumer comes around, only the latest one is shown
+	unsigned int first = chiaki_frame_mailbox_write_slot(&mailbox);
+	chiaki_frame_mailbox_publish(&mailbox);
+	unsigned int second = chiaki_frame_mailbox_write_slot(&mailbox);
+	munit_assert_uint(second, !=, first);
+	munit_assert_uint(second, !=, slot); // still being read
+	chiaki_frame_mailbox_publish(&mailbox);
+	munit_assert_uint(chiaki_frame_mailbox_write_slot(&mailbox), ==, first);
+	munit_assert_int(chiaki_frame_mailbox_acquire(&mailbox, &fresh), ==, second);
+	munit_assert_true(fresh);
+
+	uint64_t published, dropped, consumed;
+	chiaki_frame_mailbox_get_stats(&mailbox, &published, &dropped, &consumed);
+	munit_assert_uint64(published, ==, 3);
+	munit_assert_uint64(dropped, ==, 1);
+	munit_assert_uint64(consumed, ==, 2);
+
+	return MUNIT_OK;
+}
+
+typedef struct stress_frame_t
+{
+	uint64_t seq;
+	uint32_t words[FRAME_WORDS];
+} StressFrame;
+
+typedef struct stress_t
+{
+	ChiakiFrameMailbox mailbox;
+	StressFrame frames[CHIAKI_FRAME_MAILBOX_SLOTS];
+	uint32_t busy[CHIAKI_FRAME_MAILBOX_SLOTS]; // catches both sides touching the same slot
+	bool producer_done;
+	uint64_t overlaps;
+	uint64_t torn;
+	uint64_t reordered;
+	uint64_t shown;
+} Stress;
+
+static uint32_t stress_word(uint64_t seq, size_t i)
+{
+	return (uint32_t)(seq * 2654435761u) ^ (uint32_t)i;
+}
+
+static void *stress_producer(void *user)
+{
+	Stress *stress = user;
+	for(uint64_t seq=1; seq<=STRESS_FRAMES; seq++)
+	{
+		unsigned int slot = chiaki_frame_mailbox_write_slot(&stress->mailbox);
+		if(__atomic_exchange_n(&stress->busy[slot], 1, __ATOMIC_RELAXED))
+			stress->overlaps++;
+		StressFrame *frame = &stress->frames[slot];
+		frame->seq = seq;
+		for(size_t i=0; i<FRAME_WORDS; i++)
+			frame->words[i] = stress_word(seq, i);
+		__atomic_store_n(&stress->busy[slot], 0, __ATOMIC_RELAXED);
+		chiaki_frame_mailbox_publish(&stress->mailbox);
+	}
+	__atomic_store_n(&stress->producer_done, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void stress_check(Stress *stress, uint64_t *last_seq)
+{
+	bool fresh;
+	int slot = chiaki_frame_mailbox_acquire(&stress->mailbox, &fresh);
+	if(slot < 0)
+		return;
+	if(__atomic_exchange_n(&stress->busy[slot], 1, __ATOMIC_RELAXED))
+		stress->overlaps++;
+	const StressFrame *frame = &stress->frames[slot];
+	if(fresh)
+	{
+		if(frame->seq <= *last_seq)
+			stress->reordered++;
+		*last_seq = frame->seq;
+		stress->shown++;
+	}
+	else if(frame->seq != *last_seq)
+		stress->reordered++;
+	for(size_t i=0; i<FRAME_WORDS; i++)
+	{
+		if(frame->words[i] != stress_word(frame->seq, i))
+		{
+			stress->torn++;
+			break;
+		}
+	}
+	__atomic_store_n(&stress->busy[slot], 0, __ATOMIC_RELAXED);
+}
+
+static void *stress_consumer(void *user)
+{
+	Stress *stress = user;
+	uint64_t last_seq = 0;
+	while(!__atomic_load_n(&stress->producer_done, __ATOMIC_ACQUIRE))
+		stress_check(stress, &last_seq);
+	// take the frame that may still be waiting
+	stress_check(stress, &last_seq);
+	if(last_seq != STRESS_FRAMES)
+		stress->reordered++;
+	return NULL;
+}
+
+static MunitResult test_stress(const MunitParameter params[], void *user)
+{
+	static Stress stress;
+	memset(&stress, 0, sizeof(stress));
+	chiaki_frame_mailbox_init(&stress.mailbox);
+
+	ChiakiThread producer, consumer;
+	munit_assert_int(chiaki_thread_create(&consumer, stress_consumer, &stress), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_thread_create(&producer, stress_producer, &stress), ==, CHIAKI_ERR_SUCCESS);
+	chiaki_thread_join(&producer, NULL);
+	chiaki_thread_join(&consumer, NULL);
+
+	munit_assert_uint64(stress.overlaps, ==, 0);
+	munit_assert_uint64(stress.torn, ==, 0);
+	munit_assert_uint64(stress.reordered, ==, 0);
+
+	uint64_t published, dropped, consumed;
+	chiaki_frame_mailbox_get_stats(&stress.mailbox, &published, &dropped, &consumed);
+	munit_assert_uint64(published, ==, STRESS_FRAMES);
+	munit_assert_uint64(consumed, ==, stress.shown);
+	munit_assert_uint64(published, ==, consumed + dropped);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_frame_mailbox[] = {
+	{
+		"/protocol",
+		test_protocol,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/stress",
+		test_stress,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/framepacer.h>
+
+#define SIM_DURATION_US 20000000ull
+
+typedef struct sim_t
+{
+	uint64_t now_us;
+	uint32_t rng;
+} Sim;
+
+static uint64_t sim_clock(void *user)
+{
+	return ((Sim *)user)->now_us;
+}
+
+static int64_t sim_jitter(Sim *sim, int64_t max_us)
+{
+	sim->rng = sim->rng * 1664525u + 1013904223u;
+	return (int64_t)(sim->rng >> 8) % (2 * max_us + 1) - max_us;
+}
+
+typedef struct trace_result_t
+{
+	ChiakiFramePacerStats stats;
+	uint64_t vsyncs;
+} TraceResult;
+
+/**
+ * Replay a source at fps with arrival jitter of +/- jitter_us against a display at hz,
+ * whose refreshes are shifted by vsync_phase (0.0-1.0 of a refresh) relative to the source.
+ */
+static void run_trace(unsigned int fps, unsigned int hz, double vsync_phase, int64_t jitter_us, unsigned int catchup_vsyncs, TraceResult *result)
+{
+	Sim sim = { 0 };
+	sim.rng = fps * 1000 + hz;
+	ChiakiFramePacer pacer;
+	chiaki_frame_pacer_init(&pacer, sim_clock, &sim, 0);
+	if(catchup_vsyncs)
+		pacer.catchup_vsyncs = catchup_vsyncs;
+
+	const double frame_us = 1000000.0 / fps;
+	const double refresh_us = 1000000.0 / hz;
+	uint64_t frame = 0, vsync = 0;
+	uint64_t last_arrival = 0;
+	uint64_t next_arrival = 100000 + (uint64_t)jitter_us;
+	uint64_t next_vsync = 100000 + (uint64_t)(vsync_phase * refresh_us);
+	while(next_arrival < SIM_DURATION_US || next_vsync < SIM_DURATION_US)
+	{
+		if(next_arrival <= next_vsync)
+		{
+			sim.now_us = next_arrival;
+			chiaki_frame_pacer_push(&pacer, frame, (uint64_t)(frame * frame_us), NULL);
+			last_arrival = next_arrival;
+			frame++;
+			int64_t arrival = 100000 + (int64_t)(frame * frame_us) + jitter_us + sim_jitter(&sim, jitter_us);
+			next_arrival = (uint64_t)arrival > last_arrival ? (uint64_t)arrival : last_arrival; // no reordering
+		}
+		else
+		{
+			sim.now_us = next_vsync;
+			ChiakiFramePacerDecision decision;
+			chiaki_frame_pacer_vsync(&pacer, next_vsync, &decision);
+			vsync++;
+			next_vsync = 100000 + (uint64_t)((vsync + vsync_phase) * refresh_us);
+		}
+	}
+
+	result->stats = pacer.stats;
+	result->vsyncs = vsync;
+}
+
+static double mean_ms(uint64_t sum_us, uint64_t count)
+{
+	return count ? (double)sum_us / count / 1000.0 : 0.0;
+}
+
+static MunitResult test_matrix(const MunitParameter params[], void *user)
+{
+	static const unsigned int fps_list[] = { 30, 60, 120 };
+	static const unsigned int hz_list[] = { 60, 90, 120, 144 };
+	for(size_t i=0; i<sizeof(fps_list)/sizeof(fps_list[0]); i++)
+	{
+		for(size_t j=0; j<sizeof(hz_list)/sizeof(hz_list[0]); j++)
+		{
+			unsigned int fps = fps_list[i], hz = hz_list[j];
+			TraceResult r;
+			run_trace(fps, hz, 0.5, 2000, 0, &r);
+			ChiakiFramePacerStats *s = &r.stats;
+			munit_logf(MUNIT_LOG_INFO, "%3u fps @ %3u Hz: presented %llu/%llu, dropped %llu, latency mean %.2fms max %.2fms, judder mean %.2fms max %.2fms",
+					fps, hz, (unsigned long long)s->frames_presented, (unsigned long long)s->frames_arrived,
+					(unsigned long long)s->frames_dropped,
+					mean_ms(s->latency_sum_us, s->frames_presented), s->latency_max_us / 1000.0,
+					mean_ms(s->judder_sum_us, s->judder_count), s->judder_max_us / 1000.0);
+
+			double frame_us = 1000000.0 / fps;
+			double refresh_us = 1000000.0 / hz;
+			munit_assert_uint64(s->frames_presented + s->frames_dropped, >=, s->frames_arrived - CHIAKI_FRAME_PACER_QUEUE_MAX);
+
+			// added latency is bounded by waiting for the next refresh plus one frame of backlog
+			munit_assert_double(mean_ms(s->latency_sum_us, s->frames_presented) * 1000.0, <=, refresh_us + 2000.0);
+			munit_assert_double((double)s->latency_max_us, <=, frame_us + 2 * refresh_us + 4000.0);
+
+			if(fps <= hz)
+			{
+				// everything is shown, apart from rare catch-ups
+				munit_assert_uint64(s->frames_dropped, <=, s->frames_arrived / 50);
+				// the display can't do better than rounding each frame to a refresh
+				munit_assert_double(mean_ms(s->judder_sum_us, s->judder_count) * 1000.0, <=, refresh_us / 2 + 500.0);
+				if(hz % fps == 0)
+					munit_assert_double(mean_ms(s->judder_sum_us, s->judder_count), <, 0.5);
+			}
+			else
+			{
+				// faster source, every refresh shows a new frame
+				munit_assert_uint64(s->frames_presented, >=, r.vsyncs * 95 / 100);
+				munit_assert_uint64(s->vsyncs_held, <=, r.vsyncs / 50);
+			}
+		}
+	}
+	return MUNIT_OK;
+}
+
+static MunitResult test_phase_aligned(const MunitParameter params[], void *user)
+{
+	// 60 fps @ 60 Hz with frames arriving right around the refresh is the worst case:
+	// showing the newest frame judders on nearly every jittered frame,
+	// keeping a small backlog turns that into a rare catch-up.
+	const double phase = 2000.0 / (1000000.0 / 60); // arrivals are spread over +/-2ms around the refresh
+	TraceResult newest, backlog;
+	run_trace(60, 60, phase, 2000, 1, &newest);
+	run_trace(60, 60, phase, 2000, 0, &backlog);
+	munit_logf(MUNIT_LOG_INFO, "newest: judder mean %.2fms, dropped %llu; backlog: judder mean %.2fms, dropped %llu, latency mean %.2fms",
+			mean_ms(newest.stats.judder_sum_us, newest.stats.judder_count), (unsigned long long)newest.stats.frames_dropped,
+			mean_ms(backlog.stats.judder_sum_us, backlog.stats.judder_count), (unsigned long long)backlog.stats.frames_dropped,
+			mean_ms(backlog.stats.latency_sum_us, backlog.stats.frames_presented));
+
+	munit_assert_uint64(backlog.stats.frames_dropped * 4, <, newest.stats.frames_dropped);
+	munit_assert_uint64(backlog.stats.judder_sum_us * 4, <, newest.stats.judder_sum_us);
+	munit_assert_double(mean_ms(backlog.stats.latency_sum_us, backlog.stats.frames_presented), <, 1000.0 / 60 * 1.5);
+	return MUNIT_OK;
+}
+
+static MunitResult test_queue_depth(const MunitParameter params[], void *user)
+{
+	Sim sim = { 0 };
+	ChiakiFramePacer pacer;
+	chiaki_frame_pacer_init(&pacer, sim_clock, &sim, 2);
+
+	ChiakiFramePacerFrame dropped;
+	munit_assert_false(chiaki_frame_pacer_push(&pacer, 0, 0, &dropped));
+	munit_assert_false(chiaki_frame_pacer_push(&pacer, 1, 16666, &dropped));
+	munit_assert_true(chiaki_frame_pacer_push(&pacer, 2, 33333, &dropped));
+	munit_assert_uint64(dropped.id, ==, 0);
+	munit_assert_uint(chiaki_frame_pacer_queued(&pacer), ==, 2);
+
+	ChiakiFramePacerDecision decision;
+	sim.now_us = 1000;
+	chiaki_frame_pacer_vsync(&pacer, sim.now_us, &decision);
+	munit_assert_int(decision.action, ==, CHIAKI_FRAME_PACER_PRESENT);
+	munit_assert_uint64(decision.frame.id, ==, 1);
+	chiaki_frame_pacer_vsync(&pacer, sim.now_us + 16666, &decision);
+	munit_assert_uint64(decision.frame.id, ==, 2);
+	chiaki_frame_pacer_vsync(&pacer, sim.now_us + 33333, &decision);
+	munit_assert_int(decision.action, ==, CHIAKI_FRAME_PACER_HOLD);
+	return MUNIT_OK;
+}
+
+static MunitResult test_throttle(const MunitParameter params[], void *user)
+{
+	Sim sim = { 0 };
+	sim.now_us = 1000000;
+	ChiakiFramePacer pacer;
+	chiaki_frame_pacer_init(&pacer, sim_clock, &sim, 0);
+	munit_assert_int64(chiaki_frame_pacer_submit_swap_estimate(&pacer), ==, 1500);
+	chiaki_frame_pacer_submit_swap_observed(&pacer, 3100);
+	munit_assert_int64(chiaki_frame_pacer_submit_swap_estimate(&pacer), ==, 1700);
+
+	uint64_t target;
+	uint64_t wakeup = chiaki_frame_pacer_throttle_wakeup(&pacer, 16666, 2000, &target);
+	munit_assert_uint64(target, ==, 1016666);
+	munit_assert_uint64(wakeup, ==, 1014666);
+	chiaki_frame_pacer_throttle_advance(&pacer);
+
+	// we overslept by more than two intervals, the schedule skips ahead instead of bursting
+	sim.now_us = 1040000;
+	wakeup = chiaki_frame_pacer_throttle_wakeup(&pacer, 16666, 2000, &target);
+	munit_assert_uint64(target, ==, 1049998);
+	munit_assert_uint64(wakeup, ==, 1047998);
+
+	// lead larger than the time left, wake up right away
+	sim.now_us = 1049000;
+	wakeup = chiaki_frame_pacer_throttle_wakeup(&pacer, 16666, 2000, &target);
+	munit_assert_uint64(wakeup, ==, 1049000);
+
+	// a new interval starts over from now
+	wakeup = chiaki_frame_pacer_throttle_wakeup(&pacer, 8333, 0, &target);
+	munit_assert_uint64(target, ==, 1057333);
+	return MUNIT_OK;
+}
+
+MunitTest tests_frame_pacer[] = {
+	{
+		"/matrix",
+		test_matrix,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/phase_aligned",
+		test_phase_aligned,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/queue_depth",
+		test_queue_depth,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/throttle",
+		test_throttle,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
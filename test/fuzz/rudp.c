@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+// libFuzzer target for the RUDP message parser, build with -DCHIAKI_ENABLE_FUZZERS=ON using clang
+
+#include <chiaki/remote/rudp.h>
+
+#include <string.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	if(size > CHIAKI_RUDP_DATAGRAM_SIZE_MAX)
+		return 0;
+	// copy so reads past the received size are caught instead of landing in the fuzzer's buffer
+	uint8_t buf[CHIAKI_RUDP_DATAGRAM_SIZE_MAX];
+	memcpy(buf, data, size);
+
+	RudpMessage messages[CHIAKI_RUDP_MESSAGES_MAX];
+	size_t count = 0;
+	if(chiaki_rudp_message_parse(buf, size, messages, CHIAKI_RUDP_MESSAGES_MAX, &count) != CHIAKI_ERR_SUCCESS)
+		return 0;
+	if(memcmp(buf, data, size) != 0)
+		__builtin_trap();
+
+	// whatever was parsed has to fit into a datagram again
+	uint8_t serialized[CHIAKI_RUDP_DATAGRAM_SIZE_MAX];
+	size_t serialized_size = 0;
+	if(chiaki_rudp_message_serialize(&messages[0], serialized, sizeof(serialized), &serialized_size) != CHIAKI_ERR_SUCCESS
+			|| serialized_size > size)
+		__builtin_trap();
+	return 0;
+}
@@ -4,6 +4,9 @@
 
 #include <chiaki/ecdh.h>
 #include <chiaki/gkcrypt.h>
+#include <chiaki/stoppipe.h>
+
+#include "test_log.h"
 
 static MunitResult test_ecdh(const MunitParameter params[], void *user)
 {
@@ -63,7 +66,7 @@ static MunitResult test_key_stream(const MunitParameter params[], void *user)
 	ChiakiLog log;
 
 	ChiakiGKCrypt gkcrypt;
-	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, &log, 0, 42, handshake_key, ecdh_secret);
+	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, &log, 0, NULL, 42, handshake_key, ecdh_secret);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return MUNIT_ERROR;
 
@@ -109,7 +112,7 @@ static MunitResult test_endecrypt(const MunitParameter params[], void *user)
 	ChiakiLog log;
 
 	ChiakiGKCrypt gkcrypt;
-	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, &log, 0, 42, handshake_key, ecdh_secret);
+	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, &log, 0, NULL, 42, handshake_key, ecdh_secret);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return MUNIT_ERROR;
 
@@ -365,7 +368,7 @@ static MunitResult test_gmac_multiple_of_key_refresh(const MunitParameter params
 
 	ChiakiLog log;
 	ChiakiGKCrypt gkcrypt;
-	chiaki_gkcrypt_init(&gkcrypt, &log, 0, crypt_index, handshake_key, ecdh_secret);
+	chiaki_gkcrypt_init(&gkcrypt, &log, 0, NULL, crypt_index, handshake_key, ecdh_secret);
 
 	uint8_t gmac[CHIAKI_GKCRYPT_GMAC_SIZE];
 	ChiakiErrorCode err = chiaki_gkcrypt_gmac(&gkcrypt, key_pos, data, sizeof(data), gmac);
@@ -380,6 +383,83 @@ static MunitResult test_gmac_multiple_of_key_refresh(const MunitParameter params
 }
 
 
+static bool key_buf_wait_ahead(ChiakiGKCrypt *gkcrypt)
+{
+	ChiakiStopPipe sleep_pipe;
+	munit_assert_int(chiaki_stop_pipe_init(&sleep_pipe), ==, CHIAKI_ERR_SUCCESS);
+	bool ahead = false;
+	for(int i=0; i<1000 && !ahead; i++)
+	{
+		chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
+		ahead = gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_populated >= gkcrypt->last_key_pos + gkcrypt->key_buf_size / 2;
+		chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
+		if(!ahead)
+			chiaki_stop_pipe_sleep(&sleep_pipe, 1);
+	}
+	chiaki_stop_pipe_fini(&sleep_pipe);
+	return ahead;
+}
+
+static void key_buf_run(ChiakiExecutor *executor)
+{
+	static const uint8_t handshake_key[] = { 0x83, 0xcf, 0x93, 0x1a, 0x6a, 0xa7, 0x69, 0xa6, 0xc4, 0x48, 0x5d, 0x19, 0xc1, 0x5c, 0xcc, 0x52 };
+	static const uint8_t ecdh_secret[] = { 0x73, 0xc8, 0xd5, 0x49, 0xc4, 0xd9, 0xdb, 0x50, 0x2e, 0xc0, 0x44, 0xea, 0x33, 0x64, 0x8c, 0x6a, 0xc9, 0xf3, 0x6c, 0x41, 0xb6, 0xa0, 0x50, 0x4f, 0xe0, 0x93, 0xde, 0xfb, 0x61, 0x9b, 0x9, 0x73 };
+
+	ChiakiGKCrypt gkcrypt;
+	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, get_test_log(), 8, executor, 42, handshake_key, ecdh_secret);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// consume the key stream across several wraps of the buffer, waiting for the generator each time
+	uint8_t key_stream[0x500];
+	uint8_t key_stream_expected[0x500];
+	size_t requests = 0;
+	for(uint64_t key_pos=0; key_pos<0x40000; key_pos+=0x5b0)
+	{
+		munit_assert_true(key_buf_wait_ahead(&gkcrypt));
+		uint64_t key_pos_aligned = key_pos - key_pos % CHIAKI_GKCRYPT_BLOCK_SIZE;
+		err = chiaki_gkcrypt_get_key_stream(&gkcrypt, key_pos_aligned, key_stream, sizeof(key_stream));
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		err = chiaki_gkcrypt_gen_key_stream(&gkcrypt, key_pos_aligned, key_stream_expected, sizeof(key_stream_expected));
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_memory_equal(sizeof(key_stream), key_stream, key_stream_expected);
+		requests++;
+	}
+
+	// jumping far beyond the buffer falls back to generating synchronously and the generator skips ahead
+	uint64_t key_pos_far = 0x1000000;
+	err = chiaki_gkcrypt_get_key_stream(&gkcrypt, key_pos_far, key_stream, sizeof(key_stream));
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	err = chiaki_gkcrypt_gen_key_stream(&gkcrypt, key_pos_far, key_stream_expected, sizeof(key_stream_expected));
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_memory_equal(sizeof(key_stream), key_stream, key_stream_expected);
+	munit_assert_true(key_buf_wait_ahead(&gkcrypt));
+	err = chiaki_gkcrypt_get_key_stream(&gkcrypt, key_pos_far + 0x100, key_stream, sizeof(key_stream));
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	err = chiaki_gkcrypt_gen_key_stream(&gkcrypt, key_pos_far + 0x100, key_stream_expected, sizeof(key_stream_expected));
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_memory_equal(sizeof(key_stream), key_stream, key_stream_expected);
+
+	ChiakiGKCryptStats stats;
+	chiaki_gkcrypt_get_stats(&gkcrypt, &stats);
+	munit_assert_uint64(stats.key_buf_hits, ==, requests + 1);
+	munit_assert_uint64(stats.key_buf_misses, ==, 1);
+	munit_assert_uint64(stats.key_buf_generated, >=, 0x40000);
+
+	chiaki_gkcrypt_fini(&gkcrypt);
+}
+
+static MunitResult test_key_buf(const MunitParameter params[], void *user)
+{
+	key_buf_run(NULL);
+
+	ChiakiExecutor executor;
+	munit_assert_int(chiaki_executor_init(&executor, get_test_log(), 0), ==, CHIAKI_ERR_SUCCESS);
+	key_buf_run(&executor);
+	chiaki_executor_fini(&executor);
+
+	return MUNIT_OK;
+}
+
 MunitTest tests_gkcrypt[] = {
 	{
 		"/ecdh",
@@ -405,6 +485,14 @@ MunitTest tests_gkcrypt[] = {
 		MUNIT_TEST_OPTION_NONE,
 		NULL
 	},
+	{
+		"/key_buf",
+		test_key_buf,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
 	{
 		"/gmac",
 		test_gmac,
@@ -0,0 +1,300 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/haptics.h>
+#include <chiaki/time.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define PACKET_FRAMES 30 // what the console sends every 10ms
+
+static const int16_t golden_in[] = { 0, 1, -1, 100, -100, 32767, -32768, 12345, -12345, 20000, -7 };
+
+static int16_t gain_sample_ref(int16_t sample, float gain)
+{
+	// what the frontends did before
+	int32_t adjusted = (int32_t)sample * gain;
+	adjusted = (adjusted > INT16_MAX) ? INT16_MAX : adjusted;
+	return (adjusted < INT16_MIN) ? INT16_MIN : adjusted;
+}
+
+static void random_pcm(int16_t *buf, size_t samples)
+{
+	for(size_t i=0; i<samples; i++)
+		buf[i] = (int16_t)munit_rand_int_range(INT16_MIN, INT16_MAX);
+}
+
+static MunitResult test_gain(const MunitParameter params[], void *user)
+{
+	static const int16_t golden_2[] = { 0, 2, -2, 200, -200, 32767, -32768, 24690, -24690, 32767, -14 };
+	static const int16_t golden_05[] = { 0, 0, 0, 50, -50, 16383, -16384, 6172, -6172, 10000, -3 };
+	int16_t out[sizeof(golden_in) / sizeof(int16_t)];
+	size_t count = sizeof(golden_in) / sizeof(int16_t);
+
+	chiaki_haptics_gain(out, golden_in, count, 2.0f);
+	munit_assert_memory_equal(sizeof(out), out, golden_2);
+	chiaki_haptics_gain(out, golden_in, count, 0.5f);
+	munit_assert_memory_equal(sizeof(out), out, golden_05);
+
+	static const float gains[] = { 0.0f, 0.2f, 0.37f, 1.0f, 1.3f, 2.0f, 5.0f };
+	int16_t in[257];
+	int16_t res[257];
+	random_pcm(in, 257);
+	for(size_t g=0; g<sizeof(gains)/sizeof(gains[0]); g++)
+	{
+		for(size_t n=0; n<=257; n+=37)
+		{
+			chiaki_haptics_gain(res, in, n, gains[g]);
+			for(size_t i=0; i<n; i++)
+				munit_assert_int16(res[i], ==, gain_sample_ref(in[i], gains[g]));
+		}
+	}
+
+	// in place
+	memcpy(res, in, sizeof(in));
+	chiaki_haptics_gain(res, res, 257, 1.3f);
+	for(size_t i=0; i<257; i++)
+		munit_assert_int16(res[i], ==, gain_sample_ref(in[i], 1.3f));
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_split_remix(const MunitParameter params[], void *user)
+{
+	static const int16_t golden_remix[] = {
+		0, 0, 0, 1,
+		0, 0, -1, 100,
+		0, 0, -100, 32767,
+		0, 0, -32768, 12345,
+		0, 0, -12345, 20000
+	};
+	int16_t out[sizeof(golden_remix) / sizeof(int16_t)];
+	chiaki_haptics_remix_4ch(out, golden_in, 5, 1.0f);
+	munit_assert_memory_equal(sizeof(out), out, golden_remix);
+
+	int16_t in[67 * 2];
+	int16_t left[67], right[67];
+	int16_t remixed[67 * 4];
+	random_pcm(in, 67 * 2);
+	for(size_t n=0; n<=67; n+=67/5)
+	{
+		chiaki_haptics_split(left, right, in, n, 1.7f);
+		chiaki_haptics_remix_4ch(remixed, in, n, 0.6f);
+		for(size_t i=0; i<n; i++)
+		{
+			munit_assert_int16(left[i], ==, gain_sample_ref(in[i * 2], 1.7f));
+			munit_assert_int16(right[i], ==, gain_sample_ref(in[i * 2 + 1], 1.7f));
+			munit_assert_int16(remixed[i * 4], ==, 0);
+			munit_assert_int16(remixed[i * 4 + 1], ==, 0);
+			munit_assert_int16(remixed[i * 4 + 2], ==, gain_sample_ref(in[i * 2], 0.6f));
+			munit_assert_int16(remixed[i * 4 + 3], ==, gain_sample_ref(in[i * 2 + 1], 0.6f));
+		}
+	}
+	return MUNIT_OK;
+}
+
+static MunitResult test_envelope(const MunitParameter params[], void *user)
+{
+	uint32_t left, right;
+	chiaki_haptics_envelope(golden_in, 5, &left, &right);
+	munit_assert_uint32(left, ==, (0 + 1 + 100 + 32768 + 12345) / 5);
+	munit_assert_uint32(right, ==, (1 + 100 + 32767 + 12345 + 20000) / 5);
+
+	// long enough to go through more than one accumulator block
+	static int16_t in[0x2345 * 2];
+	for(size_t i=0; i<0x2345 * 2; i++)
+		in[i] = (i % 3) ? INT16_MIN : (int16_t)munit_rand_int_range(INT16_MIN, INT16_MAX);
+	for(size_t n=0; n<=0x2345; n+=0x2345/7)
+	{
+		uint64_t sum_left = 0, sum_right = 0;
+		for(size_t i=0; i<n; i++)
+		{
+			sum_left += abs(in[i * 2]);
+			sum_right += abs(in[i * 2 + 1]);
+		}
+		chiaki_haptics_envelope(in, n, &left, &right);
+		munit_assert_uint32(left, ==, n ? sum_left / n : 0);
+		munit_assert_uint32(right, ==, n ? sum_right / n : 0);
+	}
+	return MUNIT_OK;
+}
+
+static void synth(int16_t *out, size_t frames, double freq_start, double freq_end, double amplitude, double *phase)
+{
+	for(size_t i=0; i<frames; i++)
+	{
+		double freq = freq_start + (freq_end - freq_start) * i / frames;
+		*phase += 2.0 * M_PI * freq / CHIAKI_HAPTICS_SAMPLE_RATE;
+		out[i * 2] = out[i * 2 + 1] = (int16_t)(amplitude * sin(*phase));
+	}
+}
+
+static MunitResult test_dominant_freq(const MunitParameter params[], void *user)
+{
+	int16_t in[CHIAKI_HAPTICS_PACKET_FRAMES_MAX * 2];
+	float amplitude;
+	double phase = 0.0;
+
+	memset(in, 0, sizeof(in));
+	munit_assert_double(chiaki_haptics_dominant_freq(in, PACKET_FRAMES, CHIAKI_HAPTICS_SAMPLE_RATE, &amplitude), ==, 0.0);
+	munit_assert_double(amplitude, ==, 0.0);
+
+	// a single packet only covers periods of up to half its length
+	static const double freqs[] = { 220.0, 300.0, 450.0, 600.0, 800.0, 1000.0 };
+	for(size_t i=0; i<sizeof(freqs)/sizeof(freqs[0]); i++)
+	{
+		synth(in, PACKET_FRAMES, freqs[i], freqs[i], 8000.0, &phase);
+		float freq = chiaki_haptics_dominant_freq(in, PACKET_FRAMES, CHIAKI_HAPTICS_SAMPLE_RATE, &amplitude);
+		munit_logf(MUNIT_LOG_DEBUG, "%.0f Hz estimated as %.1f Hz, amplitude %.0f", freqs[i], freq, amplitude);
+		munit_assert_double(fabs(freq - freqs[i]) / freqs[i], <, 0.05);
+		munit_assert_double(amplitude, >, 8000.0 * 0.8);
+		munit_assert_double(amplitude, <, 8000.0 * 1.2);
+	}
+
+	// a chirp, every packet is compared against the frequency in its middle
+	for(double freq_start = 250.0; freq_start < 900.0; freq_start += 50.0)
+	{
+		synth(in, PACKET_FRAMES, freq_start, freq_start + 50.0, 12000.0, &phase);
+		float freq = chiaki_haptics_dominant_freq(in, PACKET_FRAMES, CHIAKI_HAPTICS_SAMPLE_RATE, NULL);
+		munit_assert_double(fabs(freq - (freq_start + 25.0)) / (freq_start + 25.0), <, 0.08);
+	}
+
+	// noise is not periodic, given enough frames to tell
+	int16_t noise[256 * 2];
+	for(size_t i=0; i<256 * 2; i++)
+		noise[i] = (int16_t)munit_rand_int_range(-8000, 8000);
+	munit_assert_double(chiaki_haptics_dominant_freq(noise, 256, CHIAKI_HAPTICS_SAMPLE_RATE, NULL), ==, 0.0);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_processor(const MunitParameter params[], void *user)
+{
+	ChiakiHapticsProcessor processor;
+	munit_assert_int(chiaki_haptics_processor_init(&processor, CHIAKI_HAPTICS_SAMPLE_RATE, 44100), ==, CHIAKI_ERR_INVALID_DATA);
+	munit_assert_int(chiaki_haptics_processor_init(&processor, 3000, 12000), ==, CHIAKI_ERR_SUCCESS);
+
+	static const int16_t in_a[] = { 400, -400, 800, 0 };
+	static const int16_t in_b[] = { -400, 4000 };
+	static const int16_t golden_a[] = {
+		0, 0, 0, 0,
+		0, 0, 100, -100,
+		0, 0, 200, -200,
+		0, 0, 300, -300,
+		0, 0, 400, -400,
+		0, 0, 500, -300,
+		0, 0, 600, -200,
+		0, 0, 700, -100
+	};
+	static const int16_t golden_b[] = {
+		0, 0, 800, 0,
+		0, 0, 500, 1000,
+		0, 0, 200, 2000,
+		0, 0, -100, 3000
+	};
+	int16_t out[8 * 4];
+	munit_assert_size(chiaki_haptics_processor_process(&processor, in_a, 2, 1.0f, out, 8), ==, 8);
+	munit_assert_memory_equal(sizeof(golden_a), out, golden_a);
+	// continues from the last frame of the previous packet
+	munit_assert_size(chiaki_haptics_processor_process(&processor, in_b, 1, 1.0f, out, 8), ==, 4);
+	munit_assert_memory_equal(sizeof(golden_b), out, golden_b);
+	// never writes beyond out_frames_max
+	munit_assert_size(chiaki_haptics_processor_process(&processor, in_a, 2, 1.0f, out, 7), ==, 4);
+
+	chiaki_haptics_processor_reset(&processor);
+	munit_assert_size(chiaki_haptics_processor_process(&processor, in_a, 2, 1.0f, out, 8), ==, 8);
+	munit_assert_memory_equal(sizeof(golden_a), out, golden_a);
+	return MUNIT_OK;
+}
+
+static MunitResult test_benchmark(const MunitParameter params[], void *user)
+{
+	ChiakiHapticsProcessor processor;
+	munit_assert_int(chiaki_haptics_processor_init(&processor, CHIAKI_HAPTICS_SAMPLE_RATE, 48000), ==, CHIAKI_ERR_SUCCESS);
+
+	int16_t in[PACKET_FRAMES * 2];
+	double phase = 0.0;
+	synth(in, PACKET_FRAMES, 320.0, 320.0, 9000.0, &phase);
+	int16_t left[PACKET_FRAMES], right[PACKET_FRAMES];
+	int16_t out[PACKET_FRAMES * 16 * 4];
+
+	// what every frontend does with a packet at most: envelope for rumble, split for the Steam Deck,
+	// frequency for actuators driven by period and the 4 channel 48kHz stream for the DualSense
+	const size_t packets = 20000;
+	uint64_t sink = 0;
+	uint64_t start_us = chiaki_time_now_monotonic_us();
+	for(size_t i=0; i<packets; i++)
+	{
+		uint32_t env_left, env_right;
+		chiaki_haptics_envelope(in, PACKET_FRAMES, &env_left, &env_right);
+		chiaki_haptics_split(left, right, in, PACKET_FRAMES, 1.3f);
+		float freq = chiaki_haptics_dominant_freq(in, PACKET_FRAMES, CHIAKI_HAPTICS_SAMPLE_RATE, NULL);
+		size_t frames = chiaki_haptics_processor_process(&processor, in, PACKET_FRAMES, 1.3f, out, PACKET_FRAMES * 16);
+		sink += env_left + env_right + left[i % PACKET_FRAMES] + (uint64_t)freq + out[frames * 4 - 1];
+	}
+	uint64_t elapsed_us = chiaki_time_now_monotonic_us() - start_us;
+	munit_logf(MUNIT_LOG_INFO, "Haptics packet of %d frames processed in %.3f us (%llu)",
+			PACKET_FRAMES, (double)elapsed_us / packets, (unsigned long long)sink);
+	// a packet arrives every 10ms, so even slow machines are nowhere near this
+	munit_assert_uint64(elapsed_us / packets, <, 1000);
+	return MUNIT_OK;
+}
+
+MunitTest tests_haptics[] = {
+	{
+		"/gain",
+		test_gain,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/split_remix",
+		test_split_remix,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/envelope",
+		test_envelope,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/dominant_freq",
+		test_dominant_freq,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/processor",
+		test_processor,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/benchmark",
+		test_benchmark,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,601 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/remote/httpclient.h>
+#include <chiaki/stoppipe.h>
+#include <chiaki/thread.h>
+#include <chiaki/time.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#ifndef CHIAKI_LIB_ENABLE_MBEDTLS
+#define STAND_IN_TLS 1
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <openssl/pem.h>
+#endif
+
+#include "test_log.h"
+
+#define STAND_IN_CONNECTIONS_MAX 16
+
+#ifdef STAND_IN_TLS
+#define STAND_IN_SCHEME "https"
+#else
+#define STAND_IN_SCHEME "http"
+#endif
+
+typedef struct stand_in_server_t StandInServer;
+
+typedef struct stand_in_connection_t
+{
+	StandInServer *server;
+	chiaki_socket_t sock;
+#ifdef STAND_IN_TLS
+	SSL *ssl;
+#endif
+	ChiakiThread thread;
+} StandInConnection;
+
+/**
+ * Local stand-in for the PSN HTTPS endpoints. It answers every request with its method and path,
+ * and counts the connections and TLS handshakes it had to accept for them.
+ */
+struct stand_in_server_t
+{
+	chiaki_socket_t sock;
+	uint16_t port;
+	ChiakiStopPipe stop_pipe;
+	ChiakiThread thread;
+#ifdef STAND_IN_TLS
+	SSL_CTX *ssl_ctx;
+	char ca_file[64];
+#endif
+
+	bool close_after_response;
+	uint64_t delay_ms;
+
+	ChiakiMutex mutex;
+	StandInConnection connections[STAND_IN_CONNECTIONS_MAX];
+	size_t connections_count;
+	unsigned int requests;
+	unsigned int handshakes_resumed;
+};
+
+#ifdef STAND_IN_TLS
+static void add_ext(X509 *x509, int nid, const char *value)
+{
+	X509V3_CTX ctx;
+	X509V3_set_ctx_nodb(&ctx);
+	X509V3_set_ctx(&ctx, x509, x509, NULL, NULL, 0);
+	X509_EXTENSION *ext = X509V3_EXT_conf_nid(NULL, &ctx, nid, value);
+	munit_assert_not_null(ext);
+	X509_add_ext(x509, ext, -1);
+	X509_EXTENSION_free(ext);
+}
+
+/**
+ * Create a self-signed certificate for localhost and write it to server->ca_file for the client to trust.
+ */
+static void stand_in_tls_init(StandInServer *server)
+{
+	EVP_PKEY *pkey = NULL;
+	EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+	munit_assert_not_null(pctx);
+	munit_assert_int(EVP_PKEY_keygen_init(pctx), ==, 1);
+	munit_assert_int(EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1), ==, 1);
+	munit_assert_int(EVP_PKEY_keygen(pctx, &pkey), ==, 1);
+	EVP_PKEY_CTX_free(pctx);
+
+	X509 *x509 = X509_new();
+	munit_assert_not_null(x509);
+	X509_set_version(x509, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(x509), (long)(munit_rand_uint32() & 0x7fffffff));
+	X509_gmtime_adj(X509_getm_notBefore(x509), -60);
+	X509_gmtime_adj(X509_getm_notAfter(x509), 60 * 60);
+	X509_set_pubkey(x509, pkey);
+	X509_NAME *name = X509_get_subject_name(x509);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0);
+	X509_set_issuer_name(x509, name);
+	add_ext(x509, NID_basic_constraints, "critical,CA:TRUE");
+	add_ext(x509, NID_key_usage, "critical,digitalSignature,keyCertSign");
+	add_ext(x509, NID_subject_alt_name, "DNS:localhost,IP:127.0.0.1");
+	munit_assert_int(X509_sign(x509, pkey, EVP_sha256()), >, 0);
+
+	snprintf(server->ca_file, sizeof(server->ca_file), "chiaki-test-http-ca-%08x.pem", (unsigned int)munit_rand_uint32());
+	FILE *f = fopen(server->ca_file, "wb");
+	munit_assert_not_null(f);
+	munit_assert_int(PEM_write_X509(f, x509), ==, 1);
+	fclose(f);
+
+	server->ssl_ctx = SSL_CTX_new(TLS_server_method());
+	munit_assert_not_null(server->ssl_ctx);
+	munit_assert_int(SSL_CTX_use_certificate(server->ssl_ctx, x509), ==, 1);
+	munit_assert_int(SSL_CTX_use_PrivateKey(server->ssl_ctx, pkey), ==, 1);
+	X509_free(x509);
+	EVP_PKEY_free(pkey);
+}
+#endif
+
+static int conn_read(StandInConnection *conn, char *buf, size_t size)
+{
+#ifdef STAND_IN_TLS
+	if(!SSL_has_pending(conn->ssl)
+		&& chiaki_stop_pipe_select_single(&conn->server->stop_pipe, conn->sock, false, UINT64_MAX) != CHIAKI_ERR_SUCCESS)
+		return -1;
+	return SSL_read(conn->ssl, buf, (int)size);
+#else
+	if(chiaki_stop_pipe_select_single(&conn->server->stop_pipe, conn->sock, false, UINT64_MAX) != CHIAKI_ERR_SUCCESS)
+		return -1;
+	return (int)recv(conn->sock, (CHIAKI_SOCKET_BUF_TYPE)buf, size, 0);
+#endif
+}
+
+static bool conn_write(StandInConnection *conn, const char *buf, size_t size)
+{
+#ifdef STAND_IN_TLS
+	return SSL_write(conn->ssl, buf, (int)size) == (int)size;
+#else
+	return send(conn->sock, (CHIAKI_SOCKET_BUF_TYPE)buf, size, 0) == (CHIAKI_SSIZET_TYPE)size;
+#endif
+}
+
+static void *stand_in_connection_thread(void *user)
+{
+	StandInConnection *conn = user;
+	StandInServer *server = conn->server;
+#ifdef STAND_IN_TLS
+	if(chiaki_stop_pipe_select_single(&server->stop_pipe, conn->sock, false, UINT64_MAX) != CHIAKI_ERR_SUCCESS
+		|| SSL_accept(conn->ssl) != 1)
+		return NULL;
+	chiaki_mutex_lock(&server->mutex);
+	if(SSL_session_reused(conn->ssl))
+		server->handshakes_resumed++;
+	chiaki_mutex_unlock(&server->mutex);
+#endif
+
+	char buf[4096];
+	buf[0] = '\0';
+	size_t buf_size = 0;
+	while(true)
+	{
+		char *header_end;
+		while(!(header_end = strstr(buf, "\r\n\r\n")))
+		{
+			if(buf_size >= sizeof(buf) - 1)
+				return NULL;
+			int received = conn_read(conn, buf + buf_size, sizeof(buf) - 1 - buf_size);
+			if(received <= 0)
+				return NULL;
+			buf_size += (size_t)received;
+			buf[buf_size] = '\0';
+		}
+
+		char method[16], path[256];
+		if(sscanf(buf, "%15s %255s", method, path) != 2)
+			return NULL;
+		size_t content_length = 0;
+		const char *cl = strstr(buf, "Content-Length:");
+		if(cl && cl < header_end)
+			content_length = strtoul(cl + strlen("Content-Length:"), NULL, 10);
+		size_t request_size = (size_t)(header_end + 4 - buf) + content_length;
+		while(buf_size < request_size)
+		{
+			if(request_size >= sizeof(buf))
+				return NULL;
+			int received = conn_read(conn, buf + buf_size, request_size - buf_size);
+			if(received <= 0)
+				return NULL;
+			buf_size += (size_t)received;
+			buf[buf_size] = '\0';
+		}
+
+		chiaki_mutex_lock(&server->mutex);
+		server->requests++;
+		chiaki_mutex_unlock(&server->mutex);
+		if(server->delay_ms && chiaki_stop_pipe_sleep(&server->stop_pipe, server->delay_ms) == CHIAKI_ERR_CANCELED)
+			return NULL;
+
+		char body[512];
+		int body_len = snprintf(body, sizeof(body), "%s %s %.*s", method, path,
+				(int)content_length, header_end + 4);
+		char response[1024];
+		int response_len = snprintf(response, sizeof(response),
+				"HTTP/1.1 %s\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n%s\r\n%s",
+				strcmp(path, "/missing") == 0 ? "404 Not Found" : "200 OK",
+				body_len,
+				server->close_after_response ? "Connection: close\r\n" : "",
+				body);
+		if(!conn_write(conn, response, (size_t)response_len))
+			return NULL;
+		if(server->close_after_response)
+			break;
+
+		memmove(buf, buf + request_size, buf_size - request_size);
+		buf_size -= request_size;
+		buf[buf_size] = '\0';
+	}
+#ifdef STAND_IN_TLS
+	SSL_shutdown(conn->ssl);
+#endif
+	return NULL;
+}
+
+static void *stand_in_server_thread(void *user)
+{
+	StandInServer *server = user;
+	while(chiaki_stop_pipe_select_single(&server->stop_pipe, server->sock, false, UINT64_MAX) == CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_socket_t sock = accept(server->sock, NULL, NULL);
+		if(CHIAKI_SOCKET_IS_INVALID(sock))
+			continue;
+		chiaki_mutex_lock(&server->mutex);
+		if(server->connections_count == STAND_IN_CONNECTIONS_MAX)
+		{
+			chiaki_mutex_unlock(&server->mutex);
+			CHIAKI_SOCKET_CLOSE(sock);
+			continue;
+		}
+		StandInConnection *conn = &server->connections[server->connections_count++];
+		chiaki_mutex_unlock(&server->mutex);
+		conn->server = server;
+		conn->sock = sock;
+#ifdef STAND_IN_TLS
+		conn->ssl = SSL_new(server->ssl_ctx);
+		munit_assert_not_null(conn->ssl);
+		SSL_set_fd(conn->ssl, (int)sock);
+#endif
+		munit_assert_int(chiaki_thread_create(&conn->thread, stand_in_connection_thread, conn), ==, CHIAKI_ERR_SUCCESS);
+	}
+	return NULL;
+}
+
+static void stand_in_init(StandInServer *server)
+{
+	memset(server, 0, sizeof(*server));
+	munit_assert_int(chiaki_lib_init(), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_stop_pipe_init(&server->stop_pipe), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_mutex_init(&server->mutex, false), ==, CHIAKI_ERR_SUCCESS);
+#ifdef STAND_IN_TLS
+	stand_in_tls_init(server);
+#endif
+
+	server->sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	munit_assert_false(CHIAKI_SOCKET_IS_INVALID(server->sock));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	munit_assert_int(bind(server->sock, (struct sockaddr *)&addr, sizeof(addr)), ==, 0);
+	socklen_t addr_len = sizeof(addr);
+	munit_assert_int(getsockname(server->sock, (struct sockaddr *)&addr, &addr_len), ==, 0);
+	server->port = ntohs(addr.sin_port);
+	munit_assert_int(listen(server->sock, 16), ==, 0);
+}
+
+static void stand_in_start(StandInServer *server)
+{
+	munit_assert_int(chiaki_thread_create(&server->thread, stand_in_server_thread, server), ==, CHIAKI_ERR_SUCCESS);
+}
+
+static void stand_in_fini(StandInServer *server)
+{
+	chiaki_stop_pipe_stop(&server->stop_pipe);
+	chiaki_thread_join(&server->thread, NULL);
+	for(size_t i = 0; i < server->connections_count; i++)
+	{
+		StandInConnection *conn = &server->connections[i];
+		chiaki_thread_join(&conn->thread, NULL);
+#ifdef STAND_IN_TLS
+		SSL_free(conn->ssl);
+#endif
+		CHIAKI_SOCKET_CLOSE(conn->sock);
+	}
+	CHIAKI_SOCKET_CLOSE(server->sock);
+#ifdef STAND_IN_TLS
+	SSL_CTX_free(server->ssl_ctx);
+	remove(server->ca_file);
+#endif
+	chiaki_mutex_fini(&server->mutex);
+	chiaki_stop_pipe_fini(&server->stop_pipe);
+}
+
+static ChiakiHttpClient *stand_in_client(StandInServer *server)
+{
+	ChiakiHttpClient *client = chiaki_http_client_new(get_test_log());
+	munit_assert_not_null(client);
+#ifdef STAND_IN_TLS
+	munit_assert_int(chiaki_http_client_set_ca_file(client, server->ca_file), ==, CHIAKI_ERR_SUCCESS);
+#endif
+	return client;
+}
+
+static size_t stand_in_connections(StandInServer *server)
+{
+	chiaki_mutex_lock(&server->mutex);
+	size_t r = server->connections_count;
+	chiaki_mutex_unlock(&server->mutex);
+	return r;
+}
+
+static void stand_in_url(StandInServer *server, char *buf, size_t size, const char *path)
+{
+	snprintf(buf, size, STAND_IN_SCHEME "://localhost:%u%s", (unsigned int)server->port, path);
+}
+
+#define SEQUENTIAL_REQUESTS 5
+
+static MunitResult test_connection_reuse(const MunitParameter params[], void *user)
+{
+	StandInServer server;
+	stand_in_init(&server);
+	stand_in_start(&server);
+	char url[128];
+	stand_in_url(&server, url, sizeof(url), "/np/session");
+
+	// what every request did before: a fresh handle and with it a fresh connection
+	for(size_t i = 0; i < SEQUENTIAL_REQUESTS; i++)
+	{
+		ChiakiHttpClient *client = stand_in_client(&server);
+		ChiakiHttpRequest req = { .url = url };
+		munit_assert_int(chiaki_http_client_perform(client, &req), ==, CHIAKI_ERR_SUCCESS);
+		chiaki_http_request_fini(&req);
+		chiaki_http_client_free(client);
+	}
+	size_t unpooled_connections = stand_in_connections(&server);
+	munit_assert_size(unpooled_connections, ==, SEQUENTIAL_REQUESTS);
+
+	ChiakiHttpClient *client = stand_in_client(&server);
+	const char *headers[] = { "Content-Type: application/json; charset=utf-8", NULL };
+	for(size_t i = 0; i < SEQUENTIAL_REQUESTS; i++)
+	{
+		ChiakiHttpRequest req = {
+			.url = url,
+			.headers = headers,
+			.body = "{}",
+			.body_size = 2
+		};
+		munit_assert_int(chiaki_http_client_perform(client, &req), ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_long(req.http_code, ==, 200);
+		munit_assert_string_equal(req.response, "POST /np/session {}");
+		chiaki_http_request_fini(&req);
+	}
+	size_t pooled_connections = stand_in_connections(&server) - unpooled_connections;
+	munit_logf(MUNIT_LOG_INFO, "connections for %d requests: %zu unpooled, %zu pooled",
+			SEQUENTIAL_REQUESTS, unpooled_connections, pooled_connections);
+	munit_assert_size(pooled_connections, ==, 1);
+
+	ChiakiHttpClientStats stats;
+	chiaki_http_client_get_stats(client, &stats);
+	munit_assert_uint64(stats.requests, ==, SEQUENTIAL_REQUESTS);
+	munit_assert_uint64(stats.connects, ==, 1);
+
+	chiaki_http_client_free(client);
+	stand_in_fini(&server);
+	return MUNIT_OK;
+}
+
+static MunitResult test_tls_resumption(const MunitParameter params[], void *user)
+{
+#ifndef STAND_IN_TLS
+	return MUNIT_SKIP;
+#else
+	// The server closes every connection, the handshakes for the following ones are abbreviated.
+	StandInServer server;
+	stand_in_init(&server);
+	server.close_after_response = true;
+	stand_in_start(&server);
+	char url[128];
+	stand_in_url(&server, url, sizeof(url), "/np/session");
+
+	ChiakiHttpClient *client = stand_in_client(&server);
+	for(size_t i = 0; i < 3; i++)
+	{
+		ChiakiHttpRequest req = { .url = url };
+		munit_assert_int(chiaki_http_client_perform(client, &req), ==, CHIAKI_ERR_SUCCESS);
+		chiaki_http_request_fini(&req);
+	}
+	chiaki_http_client_free(client);
+
+	munit_assert_size(stand_in_connections(&server), ==, 3);
+	chiaki_mutex_lock(&server.mutex);
+	unsigned int resumed = server.handshakes_resumed;
+	chiaki_mutex_unlock(&server.mutex);
+	munit_assert_uint(resumed, ==, 2);
+
+	stand_in_fini(&server);
+	return MUNIT_OK;
+#endif
+}
+
+#define CONCURRENT_REQUESTS 4
+#define CONCURRENT_DELAY_MS 200
+
+static MunitResult test_perform_all(const MunitParameter params[], void *user)
+{
+	StandInServer server;
+	stand_in_init(&server);
+	server.delay_ms = CONCURRENT_DELAY_MS;
+	stand_in_start(&server);
+
+	char urls[CONCURRENT_REQUESTS][128];
+	ChiakiHttpRequest reqs[CONCURRENT_REQUESTS];
+	memset(reqs, 0, sizeof(reqs));
+	for(size_t i = 0; i < CONCURRENT_REQUESTS; i++)
+	{
+		char path[32];
+		snprintf(path, sizeof(path), "/list/%zu", i);
+		stand_in_url(&server, urls[i], sizeof(urls[i]), path);
+		reqs[i].url = urls[i];
+	}
+
+	ChiakiHttpClient *client = stand_in_client(&server);
+	uint64_t start = chiaki_time_now_monotonic_ms();
+	ChiakiErrorCode err = chiaki_http_client_perform_all(client, reqs, CONCURRENT_REQUESTS);
+	uint64_t elapsed = chiaki_time_now_monotonic_ms() - start;
+	munit_logf(MUNIT_LOG_INFO, "%d requests taking %dms each finished after %llums",
+			CONCURRENT_REQUESTS, CONCURRENT_DELAY_MS, (unsigned long long)elapsed);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	for(size_t i = 0; i < CONCURRENT_REQUESTS; i++)
+	{
+		char expected[32];
+		snprintf(expected, sizeof(expected), "GET /list/%zu ", i);
+		munit_assert_int(reqs[i].err, ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_string_equal(reqs[i].response, expected);
+		chiaki_http_request_fini(&reqs[i]);
+	}
+	munit_assert_uint64(elapsed, <, 2 * CONCURRENT_DELAY_MS);
+
+	// the connections opened for the first batch are kept for the next one
+	size_t connections = stand_in_connections(&server);
+	err = chiaki_http_client_perform_all(client, reqs, CONCURRENT_REQUESTS);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	for(size_t i = 0; i < CONCURRENT_REQUESTS; i++)
+		chiaki_http_request_fini(&reqs[i]);
+	munit_assert_size(stand_in_connections(&server), ==, connections);
+
+	chiaki_http_client_free(client);
+	stand_in_fini(&server);
+	return MUNIT_OK;
+}
+
+typedef struct perform_thread_t
+{
+	ChiakiThread thread;
+	ChiakiHttpClient *client;
+	char url[128];
+	ChiakiHttpRequest req;
+} PerformThread;
+
+static void *perform_thread_func(void *user)
+{
+	PerformThread *t = user;
+	t->req.url = t->url;
+	chiaki_http_client_perform(t->client, &t->req);
+	return NULL;
+}
+
+static MunitResult test_perform_threads(const MunitParameter params[], void *user)
+{
+	// Requests from several threads share the client's transfers, none of them has to wait for another to finish.
+	StandInServer server;
+	stand_in_init(&server);
+	server.delay_ms = CONCURRENT_DELAY_MS;
+	stand_in_start(&server);
+
+	ChiakiHttpClient *client = stand_in_client(&server);
+	PerformThread threads[CONCURRENT_REQUESTS];
+	memset(threads, 0, sizeof(threads));
+	uint64_t start = chiaki_time_now_monotonic_ms();
+	for(size_t i = 0; i < CONCURRENT_REQUESTS; i++)
+	{
+		char path[32];
+		snprintf(path, sizeof(path), "/thread/%zu", i);
+		stand_in_url(&server, threads[i].url, sizeof(threads[i].url), path);
+		threads[i].client = client;
+		munit_assert_int(chiaki_thread_create(&threads[i].thread, perform_thread_func, &threads[i]), ==, CHIAKI_ERR_SUCCESS);
+	}
+	for(size_t i = 0; i < CONCURRENT_REQUESTS; i++)
+		chiaki_thread_join(&threads[i].thread, NULL);
+	uint64_t elapsed = chiaki_time_now_monotonic_ms() - start;
+	munit_logf(MUNIT_LOG_INFO, "%d threads with requests taking %dms each finished after %llums",
+			CONCURRENT_REQUESTS, CONCURRENT_DELAY_MS, (unsigned long long)elapsed);
+	for(size_t i = 0; i < CONCURRENT_REQUESTS; i++)
+	{
+		char expected[32];
+		snprintf(expected, sizeof(expected), "GET /thread/%zu ", i);
+		munit_assert_int(threads[i].req.err, ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_string_equal(threads[i].req.response, expected);
+		chiaki_http_request_fini(&threads[i].req);
+	}
+	munit_assert_uint64(elapsed, <, 2 * CONCURRENT_DELAY_MS);
+
+	chiaki_http_client_free(client);
+	stand_in_fini(&server);
+	return MUNIT_OK;
+}
+
+static MunitResult test_http_error(const MunitParameter params[], void *user)
+{
+	StandInServer server;
+	stand_in_init(&server);
+	stand_in_start(&server);
+	char url[128];
+	ChiakiHttpClient *client = stand_in_client(&server);
+
+	stand_in_url(&server, url, sizeof(url), "/missing");
+	ChiakiHttpRequest req = { .method = "DELETE", .url = url };
+	munit_assert_int(chiaki_http_client_perform(client, &req), ==, CHIAKI_ERR_HTTP_NONOK);
+	munit_assert_long(req.http_code, ==, 404);
+	munit_assert_null(req.error);
+	munit_assert_string_equal(req.response, "DELETE /missing ");
+	chiaki_http_request_fini(&req);
+
+	// an error status does not cost the connection
+	stand_in_url(&server, url, sizeof(url), "/np/session");
+	req = (ChiakiHttpRequest){ .url = url };
+	munit_assert_int(chiaki_http_client_perform(client, &req), ==, CHIAKI_ERR_SUCCESS);
+	// performing again replaces the previous response
+	munit_assert_int(chiaki_http_client_perform(client, &req), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_not_null(req.response);
+	chiaki_http_request_fini(&req);
+	munit_assert_size(stand_in_connections(&server), ==, 1);
+
+	chiaki_http_client_free(client);
+	stand_in_fini(&server);
+	return MUNIT_OK;
+}
+
+MunitTest tests_http_client[] = {
+	{
+		"/connection_reuse",
+		test_connection_reuse,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/tls_resumption",
+		test_tls_resumption,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/perform_all",
+		test_perform_all,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/perform_threads",
+		test_perform_threads,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/http_error",
+		test_http_error,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
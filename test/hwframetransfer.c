@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/hwframetransfer.h>
+
+#include <libavutil/common.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/pixdesc.h>
+
+#include <string.h>
+
+#define POOL_FRAMES 3
+#define HW_WIDTH 256
+#define HW_HEIGHT 128
+
+static void fill_planes(AVFrame *frame, uint8_t value)
+{
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+	for(int p=0; p<4 && frame->data[p]; p++)
+	{
+		int h = p == 0 || p == 3 ? frame->height : AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h);
+		memset(frame->data[p], value, (size_t)frame->linesize[p] * h);
+	}
+}
+
+static MunitResult test_sw_passthrough(const MunitParameter params[], void *user)
+{
+	ChiakiHwFrameTransfer transfer;
+	chiaki_hw_frame_transfer_init(&transfer, NULL, true);
+
+	AVFrame *frame = av_frame_alloc();
+	munit_assert_not_null(frame);
+	frame->format = AV_PIX_FMT_YUV420P;
+	frame->width = 64;
+	frame->height = 64;
+	munit_assert_int(av_frame_get_buffer(frame, 0), ==, 0);
+
+	AVFrame *orig = frame;
+	munit_assert_int(chiaki_hw_frame_transfer_download(&transfer, &frame), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_ptr_equal(frame, orig);
+	munit_assert_uint64(transfer.stats.mapped + transfer.stats.copied + transfer.stats.failed, ==, 0);
+
+	av_frame_free(&frame);
+	chiaki_hw_frame_transfer_fini(&transfer);
+	return MUNIT_OK;
+}
+
+static MunitResult test_pool(const MunitParameter params[], void *user)
+{
+	ChiakiHwFrameTransfer transfer;
+	chiaki_hw_frame_transfer_init(&transfer, NULL, true);
+
+	// like a renderer holding on to a few frames while new ones keep coming
+	AVFrame *frames[POOL_FRAMES] = { 0 };
+	for(int i=0; i<100; i++)
+	{
+		AVFrame **slot = &frames[i % POOL_FRAMES];
+		av_frame_free(slot);
+		*slot = chiaki_hw_frame_transfer_get_buffer(&transfer, AV_PIX_FMT_NV12, 1920, 1080);
+		munit_assert_not_null(*slot);
+		munit_assert_int((*slot)->format, ==, AV_PIX_FMT_NV12);
+		munit_assert_int((*slot)->width, ==, 1920);
+		munit_assert_int((*slot)->height, ==, 1080);
+		for(int p=0; p<2; p++)
+		{
+			munit_assert_int((*slot)->linesize[p] % 64, ==, 0);
+			munit_assert_uint64((uintptr_t)(*slot)->data[p] % 32, ==, 0);
+		}
+		fill_planes(*slot, (uint8_t)i);
+	}
+	munit_assert_uint64(transfer.stats.pool_allocs, ==, POOL_FRAMES);
+
+	// a new size gets a new pool, the frames from the old one stay usable
+	AVFrame *small = chiaki_hw_frame_transfer_get_buffer(&transfer, AV_PIX_FMT_P010, 1280, 720);
+	munit_assert_not_null(small);
+	fill_planes(small, 0x42);
+	munit_assert_uint64(transfer.stats.pool_allocs, ==, POOL_FRAMES + 1);
+	for(int i=0; i<POOL_FRAMES; i++)
+	{
+		fill_planes(frames[i], 0x23);
+		av_frame_free(&frames[i]);
+	}
+
+	av_frame_free(&small);
+	small = chiaki_hw_frame_transfer_get_buffer(&transfer, AV_PIX_FMT_P010, 1280, 720);
+	munit_assert_not_null(small);
+	munit_assert_uint64(transfer.stats.pool_allocs, ==, POOL_FRAMES + 1);
+	av_frame_free(&small);
+
+	munit_assert_null(chiaki_hw_frame_transfer_get_buffer(&transfer, AV_PIX_FMT_NONE, 1280, 720));
+
+	chiaki_hw_frame_transfer_fini(&transfer);
+	return MUNIT_OK;
+}
+
+/**
+ * Any hardware device that can hold NV12 frames, like a software Vulkan implementation on CI.
+ */
+static AVBufferRef *hw_frames_create(void)
+{
+	enum AVHWDeviceType type = AV_HWDEVICE_TYPE_NONE;
+	while((type = av_hwdevice_iterate_types(type)) != AV_HWDEVICE_TYPE_NONE)
+	{
+		AVBufferRef *device = NULL;
+		if(av_hwdevice_ctx_create(&device, type, NULL, NULL, 0) < 0)
+			continue;
+		AVBufferRef *frames_ref = NULL;
+		AVHWFramesConstraints *constraints = av_hwdevice_get_hwframe_constraints(device, NULL);
+		if(constraints && constraints->valid_hw_formats && constraints->valid_hw_formats[0] != AV_PIX_FMT_NONE)
+		{
+			frames_ref = av_hwframe_ctx_alloc(device);
+			if(frames_ref)
+			{
+				AVHWFramesContext *frames = (AVHWFramesContext *)frames_ref->data;
+				frames->format = constraints->valid_hw_formats[0];
+				frames->sw_format = AV_PIX_FMT_NV12;
+				frames->width = HW_WIDTH;
+				frames->height = HW_HEIGHT;
+				frames->initial_pool_size = 4;
+				if(av_hwframe_ctx_init(frames_ref) < 0)
+					av_buffer_unref(&frames_ref);
+			}
+		}
+		if(constraints)
+			av_hwframe_constraints_free(&constraints);
+		av_buffer_unref(&device);
+		if(frames_ref)
+			return frames_ref;
+	}
+	return NULL;
+}
+
+static void check_pattern(const AVFrame *frame)
+{
+	munit_assert_null(frame->hw_frames_ctx);
+	munit_assert_int(frame->width, ==, HW_WIDTH);
+	munit_assert_int(frame->height, ==, HW_HEIGHT);
+	munit_assert_int64(frame->pts, ==, 1234);
+	for(int y=0; y<HW_HEIGHT; y++)
+	{
+		for(int x=0; x<HW_WIDTH; x++)
+			munit_assert_uint8(frame->data[0][y * frame->linesize[0] + x], ==, (uint8_t)(x + y));
+	}
+}
+
+static MunitResult test_hw_download(const MunitParameter params[], void *user)
+{
+	AVBufferRef *frames_ref = hw_frames_create();
+	if(!frames_ref)
+		return MUNIT_SKIP;
+
+	AVFrame *sw = av_frame_alloc();
+	munit_assert_not_null(sw);
+	sw->format = AV_PIX_FMT_NV12;
+	sw->width = HW_WIDTH;
+	sw->height = HW_HEIGHT;
+	munit_assert_int(av_frame_get_buffer(sw, 0), ==, 0);
+	fill_planes(sw, 0x80);
+	for(int y=0; y<HW_HEIGHT; y++)
+	{
+		for(int x=0; x<HW_WIDTH; x++)
+			sw->data[0][y * sw->linesize[0] + x] = (uint8_t)(x + y);
+	}
+
+	AVFrame *hw = av_frame_alloc();
+	munit_assert_not_null(hw);
+	munit_assert_int(av_hwframe_get_buffer(frames_ref, hw, 0), ==, 0);
+	munit_assert_int(av_hwframe_transfer_data(hw, sw, 0), ==, 0);
+	hw->pts = 1234;
+
+	for(int allow_map=0; allow_map<2; allow_map++)
+	{
+		ChiakiHwFrameTransfer transfer;
+		chiaki_hw_frame_transfer_init(&transfer, NULL, allow_map);
+		AVFrame *held[POOL_FRAMES] = { 0 };
+		for(int i=0; i<30; i++)
+		{
+			av_frame_free(&held[i % POOL_FRAMES]);
+			AVFrame *frame = av_frame_clone(hw);
+			munit_assert_not_null(frame);
+			munit_assert_int(chiaki_hw_frame_transfer_download(&transfer, &frame), ==, CHIAKI_ERR_SUCCESS);
+			check_pattern(frame);
+			held[i % POOL_FRAMES] = frame;
+		}
+		for(int i=0; i<POOL_FRAMES; i++)
+			av_frame_free(&held[i]);
+
+		munit_assert_uint64(transfer.stats.failed, ==, 0);
+		munit_assert_uint64(transfer.stats.mapped + transfer.stats.copied, ==, 30);
+		if(!allow_map)
+			munit_assert_uint64(transfer.stats.mapped, ==, 0);
+		// one buffer per frame held at the same time, no matter how many are downloaded
+		munit_assert_uint64(transfer.stats.pool_allocs, <=, POOL_FRAMES);
+		chiaki_hw_frame_transfer_fini(&transfer);
+	}
+
+	av_frame_free(&hw);
+	av_frame_free(&sw);
+	av_buffer_unref(&frames_ref);
+	return MUNIT_OK;
+}
+
+MunitTest tests_hw_frame_transfer[] = {
+	{
+		"/sw_passthrough",
+		test_sw_passthrough,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/pool",
+		test_pool,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/hw_download",
+		test_hw_download,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
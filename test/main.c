@@ -13,8 +13,36 @@ extern MunitTest tests_takion[];
 extern MunitTest tests_fec[];
 extern MunitTest tests_regist[];
 extern MunitTest tests_bitstream[];
+extern MunitTest tests_dpb[];
+extern MunitTest tests_audio_receiver[];
+extern MunitTest tests_audio_ring[];
+extern MunitTest tests_audio_resampler[];
+extern MunitTest tests_frame_pacer[];
+extern MunitTest tests_stun_client[];
+extern MunitTest tests_path_cache[];
+extern MunitTest tests_http_client[];
+extern MunitTest tests_port_guess[];
+extern MunitTest tests_rudp[];
+extern MunitTest tests_discovery[];
+extern MunitTest tests_discovery_service[];
+extern MunitTest tests_executor[];
+extern MunitTest tests_haptics[];
+extern MunitTest tests_orientation[];
+extern MunitTest tests_controller_input[];
+extern MunitTest tests_frame_mailbox[];
 #if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
 extern MunitTest tests_ffmpegdecoder[];
+extern MunitTest tests_hw_frame_transfer[];
+extern MunitTest tests_recorder[];
+#endif
+#ifdef CHIAKI_UNIT_ENABLE_STEAMDECK_NATIVE
+extern MunitTest tests_sdeck[];
+#endif
+#ifdef CHIAKI_UNIT_ENABLE_SETSU
+extern MunitTest tests_setsu[];
+#endif
+#ifdef CHIAKI_UNIT_ENABLE_CLI
+extern MunitTest tests_cli[];
 #endif
 
 static MunitSuite suites[] = {
@@ -88,6 +116,125 @@ static MunitSuite suites[] = {
 		1,
 		MUNIT_SUITE_OPTION_NONE
 	},
+	{
+		"/dpb",
+		tests_dpb,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/audio_receiver",
+		tests_audio_receiver,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/audio_ring",
+		tests_audio_ring,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/audio_resampler",
+		tests_audio_resampler,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/frame_pacer",
+		tests_frame_pacer,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/stun_client",
+		tests_stun_client,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/path_cache",
+		tests_path_cache,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/http_client",
+		tests_http_client,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/port_guess",
+		tests_port_guess,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/rudp",
+		tests_rudp,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/discovery",
+		tests_discovery,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/discovery_service",
+		tests_discovery_service,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/executor",
+		tests_executor,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/haptics",
+		tests_haptics,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/orientation",
+		tests_orientation,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/controllerinput",
+		tests_controller_input,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/framemailbox",
+		tests_frame_mailbox,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
 #if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
 	{
 		"/ffmpegdecoder",
@@ -96,6 +243,47 @@ static MunitSuite suites[] = {
 		1,
 		MUNIT_SUITE_OPTION_NONE
 	},
+	{
+		"/hwframetransfer",
+		tests_hw_frame_transfer,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/recorder",
+		tests_recorder,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+#endif
+#ifdef CHIAKI_UNIT_ENABLE_STEAMDECK_NATIVE
+	{
+		"/sdeck",
+		tests_sdeck,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+#endif
+#ifdef CHIAKI_UNIT_ENABLE_SETSU
+	{
+		"/setsu",
+		tests_setsu,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+#endif
+#ifdef CHIAKI_UNIT_ENABLE_CLI
+	{
+		"/cli",
+		tests_cli,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
 #endif
 	{ NULL, NULL, NULL, 0, MUNIT_SUITE_OPTION_NONE }
 };
@@ -0,0 +1,542 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/orientation.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/**
+ * Replays of a synthetic IMU recording with known ground truth:
+ * rests and rotations around every axis, a gyro with bias and noise,
+ * samples delivered in batches like the controllers do and the orientation taken on the feedback sender's tick.
+ * The recording is generated from a fixed seed, so every run replays the exact same samples.
+ */
+
+#define TRUTH_STEP_US 100
+#define RECORDING_US 24000000
+#define SAMPLE_INTERVAL_US 4000 // 250Hz
+#define ACCEL_OFFSET_US 1000 // when gyro and accel are separate readings
+#define BATCH_INTERVAL_US 8000
+#define BATCH_DELAY_US 2000
+#define TICK_INTERVAL_US 8000 // FEEDBACK_STATE_TIMEOUT_MIN_MS
+#define TICK_OFFSET_US 4300
+#define DRIFT_WINDOW_US 2000000
+
+#define GYRO_BIAS_X 0.015
+#define GYRO_BIAS_Y -0.02
+#define GYRO_BIAS_Z 0.01
+#define GYRO_NOISE 0.005
+#define ACCEL_NOISE 0.004
+
+#define RATE_MOVING 0.3
+
+typedef struct quat_t
+{
+	double w, x, y, z;
+} Quat;
+
+static Quat quat_mul(Quat a, Quat b)
+{
+	Quat r;
+	r.w = a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z;
+	r.x = a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y;
+	r.y = a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x;
+	r.z = a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w;
+	return r;
+}
+
+static double quat_angle(Quat a, Quat b)
+{
+	double d = fabs(a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z);
+	return d >= 1.0 ? 0.0 : 2.0 * acos(d);
+}
+
+static Quat quat_from_orient(const ChiakiOrientation *orient)
+{
+	// the fuzz filter of chiaki_orientation_update() leaves it not quite normalized
+	double norm = sqrt(orient->w * orient->w + orient->x * orient->x + orient->y * orient->y + orient->z * orient->z);
+	Quat q = { orient->w / norm, orient->x / norm, orient->y / norm, orient->z / norm };
+	return q;
+}
+
+// gravity in the sensor frame, as the accelerometer sees it at rest
+static void quat_gravity(Quat q, double *ax, double *ay, double *az)
+{
+	*ax = 2.0 * (q.x * q.z - q.w * q.y);
+	*ay = 2.0 * (q.w * q.x + q.y * q.z);
+	*az = q.w * q.w - q.x * q.x - q.y * q.y + q.z * q.z;
+}
+
+/**
+ * Body rates of the recording: 2s rest, then a rotation of 2s around each axis in turn,
+ * rests in between, and back again so the recording ends where it started.
+ */
+static void truth_rates(uint64_t t_us, double *gx, double *gy, double *gz)
+{
+	static const double segments[][3] = {
+		{ 0.0, 0.0, 0.0 },
+		{ 0.0, 1.2, 0.0 },
+		{ 0.0, 0.0, 0.0 },
+		{ 0.9, 0.0, 0.0 },
+		{ 0.0, 0.0, 0.0 },
+		{ 0.0, 0.0, -0.8 },
+		{ 0.0, 0.0, 0.0 },
+		{ 0.0, 0.0, 0.8 },
+		{ 0.0, 0.0, 0.0 },
+		{ -0.9, 0.0, 0.0 },
+		{ 0.0, 0.0, 0.0 },
+		{ 0.0, -1.2, 0.0 }
+	};
+	size_t segment = t_us / 2000000;
+	*gx = *gy = *gz = 0.0;
+	if(segment >= sizeof(segments) / sizeof(segments[0]))
+		return;
+	// smooth start and stop, the peak rate is twice the mean
+	double s = sin(M_PI * (double)(t_us % 2000000) / 2000000.0);
+	double shape = 2.0 * s * s;
+	*gx = segments[segment][0] * shape;
+	*gy = segments[segment][1] * shape;
+	*gz = segments[segment][2] * shape;
+}
+
+typedef struct recording_t
+{
+	Quat *truth; // every TRUTH_STEP_US
+	size_t truth_count;
+	ChiakiMotionSample *samples; // in order of delivery
+	uint64_t *arrival_us;
+	size_t samples_count;
+} Recording;
+
+static uint64_t rng_state;
+
+static double rng_uniform()
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return ((double)(rng_state >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static double rng_gauss()
+{
+	return sqrt(-2.0 * log(rng_uniform())) * cos(2.0 * M_PI * rng_uniform());
+}
+
+static Quat truth_at(Recording *rec, uint64_t t_us)
+{
+	size_t i = t_us / TRUTH_STEP_US;
+	if(i >= rec->truth_count)
+		i = rec->truth_count - 1;
+	return rec->truth[i];
+}
+
+static int sample_cmp_arrival(const void *a, const void *b)
+{
+	const ChiakiMotionSample *sa = a, *sb = b;
+	uint64_t aa = (sa->timestamp_us + BATCH_DELAY_US + BATCH_INTERVAL_US - 1) / BATCH_INTERVAL_US;
+	uint64_t ab = (sb->timestamp_us + BATCH_DELAY_US + BATCH_INTERVAL_US - 1) / BATCH_INTERVAL_US;
+	if(aa != ab)
+		return aa < ab ? -1 : 1;
+	if(sa->timestamp_us != sb->timestamp_us)
+		return sa->timestamp_us < sb->timestamp_us ? -1 : 1;
+	return 0;
+}
+
+/**
+ * @param split gyro and accel as separate readings, delivered out of order within their batch
+ */
+static void recording_init(Recording *rec, bool split)
+{
+	rng_state = 0x2545f4914f6cdd1dULL;
+	rec->truth_count = RECORDING_US / TRUTH_STEP_US + 1;
+	rec->truth = malloc(rec->truth_count * sizeof(Quat));
+	munit_assert_not_null(rec->truth);
+	// level, as chiaki_orientation_init()
+	Quat q = { cos(M_PI / 4.0), sin(M_PI / 4.0), 0.0, 0.0 };
+	for(size_t i=0; i<rec->truth_count; i++)
+	{
+		rec->truth[i] = q;
+		double gx, gy, gz;
+		truth_rates(i * TRUTH_STEP_US + TRUTH_STEP_US / 2, &gx, &gy, &gz);
+		double rate = sqrt(gx * gx + gy * gy + gz * gz);
+		if(rate <= 0.0)
+			continue;
+		double half = 0.5 * rate * TRUTH_STEP_US / 1000000.0;
+		Quat d = { cos(half), gx / rate * sin(half), gy / rate * sin(half), gz / rate * sin(half) };
+		q = quat_mul(q, d);
+	}
+
+	size_t readings = RECORDING_US / SAMPLE_INTERVAL_US;
+	rec->samples = calloc(readings * 2, sizeof(ChiakiMotionSample));
+	rec->arrival_us = calloc(readings * 2, sizeof(uint64_t));
+	munit_assert_not_null(rec->samples);
+	munit_assert_not_null(rec->arrival_us);
+	rec->samples_count = 0;
+	for(size_t i=0; i<readings; i++)
+	{
+		uint64_t t_us = i * SAMPLE_INTERVAL_US;
+		ChiakiMotionSample *gyro = &rec->samples[rec->samples_count++];
+		double gx, gy, gz;
+		truth_rates(t_us, &gx, &gy, &gz);
+		gyro->timestamp_us = t_us;
+		gyro->flags = CHIAKI_MOTION_SAMPLE_GYRO;
+		gyro->gyro_x = gx + GYRO_BIAS_X + GYRO_NOISE * rng_gauss();
+		gyro->gyro_y = gy + GYRO_BIAS_Y + GYRO_NOISE * rng_gauss();
+		gyro->gyro_z = gz + GYRO_BIAS_Z + GYRO_NOISE * rng_gauss();
+
+		ChiakiMotionSample *accel = gyro;
+		if(split)
+		{
+			accel = &rec->samples[rec->samples_count++];
+			accel->timestamp_us = t_us + ACCEL_OFFSET_US;
+		}
+		double ax, ay, az;
+		quat_gravity(truth_at(rec, accel->timestamp_us), &ax, &ay, &az);
+		accel->flags |= CHIAKI_MOTION_SAMPLE_ACCEL;
+		accel->accel_x = ax + ACCEL_NOISE * rng_gauss();
+		accel->accel_y = ay + ACCEL_NOISE * rng_gauss();
+		accel->accel_z = az + ACCEL_NOISE * rng_gauss();
+	}
+
+	qsort(rec->samples, rec->samples_count, sizeof(ChiakiMotionSample), sample_cmp_arrival);
+	size_t batch_start = 0;
+	for(size_t i=0; i<rec->samples_count; i++)
+	{
+		uint64_t batch = (rec->samples[i].timestamp_us + BATCH_DELAY_US + BATCH_INTERVAL_US - 1) / BATCH_INTERVAL_US;
+		rec->arrival_us[i] = batch * BATCH_INTERVAL_US;
+		if(i + 1 < rec->samples_count && rec->arrival_us[i] == (rec->samples[i + 1].timestamp_us + BATCH_DELAY_US + BATCH_INTERVAL_US - 1) / BATCH_INTERVAL_US * BATCH_INTERVAL_US)
+			continue;
+		if(split)
+		{
+			// shuffle the batch
+			for(size_t j=i; j>batch_start; j--)
+			{
+				size_t k = batch_start + (size_t)(rng_uniform() * (double)(j - batch_start + 1));
+				if(k > j)
+					k = j;
+				ChiakiMotionSample tmp = rec->samples[j];
+				rec->samples[j] = rec->samples[k];
+				rec->samples[k] = tmp;
+			}
+		}
+		batch_start = i + 1;
+	}
+}
+
+static void recording_fini(Recording *rec)
+{
+	free(rec->truth);
+	free(rec->samples);
+	free(rec->arrival_us);
+}
+
+/**
+ * The filter as used before ChiakiMotionFusion: Madgwick applied to each sample in order of arrival,
+ * with the latest reading of the other sensor.
+ */
+typedef struct madgwick_replay_t
+{
+	ChiakiOrientation orient;
+	float gyro_x, gyro_y, gyro_z;
+	float accel_x, accel_y, accel_z;
+	uint32_t timestamp;
+	uint64_t sample_index;
+} MadgwickReplay;
+
+static void madgwick_replay_init(MadgwickReplay *replay)
+{
+	memset(replay, 0, sizeof(*replay));
+	chiaki_orientation_init(&replay->orient);
+	replay->accel_y = 1.0f;
+}
+
+static void madgwick_replay_push(MadgwickReplay *replay, const ChiakiMotionSample *sample)
+{
+	if(sample->flags & CHIAKI_MOTION_SAMPLE_GYRO)
+	{
+		replay->gyro_x = sample->gyro_x;
+		replay->gyro_y = sample->gyro_y;
+		replay->gyro_z = sample->gyro_z;
+	}
+	if(sample->flags & CHIAKI_MOTION_SAMPLE_ACCEL)
+	{
+		replay->accel_x = sample->accel_x;
+		replay->accel_y = sample->accel_y;
+		replay->accel_z = sample->accel_z;
+	}
+	uint32_t timestamp_us = (uint32_t)sample->timestamp_us;
+	replay->sample_index++;
+	if(replay->sample_index <= 1)
+	{
+		replay->timestamp = timestamp_us;
+		return;
+	}
+	uint64_t delta_us = timestamp_us;
+	if(delta_us < replay->timestamp)
+		delta_us += (1ULL << 32);
+	delta_us -= replay->timestamp;
+	replay->timestamp = timestamp_us;
+	chiaki_orientation_update(&replay->orient, replay->gyro_x, replay->gyro_y, replay->gyro_z,
+			replay->accel_x, replay->accel_y, replay->accel_z,
+			replay->sample_index < 30 ? 20.0f : 0.05f, (float)delta_us / 1000000.0f);
+}
+
+typedef struct replay_result_t
+{
+	double drift_deg; // mean error over the rest at the end
+	double error_max_deg;
+	double latency_ms; // lag of the rotation speed behind the truth
+} ReplayResult;
+
+typedef struct replay_t
+{
+	ChiakiMotionFusion fusion;
+	MadgwickReplay madgwick;
+	Quat *fusion_ticks, *madgwick_ticks;
+	size_t ticks_count;
+} Replay;
+
+static void replay_run(Replay *replay, Recording *rec)
+{
+	chiaki_motion_fusion_init(&replay->fusion);
+	madgwick_replay_init(&replay->madgwick);
+	replay->ticks_count = (RECORDING_US - TICK_OFFSET_US) / TICK_INTERVAL_US;
+	replay->fusion_ticks = calloc(replay->ticks_count, sizeof(Quat));
+	replay->madgwick_ticks = calloc(replay->ticks_count, sizeof(Quat));
+	munit_assert_not_null(replay->fusion_ticks);
+	munit_assert_not_null(replay->madgwick_ticks);
+	size_t next = 0;
+	for(size_t k=0; k<replay->ticks_count; k++)
+	{
+		uint64_t tick_us = TICK_OFFSET_US + k * TICK_INTERVAL_US;
+		for(; next < rec->samples_count && rec->arrival_us[next] <= tick_us; next++)
+		{
+			chiaki_motion_fusion_push(&replay->fusion, &rec->samples[next]);
+			madgwick_replay_push(&replay->madgwick, &rec->samples[next]);
+		}
+		ChiakiOrientation orient;
+		chiaki_motion_fusion_get(&replay->fusion, tick_us, &orient);
+		replay->fusion_ticks[k] = quat_from_orient(&orient);
+		replay->madgwick_ticks[k] = quat_from_orient(&replay->madgwick.orient);
+	}
+}
+
+static void replay_fini(Replay *replay)
+{
+	free(replay->fusion_ticks);
+	free(replay->madgwick_ticks);
+}
+
+static ReplayResult replay_evaluate(Recording *rec, Quat *ticks, size_t ticks_count)
+{
+	ReplayResult result = { 0 };
+	size_t drift_count = 0;
+	for(size_t k=0; k<ticks_count; k++)
+	{
+		uint64_t tick_us = TICK_OFFSET_US + k * TICK_INTERVAL_US;
+		double error = quat_angle(ticks[k], truth_at(rec, tick_us)) * 180.0 / M_PI;
+		if(error > result.error_max_deg)
+			result.error_max_deg = error;
+		if(tick_us >= RECORDING_US - DRIFT_WINDOW_US)
+		{
+			result.drift_deg += error;
+			drift_count++;
+		}
+	}
+	result.drift_deg /= drift_count;
+
+	// find the lag at which the speed between ticks while moving matches the truth best,
+	// unaffected by any constant offset
+	double best = INFINITY;
+	for(uint64_t lag_us=0; lag_us<=60000; lag_us+=TRUTH_STEP_US)
+	{
+		double sum = 0.0;
+		for(size_t k=1; k<ticks_count; k++)
+		{
+			uint64_t tick_us = TICK_OFFSET_US + k * TICK_INTERVAL_US;
+			double gx, gy, gz;
+			truth_rates(tick_us, &gx, &gy, &gz);
+			if(sqrt(gx * gx + gy * gy + gz * gz) < RATE_MOVING)
+				continue;
+			double speed = quat_angle(ticks[k - 1], ticks[k]);
+			double speed_truth = quat_angle(truth_at(rec, tick_us - TICK_INTERVAL_US - lag_us), truth_at(rec, tick_us - lag_us));
+			sum += (speed - speed_truth) * (speed - speed_truth);
+		}
+		if(sum < best)
+		{
+			best = sum;
+			result.latency_ms = (double)lag_us / 1000.0;
+		}
+	}
+	return result;
+}
+
+static MunitResult test_fusion_gravity(const MunitParameter params[], void *user)
+{
+	static const float accels[][3] = {
+		{ 0.0f, 1.0f, 0.0f },
+		{ 0.0f, 0.0f, 1.0f },
+		{ 0.0f, 0.0f, -1.0f },
+		{ 0.5f, 0.7f, -0.3f },
+		{ -1.0f, 0.1f, 0.0f },
+		{ 0.0f, -1.0f, 0.0f }
+	};
+	for(size_t i=0; i<sizeof(accels)/sizeof(accels[0]); i++)
+	{
+		ChiakiMotionFusion fusion;
+		chiaki_motion_fusion_init(&fusion);
+		ChiakiOrientation orient;
+		munit_assert_false(chiaki_motion_fusion_get(&fusion, 0, &orient));
+
+		ChiakiMotionSample sample = { 0 };
+		sample.timestamp_us = 1000;
+		sample.flags = CHIAKI_MOTION_SAMPLE_ACCEL;
+		sample.accel_x = accels[i][0];
+		sample.accel_y = accels[i][1];
+		sample.accel_z = accels[i][2];
+		chiaki_motion_fusion_push(&fusion, &sample);
+		munit_assert_true(chiaki_motion_fusion_get(&fusion, 1000, &orient));
+
+		// the first reading sets the tilt right away
+		double norm = sqrt(accels[i][0] * accels[i][0] + accels[i][1] * accels[i][1] + accels[i][2] * accels[i][2]);
+		double ax, ay, az;
+		quat_gravity(quat_from_orient(&orient), &ax, &ay, &az);
+		munit_assert_double_equal(ax, accels[i][0] / norm, 4);
+		munit_assert_double_equal(ay, accels[i][1] / norm, 4);
+		munit_assert_double_equal(az, accels[i][2] / norm, 4);
+	}
+
+	// level is the same orientation the old filter starts with
+	ChiakiMotionFusion fusion;
+	chiaki_motion_fusion_init(&fusion);
+	ChiakiMotionSample sample = { 0 };
+	sample.flags = CHIAKI_MOTION_SAMPLE_ACCEL;
+	sample.accel_y = 1.0f;
+	chiaki_motion_fusion_push(&fusion, &sample);
+	ChiakiOrientation orient, level;
+	chiaki_motion_fusion_get(&fusion, 0, &orient);
+	chiaki_orientation_init(&level);
+	munit_assert_double(quat_angle(quat_from_orient(&orient), quat_from_orient(&level)), <, 1e-3);
+	return MUNIT_OK;
+}
+
+static MunitResult test_fusion_late(const MunitParameter params[], void *user)
+{
+	ChiakiMotionFusion fusion;
+	chiaki_motion_fusion_init(&fusion);
+	ChiakiMotionSample sample = { 0 };
+	sample.flags = CHIAKI_MOTION_SAMPLE_GYRO | CHIAKI_MOTION_SAMPLE_ACCEL;
+	sample.accel_y = 1.0f;
+	for(uint64_t t_us=0; t_us<=100000; t_us+=4000)
+	{
+		sample.timestamp_us = t_us;
+		chiaki_motion_fusion_push(&fusion, &sample);
+	}
+	munit_assert_uint64(fusion.dropped, ==, 0);
+	munit_assert_size(fusion.queue_count, <=, CHIAKI_MOTION_FUSION_REORDER_US / 4000 + 1);
+
+	// within the reorder window is fine, older than that was already integrated
+	sample.timestamp_us = 100000 - CHIAKI_MOTION_FUSION_REORDER_US / 2;
+	chiaki_motion_fusion_push(&fusion, &sample);
+	munit_assert_uint64(fusion.dropped, ==, 0);
+	sample.timestamp_us = 100000 - CHIAKI_MOTION_FUSION_REORDER_US * 2;
+	chiaki_motion_fusion_push(&fusion, &sample);
+	munit_assert_uint64(fusion.dropped, ==, 1);
+
+	// samples at any time never overflow the queue
+	for(size_t i=0; i<CHIAKI_MOTION_FUSION_QUEUE_SIZE * 2; i++)
+	{
+		sample.timestamp_us = 100000 + i;
+		chiaki_motion_fusion_push(&fusion, &sample);
+	}
+	munit_assert_size(fusion.queue_count, <=, CHIAKI_MOTION_FUSION_QUEUE_SIZE);
+	return MUNIT_OK;
+}
+
+static MunitResult test_fusion_replay(const MunitParameter params[], void *user)
+{
+	Recording rec;
+	recording_init(&rec, false);
+	Replay replay;
+	replay_run(&replay, &rec);
+	ReplayResult fusion = replay_evaluate(&rec, replay.fusion_ticks, replay.ticks_count);
+	ReplayResult madgwick = replay_evaluate(&rec, replay.madgwick_ticks, replay.ticks_count);
+	munit_logf(MUNIT_LOG_INFO, "Fusion: drift %.2f deg, max error %.2f deg, latency %.1f ms",
+			fusion.drift_deg, fusion.error_max_deg, fusion.latency_ms);
+	munit_logf(MUNIT_LOG_INFO, "Madgwick: drift %.2f deg, max error %.2f deg, latency %.1f ms",
+			madgwick.drift_deg, madgwick.error_max_deg, madgwick.latency_ms);
+	munit_assert_uint64(replay.fusion.dropped, ==, 0);
+	munit_assert_double(fusion.drift_deg, <, 3.0);
+	munit_assert_double(fusion.drift_deg, <, madgwick.drift_deg);
+	munit_assert_double(fusion.latency_ms, <, 2.0);
+	munit_assert_double(fusion.latency_ms, <, madgwick.latency_ms);
+	replay_fini(&replay);
+	recording_fini(&rec);
+	return MUNIT_OK;
+}
+
+static MunitResult test_fusion_reorder(const MunitParameter params[], void *user)
+{
+	// gyro and accel as separate readings, shuffled within each batch
+	Recording rec;
+	recording_init(&rec, true);
+	Replay replay;
+	replay_run(&replay, &rec);
+	ReplayResult fusion = replay_evaluate(&rec, replay.fusion_ticks, replay.ticks_count);
+	ReplayResult madgwick = replay_evaluate(&rec, replay.madgwick_ticks, replay.ticks_count);
+	munit_logf(MUNIT_LOG_INFO, "Fusion: drift %.2f deg, max error %.2f deg, latency %.1f ms",
+			fusion.drift_deg, fusion.error_max_deg, fusion.latency_ms);
+	munit_logf(MUNIT_LOG_INFO, "Madgwick: drift %.2f deg, max error %.2f deg, latency %.1f ms",
+			madgwick.drift_deg, madgwick.error_max_deg, madgwick.latency_ms);
+	munit_assert_uint64(replay.fusion.dropped, ==, 0);
+	munit_assert_double(fusion.drift_deg, <, 3.0);
+	munit_assert_double(fusion.drift_deg, <, madgwick.drift_deg);
+	munit_assert_double(fusion.latency_ms, <, 2.0);
+	replay_fini(&replay);
+	recording_fini(&rec);
+	return MUNIT_OK;
+}
+
+MunitTest tests_orientation[] = {
+	{
+		"/fusion_gravity",
+		test_fusion_gravity,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/fusion_late",
+		test_fusion_late,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/fusion_replay",
+		test_fusion_replay,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/fusion_reorder",
+		test_fusion_reorder,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
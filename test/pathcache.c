@@ -0,0 +1,279 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/remote/pathcache.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "test_log.h"
+
+static void path_cache_file_name(char *buf, size_t size)
+{
+	snprintf(buf, size, "chiaki-test-network-paths-%08x.json", (unsigned int)munit_rand_uint32());
+}
+
+static void make_path(ChiakiNetworkPath *path, const char *descriptor)
+{
+	memset(path, 0, sizeof(*path));
+	chiaki_network_identity_from_descriptor(descriptor, path->network_id);
+}
+
+static MunitResult test_save_load(const MunitParameter params[], void *user)
+{
+	char file[64];
+	path_cache_file_name(file, sizeof(file));
+
+	ChiakiNetworkPathCache cache;
+	ChiakiErrorCode err = chiaki_network_path_cache_init(&cache, file, get_test_log());
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(cache.entries_count, ==, 0);
+
+	ChiakiNetworkPath path;
+	make_path(&path, "if=wlan0;net=192.168.1.0/255.255.255.0;gw=192.168.1.1;gwmac=00:11:22:33:44:55");
+	path.allocation_known = true;
+	path.allocation_increment = 2;
+	path.upnp = CHIAKI_NETWORK_PATH_UPNP_FOUND;
+	snprintf(path.upnp_root_desc_url, sizeof(path.upnp_root_desc_url), "http://192.168.1.1:5000/rootDesc.xml");
+	chiaki_network_path_add_stun_server(&path, "stun.example.org", 3478);
+	chiaki_network_path_add_stun_server(&path, "stun2.example.org", 19302);
+	snprintf(path.console_uid, sizeof(path.console_uid), "%064x", 0x1234);
+	path.candidate_type = 2;
+	snprintf(path.candidate_addr, sizeof(path.candidate_addr), "198.51.100.23");
+	path.candidate_port = 9296;
+	chiaki_network_path_cache_store(&cache, &path);
+
+	ChiakiNetworkPath other;
+	make_path(&other, "if=eth0;net=10.0.0.0/255.0.0.0;gw=10.0.0.1;gwmac=");
+	other.upnp = CHIAKI_NETWORK_PATH_UPNP_NONE;
+	other.allocation_known = true;
+	other.random_allocation = true;
+	chiaki_network_path_cache_store(&cache, &other);
+
+	err = chiaki_network_path_cache_save(&cache);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_network_path_cache_fini(&cache);
+
+	err = chiaki_network_path_cache_init(&cache, file, get_test_log());
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(cache.entries_count, ==, 2);
+
+	ChiakiNetworkPath loaded;
+	munit_assert_true(chiaki_network_path_cache_lookup(&cache, path.network_id, CHIAKI_NETWORK_PATH_MAX_AGE_SEC, &loaded));
+	munit_assert_string_equal(loaded.network_id, path.network_id);
+	munit_assert_uint64(loaded.updated, ==, path.updated);
+	munit_assert_true(loaded.allocation_known);
+	munit_assert_int32(loaded.allocation_increment, ==, 2);
+	munit_assert_false(loaded.random_allocation);
+	munit_assert_int(loaded.upnp, ==, CHIAKI_NETWORK_PATH_UPNP_FOUND);
+	munit_assert_string_equal(loaded.upnp_root_desc_url, path.upnp_root_desc_url);
+	munit_assert_size(loaded.stun_servers_count, ==, 2);
+	munit_assert_string_equal(loaded.stun_servers[0].host, "stun2.example.org");
+	munit_assert_uint16(loaded.stun_servers[0].port, ==, 19302);
+	munit_assert_string_equal(loaded.stun_servers[1].host, "stun.example.org");
+	munit_assert_uint16(loaded.stun_servers[1].port, ==, 3478);
+	munit_assert_string_equal(loaded.console_uid, path.console_uid);
+	munit_assert_int(loaded.candidate_type, ==, 2);
+	munit_assert_string_equal(loaded.candidate_addr, "198.51.100.23");
+	munit_assert_uint16(loaded.candidate_port, ==, 9296);
+
+	munit_assert_true(chiaki_network_path_cache_lookup(&cache, other.network_id, CHIAKI_NETWORK_PATH_MAX_AGE_SEC, &loaded));
+	munit_assert_int(loaded.upnp, ==, CHIAKI_NETWORK_PATH_UPNP_NONE);
+	munit_assert_true(loaded.allocation_known);
+	munit_assert_true(loaded.random_allocation);
+	munit_assert_size(loaded.stun_servers_count, ==, 0);
+	munit_assert_char(loaded.console_uid[0], ==, '\0');
+
+	chiaki_network_path_cache_fini(&cache);
+	remove(file);
+	return MUNIT_OK;
+}
+
+static MunitResult test_corrupt_file(const MunitParameter params[], void *user)
+{
+	char file[64];
+	path_cache_file_name(file, sizeof(file));
+	FILE *f = fopen(file, "wb");
+	munit_assert_not_null(f);
+	fputs("{\"version\": 1, \"paths\": [{\"network_id\"", f);
+	fclose(f);
+
+	ChiakiNetworkPathCache cache;
+	ChiakiErrorCode err = chiaki_network_path_cache_init(&cache, file, get_test_log());
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(cache.entries_count, ==, 0);
+	chiaki_network_path_cache_fini(&cache);
+	remove(file);
+	return MUNIT_OK;
+}
+
+static MunitResult test_lookup_max_age(const MunitParameter params[], void *user)
+{
+	ChiakiNetworkPathCache cache;
+	ChiakiErrorCode err = chiaki_network_path_cache_init(&cache, NULL, get_test_log());
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiNetworkPath path;
+	make_path(&path, "home");
+	chiaki_network_path_cache_store(&cache, &path);
+
+	ChiakiNetworkPath out;
+	munit_assert_true(chiaki_network_path_cache_lookup(&cache, path.network_id, 60, &out));
+	munit_assert_false(chiaki_network_path_cache_lookup(&cache, "0000000000000000", 60, &out));
+
+	// pretend the entry was stored long ago
+	cache.entries[0].updated = (uint64_t)time(NULL) - 120;
+	munit_assert_false(chiaki_network_path_cache_lookup(&cache, path.network_id, 60, &out));
+	munit_assert_true(chiaki_network_path_cache_lookup(&cache, path.network_id, 0, &out));
+
+	chiaki_network_path_cache_fini(&cache);
+	return MUNIT_OK;
+}
+
+static MunitResult test_evict(const MunitParameter params[], void *user)
+{
+	ChiakiNetworkPathCache cache;
+	ChiakiErrorCode err = chiaki_network_path_cache_init(&cache, NULL, get_test_log());
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	char descriptor[32];
+	ChiakiNetworkPath path;
+	for(size_t i=0; i<CHIAKI_NETWORK_PATH_CACHE_ENTRIES_MAX; i++)
+	{
+		snprintf(descriptor, sizeof(descriptor), "network %zu", i);
+		make_path(&path, descriptor);
+		chiaki_network_path_cache_store(&cache, &path);
+	}
+	munit_assert_size(cache.entries_count, ==, CHIAKI_NETWORK_PATH_CACHE_ENTRIES_MAX);
+	// network 3 is the least recently updated one
+	for(size_t i=0; i<CHIAKI_NETWORK_PATH_CACHE_ENTRIES_MAX; i++)
+		cache.entries[i].updated = 1000 + i;
+	cache.entries[3].updated = 1;
+
+	// updating an existing entry must not evict anything
+	make_path(&path, "network 5");
+	path.candidate_port = 1234;
+	chiaki_network_path_cache_store(&cache, &path);
+	munit_assert_size(cache.entries_count, ==, CHIAKI_NETWORK_PATH_CACHE_ENTRIES_MAX);
+
+	ChiakiNetworkPath out;
+	munit_assert_true(chiaki_network_path_cache_lookup(&cache, path.network_id, 0, &out));
+	munit_assert_uint16(out.candidate_port, ==, 1234);
+
+	ChiakiNetworkPath evicted;
+	make_path(&evicted, "network 3");
+	make_path(&path, "new network");
+	chiaki_network_path_cache_store(&cache, &path);
+	munit_assert_size(cache.entries_count, ==, CHIAKI_NETWORK_PATH_CACHE_ENTRIES_MAX);
+	munit_assert_true(chiaki_network_path_cache_lookup(&cache, path.network_id, 0, &out));
+	munit_assert_false(chiaki_network_path_cache_lookup(&cache, evicted.network_id, 0, &out));
+	make_path(&path, "network 2");
+	munit_assert_true(chiaki_network_path_cache_lookup(&cache, path.network_id, 0, &out));
+
+	chiaki_network_path_cache_fini(&cache);
+	return MUNIT_OK;
+}
+
+static MunitResult test_stun_servers(const MunitParameter params[], void *user)
+{
+	ChiakiNetworkPath path;
+	make_path(&path, "home");
+
+	chiaki_network_path_add_stun_server(&path, "a", 1);
+	chiaki_network_path_add_stun_server(&path, "b", 2);
+	chiaki_network_path_add_stun_server(&path, "c", 3);
+	munit_assert_size(path.stun_servers_count, ==, 3);
+	munit_assert_string_equal(path.stun_servers[0].host, "c");
+	munit_assert_string_equal(path.stun_servers[2].host, "a");
+
+	// known server moves to the front without duplicating
+	chiaki_network_path_add_stun_server(&path, "a", 1);
+	munit_assert_size(path.stun_servers_count, ==, 3);
+	munit_assert_string_equal(path.stun_servers[0].host, "a");
+	munit_assert_string_equal(path.stun_servers[1].host, "c");
+	munit_assert_string_equal(path.stun_servers[2].host, "b");
+
+	// same host on another port is another server
+	chiaki_network_path_add_stun_server(&path, "a", 4);
+	munit_assert_size(path.stun_servers_count, ==, 4);
+	munit_assert_uint16(path.stun_servers[0].port, ==, 4);
+
+	// full list drops the oldest
+	chiaki_network_path_add_stun_server(&path, "d", 5);
+	munit_assert_size(path.stun_servers_count, ==, CHIAKI_NETWORK_PATH_STUN_SERVERS_MAX);
+	munit_assert_string_equal(path.stun_servers[0].host, "d");
+	munit_assert_string_equal(path.stun_servers[3].host, "c");
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_identity_from_descriptor(const MunitParameter params[], void *user)
+{
+	char a[CHIAKI_NETWORK_ID_SIZE];
+	char b[CHIAKI_NETWORK_ID_SIZE];
+	chiaki_network_identity_from_descriptor("if=wlan0;gw=192.168.1.1", a);
+	chiaki_network_identity_from_descriptor("if=wlan0;gw=192.168.1.1", b);
+	munit_assert_size(strlen(a), ==, CHIAKI_NETWORK_ID_SIZE - 1);
+	munit_assert_string_equal(a, b);
+	chiaki_network_identity_from_descriptor("if=wlan0;gw=192.168.0.1", b);
+	munit_assert_false(strcmp(a, b) == 0);
+
+	// FNV-1a 64 of the empty string is its offset basis
+	chiaki_network_identity_from_descriptor("", a);
+	munit_assert_string_equal(a, "cbf29ce484222325");
+	return MUNIT_OK;
+}
+
+MunitTest tests_path_cache[] = {
+	{
+		"/save_load",
+		test_save_load,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/corrupt_file",
+		test_corrupt_file,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/lookup_max_age",
+		test_lookup_max_age,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/evict",
+		test_evict,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/stun_servers",
+		test_stun_servers,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/identity_from_descriptor",
+		test_identity_from_descriptor,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/remote/portguess.h>
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "test_log.h"
+
+#define PEERS_COUNT 4
+
+static chiaki_socket_t udp_socket_bind_local(struct sockaddr_storage *addr, socklen_t *addr_len)
+{
+	chiaki_socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert_false(CHIAKI_SOCKET_IS_INVALID(sock));
+	struct sockaddr_in *sin = (struct sockaddr_in *)addr;
+	memset(addr, 0, sizeof(*addr));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	munit_assert_int(bind(sock, (struct sockaddr *)sin, sizeof(*sin)), ==, 0);
+	*addr_len = sizeof(*sin);
+	munit_assert_int(getsockname(sock, (struct sockaddr *)sin, addr_len), ==, 0);
+	munit_assert_int(chiaki_socket_set_nonblock(sock, true), ==, CHIAKI_ERR_SUCCESS);
+	return sock;
+}
+
+static size_t drain(chiaki_socket_t sock)
+{
+	size_t count = 0;
+	uint8_t buf[128];
+	while(recv(sock, (CHIAKI_SOCKET_BUF_TYPE)buf, sizeof(buf), 0) > 0)
+		count++;
+	return count;
+}
+
+static MunitResult test_burst(const MunitParameter params[], void *user)
+{
+	munit_assert_int(chiaki_lib_init(), ==, CHIAKI_ERR_SUCCESS);
+	ChiakiPortGuesser guesser;
+	munit_assert_int(chiaki_port_guesser_init(&guesser, get_test_log(), 32, 64), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(guesser.socks_open, ==, 32);
+
+	// an IPv6 destination in between is skipped
+	chiaki_socket_t peers[PEERS_COUNT];
+	struct sockaddr_storage addrs[PEERS_COUNT + 1];
+	socklen_t lens[PEERS_COUNT + 1];
+	for(size_t i=0; i<PEERS_COUNT; i++)
+		peers[i] = udp_socket_bind_local(&addrs[i < 2 ? i : i + 1], &lens[i < 2 ? i : i + 1]);
+	memset(&addrs[2], 0, sizeof(addrs[2]));
+	addrs[2].ss_family = AF_INET6;
+	lens[2] = sizeof(struct sockaddr_in6);
+
+	uint8_t probe[88] = { 0 };
+	size_t sent = chiaki_port_guesser_burst(&guesser, probe, sizeof(probe), addrs, lens, PEERS_COUNT + 1);
+	munit_assert_size(sent, ==, 32 * PEERS_COUNT);
+	munit_assert_uint64(guesser.stats.probes_sent, ==, 32 * PEERS_COUNT);
+	munit_logf(MUNIT_LOG_INFO, "%llu probes took %llu send calls",
+			(unsigned long long)guesser.stats.probes_sent, (unsigned long long)guesser.stats.send_calls);
+#if defined(__linux__)
+	munit_assert_uint64(guesser.stats.send_calls, ==, 32);
+#endif
+
+	size_t received = 0;
+	for(size_t i=0; i<PEERS_COUNT; i++)
+		received += drain(peers[i]);
+	munit_assert_size(received, ==, 32 * PEERS_COUNT);
+
+	for(size_t i=0; i<PEERS_COUNT; i++)
+		CHIAKI_SOCKET_CLOSE(peers[i]);
+	chiaki_port_guesser_fini(&guesser);
+	return MUNIT_OK;
+}
+
+static MunitResult test_wait(const MunitParameter params[], void *user)
+{
+	munit_assert_int(chiaki_lib_init(), ==, CHIAKI_ERR_SUCCESS);
+	ChiakiPortGuesser guesser;
+	munit_assert_int(chiaki_port_guesser_init(&guesser, get_test_log(), 300, 64), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(guesser.socks_open, >, 0);
+
+	struct sockaddr_storage watched_addr;
+	socklen_t watched_len;
+	chiaki_socket_t watched = udp_socket_bind_local(&watched_addr, &watched_len);
+	munit_assert_int(chiaki_port_guesser_watch(&guesser, watched), ==, CHIAKI_ERR_SUCCESS);
+
+	chiaki_socket_t ready = CHIAKI_INVALID_SOCKET;
+	munit_assert_int(chiaki_port_guesser_wait(&guesser, 20, &ready), ==, CHIAKI_ERR_TIMEOUT);
+
+	// the last socket opened has the highest fd, select() would be the first to give up on it
+	chiaki_socket_t last = guesser.socks[guesser.socks_count - 1];
+	munit_logf(MUNIT_LOG_INFO, "%zu sockets, highest fd %d", guesser.socks_open, (int)last);
+	struct sockaddr_in last_addr;
+	socklen_t last_len = sizeof(last_addr);
+	munit_assert_int(getsockname(last, (struct sockaddr *)&last_addr, &last_len), ==, 0);
+	last_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	struct sockaddr_storage peer_addr;
+	socklen_t peer_len;
+	chiaki_socket_t peer = udp_socket_bind_local(&peer_addr, &peer_len);
+	uint8_t msg[4] = { 1, 2, 3, 4 };
+	munit_assert_int(sendto(peer, (CHIAKI_SOCKET_BUF_TYPE)msg, sizeof(msg), 0, (struct sockaddr *)&last_addr, last_len), ==, sizeof(msg));
+	munit_assert_int(sendto(peer, (CHIAKI_SOCKET_BUF_TYPE)msg, sizeof(msg), 0, (struct sockaddr *)&watched_addr, watched_len), ==, sizeof(msg));
+
+	// both are reported while they stay readable, neither starves the other
+	bool last_seen = false, watched_seen = false;
+	for(int i=0; i<4; i++)
+	{
+		munit_assert_int(chiaki_port_guesser_wait(&guesser, 1000, &ready), ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_true(ready == last || ready == watched);
+		last_seen |= ready == last;
+		watched_seen |= ready == watched;
+	}
+	munit_assert_true(last_seen);
+	munit_assert_true(watched_seen);
+	munit_assert_true(chiaki_port_guesser_owns(&guesser, last));
+	munit_assert_false(chiaki_port_guesser_owns(&guesser, watched));
+	munit_assert_int(chiaki_port_guesser_socket_ready(&guesser, last), ==, CHIAKI_ERR_SUCCESS);
+
+	// a released socket is neither watched nor closed by the guesser anymore
+	size_t open = guesser.socks_open;
+	chiaki_port_guesser_release(&guesser, last);
+	munit_assert_false(chiaki_port_guesser_owns(&guesser, last));
+	munit_assert_size(guesser.socks_open, ==, open - 1);
+	drain(watched);
+	munit_assert_int(chiaki_port_guesser_wait(&guesser, 20, &ready), ==, CHIAKI_ERR_TIMEOUT);
+	chiaki_port_guesser_fini(&guesser);
+	munit_assert_size(drain(last), ==, 1);
+
+	CHIAKI_SOCKET_CLOSE(last);
+	CHIAKI_SOCKET_CLOSE(watched);
+	CHIAKI_SOCKET_CLOSE(peer);
+	return MUNIT_OK;
+}
+
+static MunitResult test_port_window(const MunitParameter params[], void *user)
+{
+	munit_assert_uint16(chiaki_port_window_port(50000, 0), ==, 50000);
+	munit_assert_uint16(chiaki_port_window_port(50000, 1), ==, 50001);
+	munit_assert_uint16(chiaki_port_window_port(50000, 2), ==, 49999);
+	munit_assert_uint16(chiaki_port_window_port(50000, 5), ==, 50003);
+	// guesses wrap around without reaching well-known ports
+	munit_assert_uint16(chiaki_port_window_port(65535, 1), ==, 49152);
+	munit_assert_uint16(chiaki_port_window_port(1024, 2), ==, 65534);
+
+	ChiakiPortWindow window;
+	chiaki_port_window_init(&window, 40000, 64);
+	uint16_t ports[64];
+	munit_assert_size(chiaki_port_window_widen(&window, 16, ports, 64), ==, 16);
+	munit_assert_uint16(ports[0], ==, 40000);
+	munit_assert_uint16(ports[15], ==, 40008);
+	// doubling only yields the ports not guessed yet
+	munit_assert_size(chiaki_port_window_widen(&window, 16, ports, 64), ==, 16);
+	munit_assert_uint16(ports[0], ==, 39992);
+	munit_assert_size(chiaki_port_window_widen(&window, 16, ports, 64), ==, 32);
+	munit_assert_size(chiaki_port_window_widen(&window, 16, ports, 64), ==, 0);
+	munit_assert_size(window.size, ==, 64);
+
+	munit_assert_false(chiaki_port_window_recenter(&window, 40000));
+	munit_assert_true(chiaki_port_window_recenter(&window, 41000));
+	munit_assert_size(chiaki_port_window_widen(&window, 16, ports, 4), ==, 4);
+	munit_assert_uint16(ports[0], ==, 41000);
+	munit_assert_size(window.size, ==, 4);
+	return MUNIT_OK;
+}
+
+MunitTest tests_port_guess[] = {
+	{
+		"/burst",
+		test_burst,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/wait",
+		test_wait,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/port_window",
+		test_port_window,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
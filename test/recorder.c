@@ -0,0 +1,419 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/recorder.h>
+#include <chiaki/time.h>
+
+#include <libavformat/avformat.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define FRAME_US 16667
+#define KEY_INTERVAL 30
+#define AUDIO_FRAME_US 10000
+
+// real PS5 H264 stream header and slices, see bitstream.c
+static const uint8_t header[] = {
+	0x00, 0x00, 0x00, 0x01, 0x67, 0x4d, 0x40, 0x32, 0x91, 0x8a, 0x01, 0xe0, 0x08, 0x9f, 0x97, 0x01,
+	0x6a, 0x02, 0x02, 0x02, 0x80, 0x00, 0x03, 0xe9, 0x00, 0x01, 0xd4, 0xc0, 0x44, 0xd0, 0xf1, 0xf1,
+	0x50, 0x00, 0x00, 0x00, 0x01, 0x68, 0xee, 0x3c, 0x80,
+};
+#define HEADER_LEVEL_OFFSET 7
+
+static const uint8_t slice_i[] = {
+	0x00, 0x00, 0x00, 0x01, 0x65, 0x88, 0x80, 0x82, 0x1f, 0x00, 0x49, 0xee, 0x03, 0x29, 0xff, 0xf8,
+	0x7f, 0x88, 0x46, 0x44, 0x77, 0x17, 0xe7, 0x6d, 0xb3, 0xad, 0x38, 0x19, 0x74, 0x5a, 0xf1, 0x51,
+};
+
+static const uint8_t slice_p[] = {
+	0x00, 0x00, 0x00, 0x01, 0x41, 0x9a, 0x04, 0x44, 0x3f, 0x41, 0x5b, 0xf4, 0x65, 0xb4, 0x3e, 0x1a,
+	0xd3, 0xa0, 0x28, 0x1f, 0x83, 0x63, 0x0e, 0xc2, 0xfc, 0x9d, 0x7a, 0xc7, 0xc4, 0x7d, 0xf9, 0x18,
+};
+
+// Opus TOC for a 10 ms CELT frame, the payload is never decoded
+static const uint8_t opus_frame[] = { 0xf4, 0xff, 0xfe, 0x4a, 0x31, 0x08 };
+
+typedef struct replay_t
+{
+	ChiakiRecorder recorder;
+	uint64_t base_us;
+	uint64_t frame; // next video frame, counting lost ones
+	uint8_t level;
+} Replay;
+
+static void replay_init(Replay *replay, ChiakiRecorderSettings *settings)
+{
+	settings->codec = CHIAKI_CODEC_H264;
+	// as requested, the stream itself is 1920x1080 like it would be after a downgrade
+	settings->width = 3840;
+	settings->height = 2160;
+	settings->max_fps = 60;
+	munit_assert_int(chiaki_recorder_init(&replay->recorder, NULL, settings), ==, CHIAKI_ERR_SUCCESS);
+	replay->base_us = chiaki_time_now_monotonic_us();
+	replay->frame = 0;
+	replay->level = header[HEADER_LEVEL_OFFSET];
+}
+
+static uint64_t replay_frame_us(Replay *replay, uint64_t frame)
+{
+	return replay->base_us + frame * FRAME_US;
+}
+
+/**
+ * Push the next frame like the video receiver would, the stream header goes before every IDR.
+ */
+static void replay_video(Replay *replay, int32_t frames_lost, bool recovered)
+{
+	replay->frame += frames_lost;
+	uint64_t now_us = replay_frame_us(replay, replay->frame);
+	if(replay->frame % KEY_INTERVAL == 0)
+	{
+		uint8_t buf[sizeof(header) + sizeof(slice_i)];
+		memcpy(buf, header, sizeof(header));
+		buf[HEADER_LEVEL_OFFSET] = replay->level;
+		memcpy(buf + sizeof(header), slice_i, sizeof(slice_i));
+		chiaki_recorder_push_video(&replay->recorder, buf, sizeof(buf), frames_lost, recovered, now_us);
+	}
+	else
+		chiaki_recorder_push_video(&replay->recorder, slice_p, sizeof(slice_p), frames_lost, recovered, now_us);
+	replay->frame++;
+}
+
+typedef struct file_info_t
+{
+	int video_stream;
+	int audio_stream;
+	uint64_t video_packets;
+	uint64_t audio_packets;
+	double video_first_s;
+	double video_last_s;
+	uint8_t level;
+} FileInfo;
+
+/**
+ * Demux the whole file again and check what every file written by the recorder must look like.
+ */
+static void file_check(const char *path, FileInfo *info)
+{
+	memset(info, 0, sizeof(*info));
+	info->video_stream = -1;
+	info->audio_stream = -1;
+
+	AVFormatContext *fmt = NULL;
+	munit_assert_int(avformat_open_input(&fmt, path, NULL, NULL), ==, 0);
+	for(unsigned int i=0; i<fmt->nb_streams; i++)
+	{
+		AVCodecParameters *par = fmt->streams[i]->codecpar;
+		if(par->codec_type == AVMEDIA_TYPE_VIDEO)
+		{
+			munit_assert_int(info->video_stream, ==, -1);
+			info->video_stream = i;
+			munit_assert_int(par->codec_id, ==, AV_CODEC_ID_H264);
+			munit_assert_int(par->width, ==, 1920);
+			munit_assert_int(par->height, ==, 1080);
+			// avcC: version, profile, compatibility, level
+			munit_assert_int(par->extradata_size, >, 4);
+			munit_assert_uint8(par->extradata[0], ==, 1);
+			info->level = par->extradata[3];
+		}
+		else if(par->codec_type == AVMEDIA_TYPE_AUDIO)
+		{
+			munit_assert_int(info->audio_stream, ==, -1);
+			info->audio_stream = i;
+			munit_assert_int(par->codec_id, ==, AV_CODEC_ID_OPUS);
+		}
+	}
+	munit_assert_int(info->video_stream, >=, 0);
+
+	AVPacket *pkt = av_packet_alloc();
+	munit_assert_not_null(pkt);
+	int64_t video_pts_last = AV_NOPTS_VALUE;
+	int64_t audio_pts_last = AV_NOPTS_VALUE;
+	while(av_read_frame(fmt, pkt) >= 0)
+	{
+		munit_assert_int64(pkt->pts, !=, AV_NOPTS_VALUE);
+		AVRational time_base = fmt->streams[pkt->stream_index]->time_base;
+		if(pkt->stream_index == info->video_stream)
+		{
+			if(!info->video_packets)
+			{
+				munit_assert_true(pkt->flags & AV_PKT_FLAG_KEY);
+				info->video_first_s = pkt->pts * av_q2d(time_base);
+			}
+			else
+				munit_assert_int64(pkt->pts, >, video_pts_last);
+			video_pts_last = pkt->pts;
+			info->video_last_s = pkt->pts * av_q2d(time_base);
+			info->video_packets++;
+		}
+		else if(pkt->stream_index == info->audio_stream)
+		{
+			if(audio_pts_last != AV_NOPTS_VALUE)
+				munit_assert_int64(pkt->pts, >, audio_pts_last);
+			audio_pts_last = pkt->pts;
+			info->audio_packets++;
+		}
+		av_packet_unref(pkt);
+	}
+	av_packet_free(&pkt);
+	avformat_close_input(&fmt);
+}
+
+static MunitResult test_remux_mkv(const MunitParameter params[], void *user)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "chiaki-test-recorder-%08x.mkv", munit_rand_uint32());
+
+	ChiakiRecorderSettings settings = { 0 };
+	settings.path = path;
+	Replay replay;
+	replay_init(&replay, &settings);
+
+	ChiakiAudioHeader audio_header;
+	chiaki_audio_header_set(&audio_header, 2, 16, 48000, 480);
+	chiaki_recorder_push_audio_header(&replay.recorder, &audio_header);
+
+	// only parameter sets, nothing to write yet
+	chiaki_recorder_push_video(&replay.recorder, header, sizeof(header), 0, false, replay_frame_us(&replay, 0));
+
+	uint64_t audio_pushed = 0;
+	uint64_t audio_us = AUDIO_FRAME_US;
+	for(int i=0; i<120; i++)
+	{
+		if(i == 40)
+			replay_video(&replay, 2, false); // frame 42, corrupt until the IDR at 60
+		else if(i == 80)
+			replay_video(&replay, 1, true);
+		else
+			replay_video(&replay, 0, false);
+
+		// audio starts after the first video frame, so all of it ends up in the file
+		uint64_t until_us = (replay.frame - 1) * FRAME_US;
+		for(; audio_us <= until_us; audio_us += AUDIO_FRAME_US)
+		{
+			if(audio_us == 50 * AUDIO_FRAME_US)
+			{
+				chiaki_recorder_push_audio(&replay.recorder, NULL, 0, replay.base_us + audio_us);
+				continue;
+			}
+			chiaki_recorder_push_audio(&replay.recorder, opus_frame, sizeof(opus_frame), replay.base_us + audio_us);
+			audio_pushed++;
+		}
+	}
+
+	chiaki_recorder_fini(&replay.recorder);
+	ChiakiRecorderStats *stats = &replay.recorder.stats;
+	munit_assert_uint64(stats->errors, ==, 0);
+	munit_assert_uint64(stats->files_written, ==, 1);
+	munit_assert_uint64(stats->video_packets, ==, 120);
+	munit_assert_uint64(stats->audio_packets, ==, audio_pushed);
+	munit_assert_uint64(stats->packets_dropped, ==, 0);
+	munit_assert_uint64(stats->frames_corrupt, ==, 60 - 42); // frames 42 to 59
+
+	FileInfo info;
+	file_check(path, &info);
+	munit_assert_int(info.audio_stream, >=, 0);
+	munit_assert_uint64(info.video_packets, ==, 120);
+	munit_assert_uint64(info.audio_packets, ==, audio_pushed);
+	munit_assert_uint8(info.level, ==, header[HEADER_LEVEL_OFFSET]);
+	// the lost frames leave a gap instead of shifting everything after them
+	double duration_s = (double)(replay.frame - 1) * FRAME_US / 1000000.0;
+	munit_assert_double_equal(info.video_last_s - info.video_first_s, duration_s, 2);
+
+	remove(path);
+	return MUNIT_OK;
+}
+
+static MunitResult test_remux_mp4(const MunitParameter params[], void *user)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "chiaki-test-recorder-%08x.mp4", munit_rand_uint32());
+
+	ChiakiRecorderSettings settings = { 0 };
+	settings.path = path;
+	Replay replay;
+	replay_init(&replay, &settings);
+
+	ChiakiAudioHeader audio_header;
+	chiaki_audio_header_set(&audio_header, 2, 16, 48000, 480);
+	chiaki_recorder_push_audio_header(&replay.recorder, &audio_header);
+
+	// audio between 1 and 1.3 s is held back and arrives all at once, after the timestamps already jumped ahead
+	static const uint64_t stall_start_us = 100 * AUDIO_FRAME_US;
+	static const uint64_t stall_end_us = 130 * AUDIO_FRAME_US;
+	uint64_t audio_pushed = 0;
+	uint64_t audio_us = AUDIO_FRAME_US;
+	for(int i=0; i<120; i++)
+	{
+		replay_video(&replay, 0, false);
+		uint64_t until_us = (replay.frame - 1) * FRAME_US;
+		for(; audio_us <= until_us; audio_us += AUDIO_FRAME_US)
+		{
+			uint64_t arrival_us = audio_us >= stall_start_us && audio_us < stall_end_us ? stall_end_us : audio_us;
+			chiaki_recorder_push_audio(&replay.recorder, opus_frame, sizeof(opus_frame), replay.base_us + arrival_us);
+			audio_pushed++;
+		}
+	}
+
+	chiaki_recorder_fini(&replay.recorder);
+	ChiakiRecorderStats *stats = &replay.recorder.stats;
+	munit_assert_uint64(stats->errors, ==, 0);
+	munit_assert_uint64(stats->files_written, ==, 1);
+	munit_assert_uint64(stats->video_packets, ==, 120);
+	// what arrived too late to fit in is dropped instead of moving the timestamps back
+	munit_assert_uint64(stats->packets_dropped, >, 0);
+	munit_assert_uint64(stats->audio_packets + stats->packets_dropped, ==, audio_pushed);
+
+	// file_check() also makes sure the audio timestamps only ever increase
+	FileInfo info;
+	file_check(path, &info);
+	munit_assert_int(info.audio_stream, >=, 0);
+	munit_assert_uint64(info.video_packets, ==, 120);
+	munit_assert_uint64(info.audio_packets, ==, stats->audio_packets);
+	munit_assert_uint8(info.level, ==, header[HEADER_LEVEL_OFFSET]);
+	munit_assert_double_equal(info.video_last_s - info.video_first_s, 119.0 * FRAME_US / 1000000.0, 2);
+
+	remove(path);
+	return MUNIT_OK;
+}
+
+static MunitResult test_rotate(const MunitParameter params[], void *user)
+{
+	char path[64];
+	uint32_t id = munit_rand_uint32();
+	snprintf(path, sizeof(path), "chiaki-test-recorder-%08x.mkv", id);
+
+	ChiakiRecorderSettings settings = { 0 };
+	settings.path = path;
+	settings.rotate_ms = 1000;
+	Replay replay;
+	replay_init(&replay, &settings);
+
+	// P frames before the first IDR can't be decoded and are dropped
+	replay.frame = KEY_INTERVAL - 5;
+	for(int i=0; i<5; i++)
+		replay_video(&replay, 0, false);
+
+	// IDRs every 0.5 s, a new file every second: at 0.5, 1.5 and 2.5 s
+	while(replay.frame < 5 * KEY_INTERVAL + 5)
+		replay_video(&replay, 0, false);
+
+	// a new level can't go into the same track, even though the second isn't over
+	replay.level++;
+	while(replay.frame < 7 * KEY_INTERVAL)
+		replay_video(&replay, 0, false);
+
+	chiaki_recorder_fini(&replay.recorder);
+	ChiakiRecorderStats *stats = &replay.recorder.stats;
+	munit_assert_uint64(stats->errors, ==, 0);
+	munit_assert_uint64(stats->packets_dropped, ==, 5);
+	munit_assert_uint64(stats->files_written, ==, 4);
+
+	static const uint64_t expected_packets[] = { 2 * KEY_INTERVAL, 2 * KEY_INTERVAL, KEY_INTERVAL, KEY_INTERVAL };
+	uint64_t total = 0;
+	for(unsigned int i=0; i<4; i++)
+	{
+		char segment[64];
+		snprintf(segment, sizeof(segment), "chiaki-test-recorder-%08x-%03u.mkv", id, i);
+		FileInfo info;
+		file_check(segment, &info);
+		munit_assert_int(info.audio_stream, ==, -1);
+		munit_assert_uint64(info.video_packets, ==, expected_packets[i]);
+		munit_assert_uint8(info.level, ==, i < 3 ? header[HEADER_LEVEL_OFFSET] : header[HEADER_LEVEL_OFFSET] + 1);
+		total += info.video_packets;
+		remove(segment);
+	}
+	munit_assert_uint64(total, ==, stats->video_packets);
+
+	// nothing at the unsuffixed path
+	FILE *f = fopen(path, "rb");
+	munit_assert_null(f);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_buffer(const MunitParameter params[], void *user)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "chiaki-test-recorder-%08x.mp4", munit_rand_uint32());
+
+	ChiakiRecorderSettings settings = { 0 };
+	settings.buffer_ms = 1000;
+	Replay replay;
+	replay_init(&replay, &settings);
+
+	// 4 s of video, keeping at least the last second means starting at the IDR at 2.5 s
+	while(replay.frame < 8 * KEY_INTERVAL)
+		replay_video(&replay, 0, false);
+	munit_assert_int(chiaki_recorder_save(&replay.recorder, path), ==, CHIAKI_ERR_SUCCESS);
+
+	chiaki_recorder_fini(&replay.recorder);
+	ChiakiRecorderStats *stats = &replay.recorder.stats;
+	munit_assert_uint64(stats->errors, ==, 0);
+	munit_assert_uint64(stats->files_written, ==, 1);
+	munit_assert_uint64(stats->video_packets, ==, 3 * KEY_INTERVAL);
+
+	FileInfo info;
+	file_check(path, &info);
+	munit_assert_uint64(info.video_packets, ==, 3 * KEY_INTERVAL);
+	munit_assert_double_equal(info.video_first_s, 0.0, 3);
+	munit_assert_double_equal(info.video_last_s, (3 * KEY_INTERVAL - 1) * FRAME_US / 1000000.0, 3);
+
+	remove(path);
+
+	// nothing buffered yet
+	replay_init(&replay, &settings);
+	munit_assert_int(chiaki_recorder_save(&replay.recorder, path), ==, CHIAKI_ERR_SUCCESS);
+	chiaki_recorder_fini(&replay.recorder);
+	munit_assert_uint64(replay.recorder.stats.errors, ==, 1);
+	munit_assert_uint64(replay.recorder.stats.files_written, ==, 0);
+
+	// live recordings can't be saved
+	ChiakiRecorderSettings live_settings = { 0 };
+	live_settings.path = path;
+	replay_init(&replay, &live_settings);
+	munit_assert_int(chiaki_recorder_save(&replay.recorder, path), !=, CHIAKI_ERR_SUCCESS);
+	chiaki_recorder_fini(&replay.recorder);
+	munit_assert_uint64(replay.recorder.stats.files_written, ==, 0);
+	remove(path);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_recorder[] = {
+	{
+		"/remux_mkv",
+		test_remux_mkv,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/remux_mp4",
+		test_remux_mp4,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/rotate",
+		test_rotate,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/buffer",
+		test_buffer,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
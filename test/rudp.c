@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/remote/rudp.h>
+#include <chiaki/time.h>
+
+#include <string.h>
+
+#define THROUGHPUT_ITERATIONS 1000000
+
+// session message carrying a ctrl message, like chiaki_rudp_send_session_message() builds it
+static size_t serialize_session_message(uint8_t *buf, size_t buf_size, const uint8_t *payload, size_t payload_size)
+{
+	uint8_t subdata[2 + payload_size];
+	subdata[0] = 0x12;
+	subdata[1] = 0x34;
+	memcpy(subdata + 2, payload, payload_size);
+	RudpMessage sub_message = { 0 };
+	sub_message.type = CTRL_MESSAGE;
+	sub_message.data = subdata;
+	sub_message.data_size = sizeof(subdata);
+	sub_message.size = (0xC << 12) | (CHIAKI_RUDP_HEADER_SIZE + sub_message.data_size);
+
+	uint8_t data[4] = { 0x12, 0x35, 0x56, 0x77 };
+	RudpMessage message = { 0 };
+	message.type = SESSION_MESSAGE;
+	message.data = data;
+	message.data_size = sizeof(data);
+	message.size = (0xC << 12) | (CHIAKI_RUDP_HEADER_SIZE + message.data_size);
+	message.subMessage = &sub_message;
+
+	size_t msg_size = 0;
+	munit_assert_int(chiaki_rudp_message_serialize(&message, buf, buf_size, &msg_size), ==, CHIAKI_ERR_SUCCESS);
+	return msg_size;
+}
+
+static MunitResult test_serialize_parse(const MunitParameter params[], void *user)
+{
+	const uint8_t payload[] = { 0x00, 0x00, 0x00, 0x04, 0x00, 0x30, 0x00, 0x00, 0xde, 0xad, 0xbe, 0xef };
+	uint8_t buf[CHIAKI_RUDP_DATAGRAM_SIZE_MAX];
+	size_t size = serialize_session_message(buf, sizeof(buf), payload, sizeof(payload));
+	munit_assert_size(size, ==, 2 * CHIAKI_RUDP_HEADER_SIZE + 4 + 2 + sizeof(payload));
+	munit_assert_uint8(buf[0], ==, 0xC0);
+	munit_assert_uint8(buf[1], ==, 12);
+	munit_assert_uint8(buf[6], ==, 0x20);
+
+	uint8_t orig[sizeof(buf)];
+	memcpy(orig, buf, size);
+	RudpMessage messages[CHIAKI_RUDP_MESSAGES_MAX];
+	size_t count = 0;
+	munit_assert_int(chiaki_rudp_message_parse(buf, size, messages, CHIAKI_RUDP_MESSAGES_MAX, &count), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_memory_equal(size, buf, orig);
+	munit_assert_size(count, ==, 2);
+
+	RudpMessage *message = &messages[0];
+	munit_assert_int(message->type, ==, SESSION_MESSAGE);
+	munit_assert_uint8(message->subtype, ==, 0x20);
+	munit_assert_size(message->data_size, ==, 4);
+	munit_assert_ptr_equal(message->data, buf + CHIAKI_RUDP_HEADER_SIZE);
+	munit_assert_uint16(message->remote_counter, ==, 0x1236);
+	munit_assert_ptr_equal(message->subMessage, &messages[1]);
+	munit_assert_uint16(message->subMessage_size, ==, CHIAKI_RUDP_HEADER_SIZE + 2 + sizeof(payload));
+
+	message = message->subMessage;
+	munit_assert_int(message->type, ==, CTRL_MESSAGE);
+	munit_assert_uint8(message->subtype, ==, 0x02);
+	munit_assert_size(message->data_size, ==, 2 + sizeof(payload));
+	munit_assert_memory_equal(sizeof(payload), message->data + 2, payload);
+	munit_assert_uint16(message->remote_counter, ==, 0x1235);
+	munit_assert_null(message->subMessage);
+
+	// a parsed message serializes back to the same bytes
+	uint8_t reserialized[sizeof(buf)];
+	size_t reserialized_size = 0;
+	munit_assert_int(chiaki_rudp_message_serialize(&messages[0], reserialized, sizeof(reserialized), &reserialized_size), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(reserialized_size, ==, size);
+	munit_assert_memory_equal(size, reserialized, buf);
+
+	munit_assert_int(chiaki_rudp_message_serialize(&messages[0], reserialized, size - 1, &reserialized_size), ==, CHIAKI_ERR_BUF_TOO_SMALL);
+	munit_assert_int(chiaki_rudp_message_serialize(&messages[0], reserialized, CHIAKI_RUDP_HEADER_SIZE - 1, &reserialized_size), ==, CHIAKI_ERR_BUF_TOO_SMALL);
+	return MUNIT_OK;
+}
+
+static MunitResult test_parse_limits(const MunitParameter params[], void *user)
+{
+	RudpMessage messages[CHIAKI_RUDP_MESSAGES_MAX];
+	size_t count = 1;
+	uint8_t buf[CHIAKI_RUDP_DATAGRAM_SIZE_MAX] = { 0 };
+	munit_assert_int(chiaki_rudp_message_parse(buf, CHIAKI_RUDP_HEADER_SIZE - 1, messages, CHIAKI_RUDP_MESSAGES_MAX, &count), ==, CHIAKI_ERR_BUF_TOO_SMALL);
+	munit_assert_size(count, ==, 0);
+
+	// a length claiming more than was received is cut to what is there
+	buf[0] = 0xC0;
+	buf[1] = 0xff;
+	munit_assert_int(chiaki_rudp_message_parse(buf, 20, messages, CHIAKI_RUDP_MESSAGES_MAX, &count), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(count, ==, 1);
+	munit_assert_size(messages[0].data_size, ==, 12);
+
+	// a datagram of empty messages fills up the caller's array and no more
+	memset(buf, 0, sizeof(buf));
+	munit_assert_int(chiaki_rudp_message_parse(buf, sizeof(buf), messages, CHIAKI_RUDP_MESSAGES_MAX, &count), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(count, ==, CHIAKI_RUDP_MESSAGES_MAX);
+	munit_assert_null(messages[CHIAKI_RUDP_MESSAGES_MAX - 1].subMessage);
+	for(size_t i=0; i<CHIAKI_RUDP_MESSAGES_MAX; i++)
+	{
+		munit_assert_null(messages[i].data);
+		munit_assert_size(messages[i].data_size, ==, 0);
+	}
+	return MUNIT_OK;
+}
+
+static MunitResult test_parse_mutated(const MunitParameter params[], void *user)
+{
+	const uint8_t payload[] = { 0x00, 0x00, 0x00, 0x02, 0x00, 0x30, 0x00, 0x00, 0x01, 0x02 };
+	uint8_t valid[CHIAKI_RUDP_DATAGRAM_SIZE_MAX];
+	size_t valid_size = serialize_session_message(valid, sizeof(valid), payload, sizeof(payload));
+
+	// truncated and corrupted datagrams must never yield views outside of what was received
+	uint8_t buf[CHIAKI_RUDP_DATAGRAM_SIZE_MAX];
+	RudpMessage messages[CHIAKI_RUDP_MESSAGES_MAX];
+	for(int i=0; i<20000; i++)
+	{
+		memcpy(buf, valid, valid_size);
+		size_t size = valid_size;
+		if(i % 4 == 0)
+			size = munit_rand_int_range(0, (int)valid_size);
+		int flips = munit_rand_int_range(1, 4);
+		for(int j=0; j<flips && size; j++)
+			buf[munit_rand_int_range(0, (int)size - 1)] = (uint8_t)munit_rand_uint32();
+
+		size_t count = 0;
+		ChiakiErrorCode err = chiaki_rudp_message_parse(buf, size, messages, CHIAKI_RUDP_MESSAGES_MAX, &count);
+		if(size < CHIAKI_RUDP_HEADER_SIZE)
+		{
+			munit_assert_int(err, ==, CHIAKI_ERR_BUF_TOO_SMALL);
+			continue;
+		}
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_size(count, >=, 1);
+		munit_assert_size(count, <=, CHIAKI_RUDP_MESSAGES_MAX);
+		size_t total = 0;
+		for(RudpMessage *message = &messages[0]; message; message = message->subMessage)
+		{
+			if(message->data)
+			{
+				munit_assert_size(message->data - buf, >=, CHIAKI_RUDP_HEADER_SIZE);
+				munit_assert_size(message->data - buf + message->data_size, <=, size);
+			}
+			total += CHIAKI_RUDP_HEADER_SIZE + message->data_size;
+		}
+		munit_assert_size(total, <=, size);
+	}
+	return MUNIT_OK;
+}
+
+static MunitResult test_throughput(const MunitParameter params[], void *user)
+{
+	uint8_t payload[64];
+	memset(payload, 0x42, sizeof(payload));
+	uint8_t buf[CHIAKI_RUDP_DATAGRAM_SIZE_MAX];
+	size_t size = 0;
+	RudpMessage messages[CHIAKI_RUDP_MESSAGES_MAX];
+	size_t count = 0;
+	uint64_t remote_counters = 0;
+
+	uint64_t start = chiaki_time_now_monotonic_us();
+	for(int i=0; i<THROUGHPUT_ITERATIONS; i++)
+	{
+		payload[0] = (uint8_t)i;
+		size = serialize_session_message(buf, sizeof(buf), payload, sizeof(payload));
+		chiaki_rudp_message_parse(buf, size, messages, CHIAKI_RUDP_MESSAGES_MAX, &count);
+		remote_counters += messages[count - 1].remote_counter;
+	}
+	uint64_t elapsed_us = chiaki_time_now_monotonic_us() - start;
+	munit_assert_size(count, ==, 2);
+	munit_assert_uint64(remote_counters, ==, (uint64_t)THROUGHPUT_ITERATIONS * 0x1235);
+
+	if(elapsed_us == 0)
+		elapsed_us = 1;
+	munit_logf(MUNIT_LOG_INFO, "%d serialize/parse round trips of %zu bytes in %llu us, %.0f msgs/s",
+			THROUGHPUT_ITERATIONS, size, (unsigned long long)elapsed_us,
+			(double)THROUGHPUT_ITERATIONS * 1000000.0 / (double)elapsed_us);
+	return MUNIT_OK;
+}
+
+MunitTest tests_rudp[] = {
+	{
+		"/serialize_parse",
+		test_serialize_parse,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/parse_limits",
+		test_parse_limits,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/parse_mutated",
+		test_parse_mutated,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/throughput",
+		test_throughput,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
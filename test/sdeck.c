@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <sdeck.h>
+#include <chiaki/time.h>
+
+#include <math.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define SAMPLING_RATE 3000
+#define BUF_SAMPLES 120 // 4 haptics packets per trackpad, as the gui analyses them
+#define WARMUP_BUFS 2
+
+static void synth(int16_t *buf, size_t samples, double freq_start, double freq_end, double amplitude, double *phase)
+{
+	for(size_t i=0; i<samples; i++)
+	{
+		double freq = freq_start + (freq_end - freq_start) * (double)i / (double)samples;
+		buf[i] = (int16_t)(amplitude * sin(*phase));
+		*phase += 2.0 * M_PI * freq / SAMPLING_RATE;
+	}
+}
+
+static MunitResult test_freq_sine(const MunitParameter params[], void *user)
+{
+	static const double freqs[] = { 55.0, 80.0, 100.0, 147.0, 200.0, 262.0, 333.0, 390.0 };
+	for(size_t f=0; f<sizeof(freqs)/sizeof(freqs[0]); f++)
+	{
+		SDeckFreqTracker tracker;
+		sdeck_freq_tracker_init(&tracker, SAMPLING_RATE);
+		double phase = 0.0;
+		for(int b=0; b<10; b++)
+		{
+			int16_t buf[BUF_SAMPLES];
+			synth(buf, BUF_SAMPLES, freqs[f], freqs[f], 4000.0, &phase);
+			sdeck_freq_tracker_update(&tracker, buf, BUF_SAMPLES);
+			double freq, amplitude;
+			munit_assert_int(sdeck_freq_tracker_get(&tracker, &freq, &amplitude), ==, 0);
+			if(b < WARMUP_BUFS)
+				continue;
+			munit_assert_double(fabs(freq - freqs[f]) / freqs[f], <, 0.02);
+			munit_assert_double(amplitude, >, 4000.0 * 0.7);
+			munit_assert_double(amplitude, <, 4000.0 * 1.1);
+		}
+	}
+	return MUNIT_OK;
+}
+
+static MunitResult test_freq_chirp(const MunitParameter params[], void *user)
+{
+	SDeckFreqTracker tracker;
+	sdeck_freq_tracker_init(&tracker, SAMPLING_RATE);
+	// sweep up and back down, 40ms buffers over 2s
+	const int bufs = 50;
+	const double freq_low = 60.0, freq_high = 360.0;
+	double phase = 0.0;
+	double error_max = 0.0;
+	for(int b=0; b<bufs; b++)
+	{
+		double t0 = (double)b / bufs, t1 = (double)(b + 1) / bufs;
+		double f0 = freq_low + (freq_high - freq_low) * (t0 < 0.5 ? 2.0 * t0 : 2.0 - 2.0 * t0);
+		double f1 = freq_low + (freq_high - freq_low) * (t1 < 0.5 ? 2.0 * t1 : 2.0 - 2.0 * t1);
+		int16_t buf[BUF_SAMPLES];
+		synth(buf, BUF_SAMPLES, f0, f1, 6000.0, &phase);
+		sdeck_freq_tracker_update(&tracker, buf, BUF_SAMPLES);
+		double freq, amplitude;
+		munit_assert_int(sdeck_freq_tracker_get(&tracker, &freq, &amplitude), ==, 0);
+		if(b < WARMUP_BUFS)
+			continue;
+		// the tracker lags a little behind the sweep, so compare against the middle of the buffer
+		double expected = 0.5 * (f0 + f1);
+		double error = fabs(freq - expected) / expected;
+		if(error > error_max)
+			error_max = error;
+	}
+	munit_logf(MUNIT_LOG_INFO, "Chirp %.0f-%.0f Hz tracked with max error %.1f%%", freq_low, freq_high, error_max * 100.0);
+	munit_assert_double(error_max, <, 0.08);
+	return MUNIT_OK;
+}
+
+static MunitResult test_freq_silence(const MunitParameter params[], void *user)
+{
+	SDeckFreqTracker tracker;
+	sdeck_freq_tracker_init(&tracker, SAMPLING_RATE);
+	int16_t buf[BUF_SAMPLES] = { 0 };
+	double freq, amplitude;
+	sdeck_freq_tracker_update(&tracker, buf, BUF_SAMPLES);
+	munit_assert_int(sdeck_freq_tracker_get(&tracker, &freq, &amplitude), ==, -1);
+
+	double phase = 0.0;
+	synth(buf, BUF_SAMPLES, 150.0, 150.0, 8000.0, &phase);
+	sdeck_freq_tracker_update(&tracker, buf, BUF_SAMPLES);
+	munit_assert_int(sdeck_freq_tracker_get(&tracker, &freq, &amplitude), ==, 0);
+
+	// a tone that stopped fades out within a few buffers instead of playing on
+	memset(buf, 0, sizeof(buf));
+	for(int b=0; b<4; b++)
+		sdeck_freq_tracker_update(&tracker, buf, BUF_SAMPLES);
+	if(sdeck_freq_tracker_get(&tracker, &freq, &amplitude) == 0)
+		munit_assert_double(amplitude, <, 40.0);
+
+	sdeck_freq_tracker_reset(&tracker);
+	munit_assert_int(sdeck_freq_tracker_get(&tracker, &freq, &amplitude), ==, -1);
+	return MUNIT_OK;
+}
+
+static MunitResult test_freq_benchmark(const MunitParameter params[], void *user)
+{
+	SDeckFreqTracker tracker;
+	sdeck_freq_tracker_init(&tracker, SAMPLING_RATE);
+	int16_t buf[BUF_SAMPLES];
+	double phase = 0.0;
+	synth(buf, BUF_SAMPLES, 180.0, 180.0, 9000.0, &phase);
+
+	const size_t runs = 20000;
+	double sink = 0.0;
+	uint64_t start_us = chiaki_time_now_monotonic_us();
+	for(size_t i=0; i<runs; i++)
+	{
+		double freq = 0.0, amplitude = 0.0;
+		sdeck_freq_tracker_update(&tracker, buf, BUF_SAMPLES);
+		sdeck_freq_tracker_get(&tracker, &freq, &amplitude);
+		sink += freq;
+	}
+	uint64_t elapsed_us = chiaki_time_now_monotonic_us() - start_us;
+	munit_logf(MUNIT_LOG_INFO, "Steam Deck haptics buffer of %d samples tracked in %.3f us (%.0f)",
+			BUF_SAMPLES, (double)elapsed_us / runs, sink / runs);
+	// a buffer is analysed every 40ms per trackpad
+	munit_assert_uint64(elapsed_us / runs, <, 1000);
+	return MUNIT_OK;
+}
+
+MunitTest tests_sdeck[] = {
+	{
+		"/freq_sine",
+		test_freq_sine,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/freq_chirp",
+		test_freq_chirp,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/freq_silence",
+		test_freq_silence,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/freq_benchmark",
+		test_freq_benchmark,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
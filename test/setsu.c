@@ -0,0 +1,285 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <setsu.h>
+#include <chiaki/thread.h>
+#include <chiaki/time.h>
+
+#include <linux/uinput.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define TOUCHPAD_MAX_X 1919
+#define TOUCHPAD_MAX_Y 1079
+#define FRAMES 200
+#define BURST_FRAMES 10
+
+/**
+ * Touchpad on uinput, so setsu reads real evdev events without any hardware.
+ * Needs write access to /dev/uinput, the tests are skipped otherwise.
+ */
+typedef struct fake_touchpad_t
+{
+	int fd;
+	char path[64];
+} FakeTouchpad;
+
+static void abs_setup(int fd, int code, int max)
+{
+	struct uinput_abs_setup abs = { 0 };
+	abs.code = code;
+	abs.absinfo.maximum = max;
+	munit_assert_int(ioctl(fd, UI_ABS_SETUP, &abs), ==, 0);
+}
+
+static bool fake_touchpad_init(FakeTouchpad *touchpad)
+{
+	touchpad->fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+	if(touchpad->fd < 0)
+		return false;
+	int fd = touchpad->fd;
+	munit_assert_int(ioctl(fd, UI_SET_EVBIT, EV_KEY), ==, 0);
+	munit_assert_int(ioctl(fd, UI_SET_KEYBIT, BTN_LEFT), ==, 0);
+	munit_assert_int(ioctl(fd, UI_SET_KEYBIT, BTN_TOUCH), ==, 0);
+	munit_assert_int(ioctl(fd, UI_SET_EVBIT, EV_ABS), ==, 0);
+	munit_assert_int(ioctl(fd, UI_SET_PROPBIT, INPUT_PROP_POINTER), ==, 0);
+	munit_assert_int(ioctl(fd, UI_SET_PROPBIT, INPUT_PROP_BUTTONPAD), ==, 0);
+	abs_setup(fd, ABS_X, TOUCHPAD_MAX_X);
+	abs_setup(fd, ABS_Y, TOUCHPAD_MAX_Y);
+	abs_setup(fd, ABS_MT_SLOT, 1);
+	abs_setup(fd, ABS_MT_TRACKING_ID, 0xffff);
+	abs_setup(fd, ABS_MT_POSITION_X, TOUCHPAD_MAX_X);
+	abs_setup(fd, ABS_MT_POSITION_Y, TOUCHPAD_MAX_Y);
+
+	struct uinput_setup setup = { 0 };
+	setup.id.bustype = BUS_VIRTUAL;
+	setup.id.vendor = 0x054c;
+	setup.id.product = 0x0ce6;
+	snprintf(setup.name, sizeof(setup.name), "Setsu Test Touchpad");
+	munit_assert_int(ioctl(fd, UI_DEV_SETUP, &setup), ==, 0);
+	munit_assert_int(ioctl(fd, UI_DEV_CREATE), ==, 0);
+
+	// find the event node of the new device through sysfs
+	char sysname[32];
+	munit_assert_int(ioctl(fd, UI_GET_SYSNAME(sizeof(sysname)), sysname), >=, 0);
+	char syspath[128];
+	snprintf(syspath, sizeof(syspath), "/sys/devices/virtual/input/%s", sysname);
+	touchpad->path[0] = '\0';
+	DIR *dir = opendir(syspath);
+	munit_assert_not_null(dir);
+	struct dirent *entry;
+	while((entry = readdir(dir)))
+	{
+		if(!strncmp(entry->d_name, "event", 5))
+		{
+			snprintf(touchpad->path, sizeof(touchpad->path), "/dev/input/%s", entry->d_name);
+			break;
+		}
+	}
+	closedir(dir);
+	munit_assert_char(touchpad->path[0], !=, '\0');
+
+	// udev creates the node asynchronously
+	for(int i=0; i<100 && access(touchpad->path, R_OK) != 0; i++)
+		usleep(10000);
+	return access(touchpad->path, R_OK) == 0;
+}
+
+static void fake_touchpad_fini(FakeTouchpad *touchpad)
+{
+	ioctl(touchpad->fd, UI_DEV_DESTROY);
+	close(touchpad->fd);
+}
+
+static void fake_touchpad_emit(FakeTouchpad *touchpad, uint16_t type, uint16_t code, int32_t value)
+{
+	struct input_event ev = { 0 };
+	ev.type = type;
+	ev.code = code;
+	ev.value = value;
+	munit_assert_int(write(touchpad->fd, &ev, sizeof(ev)), ==, sizeof(ev));
+}
+
+typedef struct setsu_test_t
+{
+	Setsu *setsu;
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+	bool notified;
+
+	SetsuDevice *dev;
+	size_t positions;
+	uint32_t last_x, last_y;
+	bool down, up;
+	uint64_t latency_sum_us;
+	uint64_t latency_max_us;
+	bool time_valid;
+} SetsuTest;
+
+static void setsu_test_notify(void *user)
+{
+	SetsuTest *test = user;
+	chiaki_mutex_lock(&test->mutex);
+	test->notified = true;
+	chiaki_cond_signal(&test->cond);
+	chiaki_mutex_unlock(&test->mutex);
+}
+
+static void setsu_test_event(SetsuEvent *event, void *user)
+{
+	SetsuTest *test = user;
+	switch(event->type)
+	{
+		case SETSU_EVENT_TOUCH_DOWN:
+			test->down = true;
+			break;
+		case SETSU_EVENT_TOUCH_UP:
+			test->up = true;
+			break;
+		case SETSU_EVENT_TOUCH_POSITION: {
+			munit_assert_ptr_equal(event->dev, test->dev);
+			uint64_t now_us = chiaki_time_now_monotonic_us();
+			if(!event->time_us || event->time_us > now_us)
+			{
+				test->time_valid = false;
+				break;
+			}
+			uint64_t latency_us = now_us - event->time_us;
+			test->latency_sum_us += latency_us;
+			if(latency_us > test->latency_max_us)
+				test->latency_max_us = latency_us;
+			test->positions++;
+			test->last_x = event->touch.x;
+			test->last_y = event->touch.y;
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+static void setsu_test_wait_dispatch(SetsuTest *test)
+{
+	chiaki_mutex_lock(&test->mutex);
+	while(!test->notified)
+		munit_assert_int(chiaki_cond_timedwait(&test->cond, &test->mutex, 1000), ==, CHIAKI_ERR_SUCCESS);
+	test->notified = false;
+	chiaki_mutex_unlock(&test->mutex);
+	setsu_dispatch(test->setsu, setsu_test_event, test);
+}
+
+static MunitResult test_thread(const MunitParameter params[], void *user)
+{
+	FakeTouchpad touchpad;
+	if(!fake_touchpad_init(&touchpad))
+		return MUNIT_SKIP;
+
+	SetsuTest test = { 0 };
+	test.time_valid = true;
+	chiaki_mutex_init(&test.mutex, false);
+	chiaki_cond_init(&test.cond);
+	test.setsu = setsu_new();
+	munit_assert_not_null(test.setsu);
+	test.dev = setsu_connect(test.setsu, touchpad.path, SETSU_DEVICE_TYPE_TOUCHPAD);
+	munit_assert_not_null(test.dev);
+	munit_assert_int(setsu_thread_start(test.setsu, setsu_test_notify, &test), ==, 0);
+
+	fake_touchpad_emit(&touchpad, EV_ABS, ABS_MT_SLOT, 0);
+	fake_touchpad_emit(&touchpad, EV_ABS, ABS_MT_TRACKING_ID, 1);
+	for(int i=0; i<FRAMES; i++)
+	{
+		// the kernel filters values that did not change, so never repeat one
+		fake_touchpad_emit(&touchpad, EV_ABS, ABS_MT_POSITION_X, i * 5 + 1);
+		fake_touchpad_emit(&touchpad, EV_ABS, ABS_MT_POSITION_Y, i * 3 + 1);
+		fake_touchpad_emit(&touchpad, EV_SYN, SYN_REPORT, 0);
+		// one frame at a time, every frame must arrive on its own
+		while(test.positions < (size_t)i + 1)
+			setsu_test_wait_dispatch(&test);
+		munit_assert_uint32(test.last_x, ==, (uint32_t)i * 5 + 1);
+		munit_assert_uint32(test.last_y, ==, (uint32_t)i * 3 + 1);
+	}
+	fake_touchpad_emit(&touchpad, EV_ABS, ABS_MT_TRACKING_ID, -1);
+	fake_touchpad_emit(&touchpad, EV_SYN, SYN_REPORT, 0);
+	while(!test.up)
+		setsu_test_wait_dispatch(&test);
+
+	munit_assert_true(test.down);
+	munit_assert_true(test.time_valid);
+	munit_assert_size(test.positions, ==, FRAMES);
+	munit_logf(MUNIT_LOG_INFO, "Event to callback latency avg %.1f us, max %llu us over %d frames",
+			(double)test.latency_sum_us / FRAMES, (unsigned long long)test.latency_max_us, FRAMES);
+
+	setsu_thread_stop(test.setsu);
+	setsu_free(test.setsu);
+	chiaki_cond_fini(&test.cond);
+	chiaki_mutex_fini(&test.mutex);
+	fake_touchpad_fini(&touchpad);
+	return MUNIT_OK;
+}
+
+static MunitResult test_burst(const MunitParameter params[], void *user)
+{
+	FakeTouchpad touchpad;
+	if(!fake_touchpad_init(&touchpad))
+		return MUNIT_SKIP;
+
+	SetsuTest test = { 0 };
+	test.time_valid = true;
+	chiaki_mutex_init(&test.mutex, false);
+	chiaki_cond_init(&test.cond);
+	test.setsu = setsu_new();
+	munit_assert_not_null(test.setsu);
+	test.dev = setsu_connect(test.setsu, touchpad.path, SETSU_DEVICE_TYPE_TOUCHPAD);
+	munit_assert_not_null(test.dev);
+	munit_assert_int(setsu_thread_start(test.setsu, setsu_test_notify, &test), ==, 0);
+
+	// frames written faster than they are dispatched are all kept, in order,
+	// bursts stay well below the kernel's buffer so nothing is dropped there
+	fake_touchpad_emit(&touchpad, EV_ABS, ABS_MT_SLOT, 0);
+	fake_touchpad_emit(&touchpad, EV_ABS, ABS_MT_TRACKING_ID, 1);
+	for(int i=0; i<FRAMES; i++)
+	{
+		fake_touchpad_emit(&touchpad, EV_ABS, ABS_MT_POSITION_X, i + 1);
+		fake_touchpad_emit(&touchpad, EV_SYN, SYN_REPORT, 0);
+		if((i + 1) % BURST_FRAMES)
+			continue;
+		while(test.positions < (size_t)i + 1)
+			setsu_test_wait_dispatch(&test);
+		munit_assert_uint32(test.last_x, ==, (uint32_t)i + 1);
+	}
+	munit_assert_size(test.positions, ==, FRAMES);
+	munit_assert_uint32(test.last_x, ==, FRAMES);
+	munit_assert_true(test.time_valid);
+
+	setsu_free(test.setsu);
+	chiaki_cond_fini(&test.cond);
+	chiaki_mutex_fini(&test.mutex);
+	fake_touchpad_fini(&touchpad);
+	return MUNIT_OK;
+}
+
+MunitTest tests_setsu[] = {
+	{
+		"/thread",
+		test_thread,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/burst",
+		test_burst,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,393 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/remote/stunclient.h>
+#include <chiaki/stoppipe.h>
+#include <chiaki/thread.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "test_log.h"
+
+#define FAKE_SERVERS_MAX 8
+#define MAPPED_ADDRESS "203.0.113.7"
+#define MAPPED_ADDRESS_OTHER "198.51.100.1"
+
+/**
+ * Local STUN responder with configurable delay and loss.
+ * The mapped port it reports stands in for a NAT's allocation for this destination.
+ */
+typedef struct fake_stun_server_t
+{
+	chiaki_socket_t sock;
+	ChiakiStopPipe *stop_pipe;
+	ChiakiThread thread;
+	char host[16];
+	uint16_t port;
+
+	uint64_t delay_ms;
+	unsigned int loss_percent;
+	uint32_t rng;
+	const char *mapped_address;
+	uint16_t mapped_port;
+} FakeStunServer;
+
+typedef struct fake_stun_env_t
+{
+	ChiakiStopPipe stop_pipe;
+	FakeStunServer servers[FAKE_SERVERS_MAX];
+	ChiakiStunServer server_list[FAKE_SERVERS_MAX];
+	size_t servers_count;
+	chiaki_socket_t client_sock;
+} FakeStunEnv;
+
+static bool fake_lost(FakeStunServer *server)
+{
+	server->rng = server->rng * 1664525u + 1013904223u;
+	return (server->rng >> 8) % 100 < server->loss_percent;
+}
+
+static void *fake_stun_server_thread(void *user)
+{
+	FakeStunServer *server = user;
+	while(chiaki_stop_pipe_select_single(server->stop_pipe, server->sock, false, UINT64_MAX) == CHIAKI_ERR_SUCCESS)
+	{
+		uint8_t req[512];
+		struct sockaddr_in from;
+		socklen_t from_len = sizeof(from);
+		CHIAKI_SSIZET_TYPE received = recvfrom(server->sock, (CHIAKI_SOCKET_BUF_TYPE)req, sizeof(req), 0, (struct sockaddr *)&from, &from_len);
+		if(received < 20 || req[0] != 0x00 || req[1] != 0x01)
+			continue;
+		if(fake_lost(server))
+			continue;
+		if(server->delay_ms && chiaki_stop_pipe_sleep(server->stop_pipe, server->delay_ms) == CHIAKI_ERR_CANCELED)
+			break;
+
+		uint8_t resp[32];
+		memset(resp, 0, sizeof(resp));
+		resp[0] = 0x01; resp[1] = 0x01; // binding response
+		resp[3] = 12; // one attribute
+		memcpy(resp + 4, req + 4, 16); // magic cookie and transaction id
+		resp[20] = 0x00; resp[21] = 0x20; // XOR-MAPPED-ADDRESS
+		resp[23] = 8;
+		resp[25] = 0x01; // IPv4
+		uint16_t xport = server->mapped_port ^ 0x2112;
+		resp[26] = (uint8_t)(xport >> 8);
+		resp[27] = (uint8_t)xport;
+		struct in_addr addr;
+		inet_pton(AF_INET, server->mapped_address, &addr);
+		uint8_t *a = (uint8_t *)&addr;
+		for(size_t i=0; i<4; i++)
+			resp[28 + i] = a[i] ^ resp[4 + i];
+		sendto(server->sock, (CHIAKI_SOCKET_BUF_TYPE)resp, sizeof(resp), 0, (struct sockaddr *)&from, from_len);
+	}
+	return NULL;
+}
+
+static chiaki_socket_t udp_socket_bind_local(uint16_t *port)
+{
+	chiaki_socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert_false(CHIAKI_SOCKET_IS_INVALID(sock));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	munit_assert_int(bind(sock, (struct sockaddr *)&addr, sizeof(addr)), ==, 0);
+	socklen_t addr_len = sizeof(addr);
+	munit_assert_int(getsockname(sock, (struct sockaddr *)&addr, &addr_len), ==, 0);
+	if(port)
+		*port = ntohs(addr.sin_port);
+	return sock;
+}
+
+static void fake_stun_env_init(FakeStunEnv *env, size_t count)
+{
+	munit_assert_size(count, <=, FAKE_SERVERS_MAX);
+	memset(env, 0, sizeof(*env));
+	munit_assert_int(chiaki_lib_init(), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_stop_pipe_init(&env->stop_pipe), ==, CHIAKI_ERR_SUCCESS);
+	env->servers_count = count;
+	for(size_t i=0; i<count; i++)
+	{
+		FakeStunServer *server = &env->servers[i];
+		server->sock = udp_socket_bind_local(&server->port);
+		server->stop_pipe = &env->stop_pipe;
+		server->rng = (uint32_t)(i + 1) * 2654435761u;
+		server->mapped_address = MAPPED_ADDRESS;
+		server->mapped_port = 40000;
+		snprintf(server->host, sizeof(server->host), "127.0.0.1");
+		env->server_list[i].host = server->host;
+		env->server_list[i].port = server->port;
+	}
+	env->client_sock = udp_socket_bind_local(NULL);
+}
+
+static void fake_stun_env_start(FakeStunEnv *env)
+{
+	for(size_t i=0; i<env->servers_count; i++)
+		munit_assert_int(chiaki_thread_create(&env->servers[i].thread, fake_stun_server_thread, &env->servers[i]), ==, CHIAKI_ERR_SUCCESS);
+}
+
+static void fake_stun_env_fini(FakeStunEnv *env)
+{
+	chiaki_stop_pipe_stop(&env->stop_pipe);
+	for(size_t i=0; i<env->servers_count; i++)
+	{
+		chiaki_thread_join(&env->servers[i].thread, NULL);
+		CHIAKI_SOCKET_CLOSE(env->servers[i].sock);
+	}
+	chiaki_stop_pipe_fini(&env->stop_pipe);
+	if(!CHIAKI_SOCKET_IS_INVALID(env->client_sock))
+		CHIAKI_SOCKET_CLOSE(env->client_sock);
+}
+
+static MunitResult test_dead_servers(const MunitParameter params[], void *user)
+{
+	// The first two servers in the list never answer. Queried one after another,
+	// each of them would cost a full timeout before the first live one is even asked.
+	FakeStunEnv env;
+	fake_stun_env_init(&env, 6);
+	env.servers[0].loss_percent = 100;
+	env.servers[1].loss_percent = 100;
+	for(size_t i=2; i<6; i++)
+		env.servers[i].delay_ms = 30 + i * 10;
+	fake_stun_env_start(&env);
+
+	ChiakiStunRaceParams race_params;
+	chiaki_stun_race_params_default(&race_params, true);
+	ChiakiStunRaceResult result;
+	ChiakiErrorCode err = chiaki_stun_race(get_test_log(), &env.client_sock, env.server_list, env.servers_count, &race_params, &result);
+	munit_logf(MUNIT_LOG_INFO, "time to address with 2 dead servers: %llums", (unsigned long long)result.elapsed_ms);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(result.responses_count, ==, 1);
+	munit_assert_string_equal(result.responses[0].address, MAPPED_ADDRESS);
+	munit_assert_uint16(result.responses[0].port, ==, 40000);
+	munit_assert_size(result.responses[0].server_index, >=, 2); // which live server goes first depends on lookup order
+	munit_assert_uint64(result.elapsed_ms, <, race_params.request_timeout_ms);
+
+	fake_stun_env_fini(&env);
+	return MUNIT_OK;
+}
+
+static MunitResult test_lossy_servers(const MunitParameter params[], void *user)
+{
+	// Every server drops half of the requests, retransmissions still get 4 answers well within the timeout.
+	FakeStunEnv env;
+	fake_stun_env_init(&env, 8);
+	for(size_t i=0; i<8; i++)
+	{
+		env.servers[i].loss_percent = 50;
+		env.servers[i].delay_ms = 10;
+	}
+	fake_stun_env_start(&env);
+
+	ChiakiStunRaceParams race_params;
+	chiaki_stun_race_params_default(&race_params, true);
+	race_params.responses_wanted = 4;
+	ChiakiStunRaceResult result;
+	ChiakiErrorCode err = chiaki_stun_race(get_test_log(), &env.client_sock, env.server_list, env.servers_count, &race_params, &result);
+	munit_logf(MUNIT_LOG_INFO, "time to 4 addresses with 50%% loss: %llums, %zu servers queried",
+			(unsigned long long)result.elapsed_ms, result.sent_count);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(result.responses_count, ==, 4);
+	munit_assert_uint64(result.elapsed_ms, <, race_params.timeout_ms);
+
+	fake_stun_env_fini(&env);
+	return MUNIT_OK;
+}
+
+static MunitResult test_all_dead(const MunitParameter params[], void *user)
+{
+	FakeStunEnv env;
+	fake_stun_env_init(&env, 3);
+	for(size_t i=0; i<3; i++)
+		env.servers[i].loss_percent = 100;
+	fake_stun_env_start(&env);
+
+	ChiakiStunRaceParams race_params;
+	chiaki_stun_race_params_default(&race_params, true);
+	race_params.request_timeout_ms = 300;
+	race_params.timeout_ms = 600;
+	ChiakiStunRaceResult result;
+	ChiakiErrorCode err = chiaki_stun_race(get_test_log(), &env.client_sock, env.server_list, env.servers_count, &race_params, &result);
+	munit_assert_int(err, ==, CHIAKI_ERR_TIMEOUT);
+	munit_assert_size(result.responses_count, ==, 0);
+	munit_assert_size(result.sent_count, ==, 3);
+	munit_assert_uint64(result.elapsed_ms, >=, 600);
+	munit_assert_uint64(result.elapsed_ms, <, 1000);
+
+	fake_stun_env_fini(&env);
+	return MUNIT_OK;
+}
+
+static MunitResult test_allocation(const MunitParameter params[], void *user)
+{
+	// NAT allocating a new port every 2 for each destination. With all servers in the first batch, requests go out
+	// in list order, so the n-th server sees port 40000 + 2n. The second server is dead, but its request still took a port.
+	FakeStunEnv env;
+	fake_stun_env_init(&env, 6);
+	for(size_t i=0; i<6; i++)
+	{
+		env.servers[i].mapped_port = (uint16_t)(40000 + 2 * i);
+		env.servers[i].delay_ms = 40 - i * 5; // answers arrive in reverse order
+	}
+	env.servers[1].loss_percent = 100;
+	fake_stun_env_start(&env);
+
+	ChiakiStunRaceParams race_params;
+	chiaki_stun_race_params_default(&race_params, true);
+	race_params.parallel = 6;
+	race_params.responses_wanted = 4;
+	race_params.request_timeout_ms = 300;
+	ChiakiStunRaceResult result;
+	ChiakiErrorCode err = chiaki_stun_race(get_test_log(), &env.client_sock, env.server_list, env.servers_count, &race_params, &result);
+	munit_logf(MUNIT_LOG_INFO, "time to allocation with 1 dead server: %llums", (unsigned long long)result.elapsed_ms);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	char address[CHIAKI_STUN_ADDRESS_SIZE];
+	uint16_t port = 0;
+	int32_t increment = -1;
+	bool random_allocation = false;
+	munit_assert_true(chiaki_stun_allocation_derive(get_test_log(), &result, address, &port, &increment, &random_allocation));
+	munit_assert_string_equal(address, MAPPED_ADDRESS);
+	munit_assert_int32(increment, ==, 2);
+	munit_assert_false(random_allocation);
+	munit_assert_uint16(port, ==, 40000 + 2 * (result.sent_count - 1));
+
+	fake_stun_env_fini(&env);
+	return MUNIT_OK;
+}
+
+static void result_add(ChiakiStunRaceResult *result, size_t send_index, const char *address, uint16_t port)
+{
+	ChiakiStunResponse *response = &result->responses[result->responses_count++];
+	response->server_index = send_index;
+	response->send_index = send_index;
+	snprintf(response->address, sizeof(response->address), "%s", address);
+	response->port = port;
+	if(send_index >= result->sent_count)
+		result->sent_count = send_index + 1;
+}
+
+static MunitResult test_allocation_derive(const MunitParameter params[], void *user)
+{
+	char address[CHIAKI_STUN_ADDRESS_SIZE];
+	uint16_t port;
+	int32_t increment;
+	bool random_allocation;
+	ChiakiStunRaceResult result;
+
+	memset(&result, 0, sizeof(result));
+	munit_assert_false(chiaki_stun_allocation_derive(get_test_log(), &result, address, &port, &increment, &random_allocation));
+
+	// endpoint independent mapping
+	memset(&result, 0, sizeof(result));
+	result_add(&result, 1, MAPPED_ADDRESS, 5000);
+	result_add(&result, 0, MAPPED_ADDRESS, 5000);
+	result_add(&result, 2, MAPPED_ADDRESS, 5000);
+	random_allocation = false;
+	munit_assert_true(chiaki_stun_allocation_derive(get_test_log(), &result, address, &port, &increment, &random_allocation));
+	munit_assert_int32(increment, ==, 0);
+	munit_assert_uint16(port, ==, 5000);
+	munit_assert_false(random_allocation);
+
+	// the odd address out is ignored, the missing allocation in between is accounted for
+	memset(&result, 0, sizeof(result));
+	result_add(&result, 0, MAPPED_ADDRESS, 6000);
+	result_add(&result, 1, MAPPED_ADDRESS_OTHER, 1234);
+	result_add(&result, 3, MAPPED_ADDRESS, 6003);
+	result_add(&result, 4, MAPPED_ADDRESS, 6004);
+	result.sent_count = 6;
+	random_allocation = false;
+	munit_assert_true(chiaki_stun_allocation_derive(get_test_log(), &result, address, &port, &increment, &random_allocation));
+	munit_assert_string_equal(address, MAPPED_ADDRESS);
+	munit_assert_int32(increment, ==, 1);
+	munit_assert_uint16(port, ==, 6005);
+	munit_assert_false(random_allocation);
+
+	// one outlier among consistent increments, e.g. another host grabbed a port in between
+	memset(&result, 0, sizeof(result));
+	result_add(&result, 0, MAPPED_ADDRESS, 7000);
+	result_add(&result, 1, MAPPED_ADDRESS, 7001);
+	result_add(&result, 2, MAPPED_ADDRESS, 7003);
+	result_add(&result, 3, MAPPED_ADDRESS, 7004);
+	random_allocation = false;
+	munit_assert_true(chiaki_stun_allocation_derive(get_test_log(), &result, address, &port, &increment, &random_allocation));
+	munit_assert_int32(increment, ==, 1);
+	munit_assert_false(random_allocation);
+
+	// no two increments agree
+	memset(&result, 0, sizeof(result));
+	result_add(&result, 0, MAPPED_ADDRESS, 8000);
+	result_add(&result, 1, MAPPED_ADDRESS, 8000);
+	result_add(&result, 2, MAPPED_ADDRESS, 8417);
+	result_add(&result, 3, MAPPED_ADDRESS, 8100);
+	random_allocation = false;
+	munit_assert_true(chiaki_stun_allocation_derive(get_test_log(), &result, address, &port, &increment, &random_allocation));
+	munit_assert_true(random_allocation);
+	munit_assert_int32(increment, ==, 417);
+	munit_assert_uint16(port, ==, 8100);
+
+	// single response
+	memset(&result, 0, sizeof(result));
+	result_add(&result, 2, MAPPED_ADDRESS, 9000);
+	munit_assert_true(chiaki_stun_allocation_derive(get_test_log(), &result, address, &port, &increment, &random_allocation));
+	munit_assert_int32(increment, ==, 0);
+	munit_assert_uint16(port, ==, 9000);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_stun_client[] = {
+	{
+		"/dead_servers",
+		test_dead_servers,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/lossy_servers",
+		test_lossy_servers,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/all_dead",
+		test_all_dead,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/allocation",
+		test_allocation,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/allocation_derive",
+		test_allocation_derive,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};